@@ -575,4 +575,55 @@ Return Value:
                     );
 } 
 
+//=============================================================================
+#pragma code_seg()
+_Use_decl_annotations_
+NTSTATUS
+EventHandler_Topology
+( 
+    PPCEVENT_REQUEST EventRequest 
+)
+/*++
+
+Routine Description:
+
+    Adds control change events of the topology nodes to the port event list.
+
+Arguments:
+
+    EventRequest - event request 
+
+Return Value:
+
+    NT status code
+
+--*/
+{
+    ASSERT(EventRequest);
+
+    DPF_ENTER(("[EventHandler_Topology]"));
+
+    switch (EventRequest->Verb)
+    {
+        case PCEVENT_VERB_ADD:
+            // MajorTarget is a pointer to miniport object for miniports.
+            //
+            ((PCMiniportTopology)
+            (EventRequest->MajorTarget))->AddEventToEventList
+                        (
+                            EventRequest->EventEntry
+                        );
+            break;
+
+        case PCEVENT_VERB_SUPPORT:
+        case PCEVENT_VERB_REMOVE:
+            break;
+
+        default:
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+} 
+
 
@@ -228,6 +228,40 @@ Return Value:
     }
     RtlCopyMemory(m_pWfExt, pWfEx, sizeof(WAVEFORMATEX) + pWfEx->cbSize);
 
+    //
+    // Select the sample conversion for the stream format. Each sample rate is played with
+    // its own PWM range, so no resampling is needed.
+    //
+    PWM_SAMPLE_FORMAT sampleFormat;
+    m_ulBytesPerSample = pWfEx->nBlockAlign / pWfEx->nChannels;
+    m_ulPwmRange = PWMRANGE_FOR_RATE(pWfEx->nSamplesPerSec);
+
+    if (pWfEx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT ||
+        (pWfEx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+         IsEqualGUIDAligned(m_pWfExt->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)))
+    {
+        sampleFormat = PwmSampleFormatFloat32;
+    }
+    else if (m_ulBytesPerSample == 2)
+    {
+        sampleFormat = PwmSampleFormatPcm16;
+    }
+    else if (m_ulBytesPerSample == 3)
+    {
+        sampleFormat = PwmSampleFormatPcm24;
+    }
+    else
+    {
+        sampleFormat = PwmSampleFormatPcm32;
+    }
+
+    PwmConvertInitialize(&m_PwmConvertState, sampleFormat, m_ulPwmRange, PWMCONVERT_DEFAULT_DITHER_MODE);
+    UpdateGain(FALSE);
+    PwmRateMatchInitialize(&m_PwmRateMatch, pWfEx->nSamplesPerSec, m_ulPwmRange);
+
+    DPF(D_TERSE, ("[CMiniportWaveRTStream::Init] %d Hz, %d bit, PWM range %d",
+        pWfEx->nSamplesPerSec, pWfEx->wBitsPerSample, m_ulPwmRange));
+
     //
     // Register this stream.
     //
@@ -387,7 +421,7 @@ Return Value:
         m_ulNotificationsPerBuffer = NotificationCount;
         m_ulDmaBufferSize = RequestedSize;
         m_ulBytesPerPacket = m_ulDmaBufferSize / m_ulNotificationsPerBuffer;
-        m_ulSamplesPerPacket = m_ulBytesPerPacket / PCMBYTESPERSAMPLE;
+        m_ulSamplesPerPacket = m_ulBytesPerPacket / m_ulBytesPerSample;
 
         *AudioBufferMdl = pBufferMdl;
         *ActualSize = RequestedSize;
@@ -670,7 +704,9 @@ CMiniportWaveRTStream::GetHWLatency
 
 Routine Description:
 
-    Provides info on the latency introduced by the hardware.
+    Provides info on the latency introduced by the hardware. Once the PWM is initialized, the FIFO size
+    covers the packets the PWM driver keeps queued for DMA, which depends on the audio profile and on the
+    current adaptive queue depth of the low latency profile.
 
 Arguments:
 
@@ -689,6 +725,13 @@ Return Value:
     Latency->ChipsetDelay = 0;
     Latency->CodecDelay = 0;
     Latency->FifoSize = 32;
+
+    if (m_PwmInitialized && m_PwmAudioConfig.DmaRing)
+    {
+        Latency->FifoSize = (m_PwmAudioConfig.DmaRing->QueueDepth + 1) * m_ulBytesPerPacket;
+    }
+
+    DPF(D_TERSE, ("[CMiniportWaveRTStream::GetHWLatency] FIFO size: %d bytes", Latency->FifoSize));
 }
 
 //=============================================================================
@@ -790,6 +833,8 @@ CMiniportWaveRTStream::GetPosition
 Routine Description:
 
     Returns the current stream playback/recording position as byte offset from the beginning of the buffer.
+    The play position is read live from the PWM DMA channel, the write position is the end of the last
+    packet transferred to DMA.
 
 Arguments:
 
@@ -801,18 +846,33 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(Position);
+    ASSERT(Position);
 
-    DPF(D_TERSE, ("[CMiniportWaveRTStream::GetPosition] Not supported"));
+    ULONGLONG ullPlayPosition;
+    LARGE_INTEGER qpcTime;
 
-    return STATUS_NOT_IMPLEMENTED;
+    if (m_ulDmaBufferSize == 0)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    if (!NT_SUCCESS(GetDmaPosition(&ullPlayPosition, &qpcTime)))
+    {
+        ullPlayPosition = m_ullPlayPosition;
+    }
+
+    Position->PlayOffset = ullPlayPosition % m_ulDmaBufferSize;
+    Position->WriteOffset = ((ULONGLONG)m_ulPacketsTransferred * m_ulBytesPerPacket) % m_ulDmaBufferSize;
+
+    DPF(D_BLAB, ("[CMiniportWaveRTStream::GetPosition] PlayOffset: %I64u, WriteOffset: %I64u", Position->PlayOffset, Position->WriteOffset));
+    return STATUS_SUCCESS;
 }
 
 #pragma code_seg()
 VOID
 CMiniportWaveRTStream::ConvertPCMToPWM
 (
-    _In_reads_(SampleCount)       PINT16  InBuffer,
+    _In_                          PVOID   InBuffer,
     _Out_writes_all_(SampleCount) PUINT32 OutBuffer,
     _In_                          DWORD   SampleCount
 )
@@ -820,12 +880,14 @@ CMiniportWaveRTStream::ConvertPCMToPWM
 
 Routine Description:
 
-    Converts 16 bit audio samples with 16-bit valid audio data from the audio stack to 32 bit PWM samples with 11 bit valid audio data.
+    Converts audio samples in the stream format from the audio stack to 32 bit PWM samples with 11 to 12 bit valid audio data.
     Input buffer is the audio buffer filled by the audio stack, output buffer is the DMA buffer used by the PWM driver.
+    The samples are requantized according to the dither mode of the stream.
+    Once a mute has ramped down, silence is written without converting the samples.
 
 Arguments:
 
-    InBuffer - 16 bit sample input buffer
+    InBuffer - sample input buffer in the stream format
 
     OutBuffer - 32 bit sample output buffer
 
@@ -837,9 +899,13 @@ Return Value:
 
 --*/
 {
-    while (SampleCount--)
+    if (PwmConvertIsMuted(&m_PwmConvertState))
     {
-        *OutBuffer++ = (*InBuffer++ / PCMTOPWMDIV) + PWMSILENCE;
+        PwmConvertSilence(&m_PwmConvertState, OutBuffer, SampleCount);
+    }
+    else
+    {
+        PwmConvert(&m_PwmConvertState, InBuffer, OutBuffer, SampleCount);
     }
 }
 
@@ -869,10 +935,48 @@ Return Value:
 
 --*/
 {
-    while (SampleCount--)
+    PwmConvertSilence(&m_PwmConvertState, OutBuffer, SampleCount);
+}
+
+#pragma code_seg()
+VOID
+CMiniportWaveRTStream::UpdateGain
+(
+    _In_ BOOLEAN Ramp
+)
+/*++
+
+Routine Description:
+
+    Passes the volume and mute state of the topology nodes to the gain stage of the PCM to PWM conversion.
+    Called before each packet is converted, changes are ramped in by the conversion.
+
+Arguments:
+
+    Ramp - FALSE to apply the gain immediately
+
+Return Value:
+
+    None
+
+--*/
+{
+    PADAPTERCOMMON  pAdapterComm = m_pMiniport->GetAdapterCommObj();
+    LONG            gain[PWMCONVERT_CHANNELS];
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
     {
-        *OutBuffer++ = PWMSILENCE;
+        if (pAdapterComm->MixerMuteRead(channel))
+        {
+            gain[channel] = 0;
+        }
+        else
+        {
+            gain[channel] = PwmConvertVolumeToGain(pAdapterComm->MixerVolumeRead(channel));
+        }
     }
+
+    PwmConvertSetGain(&m_PwmConvertState, gain, Ramp);
 }
 
 #pragma code_seg()
@@ -916,20 +1020,23 @@ Return Value:
 #pragma code_seg()
 _Use_decl_annotations_
 VOID
-CMiniportWaveRTStream::AddPacketToDma
+CMiniportWaveRTStream::SetPacketDropCount
 (
-    ULONG PacketNumber
+    ULONG PacketNumber,
+    ULONG DropCount
 )
 /*++
 
 Routine Description:
 
-    This function adds a packet for processing by the DMA controller. This uses data provided by the PWM driver
-    during the buffer configuration allocation call and saves calling into the PWM driver each time.
+    This function sets the length of the first chunk of a packet before the packet is linked. The packet is not
+    processed by the DMA controller at this point, so it is safe to change its control block.
 
 Arguments:
 
-    PacketNumber - Number of the packet to add to the DMA processing
+    PacketNumber - Number of the packet
+
+    DropCount - Number of frames at the end of the first chunk of the packet the DMA controller skips
 
 Return Value:
 
@@ -939,22 +1046,70 @@ Return Value:
 {
     ULONG packetIndex = PacketNumber%m_PwmAudioConfig.DmaNumPackets;
 
+    *((ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LengthPtr)) =
+        m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LengthValue - DropCount * PWMBYTESPERSAMPLE * PWMCONVERT_CHANNELS;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+CMiniportWaveRTStream::AddPacketsToDma
+(
+    ULONG PacketNumber,
+    ULONG PacketCount
+)
+/*++
+
+Routine Description:
+
+    This function adds a batch of consecutive packets for processing by the DMA controller. This uses data provided
+    by the PWM driver during the buffer configuration allocation call and saves calling into the PWM driver each time.
+
+    The packets are linked back to front, so only the link of the first packet makes the batch reachable by the DMA
+    controller, and the batch is published to the PWM driver with a single update of the ring producer index.
+
+Arguments:
+
+    PacketNumber - Number of the first packet to add to the DMA processing
+
+    PacketCount - Number of packets to add
+
+Return Value:
+
+    None
+
+--*/
+{
+    PBCM_PWM_AUDIO_RING ring = m_PwmAudioConfig.DmaRing;
+
+    ASSERT(PacketCount > 0 && PacketCount <= m_PwmAudioConfig.DmaNumPackets);
+
     //
-    // Link the packet into the DMA controllers control block list, by establishing the link to the previous packet.
+    // Link the packets into the DMA controllers control block list, by establishing the link to the previous packet.
     //
-    // The dmaPacketLinkInfo resides in non cached memory, which could not be used with InterlockedExchange.
-    // Since the linkPtr points to the NEXTCONBK field of a DMA control block, the pointer points to a 32 bit
-    // aligned memory location and the access is atomic by default.
+    // The link pointers point to the NEXTCONBK field of a DMA control block in non cached memory, which is a 32 bit
+    // aligned memory location, the access is atomic by default. The memory barrier makes the lengths and the links
+    // inside the batch visible to the DMA controller before the batch is linked to the running list.
     //
 
-    ASSERT((ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkPtr));
-    *((ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkPtr)) = m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkValue;
+    for (ULONG ul = PacketCount; ul > 0; ul--)
+    {
+        ULONG packetIndex = (PacketNumber + ul - 1) % m_PwmAudioConfig.DmaNumPackets;
+
+        if (ul == 1)
+        {
+            KeMemoryBarrier();
+        }
+
+        ASSERT((ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkPtr));
+        *((ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkPtr)) = m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkValue;
+    }
 
     //
-    // One more packet in the DMA controllers list to process.
+    // Publish the packets to the PWM driver, after the links.
     //
 
-    InterlockedIncrement((LONG*)m_PwmAudioConfig.DmaPacketsInUse);
+    WriteULongRelease(&ring->ProducerIndex, ring->ProducerIndex + PacketCount);
 }
 
 
@@ -1013,7 +1168,7 @@ Return Value:
     }
     else
     {
-        sampleCount = EosPacketLength / PCMBYTESPERSAMPLE;
+        sampleCount = EosPacketLength / m_ulBytesPerSample;
         ASSERT(m_ulSamplesPerPacket >= sampleCount);
     }
 
@@ -1022,10 +1177,12 @@ Return Value:
     //
     if (m_pMiniport->m_PwmDevice && m_KsState == KSSTATE_RUN)
     {
+        PBCM_PWM_AUDIO_RING ring = m_PwmAudioConfig.DmaRing;
+
         //
         // Process restart request.
         //
-        if (m_RestartInProgress == FALSE && *m_PwmAudioConfig.DmaRestartRequired == TRUE)
+        if (m_RestartInProgress == FALSE && ReadULongAcquire(&ring->RestartRequestCount) != ring->RestartAckCount)
         {
             DPF(D_TERSE, ("[CMiniportWaveRTStream::SetWritePacket] Restart required at packet %d after %d packets. Last SetWritePacket call %d msec ago.",
                 orgPacketNumber, (orgPacketNumber - m_RestartPacketNumber), (ULONG)((currentTime.QuadPart - m_LastSetWritePacket.QuadPart) / (double)m_PerformanceCounterFrequency.QuadPart * 1000.0)));
@@ -1035,13 +1192,15 @@ Return Value:
             m_RestartInProgress = TRUE;
 
             //
-            // Unlink all packets.
+            // Unlink all packets and drop them from the ring. DMA is stopped, the PWM driver does not retire packets
+            // until the restart.
             //
             for (ULONG packetIndex = 0; packetIndex < m_PwmAudioConfig.DmaNumPackets; packetIndex++)
             {
                 *(ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkPtr) = 0;
             }
-            InterlockedExchange((LONG*)m_PwmAudioConfig.DmaPacketsInUse, 0);
+            WriteULongRelease(&ring->ProducerIndex, ReadULongAcquire(&ring->ConsumerIndex));
+            PwmConvertReset(&m_PwmConvertState);
 
             // Spew an event for a glitch event
             // Event type: eMINIPORT_GLITCH_REPORT
@@ -1070,7 +1229,7 @@ Return Value:
         //
         // Check if there is enough space in the PWM packet buffer.
         //
-        if (*m_PwmAudioConfig.DmaPacketsInUse == m_PwmAudioConfig.DmaNumPackets)
+        if (ring->ProducerIndex - ReadULongAcquire(&ring->ConsumerIndex) == m_PwmAudioConfig.DmaNumPackets)
         {
             return STATUS_DATA_OVERRUN;
         }
@@ -1091,37 +1250,56 @@ Return Value:
             {
                 dmaPacketBaseIndex = (packetIndex % m_PwmAudioConfig.DmaNumPackets) * m_ulSamplesPerPacket;
                 SilenceToPWM((PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex, m_ulSamplesPerPacket);
-                AddPacketToDma(packetIndex);
+                SetPacketDropCount(packetIndex, 0);
                 packetIndex++;
             }
+            if (packetIndex)
+            {
+                AddPacketsToDma(0, packetIndex);
+            }
 
             //
-            // Set initial priming.
+            // Set initial priming, limited to the queue depth of the audio profile. This replaces the outstanding
+            // prime requests of the PWM driver.
             //
-            InterlockedExchange((LONG*)m_PwmAudioConfig.DmaPacketsToPrime, m_PwmAudioConfig.DmaNumPackets / 2);
+            WriteULongRelease(&ring->PrimeAckIndex,
+                ReadULongAcquire(&ring->PrimeRequestIndex) - min(ring->QueueDepth, m_PwmAudioConfig.DmaNumPackets / 2));
         }
 
-        packetBaseIndex = (orgPacketNumber % m_ulNotificationsPerBuffer) * m_ulSamplesPerPacket;
+        packetBaseIndex = (orgPacketNumber % m_ulNotificationsPerBuffer) * m_ulBytesPerPacket;
         dmaPacketBaseIndex = (PacketNumber % m_PwmAudioConfig.DmaNumPackets) * m_ulSamplesPerPacket;
 
-        ConvertPCMToPWM((PINT16)m_DataBuffer + packetBaseIndex, (PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex, sampleCount);
+        UpdateGain(TRUE);
+        ConvertPCMToPWM(m_DataBuffer + packetBaseIndex, (PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex, sampleCount);
 
         if ((Flags & KSSTREAM_HEADER_OPTIONSF_ENDOFSTREAM) &&
             (m_ulSamplesPerPacket > sampleCount))
         {
             SilenceToPWM((PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex + sampleCount, m_ulSamplesPerPacket - sampleCount);
         }
-        AddPacketToDma(PacketNumber);
+
+        //
+        // Correct the drift between the stream sample rate and the slightly slower PWM sample rate by dropping
+        // frames at the end of the first chunk of the packet. Drops are spread over the packets at the exact
+        // rate difference, and the packet is resampled to the PWM rate, which spreads each drop over the frames.
+        //
+        ULONG chunkFrameCount = m_PwmAudioConfig.DmaPacketLinkInfo[PacketNumber % m_PwmAudioConfig.DmaNumPackets].LengthValue / (PWMBYTESPERSAMPLE * PWMCONVERT_CHANNELS);
+        ULONG dropCount = PwmRateMatchAdvance(&m_PwmRateMatch, m_ulSamplesPerPacket / PWMCONVERT_CHANNELS, chunkFrameCount / 2);
+        PwmRateMatchInterpolate(&m_PwmRateMatch, (PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex,
+            m_ulSamplesPerPacket / PWMCONVERT_CHANNELS, chunkFrameCount, dropCount);
+
+        SetPacketDropCount(PacketNumber, dropCount);
+        AddPacketsToDma(PacketNumber, 1);
         m_ulPacketsTransferred++;
 
-        ULONG packetsToPrime = InterlockedExchange((LONG*)m_PwmAudioConfig.DmaPacketsToPrime, *((LONG*)m_PwmAudioConfig.DmaPacketsToPrime));
-        if (packetsToPrime)
+        //
+        // Ask the audio stack for the packets requested by the PWM driver.
+        //
+        ULONG primeRequestIndex = ReadULongAcquire(&ring->PrimeRequestIndex);
+        while (ring->PrimeAckIndex != primeRequestIndex)
         {
-            for (ULONG ul = 0; ul < packetsToPrime; ul++)
-            {
-                InterlockedDecrement((LONG*)m_PwmAudioConfig.DmaPacketsToPrime);
-                RequestNextPacket();
-            }
+            WriteULongRelease(&ring->PrimeAckIndex, ring->PrimeAckIndex + 1);
+            RequestNextPacket();
         }
 
         if (m_PwmState != KSSTATE_RUN)
@@ -1133,7 +1311,7 @@ Return Value:
             if (m_RestartInProgress)
             {
                 m_RestartInProgress = FALSE;
-                InterlockedExchange((PLONG)m_PwmAudioConfig.DmaRestartRequired, (LONG)FALSE);
+                WriteULongRelease(&ring->RestartAckCount, ReadULongAcquire(&ring->RestartRequestCount));
             }
 
             //
@@ -1181,8 +1359,11 @@ Return Value:
 
     LARGE_INTEGER timeStamp;
     ULONGLONG ullLinearPosition = { 0 };
-    ullLinearPosition = m_ullPlayPosition;
-    timeStamp = m_PlayQpcTime;
+    if (!NT_SUCCESS(GetDmaPosition(&ullLinearPosition, &timeStamp)))
+    {
+        ullLinearPosition = m_ullPlayPosition;
+        timeStamp = m_PlayQpcTime;
+    }
 
     PresentationPosition->u64PositionInBlocks = ullLinearPosition * m_pWfExt->Format.nSamplesPerSec / m_pWfExt->Format.nAvgBytesPerSec;
     PresentationPosition->u64QPCPosition = (UINT64)timeStamp.QuadPart;
@@ -1365,11 +1546,15 @@ Return Value:
             if (m_ulPacketsTransferred)
             {
                 DPF(D_TERSE, ("[CMiniportWaveRTStream::SetState] Packets transferred: %d", m_ulPacketsTransferred));
+                DPF(D_TERSE, ("[CMiniportWaveRTStream::SetState] Frames: %I64u, dropped: %I64u, phase error: %d ppm of a frame",
+                    m_PwmRateMatch.FramesIn, m_PwmRateMatch.FramesDropped, PwmRateMatchPhasePpm(&m_PwmRateMatch)));
             }
 
             // Reset DMA
             m_ullPlayPosition = 0;
             m_ulPacketsTransferred = 0;
+            PwmConvertReset(&m_PwmConvertState);
+            PwmRateMatchReset(&m_PwmRateMatch);
 
             //
             // Stop PWM
@@ -1480,9 +1665,11 @@ Return Value:
                     BCM_PWM_AUDIO_CONFIG audioConfig;
 
                     RtlZeroMemory(&audioConfig, sizeof(BCM_PWM_AUDIO_CONFIG));
-                    audioConfig.RequestedBufferSize = m_ulDmaBufferSize * 2;
+                    audioConfig.RequestedBufferSize = m_ulSamplesPerPacket * PWMBYTESPERSAMPLE * m_ulNotificationsPerBuffer;
                     audioConfig.NotificationsPerBuffer = m_ulNotificationsPerBuffer;
-                    audioConfig.PwmRange = PWMRANGE;
+                    audioConfig.PwmRange = m_ulPwmRange;
+                    audioConfig.SampleRate = m_pWfExt->Format.nSamplesPerSec;
+                    audioConfig.Profile = gPwmAudioProfile;
                     ntStatus = PwmIoctlCall(IOCTL_BCM_PWM_INITIALIZE_AUDIO, &audioConfig, sizeof(BCM_PWM_AUDIO_CONFIG), &m_PwmAudioConfig, sizeof(BCM_PWM_AUDIO_CONFIG));
                     if (!NT_SUCCESS(ntStatus))
                     {
@@ -1490,10 +1677,26 @@ Return Value:
                         return ntStatus;
                     }
 
+                    //
+                    // Check the version of the shared ring.
+                    //
+                    if (m_PwmAudioConfig.DmaRing == NULL ||
+                        m_PwmAudioConfig.DmaRing->Version != BCM_PWM_AUDIO_RING_VERSION ||
+                        m_PwmAudioConfig.DmaRing->Size < sizeof(BCM_PWM_AUDIO_RING) ||
+                        m_PwmAudioConfig.DmaRing->NumPackets != m_PwmAudioConfig.DmaNumPackets)
+                    {
+                        DPF(D_ERROR, ("[CMiniportWaveRTStream::SetState] Unsupported PWM audio ring version (%d)",
+                            m_PwmAudioConfig.DmaRing ? m_PwmAudioConfig.DmaRing->Version : 0));
+                        return STATUS_REVISION_MISMATCH;
+                    }
+
                     //
                     // Sanity check sample width.
                     //
-                    ASSERT(PCMBYTESPERSAMPLE == m_pWfExt->Format.wBitsPerSample / 8);
+                    ASSERT(m_ulBytesPerSample == m_pWfExt->Format.wBitsPerSample / 8);
+
+                    DPF(D_TERSE, ("[CMiniportWaveRTStream::SetState] Profile %d, %d DMA packets of %d samples, queue depth %d packets",
+                        gPwmAudioProfile, m_PwmAudioConfig.DmaNumPackets, m_ulSamplesPerPacket, m_PwmAudioConfig.DmaRing->QueueDepth));
 
                     m_PwmInitialized = TRUE;
                 }
@@ -1564,7 +1767,58 @@ Return Value:
     DPF_ENTER(("[CMiniportWaveRTStream::UpdatePosition]"));
     if (m_PwmState == KSSTATE_RUN)
     {
-        m_ullPlayPosition = *m_PwmAudioConfig.DmaPacketsProcessed * m_ulBytesPerPacket;
-        m_PlayQpcTime = *m_PwmAudioConfig.DmaLastProcessedPacketTime;
+        GetDmaPosition(&m_ullPlayPosition, &m_PlayQpcTime);
+    }
+}
+
+//=============================================================================
+#pragma code_seg()
+NTSTATUS
+CMiniportWaveRTStream::GetDmaPosition
+(
+    ULONGLONG       *PlayPosition,
+    LARGE_INTEGER   *QpcTime
+)
+/*++
+
+Routine Description:
+
+    Reads the live playback position from the PWM driver. The position is derived from the DMA channel
+    registers and correlated with the performance counter, so it advances within a packet.
+
+Arguments:
+
+    PlayPosition - receives the linear play position in bytes of the audio buffer
+
+    QpcTime - receives the performance counter value of the position
+
+Return Value:
+
+    NT status code, STATUS_DEVICE_NOT_READY if PWM DMA is not running or paused
+
+--*/
+{
+    PBCM_PWM_AUDIO_RING ring = m_PwmAudioConfig.DmaRing;
+
+    *PlayPosition = 0;
+    QpcTime->QuadPart = 0;
+
+    if (!m_pMiniport->m_PwmDevice || m_PwmState == KSSTATE_STOP || ring == NULL)
+    {
+        return STATUS_DEVICE_NOT_READY;
     }
+
+    BCM_PWM_AUDIO_POSITION dmaPosition;
+    ring->GetPosition(ring->GetPositionContext, &dmaPosition);
+
+    //
+    // Convert the PWM bytes of the current packet into whole frames of the audio buffer.
+    //
+    ULONG framesPlayed = dmaPosition.PacketBytesPlayed / (PWMBYTESPERSAMPLE * PWMCONVERT_CHANNELS);
+    ULONG packetBytesPlayed = min(framesPlayed * PWMCONVERT_CHANNELS * m_ulBytesPerSample, m_ulBytesPerPacket);
+
+    *PlayPosition = (ULONGLONG)dmaPosition.PacketsPlayed * m_ulBytesPerPacket + packetBytesPlayed;
+    *QpcTime = dmaPosition.PerformanceCounter;
+
+    return STATUS_SUCCESS;
 }
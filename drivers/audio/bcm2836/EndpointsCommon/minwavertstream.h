@@ -9,18 +9,7 @@ Abstract:
 
 #pragma once
 
-//
-// These have to be constants to get the performance of the conversion good enough.
-// Using static const members will make the audio quality unusable.
-//
-
-#define PWMRANGE  2268
-#define PCMRANGE 0x10000
-#define PCMTOPWMDIV ((PCMRANGE / PWMRANGE) + 1)
-#define PWMSILENCE  (PWMRANGE / 2)
-#define PCMBYTESPERSAMPLE  2
-#define PCMFREQ 44100
-#define PWMFREQ 100000000
+#include "pwmconvert.h"
 
 //=============================================================================
 // Referenced Forward
@@ -82,6 +71,10 @@ protected:
     ULONG                       m_ulNotificationsPerBuffer;
     LARGE_INTEGER               m_LastSetWritePacket;
     LARGE_INTEGER               m_PerformanceCounterFrequency;
+    PWM_CONVERT_STATE           m_PwmConvertState;
+    PWM_RATE_MATCH              m_PwmRateMatch;
+    ULONG                       m_ulBytesPerSample;
+    ULONG                       m_ulPwmRange;
 
     ULONG                       m_ulSamplesPerPacket;
     ULONG                       m_ulPacketsTransferred;
@@ -118,6 +111,12 @@ private:
         VOID
     );
 
+    NTSTATUS GetDmaPosition
+    (
+        _Out_ ULONGLONG     *PlayPosition,
+        _Out_ LARGE_INTEGER *QpcTime
+    );
+
     NTSTATUS PwmIoctlCall
     (
         _In_                                ULONG   IoctlCode,
@@ -129,7 +128,7 @@ private:
 
     VOID ConvertPCMToPWM
     (
-        _In_reads_(SampleCount)         PINT16  InBuffer,
+        _In_                            PVOID   InBuffer,
         _Out_writes_all_(SampleCount)   PUINT32 OutBuffer,
         _In_                            DWORD   SampleCount
     );
@@ -140,9 +139,21 @@ private:
         _In_                            DWORD   SampleCount
     );
 
-    VOID AddPacketToDma
+    VOID UpdateGain
+    (
+        _In_ BOOLEAN Ramp
+    );
+
+    VOID SetPacketDropCount
+    (
+        _In_ ULONG PacketNumber,
+        _In_ ULONG DropCount
+    );
+
+    VOID AddPacketsToDma
     (
-        _In_ ULONG PacketNumber
+        _In_ ULONG PacketNumber,
+        _In_ ULONG PacketCount
     );
 
     VOID RequestNextPacket
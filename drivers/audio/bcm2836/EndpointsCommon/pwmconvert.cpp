@@ -0,0 +1,1065 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Implementation of the PCM to PWM sample conversion.
+
+    A 16 bit PCM sample is scaled to the PWM range by a multiplication with
+    the stream PWM range, which leaves a fixed point value with 16 fractional
+    bits in PWM LSB units. Samples of the wider formats are first normalized
+    to a signed 32 bit fraction, and scaled the same way. The value is multiplied
+    by the channel gain, optionally dithered and noise shaped, and rounded to the
+    nearest PWM value.
+
+    PwmConvertReference is the portable scalar implementation and defines
+    the expected output for every format and mode. PwmConvert uses NEON for
+    16 bit samples in the modes without noise shaping, and must produce bit
+    exact the same output. Gain ramps are always converted by the scalar code.
+
+--*/
+
+#include <rpiwav.h>
+#include "pwmconvert.h"
+
+#if defined(_M_ARM64)
+#include <arm64_neon.h>
+#define PWMCONVERT_NEON
+#elif defined(_M_ARM)
+#include <arm_neon.h>
+#define PWMCONVERT_NEON
+#endif
+
+//
+// Limit of the fed back requantization error, keeps the noise shaping loop
+// stable when the output clips.
+//
+
+#define PWMCONVERT_ERROR_LIMIT  (2 << 16)
+
+//
+// Converts the rate matching phase within a PWM frame, less than PWMFREQ, to
+// the Q16 interpolation weight of the later stream frame.
+//
+
+#define PWMRATEMATCH_WEIGHT_SCALE   ((1ULL << 48) / PWMFREQ)
+
+//
+// Initial dither generator states, any non zero value is valid.
+//
+
+static const UINT32 PwmConvertRandomSeed[PWMCONVERT_LANES] =
+{
+    0x2545F491, 0x9E3779B9, 0x7F4A7C15, 0x6A09E667
+};
+
+//
+// Q31 gains of 0 dB to -19.5 dB in PWMCONVERT_VOLUME_STEP steps. Each further
+// 20 dB divide the gain by 10.
+//
+
+#define PWMCONVERT_GAIN_TABLE_DB    20
+
+static const LONG PwmConvertGainTable[PWMCONVERT_GAIN_TABLE_DB * 0x10000 / PWMCONVERT_VOLUME_STEP] =
+{
+    0x7FFFFFFF, 0x78D6FC9F, 0x721482C0, 0x6BB2D604,
+    0x65AC8C2F, 0x5FFC8890, 0x5A9DF7AC, 0x558C4B22,
+    0x50C335D4, 0x4C3EA839, 0x47FACCF0, 0x43F4057F,
+    0x4026E73D, 0x3C903870, 0x392CED8E, 0x35FA26AA,
+    0x32F52CFF, 0x301B70A8, 0x2D6A866F, 0x2AE025C3,
+    0x287A26C5, 0x26368074, 0x241346F6, 0x220EA9F4,
+    0x2026F310, 0x1E5A8472, 0x1CA7D768, 0x1B0D7B1B,
+    0x198A1357, 0x181C5762, 0x16C310E3, 0x157D1AE2,
+    0x144960C5, 0x1326DD71, 0x12149A60, 0x1111AEDB,
+    0x101D3F2E, 0x0F367BEE, 0x0E5CA14C, 0x0D8EF66D
+};
+
+#pragma code_seg()
+static __forceinline UINT32
+PwmConvertNextRandom
+(
+    _Inout_ UINT32* Random
+)
+{
+    UINT32 random = *Random;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    *Random = random;
+    return random;
+}
+
+#pragma code_seg()
+static __forceinline LONG
+PwmConvertTpdfDither
+(
+    _In_ UINT32 Random
+)
+{
+    //
+    // The sum of two independent uniformly distributed 16 bit values has a
+    // triangular distribution. Centered it spans +/-1 PWM LSB.
+    //
+
+    return (LONG)(Random & 0xFFFF) + (LONG)(Random >> 16) - 0x10000;
+}
+
+#pragma code_seg()
+static __forceinline LONG
+PwmConvertFloatToFraction
+(
+    _In_ UINT32 Float
+)
+{
+    //
+    // Integer only decode of an IEEE single precision sample to a signed
+    // 32 bit fraction, so no floating point state has to be saved.
+    // The mantissa with the implicit bit set is a 24 bit integer, and
+    // the fraction is mantissa * 2^(exponent - 119).
+    //
+
+    LONG exponent = (LONG)((Float >> 23) & 0xFF);
+    LONG shift = exponent - 119;
+    LONG fraction;
+
+    if (shift >= 8)
+    {
+        //
+        // +/-1.0 and above, infinity and NaN saturate.
+        //
+
+        fraction = MAXLONG;
+    }
+    else if (shift <= -24)
+    {
+        fraction = 0;
+    }
+    else
+    {
+        ULONG mantissa = (Float & 0x7FFFFF) | 0x800000;
+        fraction = (LONG)((shift >= 0) ? (mantissa << shift) : (mantissa >> -shift));
+    }
+
+    return (Float & 0x80000000) ? -fraction : fraction;
+}
+
+#pragma code_seg()
+static __forceinline LONG
+PwmConvertLoadSample
+(
+    _In_ PWM_SAMPLE_FORMAT  SampleFormat,
+    _In_ LONG               Range,
+    _In_ const UCHAR*       InBuffer,
+    _In_ ULONG              Sample
+)
+{
+    //
+    // Returns the sample scaled to the PWM range, in 1/65536 PWM LSB.
+    //
+
+    LONG fraction;
+
+    switch (SampleFormat)
+    {
+    case PwmSampleFormatPcm16:
+        return (LONG)((const INT16*)InBuffer)[Sample] * Range;
+
+    case PwmSampleFormatPcm24:
+        InBuffer += Sample * 3;
+        fraction = (LONG)(((ULONG)InBuffer[0] << 8) | ((ULONG)InBuffer[1] << 16) | ((ULONG)InBuffer[2] << 24));
+        break;
+
+    case PwmSampleFormatPcm32:
+        fraction = ((const LONG*)InBuffer)[Sample];
+        break;
+
+    default:
+        fraction = PwmConvertFloatToFraction(((const UINT32*)InBuffer)[Sample]);
+        break;
+    }
+
+    return (LONG)(((LONGLONG)fraction * Range) >> 16);
+}
+
+#pragma code_seg()
+static __forceinline LONG
+PwmConvertApplyGain
+(
+    _In_ LONG Value,
+    _In_ LONG Gain
+)
+{
+    //
+    // Matches the NEON saturating doubling multiply high, which is exact for
+    // non negative gains.
+    //
+
+    if (Gain == PWMCONVERT_GAIN_UNITY)
+    {
+        return Value;
+    }
+
+    return (LONG)(((LONGLONG)Value * Gain) >> 31);
+}
+
+#pragma code_seg()
+static __forceinline VOID
+PwmConvertAdvanceGainRamp
+(
+    _Inout_ PPWM_CONVERT_STATE State
+)
+{
+    //
+    // Called after each frame of a ramp. The last frame lands exactly on the
+    // target, which leaves no rounding residue of the step.
+    //
+
+    State->GainRampFrames--;
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+    {
+        State->Gain[channel] = State->GainRampFrames ?
+            State->Gain[channel] + State->GainStep[channel] :
+            State->TargetGain[channel];
+    }
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmConvertInitialize
+(
+    PPWM_CONVERT_STATE  State,
+    PWM_SAMPLE_FORMAT   SampleFormat,
+    ULONG               PwmRange,
+    PWM_DITHER_MODE     DitherMode
+)
+/*++
+
+Routine Description:
+
+    Initializes the conversion state.
+
+Arguments:
+
+    State - conversion state to initialize
+
+    SampleFormat - format of the PCM input samples
+
+    PwmRange - PWM range of the stream, full scale output value
+
+    DitherMode - requantization mode to use
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(SampleFormat < PwmSampleFormatCount);
+    ASSERT(DitherMode < PwmDitherModeCount);
+
+    //
+    // The 16 bit sample scaling and the NEON conversion rely on the range
+    // fitting in 15 bits.
+    //
+
+    ASSERT((PwmRange > 1) && (PwmRange <= MAXSHORT));
+
+    State->SampleFormat = SampleFormat;
+    State->DitherMode = DitherMode;
+    State->Range = (LONG)PwmRange;
+    State->Silence = (LONG)(PwmRange / 2);
+    RtlCopyMemory(State->Random, PwmConvertRandomSeed, sizeof(State->Random));
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+    {
+        State->Gain[channel] = PWMCONVERT_GAIN_UNITY;
+        State->TargetGain[channel] = PWMCONVERT_GAIN_UNITY;
+        State->GainStep[channel] = 0;
+    }
+    State->GainRampFrames = 0;
+
+    PwmConvertReset(State);
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmConvertReset
+(
+    PPWM_CONVERT_STATE  State
+)
+/*++
+
+Routine Description:
+
+    Clears the noise shaping history. Called when the sample stream is
+    interrupted, so no error of the previous stream leaks into the new one.
+
+Arguments:
+
+    State - conversion state
+
+Return Value:
+
+    None
+
+--*/
+{
+    RtlZeroMemory(State->Error, sizeof(State->Error));
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmConvertReference
+(
+    PPWM_CONVERT_STATE  State,
+    const VOID*         InBuffer,
+    PUINT32             OutBuffer,
+    ULONG               SampleCount
+)
+/*++
+
+Routine Description:
+
+    Converts interleaved PCM samples to 32 bit PWM samples, scalar implementation.
+
+Arguments:
+
+    State - conversion state
+
+    InBuffer - sample input buffer in the stream sample format
+
+    OutBuffer - 32 bit sample output buffer
+
+    SampleCount - number of samples to convert
+
+Return Value:
+
+    None
+
+--*/
+{
+    PWM_SAMPLE_FORMAT sampleFormat = State->SampleFormat;
+    PWM_DITHER_MODE ditherMode = State->DitherMode;
+    LONG range = State->Range;
+    LONG silence = State->Silence;
+
+    for (ULONG sample = 0; sample < SampleCount; sample++)
+    {
+        ULONG channel = sample % PWMCONVERT_CHANNELS;
+        LONG value = PwmConvertLoadSample(sampleFormat, range, (const UCHAR*)InBuffer, sample);
+        LONG dither = 0;
+        LONG* error = State->Error[channel];
+
+        value = PwmConvertApplyGain(value, State->Gain[channel]);
+
+        if (ditherMode != PwmDitherNone)
+        {
+            dither = PwmConvertTpdfDither(PwmConvertNextRandom(&State->Random[sample % PWMCONVERT_LANES]));
+        }
+
+        if (ditherMode == PwmDitherTpdfShaped1)
+        {
+            value -= error[0];
+        }
+        else if (ditherMode == PwmDitherTpdfShaped2)
+        {
+            value -= 2 * error[0] - error[1];
+        }
+
+        LONG quantized = (value + dither + 0x8000) >> 16;
+        if (quantized < -silence)
+        {
+            quantized = -silence;
+        }
+        else if (quantized > range - silence)
+        {
+            quantized = range - silence;
+        }
+
+        if (ditherMode >= PwmDitherTpdfShaped1)
+        {
+            LONG quantizationError = (quantized << 16) - value;
+            if (quantizationError > PWMCONVERT_ERROR_LIMIT)
+            {
+                quantizationError = PWMCONVERT_ERROR_LIMIT;
+            }
+            else if (quantizationError < -PWMCONVERT_ERROR_LIMIT)
+            {
+                quantizationError = -PWMCONVERT_ERROR_LIMIT;
+            }
+            error[1] = error[0];
+            error[0] = quantizationError;
+        }
+
+        OutBuffer[sample] = (UINT32)(quantized + silence);
+
+        if (State->GainRampFrames && (channel == PWMCONVERT_CHANNELS - 1))
+        {
+            PwmConvertAdvanceGainRamp(State);
+        }
+    }
+}
+
+#ifdef PWMCONVERT_NEON
+
+#pragma code_seg()
+static VOID
+PwmConvertPcm16Neon
+(
+    _Inout_                         PPWM_CONVERT_STATE  State,
+    _In_reads_(SampleCount)         const INT16*        InBuffer,
+    _Out_writes_all_(SampleCount)   PUINT32             OutBuffer,
+    _In_                            ULONG               SampleCount
+)
+/*++
+
+Routine Description:
+
+    Converts interleaved 16 bit PCM samples to 32 bit PWM samples, NEON implementation
+    for the modes without noise shaping and a constant gain. Each vector lane runs its
+    own dither generator.
+
+Arguments:
+
+    State - conversion state
+
+    InBuffer - 16 bit sample input buffer
+
+    OutBuffer - 32 bit sample output buffer
+
+    SampleCount - number of samples to convert, multiple of PWMCONVERT_LANES
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(State->SampleFormat == PwmSampleFormatPcm16);
+    ASSERT(State->DitherMode <= PwmDitherTpdf);
+    ASSERT((State->GainRampFrames == 0) || (SampleCount == 0));
+    ASSERT((SampleCount % PWMCONVERT_LANES) == 0);
+
+    const int16x4_t range = vdup_n_s16((INT16)State->Range);
+    const int32x4_t silence = vdupq_n_s32(State->Silence);
+    const int32x4_t minimum = vdupq_n_s32(0);
+    const int32x4_t maximum = vdupq_n_s32(State->Range);
+
+    //
+    // Each lane holds the gain of its channel. The multiplication is skipped
+    // if all channels are at unity gain.
+    //
+
+    INT32 laneGain[PWMCONVERT_LANES];
+    BOOLEAN applyGain = FALSE;
+
+    for (ULONG lane = 0; lane < PWMCONVERT_LANES; lane++)
+    {
+        laneGain[lane] = State->Gain[lane % PWMCONVERT_CHANNELS];
+        applyGain |= (laneGain[lane] != PWMCONVERT_GAIN_UNITY);
+    }
+
+    const int32x4_t gain = vld1q_s32(laneGain);
+
+    if (State->DitherMode == PwmDitherNone)
+    {
+        for (; SampleCount; SampleCount -= PWMCONVERT_LANES, InBuffer += PWMCONVERT_LANES, OutBuffer += PWMCONVERT_LANES)
+        {
+            int32x4_t value = vmull_s16(vld1_s16(InBuffer), range);
+            if (applyGain)
+            {
+                value = vqdmulhq_s32(value, gain);
+            }
+            int32x4_t pwm = vaddq_s32(vrshrq_n_s32(value, 16), silence);
+            pwm = vminq_s32(vmaxq_s32(pwm, minimum), maximum);
+            vst1q_u32(OutBuffer, vreinterpretq_u32_s32(pwm));
+        }
+    }
+    else
+    {
+        const uint32x4_t lowMask = vdupq_n_u32(0xFFFF);
+        const int32x4_t ditherOffset = vdupq_n_s32(0x10000);
+        uint32x4_t random = vld1q_u32(State->Random);
+
+        for (; SampleCount; SampleCount -= PWMCONVERT_LANES, InBuffer += PWMCONVERT_LANES, OutBuffer += PWMCONVERT_LANES)
+        {
+            random = veorq_u32(random, vshlq_n_u32(random, 13));
+            random = veorq_u32(random, vshrq_n_u32(random, 17));
+            random = veorq_u32(random, vshlq_n_u32(random, 5));
+            int32x4_t dither = vsubq_s32(
+                vreinterpretq_s32_u32(vaddq_u32(vandq_u32(random, lowMask), vshrq_n_u32(random, 16))),
+                ditherOffset);
+
+            int32x4_t value = vmull_s16(vld1_s16(InBuffer), range);
+            if (applyGain)
+            {
+                value = vqdmulhq_s32(value, gain);
+            }
+            value = vaddq_s32(value, dither);
+            int32x4_t pwm = vaddq_s32(vrshrq_n_s32(value, 16), silence);
+            pwm = vminq_s32(vmaxq_s32(pwm, minimum), maximum);
+            vst1q_u32(OutBuffer, vreinterpretq_u32_s32(pwm));
+        }
+
+        vst1q_u32(State->Random, random);
+    }
+}
+
+#endif // PWMCONVERT_NEON
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmConvert
+(
+    PPWM_CONVERT_STATE  State,
+    const VOID*         InBuffer,
+    PUINT32             OutBuffer,
+    ULONG               SampleCount
+)
+/*++
+
+Routine Description:
+
+    Converts interleaved PCM samples to 32 bit PWM samples, using the fastest
+    implementation available for the sample format and dither mode.
+
+Arguments:
+
+    State - conversion state
+
+    InBuffer - sample input buffer in the stream sample format
+
+    OutBuffer - 32 bit sample output buffer
+
+    SampleCount - number of samples to convert
+
+Return Value:
+
+    None
+
+--*/
+{
+#ifdef PWMCONVERT_NEON
+    if ((State->SampleFormat == PwmSampleFormatPcm16) && (State->DitherMode <= PwmDitherTpdf))
+    {
+        if (State->GainRampFrames)
+        {
+            //
+            // Convert the gain ramp with the reference code. The ramp part is
+            // rounded up to whole lanes, so the vector code continues with the
+            // dither generators the reference code would have used.
+            //
+
+            ULONG rampSampleCount = State->GainRampFrames * PWMCONVERT_CHANNELS;
+            rampSampleCount = (rampSampleCount + PWMCONVERT_LANES - 1) & ~(PWMCONVERT_LANES - 1);
+            rampSampleCount = min(rampSampleCount, SampleCount);
+
+            PwmConvertReference(State, InBuffer, OutBuffer, rampSampleCount);
+
+            InBuffer = (const INT16*)InBuffer + rampSampleCount;
+            OutBuffer += rampSampleCount;
+            SampleCount -= rampSampleCount;
+        }
+
+        ULONG vectorSampleCount = SampleCount & ~(PWMCONVERT_LANES - 1);
+        PwmConvertPcm16Neon(State, (const INT16*)InBuffer, OutBuffer, vectorSampleCount);
+
+        //
+        // The remainder starts at a lane aligned sample, so the reference code
+        // picks up the same dither generators the vector code would have used.
+        //
+
+        InBuffer = (const INT16*)InBuffer + vectorSampleCount;
+        OutBuffer += vectorSampleCount;
+        SampleCount -= vectorSampleCount;
+    }
+#endif // PWMCONVERT_NEON
+
+    PwmConvertReference(State, InBuffer, OutBuffer, SampleCount);
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmConvertSilence
+(
+    PPWM_CONVERT_STATE  State,
+    PUINT32             OutBuffer,
+    ULONG               SampleCount
+)
+/*++
+
+Routine Description:
+
+    Fills a given 32 bit samples buffer with silence data.
+
+Arguments:
+
+    State - conversion state
+
+    OutBuffer - 32 bit sample output buffer
+
+    SampleCount - number of samples fill with silence data
+
+Return Value:
+
+    None
+
+--*/
+{
+    while (SampleCount--)
+    {
+        *OutBuffer++ = (UINT32)State->Silence;
+    }
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+LONG
+PwmConvertVolumeToGain
+(
+    LONG    Volume
+)
+/*++
+
+Routine Description:
+
+    Converts a volume level to a gain, integer only.
+
+Arguments:
+
+    Volume - volume level in 1/65536 dB, clamped to the supported range and
+        rounded to the nearest volume step
+
+Return Value:
+
+    Q31 gain
+
+--*/
+{
+    if (Volume >= PWMCONVERT_VOLUME_MAX)
+    {
+        return PWMCONVERT_GAIN_UNITY;
+    }
+
+    if (Volume < PWMCONVERT_VOLUME_MIN)
+    {
+        Volume = PWMCONVERT_VOLUME_MIN;
+    }
+
+    ULONG step = (ULONG)(-Volume + PWMCONVERT_VOLUME_STEP / 2) / PWMCONVERT_VOLUME_STEP;
+    LONG gain = PwmConvertGainTable[step % ARRAYSIZE(PwmConvertGainTable)];
+
+    for (ULONG decade = step / ARRAYSIZE(PwmConvertGainTable); decade; decade--)
+    {
+        gain /= 10;
+    }
+
+    return gain;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmConvertSetGain
+(
+    PPWM_CONVERT_STATE  State,
+    const LONG*         Gain,
+    BOOLEAN             Ramp
+)
+/*++
+
+Routine Description:
+
+    Sets the target gain of each channel. If a target changes, the conversion
+    ramps from the current gain to the new targets, a running ramp restarts
+    from the gain it has reached.
+
+Arguments:
+
+    State - conversion state
+
+    Gain - Q31 target gain of each channel
+
+    Ramp - FALSE to apply the gain immediately, e.g. before the first samples
+        of a stream
+
+Return Value:
+
+    None
+
+--*/
+{
+    BOOLEAN changed = FALSE;
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+    {
+        ASSERT(Gain[channel] >= 0);
+        changed |= (State->TargetGain[channel] != Gain[channel]);
+    }
+
+    if (!changed)
+    {
+        return;
+    }
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+    {
+        State->TargetGain[channel] = Gain[channel];
+        if (Ramp)
+        {
+            State->GainStep[channel] = (Gain[channel] - State->Gain[channel]) / PWMCONVERT_GAIN_RAMP_FRAMES;
+        }
+        else
+        {
+            State->Gain[channel] = Gain[channel];
+            State->GainStep[channel] = 0;
+        }
+    }
+
+    State->GainRampFrames = Ramp ? PWMCONVERT_GAIN_RAMP_FRAMES : 0;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+BOOLEAN
+PwmConvertIsMuted
+(
+    PPWM_CONVERT_STATE  State
+)
+/*++
+
+Routine Description:
+
+    Checks if all channels have reached a gain of zero. The output of a muted
+    conversion can be replaced by silence.
+
+Arguments:
+
+    State - conversion state
+
+Return Value:
+
+    TRUE if muted
+
+--*/
+{
+    if (State->GainRampFrames)
+    {
+        return FALSE;
+    }
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+    {
+        if (State->Gain[channel] != 0)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmRateMatchInitialize
+(
+    PPWM_RATE_MATCH     State,
+    ULONG               SampleRate,
+    ULONG               PwmRange
+)
+/*++
+
+Routine Description:
+
+    Initializes the rate matching for a stream sample rate and PWM range.
+
+Arguments:
+
+    State - rate matching state to initialize
+
+    SampleRate - stream sample rate in Hz
+
+    PwmRange - PWM range of the stream
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONGLONG period = (ULONGLONG)SampleRate * PwmRange;
+
+    //
+    // A PWM faster than the stream would need inserted frames. The ranges are
+    // chosen to never play faster, so no correction is done in that case.
+    //
+
+    State->Period = period;
+    State->Step = (period > PWMFREQ) ? period - PWMFREQ : 0;
+    PwmRateMatchReset(State);
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmRateMatchReset
+(
+    PPWM_RATE_MATCH     State
+)
+/*++
+
+Routine Description:
+
+    Resets the phase and statistics, called when the stream starts over.
+
+Arguments:
+
+    State - rate matching state
+
+Return Value:
+
+    None
+
+--*/
+{
+    State->Phase = 0;
+    State->PacketPhase = 0;
+    State->LastFrameValid = FALSE;
+    State->FramesIn = 0;
+    State->FramesDropped = 0;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+ULONG
+PwmRateMatchAdvance
+(
+    PPWM_RATE_MATCH     State,
+    ULONG               FrameCount,
+    ULONG               MaxDropCount
+)
+/*++
+
+Routine Description:
+
+    Advances the rate matching by a packet of stream frames.
+
+Arguments:
+
+    State - rate matching state
+
+    FrameCount - number of stream frames in the packet
+
+    MaxDropCount - maximum number of frames the packet can drop. Drops beyond
+        the maximum stay pending and are done with the following packets.
+
+Return Value:
+
+    Number of frames to drop from the packet
+
+--*/
+{
+    ULONG dropCount = 0;
+
+    State->FramesIn += FrameCount;
+    State->PacketPhase = State->Phase;
+    State->Phase += State->Step * FrameCount;
+
+    while ((State->Phase >= State->Period) && (dropCount < MaxDropCount))
+    {
+        State->Phase -= State->Period;
+        dropCount++;
+    }
+
+    State->FramesDropped += dropCount;
+
+    return dropCount;
+}
+
+#pragma code_seg()
+static __forceinline VOID
+PwmRateMatchBlendFrame
+(
+    _In_reads_(PWMCONVERT_CHANNELS)       const UINT32* Earlier,
+    _In_reads_(PWMCONVERT_CHANNELS)       const UINT32* Later,
+    _In_                                  ULONGLONG     Phase,
+    _Out_writes_all_(PWMCONVERT_CHANNELS) PUINT32       Frame
+)
+{
+    //
+    // Frame may be the same as Later, each sample is read before it is written.
+    //
+
+    ULONG weight = (ULONG)((Phase * PWMRATEMATCH_WEIGHT_SCALE) >> 32);
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+    {
+        Frame[channel] = (Earlier[channel] * (0x10000 - weight) + Later[channel] * weight + 0x8000) >> 16;
+    }
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+PwmRateMatchInterpolate
+(
+    PPWM_RATE_MATCH     State,
+    PUINT32             Buffer,
+    ULONG               FrameCount,
+    ULONG               ChunkFrameCount,
+    ULONG               DropCount
+)
+/*++
+
+Routine Description:
+
+    Resamples the PWM samples of the packet last passed to PwmRateMatchAdvance
+    in place to the PWM rate. The DMA plays the first chunk without its dropped
+    frames at the end, followed by the rest of the packet.
+
+    PWM frame n of the packet is at the stream frame position
+    (PacketPhase + n * Period) / PWMFREQ and plays the stream one frame back,
+    interpolated between the stream frame before the integer position and
+    the one at it. The position stays below the packet length, the last
+    stream frame is kept for the first PWM frame of the next packet.
+
+Arguments:
+
+    State - rate matching state
+
+    Buffer - interleaved 32 bit PWM sample buffer of the packet
+
+    FrameCount - number of frames in the packet
+
+    ChunkFrameCount - number of frames in the first chunk, including the
+        dropped frames
+
+    DropCount - number of frames PwmRateMatchAdvance dropped from the packet
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(DropCount < ChunkFrameCount);
+    ASSERT(ChunkFrameCount <= FrameCount);
+
+    //
+    // Exact rates play the stream as delivered.
+    //
+
+    if (State->Step == 0)
+    {
+        return;
+    }
+
+    UINT32 earlier[PWMCONVERT_CHANNELS];
+    UINT32 current[PWMCONVERT_CHANNELS];
+    const UINT32* lastFrame = Buffer + (FrameCount - 1) * PWMCONVERT_CHANNELS;
+
+    for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+    {
+        earlier[channel] = State->LastFrameValid ? State->LastFrame[channel] : Buffer[channel];
+        State->LastFrame[channel] = lastFrame[channel];
+    }
+    State->LastFrameValid = TRUE;
+
+    //
+    // The frames of the last chunk follow the dropped frames. They are done
+    // first and backwards, each reads no stream frame past its own position,
+    // and no stream frame of the first chunk is overwritten yet. Limiting the
+    // advance to the drop count keeps this true with drops left pending.
+    //
+
+    ULONG frameCount = FrameCount - DropCount;
+    ULONG chunkFrameCount = ChunkFrameCount - DropCount;
+
+    for (ULONG frame = frameCount; frame-- > chunkFrameCount;)
+    {
+        ULONGLONG phase = State->PacketPhase + frame * State->Step;
+        ULONG source = frame + (ULONG)min(phase / PWMFREQ, (ULONGLONG)DropCount);
+
+        PwmRateMatchBlendFrame(
+            Buffer + (source - 1) * PWMCONVERT_CHANNELS,
+            Buffer + source * PWMCONVERT_CHANNELS,
+            phase % PWMFREQ,
+            Buffer + (frame + DropCount) * PWMCONVERT_CHANNELS);
+    }
+
+    //
+    // The first chunk is done forwards. Its frames read no stream frame
+    // before their own position but the previous one, which is kept.
+    //
+
+    ULONGLONG phase = State->PacketPhase;
+    ULONG advance = 0;
+
+    while (phase >= PWMFREQ)
+    {
+        phase -= PWMFREQ;
+        advance++;
+    }
+
+    for (ULONG frame = 0; frame < chunkFrameCount; frame++)
+    {
+        PUINT32 pwmFrame = Buffer + frame * PWMCONVERT_CHANNELS;
+        ULONG source = frame + min(advance, DropCount);
+
+        RtlCopyMemory(current, pwmFrame, sizeof(current));
+
+        PwmRateMatchBlendFrame(
+            (source == frame) ? earlier : Buffer + (source - 1) * PWMCONVERT_CHANNELS,
+            Buffer + source * PWMCONVERT_CHANNELS,
+            phase,
+            pwmFrame);
+
+        RtlCopyMemory(earlier, current, sizeof(earlier));
+
+        phase += State->Step;
+        while (phase >= PWMFREQ)
+        {
+            phase -= PWMFREQ;
+            advance++;
+        }
+    }
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+ULONG
+PwmRateMatchPhasePpm
+(
+    PPWM_RATE_MATCH     State
+)
+/*++
+
+Routine Description:
+
+    Returns the phase error between the frames played and the frames the
+    stream delivered.
+
+Arguments:
+
+    State - rate matching state
+
+Return Value:
+
+    Phase error in millionths of a frame
+
+--*/
+{
+    if (State->Period == 0)
+    {
+        return 0;
+    }
+
+    return (ULONG)(State->Phase * 1000000 / State->Period);
+}
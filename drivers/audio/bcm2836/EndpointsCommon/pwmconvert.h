@@ -0,0 +1,270 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Definition of the PCM to PWM sample conversion.
+
+--*/
+
+#pragma once
+
+//
+// The PWM range defines the PWM output sample rate at the fixed PWM audio clock.
+// Each sample rate is played with the smallest range that does not make the
+// PWM output faster than the sample rate, the PWM driver corrects the remaining
+// drift by resampling the packets and dropping samples.
+//
+
+#define PWMFREQ                 BCM_PWM_AUDIO_CLOCK_FREQUENCY
+#define PWMRANGE_FOR_RATE(r)    ((PWMFREQ + (r) - 1) / (r))
+#define PWMBYTESPERSAMPLE       4
+
+//
+// Number of interleaved channels in the PCM and PWM sample streams.
+//
+
+#define PWMCONVERT_CHANNELS 2
+
+//
+// Number of independent dither noise generators. Sample n of a conversion call
+// draws its dither from generator n % PWMCONVERT_LANES, which lets the SIMD
+// conversion produce exactly the same output as the scalar reference.
+//
+
+#define PWMCONVERT_LANES 4
+
+//
+// Dither mode of every stream, applied by CMiniportWaveRTStream::Init. TPDF
+// is the highest mode the NEON code converts, the noise shaped modes fall
+// back to the scalar code.
+//
+
+#define PWMCONVERT_DEFAULT_DITHER_MODE PwmDitherTpdf
+
+//
+// Gain stage of the conversion, applied to the scaled sample before dither.
+// Gains are Q31 fractions, a channel at PWMCONVERT_GAIN_UNITY is converted
+// without multiplication. A new gain is reached by a linear ramp over
+// PWMCONVERT_GAIN_RAMP_FRAMES frames, so volume changes and mute do not click.
+//
+// Volumes are in 1/65536 dB like KSPROPERTY_AUDIO_VOLUMELEVEL, resolved in
+// PWMCONVERT_VOLUME_STEP steps from PWMCONVERT_VOLUME_MIN to PWMCONVERT_VOLUME_MAX.
+//
+
+#define PWMCONVERT_GAIN_UNITY       0x7FFFFFFF
+#define PWMCONVERT_GAIN_RAMP_FRAMES 256
+#define PWMCONVERT_VOLUME_MIN       (-96 * 0x10000)
+#define PWMCONVERT_VOLUME_MAX       0
+#define PWMCONVERT_VOLUME_STEP      0x8000
+
+//
+// Supported PCM sample formats.
+//
+// PwmSampleFormatPcm16   - 16 bit integer PCM.
+// PwmSampleFormatPcm24   - 24 bit integer PCM packed in 3 bytes.
+// PwmSampleFormatPcm32   - 32 bit integer PCM container, with 24 or 32 valid bits.
+// PwmSampleFormatFloat32 - 32 bit IEEE float PCM, full scale is +/-1.0.
+//
+
+typedef enum _PWM_SAMPLE_FORMAT
+{
+    PwmSampleFormatPcm16 = 0,
+    PwmSampleFormatPcm24,
+    PwmSampleFormatPcm32,
+    PwmSampleFormatFloat32,
+    PwmSampleFormatCount
+} PWM_SAMPLE_FORMAT;
+
+//
+// Requantization of the PCM samples to the ~11 bit PWM range.
+//
+// PwmDitherNone        - Round to the nearest PWM value.
+// PwmDitherTpdf        - Add triangular (TPDF) dither of +/-1 PWM LSB before rounding.
+//                        Turns the signal correlated quantization distortion into
+//                        a constant noise floor.
+// PwmDitherTpdfShaped1 - TPDF dither with first order error feedback, moves the
+//                        requantization noise towards high frequencies.
+// PwmDitherTpdfShaped2 - TPDF dither with second order error feedback.
+//
+// The noise shaped modes carry a per channel error state from sample to sample
+// and are always converted by the scalar code.
+//
+
+typedef enum _PWM_DITHER_MODE
+{
+    PwmDitherNone = 0,
+    PwmDitherTpdf,
+    PwmDitherTpdfShaped1,
+    PwmDitherTpdfShaped2,
+    PwmDitherModeCount
+} PWM_DITHER_MODE;
+
+typedef struct _PWM_CONVERT_STATE
+{
+    PWM_SAMPLE_FORMAT   SampleFormat;
+    PWM_DITHER_MODE     DitherMode;
+    LONG                Range;
+    LONG                Silence;
+
+    //
+    // xorshift32 dither noise generators.
+    //
+
+    UINT32              Random[PWMCONVERT_LANES];
+
+    //
+    // Last two requantization errors of each channel in 1/65536 PWM LSB.
+    //
+
+    LONG                Error[PWMCONVERT_CHANNELS][2];
+
+    //
+    // Current gain, ramp target and per frame ramp step of each channel, and
+    // the number of frames left until the ramp reaches the target.
+    //
+
+    LONG                Gain[PWMCONVERT_CHANNELS];
+    LONG                TargetGain[PWMCONVERT_CHANNELS];
+    LONG                GainStep[PWMCONVERT_CHANNELS];
+    ULONG               GainRampFrames;
+} PWM_CONVERT_STATE, *PPWM_CONVERT_STATE;
+
+//
+// Matching of the stream sample rate to the slightly slower PWM sample rate.
+//
+// The PWM plays Clock / PwmRange frames per second, while the stream delivers
+// SampleRate frames per second. For every stream frame the phase advances by
+// SampleRate * PwmRange - Clock, and each time it passes SampleRate * PwmRange
+// one frame is dropped. The step is the exact rate difference, so the number of
+// frames played never drifts from the number of frames the stream delivered,
+// the remaining phase is always less than one frame.
+//
+// The frames of a packet are not played as delivered. Each PWM frame is linearly
+// interpolated from the two stream frames around its position, one frame back,
+// so a drop is spread over all frames up to the next one instead of advancing
+// the waveform by a whole frame.
+//
+
+typedef struct _PWM_RATE_MATCH
+{
+    ULONGLONG           Step;
+    ULONGLONG           Period;
+    ULONGLONG           Phase;
+
+    //
+    // Phase at the start of the last advanced packet, and the last stream
+    // frame of the previous packet, which the first PWM frame of a packet
+    // is interpolated from.
+    //
+
+    ULONGLONG           PacketPhase;
+    UINT32              LastFrame[PWMCONVERT_CHANNELS];
+    BOOLEAN             LastFrameValid;
+
+    //
+    // Statistics, frames received from the stream and frames dropped.
+    //
+
+    ULONGLONG           FramesIn;
+    ULONGLONG           FramesDropped;
+} PWM_RATE_MATCH, *PPWM_RATE_MATCH;
+
+VOID
+PwmConvertInitialize
+(
+    _Out_   PPWM_CONVERT_STATE  State,
+    _In_    PWM_SAMPLE_FORMAT   SampleFormat,
+    _In_    ULONG               PwmRange,
+    _In_    PWM_DITHER_MODE     DitherMode
+);
+
+VOID
+PwmConvertReset
+(
+    _Inout_ PPWM_CONVERT_STATE  State
+);
+
+VOID
+PwmConvert
+(
+    _Inout_                         PPWM_CONVERT_STATE  State,
+    _In_                            const VOID*         InBuffer,
+    _Out_writes_all_(SampleCount)   PUINT32             OutBuffer,
+    _In_                            ULONG               SampleCount
+);
+
+VOID
+PwmConvertReference
+(
+    _Inout_                         PPWM_CONVERT_STATE  State,
+    _In_                            const VOID*         InBuffer,
+    _Out_writes_all_(SampleCount)   PUINT32             OutBuffer,
+    _In_                            ULONG               SampleCount
+);
+
+VOID
+PwmConvertSilence
+(
+    _In_                            PPWM_CONVERT_STATE  State,
+    _Out_writes_all_(SampleCount)   PUINT32             OutBuffer,
+    _In_                            ULONG               SampleCount
+);
+
+LONG
+PwmConvertVolumeToGain
+(
+    _In_    LONG                Volume
+);
+
+VOID
+PwmConvertSetGain
+(
+    _Inout_                         PPWM_CONVERT_STATE  State,
+    _In_reads_(PWMCONVERT_CHANNELS) const LONG*         Gain,
+    _In_                            BOOLEAN             Ramp
+);
+
+BOOLEAN
+PwmConvertIsMuted
+(
+    _In_    PPWM_CONVERT_STATE  State
+);
+
+VOID
+PwmRateMatchInitialize
+(
+    _Out_   PPWM_RATE_MATCH     State,
+    _In_    ULONG               SampleRate,
+    _In_    ULONG               PwmRange
+);
+
+VOID
+PwmRateMatchReset
+(
+    _Inout_ PPWM_RATE_MATCH     State
+);
+
+ULONG
+PwmRateMatchAdvance
+(
+    _Inout_ PPWM_RATE_MATCH     State,
+    _In_    ULONG               FrameCount,
+    _In_    ULONG               MaxDropCount
+);
+
+VOID
+PwmRateMatchInterpolate
+(
+    _Inout_                                             PPWM_RATE_MATCH State,
+    _Inout_updates_(FrameCount * PWMCONVERT_CHANNELS)   PUINT32         Buffer,
+    _In_                                                ULONG           FrameCount,
+    _In_                                                ULONG           ChunkFrameCount,
+    _In_                                                ULONG           DropCount
+);
+
+ULONG
+PwmRateMatchPhasePpm
+(
+    _In_    PPWM_RATE_MATCH     State
+);
@@ -43,6 +43,13 @@ enum
     KSPIN_TOPO_LINEOUT_DEST,
 };
 
+// Topology nodes.
+enum
+{
+    KSNODE_TOPO_VOLUME = 0,
+    KSNODE_TOPO_MUTE
+};
+
 // Wave Topology nodes.
 enum 
 {
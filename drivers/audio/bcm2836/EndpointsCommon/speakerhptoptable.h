@@ -88,12 +88,72 @@ PKSJACK_DESCRIPTION SpeakerHpJackDescriptions[] =
     &HpJackDesc
 };
 
+//=============================================================================
+static
+PCPROPERTY_ITEM PropertiesSpeakerHpTopoVolume[] =
+{
+    {
+        &KSPROPSETID_Audio,
+        KSPROPERTY_AUDIO_VOLUMELEVEL,
+        KSPROPERTY_TYPE_ALL,
+        PropertyHandler_Topology
+    }
+};
+
+static
+PCPROPERTY_ITEM PropertiesSpeakerHpTopoMute[] =
+{
+    {
+        &KSPROPSETID_Audio,
+        KSPROPERTY_AUDIO_MUTE,
+        KSPROPERTY_TYPE_ALL,
+        PropertyHandler_Topology
+    }
+};
+
+static
+PCEVENT_ITEM EventsSpeakerHpTopoControlChange[] =
+{
+    {
+        &KSEVENTSETID_AudioControlChange,
+        KSEVENT_CONTROL_CHANGE,
+        KSEVENT_TYPE_ENABLE | KSEVENT_TYPE_BASICSUPPORT,
+        EventHandler_Topology
+    }
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP_EVENT(AutomationSpeakerHpTopoVolume, PropertiesSpeakerHpTopoVolume, EventsSpeakerHpTopoControlChange);
+DEFINE_PCAUTOMATION_TABLE_PROP_EVENT(AutomationSpeakerHpTopoMute, PropertiesSpeakerHpTopoMute, EventsSpeakerHpTopoControlChange);
+
+//=============================================================================
+// Volume and mute are applied by the PCM to PWM conversion of the render stream.
+static
+PCNODE_DESCRIPTOR SpeakerHpTopoMiniportNodes[] =
+{
+  // KSNODE_TOPO_VOLUME
+  {
+    0,                                                  // Flags
+    &AutomationSpeakerHpTopoVolume,                     // AutomationTable
+    &KSNODETYPE_VOLUME,                                 // Type
+    &KSAUDFNAME_MASTER_VOLUME                           // Name
+  },
+  // KSNODE_TOPO_MUTE
+  {
+    0,                                                  // Flags
+    &AutomationSpeakerHpTopoMute,                       // AutomationTable
+    &KSNODETYPE_MUTE,                                   // Type
+    &KSAUDFNAME_MASTER_MUTE                             // Name
+  }
+};
+
 //=============================================================================
 static
 PCCONNECTION_DESCRIPTOR SpeakerHpTopoMiniportConnections[] =
 {
   //  FromNode,                     FromPin,                        ToNode,                      ToPin
-  {   PCFILTER_NODE,                KSPIN_TOPO_WAVEOUT_SOURCE,      PCFILTER_NODE,               KSPIN_TOPO_LINEOUT_DEST}
+  {   PCFILTER_NODE,                KSPIN_TOPO_WAVEOUT_SOURCE,      KSNODE_TOPO_VOLUME,          1},
+  {   KSNODE_TOPO_VOLUME,           0,                              KSNODE_TOPO_MUTE,            1},
+  {   KSNODE_TOPO_MUTE,             0,                              PCFILTER_NODE,               KSPIN_TOPO_LINEOUT_DEST}
 };
 
 
@@ -127,8 +187,8 @@ PCFILTER_DESCRIPTOR SpeakerHpTopoMiniportFilterDescriptor =
   SIZEOF_ARRAY(SpeakerHpTopoMiniportPins),          // PinCount
   SpeakerHpTopoMiniportPins,                        // Pins
   sizeof(PCNODE_DESCRIPTOR),                        // NodeSize
-  0,                                                // NodeCount
-  NULL,                                             // Nodes
+  SIZEOF_ARRAY(SpeakerHpTopoMiniportNodes),         // NodeCount
+  SpeakerHpTopoMiniportNodes,                       // Nodes
   SIZEOF_ARRAY(SpeakerHpTopoMiniportConnections),   // ConnectionCount
   SpeakerHpTopoMiniportConnections,                 // Connections
   0,                                                // CategoryCount
@@ -9,49 +9,66 @@ Abstract:
 
 #pragma once
 
-// To keep the code simple assume device supports only 48KHz, 16-bit, stereo (PCM and NON-PCM)
+// The device supports 22.05kHz, 32kHz, 44.1kHz and 48kHz stereo, as 16-bit, 24-bit and 32-bit
+// containers with 24 valid bits PCM, and as 32-bit float. Each sample rate is played with its own
+// PWM range, the samples are requantized to the PWM range.
 
 #define SPEAKERHP_DEVICE_MAX_CHANNELS                   2       // Max Channels.
 
 #define SPEAKERHP_HOST_MAX_CHANNELS                     2       // Max Channels.
 #define SPEAKERHP_HOST_MIN_BITS_PER_SAMPLE              16      // Min Bits Per Sample
-#define SPEAKERHP_HOST_MAX_BITS_PER_SAMPLE              16      // Max Bits Per Sample
-#define SPEAKERHP_HOST_MIN_SAMPLE_RATE                  44100   // Min Sample Rate
-#define SPEAKERHP_HOST_MAX_SAMPLE_RATE                  44100   // Max Sample Rate
+#define SPEAKERHP_HOST_MAX_BITS_PER_SAMPLE              32      // Max Bits Per Sample
+#define SPEAKERHP_HOST_MIN_SAMPLE_RATE                  22050   // Min Sample Rate
+#define SPEAKERHP_HOST_MAX_SAMPLE_RATE                  48000   // Max Sample Rate
 
 //
 // Max # of pin instances.
 //
 #define SPEAKERHP_MAX_INPUT_SYSTEM_STREAMS              2       // Raw + Default streams
 
+//
+// Stereo WAVEFORMATEXTENSIBLE device format.
+//
+#define SPEAKERHP_HOST_FORMAT(SubFormat, SampleRate, BitsPerSample, ValidBitsPerSample) \
+    {                                                                                   \
+        {                                                                               \
+            sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE),                                  \
+            0,                                                                          \
+            0,                                                                          \
+            0,                                                                          \
+            STATICGUIDOF(KSDATAFORMAT_TYPE_AUDIO),                                      \
+            SubFormat,                                                                  \
+            STATICGUIDOF(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX)                           \
+        },                                                                              \
+        {                                                                               \
+            {                                                                           \
+                WAVE_FORMAT_EXTENSIBLE,                                                 \
+                2,                                                                      \
+                SampleRate,                                                             \
+                (SampleRate) * 2 * (BitsPerSample) / 8,                                 \
+                2 * (BitsPerSample) / 8,                                                \
+                BitsPerSample,                                                          \
+                sizeof(WAVEFORMATEXTENSIBLE)-sizeof(WAVEFORMATEX)                       \
+            },                                                                          \
+            ValidBitsPerSample,                                                         \
+            KSAUDIO_SPEAKER_STEREO,                                                     \
+            SubFormat                                                                   \
+        }                                                                               \
+    }
+
+#define SPEAKERHP_HOST_FORMATS_FOR_RATE(SampleRate)                                     \
+    SPEAKERHP_HOST_FORMAT(STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM), SampleRate, 16, 16),   \
+    SPEAKERHP_HOST_FORMAT(STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM), SampleRate, 24, 24),   \
+    SPEAKERHP_HOST_FORMAT(STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM), SampleRate, 32, 24),   \
+    SPEAKERHP_HOST_FORMAT(STATICGUIDOF(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT), SampleRate, 32, 32)
+
 static 
 KSDATAFORMAT_WAVEFORMATEXTENSIBLE SpeakerHpHostPinSupportedDeviceFormats[] =
 {
-    { // 2
-        {
-            sizeof(KSDATAFORMAT_WAVEFORMATEXTENSIBLE),
-            0,
-            0,
-            0,
-            STATICGUIDOF(KSDATAFORMAT_TYPE_AUDIO),
-            STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM),
-            STATICGUIDOF(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX)
-        },
-        {
-            {
-                WAVE_FORMAT_EXTENSIBLE,
-                2,
-                44100,
-                176400,
-                4,
-                16,
-                sizeof(WAVEFORMATEXTENSIBLE)-sizeof(WAVEFORMATEX)
-            },
-            16,
-            KSAUDIO_SPEAKER_STEREO,
-            STATICGUIDOF(KSDATAFORMAT_SUBTYPE_PCM)
-        }
-    },
+    SPEAKERHP_HOST_FORMATS_FOR_RATE(44100),     // 0 - 3
+    SPEAKERHP_HOST_FORMATS_FOR_RATE(48000),     // 4 - 7
+    SPEAKERHP_HOST_FORMATS_FOR_RATE(32000),     // 8 - 11
+    SPEAKERHP_HOST_FORMATS_FOR_RATE(22050),     // 12 - 15
 };
 
 //
@@ -62,7 +79,7 @@ MODE_AND_DEFAULT_FORMAT SpeakerHpHostPinSupportedDeviceModes[] =
 {
     {
         STATIC_AUDIO_SIGNALPROCESSINGMODE_RAW,
-        &SpeakerHpHostPinSupportedDeviceFormats[0].DataFormat // 44.1kHz
+        &SpeakerHpHostPinSupportedDeviceFormats[0].DataFormat // 44.1kHz 16-bit
     },
 };
 
@@ -109,6 +126,22 @@ KSDATARANGE_AUDIO SpeakerHpPinDataRangesStream[] =
         SPEAKERHP_HOST_MIN_SAMPLE_RATE,            
         SPEAKERHP_HOST_MAX_SAMPLE_RATE             
     },
+    { // 1
+        {
+            sizeof(KSDATARANGE_AUDIO),
+            KSDATARANGE_ATTRIBUTES,         // An attributes list follows this data range
+            0,
+            0,
+            STATICGUIDOF(KSDATAFORMAT_TYPE_AUDIO),
+            STATICGUIDOF(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT),
+            STATICGUIDOF(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX)
+        },
+        SPEAKERHP_HOST_MAX_CHANNELS,           
+        32,    
+        32,    
+        SPEAKERHP_HOST_MIN_SAMPLE_RATE,            
+        SPEAKERHP_HOST_MAX_SAMPLE_RATE             
+    },
 };
 
 
@@ -116,6 +149,8 @@ static
 PKSDATARANGE SpeakerHpPinDataRangePointersStream[] =
 {
     PKSDATARANGE(&SpeakerHpPinDataRangesStream[0]),
+    PKSDATARANGE(&PinDataRangeAttributeList),
+    PKSDATARANGE(&SpeakerHpPinDataRangesStream[1]),
     PKSDATARANGE(&PinDataRangeAttributeList)
 };
 
@@ -25,6 +25,7 @@ Abstract:
 
 typedef void (*fnPcDriverUnload) (PDRIVER_OBJECT);
 fnPcDriverUnload gPCDriverUnloadRoutine = NULL;
+BCM_PWM_AUDIO_PROFILE gPwmAudioProfile = BCM_PWM_AUDIO_PROFILE_DEFAULT;
 extern "C" DRIVER_UNLOAD DriverUnload;
 
 //-----------------------------------------------------------------------------
@@ -160,6 +161,25 @@ Return Value:
         DPF(D_ERROR, ("WdfDriverCreate failed, 0x%x", ntStatus)),
         Done);
 
+    //
+    // Read the optional LowLatency driver parameter, which selects the low latency PWM audio profile.
+    //
+    {
+        WDFKEY      parametersKey;
+        ULONG       lowLatency = 0;
+        DECLARE_CONST_UNICODE_STRING(lowLatencyValueName, L"LowLatency");
+
+        if (NT_SUCCESS(WdfDriverOpenParametersRegistryKey(WdfGetDriver(), KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &parametersKey)))
+        {
+            if (NT_SUCCESS(WdfRegistryQueryULong(parametersKey, &lowLatencyValueName, &lowLatency)) && lowLatency)
+            {
+                gPwmAudioProfile = BCM_PWM_AUDIO_PROFILE_LOW_LATENCY;
+                DPF(D_TERSE, ("[DriverEntry] Low latency profile selected"));
+            }
+            WdfRegistryClose(parametersKey);
+        }
+    }
+
     //
     // Tell the class driver to initialize the driver.
     //
@@ -14,6 +14,7 @@ Abstract:
 
 #include <rpiwav.h>
 #include "basetopo.h"
+#include "pwmconvert.h"
 
 //=============================================================================
 #pragma code_seg("PAGE")
@@ -272,6 +273,14 @@ Return Value:
             ntStatus = PropertyHandler_CpuResources(PropertyRequest);
             break;
 
+        case KSPROPERTY_AUDIO_VOLUMELEVEL:
+            ntStatus = PropertyHandlerVolume(PropertyRequest);
+            break;
+
+        case KSPROPERTY_AUDIO_MUTE:
+            ntStatus = PropertyHandlerMute(PropertyRequest);
+            break;
+
         default:
             DPF(D_TERSE, ("[PropertyHandlerGeneric: Invalid Device Request]"));
     }
@@ -279,3 +288,342 @@ Return Value:
     return ntStatus;
 } 
 
+//=============================================================================
+#pragma code_seg("PAGE")
+_Use_decl_annotations_
+NTSTATUS
+CMiniportTopologyRPIWAV::PropertyHandlerBasicSupportVolume
+(
+    PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*++
+
+Routine Description:
+
+    Handles BasicSupport for the volume node. Reports the volume range of the
+    conversion gain stage for each channel.
+
+Arguments:
+
+    PropertyRequest - property request
+
+Return Value:
+
+    NT status code
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS ntStatus = STATUS_SUCCESS;
+    ULONG    cbFullProperty = 
+        sizeof(KSPROPERTY_DESCRIPTION) +
+        sizeof(KSPROPERTY_MEMBERSHEADER) +
+        sizeof(KSPROPERTY_STEPPING_LONG) * m_DeviceMaxChannels;
+
+    if (PropertyRequest->ValueSize >= (sizeof(KSPROPERTY_DESCRIPTION)))
+    {
+        PKSPROPERTY_DESCRIPTION PropDesc = 
+            PKSPROPERTY_DESCRIPTION(PropertyRequest->Value);
+
+        PropDesc->AccessFlags       = KSPROPERTY_TYPE_ALL;
+        PropDesc->DescriptionSize   = cbFullProperty;
+        PropDesc->PropTypeSet.Set   = KSPROPTYPESETID_General;
+        PropDesc->PropTypeSet.Id    = VT_I4;
+        PropDesc->PropTypeSet.Flags = 0;
+        PropDesc->MembersListCount  = 1;
+        PropDesc->Reserved          = 0;
+
+        // if return buffer can also hold a range description, return it too
+        if (PropertyRequest->ValueSize >= cbFullProperty)
+        {
+            // fill in the members header
+            PKSPROPERTY_MEMBERSHEADER Members = 
+                PKSPROPERTY_MEMBERSHEADER(PropDesc + 1);
+
+            Members->MembersFlags   = KSPROPERTY_MEMBER_STEPPEDRANGES;
+            Members->MembersSize    = sizeof(KSPROPERTY_STEPPING_LONG);
+            Members->MembersCount   = m_DeviceMaxChannels;
+            Members->Flags          = KSPROPERTY_MEMBER_FLAG_BASICSUPPORT_MULTICHANNEL;
+
+            // fill in the stepped range
+            PKSPROPERTY_STEPPING_LONG Range = 
+                PKSPROPERTY_STEPPING_LONG(Members + 1);
+
+            for (ULONG i = 0; i < m_DeviceMaxChannels; ++i)
+            {
+                Range[i].Bounds.SignedMaximum = PWMCONVERT_VOLUME_MAX;
+                Range[i].Bounds.SignedMinimum = PWMCONVERT_VOLUME_MIN;
+                Range[i].SteppingDelta        = PWMCONVERT_VOLUME_STEP;
+                Range[i].Reserved             = 0;
+            }
+
+            // set the return value size
+            PropertyRequest->ValueSize = cbFullProperty;
+        } 
+        else
+        {
+            PropertyRequest->ValueSize = sizeof(KSPROPERTY_DESCRIPTION);
+        }
+    } 
+    else if (PropertyRequest->ValueSize >= sizeof(ULONG))
+    {
+        // if return buffer can hold a ULONG, return the access flags
+        PULONG AccessFlags = PULONG(PropertyRequest->Value);
+
+        PropertyRequest->ValueSize = sizeof(ULONG);
+        *AccessFlags = KSPROPERTY_TYPE_ALL;
+    }
+    else
+    {
+        PropertyRequest->ValueSize = 0;
+        ntStatus = STATUS_BUFFER_TOO_SMALL;
+    }
+
+    return ntStatus;
+} 
+
+//=============================================================================
+#pragma code_seg("PAGE")
+_Use_decl_annotations_
+NTSTATUS
+CMiniportTopologyRPIWAV::PropertyHandlerVolume
+(
+    PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*++
+
+Routine Description:
+
+    Property handler for KSPROPERTY_AUDIO_VOLUMELEVEL. The volume is applied by
+    the PCM to PWM conversion of the render stream.
+
+Arguments:
+
+    PropertyRequest - property request
+
+Return Value:
+
+    NT status code
+
+--*/
+{
+    PAGED_CODE();
+
+    DPF_ENTER(("[%s]",__FUNCTION__));
+
+    NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+    if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+    {
+        return PropertyHandlerBasicSupportVolume(PropertyRequest);
+    }
+
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(LONG), sizeof(ULONG));
+    if (NT_SUCCESS(ntStatus))
+    {
+        ULONG ulChannel = *(PULONG(PropertyRequest->Instance));
+        PLONG plVolume  = PLONG(PropertyRequest->Value);
+
+        if (ulChannel >= m_DeviceMaxChannels && ulChannel != MIXER_CHANNEL_MASTER)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+        {
+            *plVolume = m_AdapterCommon->MixerVolumeRead(ulChannel == MIXER_CHANNEL_MASTER ? 0 : ulChannel);
+            PropertyRequest->ValueSize = sizeof(LONG);
+        }
+        else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+        {
+            LONG lVolume = *plVolume;
+
+            if (lVolume > PWMCONVERT_VOLUME_MAX)
+            {
+                lVolume = PWMCONVERT_VOLUME_MAX;
+            }
+            else if (lVolume < PWMCONVERT_VOLUME_MIN)
+            {
+                lVolume = PWMCONVERT_VOLUME_MIN;
+            }
+
+            for (ULONG i = 0; i < m_DeviceMaxChannels; i++)
+            {
+                if (ulChannel == MIXER_CHANNEL_MASTER || ulChannel == i)
+                {
+                    m_AdapterCommon->MixerVolumeWrite(i, lVolume);
+                }
+            }
+
+            GenerateEventList(
+                (GUID*)&KSEVENTSETID_AudioControlChange,
+                KSEVENT_CONTROL_CHANGE,
+                FALSE,
+                ULONG(-1),
+                TRUE,
+                PropertyRequest->Node);
+        }
+    }
+
+    return ntStatus;
+} 
+
+//=============================================================================
+#pragma code_seg("PAGE")
+_Use_decl_annotations_
+NTSTATUS
+CMiniportTopologyRPIWAV::PropertyHandlerMute
+(
+    PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*++
+
+Routine Description:
+
+    Property handler for KSPROPERTY_AUDIO_MUTE. The render stream ramps down to
+    silence and back.
+
+Arguments:
+
+    PropertyRequest - property request
+
+Return Value:
+
+    NT status code
+
+--*/
+{
+    PAGED_CODE();
+
+    DPF_ENTER(("[%s]",__FUNCTION__));
+
+    NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+    if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+    {
+        return PropertyHandler_BasicSupport(PropertyRequest, KSPROPERTY_TYPE_ALL, VT_BOOL);
+    }
+
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(BOOL), sizeof(ULONG));
+    if (NT_SUCCESS(ntStatus))
+    {
+        ULONG ulChannel = *(PULONG(PropertyRequest->Instance));
+        PBOOL pfMute    = PBOOL(PropertyRequest->Value);
+
+        if (ulChannel >= m_DeviceMaxChannels && ulChannel != MIXER_CHANNEL_MASTER)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+        {
+            *pfMute = m_AdapterCommon->MixerMuteRead(ulChannel == MIXER_CHANNEL_MASTER ? 0 : ulChannel);
+            PropertyRequest->ValueSize = sizeof(BOOL);
+        }
+        else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET)
+        {
+            for (ULONG i = 0; i < m_DeviceMaxChannels; i++)
+            {
+                if (ulChannel == MIXER_CHANNEL_MASTER || ulChannel == i)
+                {
+                    m_AdapterCommon->MixerMuteWrite(i, *pfMute);
+                }
+            }
+
+            GenerateEventList(
+                (GUID*)&KSEVENTSETID_AudioControlChange,
+                KSEVENT_CONTROL_CHANGE,
+                FALSE,
+                ULONG(-1),
+                TRUE,
+                PropertyRequest->Node);
+        }
+    }
+
+    return ntStatus;
+} 
+
+//=============================================================================
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+CMiniportTopologyRPIWAV::AddEventToEventList
+(
+    PKSEVENT_ENTRY    EventEntry 
+)
+/*++
+
+Routine Description:
+
+    Adds an event to the port event list.
+
+Arguments:
+
+    EventEntry - event to add
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(m_PortEvents != NULL);
+
+    DPF_ENTER(("[%s]",__FUNCTION__));
+
+    m_PortEvents->AddEventToEventList(EventEntry);
+}
+
+//=============================================================================
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+CMiniportTopologyRPIWAV::GenerateEventList
+(
+    GUID       *Set,
+    ULONG       EventId,
+    BOOL        PinEvent,
+    ULONG       PinId,
+    BOOL        NodeEvent,
+    ULONG       NodeId
+)
+/*++
+
+Routine Description:
+
+    Signals the matching events of the port event list.
+
+Arguments:
+
+    Set - event set
+
+    EventId - event id
+
+    PinEvent - TRUE if PinId is valid
+
+    PinId - pin of the event
+
+    NodeEvent - TRUE if NodeId is valid
+
+    NodeId - node of the event
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(m_PortEvents != NULL);
+
+    DPF_ENTER(("[%s]",__FUNCTION__));
+
+    m_PortEvents->GenerateEventList(
+        Set,
+        EventId,
+        PinEvent,
+        PinId,
+        NodeEvent,
+        NodeId);
+}
+
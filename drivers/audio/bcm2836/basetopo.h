@@ -66,6 +66,21 @@ class CMiniportTopologyRPIWAV
         _In_  PPCPROPERTY_REQUEST PropertyRequest
     );
 
+    NTSTATUS                    PropertyHandlerBasicSupportVolume
+    (
+        _In_  PPCPROPERTY_REQUEST PropertyRequest
+    );
+
+    NTSTATUS                    PropertyHandlerVolume
+    (
+        _In_  PPCPROPERTY_REQUEST PropertyRequest
+    );
+
+    NTSTATUS                    PropertyHandlerMute
+    (
+        _In_  PPCPROPERTY_REQUEST PropertyRequest
+    );
+
     NTSTATUS                    PropertyHandlerDevSpecific
     (
         _In_  PPCPROPERTY_REQUEST PropertyRequest
@@ -40,6 +40,9 @@ class CAdapterCommon :
 
         DWORD                   m_dwIdleRequests;
 
+        LONG                    m_MixerVolume[MIXER_MAX_CHANNELS];  // Volume node level in 1/65536 dB.
+        BOOL                    m_MixerMute[MIXER_MAX_CHANNELS];    // Mute node state.
+
     public:
         //=====================================================================
         // Default CUnknown
@@ -152,6 +155,28 @@ class CAdapterCommon :
             _In_        BOOL                Enabled
         );
 
+        STDMETHODIMP_(LONG)     MixerVolumeRead
+        (
+            _In_        ULONG               Channel
+        );
+
+        STDMETHODIMP_(VOID)     MixerVolumeWrite
+        (
+            _In_        ULONG               Channel,
+            _In_        LONG                Value
+        );
+
+        STDMETHODIMP_(BOOL)     MixerMuteRead
+        (
+            _In_        ULONG               Channel
+        );
+
+        STDMETHODIMP_(VOID)     MixerMuteWrite
+        (
+            _In_        ULONG               Channel,
+            _In_        BOOL                Value
+        );
+
         //=====================================================================
         // friends
         friend NTSTATUS         NewAdapterCommon
@@ -447,6 +472,12 @@ Return Value:
     m_PowerState            = PowerDeviceD0;
     m_pPortClsEtwHelper     = NULL;
 
+    for (ULONG channel = 0; channel < MIXER_MAX_CHANNELS; channel++)
+    {
+        m_MixerVolume[channel] = 0;
+        m_MixerMute[channel] = FALSE;
+    }
+
     InitializeListHead(&m_SubdeviceCache);
 
     //
@@ -1880,3 +1911,128 @@ Return Value:
     return ntStatus;
 }
 
+//=============================================================================
+#pragma code_seg()
+_Use_decl_annotations_
+STDMETHODIMP_(LONG)
+CAdapterCommon::MixerVolumeRead
+(
+    ULONG   Channel
+)
+/*++
+
+Routine Description:
+
+    Returns the level of the topology volume node. Called from the streams at
+    DISPATCH_LEVEL.
+
+Arguments:
+
+    Channel - mixer channel
+
+Return Value:
+
+    Volume level in 1/65536 dB
+
+--*/
+{
+    ASSERT(Channel < MIXER_MAX_CHANNELS);
+
+    return ReadNoFence((volatile LONG*)&m_MixerVolume[Channel]);
+}
+
+//=============================================================================
+#pragma code_seg()
+_Use_decl_annotations_
+STDMETHODIMP_(VOID)
+CAdapterCommon::MixerVolumeWrite
+(
+    ULONG   Channel,
+    LONG    Value
+)
+/*++
+
+Routine Description:
+
+    Stores the level of the topology volume node. The streams pick up the new
+    level with their next packet.
+
+Arguments:
+
+    Channel - mixer channel
+
+    Value - volume level in 1/65536 dB
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(Channel < MIXER_MAX_CHANNELS);
+
+    WriteNoFence((volatile LONG*)&m_MixerVolume[Channel], Value);
+}
+
+//=============================================================================
+#pragma code_seg()
+_Use_decl_annotations_
+STDMETHODIMP_(BOOL)
+CAdapterCommon::MixerMuteRead
+(
+    ULONG   Channel
+)
+/*++
+
+Routine Description:
+
+    Returns the state of the topology mute node. Called from the streams at
+    DISPATCH_LEVEL.
+
+Arguments:
+
+    Channel - mixer channel
+
+Return Value:
+
+    TRUE if muted
+
+--*/
+{
+    ASSERT(Channel < MIXER_MAX_CHANNELS);
+
+    return ReadNoFence((volatile LONG*)&m_MixerMute[Channel]);
+}
+
+//=============================================================================
+#pragma code_seg()
+_Use_decl_annotations_
+STDMETHODIMP_(VOID)
+CAdapterCommon::MixerMuteWrite
+(
+    ULONG   Channel,
+    BOOL    Value
+)
+/*++
+
+Routine Description:
+
+    Stores the state of the topology mute node.
+
+Arguments:
+
+    Channel - mixer channel
+
+    Value - TRUE to mute
+
+Return Value:
+
+    None
+
+--*/
+{
+    ASSERT(Channel < MIXER_MAX_CHANNELS);
+
+    WriteNoFence((volatile LONG*)&m_MixerMute[Channel], Value ? TRUE : FALSE);
+}
+
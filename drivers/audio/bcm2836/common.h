@@ -327,6 +327,32 @@ DECLARE_INTERFACE_(IAdapterCommon, IUnknown)
         _In_        PENDPOINT_MINIPAIR  MiniportPair,
         _In_        BOOL                Enable
     );
+
+    STDMETHOD_(LONG,            MixerVolumeRead)
+    (
+        THIS_
+        _In_        ULONG               Channel
+    );
+
+    STDMETHOD_(VOID,            MixerVolumeWrite)
+    (
+        THIS_
+        _In_        ULONG               Channel,
+        _In_        LONG                Value
+    );
+
+    STDMETHOD_(BOOL,            MixerMuteRead)
+    (
+        THIS_
+        _In_        ULONG               Channel
+    );
+
+    STDMETHOD_(VOID,            MixerMuteWrite)
+    (
+        THIS_
+        _In_        ULONG               Channel,
+        _In_        BOOL                Value
+    );
 };
 
 typedef IAdapterCommon *PADAPTERCOMMON;
@@ -0,0 +1,13 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Maps the MSVC ARM64 NEON header name to the GCC/Clang one, for building
+    the host-side tests natively on ARM64 hosts.
+
+--*/
+
+#pragma once
+
+#include <arm_neon.h>
@@ -0,0 +1,980 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Host-side simulation of the audio path, from the WaveRT packets to the
+    PWM output.
+
+    The PWM driver runs unmodified on the simulated DMA and PWM of
+    sim/pwmsim.cpp. CStreamModel plays the part of CMiniportWaveRTStream: it
+    initializes the audio DMA like SetState, and converts, drift corrects,
+    links and starts packets like SetWritePacket, AddPacketsToDma and
+    SetPacketDropCount, with the same ring protocol. The audio engine writes
+    a packet of a 1 kHz tone for every notification the stream signals,
+    after a wake latency with a random jitter.
+
+    --test checks that playback runs without underflows, recovers from an
+    underflow, and that the tone at the PWM output meets THD+N and SNR
+    limits, measured with an FFT over the captured PWM frames.
+
+    --bench reports the conversion, ISR and DPC cost and the underflows
+    under increasing wake jitter for both audio profiles.
+
+--*/
+
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <rpiwav.h>
+#include "pwmconvert.h"
+#include "pwmsim.h"
+
+#if defined(_M_ARM64)
+#include <arm64_neon.h>
+#elif defined(_M_ARM)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+#define STATUS_SUCCESS          ((NTSTATUS)0x00000000L)
+#define STATUS_DATA_OVERRUN     ((NTSTATUS)0xC000003CL)
+#define NT_SUCCESS(Status)      (((NTSTATUS)(Status)) >= 0)
+
+inline ULONG ReadULongAcquire(volatile ULONG* Source)
+{
+    return __atomic_load_n(Source, __ATOMIC_ACQUIRE);
+}
+
+inline VOID WriteULongRelease(volatile ULONG* Destination, ULONG Value)
+{
+    __atomic_store_n(Destination, Value, __ATOMIC_RELEASE);
+}
+
+inline VOID KeMemoryBarrier()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+//
+// The stream format of the simulation, 16 bit stereo in 10 ms packets with
+// two packets per WaveRT buffer. 48 kHz plays with a PWM range of 2084 and
+// drops a frame about every 65 ms. 32 kHz divides the PWM clock exactly,
+// its PWM range of 3125 plays the stream without any drift correction.
+//
+
+const ULONG DefaultSampleRate = 48000;
+const ULONG ExactSampleRate = 32000;
+const ULONG PacketMs = 10;
+const ULONG NotificationsPerBuffer = 2;
+
+const double ToneHz = 1000.0;
+const double ToneAmplitude = 0.5;
+
+//
+// Interrupt and DPC latency of the simulated system, and the time from a
+// notification to the audio engine writing the packet without jitter.
+//
+
+const PWMSIM_TIMING Timing = { 5000, 20000 };
+const ULONG WakeLatencyNs = 200000;
+
+const ULONGLONG NsPerSecond = 1000000000;
+const ULONGLONG NsPerMs = 1000000;
+
+const char* const ProfileNames[] = { "default", "low latency" };
+
+class CStreamModel
+{
+public:
+    CStreamModel();
+    ~CStreamModel();
+
+    NTSTATUS Open(BCM_PWM_AUDIO_PROFILE Profile, ULONG SampleRate, ULONG JitterNs);
+    VOID Close();
+
+    //
+    // The audio engine does not write packets until UntilNs.
+    //
+    VOID Stall(ULONGLONG UntilNs) { m_StallUntilNs = UntilNs; }
+
+    //
+    // Ramps the gain to 0, after the ramp the packets are converted with
+    // PwmConvertSilence.
+    //
+    VOID Mute();
+
+    const BCM_PWM_AUDIO_CONFIG& Config() const { return m_PwmAudioConfig; }
+    const PWM_RATE_MATCH& RateMatch() const { return m_PwmRateMatch; }
+    ULONG FramesPerPacket() const { return m_ulSamplesPerPacket / PWMCONVERT_CHANNELS; }
+    ULONG PwmFrameRate() const { return PWMFREQ / m_ulPwmRange; }
+
+    ULONG       m_Restarts;
+    ULONG       m_Overruns;
+    ULONG       m_PacketsTransferred;
+    ULONGLONG   m_ConvertCycles;
+    ULONGLONG   m_ConvertSamples;
+    ULONGLONG   m_SilenceCycles;
+    ULONGLONG   m_SilenceSamples;
+
+private:
+    static PWMSIM_CALLBACK OnNotification;
+    static PWMSIM_CALLBACK OnWake;
+
+    VOID ScheduleWake();
+    VOID WritePackets();
+    NTSTATUS SetWritePacket(ULONG PacketNumber);
+    VOID SetPacketDropCount(ULONG PacketNumber, ULONG DropCount);
+    VOID AddPacketsToDma(ULONG PacketNumber, ULONG PacketCount);
+    VOID RequestNextPacket();
+    VOID ConvertPCMToPWM(const INT16* InBuffer, PUINT32 OutBuffer, ULONG SampleCount);
+    VOID SilenceToPWM(PUINT32 OutBuffer, ULONG SampleCount);
+
+    ULONG                   m_ulSampleRate;
+    ULONG                   m_ulPwmRange;
+    ULONG                   m_ulSamplesPerPacket;
+    BCM_PWM_AUDIO_CONFIG    m_PwmAudioConfig;
+    PWM_CONVERT_STATE       m_PwmConvertState;
+    PWM_RATE_MATCH          m_PwmRateMatch;
+    BOOLEAN                 m_PwmRunning;
+    BOOLEAN                 m_RestartInProgress;
+    ULONG                   m_RestartPacketNumber;
+    PVOID                   m_NotificationEvent;
+
+    //
+    // Audio engine. The WaveRT buffer, the next packet number, the packets
+    // requested by notifications and not written yet, and the wake timing.
+    //
+    std::vector<INT16>      m_DataBuffer;
+    ULONG                   m_NextPacketNumber;
+    ULONG                   m_PendingPackets;
+    bool                    m_WakeScheduled;
+    ULONG                   m_JitterNs;
+    ULONGLONG               m_StallUntilNs;
+    UINT32                  m_Random;
+};
+
+CStreamModel::CStreamModel() :
+    m_Restarts(0),
+    m_Overruns(0),
+    m_PacketsTransferred(0),
+    m_ConvertCycles(0),
+    m_ConvertSamples(0),
+    m_SilenceCycles(0),
+    m_SilenceSamples(0),
+    m_ulSampleRate(0),
+    m_ulPwmRange(0),
+    m_ulSamplesPerPacket(0),
+    m_PwmRunning(FALSE),
+    m_RestartInProgress(FALSE),
+    m_RestartPacketNumber(0),
+    m_NotificationEvent(NULL),
+    m_NextPacketNumber(0),
+    m_PendingPackets(0),
+    m_WakeScheduled(false),
+    m_JitterNs(0),
+    m_StallUntilNs(0),
+    m_Random(0x2545F491)
+{
+    memset(&m_PwmAudioConfig, 0, sizeof(m_PwmAudioConfig));
+}
+
+CStreamModel::~CStreamModel()
+{
+    if (m_NotificationEvent)
+    {
+        PwmSimDeleteEvent(m_NotificationEvent);
+    }
+}
+
+//
+// KSSTATE_ACQUIRE and KSSTATE_RUN of SetState, then the engine writes the
+// first packet.
+//
+
+NTSTATUS CStreamModel::Open(BCM_PWM_AUDIO_PROFILE Profile, ULONG SampleRate, ULONG JitterNs)
+{
+    m_ulSampleRate = SampleRate;
+    m_ulPwmRange = PWMRANGE_FOR_RATE(SampleRate);
+    m_ulSamplesPerPacket = SampleRate * PacketMs / 1000 * PWMCONVERT_CHANNELS;
+    m_DataBuffer.resize(m_ulSamplesPerPacket * NotificationsPerBuffer);
+    m_JitterNs = JitterNs;
+    PwmConvertInitialize(&m_PwmConvertState, PwmSampleFormatPcm16, m_ulPwmRange, PWMCONVERT_DEFAULT_DITHER_MODE);
+    PwmRateMatchInitialize(&m_PwmRateMatch, SampleRate, m_ulPwmRange);
+
+    NTSTATUS status = PwmSimIoctl(IOCTL_BCM_PWM_AQUIRE_AUDIO, NULL, 0, NULL, 0);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    m_NotificationEvent = PwmSimCreateEvent(OnNotification, this);
+    status = PwmSimIoctl(IOCTL_BCM_PWM_REGISTER_AUDIO_NOTIFICATION, &m_NotificationEvent, sizeof(PVOID), NULL, 0);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    BCM_PWM_AUDIO_CONFIG audioConfig;
+    RtlZeroMemory(&audioConfig, sizeof(BCM_PWM_AUDIO_CONFIG));
+    audioConfig.RequestedBufferSize = m_ulSamplesPerPacket * PWMBYTESPERSAMPLE * NotificationsPerBuffer;
+    audioConfig.NotificationsPerBuffer = NotificationsPerBuffer;
+    audioConfig.PwmRange = m_ulPwmRange;
+    audioConfig.SampleRate = SampleRate;
+    audioConfig.Profile = Profile;
+    status = PwmSimIoctl(IOCTL_BCM_PWM_INITIALIZE_AUDIO, &audioConfig, sizeof(BCM_PWM_AUDIO_CONFIG), &m_PwmAudioConfig, sizeof(BCM_PWM_AUDIO_CONFIG));
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    if (m_PwmAudioConfig.DmaRing == NULL ||
+        m_PwmAudioConfig.DmaRing->Version != BCM_PWM_AUDIO_RING_VERSION ||
+        m_PwmAudioConfig.DmaRing->Size < sizeof(BCM_PWM_AUDIO_RING) ||
+        m_PwmAudioConfig.DmaRing->NumPackets != m_PwmAudioConfig.DmaNumPackets)
+    {
+        printf("  unsupported PWM audio ring\n");
+        return STATUS_DATA_OVERRUN;
+    }
+
+    m_PendingPackets = 1;
+    ScheduleWake();
+    return STATUS_SUCCESS;
+}
+
+//
+// KSSTATE_ACQUIRE from KSSTATE_PAUSE and the stream destruction.
+//
+
+VOID CStreamModel::Close()
+{
+    PwmSimIoctl(IOCTL_BCM_PWM_STOP_AUDIO, NULL, 0, NULL, 0);
+    PwmSimIoctl(IOCTL_BCM_PWM_RELEASE_AUDIO, NULL, 0, NULL, 0);
+    PwmSimIoctl(IOCTL_BCM_PWM_UNREGISTER_AUDIO_NOTIFICATION, &m_NotificationEvent, sizeof(PVOID), NULL, 0);
+    m_PwmRunning = FALSE;
+    m_PendingPackets = 0;
+}
+
+VOID CStreamModel::Mute()
+{
+    const LONG gain[PWMCONVERT_CHANNELS] = { 0, 0 };
+    PwmConvertSetGain(&m_PwmConvertState, gain, TRUE);
+}
+
+//
+// Every signal of the notification event asks the engine for a packet.
+// Signals are counted, up to the packets the DMA ring holds, and the engine
+// writes them after its wake latency.
+//
+
+VOID CStreamModel::OnNotification(PVOID Context)
+{
+    CStreamModel* stream = (CStreamModel*)Context;
+
+    if (stream->m_PendingPackets < stream->m_PwmAudioConfig.DmaNumPackets)
+    {
+        stream->m_PendingPackets++;
+    }
+    stream->ScheduleWake();
+}
+
+VOID CStreamModel::OnWake(PVOID Context)
+{
+    CStreamModel* stream = (CStreamModel*)Context;
+
+    stream->m_WakeScheduled = false;
+    if (PwmSimNow() < stream->m_StallUntilNs)
+    {
+        stream->ScheduleWake();
+        return;
+    }
+    stream->WritePackets();
+}
+
+VOID CStreamModel::ScheduleWake()
+{
+    if (m_WakeScheduled)
+    {
+        return;
+    }
+
+    ULONGLONG wakeNs = max(PwmSimNow(), m_StallUntilNs) + WakeLatencyNs;
+    if (m_JitterNs)
+    {
+        m_Random ^= m_Random << 13;
+        m_Random ^= m_Random >> 17;
+        m_Random ^= m_Random << 5;
+        wakeNs += m_Random % m_JitterNs;
+    }
+    m_WakeScheduled = true;
+    PwmSimSchedule(wakeNs, OnWake, this);
+}
+
+//
+// Writes the requested packets of the tone into the WaveRT buffer and hands
+// them to SetWritePacket. A packet the DMA ring has no room for stays
+// requested.
+//
+
+VOID CStreamModel::WritePackets()
+{
+    while (m_PendingPackets)
+    {
+        ULONG packetNumber = m_NextPacketNumber;
+        INT16* packet = &m_DataBuffer[(packetNumber % NotificationsPerBuffer) * m_ulSamplesPerPacket];
+        for (ULONG frame = 0; frame < FramesPerPacket(); frame++)
+        {
+            ULONGLONG streamFrame = (ULONGLONG)packetNumber * FramesPerPacket() + frame;
+            double phase = 2.0 * M_PI * fmod(streamFrame * ToneHz / m_ulSampleRate, 1.0);
+            INT16 sample = (INT16)lrint(ToneAmplitude * MAXSHORT * sin(phase));
+            packet[frame * PWMCONVERT_CHANNELS] = sample;
+            packet[frame * PWMCONVERT_CHANNELS + 1] = sample;
+        }
+
+        NTSTATUS status = SetWritePacket(packetNumber);
+        if (status == STATUS_DATA_OVERRUN)
+        {
+            m_Overruns++;
+            break;
+        }
+        m_NextPacketNumber++;
+        m_PendingPackets--;
+    }
+}
+
+//
+// CMiniportWaveRTStream::SetWritePacket, for full packets.
+//
+
+NTSTATUS CStreamModel::SetWritePacket(ULONG PacketNumber)
+{
+    NTSTATUS ntStatus = STATUS_SUCCESS;
+    ULONG orgPacketNumber = PacketNumber;
+    PBCM_PWM_AUDIO_RING ring = m_PwmAudioConfig.DmaRing;
+
+    if (m_RestartInProgress == FALSE && ReadULongAcquire(&ring->RestartRequestCount) != ring->RestartAckCount)
+    {
+        m_Restarts++;
+        m_PwmRunning = FALSE;
+        m_RestartPacketNumber = PacketNumber;
+        m_RestartInProgress = TRUE;
+
+        for (ULONG packetIndex = 0; packetIndex < m_PwmAudioConfig.DmaNumPackets; packetIndex++)
+        {
+            *(ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkPtr) = 0;
+        }
+        WriteULongRelease(&ring->ProducerIndex, ReadULongAcquire(&ring->ConsumerIndex));
+        PwmConvertReset(&m_PwmConvertState);
+
+        RequestNextPacket();
+
+        return ntStatus;
+    }
+
+    PacketNumber = PacketNumber - m_RestartPacketNumber;
+
+    if (ring->ProducerIndex - ReadULongAcquire(&ring->ConsumerIndex) == m_PwmAudioConfig.DmaNumPackets)
+    {
+        return STATUS_DATA_OVERRUN;
+    }
+
+    ULONG packetBaseIndex;
+    ULONG dmaPacketBaseIndex;
+    if (!m_PwmRunning)
+    {
+        ULONG packetIndex = 0;
+        while (packetIndex < PacketNumber && packetIndex < m_PwmAudioConfig.DmaNumPackets - 1)
+        {
+            dmaPacketBaseIndex = (packetIndex % m_PwmAudioConfig.DmaNumPackets) * m_ulSamplesPerPacket;
+            SilenceToPWM((PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex, m_ulSamplesPerPacket);
+            SetPacketDropCount(packetIndex, 0);
+            packetIndex++;
+        }
+        if (packetIndex)
+        {
+            AddPacketsToDma(0, packetIndex);
+        }
+
+        WriteULongRelease(&ring->PrimeAckIndex,
+            ReadULongAcquire(&ring->PrimeRequestIndex) - min(ring->QueueDepth, m_PwmAudioConfig.DmaNumPackets / 2));
+    }
+
+    packetBaseIndex = (orgPacketNumber % NotificationsPerBuffer) * m_ulSamplesPerPacket;
+    dmaPacketBaseIndex = (PacketNumber % m_PwmAudioConfig.DmaNumPackets) * m_ulSamplesPerPacket;
+
+    ConvertPCMToPWM(&m_DataBuffer[packetBaseIndex], (PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex, m_ulSamplesPerPacket);
+
+    ULONG chunkFrameCount = m_PwmAudioConfig.DmaPacketLinkInfo[PacketNumber % m_PwmAudioConfig.DmaNumPackets].LengthValue / (PWMBYTESPERSAMPLE * PWMCONVERT_CHANNELS);
+    ULONG dropCount = PwmRateMatchAdvance(&m_PwmRateMatch, m_ulSamplesPerPacket / PWMCONVERT_CHANNELS, chunkFrameCount / 2);
+    PwmRateMatchInterpolate(&m_PwmRateMatch, (PUINT32)m_PwmAudioConfig.DmaBuffer + dmaPacketBaseIndex,
+        m_ulSamplesPerPacket / PWMCONVERT_CHANNELS, chunkFrameCount, dropCount);
+
+    SetPacketDropCount(PacketNumber, dropCount);
+    AddPacketsToDma(PacketNumber, 1);
+    m_PacketsTransferred++;
+
+    ULONG primeRequestIndex = ReadULongAcquire(&ring->PrimeRequestIndex);
+    while (ring->PrimeAckIndex != primeRequestIndex)
+    {
+        WriteULongRelease(&ring->PrimeAckIndex, ring->PrimeAckIndex + 1);
+        RequestNextPacket();
+    }
+
+    if (!m_PwmRunning)
+    {
+        if (m_RestartInProgress)
+        {
+            m_RestartInProgress = FALSE;
+            WriteULongRelease(&ring->RestartAckCount, ReadULongAcquire(&ring->RestartRequestCount));
+        }
+
+        ntStatus = PwmSimIoctl(IOCTL_BCM_PWM_START_AUDIO, NULL, 0, NULL, 0);
+        if (!NT_SUCCESS(ntStatus))
+        {
+            printf("  could not start PWM audio DMA (0x%X)\n", (ULONG)ntStatus);
+        }
+        m_PwmRunning = TRUE;
+    }
+
+    return ntStatus;
+}
+
+VOID CStreamModel::SetPacketDropCount(ULONG PacketNumber, ULONG DropCount)
+{
+    ULONG packetIndex = PacketNumber%m_PwmAudioConfig.DmaNumPackets;
+
+    *((ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LengthPtr)) =
+        m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LengthValue - DropCount * PWMBYTESPERSAMPLE * PWMCONVERT_CHANNELS;
+}
+
+VOID CStreamModel::AddPacketsToDma(ULONG PacketNumber, ULONG PacketCount)
+{
+    PBCM_PWM_AUDIO_RING ring = m_PwmAudioConfig.DmaRing;
+
+    ASSERT(PacketCount > 0 && PacketCount <= m_PwmAudioConfig.DmaNumPackets);
+
+    for (ULONG ul = PacketCount; ul > 0; ul--)
+    {
+        ULONG packetIndex = (PacketNumber + ul - 1) % m_PwmAudioConfig.DmaNumPackets;
+
+        if (ul == 1)
+        {
+            KeMemoryBarrier();
+        }
+
+        *((ULONG *)(m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkPtr)) = m_PwmAudioConfig.DmaPacketLinkInfo[packetIndex].LinkValue;
+    }
+
+    WriteULongRelease(&ring->ProducerIndex, ring->ProducerIndex + PacketCount);
+}
+
+VOID CStreamModel::RequestNextPacket()
+{
+    OnNotification(this);
+}
+
+VOID CStreamModel::ConvertPCMToPWM(const INT16* InBuffer, PUINT32 OutBuffer, ULONG SampleCount)
+{
+    if (PwmConvertIsMuted(&m_PwmConvertState))
+    {
+        SilenceToPWM(OutBuffer, SampleCount);
+        return;
+    }
+
+    ULONGLONG start = PwmSimReadCycles();
+    PwmConvert(&m_PwmConvertState, InBuffer, OutBuffer, SampleCount);
+    m_ConvertCycles += PwmSimReadCycles() - start;
+    m_ConvertSamples += SampleCount;
+}
+
+VOID CStreamModel::SilenceToPWM(PUINT32 OutBuffer, ULONG SampleCount)
+{
+    ULONGLONG start = PwmSimReadCycles();
+    PwmConvertSilence(&m_PwmConvertState, OutBuffer, SampleCount);
+    m_SilenceCycles += PwmSimReadCycles() - start;
+    m_SilenceSamples += SampleCount;
+}
+
+//
+// Spectrum analysis of the captured PWM output.
+//
+
+VOID Fft(std::vector<std::complex<double>>& Data)
+{
+    size_t count = Data.size();
+
+    for (size_t i = 1, j = 0; i < count; i++)
+    {
+        size_t bit = count >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j)
+        {
+            std::swap(Data[i], Data[j]);
+        }
+    }
+
+    for (size_t length = 2; length <= count; length <<= 1)
+    {
+        std::complex<double> step = std::polar(1.0, -2.0 * M_PI / length);
+        for (size_t block = 0; block < count; block += length)
+        {
+            std::complex<double> twiddle = 1.0;
+            for (size_t k = 0; k < length / 2; k++)
+            {
+                std::complex<double> even = Data[block + k];
+                std::complex<double> odd = Data[block + k + length / 2] * twiddle;
+                Data[block + k] = even + odd;
+                Data[block + k + length / 2] = even - odd;
+                twiddle *= step;
+            }
+        }
+    }
+}
+
+struct TONE_QUALITY
+{
+    double  ToneHz;
+    double  ThdNDb;
+    double  SnrDb;
+};
+
+//
+// THD+N and SNR of one channel over the audio band, 20 Hz to 20 kHz, with a
+// 4 term Blackman-Harris window. The tone is the peak and the bins of its
+// main lobe. THD+N counts everything else in the band. SNR also leaves out
+// the harmonics up to the 10th.
+//
+
+const ULONG FftSize = 65536;
+const LONG LobeBins = 6;
+
+TONE_QUALITY MeasureTone(const std::vector<UINT32>& Capture, ULONG Channel, ULONG PwmRange)
+{
+    double frameRate = (double)PWMFREQ / PwmRange;
+    std::vector<std::complex<double>> data(FftSize);
+
+    for (ULONG frame = 0; frame < FftSize; frame++)
+    {
+        double x = 2.0 * M_PI * frame / FftSize;
+        double window = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+        double value = (double)Capture[frame * PWMCONVERT_CHANNELS + Channel] / PwmRange - 0.5;
+        data[frame] = value * window;
+    }
+    Fft(data);
+
+    double binHz = frameRate / FftSize;
+    LONG firstBin = (LONG)ceil(20.0 / binHz);
+    LONG lastBin = min((LONG)floor(20000.0 / binHz), (LONG)(FftSize / 2 - 1));
+
+    std::vector<double> power(FftSize / 2);
+    LONG peak = firstBin;
+    for (LONG bin = firstBin; bin <= lastBin; bin++)
+    {
+        power[bin] = std::norm(data[bin]);
+        if (power[bin] > power[peak])
+        {
+            peak = bin;
+        }
+    }
+
+    double tone = 0;
+    double noiseAndDistortion = 0;
+    double noise = 0;
+    for (LONG bin = firstBin; bin <= lastBin; bin++)
+    {
+        if (labs(bin - peak) <= LobeBins)
+        {
+            tone += power[bin];
+            continue;
+        }
+        noiseAndDistortion += power[bin];
+
+        bool harmonic = false;
+        for (LONG order = 2; order <= 10; order++)
+        {
+            harmonic = harmonic || (labs(bin - order * peak) <= LobeBins);
+        }
+        if (!harmonic)
+        {
+            noise += power[bin];
+        }
+    }
+
+    TONE_QUALITY quality;
+    quality.ToneHz = peak * binHz;
+    quality.ThdNDb = 10.0 * log10(noiseAndDistortion / tone);
+    quality.SnrDb = 10.0 * log10(tone / noise);
+    return quality;
+}
+
+//
+// Harness helpers.
+//
+
+bool CreateDevice()
+{
+    if (!NT_SUCCESS(PwmSimCreate(&Timing)))
+    {
+        printf("  could not create the simulated device\n");
+        return false;
+    }
+    return true;
+}
+
+bool CheckAssertions()
+{
+    PWMSIM_STATS stats;
+    PwmSimGetStats(&stats);
+    if (stats.AssertionCount)
+    {
+        printf("  %u driver assertions failed\n", stats.AssertionCount);
+        return false;
+    }
+    return true;
+}
+
+//
+// Plays 3 seconds without jitter. There must be no restart, no missed PWM
+// frame, and every packet written must be played or queued, less the frames
+// dropped by the drift correction.
+//
+
+bool TestPlayback(BCM_PWM_AUDIO_PROFILE Profile)
+{
+    if (!CreateDevice())
+    {
+        return false;
+    }
+
+    bool pass = true;
+    CStreamModel stream;
+    if (!NT_SUCCESS(stream.Open(Profile, DefaultSampleRate, 0)))
+    {
+        PwmSimDestroy();
+        return false;
+    }
+    PwmSimRun(3 * NsPerSecond);
+
+    PWMSIM_STATS stats;
+    PwmSimGetStats(&stats);
+    ULONGLONG framesQueued = stream.RateMatch().FramesIn - stream.RateMatch().FramesDropped - stats.FramesPlayed;
+    ULONGLONG maxFramesQueued = (ULONGLONG)(stream.Config().DmaNumPackets + 1) * stream.FramesPerPacket();
+
+    printf("  %s: %u packets of %u, queue depth %u, %llu frames played, %llu queued, %llu ISRs\n",
+        ProfileNames[Profile], stream.m_PacketsTransferred, stream.Config().DmaNumPackets,
+        stream.Config().DmaRing->QueueDepth, (unsigned long long)stats.FramesPlayed,
+        (unsigned long long)framesQueued, (unsigned long long)stats.IsrCount);
+
+    if (stream.m_Restarts || stats.DriverUnderflows || stats.FramesMissed || stats.DmaStops)
+    {
+        printf("  %u restarts, %u underflows, %llu frames missed, %llu DMA stops\n",
+            stream.m_Restarts, stats.DriverUnderflows, (unsigned long long)stats.FramesMissed,
+            (unsigned long long)stats.DmaStops);
+        pass = false;
+    }
+    if ((stats.FramesPlayed < 2 * stream.PwmFrameRate()) || (framesQueued > maxFramesQueued))
+    {
+        printf("  frames played and queued do not match the frames written\n");
+        pass = false;
+    }
+
+    pass = CheckAssertions() && pass;
+    stream.Close();
+    PwmSimDestroy();
+    return pass;
+}
+
+//
+// The audio engine stalls for longer than the DMA ring lasts. The driver
+// must detect the underflow, the stream must restart, and play the last
+// second without a missed frame.
+//
+
+bool TestRecovery(BCM_PWM_AUDIO_PROFILE Profile)
+{
+    if (!CreateDevice())
+    {
+        return false;
+    }
+
+    bool pass = true;
+    CStreamModel stream;
+    if (!NT_SUCCESS(stream.Open(Profile, DefaultSampleRate, 0)))
+    {
+        PwmSimDestroy();
+        return false;
+    }
+    PwmSimRun(NsPerSecond);
+    stream.Stall(PwmSimNow() + 500 * NsPerMs);
+    PwmSimRun(NsPerSecond);
+
+    PWMSIM_STATS before;
+    PwmSimGetStats(&before);
+    PwmSimRun(NsPerSecond);
+    PWMSIM_STATS after;
+    PwmSimGetStats(&after);
+
+    ULONGLONG framesPlayed = after.FramesPlayed - before.FramesPlayed;
+    ULONGLONG framesMissed = after.FramesMissed - before.FramesMissed;
+    PBCM_PWM_AUDIO_RING ring = stream.Config().DmaRing;
+
+    printf("  %s: %u restarts, %u underflows, %llu frames missed in the stall, %llu played and %llu missed after\n",
+        ProfileNames[Profile], stream.m_Restarts, after.DriverUnderflows,
+        (unsigned long long)before.FramesMissed, (unsigned long long)framesPlayed,
+        (unsigned long long)framesMissed);
+
+    if (!stream.m_Restarts || !after.DriverUnderflows || (ring->RestartAckCount != ring->RestartRequestCount))
+    {
+        printf("  underflow not detected or restart not acknowledged\n");
+        pass = false;
+    }
+    if (framesMissed || (framesPlayed < stream.PwmFrameRate() - 1))
+    {
+        printf("  playback did not recover\n");
+        pass = false;
+    }
+
+    pass = CheckAssertions() && pass;
+    stream.Close();
+    PwmSimDestroy();
+    return pass;
+}
+
+//
+// Captures the PWM output after a second of playback and measures the tone.
+// At the exact rate the figures are those of the TPDF dithered conversion.
+// At 44.1 and 48 kHz the packets are linearly interpolated to the PWM rate,
+// which spreads each dropped frame over the frames up to the next drop. The
+// interpolation error and the rounding of the interpolated PWM values cost
+// about 4 dB. The limits leave a few dB of room below the simulated figures.
+//
+
+struct TONE_LIMITS
+{
+    ULONG   SampleRate;
+    double  MaxThdNDb;
+    double  MinSnrDb;
+};
+
+const TONE_LIMITS ToneLimits[] =
+{
+    { ExactSampleRate, -55.0, 55.0 },
+    { 44100, -53.0, 53.0 },
+    { DefaultSampleRate, -53.0, 53.0 },
+};
+
+bool TestToneQuality(const TONE_LIMITS& Limits)
+{
+    if (!CreateDevice())
+    {
+        return false;
+    }
+
+    bool pass = true;
+    CStreamModel stream;
+    if (!NT_SUCCESS(stream.Open(BCM_PWM_AUDIO_PROFILE_DEFAULT, Limits.SampleRate, 0)))
+    {
+        PwmSimDestroy();
+        return false;
+    }
+    PwmSimRun(NsPerSecond);
+
+    std::vector<UINT32> capture;
+    PwmSimCapture(&capture);
+    PwmSimRun(3 * NsPerSecond);
+    PwmSimCapture(NULL);
+
+    PWMSIM_STATS stats;
+    PwmSimGetStats(&stats);
+    if (stats.FramesMissed || (capture.size() < FftSize * PWMCONVERT_CHANNELS))
+    {
+        printf("  %llu frames missed, %zu frames captured\n",
+            (unsigned long long)stats.FramesMissed, capture.size() / PWMCONVERT_CHANNELS);
+        pass = false;
+    }
+    else
+    {
+        for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+        {
+            TONE_QUALITY quality = MeasureTone(capture, channel, PWMRANGE_FOR_RATE(Limits.SampleRate));
+            printf("  %u Hz, %llu frames dropped, channel %u: %.1f Hz tone at %.1f dBFS, THD+N %.1f dB, SNR %.1f dB\n",
+                Limits.SampleRate, (unsigned long long)stream.RateMatch().FramesDropped, channel,
+                quality.ToneHz, 20.0 * log10(ToneAmplitude), quality.ThdNDb, quality.SnrDb);
+            if ((fabs(quality.ToneHz - ToneHz) > 2.0) || (quality.ThdNDb > Limits.MaxThdNDb) || (quality.SnrDb < Limits.MinSnrDb))
+            {
+                pass = false;
+            }
+        }
+    }
+
+    pass = CheckAssertions() && pass;
+    stream.Close();
+    PwmSimDestroy();
+    return pass;
+}
+
+//
+// Conversion cost of the stream path, 2 seconds of the tone and 2 seconds
+// after a mute, and the ISR and DPC cost per call.
+//
+
+VOID BenchmarkCost()
+{
+#if defined(PWMTEST_NEON_EMULATED)
+    const char* neon = "emulated, PwmConvert timings are not representative";
+#elif defined(_M_ARM) || defined(_M_ARM64)
+    const char* neon = "native";
+#else
+    const char* neon = "not built, PwmConvert runs the reference code";
+#endif
+
+    if (!CreateDevice())
+    {
+        return;
+    }
+
+    CStreamModel stream;
+    if (NT_SUCCESS(stream.Open(BCM_PWM_AUDIO_PROFILE_DEFAULT, DefaultSampleRate, 0)))
+    {
+        PwmSimRun(2 * NsPerSecond);
+        stream.Mute();
+        PwmSimRun(2 * NsPerSecond);
+
+        PWMSIM_STATS stats;
+        PwmSimGetStats(&stats);
+        const char* unit = PwmSimCycleUnit();
+
+        printf("16 bit PCM, %u Hz stereo, %u ms packets, NEON %s\n", DefaultSampleRate, PacketMs, neon);
+        printf("PwmConvert        %8.2f %s/sample\n",
+            (double)stream.m_ConvertCycles / max(stream.m_ConvertSamples, 1ULL), unit);
+        printf("PwmConvertSilence %8.2f %s/sample\n",
+            (double)stream.m_SilenceCycles / max(stream.m_SilenceSamples, 1ULL), unit);
+        printf("DmaIsr            %8.0f %s/call, max %llu, %llu calls\n",
+            (double)stats.IsrCycles / max(stats.IsrCount, 1ULL), unit,
+            (unsigned long long)stats.IsrMaxCycles, (unsigned long long)stats.IsrCount);
+        printf("DmaDpc            %8.0f %s/call, %llu calls\n",
+            (double)stats.DpcCycles / max(stats.DpcCount, 1ULL), unit, (unsigned long long)stats.DpcCount);
+        stream.Close();
+    }
+    PwmSimDestroy();
+}
+
+//
+// Underflows of 10 seconds of playback, with the wake of the audio engine
+// delayed by up to the jitter after every notification.
+//
+
+VOID BenchmarkJitter()
+{
+    const ULONG jitterMs[] = { 0, 1, 5, 10, 20, 50, 100, 200 };
+
+    printf("\n%-12s %10s %9s %11s %14s %9s\n",
+        "profile", "jitter ms", "restarts", "underflows", "frames missed", "overruns");
+
+    for (ULONG profile = BCM_PWM_AUDIO_PROFILE_DEFAULT; profile <= BCM_PWM_AUDIO_PROFILE_LOW_LATENCY; profile++)
+    {
+        for (ULONG jitter : jitterMs)
+        {
+            if (!CreateDevice())
+            {
+                return;
+            }
+
+            CStreamModel stream;
+            if (NT_SUCCESS(stream.Open((BCM_PWM_AUDIO_PROFILE)profile, DefaultSampleRate, jitter * (ULONG)NsPerMs)))
+            {
+                PwmSimRun(10 * NsPerSecond);
+
+                PWMSIM_STATS stats;
+                PwmSimGetStats(&stats);
+                printf("%-12s %10u %9u %11u %14llu %9u\n",
+                    ProfileNames[profile], jitter, stream.m_Restarts, stats.DriverUnderflows,
+                    (unsigned long long)stats.FramesMissed, stream.m_Overruns);
+                stream.Close();
+            }
+            PwmSimDestroy();
+        }
+    }
+}
+
+void Usage()
+{
+    printf(
+        "usage: audiosim [--test] [--bench] [--trace LEVEL]\n"
+        "  --test          playback, underflow recovery and tone quality\n"
+        "  --bench         conversion, ISR and DPC cost, underflows under jitter\n"
+        "  --trace LEVEL   print the PWM driver traces up to LEVEL\n");
+}
+
+} // namespace
+
+int main(int Argc, char** Argv)
+{
+    bool test = false;
+    bool bench = false;
+
+    for (int arg = 1; arg < Argc; arg++)
+    {
+        if (strcmp(Argv[arg], "--test") == 0)
+        {
+            test = true;
+        }
+        else if (strcmp(Argv[arg], "--bench") == 0)
+        {
+            bench = true;
+        }
+        else if ((strcmp(Argv[arg], "--trace") == 0) && (arg + 1 < Argc))
+        {
+            PwmSimSetTraceLevel(strtoul(Argv[++arg], nullptr, 0));
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (!test && !bench)
+    {
+        test = true;
+    }
+
+    bool pass = true;
+    if (test)
+    {
+        for (ULONG profile = BCM_PWM_AUDIO_PROFILE_DEFAULT; profile <= BCM_PWM_AUDIO_PROFILE_LOW_LATENCY; profile++)
+        {
+            bool result = TestPlayback((BCM_PWM_AUDIO_PROFILE)profile);
+            printf("%s: %s playback\n", result ? "PASS" : "FAIL", ProfileNames[profile]);
+            pass = pass && result;
+
+            result = TestRecovery((BCM_PWM_AUDIO_PROFILE)profile);
+            printf("%s: %s underflow recovery\n", result ? "PASS" : "FAIL", ProfileNames[profile]);
+            pass = pass && result;
+        }
+
+        for (const TONE_LIMITS& limits : ToneLimits)
+        {
+            bool result = TestToneQuality(limits);
+            printf("%s: %u Hz tone quality\n", result ? "PASS" : "FAIL", limits.SampleRate);
+            pass = pass && result;
+        }
+    }
+    if (bench)
+    {
+        BenchmarkCost();
+        BenchmarkJitter();
+    }
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,295 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Host-side simulation of the drift correction in pwmconvert.cpp.
+
+    The PWM plays PWMFREQ / PwmRange frames per second, slightly slower than
+    the stream rate, and the audio driver drops frames at the end of the
+    first chunk of a packet to keep up. The simulation feeds hours of
+    packets through PwmRateMatchAdvance the way
+    CMiniportWaveRTStream::WriteBytes does, accounts the frames the DMA
+    plays, and checks after every packet that the time the PWM has played
+    stays within one PWM frame of the time the stream delivered.
+
+    It also checks that PwmRateMatchInterpolate resamples the packets to the
+    PWM frames in the order the DMA plays them.
+
+--*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <rpiwav.h>
+#include "pwmconvert.h"
+
+namespace
+{
+
+const ULONG SampleRates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000 };
+
+//
+// Packet lengths in ms. WaveRT notifies every 10 ms by default, the short
+// packets have the smallest first chunks and drop limits.
+//
+
+const ULONG PacketMs[] = { 10, 1 };
+
+//
+// Length of the last chunk of a packet in bytes, AUDIO_PACKET_LAST_CHUNK_SIZE
+// of the PWM driver. The drops are done in the first chunk.
+//
+
+const ULONG LastChunkBytes = 32;
+
+struct DriftResult
+{
+    ULONGLONG   Packets;
+    ULONGLONG   FramesIn;
+    ULONGLONG   FramesDropped;
+    ULONGLONG   MaxPending;
+    double      MaxErrorFrames;
+};
+
+//
+// Plays Seconds of a stream in packets of PacketFrames frames.
+//
+// The error is the difference between the stream time delivered and the
+// time the PWM has played, in frames of the PWM:
+//
+//     (FramesIn / SampleRate - FramesPlayed * PwmRange / PWMFREQ) * PWMFREQ / PwmRange
+//
+// It is computed exactly in units of 1 / (SampleRate * PwmRange) frames. A
+// PWM frame is slightly longer than a stream frame, by at most 0.01% at the
+// supported rates.
+//
+
+bool SimulateDrift(ULONG SampleRate, ULONG PacketFrames, ULONG Seconds, DriftResult* Result)
+{
+    ULONG pwmRange = PWMRANGE_FOR_RATE(SampleRate);
+    ULONG packetBytes = PacketFrames * PWMCONVERT_CHANNELS * PWMBYTESPERSAMPLE;
+    ULONG chunkFrameCount = (packetBytes - LastChunkBytes) / (PWMBYTESPERSAMPLE * PWMCONVERT_CHANNELS);
+    ULONGLONG packetCount = (ULONGLONG)SampleRate * Seconds / PacketFrames;
+
+    PWM_RATE_MATCH rateMatch;
+    PwmRateMatchInitialize(&rateMatch, SampleRate, pwmRange);
+
+    ULONGLONG framesPlayed = 0;
+    ULONGLONG pending = 0;
+    ULONGLONG maxError = 0;
+
+    memset(Result, 0, sizeof(*Result));
+
+    for (ULONGLONG packet = 0; packet < packetCount; packet++)
+    {
+        ULONG dropCount = PwmRateMatchAdvance(&rateMatch, PacketFrames, chunkFrameCount / 2);
+        if (dropCount >= chunkFrameCount)
+        {
+            printf("  packet %llu drops %u of a %u frame chunk\n",
+                (unsigned long long)packet, dropCount, chunkFrameCount);
+            return false;
+        }
+
+        framesPlayed += PacketFrames - dropCount;
+
+        LONGLONG error = (LONGLONG)(rateMatch.FramesIn * PWMFREQ) -
+            (LONGLONG)(framesPlayed * pwmRange * SampleRate);
+        if ((error <= -(LONGLONG)rateMatch.Period) || (error >= (LONGLONG)rateMatch.Period))
+        {
+            printf("  packet %llu error %.6f frames\n",
+                (unsigned long long)packet, (double)error / rateMatch.Period);
+            return false;
+        }
+
+        if ((ULONGLONG)llabs(error) > maxError)
+        {
+            maxError = (ULONGLONG)llabs(error);
+        }
+
+        pending = rateMatch.Phase / rateMatch.Period;
+        if (pending > Result->MaxPending)
+        {
+            Result->MaxPending = pending;
+        }
+    }
+
+    //
+    // The phase is the remaining error, so the drift correction state and
+    // the frames played must agree.
+    //
+
+    if (rateMatch.FramesIn - rateMatch.FramesDropped != framesPlayed)
+    {
+        printf("  %llu frames played, rate matching accounts %llu\n",
+            (unsigned long long)framesPlayed,
+            (unsigned long long)(rateMatch.FramesIn - rateMatch.FramesDropped));
+        return false;
+    }
+
+    Result->Packets = packetCount;
+    Result->FramesIn = rateMatch.FramesIn;
+    Result->FramesDropped = rateMatch.FramesDropped;
+    Result->MaxErrorFrames = (double)maxError / rateMatch.Period;
+    return true;
+}
+
+bool TestDrift(ULONG Seconds)
+{
+    bool pass = true;
+
+    printf("%-6s %-7s %10s %14s %10s %8s %13s\n",
+        "rate", "packet", "range", "frames", "dropped", "pending", "max error");
+
+    for (ULONG rate : SampleRates)
+    {
+        for (ULONG packetMs : PacketMs)
+        {
+            ULONG packetFrames = rate * packetMs / 1000;
+            DriftResult result;
+
+            if (!SimulateDrift(rate, packetFrames, Seconds, &result))
+            {
+                printf("FAIL: %u Hz, %u ms packets\n", rate, packetMs);
+                pass = false;
+                continue;
+            }
+
+            printf("%-6u %4u ms %10u %14llu %10llu %8llu %13.9f\n",
+                rate, packetMs, (ULONG)PWMRANGE_FOR_RATE(rate),
+                (unsigned long long)result.FramesIn,
+                (unsigned long long)result.FramesDropped,
+                (unsigned long long)result.MaxPending,
+                result.MaxErrorFrames);
+        }
+    }
+
+    return pass;
+}
+
+//
+// A ramp of one PWM LSB per stream frame runs through the packets of half a
+// second, which stays within the PWM range. Linear interpolation is exact on it, so each PWM frame the DMA
+// plays is the ramp one frame back from its stream position, within the
+// rounding to a PWM value. The first PWM frame has no earlier stream frame.
+// Exact rates play the ramp unchanged.
+//
+
+bool TestInterpolate(ULONG SampleRate, ULONG PacketFrames)
+{
+    ULONG pwmRange = PWMRANGE_FOR_RATE(SampleRate);
+    ULONG packetBytes = PacketFrames * PWMCONVERT_CHANNELS * PWMBYTESPERSAMPLE;
+    ULONG chunkFrameCount = (packetBytes - LastChunkBytes) / (PWMBYTESPERSAMPLE * PWMCONVERT_CHANNELS);
+    ULONG packetCount = SampleRate / 2 / PacketFrames;
+
+    PWM_RATE_MATCH rateMatch;
+    PwmRateMatchInitialize(&rateMatch, SampleRate, pwmRange);
+
+    std::vector<UINT32> buffer(PacketFrames * PWMCONVERT_CHANNELS);
+    ULONGLONG framesPlayed = 0;
+
+    for (ULONG packet = 0; packet < packetCount; packet++)
+    {
+        for (ULONG frame = 0; frame < PacketFrames; frame++)
+        {
+            for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+            {
+                buffer[frame * PWMCONVERT_CHANNELS + channel] = 100 * (channel + 1) + packet * PacketFrames + frame;
+            }
+        }
+
+        ULONG dropCount = PwmRateMatchAdvance(&rateMatch, PacketFrames, chunkFrameCount / 2);
+        PwmRateMatchInterpolate(&rateMatch, buffer.data(), PacketFrames, chunkFrameCount, dropCount);
+
+        for (ULONG frame = 0; frame < PacketFrames; frame++, framesPlayed++)
+        {
+            if ((frame >= chunkFrameCount - dropCount) && (frame < chunkFrameCount))
+            {
+                frame = chunkFrameCount;
+            }
+
+            double position = (double)framesPlayed * rateMatch.Period / PWMFREQ - ((rateMatch.Step != 0) ? 1.0 : 0.0);
+            if (position < 0.0)
+            {
+                continue;
+            }
+
+            for (ULONG channel = 0; channel < PWMCONVERT_CHANNELS; channel++)
+            {
+                double expected = 100.0 * (channel + 1) + position;
+                double sample = buffer[frame * PWMCONVERT_CHANNELS + channel];
+                if (fabs(sample - expected) > 0.5 + 1e-6)
+                {
+                    printf("FAIL: %u Hz, %u frame packets, packet %u frame %u channel %u is %.0f, expected %.3f\n",
+                        SampleRate, PacketFrames, packet, frame, channel, sample, expected);
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (framesPlayed != rateMatch.FramesIn - rateMatch.FramesDropped)
+    {
+        printf("FAIL: %u Hz, %u frame packets, %llu frames played, %llu expected\n",
+            SampleRate, PacketFrames, (unsigned long long)framesPlayed,
+            (unsigned long long)(rateMatch.FramesIn - rateMatch.FramesDropped));
+        return false;
+    }
+
+    return true;
+}
+
+void Usage()
+{
+    printf(
+        "usage: driftsim [--seconds N]\n"
+        "  --seconds N   playback time simulated at each rate, default 10800\n");
+}
+
+} // namespace
+
+int main(int Argc, char** Argv)
+{
+    ULONG seconds = 3 * 60 * 60;
+
+    for (int arg = 1; arg < Argc; arg++)
+    {
+        if ((strcmp(Argv[arg], "--seconds") == 0) && (arg + 1 < Argc))
+        {
+            seconds = strtoul(Argv[++arg], nullptr, 0);
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    bool pass = true;
+    for (ULONG rate : SampleRates)
+    {
+        for (ULONG packetMs : PacketMs)
+        {
+            pass = TestInterpolate(rate, rate * packetMs / 1000) && pass;
+        }
+    }
+    if (pass)
+    {
+        printf("PASS: interpolation\n");
+    }
+
+    printf("%u seconds of playback per rate and packet length\n", seconds);
+    if (TestDrift(seconds))
+    {
+        printf("PASS: drift below one frame\n");
+    }
+    else
+    {
+        pass = false;
+    }
+
+    return pass ? 0 : 1;
+}
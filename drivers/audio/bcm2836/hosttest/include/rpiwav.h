@@ -0,0 +1,97 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Host stand-in for rpiwav.h. Provides the basic types, SAL annotations and
+    runtime routines the portable parts of the audio path use, so they build
+    as user-mode code for the host-side tests.
+
+--*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+//
+// Windows types, LONG and ULONG are 32 bit like on Windows.
+//
+
+typedef void                VOID;
+typedef void*               PVOID;
+typedef int8_t              CHAR;
+typedef uint8_t             UCHAR;
+typedef int16_t             SHORT;
+typedef uint16_t            USHORT;
+typedef int16_t             INT16;
+typedef int32_t             INT32;
+typedef int32_t             LONG;
+typedef uint32_t            ULONG;
+typedef uint32_t            UINT32;
+typedef uint32_t            DWORD;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef uint8_t             BOOLEAN;
+typedef LONG                NTSTATUS;
+typedef LONG*               PLONG;
+typedef ULONG*              PULONG;
+typedef UINT32*             PUINT32;
+typedef INT16*              PINT16;
+typedef UCHAR*              PUCHAR;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+#define TRUE                1
+#define FALSE               0
+#define MAXSHORT            0x7FFF
+#define MAXLONG             0x7FFFFFFF
+#define ARRAYSIZE(a)        (sizeof(a) / sizeof((a)[0]))
+
+#ifndef min
+#define min(a, b)           (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)           (((a) > (b)) ? (a) : (b))
+#endif
+
+#define __forceinline       inline __attribute__((always_inline))
+#define DECLSPEC_ALIGN(x)   __attribute__((aligned(x)))
+
+#define ASSERT(e)           assert(e)
+#define RtlCopyMemory(d, s, l)  memcpy((d), (s), (l))
+#define RtlZeroMemory(d, l)     memset((d), 0, (l))
+
+//
+// SAL annotations.
+//
+
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+#define _In_reads_(n)
+#define _Out_writes_all_(n)
+#define _Inout_updates_(n)
+#define _Use_decl_annotations_
+
+//
+// What bcm2836pwm.h needs to build.
+//
+
+#define NTDDI_WINTHRESHOLD  0x0A000000
+#define NTDDI_VERSION       NTDDI_WINTHRESHOLD
+
+#define METHOD_BUFFERED     0
+#define FILE_WRITE_DATA     0x0002
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#include <bcm2836pwm.h>
@@ -0,0 +1,167 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Portable emulation of the NEON intrinsics used by pwmconvert.cpp, for
+    hosts without NEON. Each intrinsic follows the lane semantics of the
+    ARM instruction it stands for, so the NEON conversion code runs
+    unmodified and can be checked for bit exactness on any host. The
+    emulation says nothing about the speed of the NEON code.
+
+--*/
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct { int16_t val[4]; } int16x4_t;
+typedef struct { int32_t val[4]; } int32x4_t;
+typedef struct { uint32_t val[4]; } uint32x4_t;
+
+#define PWMTEST_NEON_EMULATED
+
+#define NEON_LANES(type, expr)              \
+    type result;                            \
+    for (int lane = 0; lane < 4; lane++)    \
+    {                                       \
+        result.val[lane] = (expr);          \
+    }                                       \
+    return result
+
+static inline int16x4_t vdup_n_s16(int16_t Value)
+{
+    NEON_LANES(int16x4_t, Value);
+}
+
+static inline int32x4_t vdupq_n_s32(int32_t Value)
+{
+    NEON_LANES(int32x4_t, Value);
+}
+
+static inline uint32x4_t vdupq_n_u32(uint32_t Value)
+{
+    NEON_LANES(uint32x4_t, Value);
+}
+
+static inline int16x4_t vld1_s16(const int16_t* Ptr)
+{
+    NEON_LANES(int16x4_t, Ptr[lane]);
+}
+
+static inline int32x4_t vld1q_s32(const int32_t* Ptr)
+{
+    NEON_LANES(int32x4_t, Ptr[lane]);
+}
+
+static inline uint32x4_t vld1q_u32(const uint32_t* Ptr)
+{
+    NEON_LANES(uint32x4_t, Ptr[lane]);
+}
+
+static inline void vst1q_u32(uint32_t* Ptr, uint32x4_t Value)
+{
+    for (int lane = 0; lane < 4; lane++)
+    {
+        Ptr[lane] = Value.val[lane];
+    }
+}
+
+static inline int32x4_t vreinterpretq_s32_u32(uint32x4_t Value)
+{
+    NEON_LANES(int32x4_t, (int32_t)Value.val[lane]);
+}
+
+static inline uint32x4_t vreinterpretq_u32_s32(int32x4_t Value)
+{
+    NEON_LANES(uint32x4_t, (uint32_t)Value.val[lane]);
+}
+
+//
+// VMULL.S16, widening multiply.
+//
+
+static inline int32x4_t vmull_s16(int16x4_t A, int16x4_t B)
+{
+    NEON_LANES(int32x4_t, (int32_t)A.val[lane] * B.val[lane]);
+}
+
+//
+// VQDMULH.S32, saturating doubling multiply returning the high half. Only
+// -2^31 * -2^31 saturates.
+//
+
+static inline int32_t neon_qdmulh_s32(int32_t A, int32_t B)
+{
+    if ((A == INT32_MIN) && (B == INT32_MIN))
+    {
+        return INT32_MAX;
+    }
+    return (int32_t)(((int64_t)A * B * 2) >> 32);
+}
+
+static inline int32x4_t vqdmulhq_s32(int32x4_t A, int32x4_t B)
+{
+    NEON_LANES(int32x4_t, neon_qdmulh_s32(A.val[lane], B.val[lane]));
+}
+
+//
+// VRSHR.S32, rounding shift right, the rounding constant is added without
+// overflow.
+//
+
+static inline int32x4_t vrshrq_n_s32(int32x4_t A, int Shift)
+{
+    NEON_LANES(int32x4_t, (int32_t)(((int64_t)A.val[lane] + ((int64_t)1 << (Shift - 1))) >> Shift));
+}
+
+//
+// Modular additions and logic.
+//
+
+static inline int32x4_t vaddq_s32(int32x4_t A, int32x4_t B)
+{
+    NEON_LANES(int32x4_t, (int32_t)((uint32_t)A.val[lane] + (uint32_t)B.val[lane]));
+}
+
+static inline int32x4_t vsubq_s32(int32x4_t A, int32x4_t B)
+{
+    NEON_LANES(int32x4_t, (int32_t)((uint32_t)A.val[lane] - (uint32_t)B.val[lane]));
+}
+
+static inline uint32x4_t vaddq_u32(uint32x4_t A, uint32x4_t B)
+{
+    NEON_LANES(uint32x4_t, A.val[lane] + B.val[lane]);
+}
+
+static inline uint32x4_t vandq_u32(uint32x4_t A, uint32x4_t B)
+{
+    NEON_LANES(uint32x4_t, A.val[lane] & B.val[lane]);
+}
+
+static inline uint32x4_t veorq_u32(uint32x4_t A, uint32x4_t B)
+{
+    NEON_LANES(uint32x4_t, A.val[lane] ^ B.val[lane]);
+}
+
+static inline uint32x4_t vshlq_n_u32(uint32x4_t A, int Shift)
+{
+    NEON_LANES(uint32x4_t, A.val[lane] << Shift);
+}
+
+static inline uint32x4_t vshrq_n_u32(uint32x4_t A, int Shift)
+{
+    NEON_LANES(uint32x4_t, A.val[lane] >> Shift);
+}
+
+static inline int32x4_t vminq_s32(int32x4_t A, int32x4_t B)
+{
+    NEON_LANES(int32x4_t, (A.val[lane] < B.val[lane]) ? A.val[lane] : B.val[lane]);
+}
+
+static inline int32x4_t vmaxq_s32(int32x4_t A, int32x4_t B)
+{
+    NEON_LANES(int32x4_t, (A.val[lane] > B.val[lane]) ? A.val[lane] : B.val[lane]);
+}
+
+#undef NEON_LANES
@@ -0,0 +1,392 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Host-side bit exactness test and microbenchmark of the PCM to PWM
+    conversion in pwmconvert.cpp.
+
+    The test converts the same input with PwmConvert and PwmConvertReference
+    from identical states, in identical chunks, and requires identical output
+    and end states. It covers every format and dither mode, the PWM range of
+    every supported rate, constant gains and gain ramps, and chunks that are
+    not a multiple of the NEON lane count.
+
+    The benchmark reports the conversion time per sample of the divide loop
+    the driver used before, of PwmConvertReference and of PwmConvert, for 16
+    bit PCM in every dither mode. On hosts without NEON, PwmConvert runs the
+    emulated NEON code and its timing is not representative.
+
+--*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <rpiwav.h>
+#include "pwmconvert.h"
+
+#if defined(_M_ARM64)
+#include <arm64_neon.h>
+#elif defined(_M_ARM)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+const ULONG SampleRates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000 };
+
+const char* const FormatNames[PwmSampleFormatCount] = { "pcm16", "pcm24", "pcm32", "float32" };
+
+const ULONG FormatBytes[PwmSampleFormatCount] = { 2, 3, 4, 4 };
+
+const char* const DitherNames[PwmDitherModeCount] = { "none", "tpdf", "tpdf-shaped1", "tpdf-shaped2" };
+
+//
+// Chunk sizes in samples, replayed in turn. Odd sizes split frames and
+// leave partial lanes behind.
+//
+
+const ULONG ChunkSizes[] = { 882, 1, 3, 4, 64, 7, 1764, 2, 255 };
+
+UINT32 g_Random = 0x12345678;
+
+UINT32 NextRandom()
+{
+    g_Random ^= g_Random << 13;
+    g_Random ^= g_Random >> 17;
+    g_Random ^= g_Random << 5;
+    return g_Random;
+}
+
+//
+// Interleaved stereo test signal: a full scale sine on the left channel,
+// white noise on the right channel, and runs of the extreme values.
+//
+
+std::vector<UCHAR> MakeInput(PWM_SAMPLE_FORMAT Format, ULONG SampleCount)
+{
+    std::vector<UCHAR> buffer(SampleCount * FormatBytes[Format]);
+
+    for (ULONG sample = 0; sample < SampleCount; sample++)
+    {
+        double value;
+        if ((sample / 512) % 8 == 7)
+        {
+            value = (sample & 2) ? 1.0 : -1.0;
+        }
+        else if (sample % 2 == 0)
+        {
+            value = sin(sample * 0.0123);
+        }
+        else
+        {
+            value = ((LONG)NextRandom()) / 2147483648.0;
+        }
+
+        LONG pcm32 = (value >= 1.0) ? MAXLONG : (LONG)(value * 2147483648.0);
+        UCHAR* out = &buffer[sample * FormatBytes[Format]];
+
+        switch (Format)
+        {
+        case PwmSampleFormatPcm16:
+        {
+            INT16 pcm16 = (INT16)(pcm32 >> 16);
+            memcpy(out, &pcm16, sizeof(pcm16));
+            break;
+        }
+
+        case PwmSampleFormatPcm24:
+            out[0] = (UCHAR)(pcm32 >> 8);
+            out[1] = (UCHAR)(pcm32 >> 16);
+            out[2] = (UCHAR)(pcm32 >> 24);
+            break;
+
+        case PwmSampleFormatPcm32:
+            memcpy(out, &pcm32, sizeof(pcm32));
+            break;
+
+        default:
+        {
+            float pcmFloat = (float)value;
+            memcpy(out, &pcmFloat, sizeof(pcmFloat));
+            break;
+        }
+        }
+    }
+
+    return buffer;
+}
+
+//
+// Gain setups applied before the conversion, and halfway through it.
+//
+
+enum GAIN_CASE
+{
+    GainUnity,
+    GainConstant,
+    GainRampDown,
+    GainRampMidStream,
+    GainCaseCount
+};
+
+const char* const GainNames[GainCaseCount] = { "unity", "constant", "ramp", "ramp-mid" };
+
+void SetupGain(PPWM_CONVERT_STATE State, GAIN_CASE GainCase)
+{
+    LONG gain[PWMCONVERT_CHANNELS];
+
+    switch (GainCase)
+    {
+    case GainConstant:
+        gain[0] = PwmConvertVolumeToGain(-6 * 0x10000);
+        gain[1] = PwmConvertVolumeToGain(-23 * 0x10000);
+        PwmConvertSetGain(State, gain, FALSE);
+        break;
+
+    case GainRampDown:
+        gain[0] = PwmConvertVolumeToGain(-40 * 0x10000);
+        gain[1] = 0;
+        PwmConvertSetGain(State, gain, TRUE);
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool StatesEqual(const PWM_CONVERT_STATE& A, const PWM_CONVERT_STATE& B)
+{
+    return (memcmp(A.Random, B.Random, sizeof(A.Random)) == 0) &&
+           (memcmp(A.Error, B.Error, sizeof(A.Error)) == 0) &&
+           (memcmp(A.Gain, B.Gain, sizeof(A.Gain)) == 0) &&
+           (A.GainRampFrames == B.GainRampFrames);
+}
+
+bool RunBitExactCase(PWM_SAMPLE_FORMAT Format, PWM_DITHER_MODE Dither, ULONG SampleRate, GAIN_CASE GainCase)
+{
+    const ULONG sampleCount = 48000;
+    const ULONG range = PWMRANGE_FOR_RATE(SampleRate);
+    std::vector<UCHAR> input = MakeInput(Format, sampleCount);
+    std::vector<UINT32> output(sampleCount);
+    std::vector<UINT32> expected(sampleCount);
+
+    PWM_CONVERT_STATE state;
+    PWM_CONVERT_STATE reference;
+    PwmConvertInitialize(&state, Format, range, Dither);
+    SetupGain(&state, GainCase);
+    reference = state;
+
+    ULONG offset = 0;
+    for (ULONG chunk = 0; offset < sampleCount; chunk++)
+    {
+        ULONG count = min(ChunkSizes[chunk % ARRAYSIZE(ChunkSizes)], sampleCount - offset);
+
+        if ((GainCase == GainRampMidStream) && (offset >= sampleCount / 2) && (state.TargetGain[0] == PWMCONVERT_GAIN_UNITY))
+        {
+            LONG gain[PWMCONVERT_CHANNELS] = { PwmConvertVolumeToGain(-3 * 0x10000), PwmConvertVolumeToGain(-60 * 0x10000) };
+            PwmConvertSetGain(&state, gain, TRUE);
+            PwmConvertSetGain(&reference, gain, TRUE);
+        }
+
+        PwmConvert(&state, &input[offset * FormatBytes[Format]], &output[offset], count);
+        PwmConvertReference(&reference, &input[offset * FormatBytes[Format]], &expected[offset], count);
+        offset += count;
+    }
+
+    for (ULONG sample = 0; sample < sampleCount; sample++)
+    {
+        if (output[sample] != expected[sample])
+        {
+            printf(
+                "FAIL: %s %s %lu Hz gain %s: sample %lu is %lu, reference %lu\n",
+                FormatNames[Format], DitherNames[Dither], (unsigned long)SampleRate, GainNames[GainCase],
+                (unsigned long)sample, (unsigned long)output[sample], (unsigned long)expected[sample]);
+            return false;
+        }
+
+        if (output[sample] > range)
+        {
+            printf(
+                "FAIL: %s %s %lu Hz gain %s: sample %lu is %lu, above the PWM range %lu\n",
+                FormatNames[Format], DitherNames[Dither], (unsigned long)SampleRate, GainNames[GainCase],
+                (unsigned long)sample, (unsigned long)output[sample], (unsigned long)range);
+            return false;
+        }
+    }
+
+    if (!StatesEqual(state, reference))
+    {
+        printf(
+            "FAIL: %s %s %lu Hz gain %s: end state differs from the reference\n",
+            FormatNames[Format], DitherNames[Dither], (unsigned long)SampleRate, GainNames[GainCase]);
+        return false;
+    }
+
+    return true;
+}
+
+bool TestBitExact()
+{
+    ULONG cases = 0;
+    ULONG failures = 0;
+
+    for (ULONG format = 0; format < PwmSampleFormatCount; format++)
+    {
+        for (ULONG dither = 0; dither < PwmDitherModeCount; dither++)
+        {
+            for (ULONG rate : SampleRates)
+            {
+                for (ULONG gainCase = 0; gainCase < GainCaseCount; gainCase++)
+                {
+                    cases++;
+                    if (!RunBitExactCase((PWM_SAMPLE_FORMAT)format, (PWM_DITHER_MODE)dither, rate, (GAIN_CASE)gainCase))
+                    {
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("bit exactness: %lu cases, %lu failed\n", (unsigned long)cases, (unsigned long)failures);
+    return failures == 0;
+}
+
+//
+// The conversion of the driver before pwmconvert.cpp, a divide by the PCM
+// to PWM ratio per sample.
+//
+
+#define LEGACY_PWMRANGE     2268
+#define LEGACY_PCMTOPWMDIV  ((0x10000 / LEGACY_PWMRANGE) + 1)
+#define LEGACY_PWMSILENCE   (LEGACY_PWMRANGE / 2)
+
+__attribute__((noinline))
+void LegacyConvert(const INT16* InBuffer, PUINT32 OutBuffer, ULONG SampleCount)
+{
+    while (SampleCount--)
+    {
+        *OutBuffer++ = (*InBuffer++ / LEGACY_PCMTOPWMDIV) + LEGACY_PWMSILENCE;
+    }
+}
+
+template <typename CONVERT>
+double MeasureNsPerSample(CONVERT Convert, ULONG SampleCount)
+{
+    using Clock = std::chrono::steady_clock;
+
+    double best = 1e30;
+    for (int round = 0; round < 5; round++)
+    {
+        ULONG iterations = 0;
+        Clock::time_point start = Clock::now();
+        Clock::duration elapsed;
+        do
+        {
+            Convert();
+            iterations++;
+            elapsed = Clock::now() - start;
+        } while (elapsed < std::chrono::milliseconds(40));
+
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations / SampleCount;
+        best = min(best, ns);
+    }
+    return best;
+}
+
+void Benchmark()
+{
+    //
+    // One 10ms packet of 44.1kHz stereo audio.
+    //
+
+    const ULONG sampleCount = 441 * PWMCONVERT_CHANNELS;
+    const ULONG range = PWMRANGE_FOR_RATE(44100);
+    std::vector<UCHAR> input = MakeInput(PwmSampleFormatPcm16, sampleCount);
+    std::vector<UINT32> output(sampleCount);
+    const INT16* pcm = (const INT16*)input.data();
+
+#if defined(PWMTEST_NEON_EMULATED)
+    const char* neon = "emulated, PwmConvert timings are not representative";
+#elif defined(_M_ARM) || defined(_M_ARM64)
+    const char* neon = "native";
+#else
+    const char* neon = "not built, PwmConvert runs the reference code";
+#endif
+
+    printf("16 bit PCM, 44100 Hz stereo, %lu samples per call, NEON %s\n", (unsigned long)sampleCount, neon);
+    printf("%-14s %14s %14s %14s\n", "dither", "legacy ns", "reference ns", "PwmConvert ns");
+
+    double legacy = MeasureNsPerSample([&] { LegacyConvert(pcm, output.data(), sampleCount); }, sampleCount);
+
+    for (ULONG dither = 0; dither < PwmDitherModeCount; dither++)
+    {
+        PWM_CONVERT_STATE state;
+        PwmConvertInitialize(&state, PwmSampleFormatPcm16, range, (PWM_DITHER_MODE)dither);
+
+        double reference = MeasureNsPerSample(
+            [&] { PwmConvertReference(&state, pcm, output.data(), sampleCount); },
+            sampleCount);
+        double convert = MeasureNsPerSample(
+            [&] { PwmConvert(&state, pcm, output.data(), sampleCount); },
+            sampleCount);
+
+        printf("%-14s %14.2f %14.2f %14.2f\n", DitherNames[dither], legacy, reference, convert);
+    }
+}
+
+void Usage()
+{
+    printf(
+        "usage: pwmtest [--test] [--bench]\n"
+        "  --test    bit exactness of PwmConvert against PwmConvertReference\n"
+        "  --bench   conversion time per sample\n");
+}
+
+} // namespace
+
+int main(int Argc, char** Argv)
+{
+    bool test = false;
+    bool bench = false;
+
+    for (int arg = 1; arg < Argc; arg++)
+    {
+        if (strcmp(Argv[arg], "--test") == 0)
+        {
+            test = true;
+        }
+        else if (strcmp(Argv[arg], "--bench") == 0)
+        {
+            bench = true;
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (!test && !bench)
+    {
+        test = true;
+    }
+
+    bool pass = true;
+    if (test)
+    {
+        pass = TestBitExact();
+        printf("%s: bit exactness\n", pass ? "PASS" : "FAIL");
+    }
+    if (bench)
+    {
+        Benchmark();
+    }
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,1231 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Simulated PWM device for the audio path of the PWM driver.
+
+    Implements the kernel and KMDF routines of wdk/wdkhost.h, the device
+    context PrepareHardware would set up, and models of the DMA channel,
+    the PWM controller with its FIFO and the PWM clock manager behind the
+    register blocks of the device context. See pwmsim.h.
+
+    Only one device exists and everything runs on the calling thread, so
+    the spin locks and interrupt locks of the driver are no-ops. An event
+    is never preempted, the ISR runs between two harness callbacks, not in
+    the middle of one.
+
+--*/
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <queue>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "driver.h"
+#include "pwmsim.h"
+
+namespace
+{
+
+//
+// Addresses of the simulated system. The memory the driver allocates with
+// MmAllocateContiguousNodeMemory lives in an arena at ArenaPa. The DMA
+// decodes bus addresses modulo 1 GB, like the aliases of the VideoCore bus.
+// memUncachedOffset is 0, which is what the ISR control block arithmetic
+// and the LinkValue of the packet link info assume.
+//
+
+const ULONG ArenaPa = 0x10000000;
+const ULONG ArenaSize = 1024 * 1024;
+const ULONG BusAddressMask = 0x3FFFFFFF;
+const ULONG PwmRegsPa = 0x3F20C000;
+const ULONG PwmRegsBusPa = 0x7E20C000;
+const ULONG CmPwmRegsPa = 0x3F1010A0;
+const ULONG DmaChannelRegsPa = 0x3F007400;
+const ULONG DmaChannel = 4;
+
+//
+// PWM clock sources in Hz, by CM_PWMCTL_SRC.
+//
+
+const ULONG PllcHz = 1000000000;
+const ULONG PlldHz = 500000000;
+
+enum EVENT_TYPE
+{
+    EventPwmFrame,
+    EventIsr,
+    EventDpc,
+    EventCallback
+};
+
+struct EVENT
+{
+    ULONGLONG           Time;
+    ULONGLONG           Sequence;
+    EVENT_TYPE          Type;
+    PWMSIM_CALLBACK*    Callback;
+    PVOID               Context;
+
+    bool operator>(const EVENT& Other) const
+    {
+        return (Time != Other.Time) ? (Time > Other.Time) : (Sequence > Other.Sequence);
+    }
+};
+
+//
+// DMA channel registers, as loaded from the current control block.
+//
+
+struct DMA_MODEL
+{
+    ULONG   Cs;
+    ULONG   ConblkAd;
+    ULONG   Ti;
+    ULONG   SourceAd;
+    ULONG   DestAd;
+    ULONG   TxfrLen;
+    ULONG   Stride;
+    ULONG   NextConbk;
+    ULONG   Debug;
+
+    //
+    // A control block is loaded, the channel resumes it when ACTIVE is set.
+    //
+    bool    Loaded;
+};
+
+struct PWM_MODEL
+{
+    ULONG               Ctl;
+    ULONG               StaErrors;
+    ULONG               Dmac;
+    ULONG               Rng1;
+    ULONG               Dat1;
+    ULONG               Rng2;
+    ULONG               Dat2;
+    std::deque<UINT32>  Fifo;
+};
+
+struct CM_MODEL
+{
+    ULONG   Ctl;
+    ULONG   Div;
+};
+
+} // namespace
+
+struct _KEVENT
+{
+    PWMSIM_CALLBACK*    Callback;
+    PVOID               Context;
+};
+
+struct WDFREQUEST__
+{
+    PVOID       InputBuffer;
+    size_t      InputBufferLength;
+    PVOID       OutputBuffer;
+    size_t      OutputBufferLength;
+    ULONG_PTR   Information;
+};
+
+namespace
+{
+
+struct SIM_DEVICE
+{
+    DEVICE_CONTEXT          Context;
+
+    //
+    // Register blocks mapped in the device context. The driver only
+    // reaches them through READ_REGISTER_ULONG and WRITE_REGISTER_ULONG,
+    // which route the accesses to the models.
+    //
+    DMA_CHANNEL_REGS        DmaRegs;
+    PWM_REGS                PwmRegs;
+    CM_PWM_REGS             CmRegs;
+
+    DMA_MODEL               Dma;
+    PWM_MODEL               Pwm;
+    CM_MODEL                Cm;
+
+    PWMSIM_TIMING           Timing;
+    PWMSIM_STATS            Stats;
+    std::vector<UINT32>*    Capture;
+
+    ULONGLONG               Now;
+    ULONGLONG               Sequence;
+    std::priority_queue<EVENT, std::vector<EVENT>, std::greater<EVENT>> Events;
+    bool                    FrameScheduled;
+    bool                    IsrScheduled;
+    bool                    DpcQueued;
+
+    PUINT8                  Arena;
+    ULONG                   ArenaUsed;
+};
+
+SIM_DEVICE* g_Sim;
+ULONG g_TraceLevel = TRACE_LEVEL_NONE;
+ULONG g_AssertionCount;
+
+//
+// Distinct handles of the KMDF objects the driver uses.
+//
+
+WDFDEVICE const DeviceHandle = (WDFDEVICE)0x1000;
+WDFINTERRUPT const InterruptHandle = (WDFINTERRUPT)0x2000;
+WDFSPINLOCK const PwmLockHandle = (WDFSPINLOCK)0x3000;
+WDFSPINLOCK const NotificationLockHandle = (WDFSPINLOCK)0x3001;
+WDFQUEUE const QueueHandle = (WDFQUEUE)0x4000;
+WDFQUEUE const StreamQueueHandle = (WDFQUEUE)0x4001;
+
+VOID ScheduleEvent(ULONGLONG Time, EVENT_TYPE Type, PWMSIM_CALLBACK* Callback = nullptr, PVOID Context = nullptr)
+{
+    g_Sim->Events.push({ Time, g_Sim->Sequence++, Type, Callback, Context });
+}
+
+//
+// Bus accesses of the DMA. Memory is the arena, the only peripheral is the
+// PWM FIFO.
+//
+
+PULONG BusToHost(ULONG BusAddress)
+{
+    ULONG pa = BusAddress & BusAddressMask;
+    if ((pa < ArenaPa) || (pa - ArenaPa > ArenaSize - sizeof(ULONG)) || (pa & (sizeof(ULONG) - 1)))
+    {
+        SimAssertionFailure("DMA bus address outside of the DMA memory", __FILE__, __LINE__);
+        return nullptr;
+    }
+    return (PULONG)(g_Sim->Arena + (pa - ArenaPa));
+}
+
+bool FifoFull()
+{
+    return g_Sim->Pwm.Fifo.size() >= PWMSIM_FIFO_WORDS;
+}
+
+VOID FifoWrite(ULONG Value)
+{
+    if (FifoFull())
+    {
+        g_Sim->Pwm.StaErrors |= PWM_STA_WERR1;
+        return;
+    }
+    g_Sim->Pwm.Fifo.push_back(Value);
+}
+
+VOID BusWrite(ULONG BusAddress, ULONG Value)
+{
+    if (BusAddress == PwmRegsBusPa + FIELD_OFFSET(PWM_REGS, FIF1))
+    {
+        FifoWrite(Value);
+        return;
+    }
+    PULONG host = BusToHost(BusAddress);
+    if (host)
+    {
+        *host = Value;
+    }
+}
+
+ULONG BusRead(ULONG BusAddress)
+{
+    PULONG host = BusToHost(BusAddress);
+    return host ? *host : 0;
+}
+
+//
+// DMA channel model.
+//
+
+bool DmaDreq()
+{
+    return (g_Sim->Pwm.Dmac & PWM_DMAC_ENAB) && !FifoFull();
+}
+
+VOID DmaRaiseInterrupt()
+{
+    if (!g_Sim->IsrScheduled)
+    {
+        g_Sim->IsrScheduled = true;
+        ScheduleEvent(g_Sim->Now + g_Sim->Timing.IsrLatencyNs, EventIsr);
+    }
+}
+
+VOID DmaLoadControlBlock(ULONG BusAddress)
+{
+    DMA_MODEL& dma = g_Sim->Dma;
+    PULONG cb = BusToHost(BusAddress);
+    if ((cb == nullptr) || (BusAddress & (sizeof(DMA_CB) - 1)))
+    {
+        SimAssertionFailure("DMA control block not 256 bit aligned in DMA memory", __FILE__, __LINE__);
+        dma.Cs &= ~DMA_CS_ACTIVE;
+        return;
+    }
+    dma.ConblkAd = BusAddress;
+    dma.Ti = cb[FIELD_OFFSET(DMA_CB, TI) / sizeof(ULONG)];
+    dma.SourceAd = cb[FIELD_OFFSET(DMA_CB, SOURCE_AD) / sizeof(ULONG)];
+    dma.DestAd = cb[FIELD_OFFSET(DMA_CB, DEST_AD) / sizeof(ULONG)];
+    dma.TxfrLen = cb[FIELD_OFFSET(DMA_CB, TXFR_LEN) / sizeof(ULONG)];
+    dma.Stride = cb[FIELD_OFFSET(DMA_CB, STRIDE) / sizeof(ULONG)];
+    dma.NextConbk = cb[FIELD_OFFSET(DMA_CB, NEXTCONBK) / sizeof(ULONG)];
+    dma.Loaded = true;
+}
+
+//
+// The control block is done. The channel raises INT if the block asks for
+// it and loads the next block right away, or stops with CONBLK_AD 0 if the
+// block had no link when it was loaded.
+//
+
+VOID DmaFinishControlBlock()
+{
+    DMA_MODEL& dma = g_Sim->Dma;
+    g_Sim->Stats.ControlBlocks++;
+    dma.Cs |= DMA_CS_END;
+    if (dma.Ti & DMA_TI_INTEN)
+    {
+        dma.Cs |= DMA_CS_INT;
+        DmaRaiseInterrupt();
+    }
+    dma.Loaded = false;
+    if (dma.NextConbk == 0)
+    {
+        dma.Cs &= ~DMA_CS_ACTIVE;
+        dma.ConblkAd = 0;
+        g_Sim->Stats.DmaStops++;
+    }
+    else
+    {
+        DmaLoadControlBlock(dma.NextConbk);
+    }
+}
+
+//
+// Moves words to the PWM FIFO while the PWM requests data.
+//
+
+VOID DmaService()
+{
+    DMA_MODEL& dma = g_Sim->Dma;
+    while ((dma.Cs & DMA_CS_ACTIVE) && dma.Loaded)
+    {
+        if (dma.TxfrLen == 0)
+        {
+            DmaFinishControlBlock();
+            continue;
+        }
+        if ((dma.Ti & (DMA_TI_SRC_DREQ | DMA_TI_DEST_DREQ)) && !DmaDreq())
+        {
+            break;
+        }
+        BusWrite(dma.DestAd, BusRead(dma.SourceAd));
+        if (dma.Ti & DMA_TI_SRC_INC)
+        {
+            dma.SourceAd += sizeof(ULONG);
+        }
+        if (dma.Ti & DMA_TI_DEST_INC)
+        {
+            dma.DestAd += sizeof(ULONG);
+        }
+        dma.TxfrLen -= min(dma.TxfrLen, (ULONG)sizeof(ULONG));
+        if (dma.TxfrLen == 0)
+        {
+            DmaFinishControlBlock();
+        }
+    }
+}
+
+ULONG DmaRead(ULONG Offset)
+{
+    DMA_MODEL& dma = g_Sim->Dma;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, CS):
+    {
+        ULONG cs = dma.Cs;
+        if (!(cs & DMA_CS_ACTIVE) && dma.Loaded)
+        {
+            cs |= DMA_CS_PAUSED;
+        }
+        if (DmaDreq())
+        {
+            cs |= DMA_CS_DREQ;
+        }
+        if (dma.Debug & (DMA_DEBUG_READ_LAST_NOT_SET_ERROR | DMA_DEBUG_FIFO_ERROR | DMA_DEBUG_READ_ERROR))
+        {
+            cs |= DMA_CS_ERROR;
+        }
+        return cs;
+    }
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, CONBLK_AD):
+        return dma.ConblkAd;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, TI):
+        return dma.Ti;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, SOURCE_AD):
+        return dma.SourceAd;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, DEST_AD):
+        return dma.DestAd;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, TXFR_LEN):
+        return dma.TxfrLen;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, STRIDE):
+        return dma.Stride;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, NEXTCONBK):
+        return dma.NextConbk;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, DEBUG):
+        return dma.Debug | (DmaChannel << DMA_DEBUG_DMA_ID_SHIFT);
+    }
+    return 0;
+}
+
+VOID DmaWrite(ULONG Offset, ULONG Value)
+{
+    DMA_MODEL& dma = g_Sim->Dma;
+    const ULONG csReadWrite = DMA_CS_PRIORITY_MASK | DMA_CS_PANIC_PRIORITY_MASK |
+        DMA_CS_WAIT_FOR_OUTSTANDING_WRITES | DMA_CS_DISDEBUG;
+
+    switch (Offset)
+    {
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, CS):
+        if (Value & DMA_CS_RESET)
+        {
+            memset(&dma, 0, sizeof(dma));
+            break;
+        }
+        dma.Cs &= ~(Value & (DMA_CS_END | DMA_CS_INT));
+        dma.Cs = (dma.Cs & ~csReadWrite) | (Value & csReadWrite);
+        if (!(Value & DMA_CS_ACTIVE))
+        {
+            dma.Cs &= ~DMA_CS_ACTIVE;
+        }
+        else if (!(dma.Cs & DMA_CS_ACTIVE))
+        {
+            //
+            // Start with the control block at CONBLK_AD, or resume the
+            // loaded one after a pause.
+            //
+            if (dma.Loaded)
+            {
+                dma.Cs |= DMA_CS_ACTIVE;
+            }
+            else if (dma.ConblkAd != 0)
+            {
+                dma.Cs |= DMA_CS_ACTIVE;
+                DmaLoadControlBlock(dma.ConblkAd);
+            }
+        }
+        break;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, CONBLK_AD):
+        dma.ConblkAd = Value;
+        dma.Loaded = false;
+        break;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, NEXTCONBK):
+        dma.NextConbk = Value;
+        break;
+    case FIELD_OFFSET(DMA_CHANNEL_REGS, DEBUG):
+        dma.Debug &= ~Value;
+        break;
+    }
+    DmaService();
+}
+
+//
+// PWM controller model. The PWM takes a word per FIFO channel every frame,
+// the frame length is the range in PWM clock cycles.
+//
+
+ULONG PwmFifoChannels()
+{
+    const PWM_MODEL& pwm = g_Sim->Pwm;
+    return ((pwm.Ctl & (PWM_CTL_PWEN1 | PWM_CTL_USEF1)) == (PWM_CTL_PWEN1 | PWM_CTL_USEF1)) +
+        ((pwm.Ctl & (PWM_CTL_PWEN2 | PWM_CTL_USEF2)) == (PWM_CTL_PWEN2 | PWM_CTL_USEF2));
+}
+
+ULONGLONG PwmFrameNs()
+{
+    const CM_MODEL& cm = g_Sim->Cm;
+    ULONG divi = (cm.Div & CM_PWMDIV_DIVI_MASK) >> CM_PWMDIV_DIVI_SHIFT;
+    ULONG sourceHz;
+    switch (cm.Ctl & CM_PWMCTL_SRC_MASK)
+    {
+    case CM_PWMCTL_SRC_PLLC:
+        sourceHz = PllcHz;
+        break;
+    case CM_PWMCTL_SRC_PLLD:
+        sourceHz = PlldHz;
+        break;
+    default:
+        return 0;
+    }
+    if (!(cm.Ctl & CM_PWMCTL_ENAB) || (divi == 0))
+    {
+        return 0;
+    }
+    return (ULONGLONG)g_Sim->Pwm.Rng1 * divi * 1000000000 / sourceHz;
+}
+
+VOID PwmUpdate()
+{
+    if (!g_Sim->FrameScheduled && PwmFifoChannels() && PwmFrameNs())
+    {
+        g_Sim->FrameScheduled = true;
+        ScheduleEvent(g_Sim->Now + PwmFrameNs(), EventPwmFrame);
+    }
+}
+
+VOID PwmFrame()
+{
+    PWM_MODEL& pwm = g_Sim->Pwm;
+    ULONG channels = PwmFifoChannels();
+    g_Sim->FrameScheduled = false;
+    if (channels == 0)
+    {
+        return;
+    }
+
+    UINT32 values[2] = { 0, 0 };
+    if (pwm.Fifo.size() < channels)
+    {
+        pwm.StaErrors |= PWM_STA_GAPO1 | ((channels > 1) ? PWM_STA_GAPO2 : 0);
+        g_Sim->Stats.FramesMissed++;
+    }
+    else
+    {
+        for (ULONG channel = 0; channel < channels; channel++)
+        {
+            values[channel] = pwm.Fifo.front();
+            pwm.Fifo.pop_front();
+        }
+        g_Sim->Stats.FramesPlayed++;
+    }
+    if (g_Sim->Capture)
+    {
+        g_Sim->Capture->push_back(values[0]);
+        g_Sim->Capture->push_back(values[1]);
+    }
+
+    DmaService();
+    PwmUpdate();
+}
+
+ULONG PwmRead(ULONG Offset)
+{
+    const PWM_MODEL& pwm = g_Sim->Pwm;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(PWM_REGS, CTL):
+        return pwm.Ctl;
+    case FIELD_OFFSET(PWM_REGS, STA):
+        return pwm.StaErrors |
+            (FifoFull() ? PWM_STA_FULL1 : 0) |
+            (pwm.Fifo.empty() ? PWM_STA_EMPT1 : 0) |
+            ((pwm.Ctl & PWM_CTL_PWEN1) ? PWM_STA_STA1 : 0) |
+            ((pwm.Ctl & PWM_CTL_PWEN2) ? PWM_STA_STA2 : 0);
+    case FIELD_OFFSET(PWM_REGS, DMAC):
+        return pwm.Dmac;
+    case FIELD_OFFSET(PWM_REGS, RNG1):
+        return pwm.Rng1;
+    case FIELD_OFFSET(PWM_REGS, DAT1):
+        return pwm.Dat1;
+    case FIELD_OFFSET(PWM_REGS, RNG2):
+        return pwm.Rng2;
+    case FIELD_OFFSET(PWM_REGS, DAT2):
+        return pwm.Dat2;
+    }
+    return 0;
+}
+
+VOID PwmWrite(ULONG Offset, ULONG Value)
+{
+    PWM_MODEL& pwm = g_Sim->Pwm;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(PWM_REGS, CTL):
+        if (Value & PWM_CTL_CLRF1)
+        {
+            pwm.Fifo.clear();
+        }
+        pwm.Ctl = Value & ~PWM_CTL_CLRF1;
+        break;
+    case FIELD_OFFSET(PWM_REGS, STA):
+        pwm.StaErrors &= ~Value;
+        break;
+    case FIELD_OFFSET(PWM_REGS, DMAC):
+        pwm.Dmac = Value;
+        break;
+    case FIELD_OFFSET(PWM_REGS, RNG1):
+        pwm.Rng1 = Value;
+        break;
+    case FIELD_OFFSET(PWM_REGS, DAT1):
+        pwm.Dat1 = Value;
+        break;
+    case FIELD_OFFSET(PWM_REGS, FIF1):
+        FifoWrite(Value);
+        break;
+    case FIELD_OFFSET(PWM_REGS, RNG2):
+        pwm.Rng2 = Value;
+        break;
+    case FIELD_OFFSET(PWM_REGS, DAT2):
+        pwm.Dat2 = Value;
+        break;
+    }
+    DmaService();
+    PwmUpdate();
+}
+
+//
+// Clock manager model, the clock is busy while it is enabled. Writes
+// without the password are ignored.
+//
+
+ULONG CmRead(ULONG Offset)
+{
+    const CM_MODEL& cm = g_Sim->Cm;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(CM_PWM_REGS, PWMCTL):
+        return cm.Ctl | ((cm.Ctl & CM_PWMCTL_ENAB) ? CM_PWMCTL_BUSY : 0);
+    case FIELD_OFFSET(CM_PWM_REGS, PWMDIV):
+        return cm.Div;
+    }
+    return 0;
+}
+
+VOID CmWrite(ULONG Offset, ULONG Value)
+{
+    CM_MODEL& cm = g_Sim->Cm;
+    if ((Value & CM_PWMCTL_PASSWD_MASK) != CM_PWMCTL_PASSWD)
+    {
+        return;
+    }
+    switch (Offset)
+    {
+    case FIELD_OFFSET(CM_PWM_REGS, PWMCTL):
+        cm.Ctl = Value & ~(CM_PWMCTL_PASSWD_MASK | CM_PWMCTL_BUSY | CM_PWMCTL_KILL);
+        break;
+    case FIELD_OFFSET(CM_PWM_REGS, PWMDIV):
+        cm.Div = Value & ~CM_PWMDIV_PASSWD_MASK;
+        break;
+    }
+    PwmUpdate();
+}
+
+template <typename REGS>
+bool RegisterOffset(volatile ULONG* Register, REGS* Block, ULONG* Offset)
+{
+    ULONG_PTR address = (ULONG_PTR)Register;
+    ULONG_PTR base = (ULONG_PTR)Block;
+    if ((address < base) || (address >= base + sizeof(REGS)))
+    {
+        return false;
+    }
+    *Offset = (ULONG)(address - base);
+    return true;
+}
+
+//
+// Runs the ISR or the DPC and accounts their CPU time.
+//
+
+VOID RunIsr()
+{
+    g_Sim->IsrScheduled = false;
+    if (!(g_Sim->Dma.Cs & DMA_CS_INT))
+    {
+        return;
+    }
+    ULONGLONG start = PwmSimReadCycles();
+    DmaIsr(InterruptHandle, 0);
+    ULONGLONG cycles = PwmSimReadCycles() - start;
+    g_Sim->Stats.IsrCount++;
+    g_Sim->Stats.IsrCycles += cycles;
+    g_Sim->Stats.IsrMaxCycles = max(g_Sim->Stats.IsrMaxCycles, cycles);
+}
+
+VOID RunDpc()
+{
+    g_Sim->DpcQueued = false;
+    ULONGLONG start = PwmSimReadCycles();
+    DmaDpc(InterruptHandle, DeviceHandle);
+    g_Sim->Stats.DpcCycles += PwmSimReadCycles() - start;
+    g_Sim->Stats.DpcCount++;
+}
+
+//
+// Cycle counter.
+//
+
+int g_CycleCounterFd = -2;
+
+int CycleCounter()
+{
+    if (g_CycleCounterFd == -2)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        g_CycleCounterFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return g_CycleCounterFd;
+}
+
+} // namespace
+
+//
+// Kernel and KMDF routines of wdkhost.h.
+//
+
+ULONG READ_REGISTER_ULONG(volatile ULONG* Register)
+{
+    ULONG offset;
+    if (RegisterOffset(Register, &g_Sim->DmaRegs, &offset))
+    {
+        return DmaRead(offset);
+    }
+    if (RegisterOffset(Register, &g_Sim->PwmRegs, &offset))
+    {
+        return PwmRead(offset);
+    }
+    if (RegisterOffset(Register, &g_Sim->CmRegs, &offset))
+    {
+        return CmRead(offset);
+    }
+    SimAssertionFailure("register read outside of the simulated devices", __FILE__, __LINE__);
+    return 0;
+}
+
+VOID WRITE_REGISTER_ULONG(volatile ULONG* Register, ULONG Value)
+{
+    ULONG offset;
+    if (RegisterOffset(Register, &g_Sim->DmaRegs, &offset))
+    {
+        DmaWrite(offset, Value);
+    }
+    else if (RegisterOffset(Register, &g_Sim->PwmRegs, &offset))
+    {
+        PwmWrite(offset, Value);
+    }
+    else if (RegisterOffset(Register, &g_Sim->CmRegs, &offset))
+    {
+        CmWrite(offset, Value);
+    }
+    else
+    {
+        SimAssertionFailure("register write outside of the simulated devices", __FILE__, __LINE__);
+    }
+}
+
+PVOID MmAllocateContiguousNodeMemory(SIZE_T NumberOfBytes, PHYSICAL_ADDRESS LowestAcceptableAddress,
+    PHYSICAL_ADDRESS HighestAcceptableAddress, PHYSICAL_ADDRESS BoundaryAddressMultiple, ULONG Protect,
+    NODE_REQUIREMENT PreferredNode)
+{
+    UNREFERENCED_PARAMETER(LowestAcceptableAddress);
+    UNREFERENCED_PARAMETER(BoundaryAddressMultiple);
+    UNREFERENCED_PARAMETER(Protect);
+    UNREFERENCED_PARAMETER(PreferredNode);
+
+    SIZE_T size = ROUND_TO_PAGES(NumberOfBytes);
+    if ((g_Sim->ArenaUsed + size > ArenaSize) || (ArenaPa + g_Sim->ArenaUsed + size - 1 > (ULONGLONG)HighestAcceptableAddress.QuadPart))
+    {
+        return NULL;
+    }
+    PVOID address = g_Sim->Arena + g_Sim->ArenaUsed;
+    g_Sim->ArenaUsed += (ULONG)size;
+    memset(address, 0, size);
+    return address;
+}
+
+VOID MmFreeContiguousMemory(PVOID BaseAddress)
+{
+    UNREFERENCED_PARAMETER(BaseAddress);
+}
+
+PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID BaseAddress)
+{
+    PHYSICAL_ADDRESS pa;
+    pa.QuadPart = 0;
+    if (((PUINT8)BaseAddress < g_Sim->Arena) || ((PUINT8)BaseAddress >= g_Sim->Arena + ArenaSize))
+    {
+        SimAssertionFailure("MmGetPhysicalAddress of memory outside of the contiguous memory", __FILE__, __LINE__);
+        return pa;
+    }
+    pa.QuadPart = ArenaPa + ((PUINT8)BaseAddress - g_Sim->Arena);
+    return pa;
+}
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(Tag);
+    return aligned_alloc(BCM_PWM_CACHE_LINE_SIZE, (NumberOfBytes + BCM_PWM_CACHE_LINE_SIZE - 1) & ~(SIZE_T)(BCM_PWM_CACHE_LINE_SIZE - 1));
+}
+
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    UNREFERENCED_PARAMETER(Tag);
+    free(P);
+}
+
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (PerformanceFrequency)
+    {
+        PerformanceFrequency->QuadPart = 1000000000;
+    }
+    LARGE_INTEGER counter;
+    counter.QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+    return counter;
+}
+
+VOID KeStallExecutionProcessor(ULONG MicroSeconds)
+{
+    UNREFERENCED_PARAMETER(MicroSeconds);
+}
+
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+    Event->Callback(Event->Context);
+    return 0;
+}
+
+PEPROCESS IoGetCurrentProcess()
+{
+    return NULL;
+}
+
+VOID SimAssertionFailure(const char* Expression, const char* File, int Line)
+{
+    g_AssertionCount++;
+    fprintf(stderr, "ASSERTION FAILED: %s (%s:%d)\n", Expression, File, Line);
+}
+
+VOID SimTrace(ULONG Level, const char* Format, ...)
+{
+    if (Level > g_TraceLevel)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, Format);
+    printf("  [%10.3f ms] ", g_Sim ? g_Sim->Now / 1e6 : 0.0);
+    vprintf(Format, args);
+    printf("\n");
+    va_end(args);
+}
+
+PVOID SimGetObjectContext(WDFOBJECT Handle)
+{
+    if (Handle != DeviceHandle)
+    {
+        SimAssertionFailure("context of an object other than the device", __FILE__, __LINE__);
+    }
+    return &g_Sim->Context;
+}
+
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock)
+{
+    UNREFERENCED_PARAMETER(SpinLock);
+}
+
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock)
+{
+    UNREFERENCED_PARAMETER(SpinLock);
+}
+
+VOID WdfInterruptAcquireLock(WDFINTERRUPT Interrupt)
+{
+    UNREFERENCED_PARAMETER(Interrupt);
+}
+
+VOID WdfInterruptReleaseLock(WDFINTERRUPT Interrupt)
+{
+    UNREFERENCED_PARAMETER(Interrupt);
+}
+
+BOOLEAN WdfInterruptQueueDpcForIsr(WDFINTERRUPT Interrupt)
+{
+    UNREFERENCED_PARAMETER(Interrupt);
+    if (g_Sim->DpcQueued)
+    {
+        return FALSE;
+    }
+    g_Sim->DpcQueued = true;
+    ScheduleEvent(g_Sim->Now + g_Sim->Timing.DpcLatencyNs, EventDpc);
+    return TRUE;
+}
+
+WDFDEVICE WdfInterruptGetDevice(WDFINTERRUPT Interrupt)
+{
+    UNREFERENCED_PARAMETER(Interrupt);
+    return DeviceHandle;
+}
+
+NTSTATUS WdfRequestRetrieveInputBuffer(WDFREQUEST Request, size_t MinimumRequiredLength, PVOID* Buffer, size_t* Length)
+{
+    if ((Request->InputBuffer == NULL) || (Request->InputBufferLength < MinimumRequiredLength))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    *Buffer = Request->InputBuffer;
+    if (Length)
+    {
+        *Length = Request->InputBufferLength;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize, PVOID* Buffer, size_t* Length)
+{
+    if ((Request->OutputBuffer == NULL) || (Request->OutputBufferLength < MinimumRequiredSize))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    *Buffer = Request->OutputBuffer;
+    if (Length)
+    {
+        *Length = Request->OutputBufferLength;
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID WdfRequestSetInformation(WDFREQUEST Request, ULONG_PTR Information)
+{
+    Request->Information = Information;
+}
+
+//
+// The stream path of dma.cpp is linked but not simulated.
+//
+
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status)
+{
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(Status);
+}
+
+WDFFILEOBJECT WdfRequestGetFileObject(WDFREQUEST Request)
+{
+    UNREFERENCED_PARAMETER(Request);
+    return NULL;
+}
+
+NTSTATUS WdfRequestForwardToIoQueue(WDFREQUEST Request, WDFQUEUE DestinationQueue)
+{
+    UNREFERENCED_PARAMETER(Request);
+    UNREFERENCED_PARAMETER(DestinationQueue);
+    return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS WdfIoQueueRetrieveNextRequest(WDFQUEUE Queue, WDFREQUEST* OutRequest)
+{
+    UNREFERENCED_PARAMETER(Queue);
+    *OutRequest = NULL;
+    return STATUS_UNSUCCESSFUL;
+}
+
+WDF_IO_QUEUE_STATE WdfIoQueueGetState(WDFQUEUE Queue, PULONG QueueRequests, PULONG DriverRequests)
+{
+    UNREFERENCED_PARAMETER(Queue);
+    if (QueueRequests)
+    {
+        *QueueRequests = 0;
+    }
+    if (DriverRequests)
+    {
+        *DriverRequests = 0;
+    }
+    return (WDF_IO_QUEUE_STATE)(WdfIoQueueAcceptRequests | WdfIoQueueDispatchRequests | WdfIoQueueNoRequests | WdfIoQueueDriverNoRequests);
+}
+
+//
+// Harness interface.
+//
+
+_Use_decl_annotations_
+NTSTATUS
+PwmSimCreate
+(
+    const PWMSIM_TIMING* Timing
+)
+{
+    NT_ASSERT(g_Sim == nullptr);
+
+    g_Sim = new SIM_DEVICE();
+    g_Sim->Timing = *Timing;
+    g_Sim->Arena = (PUINT8)aligned_alloc(PAGE_SIZE, ArenaSize);
+    g_AssertionCount = 0;
+
+    //
+    // What PrepareHardware sets up from the ACPI resources: the register
+    // blocks, DMA channel 4 with the PWM DREQ, and the DMA memory.
+    //
+
+    PDEVICE_CONTEXT deviceContext = &g_Sim->Context;
+    deviceContext->dmaChannelRegs = &g_Sim->DmaRegs;
+    deviceContext->dmaChannelRegsPa.QuadPart = DmaChannelRegsPa;
+    deviceContext->pwmRegs = &g_Sim->PwmRegs;
+    deviceContext->pwmRegsPa.QuadPart = PwmRegsPa;
+    deviceContext->pwmRegsBusPa.QuadPart = PwmRegsBusPa;
+    deviceContext->memUncachedOffset = 0;
+    deviceContext->cmPwmRegs = &g_Sim->CmRegs;
+    deviceContext->cmPwmRegsPa.QuadPart = CmPwmRegsPa;
+    deviceContext->dmaChannel = DmaChannel;
+    deviceContext->dmaDreq = DMA_DREQ_PWM;
+    deviceContext->dmaTransferWidth = Width32Bits;
+    deviceContext->interruptObj = InterruptHandle;
+    deviceContext->queueObj = QueueHandle;
+    deviceContext->streamWriteQueue = StreamQueueHandle;
+    deviceContext->pwmLock = PwmLockHandle;
+    deviceContext->notificationListLock = NotificationLockHandle;
+
+    NTSTATUS status = AllocateDmaBuffer(deviceContext);
+    if (!NT_SUCCESS(status))
+    {
+        PwmSimDestroy();
+        return status;
+    }
+
+    deviceContext->pwmClockConfig.ClockSource = BCM_PWM_CLOCKSOURCE_PLLC;
+    deviceContext->pwmClockConfig.Divisor = CM_PWMCTL_DIVI_PLLC_1MHZ;
+    deviceContext->pwmChannel1Config.Channel = BCM_PWM_CHANNEL_CHANNEL1;
+    deviceContext->pwmChannel1Config.Range = 0x20;
+    deviceContext->pwmChannel1Config.DutyMode = BCM_PWM_DUTYMODE_PWM;
+    deviceContext->pwmChannel1Config.Mode = BCM_PWM_MODE_PWM;
+    deviceContext->pwmChannel1Config.Polarity = BCM_PWM_POLARITY_NORMAL;
+    deviceContext->pwmChannel1Config.Repeat = BCM_PWM_REPEATMODE_OFF;
+    deviceContext->pwmChannel1Config.Silence = BCM_PWM_SILENCELEVEL_LOW;
+    deviceContext->pwmChannel2Config = deviceContext->pwmChannel1Config;
+    deviceContext->pwmChannel2Config.Channel = BCM_PWM_CHANNEL_CHANNEL2;
+    deviceContext->pwmMode = PWM_MODE_REGISTER;
+    InitializeListHead(&deviceContext->notificationList);
+    KeQueryPerformanceCounter(&deviceContext->dmaPerformanceFrequency);
+    deviceContext->dmaLastKnownCompletedPacket = NO_LAST_COMPLETED_PACKET;
+    deviceContext->dmaProfile = BCM_PWM_AUDIO_PROFILE_DEFAULT;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+PwmSimDestroy()
+{
+    if (g_Sim == nullptr)
+    {
+        return;
+    }
+
+    PLIST_ENTRY entry = g_Sim->Context.notificationList.Flink;
+    while (entry && (entry != &g_Sim->Context.notificationList))
+    {
+        PLIST_ENTRY next = entry->Flink;
+        ExFreePoolWithTag(CONTAINING_RECORD(entry, NOTIFICATION_LIST_ENTRY, ListEntry), BCM_PWM_POOLTAG);
+        entry = next;
+    }
+    if (g_Sim->Context.dmaRing)
+    {
+        ExFreePoolWithTag(g_Sim->Context.dmaRing, BCM_PWM_POOLTAG);
+    }
+    free(g_Sim->Arena);
+    delete g_Sim;
+    g_Sim = nullptr;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+PwmSimIoctl
+(
+    ULONG IoControlCode,
+    PVOID InputBuffer,
+    ULONG InputBufferLength,
+    PVOID OutputBuffer,
+    ULONG OutputBufferLength
+)
+{
+    WDFREQUEST__ request = { InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, 0 };
+
+    switch (IoControlCode)
+    {
+    case IOCTL_BCM_PWM_AQUIRE_AUDIO:
+        return AquireAudio(DeviceHandle);
+    case IOCTL_BCM_PWM_RELEASE_AUDIO:
+        return ReleaseAudio(DeviceHandle);
+    case IOCTL_BCM_PWM_INITIALIZE_AUDIO:
+        return InitializeAudio(DeviceHandle, &request);
+    case IOCTL_BCM_PWM_REGISTER_AUDIO_NOTIFICATION:
+        return RegisterAudioNotification(DeviceHandle, &request);
+    case IOCTL_BCM_PWM_UNREGISTER_AUDIO_NOTIFICATION:
+        return UnregisterAudioNotification(DeviceHandle, &request);
+    case IOCTL_BCM_PWM_START_AUDIO:
+        return StartAudio(DeviceHandle);
+    case IOCTL_BCM_PWM_PAUSE_AUDIO:
+        return PauseAudio(DeviceHandle);
+    case IOCTL_BCM_PWM_RESUME_AUDIO:
+        return ResumeAudio(DeviceHandle);
+    case IOCTL_BCM_PWM_STOP_AUDIO:
+        return StopAudio(DeviceHandle);
+    }
+    return STATUS_INVALID_PARAMETER;
+}
+
+_Use_decl_annotations_
+PVOID
+PwmSimCreateEvent
+(
+    PWMSIM_CALLBACK* Callback,
+    PVOID Context
+)
+{
+    return new KEVENT{ Callback, Context };
+}
+
+_Use_decl_annotations_
+VOID
+PwmSimDeleteEvent
+(
+    PVOID Event
+)
+{
+    delete (PKEVENT)Event;
+}
+
+ULONGLONG
+PwmSimNow()
+{
+    return g_Sim->Now;
+}
+
+_Use_decl_annotations_
+VOID
+PwmSimSchedule
+(
+    ULONGLONG TimeNs,
+    PWMSIM_CALLBACK* Callback,
+    PVOID Context
+)
+{
+    ScheduleEvent(max(TimeNs, g_Sim->Now), EventCallback, Callback, Context);
+}
+
+_Use_decl_annotations_
+VOID
+PwmSimRun
+(
+    ULONGLONG DurationNs
+)
+{
+    ULONGLONG end = g_Sim->Now + DurationNs;
+    while (!g_Sim->Events.empty() && (g_Sim->Events.top().Time <= end))
+    {
+        EVENT event = g_Sim->Events.top();
+        g_Sim->Events.pop();
+        g_Sim->Now = event.Time;
+        switch (event.Type)
+        {
+        case EventPwmFrame:
+            PwmFrame();
+            break;
+        case EventIsr:
+            RunIsr();
+            break;
+        case EventDpc:
+            RunDpc();
+            break;
+        case EventCallback:
+            event.Callback(event.Context);
+            break;
+        }
+    }
+    g_Sim->Now = end;
+}
+
+_Use_decl_annotations_
+VOID
+PwmSimCapture
+(
+    std::vector<UINT32>* Capture
+)
+{
+    g_Sim->Capture = Capture;
+}
+
+_Use_decl_annotations_
+VOID
+PwmSimGetStats
+(
+    PPWMSIM_STATS Stats
+)
+{
+    *Stats = g_Sim->Stats;
+    Stats->DriverUnderflows = g_Sim->Context.dmaUnderflowErrorCount;
+    Stats->AssertionCount = g_AssertionCount;
+}
+
+VOID
+PwmSimResetStats()
+{
+    memset(&g_Sim->Stats, 0, sizeof(g_Sim->Stats));
+}
+
+_Use_decl_annotations_
+VOID
+PwmSimSetTraceLevel
+(
+    ULONG Level
+)
+{
+    g_TraceLevel = Level;
+}
+
+ULONGLONG
+PwmSimReadCycles()
+{
+    int fd = CycleCounter();
+    if (fd >= 0)
+    {
+        ULONGLONG count;
+        if (read(fd, &count, sizeof(count)) == sizeof(count))
+        {
+            return count;
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+const char*
+PwmSimCycleUnit()
+{
+    if (CycleCounter() >= 0)
+    {
+        return "cycles";
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return "TSC ticks";
+#else
+    return "ns";
+#endif
+}
@@ -0,0 +1,192 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Harness side interface of the simulated PWM device.
+
+    The audio path of the PWM driver (dma.cpp, dmaInterrupt.cpp and pwm.cpp)
+    runs unmodified on top of a model of the DMA channel, the PWM FIFO and
+    the PWM clock. The harness talks to the driver through PwmSimIoctl, like
+    rpiwav.sys does through PwmIoctlCall, and gets the notification events
+    of the driver DPC as callbacks.
+
+    Time is simulated, in ns. Every event runs to completion at its time:
+    a PWM frame, a DMA interrupt running DmaIsr, a DPC running DmaDpc, or a
+    callback scheduled by the harness. The DMA controller is much faster
+    than the PWM, so it moves words to the FIFO as soon as the FIFO has room
+    and never delays playback on its own. It reads the NEXTCONBK of a
+    control block when it loads the block, like the hardware, so a packet
+    linked after the last control block before it was loaded is not played.
+
+    Include after rpiwav.h or the wdk/ stand-ins, which both provide the
+    basic types and bcm2836pwm.h.
+
+--*/
+
+#pragma once
+
+#include <vector>
+
+//
+// PWM FIFO depth in 32 bit words, shared by both channels.
+//
+
+#define PWMSIM_FIFO_WORDS       16
+
+typedef VOID PWMSIM_CALLBACK(PVOID Context);
+
+typedef struct _PWMSIM_TIMING
+{
+    //
+    // Delay from a control block raising INT to DmaIsr, and from the ISR
+    // queuing the DPC to DmaDpc.
+    //
+    ULONG   IsrLatencyNs;
+    ULONG   DpcLatencyNs;
+} PWMSIM_TIMING, *PPWMSIM_TIMING;
+
+typedef struct _PWMSIM_STATS
+{
+    //
+    // PWM frames played from the FIFO, and frames the PWM found the FIFO
+    // empty while the channels were enabled.
+    //
+    ULONGLONG   FramesPlayed;
+    ULONGLONG   FramesMissed;
+
+    //
+    // Control blocks the DMA completed, and the times the DMA stopped at a
+    // control block without a link.
+    //
+    ULONGLONG   ControlBlocks;
+    ULONGLONG   DmaStops;
+
+    //
+    // ISR and DPC calls and the CPU time they took, in PwmSimCycleUnit.
+    //
+    ULONGLONG   IsrCount;
+    ULONGLONG   IsrCycles;
+    ULONGLONG   IsrMaxCycles;
+    ULONGLONG   DpcCount;
+    ULONGLONG   DpcCycles;
+
+    //
+    // Underflows detected by the driver, dmaUnderflowErrorCount of the
+    // device context, which StopAudio resets.
+    //
+    ULONG       DriverUnderflows;
+
+    ULONG       AssertionCount;
+} PWMSIM_STATS, *PPWMSIM_STATS;
+
+//
+// Creates the device and runs the parts of PrepareHardware the audio path
+// needs, with the DMA, PWM and clock registers of the simulated devices.
+//
+
+NTSTATUS
+PwmSimCreate
+(
+    _In_    const PWMSIM_TIMING*    Timing
+);
+
+VOID
+PwmSimDestroy();
+
+//
+// Dispatches the audio IOCTLs to the driver routines OnIoDeviceControl
+// calls for them.
+//
+
+NTSTATUS
+PwmSimIoctl
+(
+    _In_    ULONG   IoControlCode,
+    _In_    PVOID   InputBuffer,
+    _In_    ULONG   InputBufferLength,
+    _Out_   PVOID   OutputBuffer,
+    _In_    ULONG   OutputBufferLength
+);
+
+//
+// Creates an event for IOCTL_BCM_PWM_REGISTER_AUDIO_NOTIFICATION, each
+// KeSetEvent on it calls Callback.
+//
+
+PVOID
+PwmSimCreateEvent
+(
+    _In_    PWMSIM_CALLBACK*    Callback,
+    _In_    PVOID               Context
+);
+
+VOID
+PwmSimDeleteEvent
+(
+    _In_    PVOID   Event
+);
+
+//
+// Simulated time in ns, harness callbacks and running the simulation.
+//
+
+ULONGLONG
+PwmSimNow();
+
+VOID
+PwmSimSchedule
+(
+    _In_    ULONGLONG           TimeNs,
+    _In_    PWMSIM_CALLBACK*    Callback,
+    _In_    PVOID               Context
+);
+
+VOID
+PwmSimRun
+(
+    _In_    ULONGLONG   DurationNs
+);
+
+//
+// Appends the left and right value of every PWM frame to Capture, missed
+// frames as 0 like the PWM outputs with the silence bit low. NULL stops
+// capturing.
+//
+
+VOID
+PwmSimCapture
+(
+    _In_opt_    std::vector<UINT32>*    Capture
+);
+
+VOID
+PwmSimGetStats
+(
+    _Out_   PPWMSIM_STATS   Stats
+);
+
+VOID
+PwmSimResetStats();
+
+//
+// Prints the driver traces up to Level.
+//
+
+VOID
+PwmSimSetTraceLevel
+(
+    _In_    ULONG   Level
+);
+
+//
+// CPU time stamps for the cost measurements. Core cycles from the perf
+// counters where the host allows them, otherwise the time stamp counter on
+// x86 or nanoseconds.
+//
+
+ULONGLONG
+PwmSimReadCycles();
+
+const char*
+PwmSimCycleUnit();
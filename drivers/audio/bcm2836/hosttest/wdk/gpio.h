@@ -0,0 +1,11 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    Host-side test harness stand-in for gpio.h, which driver.h includes
+    but the audio path does not use.
+
+--*/
+
+#pragma once
@@ -0,0 +1,335 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Abstract:
+    The subset of the WDK kernel and KMDF headers the audio path of the
+    BCM2836 PWM driver compiles against. dma.cpp, dmaInterrupt.cpp and
+    pwm.cpp build unmodified on top of it, the routines are implemented by
+    the simulated device in sim/pwmsim.cpp. Types keep their Windows
+    widths, so the driver structures and the shared audio ring keep their
+    layout.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//
+// Target version, bcm2836pwm.h only exposes the audio ring to Threshold and
+// later.
+//
+
+#define NTDDI_WINTHRESHOLD          0x0A000000
+#define NTDDI_VERSION               NTDDI_WINTHRESHOLD
+
+//
+// Compiler keywords.
+//
+
+#define __declspec(x)               __declspec_##x
+#define __declspec_align(n)         __attribute__((aligned(n)))
+#define __forceinline               inline __attribute__((always_inline))
+#define FORCEINLINE                 __forceinline
+#define DECLSPEC_ALIGN(n)           __attribute__((aligned(n)))
+#define INITGUID
+
+//
+// SAL annotations.
+//
+
+#define _Use_decl_annotations_
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _In_reads_(n)
+#define _In_reads_bytes_(n)
+#define _Out_writes_all_(n)
+#define _Inout_updates_(n)
+#define _Must_inspect_result_
+#define _Function_class_(n)
+#define _IRQL_requires_(n)
+#define _IRQL_requires_max_(n)
+#define _IRQL_requires_same_
+
+//
+// Base types.
+//
+
+typedef void                VOID;
+typedef void*               PVOID;
+typedef char                CHAR;
+typedef CHAR*               PCHAR;
+typedef unsigned char       UCHAR;
+typedef UCHAR*              PUCHAR;
+typedef int16_t             SHORT;
+typedef uint16_t            USHORT;
+typedef int32_t             LONG;
+typedef LONG*               PLONG;
+typedef uint32_t            ULONG;
+typedef ULONG*              PULONG;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef int8_t              INT8;
+typedef uint8_t             UINT8;
+typedef UINT8*              PUINT8;
+typedef int16_t             INT16;
+typedef int32_t             INT32;
+typedef uint32_t            UINT32;
+typedef UINT32*             PUINT32;
+typedef uint32_t            DWORD;
+typedef uintptr_t           ULONG_PTR;
+typedef uintptr_t           UINT_PTR;
+typedef ULONG_PTR           SIZE_T;
+typedef UCHAR               BOOLEAN;
+typedef LONG                NTSTATUS;
+typedef LONG                KPRIORITY;
+
+#ifndef NULL
+#define NULL                0
+#endif
+#define TRUE                1
+#define FALSE               0
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef LARGE_INTEGER PHYSICAL_ADDRESS, *PPHYSICAL_ADDRESS;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY* Flink;
+    struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _KEVENT KEVENT, *PKEVENT, *PRKEVENT;
+typedef struct _EPROCESS* PEPROCESS;
+
+//
+// Helper macros.
+//
+
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+#define FIELD_OFFSET(t, f)          ((LONG)offsetof(t, f))
+#define CONTAINING_RECORD(a, t, f)  ((t*)((PCHAR)(a) - offsetof(t, f)))
+#define PAGED_CODE()
+#define RtlCopyMemory(d, s, l)      memcpy((d), (s), (l))
+#define RtlZeroMemory(d, l)         memset((d), 0, (l))
+
+#ifndef min
+#define min(a, b)                   (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)                   (((a) > (b)) ? (a) : (b))
+#endif
+
+#define PAGE_SIZE                   0x1000
+#define ROUND_TO_PAGES(s)           (((ULONG_PTR)(s) + PAGE_SIZE - 1) & ~((ULONG_PTR)PAGE_SIZE - 1))
+
+//
+// Status codes.
+//
+
+#define NT_SUCCESS(s)                       (((NTSTATUS)(s)) >= 0)
+#define NT_ERROR(s)                         ((((ULONG)(s)) >> 30) == 3)
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103L)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_ACCESS_DENIED                ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_CANCELLED                    ((NTSTATUS)0xC0000120L)
+#define STATUS_DEVICE_CONFIGURATION_ERROR   ((NTSTATUS)0xC0000182L)
+#define STATUS_OPERATION_IN_PROGRESS        ((NTSTATUS)0xC0000239L)
+
+//
+// IOCTL codes.
+//
+
+#define METHOD_BUFFERED             0
+#define FILE_WRITE_DATA             0x0002
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+//
+// Lists.
+//
+
+inline VOID InitializeListHead(PLIST_ENTRY ListHead)
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+inline BOOLEAN IsListEmpty(const LIST_ENTRY* ListHead)
+{
+    return ListHead->Flink == ListHead;
+}
+
+inline VOID InsertTailList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+    Entry->Flink = ListHead;
+    Entry->Blink = ListHead->Blink;
+    ListHead->Blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+inline BOOLEAN RemoveEntryList(PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY flink = Entry->Flink;
+    PLIST_ENTRY blink = Entry->Blink;
+    blink->Flink = flink;
+    flink->Blink = blink;
+    return flink == blink;
+}
+
+//
+// Register and shared memory access. The register accessors are routed to
+// the simulated devices, the ring accessors map to the compiler atomics.
+//
+
+ULONG READ_REGISTER_ULONG(volatile ULONG* Register);
+VOID WRITE_REGISTER_ULONG(volatile ULONG* Register, ULONG Value);
+
+inline ULONG ReadULongAcquire(volatile const ULONG* Source)
+{
+    return __atomic_load_n(Source, __ATOMIC_ACQUIRE);
+}
+
+inline VOID WriteULongRelease(volatile ULONG* Destination, ULONG Value)
+{
+    __atomic_store_n(Destination, Value, __ATOMIC_RELEASE);
+}
+
+#define KeMemoryBarrier()           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+//
+// Kernel routines.
+//
+
+typedef enum _POOL_TYPE {
+    NonPagedPoolNx = 512
+} POOL_TYPE;
+
+typedef ULONG NODE_REQUIREMENT;
+
+#define MM_ANY_NODE_OK              0x80000000
+#define PAGE_READWRITE              0x04
+#define PAGE_NOCACHE                0x200
+#define IO_NO_INCREMENT             0
+
+PVOID MmAllocateContiguousNodeMemory(SIZE_T NumberOfBytes, PHYSICAL_ADDRESS LowestAcceptableAddress,
+    PHYSICAL_ADDRESS HighestAcceptableAddress, PHYSICAL_ADDRESS BoundaryAddressMultiple, ULONG Protect,
+    NODE_REQUIREMENT PreferredNode);
+VOID MmFreeContiguousMemory(PVOID BaseAddress);
+PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID BaseAddress);
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag);
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag);
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency);
+VOID KeStallExecutionProcessor(ULONG MicroSeconds);
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait);
+PEPROCESS IoGetCurrentProcess();
+
+VOID SimAssertionFailure(const char* Expression, const char* File, int Line);
+
+#define NT_ASSERT(e) \
+    ((void)((e) ? 0 : (SimAssertionFailure(#e, __FILE__, __LINE__), 0)))
+
+//
+// WPP tracing, TraceEvents prints at the level selected by the harness.
+//
+
+#define TRACE_LEVEL_NONE            0
+#define TRACE_LEVEL_CRITICAL        1
+#define TRACE_LEVEL_ERROR           2
+#define TRACE_LEVEL_WARNING         3
+#define TRACE_LEVEL_INFORMATION     4
+#define TRACE_LEVEL_VERBOSE         5
+
+enum {
+    TRACE_INIT,
+    TRACE_DEVICE,
+    TRACE_IOCTL,
+    TRACE_IO,
+    TRACE_IRQ,
+    TRACE_FUNC
+};
+
+VOID SimTrace(ULONG Level, const char* Format, ...) __attribute__((format(printf, 2, 3)));
+
+#define TraceEvents(Level, Flags, ...)  SimTrace((Level), __VA_ARGS__)
+
+//
+// KMDF handles and the routines the audio path calls.
+//
+
+typedef PVOID WDFOBJECT;
+typedef struct WDFDEVICE__* WDFDEVICE;
+typedef struct WDFREQUEST__* WDFREQUEST;
+typedef struct WDFINTERRUPT__* WDFINTERRUPT;
+typedef struct WDFSPINLOCK__* WDFSPINLOCK;
+typedef struct WDFQUEUE__* WDFQUEUE;
+typedef struct WDFFILEOBJECT__* WDFFILEOBJECT;
+typedef struct WDFDRIVER__* WDFDRIVER;
+typedef struct WDFCMRESLIST__* WDFCMRESLIST;
+typedef struct WDFDEVICE_INIT* PWDFDEVICE_INIT;
+typedef struct _DRIVER_OBJECT* PDRIVER_OBJECT;
+typedef struct _UNICODE_STRING* PUNICODE_STRING;
+
+typedef enum _DMA_WIDTH {
+    Width8Bits,
+    Width16Bits,
+    Width32Bits,
+    Width64Bits,
+    WidthNoWrap,
+    MaximumDmaWidth
+} DMA_WIDTH;
+
+typedef enum _WDF_IO_QUEUE_STATE {
+    WdfIoQueueAcceptRequests = 0x01,
+    WdfIoQueueDispatchRequests = 0x02,
+    WdfIoQueueNoRequests = 0x04,
+    WdfIoQueueDriverNoRequests = 0x08,
+    WdfIoQueuePnpHeld = 0x10
+} WDF_IO_QUEUE_STATE;
+
+PVOID SimGetObjectContext(WDFOBJECT Handle);
+
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(type, name) \
+    inline type* name(WDFOBJECT Handle) { return (type*)SimGetObjectContext(Handle); }
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+typedef VOID EVT_WDF_DRIVER_UNLOAD(WDFDRIVER Driver);
+typedef NTSTATUS EVT_WDF_DRIVER_DEVICE_ADD(WDFDRIVER Driver, PWDFDEVICE_INIT DeviceInit);
+typedef NTSTATUS EVT_WDF_DEVICE_PREPARE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesRaw, WDFCMRESLIST ResourcesTranslated);
+typedef NTSTATUS EVT_WDF_DEVICE_RELEASE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesTranslated);
+typedef VOID EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL(WDFQUEUE Queue, WDFREQUEST Request, size_t OutputBufferLength,
+    size_t InputBufferLength, ULONG IoControlCode);
+typedef VOID EVT_WDF_DEVICE_CONTEXT_CLEANUP(WDFOBJECT Object);
+typedef VOID EVT_WDF_FILE_CLEANUP(WDFFILEOBJECT FileObject);
+typedef BOOLEAN EVT_WDF_INTERRUPT_ISR(WDFINTERRUPT Interrupt, ULONG MessageID);
+typedef VOID EVT_WDF_INTERRUPT_DPC(WDFINTERRUPT Interrupt, WDFOBJECT AssociatedObject);
+
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock);
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock);
+VOID WdfInterruptAcquireLock(WDFINTERRUPT Interrupt);
+VOID WdfInterruptReleaseLock(WDFINTERRUPT Interrupt);
+BOOLEAN WdfInterruptQueueDpcForIsr(WDFINTERRUPT Interrupt);
+WDFDEVICE WdfInterruptGetDevice(WDFINTERRUPT Interrupt);
+NTSTATUS WdfRequestRetrieveInputBuffer(WDFREQUEST Request, size_t MinimumRequiredLength, PVOID* Buffer, size_t* Length);
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize, PVOID* Buffer, size_t* Length);
+VOID WdfRequestSetInformation(WDFREQUEST Request, ULONG_PTR Information);
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status);
+WDFFILEOBJECT WdfRequestGetFileObject(WDFREQUEST Request);
+NTSTATUS WdfRequestForwardToIoQueue(WDFREQUEST Request, WDFQUEUE DestinationQueue);
+NTSTATUS WdfIoQueueRetrieveNextRequest(WDFQUEUE Queue, WDFREQUEST* OutRequest);
+WDF_IO_QUEUE_STATE WdfIoQueueGetState(WDFQUEUE Queue, PULONG QueueRequests, PULONG DriverRequests);
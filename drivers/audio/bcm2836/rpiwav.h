@@ -54,6 +54,11 @@ DEFINE_GUIDSTRUCT("DCA49BAE-8129-4901-91E2-BAF50AF71D96", PID_RPIWAV);
 #define KSPROPERTY_TYPE_ALL         KSPROPERTY_TYPE_BASICSUPPORT | \
                                     KSPROPERTY_TYPE_GET | \
                                     KSPROPERTY_TYPE_SET
+
+// Channels of the topology volume and mute nodes. The master channel of
+// KSNODEPROPERTY_AUDIO_CHANNEL addresses all channels.
+#define MIXER_MAX_CHANNELS          2
+#define MIXER_CHANNEL_MASTER        ((ULONG)-1)
  
 // Flags to identify stream processing mode
 typedef enum {
@@ -177,6 +182,12 @@ NTSTATUS PropertyHandler_Topology
     _In_  PPCPROPERTY_REQUEST PropertyRequest 
 );
 
+// Generic topology event handler
+NTSTATUS EventHandler_Topology
+(
+    _In_  PPCEVENT_REQUEST EventRequest
+);
+
 // Default WaveFilter automation table.
 // Handles the GeneralComponentId request.
 NTSTATUS PropertyHandler_WaveFilter
@@ -189,6 +200,11 @@ NTSTATUS PropertyHandler_OffloadPin
     _In_ PPCPROPERTY_REQUEST PropertyRequest
 );
 
+//
+// PWM audio profile, selected by the LowLatency driver parameter.
+//
+extern BCM_PWM_AUDIO_PROFILE gPwmAudioProfile;
+
 // common.h uses some of the above definitions.
 #include "common.h"
 #include "kshelper.h"
@@ -173,6 +173,14 @@ extern "C" {
 
 //
 // Initializes PWM for audio playback. This includes configuration of the PWM channels and setup of the DMA control blocks.
+// Audio runs from a BCM_PWM_AUDIO_CLOCK_FREQUENCY PWM clock, PwmRange selects the PWM sample rate. A SampleRate
+// of 0 selects BCM_PWM_AUDIO_DEFAULT_SAMPLE_RATE. The caller compensates the difference between the PWM sample
+// rate and SampleRate by shortening packets through LengthPtr of the packet link info before linking them.
+// Profile selects how many packets are kept queued for DMA. BCM_PWM_AUDIO_PROFILE_DEFAULT keeps the DMA buffer
+// mostly filled. BCM_PWM_AUDIO_PROFILE_LOW_LATENCY keeps only QueueDepth packets of the ring queued, a depth
+// which grows after underflows and shrinks again while playback is stable.
+// On return DmaRing points to the shared ring of the audio stream, see BCM_PWM_AUDIO_RING. The caller must check
+// the ring version before using it.
 // 
 // Input buffer:
 // lpInBuffer - pointer to a variable of type BCM_PWM_AUDIO_CONFIG
@@ -183,6 +191,9 @@ extern "C" {
 //
 #define IOCTL_BCM_PWM_INITIALIZE_AUDIO              CTL_CODE(FILE_DEVICE_PWM_PERIPHERAL, 0x70A, METHOD_BUFFERED, FILE_WRITE_DATA)
 
+#define BCM_PWM_AUDIO_CLOCK_FREQUENCY               100000000
+#define BCM_PWM_AUDIO_DEFAULT_SAMPLE_RATE           44100
+
 //
 // Register an event for notification by the driver. During the allocation the driver receives the number of
 // notifications sent per buffer.
@@ -253,6 +264,52 @@ extern "C" {
 //
 #define IOCTL_BCM_PWM_RESUME_AUDIO                  CTL_CODE(FILE_DEVICE_PWM_PERIPHERAL, 0x710, METHOD_BUFFERED, FILE_WRITE_DATA)
 
+//
+// Start streaming duty values by DMA.
+// The clock and channel configuration must be set before, all PWM channels must be stopped. The field channel
+// in the input variable specifies the channel(s) fed from the PWM FIFO. For BCM_PWM_CHANNEL_ALLCHANNELS the duty
+// values are interleaved, starting with channel 1. A channel configured with BCM_PWM_REPEATMODE_ON repeats the
+// last duty value when the stream runs empty, otherwise it outputs the silence level.
+// On return the field MaxValuesPerWrite contains the maximal number of duty values for a single write.
+//
+// Input buffer:
+// lpInBuffer - pointer to a variable of type BCM_PWM_STREAM_CONFIG
+// nInBufferSize - sizeof(BCM_PWM_STREAM_CONFIG)
+//
+// Output buffer:
+// lpOutBuffer - pointer to a variable of type BCM_PWM_STREAM_CONFIG
+// nOutBufferSize - sizeof(BCM_PWM_STREAM_CONFIG)
+//
+#define IOCTL_BCM_PWM_START_STREAM                  CTL_CODE(FILE_DEVICE_PWM_PERIPHERAL, 0x711, METHOD_BUFFERED, FILE_WRITE_DATA)
+
+//
+// Queue duty values for streaming.
+// The driver double buffers the stream, a write is completed as soon as its values are queued for DMA. If both
+// buffers are in use, the write is pending until DMA has played one of them. Writes are played in order and
+// without gaps as long as the next write is issued before the previous one has been played.
+//
+// Input buffer:
+// lpInBuffer - pointer to an array of ULONG duty values
+// nInBufferSize - number of duty values * sizeof(ULONG), up to MaxValuesPerWrite values. For interleaved
+//                 channels the number of duty values must be even.
+//
+// Output buffer:
+// None
+//
+#define IOCTL_BCM_PWM_WRITE_STREAM                  CTL_CODE(FILE_DEVICE_PWM_PERIPHERAL, 0x712, METHOD_BUFFERED, FILE_WRITE_DATA)
+
+//
+// Stop streaming duty values. Queued duty values are discarded and pending writes are cancelled.
+// Only the handle that started the stream can stop it, closing that handle stops the stream as well.
+//
+// Input buffer:
+// None
+//
+// Output buffer:
+// None
+//
+#define IOCTL_BCM_PWM_STOP_STREAM                   CTL_CODE(FILE_DEVICE_PWM_PERIPHERAL, 0x713, METHOD_BUFFERED, FILE_WRITE_DATA)
+
 
 typedef enum _BCM_PWM_CHANNEL {
     BCM_PWM_CHANNEL_CHANNEL1,
@@ -310,25 +367,132 @@ typedef struct _BCM_PWM_SET_DUTY_REGISTER {
     ULONG                   Duty;
 } BCM_PWM_SET_DUTY_REGISTER, *PBCM_PWM_SET_DUTY_REGISTER;
 
+typedef enum _BCM_PWM_AUDIO_PROFILE {
+    BCM_PWM_AUDIO_PROFILE_DEFAULT,
+    BCM_PWM_AUDIO_PROFILE_LOW_LATENCY,
+} BCM_PWM_AUDIO_PROFILE;
+
 typedef struct _BCM_PWM_PACKET_LINK_INFO {
     PVOID                   LinkPtr;
     ULONG                   LinkValue;
+    PVOID                   LengthPtr;
+    ULONG                   LengthValue;
 } BCM_PWM_PACKET_LINK_INFO, *PBCM_PWM_PACKET_LINK_INFO;
 
+//
+// Shared ring between the audio driver (producer) and the PWM driver (consumer) of an audio stream.
+//
+// The ring resides in cached nonpaged memory of the PWM driver. Each field is written by one side only and the
+// fields of each side are in a separate cache line. Indices count since IOCTL_BCM_PWM_INITIALIZE_AUDIO and wrap
+// around at 2^32, differences of indices are computed modulo 2^32.
+//
+// ProducerIndex        - number of packets linked into the DMA control block list by the audio driver. The
+//                        packets in use by DMA are ProducerIndex - ConsumerIndex. Before a restart the audio
+//                        driver unlinks all packets and sets ProducerIndex to ConsumerIndex.
+// PrimeAckIndex        - number of packets requested through PrimeRequestIndex the audio driver has asked
+//                        the audio stack for.
+// RestartAckCount      - number of restart requests the audio driver has handled.
+//
+// ConsumerIndex        - number of packets unlinked by the PWM driver after DMA has played them. After an
+//                        underflow the PWM driver sets ConsumerIndex to ProducerIndex.
+// PrimeRequestIndex    - number of packets the PWM driver has requested to keep DMA busy. The audio driver
+//                        asks the audio stack for PrimeRequestIndex - PrimeAckIndex packets.
+// RestartRequestCount  - number of DMA restart requests. A restart is pending while RestartRequestCount differs
+//                        from RestartAckCount.
+// QueueDepth           - number of packets to keep queued for DMA.
+// PacketsProcessed     - number of packets played by DMA.
+// LastProcessedPacketTime - performance counter value of the last processed packet.
+//
+// GetPosition          - returns the live playback position, see BCM_PWM_GET_AUDIO_POSITION. Set by the PWM driver
+//                        on IOCTL_BCM_PWM_INITIALIZE_AUDIO and called with GetPositionContext.
+//
+// Memory ordering: a side reads the indices of the other side with acquire semantics (ReadULongAcquire) and
+// publishes its own indices with release semantics (WriteULongRelease), after the control block writes they
+// announce. The audio driver links packets before it publishes ProducerIndex, and the PWM driver unlinks packets
+// before it publishes ConsumerIndex, so a packet is only reused by the audio driver after its link has been
+// cleared. A batch of packets is linked back to front and published with a single ProducerIndex update.
+//
+
+#define BCM_PWM_AUDIO_RING_VERSION                  2
+#define BCM_PWM_CACHE_LINE_SIZE                     64
+
+//
+// Live playback position of the audio stream.
+//
+// PacketsPlayed        - number of packets played by DMA, counted like PacketsProcessed of the ring. Includes the
+//                        packets DMA has completed, but the ISR has not processed yet.
+// PacketBytesPlayed    - number of bytes of the current packet transferred by DMA, derived from the CONBLK_AD and
+//                        TXFR_LEN registers of the DMA channel. Frames dropped by the drift correction are counted
+//                        as played.
+// PerformanceCounter   - performance counter value at which the DMA registers were sampled.
+//
+
+typedef struct _BCM_PWM_AUDIO_POSITION {
+    ULONG                   PacketsPlayed;
+    ULONG                   PacketBytesPlayed;
+    LARGE_INTEGER           PerformanceCounter;
+} BCM_PWM_AUDIO_POSITION, *PBCM_PWM_AUDIO_POSITION;
+
+//
+// Reads the live playback position without an IOCTL round trip. Callable at IRQL <= DISPATCH_LEVEL from kernel
+// mode while the audio mode is aquired.
+//
+
+typedef
+VOID
+BCM_PWM_GET_AUDIO_POSITION(
+    _In_    PVOID                   Context,
+    _Out_   PBCM_PWM_AUDIO_POSITION Position
+    );
+
+typedef BCM_PWM_GET_AUDIO_POSITION *PBCM_PWM_GET_AUDIO_POSITION;
+
+typedef struct _BCM_PWM_AUDIO_RING {
+    ULONG                   Version;
+    ULONG                   Size;
+    ULONG                   NumPackets;
+    PBCM_PWM_GET_AUDIO_POSITION GetPosition;
+    PVOID                   GetPositionContext;
+
+    //
+    // Written by the audio driver.
+    //
+
+    DECLSPEC_ALIGN(BCM_PWM_CACHE_LINE_SIZE)
+    volatile ULONG          ProducerIndex;
+    volatile ULONG          PrimeAckIndex;
+    volatile ULONG          RestartAckCount;
+
+    //
+    // Written by the PWM driver.
+    //
+
+    DECLSPEC_ALIGN(BCM_PWM_CACHE_LINE_SIZE)
+    volatile ULONG          ConsumerIndex;
+    volatile ULONG          PrimeRequestIndex;
+    volatile ULONG          RestartRequestCount;
+    volatile ULONG          QueueDepth;
+    volatile ULONG          PacketsProcessed;
+    LARGE_INTEGER           LastProcessedPacketTime;
+} BCM_PWM_AUDIO_RING, *PBCM_PWM_AUDIO_RING;
+
 typedef struct _BCM_PWM_AUDIO_CONFIG {
     ULONG                   RequestedBufferSize;
     ULONG                   NotificationsPerBuffer;
     ULONG                   PwmRange;
+    ULONG                   SampleRate;
+    BCM_PWM_AUDIO_PROFILE   Profile;
     PVOID                   DmaBuffer;
-    PBOOLEAN                DmaRestartRequired;
     PBCM_PWM_PACKET_LINK_INFO DmaPacketLinkInfo;
     ULONG                   DmaNumPackets;
-    PULONG                  DmaPacketsInUse;
-    PULONG                  DmaPacketsToPrime;
-    PULONG                  DmaPacketsProcessed;
-    PLARGE_INTEGER          DmaLastProcessedPacketTime;
+    PBCM_PWM_AUDIO_RING     DmaRing;
 } BCM_PWM_AUDIO_CONFIG, *PBCM_PWM_AUDIO_CONFIG;
 
+typedef struct _BCM_PWM_STREAM_CONFIG {
+    BCM_PWM_CHANNEL         Channel;
+    ULONG                   MaxValuesPerWrite;
+} BCM_PWM_STREAM_CONFIG, *PBCM_PWM_STREAM_CONFIG;
+
 #ifdef __cplusplus
 } // extern "C"
 #endif // __cplusplus
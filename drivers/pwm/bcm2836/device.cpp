@@ -62,6 +62,19 @@ Return Value:
 
     WdfDeviceInitSetExclusive(DeviceInit, TRUE);
 
+    //
+    // Set file object callbacks, a stream left running by a client is stopped when its handle is closed.
+    //
+
+    WDF_FILEOBJECT_CONFIG fileObjectConfig;
+    WDF_FILEOBJECT_CONFIG_INIT(
+        &fileObjectConfig,
+        WDF_NO_EVENT_CALLBACK,
+        WDF_NO_EVENT_CALLBACK,
+        OnFileCleanup
+        );
+    WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileObjectConfig, WDF_NO_OBJECT_ATTRIBUTES);
+
     //
     // Create device object.
     //
@@ -153,6 +166,29 @@ Return Value:
         goto Exit;
     }
 
+    //
+    // Create a manual queue for stream writes waiting for a free stream buffer.
+    //
+
+    WDF_IO_QUEUE_CONFIG_INIT(
+        &queueConfig,
+        WdfIoQueueDispatchManual);
+
+    queueConfig.PowerManaged = WdfFalse;
+
+    status = WdfIoQueueCreate(
+        device,
+        &queueConfig,
+        WDF_NO_OBJECT_ATTRIBUTES,
+        &deviceContext->streamWriteQueue
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_INIT, "Can not create stream write queue (0x%08x)", status);
+        goto Exit;
+    }
+
     //
     // Create a symbolic link.
     //
@@ -451,13 +487,14 @@ Return Value:
         InitializeListHead(&deviceContext->notificationList);
         deviceContext->dmaDpcForIsrErrorCount = 0;
         deviceContext->dmaUnderflowErrorCount = 0;
+        KeQueryPerformanceCounter(&deviceContext->dmaPerformanceFrequency);
+        RtlZeroMemory(deviceContext->dmaIsrTimeHistogram, sizeof(deviceContext->dmaIsrTimeHistogram));
+        deviceContext->dmaIsrTimeMaxUs = 0;
         deviceContext->dmaLastKnownCompletedPacket = NO_LAST_COMPLETED_PACKET;
-        deviceContext->dmaPacketsInUse = 0;
-        deviceContext->dmaPacketsToPrime = 0;
         deviceContext->dmaPacketsToPrimePreset = 0;
-        deviceContext->dmaPacketsProcessed = 0;
+        deviceContext->dmaPacketsSinceUnderflow = 0;
+        deviceContext->dmaProfile = BCM_PWM_AUDIO_PROFILE_DEFAULT;
         deviceContext->dmaAudioNotifcationCount = 0;
-        deviceContext->dmaRestartRequired = FALSE;
     }
     else
     {
@@ -629,13 +666,32 @@ Return Value:
         status = StopAudio(device);
         break;
 
+    case IOCTL_BCM_PWM_START_STREAM:
+        status = StartStream(device, Request);
+        break;
+
+    case IOCTL_BCM_PWM_WRITE_STREAM:
+        status = WriteStream(device, Request);
+        break;
+
+    case IOCTL_BCM_PWM_STOP_STREAM:
+        status = StopStream(device, WdfRequestGetFileObject(Request));
+        break;
+
     default:
         status = STATUS_INVALID_DEVICE_REQUEST;
         TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "Unexpected IO code in request. Request: 0x%p, Code: 0x%08x", Request, IoControlCode);
         break;
     }
 
-    WdfRequestComplete(Request, status);
+    //
+    // Pending stream writes are completed by the DPC.
+    //
+
+    if (status != STATUS_PENDING)
+    {
+        WdfRequestComplete(Request, status);
+    }
 }
 
 #pragma code_seg()
@@ -681,4 +737,49 @@ Return Value:
         MmFreeContiguousMemorySpecifyCache(deviceContext->dmaCb, deviceContext->dmaControlDataSize, MmNonCached);
         #pragma warning(pop)
     }
-}
\ No newline at end of file
+    if (deviceContext->dmaRing)
+    {
+        ExFreePoolWithTag(deviceContext->dmaRing, BCM_PWM_POOLTAG);
+    }
+}
+
+#pragma code_seg("PAGE")
+_Use_decl_annotations_
+VOID
+OnFileCleanup(
+    WDFFILEOBJECT FileObject
+)
+/*++
+
+Routine Description:
+
+    This event handles cleanup of a file object, when the last handle to it is closed.
+    A stream started through the file object is stopped.
+
+Arguments:
+
+    FileObject - Handle to the file object
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+    PDEVICE_CONTEXT deviceContext;
+    WDFDEVICE device;
+
+    device = WdfFileObjectGetDevice(FileObject);
+    deviceContext = GetContext(device);
+
+    //
+    // StopStream checks the owner again while holding the PWM lock.
+    //
+
+    if (deviceContext->pwmMode == PWM_MODE_STREAM && deviceContext->streamFileObject == FileObject)
+    {
+        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Stopping stream of closed file object 0x%p", FileObject);
+        (void)StopStream(device, FileObject);
+    }
+}
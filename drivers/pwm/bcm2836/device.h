@@ -11,6 +11,7 @@ Abstract:
 #pragma once
 
 #define NO_LAST_COMPLETED_PACKET    0xFFFFFFFF
+#define DMA_ISR_TIME_HISTOGRAM_BUCKETS  12
 
 typedef struct _DEVICE_CONTEXT
 {
@@ -43,19 +44,43 @@ typedef struct _DEVICE_CONTEXT
     // DMA processing.
     //
 
+    PBCM_PWM_AUDIO_RING         dmaRing;
+    ULONG                       dmaRingSize;
     PBCM_PWM_PACKET_LINK_INFO   dmaPacketLinkInfo;
     ULONG                       dmaMaxPackets;
     ULONG                       dmaNumPackets;
-    ULONG                       dmaPacketsInUse;
-    ULONG                       dmaPacketsToPrime;
     ULONG                       dmaPacketsToPrimePreset;
-    ULONG                       dmaPacketsProcessed;
-    LARGE_INTEGER               dmaLastProcessedPacketTime;
+    ULONG                       dmaPacketsSinceUnderflow;
+    BCM_PWM_AUDIO_PROFILE       dmaProfile;
     ULONG                       dmaLastKnownCompletedPacket;
     ULONG                       dmaAudioNotifcationCount;
     ULONG                       dmaDpcForIsrErrorCount;
     ULONG                       dmaUnderflowErrorCount;
-    BOOLEAN                     dmaRestartRequired;
+
+    //
+    // DMA ISR execution time statistics. Bucket 0 counts ISR calls below 1us,
+    // bucket n counts calls from 2^(n-1)us to below 2^n us. The last bucket
+    // counts all longer calls.
+    //
+
+    LARGE_INTEGER               dmaPerformanceFrequency;
+    ULONG                       dmaIsrTimeHistogram[DMA_ISR_TIME_HISTOGRAM_BUCKETS];
+    ULONG                       dmaIsrTimeMaxUs;
+
+    //
+    // DMA streaming. The stream buffers are played in order starting with streamBufferHead,
+    // streamBuffersQueued is the number of buffers queued for DMA. Writes waiting for a free
+    // buffer are kept in streamWriteQueue. The stream is owned by the file object that started
+    // it, and is stopped when that file object is cleaned up.
+    //
+
+    WDFQUEUE                    streamWriteQueue;
+    WDFFILEOBJECT               streamFileObject;
+    BCM_PWM_CHANNEL             streamChannel;
+    ULONG                       streamBufferHead;
+    ULONG                       streamBuffersQueued;
+    ULONGLONG                   streamValuesQueued;
+    ULONGLONG                   streamValuesPlayed;
 
     //
     // PWM configuration.
@@ -82,4 +107,5 @@ EVT_WDF_DRIVER_DEVICE_ADD           OnDeviceAdd;
 EVT_WDF_DEVICE_PREPARE_HARDWARE     PrepareHardware;
 EVT_WDF_DEVICE_RELEASE_HARDWARE     ReleaseHardware;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL  OnIoDeviceControl;
-EVT_WDF_DEVICE_CONTEXT_CLEANUP      OnDeviceContextCleanup;
\ No newline at end of file
+EVT_WDF_DEVICE_CONTEXT_CLEANUP      OnDeviceContextCleanup;
+EVT_WDF_FILE_CLEANUP                OnFileCleanup;
\ No newline at end of file
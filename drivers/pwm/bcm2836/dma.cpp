@@ -21,7 +21,7 @@ AllocateDmaBuffer(
 
 Routine Description:
 
-    Allocate a contiguous buffer for DMA and a noncached buffer of the control blocks.
+    Allocate a contiguous buffer for DMA, a noncached buffer of the control blocks and the shared audio ring.
 
 Arguments:
 
@@ -54,14 +54,13 @@ Return Value:
     if (NT_SUCCESS(status))
     {
         //
-        // Allocate non cached non paged memory for the DMA Control Blocks and for link information provided to the audio driver.
-        // For each audio packet we need 2 CBs. The second (smaller) one is used to generate audio packet notifications and is used to pause
-        // audio in case of an underflow condition. 
-        // We use a full page for CBs, which defines the maximal supported number of packets.
+        // Allocate non cached non paged memory for the DMA Control Blocks. For each audio packet we need 2 CBs. The second (smaller)
+        // one is used to generate audio packet notifications and is used to pause audio in case of an underflow condition. 
+        // We use DMA_CONTROL_DATA_PAGE_COUNT pages for CBs, which defines the maximal supported number of packets.
         //
 
-        DeviceContext->dmaControlDataSize = PAGE_SIZE;
-        DeviceContext->dmaMaxPackets = DeviceContext->dmaControlDataSize / (2 * sizeof(DMA_CB) + sizeof(BCM_PWM_PACKET_LINK_INFO));
+        DeviceContext->dmaControlDataSize = DMA_CONTROL_DATA_PAGE_COUNT * PAGE_SIZE;
+        DeviceContext->dmaMaxPackets = DeviceContext->dmaControlDataSize / (2 * sizeof(DMA_CB));
         if (NULL == (DeviceContext->dmaCb = (PDMA_CB)MmAllocateContiguousNodeMemory(DeviceContext->dmaControlDataSize, lowAddress, highAddress, boundaryAddress, PAGE_READWRITE | PAGE_NOCACHE, MM_ANY_NODE_OK)))
         {
             TraceEvents(TRACE_LEVEL_ERROR, TRACE_INIT, "Can not allocate %d bytes of non paged memory for control blocks.", DeviceContext->dmaControlDataSize);
@@ -78,7 +77,31 @@ Return Value:
 
             DeviceContext->dmaCbPa = MmGetPhysicalAddress(DeviceContext->dmaCb);
             DeviceContext->dmaBufferPa = MmGetPhysicalAddress(DeviceContext->dmaBuffer);
-            DeviceContext->dmaPacketLinkInfo = (PBCM_PWM_PACKET_LINK_INFO)(DeviceContext->dmaCb + 2 * DeviceContext->dmaMaxPackets);
+        }
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        //
+        // Allocate cached non paged memory for the shared audio ring, followed by the packet link information provided
+        // to the audio driver. Both are only accessed by the CPU. The allocation is page aligned, which keeps the
+        // producer and consumer fields of the ring in separate cache lines.
+        //
+
+        DeviceContext->dmaRingSize = ROUND_TO_PAGES(sizeof(BCM_PWM_AUDIO_RING) + DeviceContext->dmaMaxPackets * sizeof(BCM_PWM_PACKET_LINK_INFO));
+        if (NULL == (DeviceContext->dmaRing = (PBCM_PWM_AUDIO_RING)ExAllocatePoolWithTag(NonPagedPoolNx, DeviceContext->dmaRingSize, BCM_PWM_POOLTAG)))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, TRACE_INIT, "Can not allocate %d bytes of non paged memory for the audio ring.", DeviceContext->dmaRingSize);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            MmFreeContiguousMemory(DeviceContext->dmaCb);
+            DeviceContext->dmaCb = NULL;
+            MmFreeContiguousMemory(DeviceContext->dmaBuffer);
+            DeviceContext->dmaBuffer = NULL;
+        }
+        else
+        {
+            RtlZeroMemory(DeviceContext->dmaRing, DeviceContext->dmaRingSize);
+            DeviceContext->dmaPacketLinkInfo = (PBCM_PWM_PACKET_LINK_INFO)(DeviceContext->dmaRing + 1);
         }
     }
     return status;
@@ -276,6 +299,12 @@ Return Value:
             return STATUS_UNSUCCESSFUL;
         }
 
+        if (bufferConfigIn->PwmRange < 2)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "Invalid audio PWM range (%d)", bufferConfigIn->PwmRange);
+            return STATUS_INVALID_PARAMETER;
+        }
+
         deviceContext = GetContext(Device);
 
         NT_ASSERT(bufferConfigIn->NotificationsPerBuffer > 0);
@@ -285,9 +314,18 @@ Return Value:
         deviceContext->dmaNumPackets = DMA_BUFFER_SIZE / packetSize;
         if (deviceContext->dmaMaxPackets < deviceContext->dmaNumPackets)
         {
-            TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "Too less memory for packet management allocated (%d byte, required %d byte). Increase memory for packet management or packet size.",
-                PAGE_SIZE, deviceContext->dmaNumPackets * sizeof(DMA_CB) * 2
+            //
+            // Small packets, only use the part of the DMA buffer we have control blocks for.
+            //
+
+            TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Packet count limited to %d by the control block memory (%d byte, %d packets requested).",
+                deviceContext->dmaMaxPackets, deviceContext->dmaControlDataSize, deviceContext->dmaNumPackets
                 );
+            deviceContext->dmaNumPackets = deviceContext->dmaMaxPackets;
+        }
+        if (deviceContext->dmaNumPackets < 2)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "Requested audio packet size (%d) is too large.", packetSize);
             return STATUS_UNSUCCESSFUL;
         }
 
@@ -322,11 +360,10 @@ Return Value:
                 SetClockConfig(deviceContext);
 
                 //
-                // Set audio channel configuration. The audio generation is based on a PWM range
-                // of 2268 to generate an 44,1kHz audio stream with 11 valid audio bits.
+                // Set audio channel configuration. The PWM range defines the PWM sample rate, e.g.
+                // a range of 2268 generates an 44,1kHz audio stream with 11 valid audio bits.
                 //
                 
-                NT_ASSERT(bufferConfigIn->PwmRange == 2268);
                 deviceContext->pwmChannel1Config.Range = bufferConfigIn->PwmRange;
                 deviceContext->pwmChannel1Config.DutyMode = BCM_PWM_DUTYMODE_MARKSPACE;
                 deviceContext->pwmChannel1Config.Mode = BCM_PWM_MODE_PWM;
@@ -349,36 +386,55 @@ Return Value:
             if (NT_SUCCESS(status))
             {
                 //
-                // PWM output rate does not match the audio sample rate precisely. To keep the playback
-                // time correct we by skipping samples. 
-                // With a range of 2268 at 100MHz clock rate, each sample takes 2.268 * 10E-5 seconds.
-                // At 44.1 kZHz each sample should take 2.26757... * 10E-5 seconds.
-                // The difference cummulates over 5320 samples to drift one sample, which means we should
-                // skip each 5320 samples one sample. The buffer size and packet data we receive are
-                // already taking into account that a PWM stereo sample is 8 byte in size.
-                // Note: We do not calculate at runtime to prevent usage of floating point operations.
+                // PWM output rate does not match the audio sample rate precisely. With a range of 2268 at
+                // 100MHz clock rate, each sample takes 2.268 * 10E-5 seconds, at 44.1 kZHz each sample
+                // should take 2.26757... * 10E-5 seconds. The audio driver keeps the playback time correct
+                // by dropping single samples, spread over the packets at the exact rate difference. It
+                // shortens the first CB of a packet through the LengthPtr of the packet link info.
                 //
 
                 NT_ASSERT(deviceContext->pwmClockConfig.ClockSource == BCM_PWM_CLOCKSOURCE_PLLC);
                 NT_ASSERT(deviceContext->pwmClockConfig.Divisor == 10);
-                ULONG correctionDropSampleCount = 5320;
-                ULONG bytesPerPwmSample = 8;
-                ULONG samplesPerPacket = packetSize / bytesPerPwmSample;
-                ULONG correctionDropPacketCount = correctionDropSampleCount / samplesPerPacket;
+                ULONG sampleRate = bufferConfigIn->SampleRate ? bufferConfigIn->SampleRate : BCM_PWM_AUDIO_DEFAULT_SAMPLE_RATE;
+                if ((ULONGLONG)sampleRate * bufferConfigIn->PwmRange < BCM_PWM_AUDIO_CLOCK_FREQUENCY)
+                {
+                    TraceEvents(TRACE_LEVEL_WARNING, TRACE_INIT, "PWM range %d plays faster than the sample rate %d Hz",
+                        bufferConfigIn->PwmRange, sampleRate
+                        );
+                }
 
                 //
-                // If our DMA buffer is too small we overcorrect by dropping a sample in the last packet.
+                // Create control blocks for DMA operation.
                 //
 
-                ULONG correctionDropPacketIndex = correctionDropPacketCount > deviceContext->dmaNumPackets ? deviceContext->dmaNumPackets - 1 : correctionDropPacketCount - 1;
-
                 //
-                // Create control blocks for DMA operation.
+                // The default profile keeps the DMA buffer filled up to the prime preset. The low latency profile
+                // requests packets one by one and keeps only an adaptive number of packets queued.
                 //
 
-                deviceContext->dmaPacketsToPrimePreset = deviceContext->dmaNumPackets / 4;
-                deviceContext->dmaPacketsToPrime = deviceContext->dmaPacketsToPrimePreset;
-                TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_INIT, "Preset for packet prime: %d packets", deviceContext->dmaPacketsToPrimePreset);
+                PBCM_PWM_AUDIO_RING ring = deviceContext->dmaRing;
+                RtlZeroMemory(ring, sizeof(BCM_PWM_AUDIO_RING));
+                ring->Version = BCM_PWM_AUDIO_RING_VERSION;
+                ring->Size = sizeof(BCM_PWM_AUDIO_RING);
+                ring->NumPackets = deviceContext->dmaNumPackets;
+                ring->GetPosition = GetAudioPosition;
+                ring->GetPositionContext = deviceContext;
+
+                deviceContext->dmaProfile = bufferConfigIn->Profile;
+                if (deviceContext->dmaProfile == BCM_PWM_AUDIO_PROFILE_LOW_LATENCY)
+                {
+                    deviceContext->dmaPacketsToPrimePreset = 1;
+                    ring->QueueDepth = min(DMA_LOW_LATENCY_INITIAL_QUEUE_DEPTH, deviceContext->dmaNumPackets - 1);
+                }
+                else
+                {
+                    deviceContext->dmaPacketsToPrimePreset = deviceContext->dmaNumPackets / 4;
+                    ring->QueueDepth = deviceContext->dmaNumPackets - deviceContext->dmaPacketsToPrimePreset;
+                }
+                ring->PrimeRequestIndex = deviceContext->dmaPacketsToPrimePreset;
+                deviceContext->dmaPacketsSinceUnderflow = 0;
+                TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_INIT, "Profile %d, preset for packet prime: %d packets, queue depth: %d packets",
+                    deviceContext->dmaProfile, deviceContext->dmaPacketsToPrimePreset, ring->QueueDepth);
 
                 //
                 // Create for each packet 2 CBs and link them. 
@@ -401,18 +457,7 @@ Return Value:
                     currentCb->SOURCE_AD = deviceContext->dmaBufferPa.LowPart + packetIndex * packetSize + deviceContext->memUncachedOffset;
                     currentCb->DEST_AD = deviceContext->pwmRegsBusPa.LowPart + FIELD_OFFSET(PWM_REGS, FIF1);
 
-                    // 
-                    // Apply drift correction.
-                    //
-
-                    if (packetIndex == correctionDropPacketIndex)
-                    {
-                        currentCb->TXFR_LEN = packetFirstChunkSize - bytesPerPwmSample;
-                    }
-                    else
-                    {
-                        currentCb->TXFR_LEN = packetFirstChunkSize;
-                    }
+                    currentCb->TXFR_LEN = packetFirstChunkSize;
                     currentCb->STRIDE = 0;
                     nextCbPa = MmGetPhysicalAddress(currentCb + 1);
                     currentCb->NEXTCONBK = nextCbPa.LowPart + deviceContext->memUncachedOffset;
@@ -442,6 +487,8 @@ Return Value:
                     // first control block of the packet. The LinkPtr is the address of the NEXTCONBK value in the second
                     // control block of the preceeding packet. Packet 0 needs special handling to establish a cyclic list.
                     // Finally we set all NEXTCONBK values in the packet list to 0.
+                    // The LengthPtr is the address of the TXFR_LEN value in the first control block of the packet, and
+                    // LengthValue the full length of the first chunk. The audio driver shortens it for drift correction.
                     //
 
                     deviceContext->dmaPacketLinkInfo[packetIndex].LinkValue = (UINT_PTR)((PCHAR)(deviceContext->dmaCbPa.LowPart) + packetIndex * 2 * sizeof(DMA_CB));;
@@ -453,15 +500,13 @@ Return Value:
                     {
                         deviceContext->dmaPacketLinkInfo[packetIndex].LinkPtr = &(deviceContext->dmaCb[2 * (packetIndex - 1) + 1].NEXTCONBK);
                     }
+                    deviceContext->dmaPacketLinkInfo[packetIndex].LengthPtr = &(deviceContext->dmaCb[2 * packetIndex].TXFR_LEN);
+                    deviceContext->dmaPacketLinkInfo[packetIndex].LengthValue = packetFirstChunkSize;
                 }
                 bufferConfigOut->DmaNumPackets = deviceContext->dmaNumPackets;
                 bufferConfigOut->DmaPacketLinkInfo = deviceContext->dmaPacketLinkInfo;
-                bufferConfigOut->DmaPacketsInUse = &deviceContext->dmaPacketsInUse;
-                bufferConfigOut->DmaPacketsToPrime = &deviceContext->dmaPacketsToPrime;
                 bufferConfigOut->DmaBuffer = deviceContext->dmaBuffer;
-                bufferConfigOut->DmaRestartRequired = &deviceContext->dmaRestartRequired;
-                bufferConfigOut->DmaPacketsProcessed = &deviceContext->dmaPacketsProcessed;
-                bufferConfigOut->DmaLastProcessedPacketTime = &deviceContext->dmaLastProcessedPacketTime;
+                bufferConfigOut->DmaRing = deviceContext->dmaRing;
 
                 WdfRequestSetInformation(Request, sizeof(BCM_PWM_AUDIO_CONFIG));
             }
@@ -681,8 +726,8 @@ Status
         TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Start all channels.");
 
         deviceContext->dmaLastKnownCompletedPacket = NO_LAST_COMPLETED_PACKET;
-        deviceContext->dmaRestartRequired = FALSE;
-        deviceContext->dmaLastProcessedPacketTime.QuadPart = 0;
+        deviceContext->dmaRing->RestartRequestCount = ReadULongAcquire(&deviceContext->dmaRing->RestartAckCount);
+        deviceContext->dmaRing->LastProcessedPacketTime.QuadPart = 0;
         deviceContext->dmaDpcForIsrErrorCount = 0;
 
         StartDma(deviceContext, deviceContext->dmaCbPa);
@@ -743,17 +788,27 @@ Return Value:
         StopChannel(deviceContext, BCM_PWM_CHANNEL_ALLCHANNELS);
         StopDma(deviceContext);
 
-        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "DMA notification count at stop: %d, packets processed: %d", deviceContext->dmaAudioNotifcationCount, deviceContext->dmaPacketsProcessed);
+        PBCM_PWM_AUDIO_RING ring = deviceContext->dmaRing;
+        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "DMA notification count at stop: %d, packets processed: %d", deviceContext->dmaAudioNotifcationCount, ring->PacketsProcessed);
+        TraceIsrTimeHistogram(deviceContext);
+        RtlZeroMemory(deviceContext->dmaIsrTimeHistogram, sizeof(deviceContext->dmaIsrTimeHistogram));
+        deviceContext->dmaIsrTimeMaxUs = 0;
 
         deviceContext->dmaDpcForIsrErrorCount = 0;
         deviceContext->dmaUnderflowErrorCount = 0;
         deviceContext->dmaLastKnownCompletedPacket = NO_LAST_COMPLETED_PACKET;
-        deviceContext->dmaPacketsInUse = 0;
-        deviceContext->dmaPacketsToPrime = deviceContext->dmaPacketsToPrimePreset;
-        deviceContext->dmaPacketsProcessed = 0;
-        deviceContext->dmaRestartRequired = FALSE;
         deviceContext->dmaAudioNotifcationCount = 0;
-        deviceContext->dmaLastProcessedPacketTime.QuadPart = 0;
+
+        //
+        // DMA is stopped, retire all packets and pending requests of the ring. Only the consumer fields are reset,
+        // the audio driver continues from its current producer indices.
+        //
+
+        ring->ConsumerIndex = ReadULongAcquire(&ring->ProducerIndex);
+        ring->PrimeRequestIndex = ReadULongAcquire(&ring->PrimeAckIndex) + deviceContext->dmaPacketsToPrimePreset;
+        ring->RestartRequestCount = ReadULongAcquire(&ring->RestartAckCount);
+        ring->PacketsProcessed = 0;
+        ring->LastProcessedPacketTime.QuadPart = 0;
     }
 
     WdfSpinLockRelease(deviceContext->pwmLock);
@@ -887,3 +942,559 @@ Return Value:
     return status;
 }
 
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+GetAudioPosition(
+    PVOID Context,
+    PBCM_PWM_AUDIO_POSITION Position
+)
+/*++
+
+Routine Description:
+
+    This function returns the live playback position of the audio stream. The DMA registers are sampled
+    together with the packet counters of the ISR under the interrupt lock.
+
+Arguments:
+
+    Context - device context
+
+    Position - receives the playback position
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDEVICE_CONTEXT deviceContext = (PDEVICE_CONTEXT)Context;
+
+    WdfInterruptAcquireLock(deviceContext->interruptObj);
+
+    ULONG packetsProcessed = deviceContext->dmaRing->PacketsProcessed;
+    ULONG lastKnownCompletedPacket = deviceContext->dmaLastKnownCompletedPacket;
+    ULONG conblk_ad = READ_REGISTER_ULONG(&deviceContext->dmaChannelRegs->CONBLK_AD);
+    ULONG txfr_len = READ_REGISTER_ULONG(&deviceContext->dmaChannelRegs->TXFR_LEN);
+    Position->PerformanceCounter = KeQueryPerformanceCounter(NULL);
+
+    WdfInterruptReleaseLock(deviceContext->interruptObj);
+
+    Position->PacketsPlayed = packetsProcessed;
+    Position->PacketBytesPlayed = 0;
+
+    //
+    // CONBLK_AD is zero if DMA is stopped or has run into an underflow. DMA rests at a packet boundary
+    // in this case. While DMA is paused CONBLK_AD and TXFR_LEN keep the position.
+    //
+
+    if (conblk_ad < deviceContext->dmaCbPa.LowPart)
+    {
+        return;
+    }
+
+    ULONG controlBlock = (conblk_ad - deviceContext->dmaCbPa.LowPart) / sizeof(DMA_CB);
+    ULONG currentPacket = controlBlock / 2;
+    if (currentPacket >= deviceContext->dmaNumPackets)
+    {
+        return;
+    }
+
+    //
+    // The ISR retires a packet as soon as DMA has moved on to its last chunk. Packets DMA has completed
+    // before the current one, but the ISR has not seen yet, are counted as played.
+    //
+
+    if (currentPacket == lastKnownCompletedPacket)
+    {
+        Position->PacketsPlayed = packetsProcessed - 1;
+    }
+    else
+    {
+        ULONG nextPacket = (lastKnownCompletedPacket == NO_LAST_COMPLETED_PACKET) ? 0 : (lastKnownCompletedPacket + 1) % deviceContext->dmaNumPackets;
+        Position->PacketsPlayed = packetsProcessed + (currentPacket + deviceContext->dmaNumPackets - nextPacket) % deviceContext->dmaNumPackets;
+    }
+
+    //
+    // TXFR_LEN counts down the bytes left in the active control block. The offset of the control block
+    // in the packet is the difference of its source address to the one of the first control block.
+    //
+
+    PDMA_CB activeCb = &deviceContext->dmaCb[controlBlock];
+    ULONG controlBlockLength = activeCb->TXFR_LEN;
+    ULONG controlBlockOffset = activeCb->SOURCE_AD - deviceContext->dmaCb[2 * currentPacket].SOURCE_AD;
+
+    Position->PacketBytesPlayed = controlBlockOffset + (controlBlockLength > txfr_len ? controlBlockLength - txfr_len : 0);
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+NTSTATUS
+StartStream(
+    WDFDEVICE Device,
+    WDFREQUEST Request
+)
+/*++
+
+Routine Description:
+
+    This function puts the PWM driver in stream mode and starts the selected PWM channels with FIFO input.
+    The stream buffers are played by DMA as they are queued by WriteStream.
+
+Arguments:
+
+    Device - a pointer to the WDFDEVICE object
+    Request - a pointer to the WDFREQUEST object
+
+Return Value:
+
+    Status
+
+--*/
+{
+    PDEVICE_CONTEXT deviceContext;
+    NTSTATUS status = STATUS_SUCCESS;
+    PBCM_PWM_STREAM_CONFIG streamConfigIn;
+    PBCM_PWM_STREAM_CONFIG streamConfigOut;
+
+    deviceContext = GetContext(Device);
+
+    //
+    // Validate the request parameter.
+    //
+
+    status = WdfRequestRetrieveInputBuffer(
+        Request,
+        sizeof(*streamConfigIn),
+        (PVOID *)&streamConfigIn,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "Error retrieving stream configuration input buffer. (0x%08x)", status);
+        return status;
+    }
+
+    if (IS_INVALID_CHANNEL(streamConfigIn->Channel))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "Invalid stream channel (%d)", streamConfigIn->Channel);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(
+        Request,
+        sizeof(*streamConfigOut),
+        (PVOID *)&streamConfigOut,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "Error retrieving stream configuration output buffer. (0x%08x)", status);
+        return status;
+    }
+
+    WdfSpinLockAcquire(deviceContext->pwmLock);
+
+    //
+    // Only allow streaming if PWM is in register mode and no PWM channel is running.
+    //
+
+    if (deviceContext->pwmMode != PWM_MODE_REGISTER)
+    {
+        status = STATUS_OPERATION_IN_PROGRESS;
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "PWM is not in register mode. Could not start stream.");
+    }
+    else if (PWM_CHANNEL1_IS_RUNNING(deviceContext) || PWM_CHANNEL2_IS_RUNNING(deviceContext))
+    {
+        status = STATUS_OPERATION_IN_PROGRESS;
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "Device is running. Could not start stream.");
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        //
+        // Create one CB for each stream buffer. Each CB generates an interrupt, the transfer length
+        // and the link to the next buffer are set when a buffer is queued.
+        //
+
+        ULONG ti = DMA_TI_SRC_INC | DMA_TI_SRC_DREQ | (deviceContext->dmaDreq << DMA_TI_PERMAP_SHIFT) | DMA_TI_BURST_LENGTH_0 | DMA_TI_INTEN;
+
+        for (ULONG buffer = 0; buffer < DMA_STREAM_BUFFER_COUNT; buffer++)
+        {
+            PDMA_CB currentCb = &deviceContext->dmaCb[buffer];
+
+            currentCb->TI = ti;
+            currentCb->SOURCE_AD = deviceContext->dmaBufferPa.LowPart + buffer * DMA_STREAM_BUFFER_SIZE + deviceContext->memUncachedOffset;
+            currentCb->DEST_AD = deviceContext->pwmRegsBusPa.LowPart + FIELD_OFFSET(PWM_REGS, FIF1);
+            currentCb->TXFR_LEN = 0;
+            currentCb->STRIDE = 0;
+            currentCb->NEXTCONBK = 0;
+        }
+
+        deviceContext->streamChannel = streamConfigIn->Channel;
+        deviceContext->streamFileObject = WdfRequestGetFileObject(Request);
+        deviceContext->streamBufferHead = 0;
+        deviceContext->streamBuffersQueued = 0;
+        deviceContext->streamValuesQueued = 0;
+        deviceContext->streamValuesPlayed = 0;
+
+        //
+        // Move PWM into stream mode and start the channels. The FIFO is filled when the first buffer is queued.
+        //
+
+        deviceContext->pwmMode = PWM_MODE_STREAM;
+        StartChannel(deviceContext, deviceContext->streamChannel);
+
+        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IOCTL, "Stream started for channel %d, %d buffers of %d byte",
+            deviceContext->streamChannel, DMA_STREAM_BUFFER_COUNT, DMA_STREAM_BUFFER_SIZE);
+
+        streamConfigOut->Channel = deviceContext->streamChannel;
+        streamConfigOut->MaxValuesPerWrite = DMA_STREAM_BUFFER_SIZE / sizeof(ULONG);
+        WdfRequestSetInformation(Request, sizeof(BCM_PWM_STREAM_CONFIG));
+    }
+
+    WdfSpinLockRelease(deviceContext->pwmLock);
+
+    return status;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+NTSTATUS
+WriteStream(
+    WDFDEVICE Device,
+    WDFREQUEST Request
+)
+/*++
+
+Routine Description:
+
+    This function queues the duty values of a write request for DMA. If no stream buffer is free,
+    the request is kept in the stream write queue and processed by the DPC.
+
+Arguments:
+
+    Device - a pointer to the WDFDEVICE object
+    Request - a pointer to the WDFREQUEST object
+
+Return Value:
+
+    Status, STATUS_PENDING if the request was queued for later processing
+
+--*/
+{
+    PDEVICE_CONTEXT deviceContext;
+    NTSTATUS status = STATUS_SUCCESS;
+    PVOID values;
+    size_t length;
+    ULONG pendingWrites = 0;
+
+    deviceContext = GetContext(Device);
+
+    //
+    // Validate the request parameter.
+    //
+
+    status = WdfRequestRetrieveInputBuffer(
+        Request,
+        sizeof(ULONG),
+        &values,
+        &length
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "Error retrieving stream write input buffer. (0x%08x)", status);
+        return status;
+    }
+
+    WdfSpinLockAcquire(deviceContext->pwmLock);
+
+    if (deviceContext->pwmMode != PWM_MODE_STREAM)
+    {
+        status = STATUS_DEVICE_CONFIGURATION_ERROR;
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "PWM is not in stream mode.");
+    }
+    else if (length > DMA_STREAM_BUFFER_SIZE ||
+        (length % (IS_CHANNEL_ALL(deviceContext->streamChannel) ? 2 * sizeof(ULONG) : sizeof(ULONG))) != 0)
+    {
+        status = STATUS_INVALID_PARAMETER;
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "Invalid stream write size (%d)", (ULONG)length);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        //
+        // Keep the order of the writes. If writes are pending or both buffers are in use, the DPC
+        // processes this write when DMA has played a buffer.
+        //
+
+        WdfIoQueueGetState(deviceContext->streamWriteQueue, &pendingWrites, NULL);
+
+        WdfInterruptAcquireLock(deviceContext->interruptObj);
+        BOOLEAN bufferFree = (deviceContext->streamBuffersQueued < DMA_STREAM_BUFFER_COUNT);
+        WdfInterruptReleaseLock(deviceContext->interruptObj);
+
+        if (pendingWrites || !bufferFree)
+        {
+            status = WdfRequestForwardToIoQueue(Request, deviceContext->streamWriteQueue);
+            if (NT_SUCCESS(status))
+            {
+                status = STATUS_PENDING;
+            }
+            else
+            {
+                TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "Could not queue stream write. (0x%08x)", status);
+            }
+        }
+        else
+        {
+            QueueStreamBuffer(deviceContext, values, (ULONG)length);
+        }
+    }
+
+    WdfSpinLockRelease(deviceContext->pwmLock);
+
+    return status;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+NTSTATUS
+StopStream(
+    WDFDEVICE Device,
+    WDFFILEOBJECT FileObject
+)
+/*++
+
+Routine Description:
+
+    This function stops the stream and puts the PWM driver back into register mode.
+    Pending writes are cancelled. Only the file object that started the stream can stop it.
+
+Arguments:
+
+    Device - a pointer to the WDFDEVICE object
+    FileObject - the file object of the caller
+
+Return Value:
+
+    Status
+
+--*/
+{
+    PDEVICE_CONTEXT deviceContext;
+    NTSTATUS status = STATUS_SUCCESS;
+    WDFREQUEST request;
+
+    deviceContext = GetContext(Device);
+
+    WdfSpinLockAcquire(deviceContext->pwmLock);
+
+    //
+    // If PWM is not in stream mode, no need to stop the stream.
+    //
+
+    if (deviceContext->pwmMode != PWM_MODE_STREAM)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "PWM is not in stream mode.");
+    }
+    else if (deviceContext->streamFileObject != FileObject)
+    {
+        status = STATUS_ACCESS_DENIED;
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "Stream is owned by another file object.");
+    }
+    else
+    {
+        StopChannel(deviceContext, deviceContext->streamChannel);
+
+        WdfInterruptAcquireLock(deviceContext->interruptObj);
+        StopDma(deviceContext);
+        deviceContext->streamBufferHead = 0;
+        deviceContext->streamBuffersQueued = 0;
+        WdfInterruptReleaseLock(deviceContext->interruptObj);
+
+        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Stream stopped. Values queued: %I64u, values played: %I64u",
+            deviceContext->streamValuesQueued, deviceContext->streamValuesPlayed);
+
+        deviceContext->pwmMode = PWM_MODE_REGISTER;
+        deviceContext->streamFileObject = NULL;
+
+        //
+        // Cancel pending writes.
+        //
+
+        while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(deviceContext->streamWriteQueue, &request)))
+        {
+            WdfRequestComplete(request, STATUS_CANCELLED);
+        }
+    }
+
+    WdfSpinLockRelease(deviceContext->pwmLock);
+
+    return status;
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+QueueStreamBuffer(
+    PDEVICE_CONTEXT DeviceContext,
+    PVOID Values,
+    ULONG Length
+)
+/*++
+
+Routine Description:
+
+    This function copies duty values into the next free stream buffer and queues the buffer for DMA.
+    The caller holds the PWM lock and made sure a stream buffer is free.
+
+    If a buffer is still queued, DMA is paused and the new buffer is linked through the NEXTCONBK
+    register, since the NEXTCONBK value of the active CB has already been loaded by DMA. If DMA has
+    finished all buffers, it is restarted with the new buffer.
+
+Arguments:
+
+    DeviceContext - a pointer to the device context
+    Values - the duty values
+    Length - size of the duty values in byte
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG buffer;
+    BOOLEAN linked = FALSE;
+
+    //
+    // Only the ISR retires buffers, which does not change the index of the next free buffer.
+    //
+
+    WdfInterruptAcquireLock(DeviceContext->interruptObj);
+    NT_ASSERT(DeviceContext->streamBuffersQueued < DMA_STREAM_BUFFER_COUNT);
+    buffer = (DeviceContext->streamBufferHead + DeviceContext->streamBuffersQueued) % DMA_STREAM_BUFFER_COUNT;
+    WdfInterruptReleaseLock(DeviceContext->interruptObj);
+
+    RtlCopyMemory(DeviceContext->dmaBuffer + buffer * DMA_STREAM_BUFFER_SIZE, Values, Length);
+    DeviceContext->dmaCb[buffer].TXFR_LEN = Length;
+    DeviceContext->dmaCb[buffer].NEXTCONBK = 0;
+
+    PHYSICAL_ADDRESS cbPa = DeviceContext->dmaCbPa;
+    cbPa.LowPart += buffer * sizeof(DMA_CB);
+
+    WdfInterruptAcquireLock(DeviceContext->interruptObj);
+
+    if (DeviceContext->streamBuffersQueued)
+    {
+        //
+        // Pause DMA without clearing a pending interrupt and wait until it stopped transferring data.
+        //
+
+        ULONG conblk_ad = 0;
+        WRITE_REGISTER_ULONG(&DeviceContext->dmaChannelRegs->CS,
+            DMA_CS_PRIORITY_8 | DMA_CS_PANIC_PRIORITY_F | DMA_CS_WAIT_FOR_OUTSTANDING_WRITES | DMA_CS_DISDEBUG
+            );
+        for (ULONG poll = 0; poll < DMA_STREAM_PAUSE_POLL_COUNT; poll++)
+        {
+            conblk_ad = READ_REGISTER_ULONG(&DeviceContext->dmaChannelRegs->CONBLK_AD);
+            if (conblk_ad == 0 || (READ_REGISTER_ULONG(&DeviceContext->dmaChannelRegs->CS) & DMA_CS_PAUSED))
+            {
+                break;
+            }
+            KeStallExecutionProcessor(1);
+        }
+        conblk_ad = READ_REGISTER_ULONG(&DeviceContext->dmaChannelRegs->CONBLK_AD);
+
+        if (conblk_ad)
+        {
+            //
+            // DMA still plays the queued buffer, link the new buffer and resume.
+            //
+
+            WRITE_REGISTER_ULONG(&DeviceContext->dmaChannelRegs->NEXTCONBK, cbPa.LowPart + DeviceContext->memUncachedOffset);
+            WRITE_REGISTER_ULONG(&DeviceContext->dmaChannelRegs->CS,
+                DMA_CS_ACTIVE | DMA_CS_PRIORITY_8 | DMA_CS_PANIC_PRIORITY_F | DMA_CS_WAIT_FOR_OUTSTANDING_WRITES | DMA_CS_DISDEBUG
+                );
+            linked = TRUE;
+        }
+        else
+        {
+            //
+            // DMA has finished the queued buffers, retire them before the restart clears the interrupt.
+            //
+
+            ProcessStreamBuffers(DeviceContext, conblk_ad);
+        }
+    }
+
+    if (!linked)
+    {
+        StartDma(DeviceContext, cbPa);
+    }
+
+    DeviceContext->streamBuffersQueued++;
+    DeviceContext->streamValuesQueued += Length / sizeof(ULONG);
+
+    WdfInterruptReleaseLock(DeviceContext->interruptObj);
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+ProcessPendingStreamWrites(
+    PDEVICE_CONTEXT DeviceContext
+)
+/*++
+
+Routine Description:
+
+    This function queues pending stream writes into the free stream buffers and completes them.
+    It is called by the DPC after DMA has played a buffer.
+
+Arguments:
+
+    DeviceContext - a pointer to the device context
+
+Return Value:
+
+    None
+
+--*/
+{
+    WDFREQUEST request;
+    PVOID values;
+    size_t length;
+
+    WdfSpinLockAcquire(DeviceContext->pwmLock);
+
+    while (DeviceContext->pwmMode == PWM_MODE_STREAM)
+    {
+        WdfInterruptAcquireLock(DeviceContext->interruptObj);
+        BOOLEAN bufferFree = (DeviceContext->streamBuffersQueued < DMA_STREAM_BUFFER_COUNT);
+        WdfInterruptReleaseLock(DeviceContext->interruptObj);
+
+        if (!bufferFree || !NT_SUCCESS(WdfIoQueueRetrieveNextRequest(DeviceContext->streamWriteQueue, &request)))
+        {
+            break;
+        }
+
+        //
+        // The write was validated before it was queued.
+        //
+
+        NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(ULONG), &values, &length);
+        if (NT_SUCCESS(status))
+        {
+            QueueStreamBuffer(DeviceContext, values, (ULONG)length);
+        }
+        WdfRequestComplete(request, status);
+    }
+
+    WdfSpinLockRelease(DeviceContext->pwmLock);
+}
+
@@ -17,6 +17,42 @@ Abstract:
 #define DMA_BUFFER_PAGE_COUNT           16
 #define DMA_BUFFER_SIZE                 (DMA_BUFFER_PAGE_COUNT * PAGE_SIZE)
 
+//
+// Size of the noncached buffer for the control blocks, which defines the maximal
+// supported number of packets. The packet link information lives in the cached
+// audio ring allocation. Small packets of the low latency profile need more
+// packets to use the full DMA buffer.
+//
+
+#define DMA_CONTROL_DATA_PAGE_COUNT     4
+
+//
+// Shared ring accessors, see BCM_PWM_AUDIO_RING. Only the PWM driver writes the consumer fields, so it
+// reads them without ordering constraints.
+//
+
+#define DMA_RING_PACKETS_IN_USE(ring)   (ReadULongAcquire(&(ring)->ProducerIndex) - (ring)->ConsumerIndex)
+#define DMA_RING_RESTART_PENDING(ring)  ((ring)->RestartRequestCount != ReadULongAcquire(&(ring)->RestartAckCount))
+
+//
+// Low latency profile queue depth limits. The queue depth starts at the initial depth,
+// grows by one packet after each underflow, and shrinks by one packet after
+// DMA_LOW_LATENCY_STABLE_PACKETS packets were played without underflow.
+//
+
+#define DMA_LOW_LATENCY_INITIAL_QUEUE_DEPTH 2
+#define DMA_LOW_LATENCY_MIN_QUEUE_DEPTH     1
+#define DMA_LOW_LATENCY_STABLE_PACKETS      2000
+
+//
+// Streaming uses the DMA buffer as two buffers with one control block each. While DMA
+// plays one buffer, the next write fills the other one.
+//
+
+#define DMA_STREAM_BUFFER_COUNT         2
+#define DMA_STREAM_BUFFER_SIZE          (DMA_BUFFER_SIZE / DMA_STREAM_BUFFER_COUNT)
+#define DMA_STREAM_PAUSE_POLL_COUNT     10
+
 //
 // At the very end of the packet we add a CB for a small data block to generate
 // an interrupt and do packet processing.
@@ -266,3 +302,35 @@ NTSTATUS
 ResumeAudio(
     _In_ WDFDEVICE Device
 );
+
+BCM_PWM_GET_AUDIO_POSITION GetAudioPosition;
+
+NTSTATUS
+StartStream(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request
+);
+
+NTSTATUS
+WriteStream(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request
+);
+
+NTSTATUS
+StopStream(
+    _In_ WDFDEVICE Device,
+    _In_ WDFFILEOBJECT FileObject
+);
+
+VOID
+QueueStreamBuffer(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_reads_bytes_(Length) PVOID Values,
+    _In_ ULONG Length
+);
+
+VOID
+ProcessPendingStreamWrites(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
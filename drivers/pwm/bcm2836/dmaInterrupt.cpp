@@ -20,7 +20,7 @@ Abstract:
 #pragma code_seg()
 _Use_decl_annotations_
 VOID
-ClearDmaErrorAndRequestRestart
+ClearDmaError
 (
     PDEVICE_CONTEXT DeviceContext
 )
@@ -28,7 +28,7 @@ ClearDmaErrorAndRequestRestart
 
 Routine Description:
 
-    Clear all DMA and PWM error flags and requests a restart of the DMA.
+    Clear all DMA and PWM error flags.
 
 Arguments:
 
@@ -49,13 +49,42 @@ Return Value:
     WRITE_REGISTER_ULONG(&DeviceContext->pwmRegs->STA, pwmStatus & ~(PWM_STA_BERR | PWM_STA_GAPO1 | PWM_STA_GAPO2 | PWM_STA_RERR1 | PWM_STA_WERR1));
     WRITE_REGISTER_ULONG(&DeviceContext->dmaChannelRegs->DEBUG, (DMA_DEBUG_FIFO_ERROR | DMA_DEBUG_READ_ERROR | DMA_DEBUG_READ_LAST_NOT_SET_ERROR));
 
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "PWM STA: 0x%08x, DMA DEBUG: 0x%08x", pwmStatus, dmaDebug);
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+ClearDmaErrorAndRequestRestart
+(
+    PDEVICE_CONTEXT DeviceContext
+)
+/*++
+
+Routine Description:
+
+    Clear all DMA and PWM error flags and requests a restart of the audio DMA.
+
+Arguments:
+
+    DeviceContext - device context
+
+Return Value:
+
+    None
+
+--*/
+{
+    ClearDmaError(DeviceContext);
+
     //
-    // Request DMA restart.
+    // Request DMA restart, if no restart is pending.
     //
 
-    InterlockedExchange((PLONG)&DeviceContext->dmaRestartRequired, (LONG)TRUE);
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "PWM STA: 0x%08x, DMA DEBUG: 0x%08x", pwmStatus, dmaDebug);
+    if (!DMA_RING_RESTART_PENDING(DeviceContext->dmaRing))
+    {
+        WriteULongRelease(&DeviceContext->dmaRing->RestartRequestCount, DeviceContext->dmaRing->RestartRequestCount + 1);
+    }
 }
 
 #pragma code_seg()
@@ -183,14 +212,31 @@ HandleUnderflow(
         // Update counters.
         //
 
-        ULONG lastPacketsInUse = InterlockedExchange((LONG*)&DeviceContext->dmaPacketsInUse, 0);
-        InterlockedAdd((LONG*)&DeviceContext->dmaPacketsProcessed, processedPackets);
+        PBCM_PWM_AUDIO_RING ring = DeviceContext->dmaRing;
+        ULONG producerIndex = ReadULongAcquire(&ring->ProducerIndex);
+        ULONG lastPacketsInUse = producerIndex - ring->ConsumerIndex;
+        WriteULongRelease(&ring->ConsumerIndex, producerIndex);
+        WriteULongRelease(&ring->PacketsProcessed, ring->PacketsProcessed + processedPackets);
         DeviceContext->dmaUnderflowErrorCount++;
 
+        //
+        // Low latency profile: grow the queue depth, the current depth was not sufficient.
+        //
+
+        if (DeviceContext->dmaProfile == BCM_PWM_AUDIO_PROFILE_LOW_LATENCY)
+        {
+            DeviceContext->dmaPacketsSinceUnderflow = 0;
+            if (ring->QueueDepth < DeviceContext->dmaNumPackets - 1)
+            {
+                ring->QueueDepth++;
+            }
+            TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Low latency queue depth: %d packets", ring->QueueDepth);
+        }
+
         TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "DMA underflow condition detected (%d), Packets in use: %d",
-            DeviceContext->dmaUnderflowErrorCount, DeviceContext->dmaPacketsInUse);
+            DeviceContext->dmaUnderflowErrorCount, lastPacketsInUse);
         TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "DMA Notification count: %d, Last known completed packet: %d, Packets processed: %d",
-            DeviceContext->dmaAudioNotifcationCount, DeviceContext->dmaLastKnownCompletedPacket, (ULONG)DeviceContext->dmaPacketsProcessed);
+            DeviceContext->dmaAudioNotifcationCount, DeviceContext->dmaLastKnownCompletedPacket, ring->PacketsProcessed);
         TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Current packet: %d, Completed packet: %d, Currently processed: %d Last in-use count: %d",
             currentPacket, completedPacket, processedPackets, lastPacketsInUse);
         TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "DMA DEBUG: 0x%08x, DMA SOURCE_AD: 0x%08x, PWM STA: 0x%08x",
@@ -213,6 +259,171 @@ HandleUnderflow(
     }
 }
 
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+UnlinkProcessedPackets(
+    PDEVICE_CONTEXT DeviceContext,
+    ULONG CompletedPacket,
+    ULONG ProcessedPackets
+    )
+    /*++
+
+    Routine Description:
+
+        Unlinks the packets processed by DMA since the last interrupt. The link of a packet is the NEXTCONBK
+        value in the second control block of the preceding packet. Since the control blocks are contiguous,
+        the links are cleared in at most two runs through the control blocks, without reading the link info.
+
+    Arguments:
+
+        DeviceContext - device context
+
+        CompletedPacket - index of last packet processed by DMA
+
+        ProcessedPackets - number of packets processed, ending with CompletedPacket
+
+    Return Value:
+
+        None
+
+    --*/
+{
+    ULONG numPackets = DeviceContext->dmaNumPackets;
+    ULONG firstPacket = (CompletedPacket + numPackets - ProcessedPackets + 1) % numPackets;
+    ULONG linkPacket = PREVIOUS_PACKET_INDEX(firstPacket, numPackets);
+
+    while (ProcessedPackets)
+    {
+        ULONG run = min(ProcessedPackets, numPackets - linkPacket);
+        PDMA_CB linkCb = &DeviceContext->dmaCb[2 * linkPacket + 1];
+
+        for (ULONG ul = 0; ul < run; ul++, linkCb += 2)
+        {
+            linkCb->NEXTCONBK = 0;
+        }
+
+        ProcessedPackets -= run;
+        linkPacket = 0;
+    }
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+RecordIsrTime(
+    PDEVICE_CONTEXT DeviceContext,
+    LARGE_INTEGER IsrStartTime
+    )
+    /*++
+
+    Routine Description:
+
+        Adds the execution time of the current ISR call to the ISR time histogram.
+
+    Arguments:
+
+        DeviceContext - device context
+
+        IsrStartTime - performance counter value at ISR entry
+
+    Return Value:
+
+        None
+
+    --*/
+{
+    LARGE_INTEGER now = KeQueryPerformanceCounter(NULL);
+    ULONG timeUs = (ULONG)((now.QuadPart - IsrStartTime.QuadPart) * 1000000 / DeviceContext->dmaPerformanceFrequency.QuadPart);
+    ULONG bucket = 0;
+
+    while (bucket < DMA_ISR_TIME_HISTOGRAM_BUCKETS - 1 && (timeUs >> bucket) != 0)
+    {
+        bucket++;
+    }
+
+    DeviceContext->dmaIsrTimeHistogram[bucket]++;
+    if (timeUs > DeviceContext->dmaIsrTimeMaxUs)
+    {
+        DeviceContext->dmaIsrTimeMaxUs = timeUs;
+    }
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+TraceIsrTimeHistogram(
+    PDEVICE_CONTEXT DeviceContext
+    )
+    /*++
+
+    Routine Description:
+
+        Traces the ISR time histogram.
+
+    Arguments:
+
+        DeviceContext - device context
+
+    Return Value:
+
+        None
+
+    --*/
+{
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "DMA ISR time max: %dus", DeviceContext->dmaIsrTimeMaxUs);
+
+    for (ULONG bucket = 0; bucket < DMA_ISR_TIME_HISTOGRAM_BUCKETS; bucket++)
+    {
+        if (DeviceContext->dmaIsrTimeHistogram[bucket])
+        {
+            TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "DMA ISR time below %dus: %d",
+                1 << bucket, DeviceContext->dmaIsrTimeHistogram[bucket]);
+        }
+    }
+}
+
+#pragma code_seg()
+_Use_decl_annotations_
+VOID
+ProcessStreamBuffers(
+    PDEVICE_CONTEXT DeviceContext,
+    ULONG ConblkAd
+    )
+    /*++
+
+    Routine Description:
+
+        Retires the stream buffers played by DMA. The queued buffers are played in order, all buffers
+        before the buffer of the active CB have been played. If DMA has finished, CONBLK_AD is 0 and
+        all queued buffers have been played. Called by the ISR or with the interrupt lock held.
+
+    Arguments:
+
+        DeviceContext - device context
+
+        ConblkAd - current value of the DMA CONBLK_AD register
+
+    Return Value:
+
+        None
+
+    --*/
+{
+    while (DeviceContext->streamBuffersQueued)
+    {
+        ULONG head = DeviceContext->streamBufferHead;
+        if (ConblkAd == DeviceContext->dmaCbPa.LowPart + head * sizeof(DMA_CB) + DeviceContext->memUncachedOffset)
+        {
+            break;
+        }
+
+        DeviceContext->streamValuesPlayed += DeviceContext->dmaCb[head].TXFR_LEN / sizeof(ULONG);
+        DeviceContext->streamBufferHead = (head + 1) % DMA_STREAM_BUFFER_COUNT;
+        DeviceContext->streamBuffersQueued--;
+    }
+}
+
 #pragma code_seg()
 _Use_decl_annotations_
 BOOLEAN 
@@ -241,6 +452,7 @@ Return Value:
 
     PDEVICE_CONTEXT deviceContext;
     WDFDEVICE device;
+    LARGE_INTEGER isrStartTime = KeQueryPerformanceCounter(NULL);
 
     device = WdfInterruptGetDevice(Interrupt);
     deviceContext = GetContext(device);
@@ -264,7 +476,33 @@ Return Value:
 
     WRITE_REGISTER_ULONG(&deviceContext->dmaChannelRegs->CS, cs);
 
-    if (cs & DMA_CS_INT)
+    if ((cs & DMA_CS_INT) && deviceContext->pwmMode == PWM_MODE_STREAM)
+    {
+        //
+        // Stream mode: retire the played stream buffers, the DPC queues pending writes.
+        //
+
+        if (cs & DMA_CS_ERROR)
+        {
+            //
+            // Clear error bits and stop DMA. The queued buffers are dropped, the next write restarts DMA.
+            // No audio restart is requested, it would stay pending on the ring after the stream.
+            //
+
+            ClearDmaError(deviceContext);
+            StopDma(deviceContext);
+            conblk_ad = 0;
+            TraceEvents(TRACE_LEVEL_ERROR, TRACE_IO, "DMA error detected in stream mode (0x%08x)", cs);
+        }
+
+        ProcessStreamBuffers(deviceContext, conblk_ad);
+
+        if (FALSE == WdfInterruptQueueDpcForIsr(deviceContext->interruptObj))
+        {
+            deviceContext->dmaDpcForIsrErrorCount++;
+        }
+    }
+    else if (cs & DMA_CS_INT)
     {
         //
         // Check for error condition.
@@ -309,41 +547,41 @@ Return Value:
                 NT_ASSERT(conblk_ad);
 
                 //
-                // If the packet count in the buffer allows to add enough (dmaPacketToPrimePreset) packets and current packets to add to buffer without packets
-                // actually transmitted by DMA (dmaPacketsToPrime) is smaller than the preset, then request more packets (dmaPacketsToPrimePreset) from the audio
-                // stack.
+                // If the packet count in the buffer is below the queue depth (by default the packet count which allows to add dmaPacketToPrimePreset
+                // packets) and the packets requested but not yet asked for by the audio driver (PrimeRequestIndex - PrimeAckIndex) are less than
+                // the preset, then request more packets (dmaPacketsToPrimePreset) from the audio stack.
                 //
 
-                if (deviceContext->dmaPacketsInUse < (deviceContext->dmaNumPackets - deviceContext->dmaPacketsToPrimePreset) && deviceContext->dmaPacketsToPrime < deviceContext->dmaPacketsToPrimePreset)
+                PBCM_PWM_AUDIO_RING ring = deviceContext->dmaRing;
+                ULONG packetsInUse = DMA_RING_PACKETS_IN_USE(ring);
+                ULONG primeAckIndex = ReadULongAcquire(&ring->PrimeAckIndex);
+
+                if (packetsInUse < ring->QueueDepth && ring->PrimeRequestIndex - primeAckIndex < deviceContext->dmaPacketsToPrimePreset)
                 {
-                    InterlockedExchange((LONG*)&deviceContext->dmaPacketsToPrime, deviceContext->dmaPacketsToPrimePreset);
+                    WriteULongRelease(&ring->PrimeRequestIndex, primeAckIndex + deviceContext->dmaPacketsToPrimePreset);
 #ifdef ISRDPC_DEBUG
                     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Only %d packets in buffer. Request buffer priming with %d packets",
-                        deviceContext->dmaPacketsInUse, deviceContext->dmaPacketsToPrimePreset);
+                        packetsInUse, deviceContext->dmaPacketsToPrimePreset);
 #endif
                 }
 
                 //
                 // Compute the last processed packet based on the value of current CONBLK_AD value.
                 // The control block currently active is already beyond the packet we have just completed.
+                // The current packet is the first packet whose first control block address is not below
+                // CONBLK_AD (each packet has two control blocks), computed directly from the control block offset.
                 //
 
                 ULONG lastKnownCompletedPacket = deviceContext->dmaLastKnownCompletedPacket;
                 ULONG currentPacket = 0;
 
-                for (; currentPacket < deviceContext->dmaNumPackets; currentPacket++)
+                if (conblk_ad > deviceContext->dmaCbPa.LowPart)
                 {
-                    //
-                    // If the current CONBLK_AD register value is larger than the currently inspected packets first control block address (each packet
-                    // has two control blocks), check next packet.
-                    //
-
-                    ULONG currentPacketFirstCbAddress = FIRST_CB_ADDRESS_OF_PACKET(currentPacket, deviceContext->dmaCbPa.LowPart);
-                    if (conblk_ad > currentPacketFirstCbAddress)
+                    currentPacket = (ULONG)PACKET_INDEX_OF_CB_ADDRESS(conblk_ad, deviceContext->dmaCbPa.LowPart);
+                    if (currentPacket > deviceContext->dmaNumPackets)
                     {
-                        continue;
+                        currentPacket = deviceContext->dmaNumPackets;
                     }
-                    break;
                 }
 
                 ULONG completedPacket = PREVIOUS_PACKET_INDEX(currentPacket, deviceContext->dmaNumPackets);
@@ -360,29 +598,41 @@ Return Value:
 #ifdef ISRDPC_DEBUG
                 {
                     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "current: %d, completed: %d, lastknowncompleted: %d, processed: %d, inuse: %d, toprime: %d",
-                        currentPacket, completedPacket, lastKnownCompletedPacket, processedPackets, deviceContext->dmaPacketsInUse, deviceContext->dmaPacketsToPrime);
+                        currentPacket, completedPacket, lastKnownCompletedPacket, processedPackets, packetsInUse, ring->PrimeRequestIndex - primeAckIndex);
                 }
 #endif
 
                 //
-                // Adjust in use packet count and unlink each of the processed packets.
+                // Unlink each of the processed packets and retire them from the ring.
                 // If the DMA controller reads the 2nd control block of an unlinked packet,
                 // it reads 0 as the NEXTCONBK, which stops the DMA and allows to identify an underflow condition.
-                // Note: The dmaPacketLinkInfo resides in non cached memory, which could not be used with InterlockedExchange.
-                // Since the LinkPtr points to the NEXTCONBK field of a DMA control block, the pointer points to a 32 bit
-                // aligned memory location and the access is atomic by default.
+                // Note: The NEXTCONBK field of a DMA control block is a 32 bit aligned memory location and the access is
+                // atomic by default. The release semantics of the ConsumerIndex update make the unlink visible before
+                // the audio driver can reuse the packets.
                 //
 
-                ULONG packetToUnlink = completedPacket;
-                for (ULONG ul = 0; ul < processedPackets; ul++)
+                UnlinkProcessedPackets(deviceContext, completedPacket, processedPackets);
+                WriteULongRelease(&ring->ConsumerIndex, ring->ConsumerIndex + processedPackets);
+                WriteULongRelease(&ring->PacketsProcessed, ring->PacketsProcessed + processedPackets);
+
+                //
+                // Low latency profile: shrink the queue depth after a stable playback period.
+                //
+
+                if (deviceContext->dmaProfile == BCM_PWM_AUDIO_PROFILE_LOW_LATENCY)
                 {
-                    *((LONG*)deviceContext->dmaPacketLinkInfo[packetToUnlink].LinkPtr) = 0;
-                    packetToUnlink = PREVIOUS_PACKET_INDEX(packetToUnlink, deviceContext->dmaNumPackets);
+                    deviceContext->dmaPacketsSinceUnderflow += processedPackets;
+                    if (deviceContext->dmaPacketsSinceUnderflow >= DMA_LOW_LATENCY_STABLE_PACKETS)
+                    {
+                        deviceContext->dmaPacketsSinceUnderflow = 0;
+                        if (ring->QueueDepth > DMA_LOW_LATENCY_MIN_QUEUE_DEPTH)
+                        {
+                            ring->QueueDepth--;
+                        }
+                    }
                 }
-                InterlockedAdd((LONG*)&deviceContext->dmaPacketsInUse, -1L * (LONG)processedPackets);
-                InterlockedAdd((LONG*)&deviceContext->dmaPacketsProcessed, processedPackets);
             }
-            deviceContext->dmaLastProcessedPacketTime = KeQueryPerformanceCounter(NULL);
+            deviceContext->dmaRing->LastProcessedPacketTime = KeQueryPerformanceCounter(NULL);
         }
 
         //
@@ -403,6 +653,9 @@ Return Value:
         TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IO, "Interrupt not from PWM DMA. Ingoring.");
         return FALSE;
     }
+
+    RecordIsrTime(deviceContext, isrStartTime);
+
     return TRUE;
 }
 
@@ -443,11 +696,21 @@ Return Value:
 
     ULONG cs = READ_REGISTER_ULONG(&deviceContext->dmaChannelRegs->CS);
 
+    //
+    // Stream mode: queue pending writes into the buffers played by DMA.
+    //
+
+    if (deviceContext->pwmMode == PWM_MODE_STREAM)
+    {
+        ProcessPendingStreamWrites(deviceContext);
+        return;
+    }
+
     //
     // If DMA is not active and no restart pending.
     //
 
-    if ((cs & DMA_CS_ACTIVE) == 0 && (deviceContext->dmaRestartRequired == FALSE))
+    if ((cs & DMA_CS_ACTIVE) == 0 && !DMA_RING_RESTART_PENDING(deviceContext->dmaRing))
     {
         //
         // Handle underflow condition. This underflow may happen while the ISR is running. In this case we are loosing the interrupt
@@ -12,11 +12,23 @@ Abstract:
 
 #define PREVIOUS_PACKET_INDEX(currentPacket, numPackets) (currentPacket ? currentPacket - 1 : numPackets - 1)
 #define FIRST_CB_ADDRESS_OF_PACKET(packet, cbBaseAddressPaLow) (cbBaseAddressPaLow + (2 * packet * sizeof(DMA_CB)))
+
+//
+// Index of the first packet whose first control block address is not below the given control block address.
+// The control blocks of all packets are contiguous, with two control blocks per packet.
+//
+#define PACKET_INDEX_OF_CB_ADDRESS(cbAddress, cbBaseAddressPaLow) (((cbAddress) - (cbBaseAddressPaLow) + sizeof(DMA_CB)) / (2 * sizeof(DMA_CB)))
 #define SOURCE_AD_INIT_VALUE_OF_PACKET(packet, cbBaseAddress) (cbBaseAddress[2 * packet].SOURCE_AD)
 
 EVT_WDF_INTERRUPT_ISR DmaIsr;
 EVT_WDF_INTERRUPT_DPC DmaDpc;
 
+VOID
+ClearDmaError
+(
+    _In_ PDEVICE_CONTEXT DeviceContext
+);
+
 VOID
 ClearDmaErrorAndRequestRestart
 (
@@ -35,3 +47,27 @@ VOID
 HandleUnderflow(
     _In_ PDEVICE_CONTEXT DeviceContext
     );
+
+VOID
+UnlinkProcessedPackets(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ ULONG CompletedPacket,
+    _In_ ULONG ProcessedPackets
+    );
+
+VOID
+RecordIsrTime(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ LARGE_INTEGER IsrStartTime
+    );
+
+VOID
+TraceIsrTimeHistogram(
+    _In_ PDEVICE_CONTEXT DeviceContext
+    );
+
+VOID
+ProcessStreamBuffers(
+    _In_ PDEVICE_CONTEXT DeviceContext,
+    _In_ ULONG ConblkAd
+    );
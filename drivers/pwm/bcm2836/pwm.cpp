@@ -868,10 +868,10 @@ Return Value:
         if (DeviceContext->pwmChannel1Config.Repeat == BCM_PWM_REPEATMODE_ON)
         {
             //
-            // Repeat is not supported for audio mode (both channels use FIFO input).
+            // Repeat only applies to FIFO input, which is used in audio and stream mode.
             //
 
-            if (DeviceContext->pwmMode == PWM_MODE_AUDIO)
+            if (DeviceContext->pwmMode == PWM_MODE_AUDIO || DeviceContext->pwmMode == PWM_MODE_STREAM)
             {
                 pwm1Ctl |= PWM_CTL_RPTL1;
             }
@@ -886,10 +886,10 @@ Return Value:
         }
 
         //
-        // Enable PWM channel 1. For audio mode use FIFO and DMA.
+        // Enable PWM channel 1. For audio and stream mode use FIFO and DMA.
         //
 
-        if (DeviceContext->pwmMode == PWM_MODE_AUDIO)
+        if (DeviceContext->pwmMode == PWM_MODE_AUDIO || DeviceContext->pwmMode == PWM_MODE_STREAM)
         {
             pwm1Ctl |= PWM_CTL_USEF1 | PWM_CTL_CLRF1 | PWM_CTL_PWEN1;
             WRITE_REGISTER_ULONG(&DeviceContext->pwmRegs->DMAC, (ULONG)(PWM_DMAC_ENAB | PWM_DMAC_DREQ_12 | PWM_DMAC_PANIC_8));
@@ -908,7 +908,7 @@ Return Value:
         TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IOCTL, "PWM channel 1 start with CTL: 0x%08x, RNG: 0x%08x (%d), DAT: 0x%08x (%d), Source: %s)",
             pwmCtl, READ_REGISTER_ULONG(&DeviceContext->pwmRegs->RNG1), READ_REGISTER_ULONG(&DeviceContext->pwmRegs->RNG1),
             READ_REGISTER_ULONG(&DeviceContext->pwmRegs->DAT1), READ_REGISTER_ULONG(&DeviceContext->pwmRegs->DAT1),
-            DeviceContext->pwmMode == PWM_MODE_AUDIO ? "audio" : "register"
+            DeviceContext->pwmMode == PWM_MODE_AUDIO ? "audio" : DeviceContext->pwmMode == PWM_MODE_STREAM ? "stream" : "register"
         );
     }
 
@@ -922,10 +922,10 @@ Return Value:
         if (DeviceContext->pwmChannel2Config.Repeat == BCM_PWM_REPEATMODE_ON)
         {
             //
-            // Repeat is not supported for audio mode (both channels use FIFO input).
+            // Repeat only applies to FIFO input, which is used in audio and stream mode.
             //
 
-            if (DeviceContext->pwmMode == PWM_MODE_AUDIO)
+            if (DeviceContext->pwmMode == PWM_MODE_AUDIO || DeviceContext->pwmMode == PWM_MODE_STREAM)
             {
                 pwm2Ctl |= PWM_CTL_RPTL2;
             }
@@ -940,10 +940,10 @@ Return Value:
         }
 
         //
-        // Enable PWM channel 2. For audio mode use FIFO and DMA.
+        // Enable PWM channel 2. For audio and stream mode use FIFO and DMA.
         //
 
-        if (DeviceContext->pwmMode == PWM_MODE_AUDIO)
+        if (DeviceContext->pwmMode == PWM_MODE_AUDIO || DeviceContext->pwmMode == PWM_MODE_STREAM)
         {
             pwm2Ctl |= PWM_CTL_USEF2 | PWM_CTL_CLRF1 | PWM_CTL_PWEN2;
             WRITE_REGISTER_ULONG(&DeviceContext->pwmRegs->DMAC, (ULONG)(PWM_DMAC_ENAB | PWM_DMAC_DREQ_12 | PWM_DMAC_PANIC_8));
@@ -962,7 +962,7 @@ Return Value:
         TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_IOCTL, "PWM channel 2 start with CTL: 0x%08x, RNG: 0x%08x (%d), DAT: 0x%08x (%d), Source: %s)",
             pwmCtl, READ_REGISTER_ULONG(&DeviceContext->pwmRegs->RNG2), READ_REGISTER_ULONG(&DeviceContext->pwmRegs->RNG2),
             READ_REGISTER_ULONG(&DeviceContext->pwmRegs->DAT2), READ_REGISTER_ULONG(&DeviceContext->pwmRegs->DAT2),
-            DeviceContext->pwmMode == PWM_MODE_AUDIO ? "audio" : "register"
+            DeviceContext->pwmMode == PWM_MODE_AUDIO ? "audio" : DeviceContext->pwmMode == PWM_MODE_STREAM ? "stream" : "register"
         );
     }
 
@@ -1289,6 +1289,11 @@ Return Value:
         status = STATUS_OPERATION_IN_PROGRESS;
         TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "Device is running. Could not aquire PWM for audio operation.");
     }
+    else if (deviceContext->pwmMode == PWM_MODE_STREAM)
+    {
+        status = STATUS_OPERATION_IN_PROGRESS;
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_IOCTL, "PWM is in stream mode. Could not aquire PWM for audio operation.");
+    }
 
     if (NT_SUCCESS(status))
     {
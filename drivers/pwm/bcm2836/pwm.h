@@ -127,7 +127,8 @@ typedef struct _PWM_REGS
 typedef enum _PWM_MODE
 {
     PWM_MODE_REGISTER,
-    PWM_MODE_AUDIO
+    PWM_MODE_AUDIO,
+    PWM_MODE_STREAM
 } PWM_MODE;
 
 //
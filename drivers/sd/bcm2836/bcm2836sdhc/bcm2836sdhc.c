@@ -46,6 +46,18 @@ ULONG DefaultDebugLevel = TRACE_LEVEL_ERROR;
 //
 #define SDHC_IGNORE_CARD_DETECT_INTERRUPT   1
 
+//
+// If to move SgDma requests through the data port with a SoC DMA channel.
+// Crashdump mode always uses PIO regardless of this setting.
+//
+#define SDHC_ENABLE_DMA_TRANSFER            1
+
+//
+// If PIO transfers move every block the controller has already buffered
+// before waiting for the next buffer ready interrupt.
+//
+#define SDHC_ENABLE_PIO_BATCHING            1
+
 //
 // Workaround offset was introduced early in the enabling effort to support GPT
 // partition. The bcm2836 platform (RPi2) only supported MBR partition and the
@@ -69,6 +81,26 @@ volatile PSDHC_EXTENSION Bcm2836Extension = NULL;
 //
 BOOLEAN LedStatus = FALSE;
 
+//
+// Minimum time between two activity LED writes. LED state changes signaled
+// within the interval are coalesced into a single write of the latest state.
+// Can be overridden through the LedUpdateIntervalMs driver parameter, 0
+// disables the rate limiting.
+//
+#define SDHC_LED_UPDATE_INTERVAL_DEFAULT_MS 50
+#define SDHC_LED_UPDATE_INTERVAL_MAX_MS     1000
+
+ULONG LedUpdateIntervalMs = SDHC_LED_UPDATE_INTERVAL_DEFAULT_MS;
+
+//
+// Number of LED state changes signaled to the LED thread, written LED
+// updates and signaled changes that did not result in a write because they
+// were coalesced or redundant.
+//
+volatile LONG LedUpdateRequests = 0;
+ULONG LedUpdateCount = 0;
+ULONG LedSuppressedUpdateCount = 0;
+
 //
 // Thread to set the activity LED.
 //
@@ -81,6 +113,17 @@ KEVENT LedWorkerStartedEvent;
 KEVENT LedWorkerUpdateEvent;
 KEVENT LedWorkerShutdownEvent;
 
+//
+// Sdport only hands SdhcSlotInitialize the register base of the controller.
+// The FixedDMA channel of each started controller is picked off
+// IRP_MN_START_DEVICE on its way to the sdport dispatch routines, and kept
+// here keyed by register base.
+//
+SDHC_DMA_RESOURCE SdhcDmaResources[SDHC_MAX_DMA_RESOURCES];
+ULONG SdhcDmaResourceCount = 0;
+FAST_MUTEX SdhcDmaResourcesLock;
+PDRIVER_DISPATCH SdportDispatch[IRP_MJ_MAXIMUM_FUNCTION + 1];
+
 //
 // SlotExtension routines.
 //
@@ -266,14 +309,138 @@ DriverEntry (
         ZwClose(ServiceHandle);
     } while (SdhcFalse());
 
+    //
+    // Read the LED update interval from the driver parameters
+    //
+    do { // once
+        OBJECT_ATTRIBUTES ObjectAttributes;
+        HANDLE ServiceHandle;
+        HANDLE ParametersHandle;
+        UNICODE_STRING UnicodeKey;
+        UCHAR Buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)];
+        PKEY_VALUE_PARTIAL_INFORMATION Value;
+        ULONG ResultLength;
+
+        //
+        // Registry\Machine\System\CurrentControlSet\Services\bcm2836sdhc\Parameters
+        // Name="LedUpdateIntervalMs"
+        // Type = "REG_DWORD"
+        //
+        InitializeObjectAttributes(&ObjectAttributes,
+                                   RegistryPath,
+                                   OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                   NULL,
+                                   NULL);
+
+        Status = ZwOpenKey(&ServiceHandle, KEY_READ, &ObjectAttributes);
+        if (!NT_SUCCESS(Status)) {
+            break;
+        } // if
+
+        RtlInitUnicodeString(&UnicodeKey, L"Parameters");
+        InitializeObjectAttributes(&ObjectAttributes,
+                                   &UnicodeKey,
+                                   OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                   ServiceHandle,
+                                   NULL);
+
+        Status = ZwOpenKey(&ParametersHandle, KEY_READ, &ObjectAttributes);
+        ZwClose(ServiceHandle);
+        if (!NT_SUCCESS(Status)) {
+            break;
+        } // if
+
+        RtlInitUnicodeString(&UnicodeKey, L"LedUpdateIntervalMs");
+
+        Value = (PKEY_VALUE_PARTIAL_INFORMATION)Buffer;
+        Status = ZwQueryValueKey(ParametersHandle,
+                                 &UnicodeKey,
+                                 KeyValuePartialInformation,
+                                 Value,
+                                 sizeof(Buffer),
+                                 &ResultLength);
+        ZwClose(ParametersHandle);
+        if (!NT_SUCCESS(Status)) {
+            break;
+        } // if
+
+        if ((Value->Type == REG_DWORD) && (Value->DataLength == sizeof(ULONG))) {
+            LedUpdateIntervalMs = min(*(ULONG UNALIGNED*)Value->Data,
+                                      SDHC_LED_UPDATE_INTERVAL_MAX_MS);
+        } // if
+    } while (SdhcFalse());
+
+    TraceMessage(TRACE_LEVEL_INFORMATION,
+        DRVR_LVL_INFO,
+        (__FUNCTION__ "LED update interval %lu ms",
+            LedUpdateIntervalMs));
+
     //
     // Hook up the IRP dispatch routines.
     //
     Status = SdPortInitialize(DriverObject, RegistryPath, &InitializationData);
 
+#if SDHC_ENABLE_DMA_TRANSFER
+    if (NT_SUCCESS(Status)) {
+        ULONG MajorFunction;
+
+        //
+        // Chain every sdport dispatch routine behind SdhcDispatch, which
+        // picks the FixedDMA resource off device starts.
+        //
+
+        ExInitializeFastMutex(&SdhcDmaResourcesLock);
+        for (MajorFunction = 0;
+             MajorFunction <= IRP_MJ_MAXIMUM_FUNCTION;
+             ++MajorFunction) {
+
+            SdportDispatch[MajorFunction] = DriverObject->MajorFunction[MajorFunction];
+            DriverObject->MajorFunction[MajorFunction] = SdhcDispatch;
+        } // for (MajorFunction)
+    } // if
+#endif // SDHC_ENABLE_DMA_TRANSFER
+
     return Status;
 } // DriverEntry (...)
 
+/*++
+
+Routine Description:
+
+    Save the FixedDMA resource of a starting controller, then forward the
+    IRP to sdport.
+
+Arguments:
+
+    DeviceObject - Device object the IRP is sent to.
+
+    Irp - The IRP.
+
+Return value:
+
+    NTSTATUS
+
+--*/
+_Use_decl_annotations_
+NTSTATUS
+SdhcDispatch (
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp
+    )
+{
+    PIO_STACK_LOCATION IrpStack;
+
+    IrpStack = IoGetCurrentIrpStackLocation(Irp);
+    if ((IrpStack->MajorFunction == IRP_MJ_PNP) &&
+        (IrpStack->MinorFunction == IRP_MN_START_DEVICE)) {
+
+        SdhcSaveDmaResource(
+            IrpStack->Parameters.StartDevice.AllocatedResourcesTranslated);
+    } // if
+
+    return SdportDispatch[IrpStack->MajorFunction](DeviceObject, Irp);
+} // SdhcDispatch (...)
+
 _Use_decl_annotations_
 VOID
 SdhcCleanup(
@@ -282,6 +449,10 @@ SdhcCleanup(
 {
     UNREFERENCED_PARAMETER(Miniport);
 
+    if (Bcm2836Extension != NULL) {
+        SdhcReleaseDma(Bcm2836Extension);
+    } // if
+
     //
     // Signal LED worker thread for shutdown
     //
@@ -336,6 +507,14 @@ VOID LedWorkerThread(
 
     (void)KeSetEvent(&LedWorkerStartedEvent, 0, FALSE);
 
+    //
+    // The LED state last written through RPIQ. It is unknown until the first
+    // write, so the first update always goes through.
+    //
+    BOOLEAN ledStateValid = FALSE;
+    BOOLEAN ledState = FALSE;
+    ULONGLONG lastUpdateTime = 0;
+
     for (;;) {
         NTSTATUS waitStatus = KeWaitForMultipleObjects(
             (ULONG)(ARRAYSIZE(waitEvents)),
@@ -348,7 +527,48 @@ VOID LedWorkerThread(
             NULL);
 
         if (waitStatus == _WAIT_UPDATE_EVENT) {
-            SdhcSetLed();
+            //
+            // Every LED write is a mailbox round trip to the firmware, and the
+            // LED state flips twice per request under load. Wait out the rest
+            // of the update interval and only write the latest state, unless
+            // it is the state already shown.
+            //
+            ULONGLONG updateInterval = (ULONGLONG)LedUpdateIntervalMs * 10000;
+            ULONGLONG elapsedTime = KeQueryInterruptTime() - lastUpdateTime;
+            if (ledStateValid && (elapsedTime < updateInterval)) {
+                LARGE_INTEGER timeout;
+                timeout.QuadPart = -(LONGLONG)(updateInterval - elapsedTime);
+                waitStatus = KeWaitForSingleObject(
+                    &LedWorkerShutdownEvent,
+                    Executive,
+                    KernelMode,
+                    FALSE,
+                    &timeout);
+                if (waitStatus == STATUS_SUCCESS) {
+                    TraceMessage(TRACE_LEVEL_INFORMATION,
+                        DRVR_LVL_INFO,
+                        (__FUNCTION__ "Shutdown requested ...")
+                    );
+                    break;
+                } // if
+            } // if
+
+            LONG updateRequests = InterlockedExchange(&LedUpdateRequests, 0);
+            BOOLEAN newLedState = LedStatus;
+            if (ledStateValid && (newLedState == ledState)) {
+                LedSuppressedUpdateCount += (ULONG)updateRequests;
+                continue;
+            } // if
+
+            SdhcSetLed(newLedState);
+            lastUpdateTime = KeQueryInterruptTime();
+            ledState = newLedState;
+            ledStateValid = TRUE;
+
+            ++LedUpdateCount;
+            if (updateRequests > 1) {
+                LedSuppressedUpdateCount += (ULONG)(updateRequests - 1);
+            } // if
         } else if (waitStatus == _WAIT_SHUTDOWN_EVENT) {
             TraceMessage(TRACE_LEVEL_INFORMATION,
                 DRVR_LVL_INFO,
@@ -373,7 +593,9 @@ VOID LedWorkerThread(
 
     TraceMessage(TRACE_LEVEL_INFORMATION,
         DRVR_LVL_INFO,
-        (__FUNCTION__ "Thread shutdown")
+        (__FUNCTION__ "Thread shutdown - %lu LED updates, %lu suppressed",
+            LedUpdateCount,
+            LedSuppressedUpdateCount)
     );
 }
 
@@ -552,6 +774,20 @@ SdhcSlotInitialize (
     Capabilities->DmaDescriptorSize = 0;
     Capabilities->Supported.ScatterGatherDma = 0;
 
+    SdhcExtension->DmaChannel = SDHC_BCM_DMA_CHANNEL_NONE;
+
+#if SDHC_ENABLE_DMA_TRANSFER
+    if (!CrashdumpMode) {
+        SdhcExtension->DmaChannel = SdhcFindDmaChannel(PhysicalBase);
+    } // if
+
+    if (!CrashdumpMode && NT_SUCCESS(SdhcInitializeDma(SdhcExtension))) {
+        Capabilities->MaximumBlockCount = SDHC_DMA_MAX_BLOCK_COUNT;
+        Capabilities->DmaDescriptorSize = SDHC_DMA_DESCRIPTOR_SIZE;
+        Capabilities->Supported.ScatterGatherDma = 1;
+    } // if
+#endif // SDHC_ENABLE_DMA_TRANSFER
+
     Capabilities->Supported.Address64Bit = 0;
     Capabilities->Supported.BusWidth8Bit = 0;
     Capabilities->Supported.HighSpeed = 1;
@@ -844,6 +1080,10 @@ SdhcSlotInterrupt (
         *Errors = (ULONG)SdhcGetErrorStatus(SdhcExtension);
     } // if
 
+    if (*Events & SDHC_IS_COMMAND_EVENT) {
+        InterlockedIncrement(&SdhcExtension->RequestInterrupts);
+    } // if
+
     //
     // If a card has changed, notify the port driver.
     //
@@ -1045,6 +1285,8 @@ SdhcRequestDpc (
         return;
     }
 
+    InterlockedIncrement(&SdhcExtension->RequestDpcs);
+
     //
     // Save current events, since we may not be waiting for them
     // at this stage, but we may be on the next phase of the command 
@@ -1083,6 +1325,7 @@ SdhcRequestDpc (
                       Request->Command.Index,
                       Errors));
         Status = SdhcConvertErrorToStatus((USHORT)Errors);
+        (void)SdhcFinishDmaTransfer(SdhcExtension, TRUE);
         (void)SdhcCompleteNonBlockSizeAlignedRequest(SdhcExtension,
                                                      Request, 
                                                      Status);
@@ -1279,6 +1522,7 @@ SdhcResetHost (
         InterlockedIncrement(&SdhcExtension->CmdAborted);
     }
     SdhcExtension->UnalignedReqState = UnalignedReqStateIdle;
+    (void)SdhcFinishDmaTransfer(SdhcExtension, TRUE);
 
     //
     // Reset the host controller
@@ -1957,11 +2201,11 @@ NTSTATUS SendIoctlSynchronously(
 
 Routine Description:
 
-    Turn the controller activity LED on/off based on the LedStatus value.
+    Turn the controller activity LED on/off.
 
 Arguments:
 
-    None
+    Enable - Whether the LED should be turned on.
 
 Return value:
 
@@ -1970,7 +2214,9 @@ Return value:
 --*/
 _Use_decl_annotations_
 VOID
-SdhcSetLed()
+SdhcSetLed(
+    BOOLEAN Enable
+    )
 {
     DECLARE_CONST_UNICODE_STRING(rpiqDeviceName, RPIQ_SYMBOLIC_NAME);
 
@@ -1990,7 +2236,7 @@ SdhcSetLed()
     }
 
     MAILBOX_GET_SET_GPIO_EXPANDER inputBuffer;
-    INIT_MAILBOX_SET_GPIO_EXPANDER(&inputBuffer, 128 + 2, LedStatus);
+    INIT_MAILBOX_SET_GPIO_EXPANDER(&inputBuffer, 128 + 2, Enable);
 
     ULONG_PTR value;
     status = SendIoctlSynchronously(
@@ -2474,20 +2720,32 @@ SdhcSendCommand (
                           Status));
             return Status;
         } // if
+
+        //
+        // Interrupt statistics cover the whole request, including the
+        // trailing bytes of unaligned requests.
+        //
+        if (Request != &SdhcExtension->UnalignedRequest) {
+            InterlockedExchange(&SdhcExtension->RequestInterrupts, 0);
+            InterlockedExchange(&SdhcExtension->RequestDpcs, 0);
+            SdhcExtension->RequestBlockCount = Command->BlockCount;
+        } // if
     } // if
 
     //
-    // Clear DMA vars, since we don't support it.
+    // Clear DMA vars for PIO requests.
     // It maybe related to an issue in sdhost, experienced 
-    // a crash when sdport was trying to flush DMA buffers, even though 
-    // miniport does not support DMA.
+    // a crash when sdport was trying to flush DMA buffers of a PIO
+    // request.
     //
     // To do:
     // Remove once issue is resolved.
     //
-    Command->DmaVirtualAddress = NULL;
-    Command->ScatterGatherList = NULL;
-    Command->ScatterGatherListSize = 0;
+    if (Command->TransferMethod != SdTransferMethodSgDma) {
+        Command->DmaVirtualAddress = NULL;
+        Command->ScatterGatherList = NULL;
+        Command->ScatterGatherListSize = 0;
+    } // if
 
     //
     // Explanation for WorkAroundOffset is in the header file.
@@ -2755,6 +3013,7 @@ SdhcSetTransferMode (
 {
     USHORT BlockCount = Request->Command.BlockCount;
     USHORT BlockSize = Request->Command.BlockSize;
+    const USHORT FunctionBlockSize = Request->Command.BlockSize;
 
     NT_ASSERT(Request->Command.TransferMethod != SdTransferMethodUndefined);
     NT_ASSERT(BlockSize <= SdhcExtension->Capabilities.MaximumBlockSize);
@@ -2791,6 +3050,26 @@ SdhcSetTransferMode (
             (USHORT) Request->Command.Length;
     } // if
 
+    //
+    // A Cmd53 byte mode transfer moves at most min(function block size, 512)
+    // bytes. Unaligned SDIO requests up to that length go as a single byte
+    // mode transfer, longer ones are split into a block mode transfer of
+    // the aligned part followed by a byte mode transfer of the trailing bytes.
+    //
+    if ((Request->Command.Index == SDCMD_IO_RW_EXTENDED) &&
+        (Request != &SdhcExtension->UnalignedRequest)) {
+        if ((Request->Command.Length % FunctionBlockSize) == 0) {
+            ++SdhcExtension->SdioAlignedRequests;
+        } else if (Request->Command.Length <=
+                   min(FunctionBlockSize, SDHC_SDIO_MAX_BYTE_MODE_LENGTH)) {
+            NT_ASSERT((BlockCount == 1) &&
+                      (BlockSize == Request->Command.Length));
+            ++SdhcExtension->SdioByteModeRequests;
+        } else {
+            ++SdhcExtension->SdioSplitRequests;
+        } // iff
+    } // if
+
     //
     // Check and start Non BlockSize aligned requests, if needed
     //
@@ -2829,7 +3108,13 @@ SdhcSetTransferMode (
             ArgumentExt->u.bits.BlockMode = 1;
         } else {
             NT_ASSERT(BlockCount == 1);
-            ArgumentExt->u.bits.Count = (ULONG)Request->Command.Length;
+            NT_ASSERT(BlockSize <= SDHC_SDIO_MAX_BYTE_MODE_LENGTH);
+            //
+            // The byte count covers the aligned part of a split request
+            // only, a byte count of 512 is encoded as 0
+            //
+            ArgumentExt->u.bits.Count =
+                (ULONG)BlockSize % SDHC_SDIO_MAX_BYTE_MODE_LENGTH;
             ArgumentExt->u.bits.BlockMode = 0;
         } // iff
         break;
@@ -2839,11 +3124,12 @@ SdhcSetTransferMode (
         break;
     } // SDCMD_IO_RW_EXTENDED
 
-    if (Request->Command.TransferMethod == SdTransferMethodSgDma) {
-        *TransferMode |= SDHC_TM_DMA_ENABLE;
-    } else {
-        NT_ASSERT(Request->Command.TransferMethod == SdTransferMethodPio);
-    } // iff
+    //
+    // SDHC_TM_DMA_ENABLE is never set, SgDma requests keep the controller
+    // in PIO mode and feed its data port with a SoC DMA channel.
+    //
+    NT_ASSERT((Request->Command.TransferMethod == SdTransferMethodPio) ||
+              (Request->Command.TransferMethod == SdTransferMethodSgDma));
 
     *TransferMode &= ~SDHC_TM_TRANSFER_READ;
     if (Request->Command.TransferDirection == SdTransferDirectionRead) {
@@ -3036,6 +3322,7 @@ SdhcStartTransfer (
 
     if (!LedStatus) {
         LedStatus = TRUE;
+        (void)InterlockedIncrement(&LedUpdateRequests);
         (void)KeSetEvent(&LedWorkerUpdateEvent, 0, FALSE);
     }
 
@@ -3108,20 +3395,191 @@ Return value:
 _Use_decl_annotations_
 NTSTATUS
 SdhcBuildAdmaTransfer (
-    const SDHC_EXTENSION* SdhcExtension,
-    const SDPORT_REQUEST* Request,
+    PSDHC_EXTENSION SdhcExtension,
+    PSDPORT_REQUEST Request,
     PUSHORT TransferMode
     )
 {
+    PSCATTER_GATHER_LIST ScatterGatherList;
+    PSDHC_BCM_DMA_CONTROL_BLOCK ControlBlocks;
+    ULONG ControlBlocksAddress;
+    ULONG ControlBlockCount;
+    ULONG TransferInformation;
+    ULONG DataPortAddress;
+    ULONG Alignment;
+    ULONG InterruptEnable;
+    ULONG Offset;
+    ULONG Remaining;
+    ULONG Index;
+    NTSTATUS Status;
+
     //
-    // The miniport does not support DMA tranfers.
+    // The BCM283x Arasan controller cannot master the bus, so instead of
+    // an ADMA2 descriptor table a SoC DMA control block chain is built,
+    // one control block per scatter/gather element, to move the data
+    // through the data port.
     //
 
-    UNREFERENCED_PARAMETER(SdhcExtension);
-    UNREFERENCED_PARAMETER(Request);
-    UNREFERENCED_PARAMETER(TransferMode);
+    if (SdhcExtension->DmaChannelBase == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    } // if
+
+    if (SdhcExtension->DmaTransferActive) {
+        NT_ASSERT(!"SDHC - Previous DMA transfer still active");
+        (void)SdhcFinishDmaTransfer(SdhcExtension, TRUE);
+    } // if
+
+    Status = SdhcSetTransferMode(SdhcExtension, Request, TransferMode);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    } // if
+
+    ScatterGatherList = Request->Command.ScatterGatherList;
+    if ((ScatterGatherList == NULL) ||
+        (Request->Command.DmaVirtualAddress == NULL)) {
+        NT_ASSERT(!"SDHC - SgDma request without DMA buffers");
+        return STATUS_INVALID_PARAMETER;
+    } // if
+
+    //
+    // The aligned part of an unaligned SDIO request is sent by the request
+    // itself, the trailing bytes by the internal request.
+    //
+    Offset = 0;
+    if (Request == &SdhcExtension->UnalignedRequest) {
+        Offset = SdhcExtension->DmaDataOffset;
+    } // if
+
+    Remaining = (ULONG)Request->Command.BlockSize *
+                (ULONG)Request->Command.BlockCount;
+
+    Alignment = (SDHC_BCM_DMA_CB_ALIGNMENT -
+                 (Request->Command.DmaPhysicalAddress.LowPart &
+                  (SDHC_BCM_DMA_CB_ALIGNMENT - 1))) &
+                (SDHC_BCM_DMA_CB_ALIGNMENT - 1);
+    ControlBlocks = (PSDHC_BCM_DMA_CONTROL_BLOCK)
+        ((PUCHAR)Request->Command.DmaVirtualAddress + Alignment);
+    ControlBlocksAddress =
+        (Request->Command.DmaPhysicalAddress.LowPart + Alignment) |
+        SDHC_BCM_UNCACHED_BUS_BASE;
+
+    DataPortAddress = SDHC_BCM_PERIPHERALS_BUS_BASE +
+                      SDHC_BCM_PERIPHERAL_OFFSET +
+                      SDHC_DATA_PORT;
+
+    TransferInformation = SDHC_BCM_DMA_TI_WAIT_RESP |
+                          (SDHC_BCM_DMA_DREQ_EMMC <<
+                           SDHC_BCM_DMA_TI_PERMAP_SHIFT);
+    if (Request->Command.TransferDirection == SdTransferDirectionRead) {
+        TransferInformation |= SDHC_BCM_DMA_TI_SRC_DREQ |
+                               SDHC_BCM_DMA_TI_DEST_INC;
+    } else {
+        TransferInformation |= SDHC_BCM_DMA_TI_DEST_DREQ |
+                               SDHC_BCM_DMA_TI_SRC_INC;
+    } // iff
+
+    ControlBlockCount = 0;
+    for (Index = 0;
+         (Index < ScatterGatherList->NumberOfElements) && (Remaining != 0);
+         ++Index) {
+
+        PSCATTER_GATHER_ELEMENT Element = &ScatterGatherList->Elements[Index];
+        PSDHC_BCM_DMA_CONTROL_BLOCK ControlBlock;
+        ULONG MemoryAddress;
+        ULONG Length;
+
+        if (Offset >= Element->Length) {
+            Offset -= Element->Length;
+            continue;
+        } // if
+
+        Length = min(Element->Length - Offset, Remaining);
+        if ((Element->Address.HighPart != 0) ||
+            ((Element->Address.LowPart + Offset + Length) >
+             SDHC_BCM_DMA_MAX_ADDRESS)) {
+
+            TraceMessage(TRACE_LEVEL_ERROR,
+                         DRVR_LVL_ERR,
+                         (__FUNCTION__ ": Buffer out of DMA reach: %I64x",
+                          Element->Address.QuadPart));
+            return STATUS_INVALID_ADDRESS;
+        } // if
+
+        if (ControlBlockCount == SDHC_DMA_MAX_CONTROL_BLOCKS) {
+            NT_ASSERT(!"SDHC - Too many scatter/gather elements");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        } // if
+
+        MemoryAddress = (Element->Address.LowPart + Offset) |
+                        SDHC_BCM_UNCACHED_BUS_BASE;
+        Offset = 0;
+
+        ControlBlock = &ControlBlocks[ControlBlockCount];
+        ControlBlock->TransferInformation = TransferInformation;
+        if (Request->Command.TransferDirection == SdTransferDirectionRead) {
+            ControlBlock->SourceAddress = DataPortAddress;
+            ControlBlock->DestinationAddress = MemoryAddress;
+        } else {
+            ControlBlock->SourceAddress = MemoryAddress;
+            ControlBlock->DestinationAddress = DataPortAddress;
+        } // iff
+        ControlBlock->TransferLength = Length;
+        ControlBlock->Stride = 0;
+        ControlBlock->NextControlBlock =
+            ControlBlocksAddress +
+            ((ControlBlockCount + 1) * sizeof(SDHC_BCM_DMA_CONTROL_BLOCK));
+        ControlBlock->Reserved[0] = 0;
+        ControlBlock->Reserved[1] = 0;
+
+        ++ControlBlockCount;
+        Remaining -= Length;
+    } // for (...)
+
+    if ((ControlBlockCount == 0) || (Remaining != 0)) {
+        NT_ASSERT(!"SDHC - Scatter/gather list shorter than the request");
+        return STATUS_INVALID_PARAMETER;
+    } // if
+
+    ControlBlocks[ControlBlockCount - 1].NextControlBlock = 0;
+
+    //
+    // The DMA channel services the buffer ready conditions, mask them so
+    // the whole data phase raises a single transfer complete interrupt.
+    //
+    InterruptEnable = SdhcReadRegisterUlong(SdhcExtension,
+                                            SDHC_INTERRUPT_ERROR_STATUS_ENABLE);
+    SdhcExtension->DmaMaskedEvents =
+        InterruptEnable &
+        (SDHC_IS_BUFFER_READ_READY | SDHC_IS_BUFFER_WRITE_READY);
+    SdhcWriteRegisterUlong(SdhcExtension,
+                           SDHC_INTERRUPT_ERROR_STATUS_ENABLE,
+                           InterruptEnable & ~SdhcExtension->DmaMaskedEvents);
+
+    //
+    // Start the channel ahead of the command, it waits for the EMMC DREQ.
+    //
+    KeMemoryBarrier();
+    SdhcWriteDmaRegisterUlong(SdhcExtension,
+                              SDHC_BCM_DMA_CONBLK_AD,
+                              ControlBlocksAddress);
+    SdhcWriteDmaRegisterUlong(SdhcExtension,
+                              SDHC_BCM_DMA_CS,
+                              SDHC_BCM_DMA_CS_ACTIVE |
+                              SDHC_BCM_DMA_CS_PRIORITY |
+                              SDHC_BCM_DMA_CS_PANIC_PRIORITY |
+                              SDHC_BCM_DMA_CS_WAIT_FOR_WRITES);
+    SdhcExtension->DmaTransferActive = TRUE;
 
-    return STATUS_NOT_IMPLEMENTED;
+    TraceMessage(TRACE_LEVEL_INFORMATION,
+                 DRVR_LVL_FUNC,
+                 (__FUNCTION__ " Exit: Cmd %d, ControlBlocks: %d, "
+                  "Length: %d",
+                  Request->Command.Index,
+                  ControlBlockCount,
+                  (ULONG)Request->Command.BlockSize *
+                  (ULONG)Request->Command.BlockCount));
+
+    return STATUS_SUCCESS;
 } // SdhcBuildAdmaTransfer (...)
 
 /*++
@@ -3149,6 +3607,9 @@ SdhcStartPioTransfer (
     )
 {
     ULONG CurrentEvents;
+    ULONG BufferEnable;
+    USHORT ReadyEvent;
+    USHORT Blocks = 0;
     NTSTATUS Status = STATUS_PENDING;
 
     NT_ASSERT((Request->Command.TransferDirection == SdTransferDirectionRead) ||
@@ -3157,33 +3618,86 @@ SdhcStartPioTransfer (
     CurrentEvents = InterlockedExchange((PLONG)&SdhcExtension->CurrentEvents,
                                         0);
 
-
     if (Request->Command.TransferDirection == SdTransferDirectionRead) {
-        SdhcReadDataPort(SdhcExtension,
-                         Request->Command.DataBuffer,
-                         Request->Command.BlockSize);
+        BufferEnable = SDHC_PS_BUFFER_READ_ENABLE;
+        ReadyEvent = SDHC_IS_BUFFER_READ_READY;
     } else {
-        SdhcWriteDataPort(SdhcExtension,
-                          Request->Command.DataBuffer,
-                          Request->Command.BlockSize);
+        BufferEnable = SDHC_PS_BUFFER_WRITE_ENABLE;
+        ReadyEvent = SDHC_IS_BUFFER_WRITE_READY;
     } // iff
 
-    --Request->Command.BlockCount;
-    if (Request->Command.BlockCount >= 1) {
-        Request->Command.DataBuffer += Request->Command.BlockSize;
-        if (Request->Command.TransferDirection == SdTransferDirectionRead) {
-            Request->RequiredEvents |= SDHC_IS_BUFFER_READ_READY;
+#if SDHC_ENABLE_PIO_BATCHING
+    //
+    // A buffer ready event may have been latched for a block a previous
+    // batch already moved. Wait for the next one instead of accessing the
+    // data port of an empty/full buffer.
+    //
+    if ((SdhcReadRegisterUlong(SdhcExtension, SDHC_PRESENT_STATE) &
+         BufferEnable) == 0) {
+
+        ++SdhcExtension->PioStaleEvents;
+        Request->RequiredEvents |= ReadyEvent;
+        Request->Status = STATUS_MORE_PROCESSING_REQUIRED;
+        return STATUS_PENDING;
+    } // if
+#endif // SDHC_ENABLE_PIO_BATCHING
 
+    for (;;) {
+        if (Request->Command.TransferDirection == SdTransferDirectionRead) {
+            SdhcReadDataPort(SdhcExtension,
+                             Request->Command.DataBuffer,
+                             Request->Command.BlockSize);
         } else {
-            Request->RequiredEvents |= SDHC_IS_BUFFER_WRITE_READY;
+            SdhcWriteDataPort(SdhcExtension,
+                              Request->Command.DataBuffer,
+                              Request->Command.BlockSize);
+        } // iff
+
+        ++Blocks;
+        --Request->Command.BlockCount;
+        if (Request->Command.BlockCount == 0) {
+            break;
         } // if
+
+        Request->Command.DataBuffer += Request->Command.BlockSize;
+
+#if SDHC_ENABLE_PIO_BATCHING
+        if ((SdhcReadRegisterUlong(SdhcExtension, SDHC_PRESENT_STATE) &
+             BufferEnable) == 0) {
+            break;
+        } // if
+
+        //
+        // The next block is already buffered, the buffer ready event
+        // latched for it is consumed here.
+        //
+        SdhcAcknowledgeInterrupts(SdhcExtension, ReadyEvent);
+#else // SDHC_ENABLE_PIO_BATCHING
+        break;
+#endif // !SDHC_ENABLE_PIO_BATCHING
+    } // for (;;)
+
+    SdhcExtension->PioBatchedBlocks += Blocks - 1;
+
+    if (Request->Command.BlockCount >= 1) {
+        Request->RequiredEvents |= ReadyEvent;
         Request->Status = STATUS_MORE_PROCESSING_REQUIRED;
     } else {
         NT_ASSERT(Request->Command.BlockCount == 0);
 
         Request->Status = STATUS_SUCCESS;
         if ((CurrentEvents & SDHC_IS_TRANSFER_COMPLETE) != 0) {
-            SdhcCompleteRequest(SdhcExtension, Request, STATUS_SUCCESS);
+            //
+            // Send the trailing bytes of an unaligned SDIO request, the
+            // request DPC completes the request once they are transferred.
+            //
+            if ((Request == &SdhcExtension->UnalignedRequest) ||
+                (SdhcCompleteNonBlockSizeAlignedRequest(SdhcExtension,
+                                                        Request,
+                                                        STATUS_SUCCESS) !=
+                 STATUS_MORE_PROCESSING_REQUIRED)) {
+                SdhcCompleteRequest(SdhcExtension, Request, STATUS_SUCCESS);
+            } // if
             Status = STATUS_SUCCESS;
         } else {
             Request->RequiredEvents |= SDHC_IS_TRANSFER_COMPLETE;
@@ -3304,7 +3818,7 @@ _Use_decl_annotations_
 NTSTATUS
 SdhcCompleteNonBlockSizeAlignedRequest (
     PSDHC_EXTENSION SdhcExtension,
-    const SDPORT_REQUEST* Request,
+    PSDPORT_REQUEST Request,
     NTSTATUS CompletionStatus
     )
 {
@@ -3350,7 +3864,7 @@ _Use_decl_annotations_
 NTSTATUS
 SdhcNonBlockSizeAlignedRequestSM (
     PSDHC_EXTENSION SdhcExtension,
-    const SDPORT_REQUEST* Request
+    PSDPORT_REQUEST Request
     )
 {
     PSDPORT_REQUEST InternalRequest = &SdhcExtension->UnalignedRequest;
@@ -3382,6 +3896,13 @@ SdhcNonBlockSizeAlignedRequestSM (
             SdhcExtension->UnalignedReqState = UnalignedReqStateIdle;
             return Status;
         } // if
+
+        //
+        // The trailing bytes command is queued right behind the aligned
+        // part. Have the request DPC wait for the events it requires, so
+        // its data is transferred as soon as the controller is ready.
+        //
+        Request->RequiredEvents = InternalRequest->RequiredEvents;
         return STATUS_MORE_PROCESSING_REQUIRED;
     } // UnalignedReqStateReady
 
@@ -3399,6 +3920,7 @@ SdhcNonBlockSizeAlignedRequestSM (
             SdhcExtension->UnalignedReqState = UnalignedReqStateIdle;
             return Status;
         } else if (Status == STATUS_PENDING) {
+            Request->RequiredEvents = SDHC_IS_TRANSFER_COMPLETE;
             return STATUS_MORE_PROCESSING_REQUIRED;
         }
 
@@ -3415,6 +3937,15 @@ SdhcNonBlockSizeAlignedRequestSM (
         // We are done, original request can be now completed.
         //
         SdhcExtension->UnalignedReqState = UnalignedReqStateIdle;
+        Status = SdhcFinishDmaTransfer(SdhcExtension, FALSE);
+        if (!NT_SUCCESS(Status)) {
+            TraceMessage(TRACE_LEVEL_WARNING,
+                         DRVR_LVL_WARN,
+                         (__FUNCTION__ ": Unaligned Cmd %d failed "
+                          "during DMA completion",
+                          Request->Command.Index));
+            return Status;
+        } // if
         TraceMessage(TRACE_LEVEL_INFORMATION,
                      DRVR_LVL_INFO,
                      (__FUNCTION__ ": Unaligned Cmd %d completed successfully",
@@ -3480,7 +4011,11 @@ SdhcPrepareInternalRequest (
     // Set the data pointer the address that follows the
     // BlockSize aligned part.
     //
-    InternalRequest->Command.DataBuffer += (BlockSize * BlockCount);
+    if (Request->Command.TransferMethod == SdTransferMethodSgDma) {
+        SdhcExtension->DmaDataOffset = BlockSize * BlockCount;
+    } else {
+        InternalRequest->Command.DataBuffer += (BlockSize * BlockCount);
+    } // iff
     //
     // If the command writes to a region of addresses rather than
     // to a single address, update the address to point the 
@@ -3521,19 +4056,411 @@ Return value:
 _Use_decl_annotations_
 NTSTATUS
 SdhcStartAdmaTransfer (
-    const SDHC_EXTENSION* SdhcExtension,
+    PSDHC_EXTENSION SdhcExtension,
     PSDPORT_REQUEST Request
     )
 {
-    UNREFERENCED_PARAMETER(SdhcExtension);
+    ULONG CurrentEvents;
+    NTSTATUS Status;
+
+    CurrentEvents = InterlockedExchange((PLONG)&SdhcExtension->CurrentEvents,
+                                        0);
 
-    Request->Status = STATUS_SUCCESS;
-    SdPortCompleteRequest(Request, Request->Status);
+    //
+    // The data command of a SgDma request waits for transfer complete, so
+    // the data phase is normally over by now. Only the trailing bytes
+    // request of an unaligned SDIO request can get here earlier, the
+    // unaligned request state machine then finishes the DMA transfer.
+    //
+    if ((CurrentEvents & SDHC_IS_TRANSFER_COMPLETE) == 0) {
+        NT_ASSERT(Request == &SdhcExtension->UnalignedRequest);
+        Request->RequiredEvents |= SDHC_IS_TRANSFER_COMPLETE;
+        Request->Status = STATUS_SUCCESS;
+        return STATUS_PENDING;
+    } // if
+
+    Status = SdhcFinishDmaTransfer(SdhcExtension, FALSE);
+
+    Request->Command.BlockCount = 0;
+    Request->Status = Status;
+
+    TraceMessage(TRACE_LEVEL_INFORMATION,
+                 DRVR_LVL_FUNC,
+                 (__FUNCTION__ ": TransferDirection: %d, Length: %d, "
+                  "Status: %08x",
+                  Request->Command.TransferDirection,
+                  Request->Command.Length,
+                  Status));
+
+    if (Request == &SdhcExtension->UnalignedRequest) {
+        return Status;
+    } // if
+
+    //
+    // Send the trailing bytes of an unaligned SDIO request, the request
+    // DPC completes the request once they are transferred.
+    //
+    if (SdhcCompleteNonBlockSizeAlignedRequest(SdhcExtension,
+                                               Request,
+                                               Status) ==
+        STATUS_MORE_PROCESSING_REQUIRED) {
+        return STATUS_SUCCESS;
+    } // if
+
+    SdhcCompleteRequest(SdhcExtension, Request, Status);
     return STATUS_SUCCESS;
 } // SdhcStartAdmaTransfer (...)
 
 /*++
 
+Routine Description:
+
+    Map the registers of the SoC DMA channel used for SgDma requests and
+    reset the channel.
+
+Arguments:
+
+    SdhcExtension - Host controller specific driver context.
+
+Return value:
+
+    NTSTATUS
+
+--*/
+_Use_decl_annotations_
+NTSTATUS
+SdhcInitializeDma (
+    PSDHC_EXTENSION SdhcExtension
+    )
+{
+    PHYSICAL_ADDRESS DmaChannelAddress;
+
+    if (SdhcExtension->DmaChannel == SDHC_BCM_DMA_CHANNEL_NONE) {
+        TraceMessage(TRACE_LEVEL_INFORMATION,
+                     DRVR_LVL_INFO,
+                     (__FUNCTION__ ": No DMA channel assigned, using PIO only"));
+        return STATUS_RESOURCE_TYPE_NOT_FOUND;
+    } // if
+
+    if (SdhcExtension->DmaChannelBase == NULL) {
+        DmaChannelAddress.QuadPart =
+            SdhcExtension->PhysicalBaseAddress.QuadPart -
+            SDHC_BCM_PERIPHERAL_OFFSET +
+            SDHC_BCM_DMA_OFFSET +
+            (SdhcExtension->DmaChannel * SDHC_BCM_DMA_CHANNEL_SIZE);
+
+        SdhcExtension->DmaChannelBase =
+            MmMapIoSpaceEx(DmaChannelAddress,
+                           SDHC_BCM_DMA_CHANNEL_SIZE,
+                           PAGE_READWRITE | PAGE_NOCACHE);
+        if (SdhcExtension->DmaChannelBase == NULL) {
+            TraceMessage(TRACE_LEVEL_ERROR,
+                         DRVR_LVL_ERR,
+                         (__FUNCTION__ ": Failed to map DMA channel %d "
+                          "registers at %I64x",
+                          SdhcExtension->DmaChannel,
+                          DmaChannelAddress.QuadPart));
+            return STATUS_INSUFFICIENT_RESOURCES;
+        } // if
+    } // if
+
+    SdhcWriteDmaRegisterUlong(SdhcExtension,
+                              SDHC_BCM_DMA_CS,
+                              SDHC_BCM_DMA_CS_RESET);
+    SdhcExtension->DmaTransferActive = FALSE;
+    SdhcExtension->DmaMaskedEvents = 0;
+    SdhcExtension->DmaDataOffset = 0;
+
+    TraceMessage(TRACE_LEVEL_INFORMATION,
+                 DRVR_LVL_INFO,
+                 (__FUNCTION__ ": SgDma enabled on DMA channel %d",
+                  SdhcExtension->DmaChannel));
+
+    return STATUS_SUCCESS;
+} // SdhcInitializeDma (...)
+
+/*++
+
+Routine Description:
+
+    Stop the SoC DMA channel and unmap its registers.
+
+Arguments:
+
+    SdhcExtension - Host controller specific driver context.
+
+Return value:
+
+--*/
+_Use_decl_annotations_
+VOID
+SdhcReleaseDma (
+    PSDHC_EXTENSION SdhcExtension
+    )
+{
+    if (SdhcExtension->DmaChannelBase == NULL) {
+        return;
+    } // if
+
+    (void)SdhcFinishDmaTransfer(SdhcExtension, TRUE);
+
+    MmUnmapIoSpace(SdhcExtension->DmaChannelBase, SDHC_BCM_DMA_CHANNEL_SIZE);
+    SdhcExtension->DmaChannelBase = NULL;
+} // SdhcReleaseDma (...)
+
+/*++
+
+Routine Description:
+
+    Save the DMA channel assigned to a controller by its FixedDMA resource,
+    keyed by the register base of the controller. A controller started
+    without a FixedDMA resource, or with one it cannot use, stays on PIO.
+
+Arguments:
+
+    ResourceList - Translated resources of the starting controller.
+
+Return value:
+
+--*/
+_Use_decl_annotations_
+VOID
+SdhcSaveDmaResource (
+    const CM_RESOURCE_LIST* ResourceList
+    )
+{
+    ULONG DmaChannel;
+    ULONG DmaCount;
+    BOOLEAN DmaValid;
+    const CM_FULL_RESOURCE_DESCRIPTOR* FullResource;
+    ULONG Index;
+    const CM_PARTIAL_RESOURCE_DESCRIPTOR* MemoryResource;
+    const CM_PARTIAL_RESOURCE_LIST* PartialList;
+    const CM_PARTIAL_RESOURCE_DESCRIPTOR* Resource;
+    ULONG ResourceIndex;
+
+    if (ResourceList == NULL) {
+        return;
+    } // if
+
+    DmaChannel = SDHC_BCM_DMA_CHANNEL_NONE;
+    DmaCount = 0;
+    DmaValid = TRUE;
+    MemoryResource = NULL;
+    FullResource = ResourceList->List;
+    for (Index = 0; Index < ResourceList->Count; ++Index) {
+        PartialList = &FullResource->PartialResourceList;
+        for (ResourceIndex = 0;
+             ResourceIndex < PartialList->Count;
+             ++ResourceIndex) {
+
+            Resource = &PartialList->PartialDescriptors[ResourceIndex];
+            if (Resource->Type == CmResourceTypeMemory) {
+                if (MemoryResource == NULL) {
+                    MemoryResource = Resource;
+                } // if
+
+            } else if (Resource->Type == CmResourceTypeDma) {
+                if ((DmaCount != 0) ||
+                    (Resource->u.DmaV3.RequestLine != SDHC_BCM_DMA_DREQ_EMMC) ||
+                    (Resource->u.DmaV3.TransferWidth != Width32Bits) ||
+                    (Resource->u.DmaV3.Channel >= SDHC_BCM_DMA_CHANNEL_COUNT)) {
+
+                    TraceMessage(TRACE_LEVEL_ERROR,
+                                 DRVR_LVL_ERR,
+                                 (__FUNCTION__ ": DMA resource %d invalid "
+                                  "(channel %d, DREQ %d, width %d), using PIO only",
+                                  DmaCount,
+                                  Resource->u.DmaV3.Channel,
+                                  Resource->u.DmaV3.RequestLine,
+                                  Resource->u.DmaV3.TransferWidth));
+                    DmaValid = FALSE;
+                } // if
+
+                DmaChannel = Resource->u.DmaV3.Channel;
+                DmaCount += 1;
+            } // iff
+        } // for (ResourceIndex)
+
+        FullResource = (const CM_FULL_RESOURCE_DESCRIPTOR*)
+            &PartialList->PartialDescriptors[PartialList->Count];
+    } // for (Index)
+
+    if (MemoryResource == NULL) {
+        return;
+    } // if
+
+    if (!DmaValid) {
+        DmaChannel = SDHC_BCM_DMA_CHANNEL_NONE;
+    } // if
+
+    //
+    // A restarted controller replaces what it was assigned on its last start.
+    //
+
+    ExAcquireFastMutex(&SdhcDmaResourcesLock);
+    for (Index = 0; Index < SdhcDmaResourceCount; ++Index) {
+        if (SdhcDmaResources[Index].PhysicalBase.QuadPart ==
+            MemoryResource->u.Memory.Start.QuadPart) {
+
+            break;
+        } // if
+    } // for (Index)
+
+    if (Index < SDHC_MAX_DMA_RESOURCES) {
+        SdhcDmaResources[Index].PhysicalBase = MemoryResource->u.Memory.Start;
+        SdhcDmaResources[Index].Channel = DmaChannel;
+        SdhcDmaResourceCount = max(SdhcDmaResourceCount, Index + 1);
+    } else {
+        TraceMessage(TRACE_LEVEL_WARNING,
+                     DRVR_LVL_WARN,
+                     (__FUNCTION__ ": Too many controllers to track their DMA "
+                      "resources, %I64x uses PIO only",
+                      MemoryResource->u.Memory.Start.QuadPart));
+    } // iff
+
+    ExReleaseFastMutex(&SdhcDmaResourcesLock);
+} // SdhcSaveDmaResource (...)
+
+/*++
+
+Routine Description:
+
+    Look up the DMA channel saved for the controller at PhysicalBase.
+
+Arguments:
+
+    PhysicalBase - Register base of the controller.
+
+Return value:
+
+    The DMA channel, SDHC_BCM_DMA_CHANNEL_NONE if there is none.
+
+--*/
+_Use_decl_annotations_
+ULONG
+SdhcFindDmaChannel (
+    PHYSICAL_ADDRESS PhysicalBase
+    )
+{
+    ULONG DmaChannel;
+    ULONG Index;
+
+    DmaChannel = SDHC_BCM_DMA_CHANNEL_NONE;
+
+    ExAcquireFastMutex(&SdhcDmaResourcesLock);
+    for (Index = 0; Index < SdhcDmaResourceCount; ++Index) {
+        if (SdhcDmaResources[Index].PhysicalBase.QuadPart ==
+            PhysicalBase.QuadPart) {
+
+            DmaChannel = SdhcDmaResources[Index].Channel;
+            break;
+        } // if
+    } // for (Index)
+
+    ExReleaseFastMutex(&SdhcDmaResourcesLock);
+
+    return DmaChannel;
+} // SdhcFindDmaChannel (...)
+
+/*++
+
+Routine Description:
+
+    Finish the DMA transfer of the current SgDma request, if any, and
+    unmask the buffer ready events masked for its data phase.
+
+Arguments:
+
+    SdhcExtension - Host controller specific driver context.
+
+    Abort - TRUE to abort the transfer, FALSE to wait for the channel to
+        retire the last writes of a completed transfer.
+
+Return value:
+
+    STATUS_SUCCESS - No transfer was active or it completed successfully.
+
+    STATUS_IO_TIMEOUT - The channel did not go idle.
+
+    STATUS_IO_DEVICE_ERROR - The channel reported an error.
+
+--*/
+_Use_decl_annotations_
+NTSTATUS
+SdhcFinishDmaTransfer (
+    PSDHC_EXTENSION SdhcExtension,
+    BOOLEAN Abort
+    )
+{
+    ULONG DmaStatus;
+    ULONG DmaDebug;
+    ULONG InterruptEnable;
+    ULONG Retries = SDHC_DMA_COMPLETION_TIMEOUT_US;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    if (!SdhcExtension->DmaTransferActive) {
+        return STATUS_SUCCESS;
+    } // if
+
+    SdhcExtension->DmaTransferActive = FALSE;
+
+    if (!Abort) {
+        DmaStatus = SdhcReadDmaRegisterUlong(SdhcExtension, SDHC_BCM_DMA_CS);
+        while (((DmaStatus & SDHC_BCM_DMA_CS_ACTIVE) != 0) && (--Retries != 0)) {
+            KeStallExecutionProcessor(1);
+            DmaStatus = SdhcReadDmaRegisterUlong(SdhcExtension, SDHC_BCM_DMA_CS);
+        } // while (...)
+
+        DmaDebug = SdhcReadDmaRegisterUlong(SdhcExtension, SDHC_BCM_DMA_DEBUG);
+        if ((DmaStatus & SDHC_BCM_DMA_CS_ACTIVE) != 0) {
+            Status = STATUS_IO_TIMEOUT;
+        } else if (((DmaStatus & SDHC_BCM_DMA_CS_ERROR) != 0) ||
+                   ((DmaDebug & SDHC_BCM_DMA_DEBUG_ERRORS) != 0)) {
+            Status = STATUS_IO_DEVICE_ERROR;
+        } // iff
+
+        if (!NT_SUCCESS(Status)) {
+            TraceMessage(TRACE_LEVEL_ERROR,
+                         DRVR_LVL_ERR,
+                         (__FUNCTION__ ": DMA transfer failed, CS: %08x, "
+                          "DEBUG: %08x, Status: %08x",
+                          DmaStatus,
+                          DmaDebug,
+                          Status));
+            Abort = TRUE;
+        } // if
+    } // if
+
+    if (Abort) {
+        SdhcWriteDmaRegisterUlong(SdhcExtension,
+                                  SDHC_BCM_DMA_CS,
+                                  SDHC_BCM_DMA_CS_RESET);
+        SdhcWriteDmaRegisterUlong(SdhcExtension,
+                                  SDHC_BCM_DMA_DEBUG,
+                                  SDHC_BCM_DMA_DEBUG_ERRORS);
+    } else {
+        SdhcWriteDmaRegisterUlong(SdhcExtension,
+                                  SDHC_BCM_DMA_CS,
+                                  SDHC_BCM_DMA_CS_END);
+    } // iff
+
+    if (SdhcExtension->DmaMaskedEvents != 0) {
+        InterruptEnable =
+            SdhcReadRegisterUlong(SdhcExtension,
+                                  SDHC_INTERRUPT_ERROR_STATUS_ENABLE);
+        SdhcWriteRegisterUlong(SdhcExtension,
+                               SDHC_INTERRUPT_ERROR_STATUS_ENABLE,
+                               InterruptEnable |
+                               SdhcExtension->DmaMaskedEvents);
+        SdhcExtension->DmaMaskedEvents = 0;
+    } // if
+
+    return Status;
+} // SdhcFinishDmaTransfer (...)
+
+/*++
+
 Routine Description:
 
     Calculates the appropriate clock divisor based on the
@@ -3834,6 +4761,29 @@ SdhcCompleteRequest(
         if (CurRequest != Request) {
             NT_ASSERT(FALSE);
         } // if
+
+        if ((Command->TransferType != SdTransferTypeNone) &&
+            (Command->TransferType != SdTransferTypeUndefined)) {
+            LONG Interrupts = InterlockedExchange(&SdhcExtension->RequestInterrupts, 0);
+            LONG Dpcs = InterlockedExchange(&SdhcExtension->RequestDpcs, 0);
+
+            ++SdhcExtension->DataRequests;
+            SdhcExtension->DataBlocks += SdhcExtension->RequestBlockCount;
+            SdhcExtension->DataInterrupts += Interrupts;
+            SdhcExtension->DataDpcs += Dpcs;
+
+            TraceMessage(TRACE_LEVEL_INFORMATION,
+                         DRVR_LVL_INFO,
+                         (__FUNCTION__ ": Cmd %d, %s, Blocks: %d, "
+                          "Interrupts: %d, DPCs: %d, Status: %08x",
+                          Command->Index,
+                          (Command->TransferMethod == SdTransferMethodSgDma) ?
+                            "DMA" : "PIO",
+                          SdhcExtension->RequestBlockCount,
+                          Interrupts,
+                          Dpcs,
+                          Status));
+        } // if
     } // if
 
     InterlockedIncrement(&SdhcExtension->CmdCompleted);
@@ -3841,6 +4791,7 @@ SdhcCompleteRequest(
 
     if (LedStatus) {
         LedStatus = FALSE;
+        (void)InterlockedIncrement(&LedUpdateRequests);
         (void)KeSetEvent(&LedWorkerUpdateEvent, 0, FALSE);
     }
     //if (LedStatus) SdhcSetLed(FALSE);
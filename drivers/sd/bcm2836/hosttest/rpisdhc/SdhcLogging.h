@@ -0,0 +1,57 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  SdhcLogging.h
+//
+// Abstract:
+//
+//  Host-side test harness replacement of the rpisdhc WPP logging macros.
+//  Messages are counted per level by the simulated kernel, and printed
+//  without their arguments when verbose tracing is requested. Assertions
+//  and critical errors fail the run
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef _SDHCLOGGING_H_
+#define _SDHCLOGGING_H_ 1
+
+#define SDHC_LOG_INIT(DriverObjectPtr, RegistryPathPtr) \
+    ((void)(DriverObjectPtr), (void)(RegistryPathPtr))
+
+#define SDHC_LOG_CLEANUP() ((void)0)
+
+#define SDHC_LOG_CRITICAL_ERROR(MSG, ...) \
+    SimTraceMessage(TRACE_LEVEL_CRITICAL, __func__, MSG)
+
+#define SDHC_LOG_ASSERTION(MSG, ...) \
+    SimTraceMessage(TRACE_LEVEL_CRITICAL, __func__, "ASSERTION: " MSG)
+
+#define SDHC_LOG_ERROR(MSG, ...) \
+    SimTraceMessage(TRACE_LEVEL_ERROR, __func__, MSG)
+
+#define SDHC_LOG_LOW_MEMORY(MSG, ...) \
+    SimTraceMessage(TRACE_LEVEL_ERROR, __func__, MSG)
+
+#define SDHC_LOG_WARNING(MSG, ...) \
+    SimTraceMessage(TRACE_LEVEL_WARNING, __func__, MSG)
+
+#define SDHC_LOG_INFORMATION(MSG, ...) \
+    SimTraceMessage(TRACE_LEVEL_INFORMATION, __func__, MSG)
+
+#define SDHC_LOG_TRACE(MSG, ...) \
+    SimTraceMessage(TRACE_LEVEL_VERBOSE, __func__, MSG)
+
+#define SDHC_CRITICAL_ASSERT(SDHC_CRIT_ASSERT_EXP) \
+    ((void)((SDHC_CRIT_ASSERT_EXP) ? 0 : \
+        (SimAssertionFailure(#SDHC_CRIT_ASSERT_EXP, __FILE__, __LINE__), 0)))
+
+#define SDHC_ASSERT(SDHC_ASSERT_EXP) \
+    ((void)((SDHC_ASSERT_EXP) ? 0 : \
+        (SimAssertionFailure(#SDHC_ASSERT_EXP, __FILE__, __LINE__), 0)))
+
+#endif // _SDHCLOGGING_H_
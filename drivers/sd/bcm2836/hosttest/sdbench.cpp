@@ -0,0 +1,728 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdbench.cpp
+//
+// Abstract:
+//
+//  Host-side benchmark and test driver for the BCM2836 SD miniports. It
+//  runs one of the miniports against the simulated controller, DMA channel
+//  and SD card, replays diskspd-like request mixes through the Sdport
+//  stand-in and reports per-request and per-mix latency, throughput and
+//  CPU cost on the simulated clock. Every transfer is checked against the
+//  card contents
+//
+//  Built once per miniport: rpisdhc drives the SDHost model, the build with
+//  SDBENCH_ARASAN defined drives the Arasan model with bcm2836sdhc
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sdportsim.h"
+#include "sdcard.h"
+#include "bcmdma.h"
+
+#if defined(SDBENCH_ARASAN)
+#include "arasan.h"
+#else
+#include "sdhost.h"
+#endif
+
+using namespace sim;
+
+namespace {
+
+#if defined(SDBENCH_ARASAN)
+
+typedef Arasan Controller;
+const char MINIPORT_NAME[] = "bcm2836sdhc";
+const ULONG DMA_CHANNEL = 5;
+
+#else
+
+typedef SdHost Controller;
+const char MINIPORT_NAME[] = "rpisdhc";
+const ULONG DMA_CHANNEL = 4;
+
+#endif
+
+enum : ULONG {
+    BLOCK_SIZE = SdCard::BLOCK_SIZE,
+    CARD_BLOCK_COUNT = 16 * 1024 * 1024,    // 8GB SDHC card
+    MAX_REQUEST_BLOCKS = 512,
+    DEFAULT_REQUEST_COUNT = 64,
+};
+
+//
+// A diskspd-like workload: request size, read/write ratio and access
+// pattern over a target region of the card
+//
+struct Mix {
+    const char* Name;
+    ULONG Blocks;
+    ULONG ReadPercent;
+    bool Random;
+    ULONG RegionBlocks;
+};
+
+const Mix MIXES[] = {
+    //  Name            Blocks  Read%   Random  Region
+    { "seq-read-64k",   128,    100,    false,  64 * 1024 },
+    { "seq-write-64k",  128,    0,      false,  64 * 1024 },
+    { "rand-read-4k",   8,      100,    true,   1024 * 1024 },
+    { "rand-write-4k",  8,      0,      true,   1024 * 1024 },
+    { "mixed-16k",      32,     70,     true,   1024 * 1024 },
+    { "rand-rw-512",    1,      50,     true,   1024 * 1024 },
+    { "seq-read-256k",  512,    100,    false,  64 * 1024 },
+    { "seq-write-256k", 512,    0,      false,  64 * 1024 },
+};
+
+struct Options {
+    std::string Test;
+    std::string MixName;
+    ULONG RequestCount;
+    uint64_t Seed;
+    bool Pio;
+    bool NoFixedDma;
+    bool PerRequest;
+    ULONG Verbosity;
+};
+
+//
+// Measurement of one request on the simulated clock
+//
+struct Sample {
+    bool Write;
+    ULONG Lba;
+    ULONG Blocks;
+    Time LatencyNs;
+    Time CpuNs;
+    uint64_t Interrupts;
+    uint64_t Dpcs;
+    uint64_t RegisterAccesses;
+    NTSTATUS Status;
+    bool Verified;
+};
+
+struct MixResult {
+    std::string Name;
+    std::vector<Sample> Samples;
+    Time ElapsedNs;
+    uint64_t Failures;
+    uint64_t Mismatches;
+};
+
+struct Platform {
+    SdCard Card;
+    Controller Host;
+    BcmDma Dma;
+    SdPortSlot Slot;
+
+    explicit Platform (uint64_t Seed) :
+        Card(CARD_BLOCK_COUNT, Seed),
+        Host(&Card),
+        Dma(DMA_CHANNEL)
+    {
+    }
+};
+
+uint64_t g_rng;
+
+ULONG random32 ()
+{
+    //
+    // xorshift64*
+    //
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return ULONG((g_rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+Time cpuNs (const Stats& S)
+{
+    return S.IsrNs + S.DpcNs + S.ThreadNs;
+}
+
+NTSTATUS startPlatform (Platform* PlatformPtr, const Options& Opt)
+{
+    MapDevice(Controller::PHYSICAL_BASE, Controller::REGISTERS_SIZE, &PlatformPtr->Host);
+    MapDevice(PlatformPtr->Dma.PhysicalBase(), BcmDma::CHANNEL_SIZE, &PlatformPtr->Dma);
+    ConnectDreq(Controller::DREQ, &PlatformPtr->Host);
+
+    //
+    // FixedDMA(Controller::DREQ, DMA_CHANNEL, Width32bit, )
+    //
+    CM_PARTIAL_RESOURCE_DESCRIPTOR dmaResource = {};
+    dmaResource.Type = CmResourceTypeDma;
+    dmaResource.u.DmaV3.Channel = DMA_CHANNEL;
+    dmaResource.u.DmaV3.RequestLine = Controller::DREQ;
+    dmaResource.u.DmaV3.TransferWidth = Width32Bits;
+
+    NTSTATUS status = PlatformPtr->Slot.Start(
+        Controller::PHYSICAL_BASE,
+        Controller::REGISTERS_SIZE,
+        &PlatformPtr->Host,
+        Opt.NoFixedDma ? nullptr : &dmaResource);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    status = PlatformPtr->Slot.InitializeCard();
+    if (!NT_SUCCESS(status)) {
+        ::fprintf(stderr, "Card initialization failed, status 0x%08x\n", unsigned(status));
+        return status;
+    }
+    if (PlatformPtr->Slot.CardBlockCount() != CARD_BLOCK_COUNT) {
+        ::fprintf(
+            stderr,
+            "CSD reports %lu blocks, the card has %lu\n",
+            (unsigned long)PlatformPtr->Slot.CardBlockCount(),
+            (unsigned long)CARD_BLOCK_COUNT);
+        return STATUS_DEVICE_PROTOCOL_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+void fillWriteData (ULONG Lba, ULONG Blocks, ULONG Salt, UCHAR* BufferPtr)
+{
+    for (ULONG i = 0; i < Blocks * BLOCK_SIZE / sizeof(ULONG); ++i) {
+        ULONG word = (Lba * 0x01000193UL) ^ (i * 0x9E3779B9UL) ^ (Salt << 7) ^ 0xA5000000UL;
+        ::memcpy(BufferPtr + i * sizeof(ULONG), &word, sizeof(ULONG));
+    }
+}
+
+bool verify (const Platform& P, ULONG Lba, ULONG Blocks, const UCHAR* BufferPtr)
+{
+    UCHAR expected[BLOCK_SIZE];
+    for (ULONG i = 0; i < Blocks; ++i) {
+        P.Card.Peek(Lba + i, expected);
+        if (::memcmp(expected, BufferPtr + i * BLOCK_SIZE, BLOCK_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+// Issue one block request, splitting it at the slot's maximum block count
+// the way Sdport would, and measure it
+//
+Sample runRequest (
+    Platform* PlatformPtr,
+    bool Write,
+    ULONG Lba,
+    ULONG Blocks,
+    UCHAR* BufferPtr,
+    const Options& Opt,
+    ULONG Salt
+    )
+{
+    Sample sample = {};
+    sample.Write = Write;
+    sample.Lba = Lba;
+    sample.Blocks = Blocks;
+
+    if (Write) {
+        fillWriteData(Lba, Blocks, Salt, BufferPtr);
+    } else {
+        ::memset(BufferPtr, 0xCC, Blocks * BLOCK_SIZE);
+    }
+
+    const Stats before = GetStats();
+    const Time start = Now();
+    const SDPORT_TRANSFER_METHOD method =
+        Opt.Pio ? SdTransferMethodPio : SdTransferMethodSgDma;
+    ULONG maxBlocks = std::max<ULONG>(
+        1,
+        std::min<ULONG>(PlatformPtr->Slot.Capabilities().MaximumBlockCount, MAX_REQUEST_BLOCKS));
+
+    NTSTATUS status = STATUS_SUCCESS;
+    for (ULONG done = 0; (done < Blocks) && NT_SUCCESS(status); ) {
+        ULONG count = std::min(Blocks - done, maxBlocks);
+        status = PlatformPtr->Slot.Transfer(
+            Write,
+            Lba + done,
+            count,
+            BufferPtr + done * BLOCK_SIZE,
+            method);
+        done += count;
+    }
+
+    const Stats& after = GetStats();
+    sample.LatencyNs = Now() - start;
+    sample.CpuNs = cpuNs(after) - cpuNs(before);
+    sample.Interrupts = after.IsrCount - before.IsrCount;
+    sample.Dpcs = after.DpcCount - before.DpcCount;
+    sample.RegisterAccesses =
+        (after.RegisterReads - before.RegisterReads) +
+        (after.RegisterWrites - before.RegisterWrites);
+    sample.Status = status;
+    sample.Verified = NT_SUCCESS(status) && verify(*PlatformPtr, Lba, Blocks, BufferPtr);
+    return sample;
+}
+
+MixResult runMix (Platform* PlatformPtr, const Mix& M, const Options& Opt, UCHAR* BufferPtr)
+{
+    MixResult result;
+    result.Name = M.Name;
+    result.Failures = 0;
+    result.Mismatches = 0;
+
+    //
+    // Each mix gets its own region so that reads see both written and
+    // never written blocks
+    //
+    static ULONG s_regionBase = 0;
+    const ULONG regionBase = s_regionBase;
+    s_regionBase += M.RegionBlocks;
+
+    const Time start = Now();
+    ULONG nextLba = regionBase;
+    for (ULONG i = 0; i < Opt.RequestCount; ++i) {
+        bool write = (random32() % 100) >= M.ReadPercent;
+        ULONG lba;
+        if (M.Random) {
+            lba = regionBase + (random32() % (M.RegionBlocks / M.Blocks)) * M.Blocks;
+        } else {
+            if (nextLba + M.Blocks > regionBase + M.RegionBlocks) {
+                nextLba = regionBase;
+            }
+            lba = nextLba;
+            nextLba += M.Blocks;
+        }
+
+        Sample sample = runRequest(PlatformPtr, write, lba, M.Blocks, BufferPtr, Opt, i);
+        if (!NT_SUCCESS(sample.Status)) {
+            ++result.Failures;
+        } else if (!sample.Verified) {
+            ++result.Mismatches;
+        }
+        if (Opt.PerRequest) {
+            ::printf(
+                "  %-15s %5lu %-5s lba %8lu blocks %4lu  %9.1f us  cpu %8.1f us  "
+                "isr %3llu  dpc %3llu  reg %6llu  %s\n",
+                M.Name,
+                (unsigned long)i,
+                write ? "write" : "read",
+                (unsigned long)lba,
+                (unsigned long)M.Blocks,
+                sample.LatencyNs / 1000.0,
+                sample.CpuNs / 1000.0,
+                (unsigned long long)sample.Interrupts,
+                (unsigned long long)sample.Dpcs,
+                (unsigned long long)sample.RegisterAccesses,
+                !NT_SUCCESS(sample.Status) ? "FAILED" : (sample.Verified ? "ok" : "MISMATCH"));
+        }
+        result.Samples.push_back(sample);
+    }
+    result.ElapsedNs = Now() - start;
+    return result;
+}
+
+Time percentile (std::vector<Time> Values, double Fraction)
+{
+    if (Values.empty()) {
+        return 0;
+    }
+    std::sort(Values.begin(), Values.end());
+    size_t index = size_t(Fraction * (Values.size() - 1) + 0.5);
+    return Values[std::min(index, Values.size() - 1)];
+}
+
+void printHeader ()
+{
+    ::printf(
+        "%-15s %5s %8s %9s %9s %9s %9s %8s %6s %6s %7s\n",
+        "mix", "reqs", "MB/s", "avg us", "p50 us", "p99 us", "max us",
+        "cpu us", "isr", "dpc", "reg");
+}
+
+void printResult (const MixResult& R)
+{
+    std::vector<Time> latencies;
+    uint64_t bytes = 0;
+    Time cpu = 0;
+    uint64_t interrupts = 0;
+    uint64_t dpcs = 0;
+    uint64_t registers = 0;
+    for (const Sample& sample : R.Samples) {
+        latencies.push_back(sample.LatencyNs);
+        bytes += uint64_t(sample.Blocks) * BLOCK_SIZE;
+        cpu += sample.CpuNs;
+        interrupts += sample.Interrupts;
+        dpcs += sample.Dpcs;
+        registers += sample.RegisterAccesses;
+    }
+    const double count = double(std::max<size_t>(R.Samples.size(), 1));
+    Time total = 0;
+    for (Time latency : latencies) {
+        total += latency;
+    }
+
+    ::printf(
+        "%-15s %5zu %8.2f %9.1f %9.1f %9.1f %9.1f %8.1f %6.1f %6.1f %7.0f",
+        R.Name.c_str(),
+        R.Samples.size(),
+        (R.ElapsedNs > 0) ? (bytes * 1e3 / R.ElapsedNs) : 0.0,
+        total / count / 1000.0,
+        percentile(latencies, 0.50) / 1000.0,
+        percentile(latencies, 0.99) / 1000.0,
+        percentile(latencies, 1.0) / 1000.0,
+        cpu / count / 1000.0,
+        interrupts / count,
+        dpcs / count,
+        registers / count);
+    if ((R.Failures != 0) || (R.Mismatches != 0)) {
+        ::printf(
+            "  failed %llu, mismatched %llu",
+            (unsigned long long)R.Failures,
+            (unsigned long long)R.Mismatches);
+    }
+    ::printf("\n");
+}
+
+void printThreads ()
+{
+    const Stats& stats = GetStats();
+    ::printf(
+        "cpu: isr %.1f ms (%llu), dpc %.1f ms (%llu), threads %.1f ms, switches %llu\n",
+        stats.IsrNs / 1e6,
+        (unsigned long long)stats.IsrCount,
+        stats.DpcNs / 1e6,
+        (unsigned long long)stats.DpcCount,
+        stats.ThreadNs / 1e6,
+        (unsigned long long)stats.SwitchCount);
+    for (const auto& thread : GetThreadBusy()) {
+        ::printf("  %-24s %.1f ms\n", thread.first.c_str(), thread.second / 1e6);
+    }
+}
+
+//
+// Tests
+//
+
+bool checkResult (const MixResult& R)
+{
+    if ((R.Failures != 0) || (R.Mismatches != 0)) {
+        ::printf(
+            "FAIL: %s: %llu failed, %llu mismatched\n",
+            R.Name.c_str(),
+            (unsigned long long)R.Failures,
+            (unsigned long long)R.Mismatches);
+        return false;
+    }
+    return true;
+}
+
+bool checkHealth (const Platform& P)
+{
+    bool pass = true;
+    if (GetStats().AssertionCount != 0) {
+        ::printf("FAIL: %llu assertions\n", (unsigned long long)GetStats().AssertionCount);
+        pass = false;
+    }
+    if (P.Slot.Timeouts() != 0) {
+        ::printf("FAIL: %llu request timeouts\n", (unsigned long long)P.Slot.Timeouts());
+        pass = false;
+    }
+    return pass;
+}
+
+//
+// Every mix completes with verified data and no assertion or timeout
+//
+bool testMixes (Platform* PlatformPtr, const Options& Opt, UCHAR* BufferPtr)
+{
+    bool pass = true;
+    printHeader();
+    for (const Mix& mix : MIXES) {
+        MixResult result = runMix(PlatformPtr, mix, Opt, BufferPtr);
+        printResult(result);
+        pass &= checkResult(result);
+    }
+    return pass;
+}
+
+//
+// Multi-block requests move every word through the DMA channel and leave
+// the CPU with a handful of register accesses per request. rpisdhc keeps
+// single block requests on PIO and drains the words of a read below the
+// FIFO read threshold by PIO. PIO requests, and every request of a
+// controller started without a FixedDMA resource, never touch the channel
+//
+bool testDma (Platform* PlatformPtr, const Options& Opt, UCHAR* BufferPtr)
+{
+    const ULONG maxBlocks = std::min<ULONG>(
+        PlatformPtr->Slot.Capabilities().MaximumBlockCount,
+        MAX_REQUEST_BLOCKS);
+    const ULONG blockCounts[] = { 1, 2, 8, 128, maxBlocks };
+    const ULONG wordsPerBlock = BLOCK_SIZE / sizeof(ULONG);
+
+    bool pass = true;
+    ULONG lba = 0x200000;
+    for (ULONG blocks : blockCounts) {
+        for (bool write : { true, false }) {
+            const BcmDma::Counters before = PlatformPtr->Dma.GetCounters();
+            Sample sample = runRequest(PlatformPtr, write, lba, blocks, BufferPtr, Opt, blocks);
+            const BcmDma::Counters& after = PlatformPtr->Dma.GetCounters();
+
+            const uint64_t words = after.Words - before.Words;
+            const uint64_t controlBlocks = after.ControlBlocks - before.ControlBlocks;
+            bool dma = !Opt.Pio && !Opt.NoFixedDma;
+#if !defined(SDBENCH_ARASAN)
+            dma &= (blocks > 1);
+#endif
+            const uint64_t expectedWords = dma ? uint64_t(blocks) * wordsPerBlock : 0;
+            uint64_t pioTail = 0;
+#if !defined(SDBENCH_ARASAN)
+            if (dma && !write) {
+                pioTail = std::min<uint64_t>(expectedWords, SdHost::FIFO_WORDS - 1);
+            }
+#endif
+
+            ::printf(
+                "%-5s %4lu blocks: dma words %6llu, control blocks %3llu, cpu registers %6llu\n",
+                write ? "write" : "read",
+                (unsigned long)blocks,
+                (unsigned long long)words,
+                (unsigned long long)controlBlocks,
+                (unsigned long long)sample.RegisterAccesses);
+
+            if (!NT_SUCCESS(sample.Status) || !sample.Verified) {
+                ::printf("FAIL: %s\n", NT_SUCCESS(sample.Status) ? "data mismatch" : "request failed");
+                pass = false;
+            }
+            if ((words > expectedWords) || (words + pioTail < expectedWords)) {
+                ::printf("FAIL: expected %llu DMA words\n", (unsigned long long)expectedWords);
+                pass = false;
+            }
+            if (dma && (controlBlocks == 0)) {
+                ::printf("FAIL: no control block loaded\n");
+                pass = false;
+            }
+            if (dma && (sample.RegisterAccesses >= expectedWords / 4)) {
+                ::printf("FAIL: CPU register accesses do not drop with DMA\n");
+                pass = false;
+            }
+            lba += blocks;
+        }
+    }
+    return pass;
+}
+
+#if !defined(SDBENCH_ARASAN)
+
+//
+// Bursts never read the FIFO empty or write it full, and PIO reads poll the
+// FIFO state less often than once per word. PIO writes are paced by the
+// card draining the FIFO one word at a time, their status reads are only
+// reported
+//
+bool testFifo (Platform* PlatformPtr, const Options& Opt, UCHAR* BufferPtr)
+{
+    static const ULONG BLOCK_COUNTS[] = { 1, 8, 64 };
+    const ULONG wordsPerBlock = BLOCK_SIZE / sizeof(ULONG);
+
+    bool pass = true;
+    ULONG lba = 0x300000;
+    for (ULONG blocks : BLOCK_COUNTS) {
+        for (bool write : { true, false }) {
+            const SdHost::Counters before = PlatformPtr->Host.GetCounters();
+            const uint64_t dmaWordsBefore = PlatformPtr->Dma.GetCounters().Words;
+            Sample sample = runRequest(PlatformPtr, write, lba, blocks, BufferPtr, Opt, blocks);
+            const SdHost::Counters& after = PlatformPtr->Host.GetCounters();
+
+            const bool pio = (PlatformPtr->Dma.GetCounters().Words == dmaWordsBefore);
+            const uint64_t statusReads =
+                (after.HstsReads - before.HstsReads) + (after.EdmReads - before.EdmReads);
+            const uint64_t emptyReads = after.EmptyReads - before.EmptyReads;
+            const uint64_t fullWrites = after.FullWrites - before.FullWrites;
+            const uint64_t words = uint64_t(blocks) * wordsPerBlock;
+
+            ::printf(
+                "%-5s %3lu blocks %-3s: status reads %5llu, empty reads %llu, full writes %llu, "
+                "read stalls %llu, write stalls %llu\n",
+                write ? "write" : "read",
+                (unsigned long)blocks,
+                pio ? "pio" : "dma",
+                (unsigned long long)statusReads,
+                (unsigned long long)emptyReads,
+                (unsigned long long)fullWrites,
+                (unsigned long long)(after.ReadStalls - before.ReadStalls),
+                (unsigned long long)(after.WriteStalls - before.WriteStalls));
+
+            if (!NT_SUCCESS(sample.Status) || !sample.Verified) {
+                ::printf("FAIL: %s\n", NT_SUCCESS(sample.Status) ? "data mismatch" : "request failed");
+                pass = false;
+            }
+            if ((emptyReads != 0) || (fullWrites != 0)) {
+                ::printf("FAIL: FIFO read while empty or written while full\n");
+                pass = false;
+            }
+            if (pio && !write && (statusReads >= words)) {
+                ::printf("FAIL: PIO read polled the FIFO state once per word or more\n");
+                pass = false;
+            }
+            lba += blocks;
+        }
+    }
+
+    const ULONG maxLevel = PlatformPtr->Host.GetCounters().MaxFifoLevel;
+    ::printf("max FIFO level %lu\n", (unsigned long)maxLevel);
+    if (maxLevel > SdHost::FIFO_WORDS) {
+        ::printf("FAIL: FIFO level above %lu words\n", (unsigned long)SdHost::FIFO_WORDS);
+        pass = false;
+    }
+    return pass;
+}
+
+#endif // !SDBENCH_ARASAN
+
+struct Test {
+    const char* Name;
+    bool (*Routine) (Platform* PlatformPtr, const Options& Opt, UCHAR* BufferPtr);
+};
+
+const Test TESTS[] = {
+    { "mixes", testMixes },
+    { "dma", testDma },
+#if !defined(SDBENCH_ARASAN)
+    { "fifo", testFifo },
+#endif
+};
+
+void usage ()
+{
+    ::printf(
+        "usage: sdbench-%s [options]\n"
+        "  --mix NAME        run one mix, default all\n"
+        "  --requests N      requests per mix, default %lu\n"
+        "  --seed N          card and workload seed\n"
+        "  --pio             do not request SgDma transfers\n"
+        "  --no-fixed-dma    start the controller without a FixedDMA resource\n"
+        "  --per-request     print every request\n"
+        "  --test NAME|all   run a test instead of the benchmark\n"
+        "  --verbose N       miniport trace level\n"
+        "mixes:",
+        MINIPORT_NAME,
+        (unsigned long)DEFAULT_REQUEST_COUNT);
+    for (const Mix& mix : MIXES) {
+        ::printf(" %s", mix.Name);
+    }
+    ::printf("\ntests:");
+    for (const Test& test : TESTS) {
+        ::printf(" %s", test.Name);
+    }
+    ::printf("\n");
+}
+
+bool parseOptions (int Argc, char** Argv, Options* OptPtr)
+{
+    OptPtr->RequestCount = DEFAULT_REQUEST_COUNT;
+    OptPtr->Seed = 1;
+    OptPtr->Pio = false;
+    OptPtr->NoFixedDma = false;
+    OptPtr->PerRequest = false;
+    OptPtr->Verbosity = TRACE_LEVEL_CRITICAL;
+
+    for (int i = 1; i < Argc; ++i) {
+        std::string arg = Argv[i];
+        bool hasValue = (i + 1 < Argc);
+        if ((arg == "--mix") && hasValue) {
+            OptPtr->MixName = Argv[++i];
+        } else if ((arg == "--requests") && hasValue) {
+            OptPtr->RequestCount = ULONG(::strtoul(Argv[++i], nullptr, 0));
+        } else if ((arg == "--seed") && hasValue) {
+            OptPtr->Seed = ::strtoull(Argv[++i], nullptr, 0);
+        } else if (arg == "--pio") {
+            OptPtr->Pio = true;
+        } else if (arg == "--no-fixed-dma") {
+            OptPtr->NoFixedDma = true;
+        } else if (arg == "--per-request") {
+            OptPtr->PerRequest = true;
+        } else if ((arg == "--test") && hasValue) {
+            OptPtr->Test = Argv[++i];
+        } else if ((arg == "--verbose") && hasValue) {
+            OptPtr->Verbosity = ULONG(::strtoul(Argv[++i], nullptr, 0));
+        } else {
+            return false;
+        }
+    }
+    return OptPtr->RequestCount != 0;
+}
+
+} // namespace
+
+int main (int Argc, char** Argv)
+{
+    Options opt;
+    if (!parseOptions(Argc, Argv, &opt)) {
+        usage();
+        return 2;
+    }
+
+    Init();
+    SetVerbosity(opt.Verbosity);
+    g_rng = opt.Seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    Platform platform(opt.Seed);
+    if (!NT_SUCCESS(startPlatform(&platform, opt))) {
+        ::printf("FAIL: %s did not bring the card up\n", MINIPORT_NAME);
+        return 1;
+    }
+
+    auto bufferPtr = static_cast<UCHAR*>(AllocatePhysical(MAX_REQUEST_BLOCKS * BLOCK_SIZE, false));
+    ::printf(
+        "%s: %s, %lu requests per mix, seed %llu\n",
+        MINIPORT_NAME,
+        opt.Pio ? "Sdport PIO" :
+            (platform.Slot.Capabilities().Supported.ScatterGatherDma ? "Sdport SgDma" : "Sdport PIO, miniport owns DMA"),
+        (unsigned long)opt.RequestCount,
+        (unsigned long long)opt.Seed);
+
+    bool pass = true;
+    if (!opt.Test.empty()) {
+        bool found = false;
+        for (const Test& test : TESTS) {
+            if ((opt.Test == "all") || (opt.Test == test.Name)) {
+                found = true;
+                ::printf("== %s\n", test.Name);
+                bool testPass = test.Routine(&platform, opt, bufferPtr);
+                ::printf("%s: %s\n", testPass ? "PASS" : "FAIL", test.Name);
+                pass &= testPass;
+            }
+        }
+        if (!found) {
+            usage();
+            return 2;
+        }
+    } else {
+        printHeader();
+        for (const Mix& mix : MIXES) {
+            if (!opt.MixName.empty() && (opt.MixName != mix.Name)) {
+                continue;
+            }
+            MixResult result = runMix(&platform, mix, opt, bufferPtr);
+            printResult(result);
+            pass &= checkResult(result);
+        }
+        printThreads();
+    }
+    pass &= checkHealth(platform);
+
+    platform.Slot.Stop();
+    FreePhysical(bufferPtr);
+    Shutdown();
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,668 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  arasan.cpp
+//
+// Abstract:
+//
+//  Arasan SDHCI controller model
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#include "arasan.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace sim {
+namespace {
+
+enum : ULONG {
+    REG_SYSADDR = 0x00,
+    REG_BLOCK_SIZE_COUNT = 0x04,
+    REG_ARGUMENT = 0x08,
+    REG_TRANSFER_MODE_COMMAND = 0x0C,
+    REG_RESPONSE_0 = 0x10,
+    REG_DATA_PORT = 0x20,
+    REG_PRESENT_STATE = 0x24,
+    REG_CONTROL_0 = 0x28,
+    REG_CONTROL_1 = 0x2C,
+    REG_INTERRUPT_ERROR_STATUS = 0x30,
+    REG_INTERRUPT_ERROR_STATUS_ENABLE = 0x34,
+    REG_INTERRUPT_ERROR_SIGNAL_ENABLE = 0x38,
+    REG_CONTROL_2 = 0x3C,
+    REG_CAPABILITIES = 0x40,
+    REG_MAXIMUM_CURRENT = 0x48,
+    REG_SLOT_INFORMATION_VERSION = 0xFC,
+
+    TM_BLKCNT_ENABLE = 0x0002,
+    TM_AUTO_CMD12_ENABLE = 0x0004,
+    TM_TRANSFER_READ = 0x0010,
+    TM_MULTIBLOCK = 0x0020,
+
+    CMD_RESPONSE_SHIFT = 16,
+    CMD_RESPONSE_MASK = 0x3,
+    CMD_RESPONSE_NONE = 0,
+    CMD_RESPONSE_136BIT = 1,
+    CMD_RESPONSE_48BIT_WBUSY = 3,
+    CMD_DATA_PRESENT = 0x00200000,
+    CMD_INDEX_SHIFT = 24,
+    CMD_INDEX_MASK = 0x3F,
+
+    PS_CMD_INHIBIT = 0x00000001,
+    PS_DAT_INHIBIT = 0x00000002,
+    PS_DAT_ACTIVE = 0x00000004,
+    PS_WRITE_TRANSFER_ACTIVE = 0x00000100,
+    PS_READ_TRANSFER_ACTIVE = 0x00000200,
+    PS_BUFFER_WRITE_ENABLE = 0x00000400,
+    PS_BUFFER_READ_ENABLE = 0x00000800,
+    PS_CARD_PRESENT = 0x00070000,
+    PS_WRITE_ENABLED = 0x00080000,
+    PS_DAT0_SIGNAL = 0x00100000,
+    PS_DAT_3_1_SIGNAL = 0x00E00000,
+    PS_CMD_SIGNAL = 0x01000000,
+
+    HC_DATA_WIDTH_4BIT = 0x02,
+
+    CC_INTERNAL_CLOCK_ENABLE = 0x0001,
+    CC_CLOCK_STABLE = 0x0002,
+    CC_DIVISOR_LOW_SHIFT = 8,
+    CC_DIVISOR_HIGH_SHIFT = 6,
+
+    RESET_ALL = 0x01000000,
+    RESET_CMD = 0x02000000,
+    RESET_DAT = 0x04000000,
+    RESET_MASK = 0x07000000,
+
+    IS_CMD_COMPLETE = 0x0001,
+    IS_TRANSFER_COMPLETE = 0x0002,
+    IS_BUFFER_WRITE_READY = 0x0010,
+    IS_BUFFER_READ_READY = 0x0020,
+    IS_ERROR_INTERRUPT = 0x8000,
+    IS_ERROR_EVENTS = 0xFFFF0000,
+    ES_CMD_TIMEOUT = 0x00010000,
+
+    //
+    // Spec version 3.0, vendor version 0x99
+    //
+    SLOT_INFORMATION_VERSION = 0x99020000,
+    MAXIMUM_CURRENT_33V = 0x000000FF,
+
+    COMMAND_CLOCKS = 48,
+    NCR_CLOCKS = 2,
+    NCC_CLOCKS = 8,
+    START_BIT_CLOCKS = 2,
+    CRC_CLOCKS = 17,
+    CRC_STATUS_CLOCKS = 8,
+};
+
+} // namespace
+
+Arasan::Arasan (SdCard* CardPtr) :
+    cardPtr(CardPtr)
+{
+    ::memset(&this->counters, 0, sizeof(this->counters));
+    this->reset(RESET_ALL);
+}
+
+void Arasan::reset (ULONG Mask)
+{
+    if ((Mask & RESET_ALL) != 0) {
+        this->sysAddr = 0;
+        this->blockSizeCount = 0;
+        this->argument = 0;
+        this->transferModeCommand = 0;
+        this->control0 = 0;
+        this->control1 = 0;
+        this->interruptStatus = 0;
+        this->statusEnable = 0;
+        this->signalEnable = 0;
+        this->control2 = 0;
+        this->busyDue = NEVER;
+        Mask |= RESET_CMD | RESET_DAT;
+    }
+    if ((Mask & RESET_CMD) != 0) {
+        ::memset(this->response, 0, sizeof(this->response));
+        this->cmdDue = NEVER;
+        this->interruptStatus &= ~IS_CMD_COMPLETE;
+    }
+    if ((Mask & RESET_DAT) != 0) {
+        this->phase = PhaseNone;
+        this->dataDue = NEVER;
+        this->autoCmdDue = NEVER;
+        this->dataRead = false;
+        this->dataActive = false;
+        this->autoCmd12 = false;
+        this->autoCmd12Done = false;
+        this->multipleBlock = false;
+        this->blockWords = 1;
+        this->blocksTotal = 0;
+        this->blocksDone = 0;
+        this->wordIndex = 0;
+        this->incomingWords = 0;
+        this->hostWords = 0;
+        this->hostWordsTotal = 0;
+        this->moreBlocks = false;
+        this->bufferEnable = false;
+        this->buffer.clear();
+        this->interruptStatus &=
+            ~(IS_TRANSFER_COMPLETE | IS_BUFFER_READ_READY | IS_BUFFER_WRITE_READY);
+    }
+}
+
+Time Arasan::clockNs () const
+{
+    //
+    // 10 bit divided clock mode, SDCLK = base / (2 * N), N = 0 is the base
+    // clock itself
+    //
+    ULONG divisor = ((this->control1 >> CC_DIVISOR_LOW_SHIFT) & 0xFF) |
+                    (((this->control1 >> CC_DIVISOR_HIGH_SHIFT) & 0x3) << 8);
+    Time periods = (divisor == 0) ? 1 : 2 * Time(divisor);
+    return std::max<Time>((periods * NS_PER_MS) / BASE_CLOCK_KHZ, 1);
+}
+
+Time Arasan::wordNs () const
+{
+    return this->clockNs() * (((this->control0 & HC_DATA_WIDTH_4BIT) != 0) ? 8 : 32);
+}
+
+void Arasan::latch (ULONG Status)
+{
+    //
+    // Only events enabled in the status enable register are reflected in
+    // the status register
+    //
+    this->interruptStatus |= Status & this->statusEnable;
+}
+
+ULONG Arasan::presentState () const
+{
+    ULONG state = PS_CARD_PRESENT | PS_WRITE_ENABLED | PS_DAT_3_1_SIGNAL | PS_CMD_SIGNAL;
+    if (this->cardPtr->BusyUntil() <= Now()) {
+        state |= PS_DAT0_SIGNAL;
+    }
+    if ((this->cmdDue != NEVER) || (this->autoCmdDue != NEVER)) {
+        state |= PS_CMD_INHIBIT;
+    }
+    if (this->dataActive || (this->busyDue != NEVER)) {
+        state |= PS_DAT_INHIBIT | PS_DAT_ACTIVE;
+    }
+    if (this->dataActive) {
+        state |= this->dataRead ? PS_READ_TRANSFER_ACTIVE : PS_WRITE_TRANSFER_ACTIVE;
+    }
+    if (this->bufferEnable) {
+        state |= this->dataRead ? PS_BUFFER_READ_ENABLE : PS_BUFFER_WRITE_ENABLE;
+    }
+    return state;
+}
+
+void Arasan::bufferReady ()
+{
+    //
+    // Buffer read/write ready are raised on the rising edge of the
+    // corresponding present state bit, which drops once the host moved a
+    // whole block through the data port
+    //
+    bool enable;
+    if (!this->dataActive) {
+        enable = false;
+    } else if (this->dataRead) {
+        enable = (this->buffer.size() - this->incomingWords) >= this->blockWords;
+    } else {
+        ULONG capacity = BUFFER_BLOCKS * this->blockWords;
+        ULONG used = ULONG(this->buffer.size()) +
+            ((this->phase == PhaseWriteBlock) ? this->blockWords : 0);
+        enable = ((capacity - std::min(capacity, used)) >= this->blockWords) &&
+                 ((this->hostWordsTotal == 0) || (this->hostWords < this->hostWordsTotal));
+    }
+    if (enable && !this->bufferEnable) {
+        ++this->counters.BufferReadyEvents;
+        this->latch(this->dataRead ? IS_BUFFER_READ_READY : IS_BUFFER_WRITE_READY);
+    }
+    this->bufferEnable = enable;
+}
+
+ULONG Arasan::Read (ULONG Offset)
+{
+    switch (Offset) {
+    case REG_SYSADDR:
+        return this->sysAddr;
+
+    case REG_BLOCK_SIZE_COUNT:
+        return this->blockSizeCount;
+
+    case REG_ARGUMENT:
+        return this->argument;
+
+    case REG_TRANSFER_MODE_COMMAND:
+        return this->transferModeCommand;
+
+    case REG_RESPONSE_0:
+    case REG_RESPONSE_0 + 4:
+    case REG_RESPONSE_0 + 8:
+    case REG_RESPONSE_0 + 12:
+        return this->response[(Offset - REG_RESPONSE_0) / 4];
+
+    case REG_DATA_PORT:
+    {
+        if (!this->dataRead || this->buffer.empty()) {
+            return 0;
+        }
+        ++this->counters.DataPortReads;
+        if (this->buffer.size() == this->incomingWords) {
+            --this->incomingWords;
+        }
+        ULONG value = this->buffer.front();
+        this->buffer.pop_front();
+        if (this->phase == PhaseReadStall) {
+            this->phase = PhaseReadBlock;
+            this->dataDue = Now() + this->wordNs();
+        }
+        if ((++this->hostWords % this->blockWords) == 0) {
+            this->bufferEnable = false;
+        }
+        this->bufferReady();
+        if (this->transferDone()) {
+            this->dataActive = false;
+            this->phase = PhaseNone;
+            this->bufferEnable = false;
+            this->latch(IS_TRANSFER_COMPLETE);
+        }
+        return value;
+    }
+
+    case REG_PRESENT_STATE:
+        return this->presentState();
+
+    case REG_CONTROL_0:
+        return this->control0;
+
+    case REG_CONTROL_1:
+        return this->control1 |
+            (((this->control1 & CC_INTERNAL_CLOCK_ENABLE) != 0) ? CC_CLOCK_STABLE : 0);
+
+    case REG_INTERRUPT_ERROR_STATUS:
+        return this->interruptStatus |
+            (((this->interruptStatus & IS_ERROR_EVENTS) != 0) ? IS_ERROR_INTERRUPT : 0);
+
+    case REG_INTERRUPT_ERROR_STATUS_ENABLE:
+        return this->statusEnable;
+
+    case REG_INTERRUPT_ERROR_SIGNAL_ENABLE:
+        return this->signalEnable;
+
+    case REG_CONTROL_2:
+        return this->control2 & ~0xFFFF;
+
+    case REG_MAXIMUM_CURRENT:
+        return MAXIMUM_CURRENT_33V;
+
+    case REG_SLOT_INFORMATION_VERSION:
+        return SLOT_INFORMATION_VERSION;
+
+    default:
+        return 0;
+    }
+}
+
+void Arasan::Write (ULONG Offset, ULONG Value)
+{
+    switch (Offset) {
+    case REG_SYSADDR:
+        this->sysAddr = Value;
+        break;
+
+    case REG_BLOCK_SIZE_COUNT:
+        this->blockSizeCount = Value;
+        break;
+
+    case REG_ARGUMENT:
+        this->argument = Value;
+        break;
+
+    case REG_TRANSFER_MODE_COMMAND:
+        this->transferModeCommand = Value;
+        this->startCommand(Now());
+        break;
+
+    case REG_DATA_PORT:
+    {
+        if (!this->dataActive || this->dataRead) {
+            break;
+        }
+        ULONG capacity = BUFFER_BLOCKS * this->blockWords;
+        if (this->buffer.size() >= capacity) {
+            break;
+        }
+        ++this->counters.DataPortWrites;
+        this->buffer.push_back(Value);
+        if ((++this->hostWords % this->blockWords) == 0) {
+            this->bufferEnable = false;
+        }
+        this->bufferReady();
+        if ((this->phase == PhaseWriteWait) && (this->buffer.size() >= this->blockWords)) {
+            this->dataDue = std::max(Now(), this->cardPtr->BusyUntil());
+        }
+        break;
+    }
+
+    case REG_CONTROL_0:
+        this->control0 = Value;
+        break;
+
+    case REG_CONTROL_1:
+        //
+        // Software reset bits clear themselves once the reset is done,
+        // which is immediately
+        //
+        this->reset(Value & RESET_MASK);
+        this->control1 = Value & ~RESET_MASK;
+        break;
+
+    case REG_INTERRUPT_ERROR_STATUS:
+        this->interruptStatus &= ~Value;
+        break;
+
+    case REG_INTERRUPT_ERROR_STATUS_ENABLE:
+        this->statusEnable = Value;
+        break;
+
+    case REG_INTERRUPT_ERROR_SIGNAL_ENABLE:
+        this->signalEnable = Value;
+        break;
+
+    case REG_CONTROL_2:
+        this->control2 = Value;
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool Arasan::Irq () const
+{
+    ULONG status = this->interruptStatus |
+        (((this->interruptStatus & IS_ERROR_EVENTS) != 0) ? IS_ERROR_INTERRUPT : 0);
+    return (status & this->signalEnable) != 0;
+}
+
+bool Arasan::Dreq () const
+{
+    if (!this->dataRead) {
+        if (!this->dataActive) {
+            return false;
+        }
+        ULONG capacity = BUFFER_BLOCKS * this->blockWords;
+        ULONG used = ULONG(this->buffer.size()) +
+            ((this->phase == PhaseWriteBlock) ? this->blockWords : 0);
+        return (used < capacity) &&
+               ((this->hostWordsTotal == 0) || (this->hostWords < this->hostWordsTotal));
+    }
+    return !this->buffer.empty();
+}
+
+void Arasan::startCommand (Time Now)
+{
+    if (this->cmdDue != NEVER) {
+        return;
+    }
+    ++this->counters.Commands;
+    ULONG responseType = (this->transferModeCommand >> CMD_RESPONSE_SHIFT) & CMD_RESPONSE_MASK;
+    Time clocks;
+    if (responseType == CMD_RESPONSE_NONE) {
+        clocks = COMMAND_CLOCKS + NCC_CLOCKS;
+    } else if (responseType == CMD_RESPONSE_136BIT) {
+        clocks = COMMAND_CLOCKS + NCR_CLOCKS + 136;
+    } else {
+        clocks = COMMAND_CLOCKS + NCR_CLOCKS + 48;
+    }
+    this->cmdDue = Now + clocks * this->clockNs();
+}
+
+void Arasan::finishCommand (Time Now)
+{
+    ULONG index = (this->transferModeCommand >> CMD_INDEX_SHIFT) & CMD_INDEX_MASK;
+    ULONG responseType = (this->transferModeCommand >> CMD_RESPONSE_SHIFT) & CMD_RESPONSE_MASK;
+    ULONG cardResponse[4];
+    Time busyEnd;
+    bool responded = this->cardPtr->Command(
+        Now,
+        UCHAR(index),
+        this->argument,
+        cardResponse,
+        &busyEnd);
+
+    if (responseType != CMD_RESPONSE_NONE) {
+        if (!responded) {
+            this->latch(ES_CMD_TIMEOUT);
+            return;
+        }
+        if (responseType == CMD_RESPONSE_136BIT) {
+            //
+            // The response registers hold bits 127:8 of an R2 response,
+            // the CRC7 and end bit are stripped
+            //
+            for (ULONG i = 0; i < 4; ++i) {
+                this->response[i] = (cardResponse[i] >> 8) |
+                    ((i < 3) ? (cardResponse[i + 1] << 24) : 0);
+            }
+        } else {
+            this->response[0] = cardResponse[0];
+        }
+    }
+    this->latch(IS_CMD_COMPLETE);
+
+    if ((this->transferModeCommand & CMD_DATA_PRESENT) == 0) {
+        if (responseType == CMD_RESPONSE_48BIT_WBUSY) {
+            this->busyDue = std::max(busyEnd, Now);
+        }
+        return;
+    }
+
+    ULONG transferMode = this->transferModeCommand & 0xFFFF;
+    ULONG blockSize = std::max<ULONG>(this->blockSizeCount & 0xFFF, sizeof(ULONG));
+    this->blockWords = (blockSize + sizeof(ULONG) - 1) / sizeof(ULONG);
+    this->block.assign(this->blockWords * sizeof(ULONG), 0);
+    this->multipleBlock = (transferMode & TM_MULTIBLOCK) != 0;
+    if (!this->multipleBlock) {
+        this->blocksTotal = 1;
+    } else if ((transferMode & TM_BLKCNT_ENABLE) != 0) {
+        this->blocksTotal = this->blockSizeCount >> 16;
+    } else {
+        this->blocksTotal = 0;
+    }
+    this->autoCmd12 = this->multipleBlock && ((transferMode & TM_AUTO_CMD12_ENABLE) != 0);
+    this->autoCmd12Done = false;
+    this->dataRead = (transferMode & TM_TRANSFER_READ) != 0;
+    this->dataActive = true;
+    this->blocksDone = 0;
+    this->incomingWords = 0;
+    this->hostWords = 0;
+    this->hostWordsTotal = this->blocksTotal * this->blockWords;
+    this->bufferEnable = false;
+    this->buffer.clear();
+
+    if (this->dataRead) {
+        this->startReadBlock(Now + this->cardPtr->ReadAccessTime());
+    } else {
+        this->phase = PhaseWriteWait;
+        this->dataDue = NEVER;
+        this->bufferReady();
+    }
+}
+
+void Arasan::startReadBlock (Time Start)
+{
+    this->moreBlocks = this->cardPtr->ReadBlock(this->block.data());
+    this->wordIndex = 0;
+    this->incomingWords = 0;
+    this->phase = PhaseReadBlock;
+    this->dataDue = Start + START_BIT_CLOCKS * this->clockNs() + this->wordNs();
+}
+
+void Arasan::readWord (Time Now)
+{
+    if (this->buffer.size() >= BUFFER_BLOCKS * this->blockWords) {
+        ++this->counters.ReadStalls;
+        this->phase = PhaseReadStall;
+        this->dataDue = NEVER;
+        return;
+    }
+
+    ULONG word;
+    ::memcpy(&word, &this->block[this->wordIndex * sizeof(ULONG)], sizeof(ULONG));
+    this->buffer.push_back(word);
+    ++this->incomingWords;
+    if (++this->wordIndex < this->blockWords) {
+        this->dataDue = Now + this->wordNs();
+        if (this->wordIndex + 1 == this->blockWords) {
+            this->dataDue += CRC_CLOCKS * this->clockNs();
+        }
+        return;
+    }
+
+    //
+    // The block is only handed to the host once its CRC checked out
+    //
+    this->incomingWords = 0;
+    ++this->blocksDone;
+    this->bufferReady();
+    if ((this->blocksDone == this->blocksTotal) || !this->moreBlocks) {
+        this->endBlocks(Now);
+    } else {
+        this->startReadBlock(Now + this->cardPtr->ReadBlockGap());
+    }
+}
+
+void Arasan::startWriteBlock (Time Now)
+{
+    for (ULONG i = 0; i < this->blockWords; ++i) {
+        ::memcpy(&this->block[i * sizeof(ULONG)], &this->buffer.front(), sizeof(ULONG));
+        this->buffer.pop_front();
+    }
+    this->phase = PhaseWriteBlock;
+    this->dataDue = Now + this->blockWords * this->wordNs() +
+        (START_BIT_CLOCKS + CRC_CLOCKS + CRC_STATUS_CLOCKS) * this->clockNs();
+}
+
+void Arasan::finishWriteBlock (Time Now)
+{
+    Time busyEnd = this->cardPtr->WriteBlock(Now, this->block.data());
+    ++this->blocksDone;
+    this->phase = PhaseWriteBusy;
+    this->dataDue = std::max(busyEnd, Now);
+    this->bufferReady();
+}
+
+void Arasan::endBlocks (Time Now)
+{
+    this->phase = PhaseStopped;
+    this->dataDue = NEVER;
+    if (this->autoCmd12) {
+        this->autoCmdDue = Now + (COMMAND_CLOCKS + NCR_CLOCKS + 48) * this->clockNs();
+    } else {
+        this->autoCmd12Done = true;
+    }
+}
+
+bool Arasan::transferDone () const
+{
+    return this->dataActive &&
+           (this->phase == PhaseStopped) &&
+           this->autoCmd12Done &&
+           (this->dataDue == NEVER) &&
+           (!this->dataRead || this->buffer.empty());
+}
+
+Time Arasan::NextEvent () const
+{
+    Time next = std::min(this->cmdDue, this->busyDue);
+    next = std::min(next, this->autoCmdDue);
+    return std::min(next, this->dataDue);
+}
+
+bool Arasan::Run (Time Now)
+{
+    bool progress = false;
+    for (;;) {
+        Time next = this->NextEvent();
+        if (next > Now) {
+            break;
+        }
+        progress = true;
+        if (next == this->cmdDue) {
+            this->cmdDue = NEVER;
+            this->finishCommand(next);
+        } else if (next == this->busyDue) {
+            this->busyDue = NEVER;
+            this->latch(IS_TRANSFER_COMPLETE);
+        } else if (next == this->autoCmdDue) {
+            //
+            // Auto CMD12 response goes to RESPONSE_3, the transfer completes
+            // once the card released DAT0
+            //
+            ULONG cardResponse[4];
+            Time busyEnd;
+            this->autoCmdDue = NEVER;
+            ++this->counters.AutoCmd12;
+            if (this->cardPtr->Command(next, 12, 0, cardResponse, &busyEnd)) {
+                this->response[3] = cardResponse[0];
+            }
+            this->dataDue = std::max(busyEnd, next);
+        } else {
+            switch (this->phase) {
+            case PhaseReadBlock:
+                this->readWord(next);
+                break;
+
+            case PhaseWriteWait:
+                this->dataDue = NEVER;
+                if ((this->buffer.size() >= this->blockWords) &&
+                    (this->cardPtr->BusyUntil() <= next)) {
+                    this->startWriteBlock(next);
+                    this->bufferReady();
+                }
+                break;
+
+            case PhaseWriteBlock:
+                this->finishWriteBlock(next);
+                break;
+
+            case PhaseWriteBusy:
+                if ((this->blocksTotal != 0) && (this->blocksDone == this->blocksTotal)) {
+                    this->endBlocks(next);
+                } else {
+                    this->phase = PhaseWriteWait;
+                    this->dataDue = (this->buffer.size() >= this->blockWords) ? next : NEVER;
+                }
+                break;
+
+            case PhaseStopped:
+                this->dataDue = NEVER;
+                this->autoCmd12Done = true;
+                break;
+
+            default:
+                this->dataDue = NEVER;
+                break;
+            }
+        }
+
+        if (this->transferDone()) {
+            this->dataActive = false;
+            this->phase = PhaseNone;
+            this->bufferEnable = false;
+            this->latch(IS_TRANSFER_COMPLETE);
+        }
+    }
+    return progress;
+}
+
+} // namespace sim
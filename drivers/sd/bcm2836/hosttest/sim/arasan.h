@@ -0,0 +1,134 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  arasan.h
+//
+// Abstract:
+//
+//  Arasan SDHCI controller model, the controller driven by bcm2836sdhc.
+//  It models the standard host controller registers the miniport uses,
+//  a two block data buffer behind the data port with edge triggered
+//  buffer ready events, block count and Auto CMD12 handling, and the EMMC
+//  DREQ the SoC DMA channel paces SgDma transfers on
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef _ARASAN_H_
+#define _ARASAN_H_
+
+#include "sdcard.h"
+
+#include <deque>
+
+namespace sim {
+
+class Arasan : public Device {
+public:
+    enum : uint64_t {
+        PHYSICAL_BASE = 0x3F300000,
+        REGISTERS_SIZE = 0x100,
+    };
+
+    enum : ULONG {
+        DREQ = 11,
+        BASE_CLOCK_KHZ = 250 * 1000,
+        BUFFER_BLOCKS = 2,
+    };
+
+    explicit Arasan (SdCard* CardPtr);
+
+    const char* Name () const override { return "arasan"; }
+    ULONG Read (ULONG Offset) override;
+    void Write (ULONG Offset, ULONG Value) override;
+    bool Run (Time Now) override;
+    Time NextEvent () const override;
+    bool Irq () const override;
+    bool Dreq () const override;
+
+    struct Counters {
+        uint64_t Commands;
+        uint64_t AutoCmd12;
+        uint64_t DataPortReads;
+        uint64_t DataPortWrites;
+        uint64_t ReadStalls;
+        uint64_t BufferReadyEvents;
+    };
+
+    const Counters& GetCounters () const { return this->counters; }
+
+private:
+    Time clockNs () const;
+    Time wordNs () const;
+    void reset (ULONG Mask);
+    void latch (ULONG Status);
+    void startCommand (Time Now);
+    void finishCommand (Time Now);
+    void startReadBlock (Time Start);
+    void readWord (Time Now);
+    void startWriteBlock (Time Now);
+    void finishWriteBlock (Time Now);
+    void endBlocks (Time Now);
+    void bufferReady ();
+    ULONG presentState () const;
+    bool transferDone () const;
+
+    SdCard* cardPtr;
+    Counters counters;
+
+    ULONG sysAddr;
+    ULONG blockSizeCount;
+    ULONG argument;
+    ULONG transferModeCommand;
+    ULONG response[4];
+    ULONG control0;
+    ULONG control1;
+    ULONG interruptStatus;
+    ULONG statusEnable;
+    ULONG signalEnable;
+    ULONG control2;
+
+    Time cmdDue;
+    Time busyDue;
+    Time autoCmdDue;
+
+    //
+    // Data phase
+    //
+    enum PHASE {
+        PhaseNone,
+        PhaseReadBlock,     // next word due at dataDue
+        PhaseReadStall,     // buffer full, clock stopped
+        PhaseWriteWait,     // waiting for a full block in the buffer
+        PhaseWriteBlock,    // block and CRC status on the bus until dataDue
+        PhaseWriteBusy,     // card programming until dataDue
+        PhaseStopped,       // all blocks done, Auto CMD12 or drain pending
+    };
+
+    PHASE phase;
+    Time dataDue;
+    bool dataRead;
+    bool dataActive;
+    bool autoCmd12;
+    bool autoCmd12Done;
+    bool multipleBlock;
+    ULONG blockWords;
+    ULONG blocksTotal;
+    ULONG blocksDone;
+    ULONG wordIndex;
+    ULONG incomingWords;
+    ULONG hostWords;
+    ULONG hostWordsTotal;
+    bool moreBlocks;
+    bool bufferEnable;
+    std::deque<ULONG> buffer;
+    std::vector<UCHAR> block;
+};
+
+} // namespace sim
+
+#endif // _ARASAN_H_
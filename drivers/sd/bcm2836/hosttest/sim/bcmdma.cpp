@@ -0,0 +1,321 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  bcmdma.cpp
+//
+// Abstract:
+//
+//  BCM2835 DMA channel model
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#include "bcmdma.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace sim {
+namespace {
+
+enum : ULONG {
+    REG_CS = 0x00,
+    REG_CONBLK_AD = 0x04,
+    REG_TI = 0x08,
+    REG_SOURCE_AD = 0x0C,
+    REG_DEST_AD = 0x10,
+    REG_TXFR_LEN = 0x14,
+    REG_STRIDE = 0x18,
+    REG_NEXTCONBK = 0x1C,
+    REG_DEBUG = 0x20,
+
+    CS_ACTIVE = 0x1,
+    CS_END = 0x2,
+    CS_INT = 0x4,
+    CS_DREQ = 0x8,
+    CS_ERROR = 0x100,
+    CS_ABORT = 0x40000000,
+    CS_RESET = 0x80000000,
+    CS_WRITABLE_MASK = 0x30FF0000,
+
+    TI_INTEN = 0x1,
+    TI_DEST_INC = 0x10,
+    TI_DEST_DREQ = 0x40,
+    TI_DEST_IGNORE = 0x80,
+    TI_SRC_INC = 0x100,
+    TI_SRC_DREQ = 0x400,
+    TI_SRC_IGNORE = 0x800,
+    TI_PERMAP_SHIFT = 16,
+    TI_PERMAP_MASK = 0x1F,
+
+    DEBUG_READ_ERROR = 0x4,
+    DEBUG_ERROR_MASK = 0x7,
+    DEBUG_VERSION = 2 << 25,
+
+    PERIPHERALS_BUS_BASE = 0x7E000000,
+    PERIPHERALS_PHYSICAL_BASE = 0x3F000000,
+    PERIPHERALS_MASK = 0x00FFFFFF,
+    BUS_ALIAS_MASK = 0x3FFFFFFF,
+};
+
+} // namespace
+
+BcmDma::BcmDma (ULONG Channel) :
+    channel(Channel),
+    counters(),
+    cs(0),
+    conblkAd(0),
+    ti(0),
+    sourceAd(0),
+    destAd(0),
+    txfrLen(0),
+    stride(0),
+    nextConbk(0),
+    debug(0),
+    due(NEVER),
+    waitingDreq(false)
+{
+    ::snprintf(this->name, sizeof(this->name), "dma%lu", (unsigned long)Channel);
+}
+
+ULONG BcmDma::Read (ULONG Offset)
+{
+    switch (Offset) {
+    case REG_CS:
+        return this->cs | (this->dreqReady() ? CS_DREQ : 0);
+
+    case REG_CONBLK_AD:
+        return this->conblkAd;
+
+    case REG_TI:
+        return this->ti;
+
+    case REG_SOURCE_AD:
+        return this->sourceAd;
+
+    case REG_DEST_AD:
+        return this->destAd;
+
+    case REG_TXFR_LEN:
+        return this->txfrLen;
+
+    case REG_STRIDE:
+        return this->stride;
+
+    case REG_NEXTCONBK:
+        return this->nextConbk;
+
+    case REG_DEBUG:
+        return this->debug | DEBUG_VERSION | (this->channel << 8);
+
+    default:
+        return 0;
+    }
+}
+
+void BcmDma::Write (ULONG Offset, ULONG Value)
+{
+    switch (Offset) {
+    case REG_CS:
+        if ((Value & CS_RESET) != 0) {
+            this->cs = 0;
+            this->conblkAd = 0;
+            this->ti = 0;
+            this->sourceAd = 0;
+            this->destAd = 0;
+            this->txfrLen = 0;
+            this->nextConbk = 0;
+            this->debug = 0;
+            this->due = NEVER;
+            this->waitingDreq = false;
+            break;
+        }
+        if ((Value & CS_ABORT) != 0) {
+            this->cs &= ~CS_ACTIVE;
+            this->txfrLen = 0;
+            this->due = NEVER;
+            this->waitingDreq = false;
+        }
+        this->cs &= ~(Value & (CS_END | CS_INT));
+        this->cs = (this->cs & ~CS_WRITABLE_MASK) | (Value & CS_WRITABLE_MASK);
+        if ((Value & CS_ACTIVE) == 0) {
+            //
+            // Clearing ACTIVE pauses the channel
+            //
+            if ((this->cs & CS_ACTIVE) != 0) {
+                this->cs &= ~CS_ACTIVE;
+                this->due = NEVER;
+                this->waitingDreq = false;
+            }
+        } else if ((this->cs & CS_ACTIVE) == 0) {
+            if (this->txfrLen != 0) {
+                this->cs |= CS_ACTIVE;
+                this->due = Now();
+            } else if (this->conblkAd != 0) {
+                this->loadControlBlock(this->conblkAd, Now());
+            }
+        }
+        break;
+
+    case REG_CONBLK_AD:
+        this->conblkAd = Value;
+        break;
+
+    case REG_DEBUG:
+        this->debug &= ~(Value & DEBUG_ERROR_MASK);
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool BcmDma::Irq () const
+{
+    return (this->cs & CS_INT) != 0;
+}
+
+bool BcmDma::dreqReady () const
+{
+    if ((this->ti & (TI_SRC_DREQ | TI_DEST_DREQ)) == 0) {
+        return true;
+    }
+    return DreqAsserted((this->ti >> TI_PERMAP_SHIFT) & TI_PERMAP_MASK);
+}
+
+void BcmDma::loadControlBlock (ULONG BusAddress, Time Now)
+{
+    const ULONG* cbPtr = static_cast<const ULONG*>(
+        HostAddressOf(BusAddress & BUS_ALIAS_MASK, 8 * sizeof(ULONG)));
+    if (cbPtr == nullptr) {
+        this->cs = (this->cs & ~CS_ACTIVE) | CS_ERROR;
+        this->debug |= DEBUG_READ_ERROR;
+        this->due = NEVER;
+        return;
+    }
+    ++this->counters.ControlBlocks;
+    this->conblkAd = BusAddress;
+    this->ti = cbPtr[0];
+    this->sourceAd = cbPtr[1];
+    this->destAd = cbPtr[2];
+    this->txfrLen = cbPtr[3];
+    this->stride = cbPtr[4];
+    this->nextConbk = cbPtr[5];
+    this->cs |= CS_ACTIVE;
+    this->waitingDreq = false;
+    this->due = Now + CONTROL_BLOCK_NS;
+}
+
+void BcmDma::finishControlBlock (Time Now)
+{
+    this->cs |= CS_END;
+    if ((this->ti & TI_INTEN) != 0) {
+        this->cs |= CS_INT;
+    }
+    if (this->nextConbk != 0) {
+        this->loadControlBlock(this->nextConbk, Now);
+        return;
+    }
+    this->cs &= ~CS_ACTIVE;
+    this->conblkAd = 0;
+    this->due = NEVER;
+}
+
+ULONG BcmDma::busRead (ULONG BusAddress)
+{
+    if ((BusAddress & ~PERIPHERALS_MASK) == PERIPHERALS_BUS_BASE) {
+        ULONG offset = 0;
+        Device* devicePtr = DeviceAt(
+            PERIPHERALS_PHYSICAL_BASE | (BusAddress & PERIPHERALS_MASK),
+            &offset);
+        return (devicePtr != nullptr) ? devicePtr->Read(offset) : 0;
+    }
+    const void* sourcePtr = HostAddressOf(BusAddress & BUS_ALIAS_MASK, sizeof(ULONG));
+    if (sourcePtr == nullptr) {
+        this->debug |= DEBUG_READ_ERROR;
+        return 0;
+    }
+    ULONG value;
+    ::memcpy(&value, sourcePtr, sizeof(ULONG));
+    return value;
+}
+
+void BcmDma::busWrite (ULONG BusAddress, ULONG Value)
+{
+    if ((BusAddress & ~PERIPHERALS_MASK) == PERIPHERALS_BUS_BASE) {
+        ULONG offset = 0;
+        Device* devicePtr = DeviceAt(
+            PERIPHERALS_PHYSICAL_BASE | (BusAddress & PERIPHERALS_MASK),
+            &offset);
+        if (devicePtr != nullptr) {
+            devicePtr->Write(offset, Value);
+        }
+        return;
+    }
+    void* destinationPtr = HostAddressOf(BusAddress & BUS_ALIAS_MASK, sizeof(ULONG));
+    if (destinationPtr == nullptr) {
+        this->cs |= CS_ERROR;
+        return;
+    }
+    ::memcpy(destinationPtr, &Value, sizeof(ULONG));
+}
+
+Time BcmDma::NextEvent () const
+{
+    if (((this->cs & CS_ACTIVE) == 0) || this->waitingDreq) {
+        return NEVER;
+    }
+    return this->due;
+}
+
+bool BcmDma::Run (Time Now)
+{
+    bool progress = false;
+    while ((this->cs & CS_ACTIVE) != 0) {
+        if (this->waitingDreq) {
+            if (!this->dreqReady()) {
+                break;
+            }
+            this->waitingDreq = false;
+            this->due = std::max(this->due, Now);
+        }
+        if (this->due > Now) {
+            break;
+        }
+        progress = true;
+        if (this->txfrLen == 0) {
+            this->finishControlBlock(this->due);
+            continue;
+        }
+        if (!this->dreqReady()) {
+            ++this->counters.DreqWaits;
+            this->waitingDreq = true;
+            break;
+        }
+
+        ULONG value = 0;
+        if ((this->ti & TI_SRC_IGNORE) == 0) {
+            value = this->busRead(this->sourceAd);
+        }
+        if ((this->ti & TI_DEST_IGNORE) == 0) {
+            this->busWrite(this->destAd, value);
+        }
+        if ((this->ti & TI_SRC_INC) != 0) {
+            this->sourceAd += sizeof(ULONG);
+        }
+        if ((this->ti & TI_DEST_INC) != 0) {
+            this->destAd += sizeof(ULONG);
+        }
+        this->txfrLen -= std::min<ULONG>(this->txfrLen, sizeof(ULONG));
+        ++this->counters.Words;
+        this->due += WORD_NS;
+    }
+    return progress;
+}
+
+} // namespace sim
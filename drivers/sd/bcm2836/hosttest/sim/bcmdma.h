@@ -0,0 +1,86 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  bcmdma.h
+//
+// Abstract:
+//
+//  BCM2835 DMA channel model. It walks control block chains in simulated
+//  physical memory and moves one 32 bit word at a time between memory and
+//  peripheral registers, pacing source or destination on the DREQ line
+//  selected by the control block's PERMAP
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef _BCMDMA_H_
+#define _BCMDMA_H_
+
+#include "sim.h"
+
+namespace sim {
+
+class BcmDma : public Device {
+public:
+    enum : uint64_t {
+        PHYSICAL_BASE = 0x3F007000,
+        CHANNEL_SIZE = 0x100,
+    };
+
+    explicit BcmDma (ULONG Channel);
+
+    const char* Name () const override { return this->name; }
+    ULONG Read (ULONG Offset) override;
+    void Write (ULONG Offset, ULONG Value) override;
+    bool Run (Time Now) override;
+    Time NextEvent () const override;
+    bool Irq () const override;
+
+    uint64_t PhysicalBase () const { return PHYSICAL_BASE + this->channel * CHANNEL_SIZE; }
+
+    struct Counters {
+        uint64_t ControlBlocks;
+        uint64_t Words;
+        uint64_t DreqWaits;
+    };
+
+    const Counters& GetCounters () const { return this->counters; }
+
+    //
+    // Time to move one word and to fetch a control block
+    //
+    static const Time WORD_NS = 40;
+    static const Time CONTROL_BLOCK_NS = 200;
+
+private:
+    void loadControlBlock (ULONG BusAddress, Time Now);
+    void finishControlBlock (Time Now);
+    bool dreqReady () const;
+    ULONG busRead (ULONG BusAddress);
+    void busWrite (ULONG BusAddress, ULONG Value);
+
+    ULONG channel;
+    char name[16];
+    Counters counters;
+
+    ULONG cs;
+    ULONG conblkAd;
+    ULONG ti;
+    ULONG sourceAd;
+    ULONG destAd;
+    ULONG txfrLen;
+    ULONG stride;
+    ULONG nextConbk;
+    ULONG debug;
+
+    Time due;
+    bool waitingDreq;
+};
+
+} // namespace sim
+
+#endif // _BCMDMA_H_
@@ -0,0 +1,437 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdcard.cpp
+//
+// Abstract:
+//
+//  SDHC memory card model
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#include "sdcard.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace sim {
+namespace {
+
+enum : ULONG {
+    R1_APP_CMD = 0x20,
+    R1_READY_FOR_DATA = 0x100,
+    R1_CURRENT_STATE_SHIFT = 9,
+    R1_ILLEGAL_COMMAND = 0x400000,
+
+    OCR_VOLTAGE_WINDOW = 0x00FF8000,
+    OCR_CCS = 0x40000000,
+    OCR_BUSY = 0x80000000,
+
+    SCR_LENGTH = 8,
+    SWITCH_STATUS_LENGTH = 64,
+
+    //
+    // ACMD41 polls until the card reports power up done
+    //
+    ACMD41_READY_COUNT = 2,
+};
+
+const Time SELECT_BUSY = 2 * NS_PER_US;
+
+const SdCardTiming DEFAULT_TIMING = {
+    50 * NS_PER_US,     // ReadAccessMin
+    300 * NS_PER_US,    // ReadAccessMax
+    1 * NS_PER_US,      // ReadBlockGapMin
+    3 * NS_PER_US,      // ReadBlockGapMax
+    10 * NS_PER_US,     // MultiBlockProgramMin
+    30 * NS_PER_US,     // MultiBlockProgramMax
+    250 * NS_PER_US,    // SingleBlockProgramMin
+    800 * NS_PER_US,    // SingleBlockProgramMax
+    200 * NS_PER_US,    // StopBusyMin
+    1 * NS_PER_MS,      // StopBusyMax
+    64,                 // SlowProgramPeriod
+    2 * NS_PER_MS,      // SlowProgramMin
+    5 * NS_PER_MS,      // SlowProgramMax
+};
+
+//
+// SCR of an SD 3.0 card supporting 1 and 4 bit buses and CMD23, sent most
+// significant byte first
+//
+const UCHAR SCR[SCR_LENGTH] = { 0x02, 0x35, 0x80, 0x02, 0x00, 0x00, 0x00, 0x00 };
+
+void setBits (ULONG Response[4], ULONG High, ULONG Low, ULONG Value)
+{
+    for (ULONG bit = Low; bit <= High; ++bit) {
+        ULONG mask = 1UL << (bit % 32);
+        if ((Value >> (bit - Low)) & 1) {
+            Response[bit / 32] |= mask;
+        } else {
+            Response[bit / 32] &= ~mask;
+        }
+    }
+}
+
+} // namespace
+
+SdCard::SdCard (ULONG BlockCount, uint64_t Seed) :
+    timing(DEFAULT_TIMING),
+    rng(Seed),
+    blockCount(BlockCount),
+    state(Idle),
+    appCmd(false),
+    highCapacity(true),
+    acmd41Count(0),
+    busWidth(1),
+    busyUntil(0),
+    dataPhase(NoData),
+    dataBlockLength(0),
+    dataLba(0),
+    dataCommand(0),
+    predefinedCount(0),
+    blocksLeft(0),
+    writeCount(0),
+    blocksRead(0),
+    blocksWritten(0)
+{
+}
+
+const SdCardTiming& SdCard::DefaultTiming ()
+{
+    return DEFAULT_TIMING;
+}
+
+Time SdCard::uniform (Time Min, Time Max)
+{
+    //
+    // splitmix64
+    //
+    uint64_t z = (this->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    if (Max <= Min) {
+        return Min;
+    }
+    return Min + Time(z % uint64_t(Max - Min + 1));
+}
+
+ULONG SdCard::status (bool AppCmd) const
+{
+    ULONG value = ULONG(this->state) << R1_CURRENT_STATE_SHIFT;
+    if (this->state != Prg) {
+        value |= R1_READY_FOR_DATA;
+    }
+    if (AppCmd) {
+        value |= R1_APP_CMD;
+    }
+    return value;
+}
+
+void SdCard::buildCsd (ULONG Response[4]) const
+{
+    ::memset(Response, 0, 4 * sizeof(ULONG));
+    setBits(Response, 127, 126, 1);         // CSD_STRUCTURE, version 2.0
+    setBits(Response, 119, 112, 0x0E);      // TAAC
+    setBits(Response, 103, 96, 0x32);       // TRAN_SPEED, 25MHz
+    setBits(Response, 95, 84, 0x5B5);       // CCC
+    setBits(Response, 83, 80, 9);           // READ_BL_LEN
+    setBits(Response, 69, 48, this->blockCount / 1024 - 1); // C_SIZE
+    setBits(Response, 46, 46, 1);           // ERASE_BLK_EN
+    setBits(Response, 45, 39, 0x7F);        // SECTOR_SIZE
+    setBits(Response, 28, 26, 2);           // R2W_FACTOR
+    setBits(Response, 25, 22, 9);           // WRITE_BL_LEN
+    setBits(Response, 7, 1, 0x2A);          // CRC7
+    setBits(Response, 0, 0, 1);
+}
+
+void SdCard::buildCid (ULONG Response[4]) const
+{
+    ::memset(Response, 0, 4 * sizeof(ULONG));
+    setBits(Response, 127, 120, 0x03);      // MID
+    setBits(Response, 119, 104, 0x5344);    // OID, "SD"
+    setBits(Response, 103, 72, 0x53494D30); // PNM, "SIM0"
+    setBits(Response, 71, 64, 0x31);        // PNM, "1"
+    setBits(Response, 63, 56, 0x10);        // PRV
+    setBits(Response, 55, 24, 0x12345678);  // PSN
+    setBits(Response, 19, 8, 0x14A);        // MDT
+    setBits(Response, 7, 1, 0x15);          // CRC7
+    setBits(Response, 0, 0, 1);
+}
+
+bool SdCard::Command (
+    Time Now,
+    UCHAR Index,
+    ULONG Argument,
+    ULONG Response[4],
+    Time* BusyUntilPtr
+    )
+{
+    if ((this->state == Prg) && (Now >= this->busyUntil)) {
+        this->state = Tran;
+    }
+    bool appCmd = this->appCmd;
+    this->appCmd = false;
+    *BusyUntilPtr = Now;
+    ::memset(Response, 0, 4 * sizeof(ULONG));
+
+    //
+    // Most responses carry the status from before the command executes
+    //
+    Response[0] = this->status(appCmd);
+
+    if (appCmd) {
+        switch (Index) {
+        case 6:
+            this->busWidth = ((Argument & 3) == 2) ? 4 : 1;
+            return true;
+
+        case 41:
+            if (++this->acmd41Count >= ACMD41_READY_COUNT) {
+                this->state = Ready;
+                Response[0] = OCR_BUSY | OCR_VOLTAGE_WINDOW |
+                    (this->highCapacity ? OCR_CCS : 0);
+            } else {
+                Response[0] = OCR_VOLTAGE_WINDOW;
+            }
+            return true;
+
+        case 51:
+            this->state = Data;
+            this->dataPhase = ReadData;
+            this->dataBlockLength = SCR_LENGTH;
+            this->dataCommand = 51;
+            this->blocksLeft = 1;
+            return true;
+
+        default:
+            break;
+        }
+    }
+
+    switch (Index) {
+    case 0:
+        this->state = Idle;
+        this->acmd41Count = 0;
+        this->busWidth = 1;
+        this->dataPhase = NoData;
+        this->predefinedCount = 0;
+        return true;
+
+    case 2:
+        if (this->state != Ready) {
+            return false;
+        }
+        this->buildCid(Response);
+        this->state = Ident;
+        return true;
+
+    case 3:
+        if ((this->state != Ident) && (this->state != Stby)) {
+            return false;
+        }
+        this->state = Stby;
+        Response[0] = (ULONG(RCA) << 16) | (ULONG(Stby) << R1_CURRENT_STATE_SHIFT) |
+            R1_READY_FOR_DATA;
+        return true;
+
+    case 6:
+        //
+        // SWITCH_FUNC, the status block reports every function as
+        // supported and already selected
+        //
+        this->state = Data;
+        this->dataPhase = ReadData;
+        this->dataBlockLength = SWITCH_STATUS_LENGTH;
+        this->dataCommand = 6;
+        this->blocksLeft = 1;
+        return true;
+
+    case 7:
+        if ((Argument >> 16) != RCA) {
+            this->state = Stby;
+            return false;
+        }
+        this->state = Tran;
+        *BusyUntilPtr = this->busyUntil = Now + SELECT_BUSY;
+        return true;
+
+    case 8:
+        if (this->state != Idle) {
+            return false;
+        }
+        Response[0] = Argument & 0xFFF;
+        return true;
+
+    case 9:
+        if (this->state != Stby) {
+            return false;
+        }
+        this->buildCsd(Response);
+        return true;
+
+    case 10:
+        if (this->state != Stby) {
+            return false;
+        }
+        this->buildCid(Response);
+        return true;
+
+    case 12:
+        if (this->state == Data) {
+            this->state = Tran;
+        } else if (this->state == Rcv) {
+            this->state = Prg;
+            this->busyUntil = std::max(this->busyUntil, Now) +
+                this->uniform(this->timing.StopBusyMin, this->timing.StopBusyMax);
+        } else {
+            Response[0] |= R1_ILLEGAL_COMMAND;
+        }
+        this->dataPhase = NoData;
+        *BusyUntilPtr = std::max(this->busyUntil, Now);
+        return true;
+
+    case 13:
+        return true;
+
+    case 16:
+        return true;
+
+    case 17:
+    case 18:
+        if (this->state != Tran) {
+            Response[0] |= R1_ILLEGAL_COMMAND;
+            return true;
+        }
+        this->state = Data;
+        this->dataPhase = ReadData;
+        this->dataBlockLength = BLOCK_SIZE;
+        this->dataCommand = Index;
+        this->dataLba = Argument;
+        this->blocksLeft = (Index == 17) ? 1 : this->predefinedCount;
+        this->predefinedCount = 0;
+        return true;
+
+    case 23:
+        this->predefinedCount = Argument;
+        return true;
+
+    case 24:
+    case 25:
+        if ((this->state != Tran) || (Now < this->busyUntil)) {
+            Response[0] |= R1_ILLEGAL_COMMAND;
+            return true;
+        }
+        this->state = Rcv;
+        this->dataPhase = WriteData;
+        this->dataBlockLength = BLOCK_SIZE;
+        this->dataCommand = Index;
+        this->dataLba = Argument;
+        this->blocksLeft = (Index == 24) ? 1 : this->predefinedCount;
+        this->predefinedCount = 0;
+        return true;
+
+    case 55:
+        this->appCmd = true;
+        Response[0] |= R1_APP_CMD;
+        return true;
+
+    default:
+        Response[0] |= R1_ILLEGAL_COMMAND;
+        return true;
+    }
+}
+
+Time SdCard::ReadAccessTime ()
+{
+    return this->uniform(this->timing.ReadAccessMin, this->timing.ReadAccessMax);
+}
+
+Time SdCard::ReadBlockGap ()
+{
+    return this->uniform(this->timing.ReadBlockGapMin, this->timing.ReadBlockGapMax);
+}
+
+bool SdCard::ReadBlock (UCHAR* BufferPtr)
+{
+    switch (this->dataCommand) {
+    case 51:
+        ::memcpy(BufferPtr, SCR, SCR_LENGTH);
+        break;
+
+    case 6:
+        ::memset(BufferPtr, 0, SWITCH_STATUS_LENGTH);
+        BufferPtr[13] = 0x03;   // Group 1 support, default and high speed
+        BufferPtr[16] = 0x01;   // Group 1 function high speed selected
+        break;
+
+    default:
+        this->Peek(this->dataLba, BufferPtr);
+        ++this->dataLba;
+        ++this->blocksRead;
+        break;
+    }
+
+    if ((this->blocksLeft != 0) && (--this->blocksLeft == 0)) {
+        this->state = Tran;
+        this->dataPhase = NoData;
+        return false;
+    }
+    return this->dataLba < this->blockCount;
+}
+
+Time SdCard::WriteBlock (Time Now, const UCHAR* BufferPtr)
+{
+    if (this->dataLba < this->blockCount) {
+        this->blocks[this->dataLba].assign(BufferPtr, BufferPtr + BLOCK_SIZE);
+    }
+    ++this->dataLba;
+    ++this->blocksWritten;
+
+    Time program;
+    if ((this->timing.SlowProgramPeriod != 0) &&
+        ((++this->writeCount % this->timing.SlowProgramPeriod) == 0)) {
+
+        program = this->uniform(this->timing.SlowProgramMin, this->timing.SlowProgramMax);
+    } else if (this->dataCommand == 24) {
+        program = this->uniform(
+            this->timing.SingleBlockProgramMin,
+            this->timing.SingleBlockProgramMax);
+    } else {
+        program = this->uniform(
+            this->timing.MultiBlockProgramMin,
+            this->timing.MultiBlockProgramMax);
+    }
+    this->busyUntil = Now + program;
+
+    if ((this->blocksLeft != 0) && (--this->blocksLeft == 0)) {
+        this->state = Prg;
+        this->dataPhase = NoData;
+    }
+    return this->busyUntil;
+}
+
+void SdCard::FillPattern (ULONG Lba, UCHAR* BufferPtr)
+{
+    for (ULONG i = 0; i < BLOCK_SIZE / sizeof(ULONG); ++i) {
+        ULONG word = (Lba * 0x9E3779B1UL) ^ (i * 0x85EBCA6BUL) ^ 0x5D0C0000UL;
+        ::memcpy(BufferPtr + i * sizeof(ULONG), &word, sizeof(ULONG));
+    }
+}
+
+void SdCard::Peek (ULONG Lba, UCHAR* BufferPtr) const
+{
+    auto it = this->blocks.find(Lba);
+    if (it == this->blocks.end()) {
+        FillPattern(Lba, BufferPtr);
+    } else {
+        ::memcpy(BufferPtr, it->second.data(), BLOCK_SIZE);
+    }
+}
+
+} // namespace sim
@@ -0,0 +1,182 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdcard.h
+//
+// Abstract:
+//
+//  SDHC memory card model shared by the SDHost and Arasan controller
+//  models. It implements the SD state machine for the commands the
+//  miniports and the Sdport stand-in issue, a sparse block store and the
+//  card side latencies: read access time, inter-block gap and the busy
+//  time of block programming and STOP_TRANSMISSION
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef _SDCARD_H_
+#define _SDCARD_H_
+
+#include "sim.h"
+
+#include <map>
+#include <vector>
+
+namespace sim {
+
+//
+// Card latencies, all ranges are uniformly distributed and drawn from a
+// seeded generator so that a run is reproducible
+//
+struct SdCardTiming {
+    Time ReadAccessMin;
+    Time ReadAccessMax;
+    Time ReadBlockGapMin;
+    Time ReadBlockGapMax;
+    Time MultiBlockProgramMin;
+    Time MultiBlockProgramMax;
+    Time SingleBlockProgramMin;
+    Time SingleBlockProgramMax;
+    Time StopBusyMin;
+    Time StopBusyMax;
+
+    //
+    // One in SlowProgramPeriod block writes takes SlowProgram* instead,
+    // like a card doing garbage collection. 0 disables them
+    //
+    ULONG SlowProgramPeriod;
+    Time SlowProgramMin;
+    Time SlowProgramMax;
+};
+
+class SdCard {
+public:
+    enum : ULONG {
+        BLOCK_SIZE = 512,
+        RCA = 0x1234,
+    };
+
+    enum STATE : ULONG {
+        Idle = 0,
+        Ready = 1,
+        Ident = 2,
+        Stby = 3,
+        Tran = 4,
+        Data = 5,
+        Rcv = 6,
+        Prg = 7,
+    };
+
+    //
+    // Data phase a command started, as seen on the data lines
+    //
+    enum DATA_PHASE {
+        NoData,
+        ReadData,
+        WriteData,
+    };
+
+    SdCard (ULONG BlockCount, uint64_t Seed);
+
+    static const SdCardTiming& DefaultTiming ();
+    void SetTiming (const SdCardTiming& Timing) { this->timing = Timing; }
+
+    //
+    // Execute a command whose end bit was received at Now. Returns false if
+    // the card does not respond, otherwise fills the response: the 32 bit
+    // payload of a 48 bit response in Response[0], or the full 128 bits of
+    // an R2 response with Response[0] holding bits 31:0 (CRC7 and end bit
+    // included). BusyUntilPtr receives the end of the busy signalled on
+    // DAT0 following the response, Now if there is none
+    //
+    bool Command (
+        Time Now,
+        UCHAR Index,
+        ULONG Argument,
+        ULONG Response[4],
+        Time* BusyUntilPtr
+        );
+
+    //
+    // Data phase started by the last command and its block length
+    //
+    DATA_PHASE DataPhase () const { return this->dataPhase; }
+    ULONG DataBlockLength () const { return this->dataBlockLength; }
+
+    //
+    // Delay between the end of a read command response and the start bit of
+    // its first block, and between two blocks of a multiple block read
+    //
+    Time ReadAccessTime ();
+    Time ReadBlockGap ();
+
+    //
+    // Fetch the next block of the current read data phase into BufferPtr.
+    // Returns true if the card sends another block after it
+    //
+    bool ReadBlock (UCHAR* BufferPtr);
+
+    //
+    // Program a block received at Now, returns the end of the busy signal
+    //
+    Time WriteBlock (Time Now, const UCHAR* BufferPtr);
+
+    Time BusyUntil () const { return this->busyUntil; }
+    STATE State () const { return this->state; }
+    ULONG BlockCount () const { return this->blockCount; }
+
+    //
+    // Content of a block that was never written
+    //
+    static void FillPattern (ULONG Lba, UCHAR* BufferPtr);
+
+    //
+    // Host side access to the medium, for data verification
+    //
+    void Peek (ULONG Lba, UCHAR* BufferPtr) const;
+
+    uint64_t BlocksRead () const { return this->blocksRead; }
+    uint64_t BlocksWritten () const { return this->blocksWritten; }
+
+private:
+    Time uniform (Time Min, Time Max);
+    ULONG status (bool AppCmd) const;
+    void buildCsd (ULONG Response[4]) const;
+    void buildCid (ULONG Response[4]) const;
+
+    SdCardTiming timing;
+    uint64_t rng;
+    ULONG blockCount;
+    std::map<ULONG, std::vector<UCHAR>> blocks;
+
+    STATE state;
+    bool appCmd;
+    bool highCapacity;
+    ULONG acmd41Count;
+    ULONG busWidth;
+    Time busyUntil;
+
+    DATA_PHASE dataPhase;
+    ULONG dataBlockLength;
+    ULONG dataLba;
+    UCHAR dataCommand;
+
+    //
+    // Block count set by SET_BLOCK_COUNT for the next multiple block
+    // command, and the blocks left in the current one. 0 means open ended
+    //
+    ULONG predefinedCount;
+    ULONG blocksLeft;
+    ULONG writeCount;
+
+    uint64_t blocksRead;
+    uint64_t blocksWritten;
+};
+
+} // namespace sim
+
+#endif // _SDCARD_H_
@@ -0,0 +1,581 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdhost.cpp
+//
+// Abstract:
+//
+//  BCM2835 SDHost controller model
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#include "sdhost.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace sim {
+namespace {
+
+enum : ULONG {
+    REG_CMD = 0x00,
+    REG_ARG = 0x04,
+    REG_TOUT = 0x08,
+    REG_CDIV = 0x0C,
+    REG_RSP0 = 0x10,
+    REG_HSTS = 0x20,
+    REG_VDD = 0x30,
+    REG_EDM = 0x34,
+    REG_HCFG = 0x38,
+    REG_HBCT = 0x3C,
+    REG_DATA = 0x40,
+    REG_HBLC = 0x50,
+
+    CMD_INDEX_MASK = 0x3F,
+    CMD_READ = 0x40,
+    CMD_WRITE = 0x80,
+    CMD_LONG_RESPONSE = 0x200,
+    CMD_NO_RESPONSE = 0x400,
+    CMD_BUSY = 0x800,
+    CMD_FAIL = 0x4000,
+    CMD_NEW = 0x8000,
+
+    HSTS_DATA_FLAG = 0x1,
+    HSTS_FIFO_ERROR = 0x8,
+    HSTS_CMD_TIMEOUT = 0x40,
+    HSTS_REW_TIMEOUT = 0x80,
+    HSTS_SDIO_IRPT = 0x100,
+    HSTS_BLOCK_IRPT = 0x200,
+    HSTS_BUSY_IRPT = 0x400,
+    HSTS_ERROR_MASK = 0xF8,
+    HSTS_W1C_MASK = 0x7F8,
+
+    HCFG_WIDE_EXT_BUS = 0x4,
+    HCFG_DATA_IRPT_EN = 0x10,
+    HCFG_SDIO_IRPT_EN = 0x20,
+    HCFG_BLOCK_IRPT_EN = 0x100,
+    HCFG_BUSY_IRPT_EN = 0x400,
+    HCFG_IRPT_EN_MASK = 0x530,
+
+    EDM_FIFO_COUNT_SHIFT = 4,
+    EDM_WRITE_THRESHOLD_SHIFT = 9,
+    EDM_READ_THRESHOLD_SHIFT = 14,
+    EDM_THRESHOLD_MASK = 0x1F,
+    EDM_FORCE = 0x80000,
+    EDM_CLEAR_FIFO = 0x200000,
+
+    //
+    // Command line: 48 command bits, then either NCR + response bits or
+    // the NCC gap of a command without response
+    //
+    COMMAND_CLOCKS = 48,
+    NCR_CLOCKS = 2,
+    NCC_CLOCKS = 8,
+
+    //
+    // Data line overhead: start bit, CRC16 + end bit, and for writes the
+    // CRC status token the card sends back
+    //
+    START_BIT_CLOCKS = 2,
+    CRC_CLOCKS = 17,
+    CRC_STATUS_CLOCKS = 8,
+
+    CORE_CLOCK_PERIOD_NS = 4,
+};
+
+} // namespace
+
+SdHost::SdHost (SdCard* CardPtr) :
+    cardPtr(CardPtr)
+{
+    this->reset();
+}
+
+void SdHost::reset ()
+{
+    ::memset(&this->counters, 0, sizeof(this->counters));
+    this->cmd = 0;
+    this->arg = 0;
+    this->tout = 0;
+    this->cdiv = 0x7FF;
+    ::memset(this->rsp, 0, sizeof(this->rsp));
+    this->hsts = 0;
+    this->vdd = 0;
+    this->readThreshold = 0;
+    this->writeThreshold = 0;
+    this->hcfg = 0;
+    this->hbct = 0;
+    this->hblc = 0;
+    this->fsm = FsmIdent;
+    this->fifo.clear();
+    this->cmdDue = NEVER;
+    this->busyDue = NEVER;
+    this->phase = PhaseNone;
+    this->dataDue = NEVER;
+    this->writeStartSince = 0;
+    this->writeActive = false;
+    this->singleBlock = false;
+    this->blockWords = 0;
+    this->wordIndex = 0;
+    this->blocksDone = 0;
+    this->moreBlocks = false;
+}
+
+Time SdHost::clockNs () const
+{
+    return Time(this->cdiv + 2) * CORE_CLOCK_PERIOD_NS;
+}
+
+Time SdHost::wordNs () const
+{
+    //
+    // A 32 bit word takes 8 clocks on a 4 bit bus, 32 on a 1 bit bus
+    //
+    return this->clockNs() * (((this->hcfg & HCFG_WIDE_EXT_BUS) != 0) ? 8 : 32);
+}
+
+ULONG SdHost::Read (ULONG Offset)
+{
+    switch (Offset) {
+    case REG_CMD:
+        return this->cmd;
+
+    case REG_ARG:
+        return this->arg;
+
+    case REG_TOUT:
+        return this->tout;
+
+    case REG_CDIV:
+        return this->cdiv;
+
+    case REG_RSP0:
+    case REG_RSP0 + 4:
+    case REG_RSP0 + 8:
+    case REG_RSP0 + 12:
+        return this->rsp[(Offset - REG_RSP0) / 4];
+
+    case REG_HSTS:
+        ++this->counters.HstsReads;
+        return this->hsts | (this->dataFlag() ? HSTS_DATA_FLAG : 0);
+
+    case REG_VDD:
+        return this->vdd;
+
+    case REG_EDM:
+        ++this->counters.EdmReads;
+        return ULONG(this->fsm) |
+            (ULONG(this->fifo.size()) << EDM_FIFO_COUNT_SHIFT) |
+            (this->writeThreshold << EDM_WRITE_THRESHOLD_SHIFT) |
+            (this->readThreshold << EDM_READ_THRESHOLD_SHIFT);
+
+    case REG_HCFG:
+        return this->hcfg;
+
+    case REG_HBCT:
+        return this->hbct;
+
+    case REG_HBLC:
+        return this->hblc;
+
+    case REG_DATA:
+    {
+        if (this->fifo.empty()) {
+            ++this->counters.EmptyReads;
+            return 0;
+        }
+        ULONG value = this->fifo.front();
+        this->fifo.pop_front();
+        ++this->counters.FifoReads;
+        if (this->phase == PhaseReadStall) {
+            //
+            // The card clock restarts now that there is room for a word
+            //
+            this->phase = PhaseReadBlock;
+            this->fsm = FsmReadData;
+            this->dataDue = this->nextReadDue(Now());
+        }
+        return value;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+void SdHost::Write (ULONG Offset, ULONG Value)
+{
+    switch (Offset) {
+    case REG_CMD:
+        this->cmd = Value;
+        if ((Value & CMD_NEW) != 0) {
+            this->startCommand(Now());
+        }
+        break;
+
+    case REG_ARG:
+        this->arg = Value;
+        break;
+
+    case REG_TOUT:
+        this->tout = Value;
+        break;
+
+    case REG_CDIV:
+        this->cdiv = Value & 0x7FF;
+        break;
+
+    case REG_HSTS:
+        this->hsts &= ~(Value & HSTS_W1C_MASK);
+        break;
+
+    case REG_VDD:
+        this->vdd = Value;
+        break;
+
+    case REG_EDM:
+        this->writeThreshold = (Value >> EDM_WRITE_THRESHOLD_SHIFT) & EDM_THRESHOLD_MASK;
+        this->readThreshold = (Value >> EDM_READ_THRESHOLD_SHIFT) & EDM_THRESHOLD_MASK;
+        if ((Value & EDM_CLEAR_FIFO) != 0) {
+            this->fifo.clear();
+            if (this->phase == PhaseReadStall) {
+                this->phase = PhaseReadBlock;
+                this->fsm = FsmReadData;
+                this->dataDue = this->nextReadDue(Now());
+            }
+        }
+        if ((Value & EDM_FORCE) != 0) {
+            //
+            // Force releases a data path parked at the end of a pre-defined
+            // block count transfer, or stuck waiting on the FIFO
+            //
+            if ((this->phase == PhaseNone) || (this->phase == PhaseReadStall)) {
+                this->endData(FsmDataMode);
+            }
+        }
+        break;
+
+    case REG_HCFG:
+        this->hcfg = Value;
+        break;
+
+    case REG_HBCT:
+        this->hbct = Value;
+        break;
+
+    case REG_HBLC:
+        this->hblc = Value & 0x1FF;
+        break;
+
+    case REG_DATA:
+        if (this->fifo.size() >= FIFO_WORDS) {
+            ++this->counters.FullWrites;
+            this->hsts |= HSTS_FIFO_ERROR;
+            break;
+        }
+        if (this->fifo.empty() && (this->phase == PhaseWriteStart)) {
+            this->writeStartSince = Now();
+        }
+        this->fifo.push_back(Value);
+        ++this->counters.FifoWrites;
+        this->counters.MaxFifoLevel =
+            std::max(this->counters.MaxFifoLevel, ULONG(this->fifo.size()));
+        if (this->phase == PhaseWriteStall) {
+            this->phase = PhaseWriteData;
+            this->dataDue = Now();
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool SdHost::dataFlag () const
+{
+    if (this->writeActive) {
+        return this->fifo.size() < FIFO_WORDS;
+    }
+    return !this->fifo.empty();
+}
+
+bool SdHost::Irq () const
+{
+    ULONG enables = this->hcfg & HCFG_IRPT_EN_MASK;
+    if (((this->hcfg & HCFG_DATA_IRPT_EN) != 0) && this->dataFlag()) {
+        return true;
+    }
+    if (((this->hsts & HSTS_BLOCK_IRPT) != 0) && ((enables & HCFG_BLOCK_IRPT_EN) != 0)) {
+        return true;
+    }
+    if (((this->hsts & HSTS_BUSY_IRPT) != 0) && ((enables & HCFG_BUSY_IRPT_EN) != 0)) {
+        return true;
+    }
+    if (((this->hsts & HSTS_SDIO_IRPT) != 0) && ((enables & HCFG_SDIO_IRPT_EN) != 0)) {
+        return true;
+    }
+    return ((this->hsts & HSTS_ERROR_MASK) != 0) && (enables != 0);
+}
+
+bool SdHost::Dreq () const
+{
+    if (this->writeActive) {
+        return (this->writeThreshold != 0) &&
+            (FIFO_WORDS - this->fifo.size() >= this->writeThreshold);
+    }
+    return (this->readThreshold != 0) && (this->fifo.size() >= this->readThreshold);
+}
+
+void SdHost::startCommand (Time Now)
+{
+    ++this->counters.Commands;
+    this->cmd &= ~CMD_FAIL;
+    Time clocks;
+    if ((this->cmd & CMD_NO_RESPONSE) != 0) {
+        clocks = COMMAND_CLOCKS + NCC_CLOCKS;
+    } else if ((this->cmd & CMD_LONG_RESPONSE) != 0) {
+        clocks = COMMAND_CLOCKS + NCR_CLOCKS + 136;
+    } else {
+        clocks = COMMAND_CLOCKS + NCR_CLOCKS + 48;
+    }
+    this->cmdDue = Now + clocks * this->clockNs();
+}
+
+void SdHost::finishCommand (Time Now)
+{
+    ULONG index = this->cmd & CMD_INDEX_MASK;
+    ULONG response[4];
+    Time busyEnd;
+    bool responded = this->cardPtr->Command(
+        Now,
+        UCHAR(index),
+        this->arg,
+        response,
+        &busyEnd);
+
+    this->cmd &= ~CMD_NEW;
+    if ((this->cmd & CMD_NO_RESPONSE) == 0) {
+        if (!responded) {
+            this->cmd |= CMD_FAIL;
+            this->hsts |= HSTS_CMD_TIMEOUT;
+            return;
+        }
+        if ((this->cmd & CMD_LONG_RESPONSE) != 0) {
+            ::memcpy(this->rsp, response, sizeof(this->rsp));
+        } else {
+            this->rsp[0] = response[0];
+        }
+    }
+
+    if ((this->cmd & CMD_BUSY) != 0) {
+        this->busyDue = std::max(busyEnd, Now);
+    }
+
+    if (index == 12) {
+        //
+        // STOP_TRANSMISSION ends the data phase, data already in the FIFO
+        // belongs to the aborted transfer
+        //
+        this->fifo.clear();
+        this->endData(FsmDataMode);
+        return;
+    }
+
+    this->blocksDone = 0;
+    if (((this->cmd & CMD_READ) != 0) &&
+        (this->cardPtr->DataPhase() == SdCard::ReadData)) {
+
+        this->blockWords = std::max<ULONG>(this->hbct / sizeof(ULONG), 1);
+        this->block.resize(this->blockWords * sizeof(ULONG));
+        this->fsm = FsmReadData;
+        this->startReadBlock(Now + this->cardPtr->ReadAccessTime());
+    } else if (((this->cmd & CMD_WRITE) != 0) &&
+               (this->cardPtr->DataPhase() == SdCard::WriteData)) {
+
+        this->blockWords = std::max<ULONG>(this->hbct / sizeof(ULONG), 1);
+        this->block.resize(this->blockWords * sizeof(ULONG));
+        this->singleBlock = (index == 24);
+        this->writeActive = true;
+        this->phase = PhaseWriteStart;
+        this->writeStartSince = Now;
+        this->fsm = FsmWriteStart1;
+    }
+}
+
+void SdHost::startReadBlock (Time Start)
+{
+    this->moreBlocks = this->cardPtr->ReadBlock(this->block.data());
+    this->wordIndex = 0;
+    this->phase = PhaseReadBlock;
+    this->dataDue = this->nextReadDue(Start);
+}
+
+Time SdHost::nextReadDue (Time Now) const
+{
+    //
+    // The last word of a block is only pushed once its CRC checked out,
+    // together with the end of block state transition
+    //
+    Time due = Now + this->wordNs();
+    if (this->wordIndex + 1 == this->blockWords) {
+        due += CRC_CLOCKS * this->clockNs();
+    }
+    return due;
+}
+
+void SdHost::readWord (Time Now)
+{
+    if (this->fifo.size() >= FIFO_WORDS) {
+        ++this->counters.ReadStalls;
+        this->phase = PhaseReadStall;
+        this->fsm = FsmReadWait;
+        this->dataDue = NEVER;
+        return;
+    }
+
+    ULONG word;
+    ::memcpy(&word, &this->block[this->wordIndex * sizeof(ULONG)], sizeof(ULONG));
+    this->fifo.push_back(word);
+    this->counters.MaxFifoLevel =
+        std::max(this->counters.MaxFifoLevel, ULONG(this->fifo.size()));
+    ++this->wordIndex;
+    this->fsm = FsmReadData;
+
+    if (this->wordIndex < this->blockWords) {
+        this->dataDue = this->nextReadDue(Now);
+        return;
+    }
+
+    ++this->blocksDone;
+    if ((this->hblc != 0) && (this->blocksDone == this->hblc)) {
+        ++this->counters.BlockIrpts;
+        this->hsts |= HSTS_BLOCK_IRPT;
+        this->endData(FsmReadWait);
+    } else if (!this->moreBlocks) {
+        this->endData(FsmDataMode);
+    } else {
+        this->startReadBlock(Now + this->cardPtr->ReadBlockGap());
+    }
+}
+
+void SdHost::writeWord (Time Now)
+{
+    switch (this->phase) {
+    case PhaseWriteData:
+        if (this->fifo.empty()) {
+            ++this->counters.WriteStalls;
+            this->phase = PhaseWriteStall;
+            this->dataDue = NEVER;
+            return;
+        }
+        ::memcpy(&this->block[this->wordIndex * sizeof(ULONG)], &this->fifo.front(), sizeof(ULONG));
+        this->fifo.pop_front();
+        if (++this->wordIndex < this->blockWords) {
+            this->dataDue = Now + this->wordNs();
+        } else {
+            this->phase = PhaseWriteCrc;
+            this->fsm = FsmWriteCrc;
+            this->dataDue = Now + this->wordNs() +
+                (CRC_CLOCKS + CRC_STATUS_CLOCKS) * this->clockNs();
+        }
+        break;
+
+    case PhaseWriteCrc:
+    {
+        Time busyEnd = this->cardPtr->WriteBlock(Now, this->block.data());
+        ++this->blocksDone;
+        if ((this->hblc != 0) && (this->blocksDone == this->hblc)) {
+            ++this->counters.BlockIrpts;
+            this->hsts |= HSTS_BLOCK_IRPT;
+        }
+        this->phase = PhaseWriteBusy;
+        this->fsm = FsmWriteWait1;
+        this->dataDue = std::max(busyEnd, Now);
+        if (this->tout != 0) {
+            this->dataDue = std::min(this->dataDue, Now + Time(this->tout) * this->clockNs());
+        }
+        break;
+    }
+
+    case PhaseWriteBusy:
+        if (this->cardPtr->BusyUntil() > Now) {
+            this->hsts |= HSTS_REW_TIMEOUT;
+            this->endData(FsmDataMode);
+        } else if (this->singleBlock) {
+            this->endData(FsmDataMode);
+        } else if ((this->hblc != 0) && (this->blocksDone == this->hblc)) {
+            this->endData(FsmWriteStart1);
+        } else {
+            this->phase = PhaseWriteStart;
+            this->fsm = FsmWriteStart1;
+            this->writeStartSince = Now;
+            this->dataDue = NEVER;
+        }
+        break;
+
+    default:
+        this->dataDue = NEVER;
+        break;
+    }
+}
+
+void SdHost::endData (FSM State)
+{
+    this->phase = PhaseNone;
+    this->dataDue = NEVER;
+    this->writeActive = false;
+    this->fsm = State;
+}
+
+Time SdHost::writeStartDue () const
+{
+    if ((this->phase != PhaseWriteStart) || this->fifo.empty()) {
+        return NEVER;
+    }
+    return std::max(this->writeStartSince, this->cardPtr->BusyUntil());
+}
+
+Time SdHost::NextEvent () const
+{
+    Time next = std::min(this->cmdDue, this->busyDue);
+    next = std::min(next, this->dataDue);
+    return std::min(next, this->writeStartDue());
+}
+
+bool SdHost::Run (Time Now)
+{
+    bool progress = false;
+    for (;;) {
+        Time next = this->NextEvent();
+        if (next > Now) {
+            break;
+        }
+        progress = true;
+        if (next == this->cmdDue) {
+            this->cmdDue = NEVER;
+            this->finishCommand(next);
+        } else if (next == this->busyDue) {
+            this->busyDue = NEVER;
+            this->hsts |= HSTS_BUSY_IRPT;
+        } else if (next == this->dataDue) {
+            if (this->phase == PhaseReadBlock) {
+                this->readWord(next);
+            } else {
+                this->writeWord(next);
+            }
+        } else {
+            this->phase = PhaseWriteData;
+            this->fsm = FsmWriteData;
+            this->wordIndex = 0;
+            this->dataDue = next + START_BIT_CLOCKS * this->clockNs();
+        }
+    }
+    return progress;
+}
+
+} // namespace sim
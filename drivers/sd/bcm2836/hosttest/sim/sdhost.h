@@ -0,0 +1,148 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdhost.h
+//
+// Abstract:
+//
+//  BCM2835 SDHost controller model, the controller driven by rpisdhc.
+//  It models the registers the miniport uses, the 16 word FIFO with its
+//  DataFlag and DREQ thresholds, the data path state machine reported in
+//  EDM, the HBLC block counter with its block interrupt, and the command
+//  and data line timing derived from CDIV and the bus width
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef _SDHOST_H_
+#define _SDHOST_H_
+
+#include "sdcard.h"
+
+#include <deque>
+
+namespace sim {
+
+class SdHost : public Device {
+public:
+    enum : uint64_t {
+        PHYSICAL_BASE = 0x3F202000,
+        REGISTERS_SIZE = 0x100,
+    };
+
+    enum : ULONG {
+        DREQ = 13,
+        FIFO_WORDS = 16,
+    };
+
+    //
+    // EDM data path state machine encoding
+    //
+    enum FSM : ULONG {
+        FsmIdent = 0x0,
+        FsmDataMode = 0x1,
+        FsmReadData = 0x2,
+        FsmWriteData = 0x3,
+        FsmReadWait = 0x4,
+        FsmReadCrc = 0x5,
+        FsmWriteCrc = 0x6,
+        FsmWriteWait1 = 0x7,
+        FsmWriteStart1 = 0xA,
+    };
+
+    explicit SdHost (SdCard* CardPtr);
+
+    const char* Name () const override { return "sdhost"; }
+    ULONG Read (ULONG Offset) override;
+    void Write (ULONG Offset, ULONG Value) override;
+    bool Run (Time Now) override;
+    Time NextEvent () const override;
+    bool Irq () const override;
+    bool Dreq () const override;
+
+    //
+    // Counters for the FIFO tests
+    //
+    struct Counters {
+        uint64_t Commands;
+        uint64_t FifoReads;
+        uint64_t FifoWrites;
+        uint64_t EmptyReads;
+        uint64_t FullWrites;
+        uint64_t EdmReads;
+        uint64_t HstsReads;
+        uint64_t ReadStalls;
+        uint64_t WriteStalls;
+        uint64_t BlockIrpts;
+        ULONG MaxFifoLevel;
+    };
+
+    const Counters& GetCounters () const { return this->counters; }
+    FSM State () const { return this->fsm; }
+
+private:
+    enum PHASE {
+        PhaseNone,
+        PhaseReadBlock,     // next word of a read block due at dataDue
+        PhaseReadStall,     // FIFO full, clock stopped
+        PhaseWriteStart,    // waiting for FIFO data and the card to be ready
+        PhaseWriteData,     // next word of a write block due at dataDue
+        PhaseWriteStall,    // FIFO empty mid-block
+        PhaseWriteCrc,      // CRC and CRC status due at dataDue
+        PhaseWriteBusy,     // card programming until dataDue
+    };
+
+    Time clockNs () const;
+    Time wordNs () const;
+    void reset ();
+    void startCommand (Time Now);
+    void finishCommand (Time Now);
+    bool dataFlag () const;
+    void startReadBlock (Time Start);
+    Time nextReadDue (Time Now) const;
+    Time writeStartDue () const;
+    void readWord (Time Now);
+    void writeWord (Time Now);
+    void endData (FSM State);
+
+    SdCard* cardPtr;
+    Counters counters;
+
+    ULONG cmd;
+    ULONG arg;
+    ULONG tout;
+    ULONG cdiv;
+    ULONG rsp[4];
+    ULONG hsts;
+    ULONG vdd;
+    ULONG readThreshold;
+    ULONG writeThreshold;
+    ULONG hcfg;
+    ULONG hbct;
+    ULONG hblc;
+
+    FSM fsm;
+    std::deque<ULONG> fifo;
+
+    Time cmdDue;
+    Time busyDue;
+
+    PHASE phase;
+    Time dataDue;
+    Time writeStartSince;
+    bool writeActive;
+    bool singleBlock;
+    ULONG blockWords;
+    ULONG wordIndex;
+    ULONG blocksDone;
+    bool moreBlocks;
+    std::vector<UCHAR> block;
+};
+
+} // namespace sim
+
+#endif // _SDHOST_H_
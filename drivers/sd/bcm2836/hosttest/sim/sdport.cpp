@@ -0,0 +1,760 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdport.cpp
+//
+// Abstract:
+//
+//  Sdport stand-in. It implements the Sdport library routines the
+//  miniports link against and sequences requests the way Sdport does:
+//  interrupt events reach the miniport RequestDpc from a DPC, a completed
+//  CommandWithTransfer is reissued as StartTransfer, and a StartTransfer
+//  completed with STATUS_MORE_PROCESSING_REQUIRED is reissued until the
+//  transfer is over
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#include "sdportsim.h"
+#include "sddef.h"
+
+#include <cstdio>
+#include <cstring>
+
+extern "C" DRIVER_INITIALIZE DriverEntry;
+
+namespace sim {
+namespace {
+
+enum : ULONG {
+    BLOCK_SIZE = 512,
+    SCR_LENGTH = 8,
+    SWITCH_STATUS_LENGTH = 64,
+
+    //
+    // Events Sdport enables on the slot after a host reset
+    //
+    ENABLED_EVENTS =
+        SDHC_IS_CMD_COMPLETE |
+        SDHC_IS_TRANSFER_COMPLETE |
+        SDHC_IS_BUFFER_WRITE_READY |
+        SDHC_IS_BUFFER_READ_READY |
+        SDHC_IS_ERROR_INTERRUPT,
+
+    ENABLED_ERRORS = 0xFFFF,
+
+    OCR_BUSY = 0x80000000,
+    OCR_CCS = 0x40000000,
+    OCR_VOLTAGE_WINDOW = 0x00FF8000,
+    IF_COND_CHECK = 0x1AA,
+    SWITCH_HIGH_SPEED = 0x80FFFFF1,
+    BUS_WIDTH_4 = 2,
+
+    ACMD41_MAX_TRIES = 100,
+    IDENTIFICATION_CLOCK_KHZ = 400,
+    HIGH_SPEED_CLOCK_KHZ = 50 * 1000,
+};
+
+//
+// A request that has not completed by then is abandoned, Sdport uses the
+// same order of magnitude before it resets the host
+//
+const LONGLONG REQUEST_TIMEOUT_100NS = -5LL * 10 * 1000 * 1000;
+
+//
+// Initialization data handed over by the miniport DriverEntry
+//
+SDPORT_INITIALIZATION_DATA g_initData;
+bool g_initialized;
+
+DRIVER_OBJECT g_driverObject;
+const WCHAR REGISTRY_PATH[] = L"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\sdhc";
+
+} // namespace
+
+SdPortSlot::SdPortSlot () :
+    init(),
+    miniport(),
+    slot(),
+    privateExtensionPtr(nullptr),
+    controllerPtr(nullptr),
+    deviceObjPtr(nullptr),
+    registersPtr(nullptr),
+    registersLength(0),
+    capabilities(),
+    started(false),
+    descriptorsPtr(nullptr),
+    sglPtr(nullptr),
+    scratchPtr(nullptr),
+    request(),
+    requestActive(false),
+    requestDoneEvt(),
+    requestStatus(STATUS_SUCCESS),
+    completionStatus(STATUS_SUCCESS),
+    completionDpcObj(),
+    pendingEvents(0),
+    pendingErrors(0),
+    eventsDpcObj(),
+    rca(0),
+    cardBlockCount(0),
+    timeouts(0)
+{
+    KeInitializeEvent(&this->requestDoneEvt, NotificationEvent, FALSE);
+    KeInitializeDpc(&this->completionDpcObj, completionDpc, this);
+    KeInitializeDpc(&this->eventsDpcObj, eventsDpc, this);
+}
+
+SdPortSlot::~SdPortSlot ()
+{
+    this->Stop();
+}
+
+NTSTATUS SdPortSlot::Start (
+    uint64_t PhysicalBase,
+    ULONG Length,
+    Device* ControllerPtr,
+    const CM_PARTIAL_RESOURCE_DESCRIPTOR* DmaResourcePtr
+    )
+{
+    UNICODE_STRING registryPath;
+    RtlInitUnicodeString(&registryPath, REGISTRY_PATH);
+
+    g_initialized = false;
+    NTSTATUS status = DriverEntry(&g_driverObject, &registryPath);
+    if (!NT_SUCCESS(status) || !g_initialized) {
+        ::fprintf(stderr, "DriverEntry failed, status 0x%08x\n", unsigned(status));
+        return NT_SUCCESS(status) ? STATUS_UNSUCCESSFUL : status;
+    }
+    this->init = g_initData;
+
+    this->miniport.ConfigurationInfo.BusType = SdBusTypeAcpi;
+    UCHAR slotCount = 0;
+    status = this->init.GetSlotCount(&this->miniport, &slotCount);
+    if (!NT_SUCCESS(status) || (slotCount != 1)) {
+        ::fprintf(stderr, "GetSlotCount failed, status 0x%08x\n", unsigned(status));
+        return NT_SUCCESS(status) ? STATUS_NOT_SUPPORTED : status;
+    }
+
+    //
+    // The private extension lives in nonpaged pool as it would under Sdport
+    //
+    this->privateExtensionPtr = ExAllocatePoolWithTag(
+        NonPagedPoolNx,
+        this->init.PrivateExtensionSize,
+        'PDSH');
+    if (this->privateExtensionPtr == nullptr) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    ::memset(this->privateExtensionPtr, 0, this->init.PrivateExtensionSize);
+    this->slot.PrivateExtension = this->privateExtensionPtr;
+    this->slot.SimSlot = this;
+    this->miniport.SlotCount = 1;
+    this->miniport.SlotExtensionList[0] = &this->slot;
+    this->controllerPtr = ControllerPtr;
+
+    //
+    // Sdport initializes the slot when its device starts, the resources go
+    // through whatever the miniport chained in front of the Sdport dispatch
+    // routines first
+    //
+    status = IoCreateDevice(
+        &g_driverObject,
+        sizeof(SdPortSlot*),
+        nullptr,
+        FILE_DEVICE_CONTROLLER,
+        0,
+        FALSE,
+        &this->deviceObjPtr);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    *static_cast<SdPortSlot**>(this->deviceObjPtr->DeviceExtension) = this;
+
+    struct {
+        CM_RESOURCE_LIST List;
+        CM_PARTIAL_RESOURCE_DESCRIPTOR More[2];
+    } resources = {};
+    CM_PARTIAL_RESOURCE_LIST* partialListPtr = &resources.List.List[0].PartialResourceList;
+    resources.List.Count = 1;
+    resources.List.List[0].InterfaceType = Internal;
+
+    CM_PARTIAL_RESOURCE_DESCRIPTOR* descriptorPtr = &partialListPtr->PartialDescriptors[0];
+    descriptorPtr->Type = CmResourceTypeMemory;
+    descriptorPtr->u.Memory.Start.QuadPart = LONGLONG(PhysicalBase);
+    descriptorPtr->u.Memory.Length = Length;
+    ++descriptorPtr;
+    descriptorPtr->Type = CmResourceTypeInterrupt;
+    ++descriptorPtr;
+    if (DmaResourcePtr != nullptr) {
+        *descriptorPtr = *DmaResourcePtr;
+        ++descriptorPtr;
+    }
+    partialListPtr->Count = ULONG(descriptorPtr - partialListPtr->PartialDescriptors);
+
+    IRP irp = {};
+    irp.Size = USHORT(sizeof(IRP));
+    irp.StackCount = 1;
+    irp.CurrentLocation = 2;
+    irp.IoStatus.Status = STATUS_NOT_SUPPORTED;
+
+    IO_STACK_LOCATION* stackPtr = IoGetNextIrpStackLocation(&irp);
+    stackPtr->MajorFunction = IRP_MJ_PNP;
+    stackPtr->MinorFunction = IRP_MN_START_DEVICE;
+    stackPtr->Parameters.StartDevice.AllocatedResources = &resources.List;
+    stackPtr->Parameters.StartDevice.AllocatedResourcesTranslated = &resources.List;
+
+    status = IoCallDriver(this->deviceObjPtr, &irp);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    this->started = true;
+    this->init.GetSlotCapabilities(this->privateExtensionPtr, &this->capabilities);
+
+    if (this->capabilities.Supported.ScatterGatherDma != 0) {
+        this->descriptorsPtr = AllocatePhysical(this->capabilities.DmaDescriptorSize, true);
+    }
+    this->sglPtr = static_cast<SCATTER_GATHER_LIST*>(::calloc(
+        1,
+        sizeof(SCATTER_GATHER_LIST) + 1024 * sizeof(SCATTER_GATHER_ELEMENT)));
+    this->scratchPtr = static_cast<UCHAR*>(AllocatePhysical(PAGE_SIZE, false));
+
+    status = this->busOperation(SdResetHost, SdResetTypeAll);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    this->init.ToggleEvents(this->privateExtensionPtr, ENABLED_EVENTS | (ENABLED_ERRORS << 16), TRUE);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SdPortSlot::startDevice (const CM_RESOURCE_LIST* ResourcesPtr)
+{
+    const CM_PARTIAL_RESOURCE_LIST& partialList = ResourcesPtr->List[0].PartialResourceList;
+    const CM_PARTIAL_RESOURCE_DESCRIPTOR* memoryPtr = nullptr;
+    for (ULONG i = 0; i < partialList.Count; ++i) {
+        if (partialList.PartialDescriptors[i].Type == CmResourceTypeMemory) {
+            memoryPtr = &partialList.PartialDescriptors[i];
+            break;
+        }
+    }
+    if (memoryPtr == nullptr) {
+        return STATUS_DEVICE_CONFIGURATION_ERROR;
+    }
+
+    PHYSICAL_ADDRESS physicalBase = memoryPtr->u.Memory.Start;
+    this->registersPtr = MmMapIoSpace(physicalBase, memoryPtr->u.Memory.Length, MmNonCached);
+    if (this->registersPtr == nullptr) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    this->registersLength = memoryPtr->u.Memory.Length;
+
+    ConnectInterrupt(this->controllerPtr, isr, this);
+
+    NTSTATUS status = this->init.Initialize(
+        this->privateExtensionPtr,
+        physicalBase,
+        this->registersPtr,
+        this->registersLength,
+        FALSE);
+    if (!NT_SUCCESS(status)) {
+        ::fprintf(stderr, "Initialize failed, status 0x%08x\n", unsigned(status));
+    }
+    return status;
+}
+
+NTSTATUS SdPortSlot::dispatch (PDEVICE_OBJECT DeviceObjectPtr, PIRP IrpPtr)
+{
+    IO_STACK_LOCATION* stackPtr = IoGetCurrentIrpStackLocation(IrpPtr);
+    NTSTATUS status = STATUS_INVALID_DEVICE_REQUEST;
+    if ((stackPtr->MajorFunction == IRP_MJ_PNP) &&
+        (stackPtr->MinorFunction == IRP_MN_START_DEVICE)) {
+
+        SdPortSlot* slotPtr = *static_cast<SdPortSlot**>(DeviceObjectPtr->DeviceExtension);
+        status = slotPtr->startDevice(stackPtr->Parameters.StartDevice.AllocatedResourcesTranslated);
+    }
+    IrpPtr->IoStatus.Status = status;
+    IoCompleteRequest(IrpPtr, IO_NO_INCREMENT);
+    return status;
+}
+
+void SdPortSlot::Stop ()
+{
+    if (this->started) {
+        this->started = false;
+        if (this->init.Cleanup != nullptr) {
+            this->init.Cleanup(&this->miniport);
+        }
+    }
+    if (this->registersPtr != nullptr) {
+        MmUnmapIoSpace(this->registersPtr, this->registersLength);
+        this->registersPtr = nullptr;
+    }
+    if (this->descriptorsPtr != nullptr) {
+        FreePhysical(this->descriptorsPtr);
+        this->descriptorsPtr = nullptr;
+    }
+    if (this->scratchPtr != nullptr) {
+        FreePhysical(this->scratchPtr);
+        this->scratchPtr = nullptr;
+    }
+    ::free(this->sglPtr);
+    this->sglPtr = nullptr;
+    if (this->deviceObjPtr != nullptr) {
+        IoDeleteDevice(this->deviceObjPtr);
+        this->deviceObjPtr = nullptr;
+    }
+}
+
+NTSTATUS SdPortSlot::busOperation (SDPORT_BUS_OPERATION_TYPE Type, ULONG Value)
+{
+    SDPORT_BUS_OPERATION operation = {};
+    operation.Type = Type;
+    switch (Type) {
+    case SdResetHost:
+        operation.Parameters.ResetType = SDPORT_RESET_TYPE(Value);
+        break;
+
+    case SdSetClock:
+        operation.Parameters.FrequencyKhz = Value;
+        break;
+
+    case SdSetVoltage:
+        operation.Parameters.Voltage = SDPORT_BUS_VOLTAGE(Value);
+        break;
+
+    case SdSetBusWidth:
+        operation.Parameters.BusWidth = SDPORT_BUS_WIDTH(Value);
+        break;
+
+    case SdSetBusSpeed:
+        operation.Parameters.BusSpeed = SDPORT_BUS_SPEED(Value);
+        break;
+
+    default:
+        break;
+    }
+
+    NTSTATUS status = this->init.IssueBusOperation(this->privateExtensionPtr, &operation);
+    if (!NT_SUCCESS(status)) {
+        ::fprintf(
+            stderr,
+            "Bus operation %d failed, status 0x%08x\n",
+            int(Type),
+            unsigned(status));
+    }
+    return status;
+}
+
+//
+// Requests
+//
+
+BOOLEAN SdPortSlot::isr (void* Context)
+{
+    auto thisPtr = static_cast<SdPortSlot*>(Context);
+    ULONG events = 0;
+    ULONG errors = 0;
+    BOOLEAN cardChange = FALSE;
+    BOOLEAN sdioInterrupt = FALSE;
+    BOOLEAN tuning = FALSE;
+
+    BOOLEAN handled = thisPtr->init.Interrupt(
+        thisPtr->privateExtensionPtr,
+        &events,
+        &errors,
+        &cardChange,
+        &sdioInterrupt,
+        &tuning);
+    if (handled && ((events | errors) != 0)) {
+        thisPtr->pendingEvents |= events;
+        thisPtr->pendingErrors |= errors;
+        (void)KeInsertQueueDpc(&thisPtr->eventsDpcObj, nullptr, nullptr);
+    }
+    return handled;
+}
+
+void SdPortSlot::eventsDpc (PKDPC, PVOID DeferredContext, PVOID, PVOID)
+{
+    auto thisPtr = static_cast<SdPortSlot*>(DeferredContext);
+    ULONG events = thisPtr->pendingEvents;
+    ULONG errors = thisPtr->pendingErrors;
+    thisPtr->pendingEvents = 0;
+    thisPtr->pendingErrors = 0;
+
+    //
+    // Like Sdport, events arriving with no request outstanding are dropped
+    //
+    if (thisPtr->requestActive) {
+        thisPtr->init.RequestDpc(
+            thisPtr->privateExtensionPtr,
+            &thisPtr->request,
+            events,
+            errors);
+    }
+}
+
+void SdPortSlot::CompleteRequest (SDPORT_REQUEST* RequestPtr, NTSTATUS Status)
+{
+    if ((RequestPtr != &this->request) || !this->requestActive) {
+        ::fprintf(stderr, "Completion of a request that is not outstanding\n");
+        return;
+    }
+    this->completionStatus = Status;
+    (void)KeInsertQueueDpc(&this->completionDpcObj, nullptr, nullptr);
+}
+
+void SdPortSlot::completionDpc (PKDPC, PVOID DeferredContext, PVOID, PVOID)
+{
+    auto thisPtr = static_cast<SdPortSlot*>(DeferredContext);
+    if (!thisPtr->requestActive) {
+        return;
+    }
+    NTSTATUS status = thisPtr->completionStatus;
+    SDPORT_REQUEST* requestPtr = &thisPtr->request;
+
+    if ((requestPtr->Type == SdRequestTypeCommandWithTransfer) && NT_SUCCESS(status)) {
+        requestPtr->Type = SdRequestTypeStartTransfer;
+        thisPtr->issue();
+        return;
+    }
+    if ((requestPtr->Type == SdRequestTypeStartTransfer) &&
+        (status == STATUS_MORE_PROCESSING_REQUIRED)) {
+
+        thisPtr->issue();
+        return;
+    }
+    thisPtr->finish(status);
+}
+
+void SdPortSlot::issue ()
+{
+    KIRQL oldIrql;
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+    this->request.Status = STATUS_PENDING;
+    this->request.RequiredEvents = 0;
+    NTSTATUS status = this->init.IssueRequest(this->privateExtensionPtr, &this->request);
+    if ((status != STATUS_PENDING) && !NT_SUCCESS(status)) {
+        this->finish(status);
+    }
+    KeLowerIrql(oldIrql);
+}
+
+void SdPortSlot::finish (NTSTATUS Status)
+{
+    this->requestStatus = Status;
+    this->requestActive = false;
+    (void)KeSetEvent(&this->requestDoneEvt, 0, FALSE);
+}
+
+NTSTATUS SdPortSlot::SubmitCommand (SDPORT_COMMAND* CommandPtr, ULONG Response[4])
+{
+    this->request = SDPORT_REQUEST();
+    this->request.Command = *CommandPtr;
+    this->request.Type = (CommandPtr->TransferType == SdTransferTypeNone) ?
+        SdRequestTypeCommandNoTransfer :
+        SdRequestTypeCommandWithTransfer;
+    this->request.SimContext = this;
+    this->requestActive = true;
+    (void)KeClearEvent(&this->requestDoneEvt);
+
+    this->issue();
+
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = REQUEST_TIMEOUT_100NS;
+    NTSTATUS status = KeWaitForSingleObject(
+        &this->requestDoneEvt,
+        Executive,
+        KernelMode,
+        FALSE,
+        &timeout);
+    if (status == STATUS_TIMEOUT) {
+        ++this->timeouts;
+        ::fprintf(
+            stderr,
+            "CMD%u timed out at %lld ns\n",
+            unsigned(CommandPtr->Index),
+            (long long)Now());
+
+        this->requestActive = false;
+        (void)KeRemoveQueueDpc(&this->completionDpcObj);
+        (void)this->busOperation(SdResetHost, SdResetTypeCmd);
+        (void)this->busOperation(SdResetHost, SdResetTypeDat);
+        return STATUS_IO_TIMEOUT;
+    }
+
+    if (NT_SUCCESS(this->requestStatus) && (Response != nullptr)) {
+        ULONG response[4] = {};
+        this->init.GetResponse(this->privateExtensionPtr, &this->request.Command, response);
+        ::memcpy(Response, response, sizeof(response));
+    }
+    return this->requestStatus;
+}
+
+NTSTATUS SdPortSlot::command (
+    UCHAR Index,
+    SDPORT_COMMAND_CLASS Class,
+    SDPORT_RESPONSE_TYPE ResponseType,
+    ULONG Argument,
+    ULONG Response[4]
+    )
+{
+    if (Class == SdCommandClassApp) {
+        ULONG appResponse[4];
+        NTSTATUS status = this->command(
+            SDCMD_APP_CMD,
+            SdCommandClassStandard,
+            SdResponseTypeR1,
+            ULONG(this->rca) << 16,
+            appResponse);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    SDPORT_COMMAND command = {};
+    command.Index = Index;
+    command.Class = Class;
+    command.TransferType = SdTransferTypeNone;
+    command.ResponseType = ResponseType;
+    command.Argument = Argument;
+    return this->SubmitCommand(&command, Response);
+}
+
+//
+// Single block register read (SCR, switch status) into the scratch page
+//
+NTSTATUS SdPortSlot::readRegister (
+    UCHAR Index,
+    SDPORT_COMMAND_CLASS Class,
+    ULONG Argument,
+    ULONG Length
+    )
+{
+    if (Class == SdCommandClassApp) {
+        ULONG appResponse[4];
+        NTSTATUS status = this->command(
+            SDCMD_APP_CMD,
+            SdCommandClassStandard,
+            SdResponseTypeR1,
+            ULONG(this->rca) << 16,
+            appResponse);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    SDPORT_COMMAND command = {};
+    command.Index = Index;
+    command.Class = Class;
+    command.TransferDirection = SdTransferDirectionRead;
+    command.TransferType = SdTransferTypeSingleBlock;
+    command.TransferMethod = SdTransferMethodPio;
+    command.ResponseType = SdResponseTypeR1;
+    command.Argument = Argument;
+    command.BlockSize = USHORT(Length);
+    command.BlockCount = 1;
+    command.Length = Length;
+    command.DataBuffer = this->scratchPtr;
+    ULONG response[4];
+    return this->SubmitCommand(&command, response);
+}
+
+NTSTATUS SdPortSlot::InitializeCard ()
+{
+    ULONG response[4] = {};
+    NTSTATUS status;
+
+    status = this->busOperation(SdSetVoltage, SdBusVoltage33);
+    if (NT_SUCCESS(status)) {
+        status = this->busOperation(SdSetClock, IDENTIFICATION_CLOCK_KHZ);
+    }
+    if (NT_SUCCESS(status)) {
+        status = this->busOperation(SdSetBusWidth, SdBusWidth1Bit);
+    }
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = this->command(SDCMD_GO_IDLE_STATE, SdCommandClassStandard, SdResponseTypeNone, 0, response);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = this->command(SDCMD_SEND_IF_COND, SdCommandClassStandard, SdResponseTypeR1, IF_COND_CHECK, response);
+    if (!NT_SUCCESS(status) || ((response[0] & 0xFFF) != IF_COND_CHECK)) {
+        ::fprintf(stderr, "CMD8 failed, status 0x%08x\n", unsigned(status));
+        return NT_SUCCESS(status) ? STATUS_DEVICE_PROTOCOL_ERROR : status;
+    }
+
+    ULONG tries = 0;
+    do {
+        status = this->command(
+            SDACMD_SEND_OP_COND,
+            SdCommandClassApp,
+            SdResponseTypeR3,
+            OCR_CCS | OCR_VOLTAGE_WINDOW,
+            response);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    } while (((response[0] & OCR_BUSY) == 0) && (++tries < ACMD41_MAX_TRIES));
+    if ((response[0] & OCR_BUSY) == 0) {
+        return STATUS_IO_TIMEOUT;
+    }
+
+    status = this->command(SDCMD_ALL_SEND_CID, SdCommandClassStandard, SdResponseTypeR2, 0, response);
+    if (NT_SUCCESS(status)) {
+        status = this->command(SDCMD_SEND_RELATIVE_ADDR, SdCommandClassStandard, SdResponseTypeR6, 0, response);
+    }
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    this->rca = USHORT(response[0] >> 16);
+
+    status = this->command(SDCMD_SEND_CSD, SdCommandClassStandard, SdResponseTypeR2, ULONG(this->rca) << 16, response);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    //
+    // CSD 2.0 C_SIZE, bits 69:48 of the CSD, land in bits 29:8 of the second
+    // response word once the CRC byte is stripped
+    //
+    ULONG cSize = (response[1] >> 8) & 0x3FFFFF;
+    this->cardBlockCount = (cSize + 1) * 1024;
+
+    status = this->command(SDCMD_SELECT_CARD, SdCommandClassStandard, SdResponseTypeR1B, ULONG(this->rca) << 16, response);
+    if (NT_SUCCESS(status)) {
+        status = this->command(SDACMD_SET_BUS_WIDTH, SdCommandClassApp, SdResponseTypeR1, BUS_WIDTH_4, response);
+    }
+    if (NT_SUCCESS(status)) {
+        status = this->busOperation(SdSetBusWidth, SdBusWidth4Bit);
+    }
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    //
+    // The SCR read lets a miniport learn whether the card supports CMD23
+    //
+    status = this->readRegister(SDACMD_SEND_SCR, SdCommandClassApp, 0, SCR_LENGTH);
+    if (!NT_SUCCESS(status)) {
+        ::fprintf(stderr, "ACMD51 failed, status 0x%08x\n", unsigned(status));
+        return status;
+    }
+
+    status = this->readRegister(SDCMD_SWITCH_FUNCTION, SdCommandClassStandard, SWITCH_HIGH_SPEED, SWITCH_STATUS_LENGTH);
+    if (!NT_SUCCESS(status)) {
+        ::fprintf(stderr, "CMD6 failed, status 0x%08x\n", unsigned(status));
+        return status;
+    }
+    status = this->busOperation(SdSetBusSpeed, SdBusSpeedHigh);
+    if (NT_SUCCESS(status)) {
+        status = this->busOperation(SdSetClock, HIGH_SPEED_CLOCK_KHZ);
+    }
+    if (NT_SUCCESS(status)) {
+        status = this->command(SDCMD_SET_BLOCKLEN, SdCommandClassStandard, SdResponseTypeR1, BLOCK_SIZE, response);
+    }
+    return status;
+}
+
+NTSTATUS SdPortSlot::Transfer (
+    bool Write,
+    ULONG Lba,
+    ULONG BlockCount,
+    UCHAR* BufferPtr,
+    SDPORT_TRANSFER_METHOD Method
+    )
+{
+    SDPORT_COMMAND command = {};
+    if (Write) {
+        command.Index = (BlockCount > 1) ? SDCMD_WRITE_MULTIPLE_BLOCK : SDCMD_WRITE_BLOCK;
+        command.TransferDirection = SdTransferDirectionWrite;
+    } else {
+        command.Index = (BlockCount > 1) ? SDCMD_READ_MULTIPLE_BLOCK : SDCMD_READ_BLOCK;
+        command.TransferDirection = SdTransferDirectionRead;
+    }
+    command.Class = SdCommandClassStandard;
+    command.TransferType = (BlockCount > 1) ? SdTransferTypeMultiBlock : SdTransferTypeSingleBlock;
+    command.ResponseType = SdResponseTypeR1;
+    command.Argument = Lba;
+    command.BlockSize = BLOCK_SIZE;
+    command.BlockCount = USHORT(BlockCount);
+    command.Length = BlockCount * BLOCK_SIZE;
+    command.DataBuffer = BufferPtr;
+
+    if ((Method == SdTransferMethodSgDma) &&
+        (this->capabilities.Supported.ScatterGatherDma != 0)) {
+
+        //
+        // One element per page, like the MDL of a virtually contiguous
+        // buffer would produce
+        //
+        ULONG offset = 0;
+        ULONG count = 0;
+        while (offset < command.Length) {
+            uint64_t physical = PhysicalAddressOf(BufferPtr + offset);
+            ULONG chunk = ULONG(PAGE_SIZE - (physical & (PAGE_SIZE - 1)));
+            if (chunk > command.Length - offset) {
+                chunk = command.Length - offset;
+            }
+            this->sglPtr->Elements[count].Address.QuadPart = LONGLONG(physical);
+            this->sglPtr->Elements[count].Length = chunk;
+            ++count;
+            offset += chunk;
+        }
+        this->sglPtr->NumberOfElements = count;
+        command.TransferMethod = SdTransferMethodSgDma;
+        command.ScatterGatherList = this->sglPtr;
+        command.ScatterGatherListSize = count;
+        command.DmaVirtualAddress = this->descriptorsPtr;
+        command.DmaPhysicalAddress.QuadPart = LONGLONG(PhysicalAddressOf(this->descriptorsPtr));
+    } else {
+        command.TransferMethod = SdTransferMethodPio;
+    }
+
+    ULONG response[4];
+    return this->SubmitCommand(&command, response);
+}
+
+} // namespace sim
+
+using namespace sim;
+
+extern "C" {
+
+//
+// Sdport library routines
+//
+
+NTSTATUS SdPortInitialize (
+    PDRIVER_OBJECT DriverObject,
+    PUNICODE_STRING /* RegistryPath */,
+    PSDPORT_INITIALIZATION_DATA HwInitializationData
+    )
+{
+    if (HwInitializationData->StructureSize != sizeof(SDPORT_INITIALIZATION_DATA)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    for (ULONG i = 0; i <= IRP_MJ_MAXIMUM_FUNCTION; ++i) {
+        DriverObject->MajorFunction[i] = SdPortSlot::dispatch;
+    }
+    g_initData = *HwInitializationData;
+    g_initialized = true;
+    return STATUS_SUCCESS;
+}
+
+VOID SdPortCompleteRequest (PSDPORT_REQUEST Request, NTSTATUS Status)
+{
+    static_cast<SdPortSlot*>(Request->SimContext)->CompleteRequest(Request, Status);
+}
+
+VOID SdPortWait (ULONG TimeInUs)
+{
+    KeStallExecutionProcessor(TimeInUs);
+}
+
+} // extern "C"
@@ -0,0 +1,143 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdportsim.h
+//
+// Abstract:
+//
+//  Sdport stand-in driving a miniport compiled into the host-side test
+//  harness. It owns the single slot of the miniport, brings an SD memory
+//  card up the way Sdport does, and runs requests through the miniport
+//  callbacks with the same CommandWithTransfer, StartTransfer and
+//  STATUS_MORE_PROCESSING_REQUIRED sequencing
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef _SDPORTSIM_H_
+#define _SDPORTSIM_H_
+
+#include "sim.h"
+#include "sdport.h"
+
+namespace sim {
+
+class SdPortSlot {
+public:
+    SdPortSlot ();
+    ~SdPortSlot ();
+
+    //
+    // Run the miniport DriverEntry, start the Sdport device with the
+    // controller registers at PhysicalBase and DmaResource as its FixedDMA
+    // resource if there is one, then reset the slot. Controller is the
+    // device whose Irq line the miniport ISR serves
+    //
+    NTSTATUS Start (
+        uint64_t PhysicalBase,
+        ULONG Length,
+        Device* ControllerPtr,
+        const CM_PARTIAL_RESOURCE_DESCRIPTOR* DmaResourcePtr
+        );
+
+    //
+    // Card identification, bus width, high speed and block length
+    //
+    NTSTATUS InitializeCard ();
+
+    //
+    // Issue one request and wait for its completion, from PASSIVE_LEVEL
+    //
+    NTSTATUS SubmitCommand (SDPORT_COMMAND* CommandPtr, ULONG Response[4]);
+
+    //
+    // Block reads and writes of 512 byte blocks, Buffer must come from
+    // AllocatePhysical. SgDma is only used if the miniport supports it
+    //
+    NTSTATUS Transfer (
+        bool Write,
+        ULONG Lba,
+        ULONG BlockCount,
+        UCHAR* BufferPtr,
+        SDPORT_TRANSFER_METHOD Method
+        );
+
+    void Stop ();
+
+    const SDPORT_CAPABILITIES& Capabilities () const { return this->capabilities; }
+    ULONG CardBlockCount () const { return this->cardBlockCount; }
+
+    //
+    // Requests the stand-in had to give up on after the completion timeout
+    //
+    uint64_t Timeouts () const { return this->timeouts; }
+
+    //
+    // Called from the Sdport library routines the miniport links against
+    //
+    void CompleteRequest (SDPORT_REQUEST* RequestPtr, NTSTATUS Status);
+
+    //
+    // Sdport dispatch routine, initializes the slot on IRP_MN_START_DEVICE
+    //
+    static DRIVER_DISPATCH dispatch;
+
+private:
+    static BOOLEAN isr (void* Context);
+    static KDEFERRED_ROUTINE eventsDpc;
+    static KDEFERRED_ROUTINE completionDpc;
+
+    NTSTATUS startDevice (const CM_RESOURCE_LIST* ResourcesPtr);
+    NTSTATUS busOperation (SDPORT_BUS_OPERATION_TYPE Type, ULONG Value);
+    NTSTATUS command (
+        UCHAR Index,
+        SDPORT_COMMAND_CLASS Class,
+        SDPORT_RESPONSE_TYPE ResponseType,
+        ULONG Argument,
+        ULONG Response[4]
+        );
+    NTSTATUS readRegister (UCHAR Index, SDPORT_COMMAND_CLASS Class, ULONG Argument, ULONG Length);
+    void issue ();
+    void finish (NTSTATUS Status);
+
+    SDPORT_INITIALIZATION_DATA init;
+    SD_MINIPORT miniport;
+    SDPORT_SLOT_EXTENSION slot;
+    PVOID privateExtensionPtr;
+    Device* controllerPtr;
+    PDEVICE_OBJECT deviceObjPtr;
+    PVOID registersPtr;
+    ULONG registersLength;
+    SDPORT_CAPABILITIES capabilities;
+    bool started;
+
+    //
+    // DMA descriptors and the scatter/gather list of the current request
+    //
+    PVOID descriptorsPtr;
+    SCATTER_GATHER_LIST* sglPtr;
+    UCHAR* scratchPtr;
+
+    SDPORT_REQUEST request;
+    bool requestActive;
+    KEVENT requestDoneEvt;
+    NTSTATUS requestStatus;
+    NTSTATUS completionStatus;
+    KDPC completionDpcObj;
+
+    ULONG pendingEvents;
+    ULONG pendingErrors;
+    KDPC eventsDpcObj;
+
+    USHORT rca;
+    ULONG cardBlockCount;
+    uint64_t timeouts;
+};
+
+} // namespace sim
+
+#endif // _SDPORTSIM_H_
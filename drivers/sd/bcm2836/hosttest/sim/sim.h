@@ -0,0 +1,130 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sim.h
+//
+// Abstract:
+//
+//  Harness side interface of the simulated kernel. Device models plug in
+//  as MMIO regions, interrupt lines and DMA request lines, and advance on
+//  a single simulated clock in nanoseconds. Kernel threads are host
+//  threads that only run one at a time, handing over on waits and yields,
+//  so a run is deterministic for a given seed
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "wdkhost.h"
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sim {
+
+typedef int64_t Time;
+
+const Time NEVER = INT64_MAX;
+const Time NS_PER_US = 1000;
+const Time NS_PER_MS = 1000 * 1000;
+
+//
+// Costs charged to the simulated clock, in nanoseconds unless noted
+//
+struct Costs {
+    Time RegisterRead;
+    Time RegisterWrite;
+    Time RegisterFence;
+    Time IsrEntry;
+    Time DpcEntry;
+    Time ContextSwitch;
+    Time HighResTimerLatency;
+    double CachedCopyNsPerByte;
+    double UncachedReadNsPerByte;
+    double UncachedWriteNsPerByte;
+};
+
+//
+// CPU and bus time accounting
+//
+struct Stats {
+    Time IsrNs;
+    Time DpcNs;
+    Time ThreadNs;
+    Time SwitchNs;
+    uint64_t IsrCount;
+    uint64_t DpcCount;
+    uint64_t SwitchCount;
+    uint64_t RegisterReads;
+    uint64_t RegisterWrites;
+    uint64_t TraceCount[6];
+    uint64_t AssertionCount;
+};
+
+class Device {
+public:
+    virtual ~Device () {}
+    virtual const char* Name () const = 0;
+
+    //
+    // Register access from the CPU or a DMA engine, Offset is relative
+    // to the base the device was mapped at
+    //
+    virtual ULONG Read (ULONG Offset) = 0;
+    virtual void Write (ULONG Offset, ULONG Value) = 0;
+
+    //
+    // Bring the device up to Now, returns true if anything changed that
+    // another device may react to
+    //
+    virtual bool Run (Time /* Now */) { return false; }
+
+    //
+    // Next time the device changes on its own, NEVER if it is waiting on
+    // register access or another device
+    //
+    virtual Time NextEvent () const { return NEVER; }
+
+    virtual bool Irq () const { return false; }
+    virtual bool Dreq () const { return false; }
+};
+
+typedef BOOLEAN IsrRoutine (void* Context);
+
+void Init (const Costs* CostsPtr = nullptr);
+void Shutdown ();
+Time Now ();
+void Charge (Time Nanoseconds);
+void SetVerbosity (ULONG TraceLevel);
+void SetTimerResolution (ULONG CurrentTime100ns);
+const Stats& GetStats ();
+std::vector<std::pair<std::string, Time>> GetThreadBusy ();
+
+void MapDevice (uint64_t PhysicalAddress, ULONG Length, Device* DevicePtr);
+void ConnectInterrupt (Device* DevicePtr, IsrRoutine* Isr, void* Context);
+void ConnectDreq (ULONG Permap, Device* DevicePtr);
+bool DreqAsserted (ULONG Permap);
+
+//
+// Physical memory, as seen by bus masters
+//
+void* AllocatePhysical (size_t Length, bool Uncached);
+void FreePhysical (void* Address);
+uint64_t PhysicalAddressOf (const void* Address);
+void* HostAddressOf (uint64_t PhysicalAddress, size_t Length);
+Device* DeviceAt (uint64_t PhysicalAddress, ULONG* OffsetPtr);
+
+void SetRegistryDword (const char* Name, ULONG Value);
+DEVICE_OBJECT* FindDeviceObject (const char* Name);
+
+} // namespace sim
+
+#endif // _SIM_H_
@@ -0,0 +1,2000 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  simkernel.cpp
+//
+// Abstract:
+//
+//  Simulated kernel behind the WDK shims. There is a single simulated CPU:
+//  kernel threads are host threads, but only the one holding the baton
+//  runs, and the baton only moves on a wait, a yield or a thread exit.
+//  Everything the CPU does is charged to a simulated clock; when no thread
+//  can run the clock jumps to the next device, timer or timeout event.
+//  Interrupts and DPCs are delivered synchronously from the clock whenever
+//  the current IRQL allows it, so ISR, DPC and thread time serialize the
+//  way they would on a single core.
+//
+// Environment:
+//
+//  Host user mode
+//
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <algorithm>
+#include <condition_variable>
+#include <csetjmp>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+#include "sim.h"
+
+namespace sim {
+namespace {
+
+enum : UCHAR {
+    OBJECT_NOTIFICATION_EVENT = 0,
+    OBJECT_SYNCHRONIZATION_EVENT = 1,
+    OBJECT_THREAD = 6,
+};
+
+const KIRQL DEVICE_IRQL = 8;
+const ULONG MAXIMUM_TIMER_RESOLUTION = 156250;
+const ULONG MINIMUM_TIMER_RESOLUTION = 5000;
+const LONGLONG PERFORMANCE_FREQUENCY = 19200000;
+const int STALL_LIMIT = 100000;
+
+const Costs DEFAULT_COSTS = {
+    80,         // RegisterRead
+    25,         // RegisterWrite
+    20,         // RegisterFence
+    2000,       // IsrEntry
+    1500,       // DpcEntry
+    5000,       // ContextSwitch
+    10000,      // HighResTimerLatency
+    1.0,        // CachedCopyNsPerByte
+    4.0,        // UncachedReadNsPerByte
+    1.5,        // UncachedWriteNsPerByte
+};
+
+struct Thread {
+    enum STATE { Ready, Waiting, Terminated };
+
+    std::string Name;
+    KTHREAD Object;
+    std::condition_variable Cv;
+    std::unique_lock<std::mutex>* Lock;
+    KIRQL Irql;
+    KPRIORITY Priority;
+    KAFFINITY Affinity;
+    STATE State;
+    uint64_t ReadySeq;
+    uint64_t WaitSeq;
+    std::vector<DISPATCHER_HEADER*> WaitObjects;
+    WAIT_TYPE WaitType;
+    Time Deadline;
+    NTSTATUS WaitStatus;
+    Time BusyNs;
+    PKSTART_ROUTINE Routine;
+    PVOID Context;
+    std::thread Host;
+    jmp_buf ExitJump;
+
+    Thread (const char* NameSz) :
+        Name(NameSz),
+        Object(),
+        Lock(nullptr),
+        Irql(PASSIVE_LEVEL),
+        Priority(8),
+        Affinity(0xF),
+        State(Ready),
+        ReadySeq(0),
+        WaitSeq(0),
+        WaitType(WaitAny),
+        Deadline(NEVER),
+        WaitStatus(STATUS_SUCCESS),
+        BusyNs(0),
+        Routine(nullptr),
+        Context(nullptr)
+    {
+        this->Object.Header.Type = OBJECT_THREAD;
+        this->Object.SimThread = this;
+    }
+};
+
+struct Interrupt {
+    Device* DevicePtr;
+    IsrRoutine* Isr;
+    void* Context;
+};
+
+struct Mapping {
+    uintptr_t Va;
+    size_t Length;
+    Device* DevicePtr;
+    ULONG DeviceOffset;
+};
+
+struct Region {
+    uint64_t Physical;
+    ULONG Length;
+    Device* DevicePtr;
+};
+
+struct Allocation {
+    size_t Length;
+    bool Uncached;
+};
+
+std::mutex g_lock;
+Thread* g_running;
+Thread* g_main;
+Thread g_idle("idle");
+thread_local Thread* t_ctx;
+std::vector<Thread*> g_threads;
+
+Time g_now;
+Costs g_costs = DEFAULT_COSTS;
+Stats g_stats;
+ULONG g_verbosity = TRACE_LEVEL_CRITICAL;
+ULONG g_timerResolution = MAXIMUM_TIMER_RESOLUTION;
+uint64_t g_seq;
+
+bool g_inIsr;
+bool g_inDpc;
+bool g_inRunDevices;
+Time g_nextDeadline = NEVER;
+
+std::deque<KDPC*> g_dpcQueue;
+std::vector<Interrupt> g_interrupts;
+std::vector<Device*> g_devices;
+std::map<ULONG, Device*> g_dreqs;
+std::map<uintptr_t, Mapping> g_mappings;
+std::map<uint64_t, Region> g_regions;
+std::map<std::string, ULONG> g_registry;
+std::vector<DEVICE_OBJECT*> g_deviceObjects;
+std::map<DEVICE_OBJECT*, std::string> g_deviceNames;
+
+//
+// Physical memory arena, pool and contiguous allocations both come from it
+// so that every buffer a driver hands to a bus master has a bus address
+//
+const uint64_t ARENA_PHYSICAL_BASE = 0x10000000;
+const size_t ARENA_SIZE = 256 * 1024 * 1024;
+
+uint8_t* g_arena;
+std::map<size_t, size_t> g_free;
+std::map<size_t, Allocation> g_allocations;
+
+} // namespace
+
+//
+// Forward declarations
+//
+namespace {
+void poll ();
+void evaluateWaits ();
+void reschedule (Thread* Self, bool Yield);
+} // namespace
+
+namespace {
+
+Thread* cur ()
+{
+    return t_ctx;
+}
+
+void fatal (const char* Format, ...)
+{
+    va_list args;
+    va_start(args, Format);
+    ::fprintf(stderr, "sim: fatal at %.3f us: ", double(g_now) / NS_PER_US);
+    ::vfprintf(stderr, Format, args);
+    ::fprintf(stderr, "\n");
+    va_end(args);
+    ::fflush(stderr);
+    ::abort();
+}
+
+std::string narrow (const UNICODE_STRING* StringPtr)
+{
+    std::string result;
+    if (StringPtr == nullptr || StringPtr->Buffer == nullptr) {
+        return result;
+    }
+    for (USHORT i = 0; i < StringPtr->Length / sizeof(WCHAR); ++i) {
+        result.push_back(char(StringPtr->Buffer[i]));
+    }
+    return result;
+}
+
+std::string routineName (void* Routine)
+{
+    Dl_info info = {};
+    if ((::dladdr(Routine, &info) == 0) || (info.dli_sname == nullptr)) {
+        char buffer[32];
+        ::snprintf(buffer, sizeof(buffer), "thread@%p", Routine);
+        return buffer;
+    }
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = (status == 0) ? demangled : info.dli_sname;
+    ::free(demangled);
+    return name;
+}
+
+//
+// Time accounting
+//
+
+void account (Time Ns)
+{
+    if (g_inIsr) {
+        g_stats.IsrNs += Ns;
+    } else if (g_inDpc) {
+        g_stats.DpcNs += Ns;
+    } else if (cur() != &g_idle) {
+        cur()->BusyNs += Ns;
+        g_stats.ThreadNs += Ns;
+    }
+}
+
+void runDevices ()
+{
+    if (g_inRunDevices) {
+        return;
+    }
+    g_inRunDevices = true;
+    for (int pass = 0; pass < 1000; ++pass) {
+        bool progress = false;
+        for (Device* devicePtr : g_devices) {
+            progress |= devicePtr->Run(g_now);
+        }
+        if (!progress) {
+            break;
+        }
+    }
+    g_inRunDevices = false;
+}
+
+Time nextDeviceEvent ()
+{
+    Time next = NEVER;
+    for (const Device* devicePtr : g_devices) {
+        next = std::min(next, devicePtr->NextEvent());
+    }
+    return next;
+}
+
+bool interruptPending ()
+{
+    for (const Interrupt& interrupt : g_interrupts) {
+        if (interrupt.DevicePtr->Irq()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+} // namespace sim
+
+//
+// EX_TIMER lives outside the anonymous namespace to complete the WDK's
+// opaque type
+//
+struct _EX_TIMER {
+    PEXT_CALLBACK Callback;
+    PVOID Context;
+    ULONG Attributes;
+    sim::Time Due;
+    sim::Time Period;
+    bool Armed;
+    KDPC Dpc;
+};
+
+namespace sim {
+namespace {
+
+std::vector<_EX_TIMER*> g_timers;
+
+Time nextTimerDue ()
+{
+    Time next = NEVER;
+    for (const _EX_TIMER* timerPtr : g_timers) {
+        if (timerPtr->Armed) {
+            next = std::min(next, timerPtr->Due);
+        }
+    }
+    return next;
+}
+
+void fireTimers ()
+{
+    for (_EX_TIMER* timerPtr : g_timers) {
+        if (!timerPtr->Armed || (timerPtr->Due > g_now)) {
+            continue;
+        }
+        if (timerPtr->Period != 0) {
+            timerPtr->Due += timerPtr->Period;
+        } else {
+            timerPtr->Armed = false;
+        }
+        KeInsertQueueDpc(&timerPtr->Dpc, nullptr, nullptr);
+    }
+}
+
+void deliverInterrupts ()
+{
+    if (g_inIsr || (cur()->Irql >= DEVICE_IRQL)) {
+        return;
+    }
+    for (int pass = 0; pass < 16; ++pass) {
+        bool delivered = false;
+        for (const Interrupt& interrupt : g_interrupts) {
+            runDevices();
+            if (!interrupt.DevicePtr->Irq()) {
+                continue;
+            }
+            delivered = true;
+
+            KIRQL oldIrql = cur()->Irql;
+            bool wasInDpc = g_inDpc;
+            cur()->Irql = DEVICE_IRQL;
+            g_inIsr = true;
+            g_inDpc = false;
+
+            ++g_stats.IsrCount;
+            g_now += g_costs.IsrEntry;
+            g_stats.IsrNs += g_costs.IsrEntry;
+            (void)interrupt.Isr(interrupt.Context);
+
+            g_inIsr = false;
+            g_inDpc = wasInDpc;
+            cur()->Irql = oldIrql;
+        }
+        if (!delivered) {
+            break;
+        }
+    }
+}
+
+void deliverDpcs ()
+{
+    if (g_inIsr || g_inDpc || (cur()->Irql >= DISPATCH_LEVEL)) {
+        return;
+    }
+    while (!g_dpcQueue.empty()) {
+        KDPC* dpcPtr = g_dpcQueue.front();
+        g_dpcQueue.pop_front();
+        dpcPtr->Queued = 0;
+
+        KIRQL oldIrql = cur()->Irql;
+        cur()->Irql = DISPATCH_LEVEL;
+        g_inDpc = true;
+
+        ++g_stats.DpcCount;
+        g_now += g_costs.DpcEntry;
+        g_stats.DpcNs += g_costs.DpcEntry;
+        dpcPtr->DeferredRoutine(
+            dpcPtr,
+            dpcPtr->DeferredContext,
+            dpcPtr->SystemArgument1,
+            dpcPtr->SystemArgument2);
+
+        g_inDpc = false;
+        cur()->Irql = oldIrql;
+        runDevices();
+        deliverInterrupts();
+    }
+}
+
+void poll ()
+{
+    runDevices();
+    if (g_now >= nextTimerDue()) {
+        fireTimers();
+    }
+    if (g_now >= g_nextDeadline) {
+        evaluateWaits();
+    }
+    deliverInterrupts();
+    deliverDpcs();
+}
+
+//
+// Waits
+//
+
+bool isSignaled (const DISPATCHER_HEADER* HeaderPtr)
+{
+    return HeaderPtr->SignalState > 0;
+}
+
+void consume (DISPATCHER_HEADER* HeaderPtr)
+{
+    if (HeaderPtr->Type == OBJECT_SYNCHRONIZATION_EVENT) {
+        HeaderPtr->SignalState = 0;
+    }
+}
+
+//
+// Returns true and sets WaitStatus if the wait of ThreadPtr is satisfied
+// by the current state of its objects, consuming synchronization events
+//
+bool trySatisfy (Thread* ThreadPtr)
+{
+    std::vector<DISPATCHER_HEADER*>& objects = ThreadPtr->WaitObjects;
+    if (objects.empty()) {
+        return false;
+    }
+    if (ThreadPtr->WaitType == WaitAny) {
+        for (size_t i = 0; i < objects.size(); ++i) {
+            if (isSignaled(objects[i])) {
+                consume(objects[i]);
+                ThreadPtr->WaitStatus = NTSTATUS(STATUS_WAIT_0 + i);
+                return true;
+            }
+        }
+        return false;
+    }
+    for (const DISPATCHER_HEADER* headerPtr : objects) {
+        if (!isSignaled(headerPtr)) {
+            return false;
+        }
+    }
+    for (DISPATCHER_HEADER* headerPtr : objects) {
+        consume(headerPtr);
+    }
+    ThreadPtr->WaitStatus = STATUS_SUCCESS;
+    return true;
+}
+
+void makeReady (Thread* ThreadPtr)
+{
+    ThreadPtr->State = Thread::Ready;
+    ThreadPtr->ReadySeq = ++g_seq;
+}
+
+void evaluateWaits ()
+{
+    std::vector<Thread*> waiters;
+    for (Thread* threadPtr : g_threads) {
+        if (threadPtr->State == Thread::Waiting) {
+            waiters.push_back(threadPtr);
+        }
+    }
+    std::sort(
+        waiters.begin(),
+        waiters.end(),
+        [] (const Thread* A, const Thread* B) { return A->WaitSeq < B->WaitSeq; });
+
+    g_nextDeadline = NEVER;
+    for (Thread* threadPtr : waiters) {
+        if (trySatisfy(threadPtr)) {
+            makeReady(threadPtr);
+        } else if (g_now >= threadPtr->Deadline) {
+            threadPtr->WaitStatus = STATUS_TIMEOUT;
+            makeReady(threadPtr);
+        } else {
+            g_nextDeadline = std::min(g_nextDeadline, threadPtr->Deadline);
+        }
+    }
+}
+
+Time deadlineOf (const LARGE_INTEGER* TimeoutPtr, bool HighResolution)
+{
+    if (TimeoutPtr == nullptr) {
+        return NEVER;
+    }
+    Time relative = (TimeoutPtr->QuadPart < 0) ?
+        -TimeoutPtr->QuadPart * 100 :
+        TimeoutPtr->QuadPart * 100 - g_now;
+    Time deadline = g_now + std::max<Time>(relative, 0);
+    if (!HighResolution) {
+        //
+        // Regular timeouts expire on the clock tick
+        //
+        Time tick = Time(g_timerResolution) * 100;
+        deadline = ((deadline + tick - 1) / tick) * tick;
+    }
+    return deadline;
+}
+
+//
+// Scheduling
+//
+
+Thread* pickReady (const Thread* Self, bool Yield)
+{
+    Thread* bestPtr = nullptr;
+    for (Thread* threadPtr : g_threads) {
+        if ((threadPtr == Self) || (threadPtr->State != Thread::Ready)) {
+            continue;
+        }
+        if (Yield && (threadPtr->Priority < Self->Priority)) {
+            continue;
+        }
+        if ((bestPtr == nullptr) ||
+            (threadPtr->Priority > bestPtr->Priority) ||
+            ((threadPtr->Priority == bestPtr->Priority) &&
+             (threadPtr->ReadySeq < bestPtr->ReadySeq))) {
+
+            bestPtr = threadPtr;
+        }
+    }
+    return bestPtr;
+}
+
+void dumpThreads ()
+{
+    for (const Thread* threadPtr : g_threads) {
+        ::fprintf(
+            stderr,
+            "sim:   %-40s state %d irql %u objects %zu deadline %lld\n",
+            threadPtr->Name.c_str(),
+            int(threadPtr->State),
+            unsigned(threadPtr->Irql),
+            threadPtr->WaitObjects.size(),
+            (long long)threadPtr->Deadline);
+    }
+}
+
+//
+// Advance the clock to the next event while no thread can run
+//
+void idleStep (Thread* Self)
+{
+    static Time lastNow = -1;
+    static int stallCount;
+
+    t_ctx = &g_idle;
+    Time next = std::min(nextDeviceEvent(), nextTimerDue());
+    next = std::min(next, g_nextDeadline);
+    if (!g_dpcQueue.empty() || interruptPending()) {
+        next = g_now;
+    }
+    if (next == NEVER) {
+        ::fprintf(stderr, "sim: deadlock, all threads waiting without timeout\n");
+        dumpThreads();
+        fatal("deadlock");
+    }
+    if (next > g_now) {
+        g_now = next;
+    }
+    if (g_now == lastNow) {
+        if (++stallCount > STALL_LIMIT) {
+            dumpThreads();
+            fatal("no progress, interrupt storm or device stuck at its next event");
+        }
+    } else {
+        lastNow = g_now;
+        stallCount = 0;
+    }
+    poll();
+    evaluateWaits();
+    t_ctx = Self;
+}
+
+void switchTo (Thread* Self, Thread* Next)
+{
+    ++g_stats.SwitchCount;
+    g_now += g_costs.ContextSwitch;
+    g_stats.SwitchNs += g_costs.ContextSwitch;
+
+    g_running = Next;
+    Next->Cv.notify_one();
+    if (Self->State == Thread::Terminated) {
+        return;
+    }
+    Self->Cv.wait(*Self->Lock, [Self] { return g_running == Self; });
+    t_ctx = Self;
+}
+
+void reschedule (Thread* Self, bool Yield)
+{
+    for (;;) {
+        evaluateWaits();
+        if ((Self->State == Thread::Ready) && !Yield) {
+            return;
+        }
+        Thread* nextPtr = pickReady(Self, Yield);
+        if (nextPtr != nullptr) {
+            switchTo(Self, nextPtr);
+            return;
+        }
+        if (Self->State == Thread::Ready) {
+            return;
+        }
+        idleStep(Self);
+    }
+}
+
+void yield ()
+{
+    Thread* selfPtr = cur();
+    if (g_inIsr || g_inDpc || (selfPtr->Irql >= DISPATCH_LEVEL) || (selfPtr == &g_idle)) {
+        return;
+    }
+    reschedule(selfPtr, true);
+}
+
+NTSTATUS waitFor (
+    ULONG Count,
+    DISPATCHER_HEADER** Objects,
+    WAIT_TYPE WaitType,
+    const LARGE_INTEGER* TimeoutPtr,
+    bool HighResolution
+    )
+{
+    Thread* selfPtr = cur();
+    selfPtr->WaitObjects.assign(Objects, Objects + Count);
+    selfPtr->WaitType = WaitType;
+    if (trySatisfy(selfPtr)) {
+        selfPtr->WaitObjects.clear();
+        return selfPtr->WaitStatus;
+    }
+    if ((TimeoutPtr != nullptr) && (TimeoutPtr->QuadPart == 0)) {
+        selfPtr->WaitObjects.clear();
+        return STATUS_TIMEOUT;
+    }
+    if (g_inIsr || g_inDpc || (selfPtr->Irql >= DISPATCH_LEVEL) || (selfPtr == &g_idle)) {
+        fatal("blocking wait at IRQL %u", unsigned(selfPtr->Irql));
+    }
+
+    selfPtr->Deadline = deadlineOf(TimeoutPtr, HighResolution);
+    selfPtr->State = Thread::Waiting;
+    selfPtr->WaitSeq = ++g_seq;
+    g_nextDeadline = std::min(g_nextDeadline, selfPtr->Deadline);
+
+    reschedule(selfPtr, false);
+
+    selfPtr->WaitObjects.clear();
+    selfPtr->Deadline = NEVER;
+    return selfPtr->WaitStatus;
+}
+
+void threadEntry (Thread* ThreadPtr)
+{
+    std::unique_lock<std::mutex> lock(g_lock);
+    ThreadPtr->Lock = &lock;
+    ThreadPtr->Cv.wait(lock, [ThreadPtr] { return g_running == ThreadPtr; });
+    t_ctx = ThreadPtr;
+
+    if (setjmp(ThreadPtr->ExitJump) == 0) {
+        ThreadPtr->Routine(ThreadPtr->Context);
+    }
+
+    ThreadPtr->State = Thread::Terminated;
+    ThreadPtr->Object.Header.SignalState = 1;
+    ThreadPtr->Irql = PASSIVE_LEVEL;
+    reschedule(ThreadPtr, false);
+}
+
+//
+// Memory
+//
+
+void* arenaAllocate (size_t Length, size_t Alignment, bool Uncached)
+{
+    Length = std::max<size_t>((Length + 15) & ~size_t(15), 16);
+    for (auto it = g_free.begin(); it != g_free.end(); ++it) {
+        size_t start = (it->first + Alignment - 1) & ~(Alignment - 1);
+        size_t end = it->first + it->second;
+        if (start + Length > end) {
+            continue;
+        }
+        size_t blockStart = it->first;
+        g_free.erase(it);
+        if (start > blockStart) {
+            g_free[blockStart] = start - blockStart;
+        }
+        if (end > start + Length) {
+            g_free[start + Length] = end - (start + Length);
+        }
+        g_allocations[start] = Allocation{ Length, Uncached };
+        return g_arena + start;
+    }
+    return nullptr;
+}
+
+void arenaFree (void* Address)
+{
+    size_t offset = static_cast<uint8_t*>(Address) - g_arena;
+    auto it = g_allocations.find(offset);
+    if (it == g_allocations.end()) {
+        fatal("free of unknown address %p", Address);
+    }
+    size_t length = it->second.Length;
+    g_allocations.erase(it);
+
+    auto next = g_free.lower_bound(offset);
+    if ((next != g_free.end()) && (next->first == offset + length)) {
+        length += next->second;
+        next = g_free.erase(next);
+    }
+    if (next != g_free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += length;
+            return;
+        }
+    }
+    g_free[offset] = length;
+}
+
+bool isArena (const void* Address)
+{
+    const uint8_t* bytePtr = static_cast<const uint8_t*>(Address);
+    return (bytePtr >= g_arena) && (bytePtr < g_arena + ARENA_SIZE);
+}
+
+bool isUncached (const void* Address)
+{
+    if (!isArena(Address)) {
+        return false;
+    }
+    size_t offset = static_cast<const uint8_t*>(Address) - g_arena;
+    auto it = g_allocations.upper_bound(offset);
+    if (it == g_allocations.begin()) {
+        return false;
+    }
+    --it;
+    return (offset < it->first + it->second.Length) && it->second.Uncached;
+}
+
+const Mapping* findMapping (volatile const void* Address)
+{
+    uintptr_t va = reinterpret_cast<uintptr_t>(Address);
+    auto it = g_mappings.upper_bound(va);
+    if (it == g_mappings.begin()) {
+        return nullptr;
+    }
+    --it;
+    if (va >= it->second.Va + it->second.Length) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+ULONG registerRead (volatile ULONG* Register, bool Fence)
+{
+    const Mapping* mappingPtr = findMapping(Register);
+    if (mappingPtr == nullptr) {
+        return *Register;
+    }
+    Charge(g_costs.RegisterRead + (Fence ? g_costs.RegisterFence : 0));
+    ++g_stats.RegisterReads;
+    ULONG offset = ULONG(reinterpret_cast<uintptr_t>(Register) - mappingPtr->Va);
+    ULONG value = mappingPtr->DevicePtr->Read(mappingPtr->DeviceOffset + offset);
+    poll();
+    return value;
+}
+
+void registerWrite (volatile ULONG* Register, ULONG Value, bool Fence)
+{
+    const Mapping* mappingPtr = findMapping(Register);
+    if (mappingPtr == nullptr) {
+        *Register = Value;
+        return;
+    }
+    Charge(g_costs.RegisterWrite + (Fence ? g_costs.RegisterFence : 0));
+    ++g_stats.RegisterWrites;
+    ULONG offset = ULONG(reinterpret_cast<uintptr_t>(Register) - mappingPtr->Va);
+    mappingPtr->DevicePtr->Write(mappingPtr->DeviceOffset + offset, Value);
+    poll();
+}
+
+} // namespace
+
+//
+// Harness interface
+//
+
+void Init (const Costs* CostsPtr)
+{
+    if (CostsPtr != nullptr) {
+        g_costs = *CostsPtr;
+    }
+    void* arenaPtr = ::mmap(
+        nullptr,
+        ARENA_SIZE,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0);
+    if (arenaPtr == MAP_FAILED) {
+        fatal("cannot reserve the physical memory arena");
+    }
+    g_arena = static_cast<uint8_t*>(arenaPtr);
+    g_free[0] = ARENA_SIZE;
+
+    g_main = new Thread("bench");
+    g_main->Lock = new std::unique_lock<std::mutex>(g_lock);
+    g_threads.push_back(g_main);
+    g_running = g_main;
+    t_ctx = g_main;
+}
+
+void Shutdown ()
+{
+    for (Thread* threadPtr : g_threads) {
+        if (threadPtr == g_main) {
+            continue;
+        }
+        if (threadPtr->State == Thread::Terminated) {
+            //
+            // The terminated thread may still be on its way out of
+            // reschedule(), it needs the lock to get there
+            //
+            g_main->Lock->unlock();
+            threadPtr->Host.join();
+            g_main->Lock->lock();
+        } else {
+            threadPtr->Host.detach();
+        }
+    }
+}
+
+Time Now ()
+{
+    return g_now;
+}
+
+void Charge (Time Nanoseconds)
+{
+    if (Nanoseconds > 0) {
+        account(Nanoseconds);
+    }
+
+    //
+    // Step through device events on the way so that devices react to each
+    // other, and interrupts land, at the right time during a long charge
+    //
+    Time target = g_now + std::max<Time>(Nanoseconds, 0);
+    int stallCount = 0;
+    for (;;) {
+        Time before = g_now;
+        Time next = std::min(nextDeviceEvent(), target);
+        next = std::min(next, nextTimerDue());
+        if (next > g_now) {
+            g_now = std::min(next, target);
+        }
+        poll();
+        if (g_now >= target) {
+            break;
+        }
+        if ((g_now == before) && (++stallCount > STALL_LIMIT)) {
+            fatal("device stuck at its next event");
+        }
+    }
+}
+
+void SetVerbosity (ULONG TraceLevel)
+{
+    g_verbosity = TraceLevel;
+}
+
+void SetTimerResolution (ULONG CurrentTime100ns)
+{
+    g_timerResolution = std::min(
+        std::max(CurrentTime100ns, MINIMUM_TIMER_RESOLUTION),
+        MAXIMUM_TIMER_RESOLUTION);
+}
+
+const Stats& GetStats ()
+{
+    return g_stats;
+}
+
+std::vector<std::pair<std::string, Time>> GetThreadBusy ()
+{
+    std::vector<std::pair<std::string, Time>> result;
+    for (const Thread* threadPtr : g_threads) {
+        result.emplace_back(threadPtr->Name, threadPtr->BusyNs);
+    }
+    return result;
+}
+
+void MapDevice (uint64_t PhysicalAddress, ULONG Length, Device* DevicePtr)
+{
+    g_regions[PhysicalAddress] = Region{ PhysicalAddress, Length, DevicePtr };
+    if (std::find(g_devices.begin(), g_devices.end(), DevicePtr) == g_devices.end()) {
+        g_devices.push_back(DevicePtr);
+    }
+}
+
+void ConnectInterrupt (Device* DevicePtr, IsrRoutine* Isr, void* Context)
+{
+    g_interrupts.push_back(Interrupt{ DevicePtr, Isr, Context });
+}
+
+void ConnectDreq (ULONG Permap, Device* DevicePtr)
+{
+    g_dreqs[Permap] = DevicePtr;
+}
+
+bool DreqAsserted (ULONG Permap)
+{
+    if (Permap == 0) {
+        return true;
+    }
+    auto it = g_dreqs.find(Permap);
+    return (it != g_dreqs.end()) && it->second->Dreq();
+}
+
+void* AllocatePhysical (size_t Length, bool Uncached)
+{
+    void* addressPtr = arenaAllocate(Length, PAGE_SIZE, Uncached);
+    if (addressPtr != nullptr) {
+        ::memset(addressPtr, 0, Length);
+    }
+    return addressPtr;
+}
+
+void FreePhysical (void* Address)
+{
+    arenaFree(Address);
+}
+
+uint64_t PhysicalAddressOf (const void* Address)
+{
+    if (!isArena(Address)) {
+        fatal("%p has no physical address", Address);
+    }
+    return ARENA_PHYSICAL_BASE + (static_cast<const uint8_t*>(Address) - g_arena);
+}
+
+void* HostAddressOf (uint64_t PhysicalAddress, size_t Length)
+{
+    if ((PhysicalAddress < ARENA_PHYSICAL_BASE) ||
+        (PhysicalAddress + Length > ARENA_PHYSICAL_BASE + ARENA_SIZE)) {
+
+        return nullptr;
+    }
+    return g_arena + (PhysicalAddress - ARENA_PHYSICAL_BASE);
+}
+
+Device* DeviceAt (uint64_t PhysicalAddress, ULONG* OffsetPtr)
+{
+    auto it = g_regions.upper_bound(PhysicalAddress);
+    if (it == g_regions.begin()) {
+        return nullptr;
+    }
+    --it;
+    if (PhysicalAddress >= it->second.Physical + it->second.Length) {
+        return nullptr;
+    }
+    *OffsetPtr = ULONG(PhysicalAddress - it->second.Physical);
+    return it->second.DevicePtr;
+}
+
+void SetRegistryDword (const char* Name, ULONG Value)
+{
+    g_registry[Name] = Value;
+}
+
+DEVICE_OBJECT* FindDeviceObject (const char* Name)
+{
+    for (const auto& entry : g_deviceNames) {
+        if (entry.second == Name) {
+            return entry.first;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace sim
+
+using namespace sim;
+
+extern "C" {
+
+//
+// Harness hooks
+//
+
+void SimAssertionFailure (PCSTR Expression, PCSTR File, int Line)
+{
+    ++g_stats.AssertionCount;
+    ::fprintf(
+        stderr,
+        "[%12.3f us] ASSERTION FAILED: %s (%s:%d)\n",
+        double(g_now) / NS_PER_US,
+        Expression,
+        File,
+        Line);
+}
+
+void SimTraceMessage (ULONG Level, PCSTR Function, PCSTR Format)
+{
+    ++g_stats.TraceCount[std::min<ULONG>(Level, TRACE_LEVEL_VERBOSE)];
+    if (Level <= g_verbosity) {
+        ::fprintf(
+            stderr,
+            "[%12.3f us] %u %s: %s\n",
+            double(g_now) / NS_PER_US,
+            unsigned(Level),
+            Function,
+            Format);
+    }
+}
+
+void SimCopyMemory (void* Destination, const void* Source, SIZE_T Length)
+{
+    ::memmove(Destination, Source, Length);
+    double nsPerByte = g_costs.CachedCopyNsPerByte;
+    if (isUncached(Source)) {
+        nsPerByte = std::max(nsPerByte, g_costs.UncachedReadNsPerByte);
+    }
+    if (isUncached(Destination)) {
+        nsPerByte = std::max(nsPerByte, g_costs.UncachedWriteNsPerByte);
+    }
+    Charge(Time(nsPerByte * double(Length)));
+}
+
+void SimZeroMemory (void* Destination, SIZE_T Length)
+{
+    ::memset(Destination, 0, Length);
+    Charge(Time(Length / 4));
+}
+
+SIZE_T RtlCompareMemory (const void* Source1, const void* Source2, SIZE_T Length)
+{
+    const UCHAR* aPtr = static_cast<const UCHAR*>(Source1);
+    const UCHAR* bPtr = static_cast<const UCHAR*>(Source2);
+    SIZE_T i = 0;
+    while ((i < Length) && (aPtr[i] == bPtr[i])) {
+        ++i;
+    }
+    return i;
+}
+
+VOID RtlInitUnicodeString (PUNICODE_STRING DestinationString, PCWSTR SourceString)
+{
+    USHORT length = 0;
+    if (SourceString != nullptr) {
+        while (SourceString[length] != 0) {
+            ++length;
+        }
+    }
+    DestinationString->Buffer = const_cast<PWSTR>(SourceString);
+    DestinationString->Length = USHORT(length * sizeof(WCHAR));
+    DestinationString->MaximumLength = USHORT((length + 1) * sizeof(WCHAR));
+}
+
+//
+// Format strings may carry WPP or %!STATUS! style specifiers that printf
+// does not know, so only the raw format is printed
+//
+ULONG DbgPrint (PCSTR Format, ...)
+{
+    if (g_verbosity >= TRACE_LEVEL_VERBOSE) {
+        ::fputs(Format, stderr);
+    }
+    return 0;
+}
+
+ULONG DbgPrintEx (ULONG /* ComponentId */, ULONG /* Level */, PCSTR Format, ...)
+{
+    if (g_verbosity >= TRACE_LEVEL_VERBOSE) {
+        ::fputs(Format, stderr);
+    }
+    return 0;
+}
+
+ULONG vDbgPrintEx (ULONG /* ComponentId */, ULONG /* Level */, PCSTR Format, va_list /* ArgList */)
+{
+    if (g_verbosity >= TRACE_LEVEL_VERBOSE) {
+        ::fputs(Format, stderr);
+    }
+    return 0;
+}
+
+//
+// Register access
+//
+
+ULONG READ_REGISTER_ULONG (volatile ULONG* Register)
+{
+    return registerRead(Register, true);
+}
+
+ULONG READ_REGISTER_NOFENCE_ULONG (volatile ULONG* Register)
+{
+    return registerRead(Register, false);
+}
+
+VOID WRITE_REGISTER_ULONG (volatile ULONG* Register, ULONG Value)
+{
+    registerWrite(Register, Value, true);
+}
+
+VOID WRITE_REGISTER_NOFENCE_ULONG (volatile ULONG* Register, ULONG Value)
+{
+    registerWrite(Register, Value, false);
+}
+
+//
+// The buffer variants fence once around the whole run, the NOFENCE ones
+// not at all
+//
+VOID READ_REGISTER_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count)
+{
+    for (ULONG i = 0; i < Count; ++i) {
+        Buffer[i] = registerRead(Register, i == 0);
+    }
+}
+
+VOID WRITE_REGISTER_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count)
+{
+    for (ULONG i = 0; i < Count; ++i) {
+        registerWrite(Register, Buffer[i], i == 0);
+    }
+}
+
+VOID READ_REGISTER_NOFENCE_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count)
+{
+    for (ULONG i = 0; i < Count; ++i) {
+        Buffer[i] = registerRead(Register, false);
+    }
+}
+
+VOID WRITE_REGISTER_NOFENCE_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count)
+{
+    for (ULONG i = 0; i < Count; ++i) {
+        registerWrite(Register, Buffer[i], false);
+    }
+}
+
+//
+// Time, IRQL and processors
+//
+
+LARGE_INTEGER KeQueryPerformanceCounter (PLARGE_INTEGER PerformanceFrequency)
+{
+    if (PerformanceFrequency != nullptr) {
+        PerformanceFrequency->QuadPart = PERFORMANCE_FREQUENCY;
+    }
+    LARGE_INTEGER counter;
+    counter.QuadPart = LONGLONG((__int128(g_now) * PERFORMANCE_FREQUENCY) / 1000000000);
+    return counter;
+}
+
+ULONGLONG KeQueryInterruptTime (VOID)
+{
+    return ULONGLONG(g_now / 100);
+}
+
+ULONGLONG KeQueryInterruptTimePrecise (PULONGLONG QpcTimeStamp)
+{
+    if (QpcTimeStamp != nullptr) {
+        *QpcTimeStamp = ULONGLONG(KeQueryPerformanceCounter(nullptr).QuadPart);
+    }
+    return KeQueryInterruptTime();
+}
+
+VOID KeQuerySystemTime (PLARGE_INTEGER CurrentTime)
+{
+    //
+    // 2020-01-01 in 100ns units since 1601
+    //
+    CurrentTime->QuadPart = 132223104000000000LL + g_now / 100;
+}
+
+VOID KeQuerySystemTimePrecise (PLARGE_INTEGER CurrentTime)
+{
+    KeQuerySystemTime(CurrentTime);
+}
+
+VOID KeStallExecutionProcessor (ULONG MicroSeconds)
+{
+    Charge(Time(MicroSeconds) * NS_PER_US);
+    yield();
+}
+
+NTSTATUS KeDelayExecutionThread (
+    KPROCESSOR_MODE /* WaitMode */,
+    BOOLEAN /* Alertable */,
+    PLARGE_INTEGER Interval
+    )
+{
+    (void)waitFor(0, nullptr, WaitAny, Interval, false);
+    return STATUS_SUCCESS;
+}
+
+VOID ExQueryTimerResolution (PULONG MaximumTime, PULONG MinimumTime, PULONG CurrentTime)
+{
+    *MaximumTime = MAXIMUM_TIMER_RESOLUTION;
+    *MinimumTime = MINIMUM_TIMER_RESOLUTION;
+    *CurrentTime = g_timerResolution;
+}
+
+ULONG ExSetTimerResolution (ULONG DesiredTime, BOOLEAN SetResolution)
+{
+    if (SetResolution) {
+        SetTimerResolution(DesiredTime);
+    }
+    return g_timerResolution;
+}
+
+KIRQL KeGetCurrentIrql (VOID)
+{
+    return cur()->Irql;
+}
+
+KIRQL KfRaiseIrql (KIRQL NewIrql)
+{
+    KIRQL oldIrql = cur()->Irql;
+    if (NewIrql < oldIrql) {
+        fatal("KfRaiseIrql %u -> %u", unsigned(oldIrql), unsigned(NewIrql));
+    }
+    cur()->Irql = NewIrql;
+    return oldIrql;
+}
+
+VOID KeLowerIrql (KIRQL NewIrql)
+{
+    if (NewIrql > cur()->Irql) {
+        fatal("KeLowerIrql %u -> %u", unsigned(cur()->Irql), unsigned(NewIrql));
+    }
+    cur()->Irql = NewIrql;
+    poll();
+}
+
+KIRQL KeRaiseIrqlToDpcLevel (VOID)
+{
+    return KfRaiseIrql(DISPATCH_LEVEL);
+}
+
+ULONG KeQueryActiveProcessorCountEx (USHORT /* GroupNumber */)
+{
+    return 4;
+}
+
+ULONG KeGetCurrentProcessorNumberEx (PPROCESSOR_NUMBER ProcNumber)
+{
+    //
+    // Interrupts, DPCs and idle run on processor 0, a thread runs on the
+    // lowest processor its affinity allows
+    //
+    ULONG number = 0;
+    if (!g_inIsr && !g_inDpc && (cur() != &g_idle) && (cur()->Affinity != 0)) {
+        number = ULONG(__builtin_ctzll(cur()->Affinity));
+    }
+    if (ProcNumber != nullptr) {
+        ProcNumber->Group = 0;
+        ProcNumber->Number = UCHAR(number);
+        ProcNumber->Reserved = 0;
+    }
+    return number;
+}
+
+KAFFINITY KeSetSystemAffinityThreadEx (KAFFINITY Affinity)
+{
+    KAFFINITY oldAffinity = cur()->Affinity;
+    cur()->Affinity = Affinity;
+    return oldAffinity;
+}
+
+VOID KeRevertToUserAffinityThreadEx (KAFFINITY Affinity)
+{
+    cur()->Affinity = Affinity;
+}
+
+//
+// Synchronization
+//
+
+VOID KeInitializeEvent (PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State)
+{
+    Event->Header.Type = (Type == SynchronizationEvent) ?
+        OBJECT_SYNCHRONIZATION_EVENT : OBJECT_NOTIFICATION_EVENT;
+    Event->Header.SignalState = State ? 1 : 0;
+    Event->Header.SimWaitList = nullptr;
+}
+
+LONG KeSetEvent (PRKEVENT Event, KPRIORITY /* Increment */, BOOLEAN /* Wait */)
+{
+    LONG oldState = Event->Header.SignalState;
+    Event->Header.SignalState = 1;
+    evaluateWaits();
+    return oldState;
+}
+
+VOID KeClearEvent (PRKEVENT Event)
+{
+    Event->Header.SignalState = 0;
+}
+
+LONG KeResetEvent (PRKEVENT Event)
+{
+    LONG oldState = Event->Header.SignalState;
+    Event->Header.SignalState = 0;
+    return oldState;
+}
+
+LONG KeReadStateEvent (PRKEVENT Event)
+{
+    return Event->Header.SignalState;
+}
+
+NTSTATUS KeWaitForSingleObject (
+    PVOID Object,
+    KWAIT_REASON /* WaitReason */,
+    KPROCESSOR_MODE /* WaitMode */,
+    BOOLEAN /* Alertable */,
+    PLARGE_INTEGER Timeout
+    )
+{
+    DISPATCHER_HEADER* headerPtr = static_cast<DISPATCHER_HEADER*>(Object);
+    return waitFor(1, &headerPtr, WaitAny, Timeout, false);
+}
+
+NTSTATUS KeWaitForMultipleObjects (
+    ULONG Count,
+    PVOID Object[],
+    WAIT_TYPE WaitType,
+    KWAIT_REASON /* WaitReason */,
+    KPROCESSOR_MODE /* WaitMode */,
+    BOOLEAN /* Alertable */,
+    PLARGE_INTEGER Timeout,
+    PKWAIT_BLOCK /* WaitBlockArray */
+    )
+{
+    if ((Count > MAXIMUM_WAIT_OBJECTS) || (Count == 0)) {
+        fatal("KeWaitForMultipleObjects count %u", unsigned(Count));
+    }
+    DISPATCHER_HEADER* headers[MAXIMUM_WAIT_OBJECTS];
+    for (ULONG i = 0; i < Count; ++i) {
+        headers[i] = static_cast<DISPATCHER_HEADER*>(Object[i]);
+    }
+    return waitFor(Count, headers, WaitType, Timeout, false);
+}
+
+//
+// With a single CPU a spin lock can never be contended, finding one held
+// means a missing release or a lock taken at the wrong IRQL
+//
+
+VOID KeInitializeSpinLock (PKSPIN_LOCK SpinLock)
+{
+    *SpinLock = 0;
+}
+
+VOID KeAcquireSpinLockAtDpcLevel (PKSPIN_LOCK SpinLock)
+{
+    if (*SpinLock != 0) {
+        fatal("spin lock %p already held", static_cast<void*>(SpinLock));
+    }
+    *SpinLock = 1;
+}
+
+VOID KeReleaseSpinLockFromDpcLevel (PKSPIN_LOCK SpinLock)
+{
+    if (*SpinLock == 0) {
+        fatal("spin lock %p not held", static_cast<void*>(SpinLock));
+    }
+    *SpinLock = 0;
+}
+
+KIRQL KeAcquireSpinLockRaiseToDpc (PKSPIN_LOCK SpinLock)
+{
+    KIRQL oldIrql = KfRaiseIrql(std::max<KIRQL>(cur()->Irql, DISPATCH_LEVEL));
+    KeAcquireSpinLockAtDpcLevel(SpinLock);
+    return oldIrql;
+}
+
+VOID KeReleaseSpinLock (PKSPIN_LOCK SpinLock, KIRQL NewIrql)
+{
+    KeReleaseSpinLockFromDpcLevel(SpinLock);
+    KeLowerIrql(NewIrql);
+}
+
+VOID KeAcquireInStackQueuedSpinLock (PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    LockHandle->LockPtr = SpinLock;
+    LockHandle->OldIrql = KeAcquireSpinLockRaiseToDpc(SpinLock);
+}
+
+VOID KeReleaseInStackQueuedSpinLock (PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    KeReleaseSpinLock(LockHandle->LockPtr, LockHandle->OldIrql);
+}
+
+VOID KeAcquireInStackQueuedSpinLockAtDpcLevel (PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    LockHandle->LockPtr = SpinLock;
+    KeAcquireSpinLockAtDpcLevel(SpinLock);
+}
+
+VOID KeReleaseInStackQueuedSpinLockFromDpcLevel (PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    KeReleaseSpinLockFromDpcLevel(LockHandle->LockPtr);
+}
+
+VOID ExInitializeFastMutex (PFAST_MUTEX FastMutex)
+{
+    FastMutex->Count = 1;
+    FastMutex->Owner = nullptr;
+    FastMutex->Contention = 0;
+    KeInitializeEvent(&FastMutex->Event, SynchronizationEvent, FALSE);
+}
+
+VOID ExAcquireFastMutex (PFAST_MUTEX FastMutex)
+{
+    KIRQL oldIrql = KfRaiseIrql(std::max<KIRQL>(cur()->Irql, APC_LEVEL));
+    while (FastMutex->Count <= 0) {
+        ++FastMutex->Contention;
+        KIRQL waitIrql = cur()->Irql;
+        cur()->Irql = oldIrql;
+        (void)KeWaitForSingleObject(&FastMutex->Event, Executive, KernelMode, FALSE, nullptr);
+        cur()->Irql = waitIrql;
+    }
+    FastMutex->Count = 0;
+    FastMutex->Owner = cur();
+    FastMutex->OldIrql = oldIrql;
+}
+
+VOID ExReleaseFastMutex (PFAST_MUTEX FastMutex)
+{
+    if (FastMutex->Owner != cur()) {
+        fatal("fast mutex %p released by a non owner", static_cast<void*>(FastMutex));
+    }
+    KIRQL oldIrql = KIRQL(FastMutex->OldIrql);
+    FastMutex->Owner = nullptr;
+    FastMutex->Count = 1;
+    KeSetEvent(&FastMutex->Event, 0, FALSE);
+    KeLowerIrql(oldIrql);
+}
+
+//
+// DPCs and timers
+//
+
+VOID KeInitializeDpc (PRKDPC Dpc, PKDEFERRED_ROUTINE DeferredRoutine, PVOID DeferredContext)
+{
+    Dpc->DeferredRoutine = DeferredRoutine;
+    Dpc->DeferredContext = DeferredContext;
+    Dpc->SystemArgument1 = nullptr;
+    Dpc->SystemArgument2 = nullptr;
+    Dpc->Queued = 0;
+}
+
+BOOLEAN KeInsertQueueDpc (PRKDPC Dpc, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    if (Dpc->Queued != 0) {
+        return FALSE;
+    }
+    Dpc->Queued = 1;
+    Dpc->SystemArgument1 = SystemArgument1;
+    Dpc->SystemArgument2 = SystemArgument2;
+    g_dpcQueue.push_back(Dpc);
+    return TRUE;
+}
+
+BOOLEAN KeRemoveQueueDpc (PRKDPC Dpc)
+{
+    if (Dpc->Queued == 0) {
+        return FALSE;
+    }
+    g_dpcQueue.erase(std::find(g_dpcQueue.begin(), g_dpcQueue.end(), Dpc));
+    Dpc->Queued = 0;
+    return TRUE;
+}
+
+static VOID exTimerDpc (PKDPC /* Dpc */, PVOID DeferredContext, PVOID, PVOID)
+{
+    _EX_TIMER* timerPtr = static_cast<_EX_TIMER*>(DeferredContext);
+    timerPtr->Callback(timerPtr, timerPtr->Context);
+}
+
+PEX_TIMER ExAllocateTimer (PEXT_CALLBACK Callback, PVOID CallbackContext, ULONG Attributes)
+{
+    _EX_TIMER* timerPtr = new _EX_TIMER();
+    timerPtr->Callback = Callback;
+    timerPtr->Context = CallbackContext;
+    timerPtr->Attributes = Attributes;
+    KeInitializeDpc(&timerPtr->Dpc, exTimerDpc, timerPtr);
+    g_timers.push_back(timerPtr);
+    return timerPtr;
+}
+
+BOOLEAN ExSetTimer (PEX_TIMER Timer, LONGLONG DueTime, LONGLONG Period, PEXT_SET_PARAMETERS /* Parameters */)
+{
+    bool highResolution = (Timer->Attributes & EX_TIMER_HIGH_RESOLUTION) != 0;
+    BOOLEAN wasSet = Timer->Armed ? TRUE : FALSE;
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = DueTime;
+    Timer->Due = deadlineOf(&dueTime, highResolution);
+    if (highResolution) {
+        Timer->Due += g_costs.HighResTimerLatency;
+    }
+    Timer->Period = Period * 100;
+    Timer->Armed = true;
+    return wasSet;
+}
+
+BOOLEAN ExCancelTimer (PEX_TIMER Timer, PEXT_CANCEL_PARAMETERS /* Parameters */)
+{
+    BOOLEAN wasSet = Timer->Armed ? TRUE : FALSE;
+    Timer->Armed = false;
+    return wasSet;
+}
+
+BOOLEAN ExDeleteTimer (PEX_TIMER Timer, BOOLEAN /* Cancel */, BOOLEAN /* Wait */, PEXT_DELETE_PARAMETERS /* Parameters */)
+{
+    BOOLEAN wasSet = ExCancelTimer(Timer, nullptr);
+    (void)KeRemoveQueueDpc(&Timer->Dpc);
+    g_timers.erase(std::find(g_timers.begin(), g_timers.end(), Timer));
+    delete Timer;
+    return wasSet;
+}
+
+//
+// Threads
+//
+
+NTSTATUS PsCreateSystemThread (
+    PHANDLE ThreadHandle,
+    ULONG /* DesiredAccess */,
+    POBJECT_ATTRIBUTES /* ObjectAttributes */,
+    HANDLE /* ProcessHandle */,
+    PVOID /* ClientId */,
+    PKSTART_ROUTINE StartRoutine,
+    PVOID StartContext
+    )
+{
+    Thread* threadPtr = new Thread(routineName(reinterpret_cast<void*>(StartRoutine)).c_str());
+    threadPtr->Routine = StartRoutine;
+    threadPtr->Context = StartContext;
+    makeReady(threadPtr);
+    g_threads.push_back(threadPtr);
+    threadPtr->Host = std::thread(threadEntry, threadPtr);
+    *ThreadHandle = &threadPtr->Object;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS PsTerminateSystemThread (NTSTATUS /* ExitStatus */)
+{
+    Thread* selfPtr = cur();
+    if (selfPtr->Routine == nullptr) {
+        fatal("PsTerminateSystemThread from a non system thread");
+    }
+    longjmp(selfPtr->ExitJump, 1);
+}
+
+PKTHREAD KeGetCurrentThread (VOID)
+{
+    return &cur()->Object;
+}
+
+KPRIORITY KeSetPriorityThread (PKTHREAD Thread, KPRIORITY Priority)
+{
+    sim::Thread* threadPtr = static_cast<sim::Thread*>(Thread->SimThread);
+    KPRIORITY oldPriority = threadPtr->Priority;
+    threadPtr->Priority = Priority;
+    return oldPriority;
+}
+
+KPRIORITY KeQueryPriorityThread (PKTHREAD Thread)
+{
+    return static_cast<sim::Thread*>(Thread->SimThread)->Priority;
+}
+
+//
+// Objects, handles, registry and files
+//
+
+static struct _OBJECT_TYPE* s_ioFileObjectType;
+static struct _OBJECT_TYPE* s_psThreadType;
+static struct _OBJECT_TYPE* s_exEventObjectType;
+POBJECT_TYPE* IoFileObjectType = &s_ioFileObjectType;
+POBJECT_TYPE* PsThreadType = &s_psThreadType;
+POBJECT_TYPE* ExEventObjectType = &s_exEventObjectType;
+
+NTSTATUS ObReferenceObjectByHandle (
+    HANDLE Handle,
+    ACCESS_MASK /* DesiredAccess */,
+    POBJECT_TYPE /* ObjectType */,
+    KPROCESSOR_MODE /* AccessMode */,
+    PVOID* Object,
+    PVOID /* HandleInformation */
+    )
+{
+    if (Handle == nullptr) {
+        return STATUS_INVALID_HANDLE;
+    }
+    *Object = Handle;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS ObReferenceObjectByHandleWithTag (
+    HANDLE Handle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode,
+    ULONG /* Tag */,
+    PVOID* Object,
+    PVOID HandleInformation
+    )
+{
+    return ObReferenceObjectByHandle(
+        Handle,
+        DesiredAccess,
+        ObjectType,
+        AccessMode,
+        Object,
+        HandleInformation);
+}
+
+VOID ObfReferenceObject (PVOID /* Object */) {}
+VOID ObfDereferenceObject (PVOID /* Object */) {}
+VOID ObDereferenceObjectWithTag (PVOID /* Object */, ULONG /* Tag */) {}
+
+NTSTATUS ZwClose (HANDLE /* Handle */)
+{
+    return STATUS_SUCCESS;
+}
+
+static int s_keyHandle;
+
+NTSTATUS ZwOpenKey (PHANDLE KeyHandle, ACCESS_MASK /* DesiredAccess */, POBJECT_ATTRIBUTES /* ObjectAttributes */)
+{
+    *KeyHandle = &s_keyHandle;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS ZwQueryValueKey (
+    HANDLE /* KeyHandle */,
+    PUNICODE_STRING ValueName,
+    KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+    PVOID KeyValueInformation,
+    ULONG Length,
+    PULONG ResultLength
+    )
+{
+    auto it = g_registry.find(narrow(ValueName));
+    if ((it == g_registry.end()) || (KeyValueInformationClass != KeyValuePartialInformation)) {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+    ULONG required = ULONG(FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data) + sizeof(ULONG));
+    *ResultLength = required;
+    if (Length < required) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    auto infoPtr = static_cast<KEY_VALUE_PARTIAL_INFORMATION*>(KeyValueInformation);
+    infoPtr->TitleIndex = 0;
+    infoPtr->Type = REG_DWORD;
+    infoPtr->DataLength = sizeof(ULONG);
+    ::memcpy(infoPtr->Data, &it->second, sizeof(ULONG));
+    return STATUS_SUCCESS;
+}
+
+//
+// There is no object namespace, opening a device by name always fails
+//
+NTSTATUS ZwCreateFile (
+    PHANDLE FileHandle,
+    ACCESS_MASK, POBJECT_ATTRIBUTES, PIO_STATUS_BLOCK IoStatusBlock,
+    PLARGE_INTEGER, ULONG, ULONG, ULONG, ULONG, PVOID, ULONG
+    )
+{
+    *FileHandle = nullptr;
+    if (IoStatusBlock != nullptr) {
+        IoStatusBlock->Status = STATUS_OBJECT_NAME_NOT_FOUND;
+        IoStatusBlock->Information = 0;
+    }
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+//
+// I/O manager
+//
+
+const UNICODE_STRING SDDL_DEVOBJ_SYS_ALL_ADM_ALL = {};
+
+NTSTATUS IoCreateDevice (
+    PDRIVER_OBJECT DriverObject,
+    ULONG DeviceExtensionSize,
+    PUNICODE_STRING DeviceName,
+    DEVICE_TYPE DeviceType,
+    ULONG DeviceCharacteristics,
+    BOOLEAN /* Exclusive */,
+    PDEVICE_OBJECT* DeviceObject
+    )
+{
+    std::string name = narrow(DeviceName);
+    if (!name.empty() && (FindDeviceObject(name.c_str()) != nullptr)) {
+        return STATUS_OBJECT_NAME_COLLISION;
+    }
+    DEVICE_OBJECT* devicePtr = new DEVICE_OBJECT();
+    devicePtr->Size = USHORT(sizeof(DEVICE_OBJECT));
+    devicePtr->DriverObject = DriverObject;
+    devicePtr->Flags = DO_DEVICE_INITIALIZING;
+    devicePtr->Characteristics = DeviceCharacteristics;
+    devicePtr->DeviceType = DeviceType;
+    devicePtr->StackSize = 1;
+    if (DeviceExtensionSize != 0) {
+        devicePtr->DeviceExtension = ::calloc(1, DeviceExtensionSize);
+    }
+    devicePtr->NextDevice = DriverObject->DeviceObject;
+    DriverObject->DeviceObject = devicePtr;
+    g_deviceObjects.push_back(devicePtr);
+    g_deviceNames[devicePtr] = name;
+    *DeviceObject = devicePtr;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS IoCreateDeviceSecure (
+    PDRIVER_OBJECT DriverObject,
+    ULONG DeviceExtensionSize,
+    PUNICODE_STRING DeviceName,
+    DEVICE_TYPE DeviceType,
+    ULONG DeviceCharacteristics,
+    BOOLEAN Exclusive,
+    PCUNICODE_STRING /* DefaultSDDLString */,
+    const GUID* /* DeviceClassGuid */,
+    PDEVICE_OBJECT* DeviceObject
+    )
+{
+    return IoCreateDevice(
+        DriverObject,
+        DeviceExtensionSize,
+        DeviceName,
+        DeviceType,
+        DeviceCharacteristics,
+        Exclusive,
+        DeviceObject);
+}
+
+VOID IoDeleteDevice (PDEVICE_OBJECT DeviceObject)
+{
+    PDEVICE_OBJECT* linkPtr = &DeviceObject->DriverObject->DeviceObject;
+    while (*linkPtr != nullptr) {
+        if (*linkPtr == DeviceObject) {
+            *linkPtr = DeviceObject->NextDevice;
+            break;
+        }
+        linkPtr = &(*linkPtr)->NextDevice;
+    }
+    g_deviceObjects.erase(
+        std::find(g_deviceObjects.begin(), g_deviceObjects.end(), DeviceObject));
+    g_deviceNames.erase(DeviceObject);
+    ::free(DeviceObject->DeviceExtension);
+    delete DeviceObject;
+}
+
+NTSTATUS IoCreateSymbolicLink (PUNICODE_STRING, PUNICODE_STRING)
+{
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS IoDeleteSymbolicLink (PUNICODE_STRING)
+{
+    return STATUS_SUCCESS;
+}
+
+PDEVICE_OBJECT IoGetRelatedDeviceObject (PFILE_OBJECT FileObject)
+{
+    return FileObject->DeviceObject;
+}
+
+enum : SHORT { IRP_TYPE_SIM_BUILT = 6 };
+
+PIRP IoBuildDeviceIoControlRequest (
+    ULONG IoControlCode,
+    PDEVICE_OBJECT /* DeviceObject */,
+    PVOID InputBuffer,
+    ULONG InputBufferLength,
+    PVOID OutputBuffer,
+    ULONG OutputBufferLength,
+    BOOLEAN InternalDeviceIoControl,
+    PKEVENT Event,
+    PIO_STATUS_BLOCK IoStatusBlock
+    )
+{
+    IRP* irpPtr = new IRP();
+    irpPtr->Type = IRP_TYPE_SIM_BUILT;
+    irpPtr->Size = USHORT(sizeof(IRP));
+    irpPtr->StackCount = 2;
+    irpPtr->CurrentLocation = 3;
+    irpPtr->UserIosb = IoStatusBlock;
+    irpPtr->UserEvent = Event;
+    irpPtr->UserBuffer = OutputBuffer;
+
+    ULONG bufferLength = std::max(InputBufferLength, OutputBufferLength);
+    if (bufferLength != 0) {
+        irpPtr->AssociatedIrp.SystemBuffer = ::calloc(1, bufferLength);
+        if (InputBuffer != nullptr) {
+            ::memcpy(irpPtr->AssociatedIrp.SystemBuffer, InputBuffer, InputBufferLength);
+        }
+    }
+
+    IO_STACK_LOCATION* stackPtr = IoGetNextIrpStackLocation(irpPtr);
+    stackPtr->MajorFunction = InternalDeviceIoControl ?
+        IRP_MJ_INTERNAL_DEVICE_CONTROL : IRP_MJ_DEVICE_CONTROL;
+    stackPtr->Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+    stackPtr->Parameters.DeviceIoControl.InputBufferLength = InputBufferLength;
+    stackPtr->Parameters.DeviceIoControl.OutputBufferLength = OutputBufferLength;
+    stackPtr->Parameters.DeviceIoControl.Type3InputBuffer = InputBuffer;
+    return irpPtr;
+}
+
+NTSTATUS IofCallDriver (PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    --Irp->CurrentLocation;
+    IO_STACK_LOCATION* stackPtr = IoGetCurrentIrpStackLocation(Irp);
+    stackPtr->DeviceObject = DeviceObject;
+    PDRIVER_DISPATCH dispatch = DeviceObject->DriverObject->MajorFunction[stackPtr->MajorFunction];
+    if (dispatch == nullptr) {
+        Irp->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+        IofCompleteRequest(Irp, IO_NO_INCREMENT);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    return dispatch(DeviceObject, Irp);
+}
+
+VOID IofCompleteRequest (PIRP Irp, KPRIORITY /* PriorityBoost */)
+{
+    if (Irp->UserIosb != nullptr) {
+        *Irp->UserIosb = Irp->IoStatus;
+    }
+    if (Irp->Type != IRP_TYPE_SIM_BUILT) {
+        if (Irp->UserEvent != nullptr) {
+            KeSetEvent(Irp->UserEvent, IO_NO_INCREMENT, FALSE);
+        }
+        return;
+    }
+    if ((Irp->AssociatedIrp.SystemBuffer != nullptr) && (Irp->UserBuffer != nullptr) &&
+        NT_SUCCESS(Irp->IoStatus.Status)) {
+
+        ::memcpy(Irp->UserBuffer, Irp->AssociatedIrp.SystemBuffer, Irp->IoStatus.Information);
+    }
+    ::free(Irp->AssociatedIrp.SystemBuffer);
+    if (Irp->UserEvent != nullptr) {
+        KeSetEvent(Irp->UserEvent, IO_NO_INCREMENT, FALSE);
+    }
+    delete Irp;
+}
+
+//
+// Memory
+//
+
+PVOID ExAllocatePoolWithTag (POOL_TYPE /* PoolType */, SIZE_T NumberOfBytes, ULONG /* Tag */)
+{
+    return arenaAllocate(NumberOfBytes, 16, false);
+}
+
+PVOID ExAllocatePool2 (POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG /* Tag */)
+{
+    void* addressPtr = arenaAllocate(NumberOfBytes, 16, false);
+    if ((addressPtr != nullptr) && ((Flags & POOL_FLAG_UNINITIALIZED) == 0)) {
+        ::memset(addressPtr, 0, NumberOfBytes);
+    }
+    return addressPtr;
+}
+
+VOID ExFreePool (PVOID P)
+{
+    arenaFree(P);
+}
+
+VOID ExFreePoolWithTag (PVOID P, ULONG /* Tag */)
+{
+    arenaFree(P);
+}
+
+PVOID MmMapIoSpaceEx (PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, ULONG /* Protect */)
+{
+    ULONG offset = 0;
+    Device* devicePtr = DeviceAt(uint64_t(PhysicalAddress.QuadPart), &offset);
+    if (devicePtr == nullptr) {
+        return nullptr;
+    }
+
+    //
+    // The VA range is reserved but inaccessible, a register access that
+    // bypasses the READ/WRITE_REGISTER routines faults right away
+    //
+    size_t length = ROUND_TO_PAGES(NumberOfBytes);
+    void* vaPtr = ::mmap(nullptr, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (vaPtr == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t va = reinterpret_cast<uintptr_t>(vaPtr);
+    g_mappings[va] = Mapping{ va, NumberOfBytes, devicePtr, offset };
+    return vaPtr;
+}
+
+PVOID MmMapIoSpace (PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, MEMORY_CACHING_TYPE /* CacheType */)
+{
+    return MmMapIoSpaceEx(PhysicalAddress, NumberOfBytes, PAGE_READWRITE | PAGE_NOCACHE);
+}
+
+VOID MmUnmapIoSpace (PVOID BaseAddress, SIZE_T NumberOfBytes)
+{
+    g_mappings.erase(reinterpret_cast<uintptr_t>(BaseAddress));
+    ::munmap(BaseAddress, ROUND_TO_PAGES(NumberOfBytes));
+}
+
+PVOID MmAllocateContiguousNodeMemory (
+    SIZE_T NumberOfBytes,
+    PHYSICAL_ADDRESS /* LowestAcceptableAddress */,
+    PHYSICAL_ADDRESS HighestAcceptableAddress,
+    PHYSICAL_ADDRESS /* BoundaryAddressMultiple */,
+    ULONG Protect,
+    NODE_REQUIREMENT /* PreferredNode */
+    )
+{
+    void* addressPtr = arenaAllocate(NumberOfBytes, PAGE_SIZE, (Protect & PAGE_NOCACHE) != 0);
+    if ((addressPtr != nullptr) &&
+        (PhysicalAddressOf(addressPtr) + NumberOfBytes - 1 >
+         uint64_t(HighestAcceptableAddress.QuadPart))) {
+
+        arenaFree(addressPtr);
+        return nullptr;
+    }
+    return addressPtr;
+}
+
+PVOID MmAllocateContiguousMemorySpecifyCache (
+    SIZE_T NumberOfBytes,
+    PHYSICAL_ADDRESS LowestAcceptableAddress,
+    PHYSICAL_ADDRESS HighestAcceptableAddress,
+    PHYSICAL_ADDRESS BoundaryAddressMultiple,
+    MEMORY_CACHING_TYPE CacheType
+    )
+{
+    return MmAllocateContiguousNodeMemory(
+        NumberOfBytes,
+        LowestAcceptableAddress,
+        HighestAcceptableAddress,
+        BoundaryAddressMultiple,
+        PAGE_READWRITE | ((CacheType == MmCached) ? 0 : PAGE_NOCACHE),
+        MM_ANY_NODE_OK);
+}
+
+PVOID MmAllocateContiguousMemory (SIZE_T NumberOfBytes, PHYSICAL_ADDRESS HighestAcceptableAddress)
+{
+    PHYSICAL_ADDRESS zero;
+    zero.QuadPart = 0;
+    return MmAllocateContiguousMemorySpecifyCache(
+        NumberOfBytes,
+        zero,
+        HighestAcceptableAddress,
+        zero,
+        MmCached);
+}
+
+VOID MmFreeContiguousMemory (PVOID BaseAddress)
+{
+    arenaFree(BaseAddress);
+}
+
+PHYSICAL_ADDRESS MmGetPhysicalAddress (PVOID BaseAddress)
+{
+    PHYSICAL_ADDRESS physicalAddress;
+    physicalAddress.QuadPart = isArena(BaseAddress) ?
+        LONGLONG(PhysicalAddressOf(BaseAddress)) : 0;
+    return physicalAddress;
+}
+
+} // extern "C"
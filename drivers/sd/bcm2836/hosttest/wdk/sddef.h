@@ -0,0 +1,59 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sddef.h
+//
+// Abstract:
+//
+//  The subset of the SD bus definitions used by the BCM2836 SD miniports
+//
+// Environment:
+//
+//  Host user mode, C and C++
+//
+
+#ifndef _SDDEF_H_
+#define _SDDEF_H_
+
+#define SDCMD_GO_IDLE_STATE                 0
+#define SDCMD_ALL_SEND_CID                  2
+#define SDCMD_SEND_RELATIVE_ADDR            3
+#define SDCMD_IO_SEND_OP_COND               5
+#define SDCMD_SWITCH_FUNCTION               6
+#define SDCMD_SELECT_CARD                   7
+#define SDCMD_SEND_IF_COND                  8
+#define SDCMD_SEND_CSD                      9
+#define SDCMD_STOP_TRANSMISSION             12
+#define SDCMD_SEND_STATUS                   13
+#define SDCMD_SET_BLOCKLEN                  16
+#define SDCMD_READ_BLOCK                    17
+#define SDCMD_READ_MULTIPLE_BLOCK           18
+#define SDCMD_SET_BLOCK_COUNT               23
+#define SDCMD_WRITE_BLOCK                   24
+#define SDCMD_WRITE_MULTIPLE_BLOCK          25
+#define SDCMD_IO_RW_DIRECT                  52
+#define SDCMD_IO_RW_EXTENDED                53
+#define SDCMD_APP_CMD                       55
+
+#define SDACMD_SET_BUS_WIDTH                6
+#define SDACMD_SD_STATUS                    13
+#define SDACMD_SEND_OP_COND                 41
+#define SDACMD_SEND_SCR                     51
+
+typedef struct _SD_RW_EXTENDED_ARGUMENT {
+    union {
+        struct {
+            ULONG Count : 9;
+            ULONG Address : 17;
+            ULONG OpCode : 1;
+            ULONG BlockMode : 1;
+            ULONG Function : 3;
+            ULONG ReadWrite : 1;
+        } bits;
+        ULONG AsULONG;
+    } u;
+} SD_RW_EXTENDED_ARGUMENT, *PSD_RW_EXTENDED_ARGUMENT;
+
+#endif // _SDDEF_H_
@@ -0,0 +1,419 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  sdport.h
+//
+// Abstract:
+//
+//  The subset of the Sdport miniport interface used by the BCM2836 SD
+//  miniports. Requests are driven by the Sdport stand-in of the host-side
+//  test harness (sim/sdport.cpp)
+//
+// Environment:
+//
+//  Host user mode, C and C++
+//
+
+#ifndef _SDPORT_H_
+#define _SDPORT_H_
+
+#include "wdkhost.h"
+
+WDKHOST_EXTERN_C_BEGIN
+
+#define SDPORT_MAX_SLOTS                    8
+
+typedef struct _SCATTER_GATHER_ELEMENT {
+    PHYSICAL_ADDRESS Address;
+    ULONG Length;
+    ULONG_PTR Reserved;
+} SCATTER_GATHER_ELEMENT, *PSCATTER_GATHER_ELEMENT;
+
+typedef struct _SCATTER_GATHER_LIST {
+    ULONG NumberOfElements;
+    ULONG_PTR Reserved;
+    SCATTER_GATHER_ELEMENT Elements[1];
+} SCATTER_GATHER_LIST, *PSCATTER_GATHER_LIST;
+
+typedef enum _SDPORT_BUS_OPERATION_TYPE {
+    SdResetHost,
+    SdResetHw,
+    SdSetClock,
+    SdClock = SdSetClock,
+    SdSetVoltage,
+    SdSetBusWidth,
+    SdSetBusSpeed,
+    SdSetSignalingVoltage,
+    SdSetDriveStrength,
+    SdSetDriverType,
+    SdSetPresetValue,
+    SdSetBlockGapInterrupt,
+    SdExecuteTuning,
+    SdBusPower,
+    SdBusPowerSelect
+} SDPORT_BUS_OPERATION_TYPE;
+
+typedef enum _SDPORT_BUS_TYPE {
+    SdBusTypeUnknown,
+    SdBusTypeAcpi,
+    SdBusTypePci
+} SDPORT_BUS_TYPE;
+
+typedef enum _SDPORT_BUS_VOLTAGE {
+    SdBusVoltageOff,
+    SdBusVoltage33,
+    SdBusVoltage30,
+    SdBusVoltage18
+} SDPORT_BUS_VOLTAGE;
+
+typedef enum _SDPORT_SIGNALING_VOLTAGE {
+    SdSignalingVoltage33,
+    SdSignalingVoltage18
+} SDPORT_SIGNALING_VOLTAGE;
+
+typedef enum _SDPORT_BUS_WIDTH {
+    SdBusWidthUndefined = 0,
+    SdBusWidth1Bit = 1,
+    SdBusWidth4Bit = 4,
+    SdBusWidth8Bit = 8
+} SDPORT_BUS_WIDTH;
+
+typedef enum _SDPORT_BUS_SPEED {
+    SdBusSpeedUndefined,
+    SdBusSpeedNormal,
+    SdBusSpeedHigh,
+    SdBusSpeedSDR12,
+    SdBusSpeedSDR25,
+    SdBusSpeedSDR50,
+    SdBusSpeedDDR50,
+    SdBusSpeedSDR104,
+    SdBusSpeedHS200,
+    SdBusSpeedHS400
+} SDPORT_BUS_SPEED;
+
+typedef enum _SDPORT_DRIVE_STRENGTH {
+    SdDriveStrengthB,
+    SdDriveStrengthA,
+    SdDriveStrengthC,
+    SdDriveStrengthD
+} SDPORT_DRIVE_STRENGTH;
+
+typedef enum _SDPORT_DRIVER_TYPE {
+    SdDriverTypeB,
+    SdDriverTypeA,
+    SdDriverTypeC,
+    SdDriverTypeD
+} SDPORT_DRIVER_TYPE;
+
+typedef enum _SDPORT_RESET_TYPE {
+    SdResetTypeUndefined,
+    SdResetTypeAll,
+    SdResetTypeCmd,
+    SdResetTypeDat
+} SDPORT_RESET_TYPE;
+
+typedef struct _SDPORT_BUS_OPERATION {
+    SDPORT_BUS_OPERATION_TYPE Type;
+    union {
+        struct {
+            SDPORT_SIGNALING_VOLTAGE SignalingVoltage;
+            SDPORT_BUS_VOLTAGE Voltage;
+            SDPORT_BUS_WIDTH BusWidth;
+            SDPORT_BUS_SPEED BusSpeed;
+            SDPORT_DRIVE_STRENGTH DriveStrength;
+            SDPORT_DRIVER_TYPE DriverType;
+            SDPORT_RESET_TYPE ResetType;
+            ULONG FrequencyKhz;
+            BOOLEAN PresetValueEnabled;
+            BOOLEAN BlockGapIntEnabled;
+        };
+    } Parameters;
+} SDPORT_BUS_OPERATION, *PSDPORT_BUS_OPERATION;
+
+typedef struct _SDPORT_CAPABILITIES {
+    USHORT SpecVersion;
+    USHORT MaximumOutstandingRequests;
+    ULONG MaximumBlockSize;
+    ULONG MaximumBlockCount;
+    ULONG BaseClockFrequencyKhz;
+    ULONG DmaDescriptorSize;
+    struct {
+        ULONG Address64Bit : 1;
+        ULONG BusWidth8Bit : 1;
+        ULONG HighSpeed : 1;
+        ULONG SDR50 : 1;
+        ULONG SDR104 : 1;
+        ULONG DDR50 : 1;
+        ULONG HS200 : 1;
+        ULONG HS400 : 1;
+        ULONG DriverTypeA : 1;
+        ULONG DriverTypeB : 1;
+        ULONG DriverTypeC : 1;
+        ULONG DriverTypeD : 1;
+        ULONG TuningForSDR50 : 1;
+        ULONG SoftwareTuning : 1;
+        ULONG AutoCmd12 : 1;
+        ULONG AutoCmd23 : 1;
+        ULONG Voltage18V : 1;
+        ULONG Voltage30V : 1;
+        ULONG Voltage33V : 1;
+        ULONG SignalingVoltage18V : 1;
+        ULONG Limit200mA : 1;
+        ULONG Limit400mA : 1;
+        ULONG Limit600mA : 1;
+        ULONG Limit800mA : 1;
+        ULONG ScatterGatherDma : 1;
+        ULONG SaveContext : 1;
+    } Supported;
+    ULONG TuningTimerCountInSeconds;
+} SDPORT_CAPABILITIES, *PSDPORT_CAPABILITIES;
+
+typedef enum _SDPORT_REQUEST_TYPE {
+    SdRequestTypeUndefined,
+    SdRequestTypeCommandNoTransfer,
+    SdRequestTypeCommandWithTransfer,
+    SdRequestTypeStartTransfer
+} SDPORT_REQUEST_TYPE;
+
+typedef enum _SDPORT_COMMAND_CLASS {
+    SdCommandClassStandard,
+    SdCommandClassApp
+} SDPORT_COMMAND_CLASS;
+
+typedef enum _SDPORT_COMMAND_TYPE {
+    SdCommandTypeUndefined,
+    SdCommandTypeSuspend,
+    SdCommandTypeResume,
+    SdCommandTypeAbort
+} SDPORT_COMMAND_TYPE;
+
+typedef enum _SDPORT_RESPONSE_TYPE {
+    SdResponseTypeUndefined,
+    SdResponseTypeNone,
+    SdResponseTypeR1,
+    SdResponseTypeR1B,
+    SdResponseTypeR2,
+    SdResponseTypeR3,
+    SdResponseTypeR4,
+    SdResponseTypeR5,
+    SdResponseTypeR5B,
+    SdResponseTypeR6
+} SDPORT_RESPONSE_TYPE;
+
+typedef enum _SDPORT_TRANSFER_TYPE {
+    SdTransferTypeUndefined,
+    SdTransferTypeNone,
+    SdTransferTypeSingleBlock,
+    SdTransferTypeMultiBlock,
+    SdTransferTypeMultiBlockNoStop
+} SDPORT_TRANSFER_TYPE;
+
+typedef enum _SDPORT_TRANSFER_DIRECTION {
+    SdTransferDirectionUndefined,
+    SdTransferDirectionRead,
+    SdTransferDirectionWrite
+} SDPORT_TRANSFER_DIRECTION;
+
+typedef enum _SDPORT_TRANSFER_METHOD {
+    SdTransferMethodUndefined,
+    SdTransferMethodPio,
+    SdTransferMethodSgDma
+} SDPORT_TRANSFER_METHOD;
+
+typedef struct _SDPORT_COMMAND {
+    UCHAR Index;
+    SDPORT_COMMAND_CLASS Class;
+    SDPORT_COMMAND_TYPE Type;
+    SDPORT_TRANSFER_DIRECTION TransferDirection;
+    SDPORT_TRANSFER_TYPE TransferType;
+    SDPORT_TRANSFER_METHOD TransferMethod;
+    SDPORT_RESPONSE_TYPE ResponseType;
+    ULONG Argument;
+    ULONG Flags;
+    USHORT BlockSize;
+    USHORT BlockCount;
+    ULONG Length;
+    PUCHAR DataBuffer;
+    PVOID DmaVirtualAddress;
+    PHYSICAL_ADDRESS DmaPhysicalAddress;
+    PSCATTER_GATHER_LIST ScatterGatherList;
+    ULONG ScatterGatherListSize;
+} SDPORT_COMMAND, *PSDPORT_COMMAND;
+
+typedef struct _SDPORT_REQUEST {
+    SDPORT_REQUEST_TYPE Type;
+    SDPORT_COMMAND Command;
+    ULONG RequiredEvents;
+    NTSTATUS Status;
+    PVOID SimContext;
+} SDPORT_REQUEST, *PSDPORT_REQUEST;
+
+//
+// Standard SDHC event and error bits, as used by Sdport
+//
+
+#define SDHC_IS_CMD_COMPLETE                0x0001
+#define SDHC_IS_TRANSFER_COMPLETE           0x0002
+#define SDHC_IS_BLOCKGAP_EVENT              0x0004
+#define SDHC_IS_DMA_EVENT                   0x0008
+#define SDHC_IS_BUFFER_WRITE_READY          0x0010
+#define SDHC_IS_BUFFER_READ_READY           0x0020
+#define SDHC_IS_CARD_INSERTION              0x0040
+#define SDHC_IS_CARD_REMOVAL                0x0080
+#define SDHC_IS_CARD_INTERRUPT              0x0100
+#define SDHC_IS_TUNING_INTERRUPT            0x1000
+#define SDHC_IS_ERROR_INTERRUPT             0x8000
+
+typedef struct _SDPORT_CONFIGURATION_INFO {
+    SDPORT_BUS_TYPE BusType;
+    ULONG BusNumber;
+    ULONG SlotNumber;
+} SDPORT_CONFIGURATION_INFO;
+
+typedef struct _SDPORT_SLOT_EXTENSION {
+    PVOID PrivateExtension;
+    PVOID SimSlot;
+} SDPORT_SLOT_EXTENSION, *PSDPORT_SLOT_EXTENSION;
+
+typedef struct _SD_MINIPORT {
+    USHORT Version;
+    USHORT Size;
+    SDPORT_CONFIGURATION_INFO ConfigurationInfo;
+    UCHAR SlotCount;
+    PSDPORT_SLOT_EXTENSION SlotExtensionList[SDPORT_MAX_SLOTS];
+} SD_MINIPORT, *PSD_MINIPORT;
+
+//
+// Miniport callbacks
+//
+
+typedef NTSTATUS SDPORT_GET_SLOT_COUNT (PSD_MINIPORT Miniport, PUCHAR SlotCount);
+typedef SDPORT_GET_SLOT_COUNT* PSDPORT_GET_SLOT_COUNT;
+
+typedef VOID SDPORT_GET_SLOT_CAPABILITIES (PVOID PrivateExtension, PSDPORT_CAPABILITIES Capabilities);
+typedef SDPORT_GET_SLOT_CAPABILITIES* PSDPORT_GET_SLOT_CAPABILITIES;
+
+typedef NTSTATUS SDPORT_INITIALIZE (
+    PVOID PrivateExtension,
+    PHYSICAL_ADDRESS PhysicalBase,
+    PVOID VirtualBase,
+    ULONG Length,
+    BOOLEAN CrashdumpMode
+    );
+typedef SDPORT_INITIALIZE* PSDPORT_INITIALIZE;
+
+typedef NTSTATUS SDPORT_ISSUE_BUS_OPERATION (PVOID PrivateExtension, PSDPORT_BUS_OPERATION BusOperation);
+typedef SDPORT_ISSUE_BUS_OPERATION* PSDPORT_ISSUE_BUS_OPERATION;
+
+typedef BOOLEAN SDPORT_GET_CARD_DETECT_STATE (PVOID PrivateExtension);
+typedef SDPORT_GET_CARD_DETECT_STATE* PSDPORT_GET_CARD_DETECT_STATE;
+
+typedef BOOLEAN SDPORT_GET_WRITE_PROTECT_STATE (PVOID PrivateExtension);
+typedef SDPORT_GET_WRITE_PROTECT_STATE* PSDPORT_GET_WRITE_PROTECT_STATE;
+
+typedef BOOLEAN SDPORT_INTERRUPT (
+    PVOID PrivateExtension,
+    PULONG Events,
+    PULONG Errors,
+    PBOOLEAN NotifyCardChange,
+    PBOOLEAN NotifySdioInterrupt,
+    PBOOLEAN NotifyTuning
+    );
+typedef SDPORT_INTERRUPT* PSDPORT_INTERRUPT;
+
+typedef NTSTATUS SDPORT_ISSUE_REQUEST (PVOID PrivateExtension, PSDPORT_REQUEST Request);
+typedef SDPORT_ISSUE_REQUEST* PSDPORT_ISSUE_REQUEST;
+
+typedef VOID SDPORT_GET_RESPONSE (PVOID PrivateExtension, PSDPORT_COMMAND Command, PVOID ResponseBuffer);
+typedef SDPORT_GET_RESPONSE* PSDPORT_GET_RESPONSE;
+
+typedef VOID SDPORT_REQUEST_DPC (PVOID PrivateExtension, PSDPORT_REQUEST Request, ULONG Events, ULONG Errors);
+typedef SDPORT_REQUEST_DPC* PSDPORT_REQUEST_DPC;
+
+typedef VOID SDPORT_TOGGLE_EVENTS (PVOID PrivateExtension, ULONG EventMask, BOOLEAN Enable);
+typedef SDPORT_TOGGLE_EVENTS* PSDPORT_TOGGLE_EVENTS;
+
+typedef VOID SDPORT_CLEAR_EVENTS (PVOID PrivateExtension, ULONG EventMask);
+typedef SDPORT_CLEAR_EVENTS* PSDPORT_CLEAR_EVENTS;
+
+typedef VOID SDPORT_SAVE_CONTEXT (PVOID PrivateExtension);
+typedef SDPORT_SAVE_CONTEXT* PSDPORT_SAVE_CONTEXT;
+
+typedef VOID SDPORT_RESTORE_CONTEXT (PVOID PrivateExtension);
+typedef SDPORT_RESTORE_CONTEXT* PSDPORT_RESTORE_CONTEXT;
+
+typedef NTSTATUS SDPORT_PO_FX_POWER_CONTROL_CALLBACK (
+    PSD_MINIPORT Miniport,
+    const GUID* PowerControlCode,
+    PVOID InputBuffer,
+    SIZE_T InputBufferSize,
+    PVOID OutputBuffer,
+    SIZE_T OutputBufferSize,
+    PSIZE_T BytesReturned
+    );
+typedef SDPORT_PO_FX_POWER_CONTROL_CALLBACK* PSDPORT_PO_FX_POWER_CONTROL_CALLBACK;
+
+typedef VOID SDPORT_CLEANUP (PSD_MINIPORT Miniport);
+typedef SDPORT_CLEANUP* PSDPORT_CLEANUP;
+
+typedef struct _SDPORT_INITIALIZATION_DATA {
+    ULONG StructureSize;
+    PSDPORT_GET_SLOT_COUNT GetSlotCount;
+    PSDPORT_GET_SLOT_CAPABILITIES GetSlotCapabilities;
+    PSDPORT_INITIALIZE Initialize;
+    PSDPORT_ISSUE_BUS_OPERATION IssueBusOperation;
+    PSDPORT_GET_CARD_DETECT_STATE GetCardDetectState;
+    PSDPORT_GET_WRITE_PROTECT_STATE GetWriteProtectState;
+    PSDPORT_INTERRUPT Interrupt;
+    PSDPORT_ISSUE_REQUEST IssueRequest;
+    PSDPORT_GET_RESPONSE GetResponse;
+    PSDPORT_TOGGLE_EVENTS ToggleEvents;
+    PSDPORT_CLEAR_EVENTS ClearEvents;
+    PSDPORT_REQUEST_DPC RequestDpc;
+    PSDPORT_SAVE_CONTEXT SaveContext;
+    PSDPORT_RESTORE_CONTEXT RestoreContext;
+    PSDPORT_PO_FX_POWER_CONTROL_CALLBACK PowerControlCallback;
+    PSDPORT_CLEANUP Cleanup;
+    ULONG PrivateExtensionSize;
+    BOOLEAN CrashdumpSupported;
+} SDPORT_INITIALIZATION_DATA, *PSDPORT_INITIALIZATION_DATA;
+
+//
+// Sdport library routines
+//
+
+NTSTATUS SdPortInitialize (
+    PDRIVER_OBJECT DriverObject,
+    PUNICODE_STRING RegistryPath,
+    PSDPORT_INITIALIZATION_DATA HwInitializationData
+    );
+
+VOID SdPortCompleteRequest (PSDPORT_REQUEST Request, NTSTATUS Status);
+
+VOID SdPortWait (ULONG TimeInUs);
+
+static inline ULONG SdPortReadRegisterUlong (PVOID BaseAddress, ULONG Offset)
+{
+    return READ_REGISTER_ULONG((volatile ULONG*)((PUCHAR)BaseAddress + Offset));
+}
+
+static inline VOID SdPortWriteRegisterUlong (PVOID BaseAddress, ULONG Offset, ULONG Data)
+{
+    WRITE_REGISTER_ULONG((volatile ULONG*)((PUCHAR)BaseAddress + Offset), Data);
+}
+
+static inline VOID SdPortReadRegisterBufferUlong (PVOID BaseAddress, ULONG Offset, PULONG Buffer, ULONG Count)
+{
+    READ_REGISTER_BUFFER_ULONG((volatile ULONG*)((PUCHAR)BaseAddress + Offset), Buffer, Count);
+}
+
+static inline VOID SdPortWriteRegisterBufferUlong (PVOID BaseAddress, ULONG Offset, PULONG Buffer, ULONG Count)
+{
+    WRITE_REGISTER_BUFFER_ULONG((volatile ULONG*)((PUCHAR)BaseAddress + Offset), Buffer, Count);
+}
+
+WDKHOST_EXTERN_C_END
+
+#endif // _SDPORT_H_
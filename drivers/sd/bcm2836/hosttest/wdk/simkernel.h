@@ -0,0 +1,360 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  simkernel.h
+//
+// Abstract:
+//
+//  Kernel routines exported by the simulated kernel (sim/simkernel.cpp) to
+//  the miniports compiled by the host-side test harness. Each routine keeps
+//  its WDK signature, its cost is charged to the simulated clock
+//
+// Environment:
+//
+//  Host user mode, C and C++
+//
+
+#ifndef _SIMKERNEL_H_
+#define _SIMKERNEL_H_
+
+WDKHOST_EXTERN_C_BEGIN
+
+//
+// Harness hooks used by the shim macros
+//
+
+void SimAssertionFailure (PCSTR Expression, PCSTR File, int Line);
+void SimTraceMessage (ULONG Level, PCSTR Function, PCSTR Format);
+void SimCopyMemory (void* Destination, const void* Source, SIZE_T Length);
+void SimZeroMemory (void* Destination, SIZE_T Length);
+
+#define RtlCopyMemory(d, s, l)              SimCopyMemory((d), (s), (l))
+#define RtlMoveMemory(d, s, l)              memmove((d), (s), (l))
+#define RtlZeroMemory(d, l)                 SimZeroMemory((d), (l))
+#define RtlFillMemory(d, l, f)              memset((d), (f), (l))
+#define RtlEqualMemory(a, b, l)             (memcmp((a), (b), (l)) == 0)
+SIZE_T RtlCompareMemory (const void* Source1, const void* Source2, SIZE_T Length);
+VOID RtlInitUnicodeString (PUNICODE_STRING DestinationString, PCWSTR SourceString);
+
+ULONG DbgPrint (PCSTR Format, ...);
+ULONG DbgPrintEx (ULONG ComponentId, ULONG Level, PCSTR Format, ...);
+ULONG vDbgPrintEx (ULONG ComponentId, ULONG Level, PCSTR Format, va_list ArgList);
+
+//
+// Register access
+//
+
+ULONG READ_REGISTER_ULONG (volatile ULONG* Register);
+ULONG READ_REGISTER_NOFENCE_ULONG (volatile ULONG* Register);
+VOID WRITE_REGISTER_ULONG (volatile ULONG* Register, ULONG Value);
+VOID WRITE_REGISTER_NOFENCE_ULONG (volatile ULONG* Register, ULONG Value);
+VOID READ_REGISTER_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count);
+VOID WRITE_REGISTER_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count);
+VOID READ_REGISTER_NOFENCE_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count);
+VOID WRITE_REGISTER_NOFENCE_BUFFER_ULONG (volatile ULONG* Register, PULONG Buffer, ULONG Count);
+
+//
+// Time, IRQL and processors
+//
+
+LARGE_INTEGER KeQueryPerformanceCounter (PLARGE_INTEGER PerformanceFrequency);
+ULONGLONG KeQueryInterruptTime (VOID);
+ULONGLONG KeQueryInterruptTimePrecise (PULONGLONG QpcTimeStamp);
+VOID KeQuerySystemTime (PLARGE_INTEGER CurrentTime);
+VOID KeQuerySystemTimePrecise (PLARGE_INTEGER CurrentTime);
+VOID KeStallExecutionProcessor (ULONG MicroSeconds);
+NTSTATUS KeDelayExecutionThread (KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval);
+VOID ExQueryTimerResolution (PULONG MaximumTime, PULONG MinimumTime, PULONG CurrentTime);
+ULONG ExSetTimerResolution (ULONG DesiredTime, BOOLEAN SetResolution);
+
+KIRQL KeGetCurrentIrql (VOID);
+KIRQL KfRaiseIrql (KIRQL NewIrql);
+VOID KeLowerIrql (KIRQL NewIrql);
+KIRQL KeRaiseIrqlToDpcLevel (VOID);
+#define KeRaiseIrql(n, o)                   (*(o) = KfRaiseIrql(n))
+
+ULONG KeQueryActiveProcessorCountEx (USHORT GroupNumber);
+ULONG KeGetCurrentProcessorNumberEx (PPROCESSOR_NUMBER ProcNumber);
+#define KeGetCurrentProcessorNumber()       KeGetCurrentProcessorNumberEx(NULL)
+KAFFINITY KeSetSystemAffinityThreadEx (KAFFINITY Affinity);
+VOID KeRevertToUserAffinityThreadEx (KAFFINITY Affinity);
+
+#define KeMemoryBarrier()                   __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define KeMemoryBarrierWithoutFence()       __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#define _ReadWriteBarrier()                 __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#define YieldProcessor()                    ((void)0)
+
+//
+// Synchronization
+//
+
+VOID KeInitializeEvent (PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State);
+LONG KeSetEvent (PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait);
+VOID KeClearEvent (PRKEVENT Event);
+LONG KeResetEvent (PRKEVENT Event);
+LONG KeReadStateEvent (PRKEVENT Event);
+NTSTATUS KeWaitForSingleObject (
+    PVOID Object,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout
+    );
+NTSTATUS KeWaitForMultipleObjects (
+    ULONG Count,
+    PVOID Object[],
+    WAIT_TYPE WaitType,
+    KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable,
+    PLARGE_INTEGER Timeout,
+    PKWAIT_BLOCK WaitBlockArray
+    );
+
+VOID KeInitializeSpinLock (PKSPIN_LOCK SpinLock);
+KIRQL KeAcquireSpinLockRaiseToDpc (PKSPIN_LOCK SpinLock);
+VOID KeReleaseSpinLock (PKSPIN_LOCK SpinLock, KIRQL NewIrql);
+VOID KeAcquireSpinLockAtDpcLevel (PKSPIN_LOCK SpinLock);
+VOID KeReleaseSpinLockFromDpcLevel (PKSPIN_LOCK SpinLock);
+VOID KeAcquireInStackQueuedSpinLock (PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle);
+VOID KeReleaseInStackQueuedSpinLock (PKLOCK_QUEUE_HANDLE LockHandle);
+VOID KeAcquireInStackQueuedSpinLockAtDpcLevel (PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle);
+VOID KeReleaseInStackQueuedSpinLockFromDpcLevel (PKLOCK_QUEUE_HANDLE LockHandle);
+#define KeAcquireSpinLock(l, o)             (*(o) = KeAcquireSpinLockRaiseToDpc(l))
+
+VOID ExInitializeFastMutex (PFAST_MUTEX FastMutex);
+VOID ExAcquireFastMutex (PFAST_MUTEX FastMutex);
+VOID ExReleaseFastMutex (PFAST_MUTEX FastMutex);
+
+static inline LONG InterlockedIncrement (LONG volatile* Addend)
+{
+    return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedDecrement (LONG volatile* Addend)
+{
+    return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedExchange (LONG volatile* Target, LONG Value)
+{
+    return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedExchangeAdd (LONG volatile* Addend, LONG Value)
+{
+    return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedOr (LONG volatile* Target, LONG Value)
+{
+    return __atomic_fetch_or(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedAnd (LONG volatile* Target, LONG Value)
+{
+    return __atomic_fetch_and(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedCompareExchange (LONG volatile* Destination, LONG Exchange, LONG Comperand)
+{
+    __atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comperand;
+}
+
+static inline LONGLONG InterlockedIncrement64 (LONGLONG volatile* Addend)
+{
+    return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONGLONG InterlockedExchangeAdd64 (LONGLONG volatile* Addend, LONGLONG Value)
+{
+    return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST);
+}
+
+static inline PVOID InterlockedExchangePointer (PVOID volatile* Target, PVOID Value)
+{
+    return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+static inline PVOID InterlockedCompareExchangePointer (PVOID volatile* Destination, PVOID Exchange, PVOID Comperand)
+{
+    __atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comperand;
+}
+
+#define ReadAcquire(p)                      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WriteRelease(p, v)                  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ReadNoFence(p)                      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define WriteNoFence(p, v)                  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+//
+// DPCs and timers
+//
+
+VOID KeInitializeDpc (PRKDPC Dpc, PKDEFERRED_ROUTINE DeferredRoutine, PVOID DeferredContext);
+BOOLEAN KeInsertQueueDpc (PRKDPC Dpc, PVOID SystemArgument1, PVOID SystemArgument2);
+BOOLEAN KeRemoveQueueDpc (PRKDPC Dpc);
+
+PEX_TIMER ExAllocateTimer (PEXT_CALLBACK Callback, PVOID CallbackContext, ULONG Attributes);
+BOOLEAN ExSetTimer (PEX_TIMER Timer, LONGLONG DueTime, LONGLONG Period, PEXT_SET_PARAMETERS Parameters);
+BOOLEAN ExCancelTimer (PEX_TIMER Timer, PEXT_CANCEL_PARAMETERS Parameters);
+BOOLEAN ExDeleteTimer (PEX_TIMER Timer, BOOLEAN Cancel, BOOLEAN Wait, PEXT_DELETE_PARAMETERS Parameters);
+
+//
+// Threads
+//
+
+NTSTATUS PsCreateSystemThread (
+    PHANDLE ThreadHandle,
+    ULONG DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    HANDLE ProcessHandle,
+    PVOID ClientId,
+    PKSTART_ROUTINE StartRoutine,
+    PVOID StartContext
+    );
+NTSTATUS PsTerminateSystemThread (NTSTATUS ExitStatus);
+PKTHREAD KeGetCurrentThread (VOID);
+#define PsGetCurrentThread()                KeGetCurrentThread()
+KPRIORITY KeSetPriorityThread (PKTHREAD Thread, KPRIORITY Priority);
+KPRIORITY KeQueryPriorityThread (PKTHREAD Thread);
+
+//
+// Objects, handles, registry and files
+//
+
+extern POBJECT_TYPE* IoFileObjectType;
+extern POBJECT_TYPE* PsThreadType;
+extern POBJECT_TYPE* ExEventObjectType;
+
+NTSTATUS ObReferenceObjectByHandle (
+    HANDLE Handle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode,
+    PVOID* Object,
+    PVOID HandleInformation
+    );
+NTSTATUS ObReferenceObjectByHandleWithTag (
+    HANDLE Handle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode,
+    ULONG Tag,
+    PVOID* Object,
+    PVOID HandleInformation
+    );
+VOID ObfReferenceObject (PVOID Object);
+VOID ObfDereferenceObject (PVOID Object);
+VOID ObDereferenceObjectWithTag (PVOID Object, ULONG Tag);
+#define ObReferenceObject(o)                ObfReferenceObject(o)
+#define ObDereferenceObject(o)              ObfDereferenceObject(o)
+
+NTSTATUS ZwClose (HANDLE Handle);
+NTSTATUS ZwOpenKey (PHANDLE KeyHandle, ACCESS_MASK DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes);
+NTSTATUS ZwQueryValueKey (
+    HANDLE KeyHandle,
+    PUNICODE_STRING ValueName,
+    KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+    PVOID KeyValueInformation,
+    ULONG Length,
+    PULONG ResultLength
+    );
+NTSTATUS ZwCreateFile (
+    PHANDLE FileHandle,
+    ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes,
+    PIO_STATUS_BLOCK IoStatusBlock,
+    PLARGE_INTEGER AllocationSize,
+    ULONG FileAttributes,
+    ULONG ShareAccess,
+    ULONG CreateDisposition,
+    ULONG CreateOptions,
+    PVOID EaBuffer,
+    ULONG EaLength
+    );
+
+//
+// I/O manager
+//
+
+extern const UNICODE_STRING SDDL_DEVOBJ_SYS_ALL_ADM_ALL;
+
+NTSTATUS IoCreateDevice (
+    PDRIVER_OBJECT DriverObject,
+    ULONG DeviceExtensionSize,
+    PUNICODE_STRING DeviceName,
+    DEVICE_TYPE DeviceType,
+    ULONG DeviceCharacteristics,
+    BOOLEAN Exclusive,
+    PDEVICE_OBJECT* DeviceObject
+    );
+NTSTATUS IoCreateDeviceSecure (
+    PDRIVER_OBJECT DriverObject,
+    ULONG DeviceExtensionSize,
+    PUNICODE_STRING DeviceName,
+    DEVICE_TYPE DeviceType,
+    ULONG DeviceCharacteristics,
+    BOOLEAN Exclusive,
+    PCUNICODE_STRING DefaultSDDLString,
+    const GUID* DeviceClassGuid,
+    PDEVICE_OBJECT* DeviceObject
+    );
+VOID IoDeleteDevice (PDEVICE_OBJECT DeviceObject);
+NTSTATUS IoCreateSymbolicLink (PUNICODE_STRING SymbolicLinkName, PUNICODE_STRING DeviceName);
+NTSTATUS IoDeleteSymbolicLink (PUNICODE_STRING SymbolicLinkName);
+PDEVICE_OBJECT IoGetRelatedDeviceObject (PFILE_OBJECT FileObject);
+PIRP IoBuildDeviceIoControlRequest (
+    ULONG IoControlCode,
+    PDEVICE_OBJECT DeviceObject,
+    PVOID InputBuffer,
+    ULONG InputBufferLength,
+    PVOID OutputBuffer,
+    ULONG OutputBufferLength,
+    BOOLEAN InternalDeviceIoControl,
+    PKEVENT Event,
+    PIO_STATUS_BLOCK IoStatusBlock
+    );
+NTSTATUS IofCallDriver (PDEVICE_OBJECT DeviceObject, PIRP Irp);
+VOID IofCompleteRequest (PIRP Irp, KPRIORITY PriorityBoost);
+#define IoCallDriver(d, i)                  IofCallDriver((d), (i))
+#define IoCompleteRequest(i, b)             IofCompleteRequest((i), (b))
+
+//
+// Memory
+//
+
+PVOID ExAllocatePoolWithTag (POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag);
+PVOID ExAllocatePool2 (POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG Tag);
+VOID ExFreePool (PVOID P);
+VOID ExFreePoolWithTag (PVOID P, ULONG Tag);
+#define ExAllocatePool(t, n)                ExAllocatePoolWithTag((t), (n), 0)
+
+PVOID MmMapIoSpace (PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, MEMORY_CACHING_TYPE CacheType);
+PVOID MmMapIoSpaceEx (PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, ULONG Protect);
+VOID MmUnmapIoSpace (PVOID BaseAddress, SIZE_T NumberOfBytes);
+PVOID MmAllocateContiguousMemory (SIZE_T NumberOfBytes, PHYSICAL_ADDRESS HighestAcceptableAddress);
+PVOID MmAllocateContiguousMemorySpecifyCache (
+    SIZE_T NumberOfBytes,
+    PHYSICAL_ADDRESS LowestAcceptableAddress,
+    PHYSICAL_ADDRESS HighestAcceptableAddress,
+    PHYSICAL_ADDRESS BoundaryAddressMultiple,
+    MEMORY_CACHING_TYPE CacheType
+    );
+PVOID MmAllocateContiguousNodeMemory (
+    SIZE_T NumberOfBytes,
+    PHYSICAL_ADDRESS LowestAcceptableAddress,
+    PHYSICAL_ADDRESS HighestAcceptableAddress,
+    PHYSICAL_ADDRESS BoundaryAddressMultiple,
+    ULONG Protect,
+    NODE_REQUIREMENT PreferredNode
+    );
+VOID MmFreeContiguousMemory (PVOID BaseAddress);
+PHYSICAL_ADDRESS MmGetPhysicalAddress (PVOID BaseAddress);
+
+WDKHOST_EXTERN_C_END
+
+#endif // _SIMKERNEL_H_
@@ -0,0 +1,7 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Host-side test harness stand-in for the WDK header of the same name
+//
+
+#include "wdkhost.h"
@@ -0,0 +1,828 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Module Name:
+//
+//  wdkhost.h
+//
+// Abstract:
+//
+//  The subset of the WDK kernel headers the BCM2836 SD miniports compile
+//  against, mapped onto the simulated kernel of the host-side test harness.
+//  Types keep their Windows widths (ULONG is 32-bit, WCHAR is 16-bit with
+//  -fshort-wchar) so driver structures keep their layout
+//
+// Environment:
+//
+//  Host user mode, C and C++
+//
+
+#ifndef _WDKHOST_H_
+#define _WDKHOST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifdef __cplusplus
+#define WDKHOST_EXTERN_C extern "C"
+#define WDKHOST_EXTERN_C_BEGIN extern "C" {
+#define WDKHOST_EXTERN_C_END }
+#else
+#define WDKHOST_EXTERN_C extern
+#define WDKHOST_EXTERN_C_BEGIN
+#define WDKHOST_EXTERN_C_END
+#endif // __cplusplus
+
+//
+// Target version, rpiq.h and rpisdhcstats.h only expose their content to
+// Threshold and later
+//
+
+#define NTDDI_WINTHRESHOLD                  0x0A000000
+#ifndef NTDDI_VERSION
+#define NTDDI_VERSION                       NTDDI_WINTHRESHOLD
+#endif // NTDDI_VERSION
+
+//
+// Compiler keywords
+//
+
+#define __cdecl
+#define __stdcall
+#define NTAPI
+#define NTSYSAPI
+#define NTKERNELAPI
+#define FASTCALL
+#define __declspec(x)                       __declspec_##x
+#define __declspec_align(n)                 __attribute__((aligned(n)))
+#define __declspec_noinline                 __attribute__((noinline))
+#define __declspec_selectany                __attribute__((weak))
+#define __pragma(x)
+#ifndef __cplusplus
+#define __forceinline                       static inline __attribute__((always_inline))
+#else
+#define __forceinline                       inline __attribute__((always_inline))
+#endif // __cplusplus
+#define FORCEINLINE                         __forceinline
+#define DECLSPEC_ALIGN(n)                   __attribute__((aligned(n)))
+#define UNALIGNED
+#ifdef __cplusplus
+#define C_ASSERT(e)                         static_assert(e, #e)
+#else
+#define C_ASSERT(e)                         _Static_assert(e, #e)
+#endif // __cplusplus
+
+//
+// SAL annotations
+//
+
+#define _Use_decl_annotations_
+#define __fallthrough
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _In_reads_(n)
+#define _In_reads_bytes_(n)
+#define _In_reads_opt_(n)
+#define _Out_writes_(n)
+#define _Out_writes_bytes_(n)
+#define _Out_writes_all_(n)
+#define _Out_writes_bytes_all_(n)
+#define _Inout_updates_(n)
+#define _Inout_updates_bytes_(n)
+#define _When_(c, a)
+#define _Must_inspect_result_
+#define _Success_(e)
+#define _Ret_maybenull_
+#define _Post_writable_byte_size_(n)
+#define _Function_class_(n)
+#define _IRQL_requires_(n)
+#define _IRQL_requires_max_(n)
+#define _IRQL_requires_min_(n)
+#define _IRQL_requires_same_
+#define _IRQL_raises_(n)
+#define _IRQL_saves_
+#define _IRQL_restores_
+#define _IRQL_saves_global_(k, n)
+#define _IRQL_restores_global_(k, n)
+#define _Requires_lock_held_(l)
+#define _Requires_lock_not_held_(l)
+#define _Acquires_lock_(l)
+#define _Releases_lock_(l)
+#define _Guarded_by_(l)
+#define _Interlocked_
+#define _Analysis_assume_(e)
+#define _Dispatch_type_(n)
+
+//
+// Legacy SAL, only the C miniport uses it and libstdc++ takes the same
+// names as identifiers
+//
+#ifndef __cplusplus
+#define __in
+#define __out
+#define __inout
+#define __in_opt
+#endif // __cplusplus
+#define __drv_formatString(k)
+#define __drv_dispatchType(n)
+
+//
+// Base types
+//
+
+typedef void VOID;
+typedef void* PVOID;
+typedef char CHAR;
+typedef CHAR* PCHAR;
+typedef CHAR* PSTR;
+typedef const CHAR* PCSTR;
+typedef unsigned char UCHAR;
+typedef UCHAR* PUCHAR;
+typedef short SHORT;
+typedef unsigned short USHORT;
+typedef USHORT* PUSHORT;
+typedef int32_t LONG;
+typedef LONG* PLONG;
+typedef uint32_t ULONG;
+typedef ULONG* PULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef LONGLONG* PLONGLONG;
+typedef ULONGLONG* PULONGLONG;
+typedef int INT;
+typedef unsigned int UINT;
+typedef int8_t INT8;
+typedef uint8_t UINT8;
+typedef int16_t INT16;
+typedef uint16_t UINT16;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef uint32_t DWORD;
+typedef uint16_t WORD;
+typedef uint8_t BYTE;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef ULONG_PTR* PULONG_PTR;
+typedef ULONG_PTR SIZE_T;
+typedef SIZE_T* PSIZE_T;
+typedef uint64_t DWORD64;
+typedef UCHAR BOOLEAN;
+typedef BOOLEAN* PBOOLEAN;
+typedef int BOOL;
+typedef wchar_t WCHAR;
+typedef WCHAR* PWCH;
+typedef WCHAR* PWSTR;
+typedef const WCHAR* PCWSTR;
+typedef LONG NTSTATUS;
+typedef NTSTATUS* PNTSTATUS;
+typedef UCHAR KIRQL;
+typedef KIRQL* PKIRQL;
+typedef LONG KPRIORITY;
+typedef ULONG_PTR KAFFINITY;
+typedef ULONG_PTR KSPIN_LOCK;
+typedef KSPIN_LOCK* PKSPIN_LOCK;
+typedef PVOID HANDLE;
+typedef HANDLE* PHANDLE;
+typedef ULONG ACCESS_MASK;
+typedef ULONG DEVICE_TYPE;
+typedef ULONG LOGICAL;
+typedef CHAR KPROCESSOR_MODE;
+
+C_ASSERT(sizeof(WCHAR) == 2);
+
+#ifndef NULL
+#define NULL                                0
+#endif // NULL
+#define TRUE                                1
+#define FALSE                               0
+
+#define MAXLONG                             0x7fffffff
+#define MAXULONG                            0xffffffff
+#define MAXLONGLONG                         (0x7fffffffffffffffLL)
+#define MAXULONGLONG                        (~(ULONGLONG)0)
+#define MAXUSHORT                           0xffff
+#define MAXUCHAR                            0xff
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        ULONG HighPart;
+    };
+    struct {
+        ULONG LowPart;
+        ULONG HighPart;
+    } u;
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef LARGE_INTEGER PHYSICAL_ADDRESS, *PPHYSICAL_ADDRESS;
+
+typedef struct _GUID {
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID, *PGUID;
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    WDKHOST_EXTERN_C const GUID name __attribute__((weak)) = \
+        { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define RTL_CONSTANT_STRING(s) \
+    { (USHORT)(sizeof(s) - sizeof((s)[0])), (USHORT)sizeof(s), (PWCH)(s) }
+
+#define DECLARE_CONST_UNICODE_STRING(_var, _string) \
+    const WCHAR _var##_buffer[] = _string; \
+    const UNICODE_STRING _var = \
+        { (USHORT)(sizeof(_string) - sizeof(WCHAR)), (USHORT)sizeof(_string), (PWCH)_var##_buffer }
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY* Flink;
+    struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+//
+// Helper macros
+//
+
+#define UNREFERENCED_PARAMETER(p)           ((void)(p))
+#define DBG_UNREFERENCED_LOCAL_VARIABLE(v)  ((void)(v))
+#define ARRAYSIZE(a)                        (sizeof(a) / sizeof((a)[0]))
+#define RTL_NUMBER_OF(a)                    ARRAYSIZE(a)
+#define FIELD_OFFSET(t, f)                  ((LONG)offsetof(t, f))
+#define CONTAINING_RECORD(a, t, f)          ((t*)((PCHAR)(a) - offsetof(t, f)))
+#define BOOLIFY(e)                          (!!(e))
+#define PAGED_CODE()
+#define INIT_CODE()
+#define ALIGN_UP_BY(l, a)                   ((((ULONG_PTR)(l)) + ((a) - 1)) & ~((ULONG_PTR)(a) - 1))
+#define ALIGN_DOWN_BY(l, a)                 (((ULONG_PTR)(l)) & ~((ULONG_PTR)(a) - 1))
+
+#ifndef NOMINMAX
+#ifndef min
+#define min(a, b)                           (((a) < (b)) ? (a) : (b))
+#endif // min
+#ifndef max
+#define max(a, b)                           (((a) > (b)) ? (a) : (b))
+#endif // max
+#endif // NOMINMAX
+
+//
+// Status codes
+//
+
+#define NT_SUCCESS(s)                       (((NTSTATUS)(s)) >= 0)
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_WAIT_0                       ((NTSTATUS)0x00000000L)
+#define STATUS_WAIT_1                       ((NTSTATUS)0x00000001L)
+#define STATUS_WAIT_2                       ((NTSTATUS)0x00000002L)
+#define STATUS_WAIT_3                       ((NTSTATUS)0x00000003L)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103L)
+#define STATUS_MORE_PROCESSING_REQUIRED     ((NTSTATUS)0xC0000016L)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED              ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_HANDLE               ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_SUCH_DEVICE               ((NTSTATUS)0xC000000EL)
+#define STATUS_INVALID_DEVICE_REQUEST       ((NTSTATUS)0xC0000010L)
+#define STATUS_ACCESS_DENIED                ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034L)
+#define STATUS_OBJECT_NAME_COLLISION        ((NTSTATUS)0xC0000035L)
+#define STATUS_DATA_ERROR                   ((NTSTATUS)0xC000003EL)
+#define STATUS_CRC_ERROR                    ((NTSTATUS)0xC000003FL)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_DEVICE_NOT_READY             ((NTSTATUS)0xC00000A3L)
+#define STATUS_INVALID_DEVICE_STATE         ((NTSTATUS)0xC0000184L)
+#define STATUS_IO_DEVICE_ERROR              ((NTSTATUS)0xC0000185L)
+#define STATUS_DEVICE_PROTOCOL_ERROR        ((NTSTATUS)0xC0000186L)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BBL)
+#define STATUS_CANCELLED                    ((NTSTATUS)0xC0000120L)
+#define STATUS_INVALID_ADDRESS              ((NTSTATUS)0xC0000141L)
+#define STATUS_INVALID_LEVEL                ((NTSTATUS)0xC0000148L)
+#define STATUS_DEVICE_DATA_ERROR            ((NTSTATUS)0xC000009CL)
+#define STATUS_DEVICE_POWER_FAILURE         ((NTSTATUS)0xC000009EL)
+#define STATUS_IO_TIMEOUT                   ((NTSTATUS)0xC00000B5L)
+#define STATUS_DEVICE_BUSY                  ((NTSTATUS)0x80000011L)
+#define STATUS_NO_MEDIA_IN_DEVICE           ((NTSTATUS)0xC0000013L)
+#define STATUS_DEVICE_CONFIGURATION_ERROR   ((NTSTATUS)0xC0000182L)
+#define STATUS_RESOURCE_TYPE_NOT_FOUND      ((NTSTATUS)0xC000008AL)
+
+//
+// IRQLs, priorities, processors
+//
+
+#define PASSIVE_LEVEL                       0
+#define LOW_LEVEL                           0
+#define APC_LEVEL                           1
+#define DISPATCH_LEVEL                      2
+#define CLOCK_LEVEL                         13
+#define HIGH_LEVEL                          15
+
+#define LOW_PRIORITY                        0
+#define LOW_REALTIME_PRIORITY               16
+#define HIGH_PRIORITY                       31
+
+#define ALL_PROCESSOR_GROUPS                0xffff
+
+typedef struct _PROCESSOR_NUMBER {
+    USHORT Group;
+    UCHAR Number;
+    UCHAR Reserved;
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+typedef enum _MODE {
+    KernelMode,
+    UserMode,
+    MaximumMode
+} MODE;
+
+typedef enum _KWAIT_REASON {
+    Executive = 0,
+    UserRequest = 6,
+    WrExecutive = 7
+} KWAIT_REASON;
+
+typedef enum _WAIT_TYPE {
+    WaitAll,
+    WaitAny
+} WAIT_TYPE;
+
+typedef enum _EVENT_TYPE {
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+//
+// Dispatcher objects
+//
+
+typedef struct _DISPATCHER_HEADER {
+    UCHAR Type;
+    UCHAR Reserved[3];
+    LONG SignalState;
+    PVOID SimWaitList;
+} DISPATCHER_HEADER, *PDISPATCHER_HEADER;
+
+typedef struct _KEVENT {
+    DISPATCHER_HEADER Header;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef struct _KTHREAD {
+    DISPATCHER_HEADER Header;
+    PVOID SimThread;
+} KTHREAD, *PKTHREAD, *PRKTHREAD, ETHREAD, *PETHREAD;
+
+typedef struct _KWAIT_BLOCK {
+    PVOID Reserved[4];
+} KWAIT_BLOCK, *PKWAIT_BLOCK;
+
+#define THREAD_WAIT_OBJECTS                 3
+#define MAXIMUM_WAIT_OBJECTS                64
+
+typedef struct _FAST_MUTEX {
+    LONG Count;
+    PVOID Owner;
+    ULONG Contention;
+    KEVENT Event;
+    ULONG OldIrql;
+} FAST_MUTEX, *PFAST_MUTEX;
+
+typedef struct _KLOCK_QUEUE_HANDLE {
+    PKSPIN_LOCK LockPtr;
+    KIRQL OldIrql;
+} KLOCK_QUEUE_HANDLE, *PKLOCK_QUEUE_HANDLE;
+
+struct _KDPC;
+
+typedef VOID KDEFERRED_ROUTINE (
+    struct _KDPC* Dpc,
+    PVOID DeferredContext,
+    PVOID SystemArgument1,
+    PVOID SystemArgument2
+    );
+typedef KDEFERRED_ROUTINE* PKDEFERRED_ROUTINE;
+
+typedef struct _KDPC {
+    PKDEFERRED_ROUTINE DeferredRoutine;
+    PVOID DeferredContext;
+    PVOID SystemArgument1;
+    PVOID SystemArgument2;
+    LONG Queued;
+} KDPC, *PKDPC, *PRKDPC;
+
+typedef struct _KTIMER {
+    DISPATCHER_HEADER Header;
+    LONGLONG DueTime;
+    LONG Period;
+    PKDPC Dpc;
+    LONG Inserted;
+} KTIMER, *PKTIMER;
+
+typedef struct _EX_TIMER* PEX_TIMER;
+
+typedef VOID EXT_CALLBACK (
+    PEX_TIMER Timer,
+    PVOID Context
+    );
+typedef EXT_CALLBACK* PEXT_CALLBACK;
+
+typedef VOID EXT_DELETE_CALLBACK (
+    PVOID Context
+    );
+typedef EXT_DELETE_CALLBACK* PEXT_DELETE_CALLBACK;
+
+typedef struct _EXT_SET_PARAMETERS_V0 {
+    ULONG Version;
+    ULONG Reserved;
+    LONGLONG NoWakeTolerance;
+} EXT_SET_PARAMETERS, *PEXT_SET_PARAMETERS;
+
+typedef struct _EXT_CANCEL_PARAMETERS {
+    ULONG Version;
+    ULONG Reserved;
+    PVOID Reserved2;
+} EXT_CANCEL_PARAMETERS, *PEXT_CANCEL_PARAMETERS;
+
+typedef struct _EXT_DELETE_PARAMETERS {
+    ULONG Version;
+    ULONG Reserved;
+    PEXT_DELETE_CALLBACK DeleteCallback;
+    PVOID DeleteContext;
+} EXT_DELETE_PARAMETERS, *PEXT_DELETE_PARAMETERS;
+
+#define EX_TIMER_HIGH_RESOLUTION            0x4
+#define EX_TIMER_NO_WAKE                    0x8
+#define EX_TIMER_NOTIFICATION               0x80000000
+
+typedef VOID KSTART_ROUTINE (
+    PVOID StartContext
+    );
+typedef KSTART_ROUTINE* PKSTART_ROUTINE;
+
+//
+// Memory
+//
+
+#define PAGE_SIZE                           0x1000
+#define PAGE_SHIFT                          12
+#define BYTES_TO_PAGES(s)                   (((s) + PAGE_SIZE - 1) >> PAGE_SHIFT)
+#define ROUND_TO_PAGES(s)                   (((ULONG_PTR)(s) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#define PAGE_NOACCESS                       0x01
+#define PAGE_READONLY                       0x02
+#define PAGE_READWRITE                      0x04
+#define PAGE_GUARD                          0x100
+#define PAGE_NOCACHE                        0x200
+#define PAGE_WRITECOMBINE                   0x400
+
+#define MM_ANY_NODE_OK                      0x80000000
+
+typedef ULONG NODE_REQUIREMENT;
+
+typedef enum _MEMORY_CACHING_TYPE {
+    MmNonCached = 0,
+    MmCached = 1,
+    MmWriteCombined = 2
+} MEMORY_CACHING_TYPE;
+
+typedef enum _POOL_TYPE {
+    NonPagedPool = 0,
+    NonPagedPoolExecute = 0,
+    PagedPool = 1,
+    NonPagedPoolNx = 512
+} POOL_TYPE;
+
+#define POOL_FLAG_NON_PAGED                 0x0000000000000040ULL
+#define POOL_FLAG_PAGED                     0x0000000000000100ULL
+#define POOL_FLAG_UNINITIALIZED             0x0000000000000002ULL
+
+typedef ULONGLONG POOL_FLAGS;
+
+//
+// Objects, files, registry
+//
+
+typedef struct _OBJECT_TYPE* POBJECT_TYPE;
+
+typedef struct _OBJECT_ATTRIBUTES {
+    ULONG Length;
+    HANDLE RootDirectory;
+    PUNICODE_STRING ObjectName;
+    ULONG Attributes;
+    PVOID SecurityDescriptor;
+    PVOID SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+#define OBJ_INHERIT                         0x00000002L
+#define OBJ_CASE_INSENSITIVE                0x00000040L
+#define OBJ_KERNEL_HANDLE                   0x00000200L
+
+#define InitializeObjectAttributes(p, n, a, r, s) { \
+    (p)->Length = sizeof(OBJECT_ATTRIBUTES); \
+    (p)->RootDirectory = r; \
+    (p)->Attributes = a; \
+    (p)->ObjectName = n; \
+    (p)->SecurityDescriptor = s; \
+    (p)->SecurityQualityOfService = NULL; \
+    }
+
+typedef struct _IO_STATUS_BLOCK {
+    union {
+        NTSTATUS Status;
+        PVOID Pointer;
+    };
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef enum _KEY_VALUE_INFORMATION_CLASS {
+    KeyValueBasicInformation,
+    KeyValueFullInformation,
+    KeyValuePartialInformation
+} KEY_VALUE_INFORMATION_CLASS;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION {
+    ULONG TitleIndex;
+    ULONG Type;
+    ULONG DataLength;
+    UCHAR Data[1];
+} KEY_VALUE_PARTIAL_INFORMATION, *PKEY_VALUE_PARTIAL_INFORMATION;
+
+#define REG_NONE                            0
+#define REG_SZ                              1
+#define REG_BINARY                          3
+#define REG_DWORD                           4
+
+#define DELETE                              0x00010000L
+#define SYNCHRONIZE                         0x00100000L
+#define STANDARD_RIGHTS_REQUIRED            0x000F0000L
+#define GENERIC_READ                        0x80000000L
+#define GENERIC_WRITE                       0x40000000L
+#define GENERIC_ALL                         0x10000000L
+#define KEY_QUERY_VALUE                     0x0001
+#define KEY_READ                            0x20019
+#define THREAD_ALL_ACCESS                   (STANDARD_RIGHTS_REQUIRED | SYNCHRONIZE | 0xFFFF)
+#define FILE_READ_DATA                      0x0001
+#define FILE_WRITE_DATA                     0x0002
+#define FILE_ANY_ACCESS                     0
+#define FILE_SHARE_READ                     0x00000001
+#define FILE_SHARE_WRITE                    0x00000002
+#define FILE_ATTRIBUTE_NORMAL               0x00000080
+#define FILE_OPEN                           0x00000001
+#define FILE_NON_DIRECTORY_FILE             0x00000040
+#define FILE_SYNCHRONOUS_IO_NONALERT        0x00000020
+
+#define METHOD_BUFFERED                     0
+#define METHOD_IN_DIRECT                    1
+#define METHOD_OUT_DIRECT                   2
+#define METHOD_NEITHER                      3
+
+#define CTL_CODE(t, f, m, a)                (((t) << 16) | ((a) << 14) | ((f) << 2) | (m))
+
+//
+// I/O manager
+//
+
+#define IRP_MJ_CREATE                       0x00
+#define IRP_MJ_CLOSE                        0x02
+#define IRP_MJ_READ                         0x03
+#define IRP_MJ_WRITE                        0x04
+#define IRP_MJ_DEVICE_CONTROL               0x0e
+#define IRP_MJ_INTERNAL_DEVICE_CONTROL      0x0f
+#define IRP_MJ_CLEANUP                      0x12
+#define IRP_MJ_PNP                          0x1b
+#define IRP_MJ_MAXIMUM_FUNCTION             0x1b
+
+#define IRP_MN_START_DEVICE                 0x00
+
+#define IO_NO_INCREMENT                     0
+
+#define DO_BUFFERED_IO                      0x00000004
+#define DO_DIRECT_IO                        0x00000010
+#define DO_DEVICE_INITIALIZING              0x00000080
+
+#define FILE_DEVICE_UNKNOWN                 0x00000022
+#define FILE_DEVICE_SECURE_OPEN             0x00000100
+
+#define FILE_DEVICE_CONTROLLER              0x00000004
+
+//
+// Resource descriptors
+//
+
+#define CmResourceTypeNull                  0
+#define CmResourceTypePort                  1
+#define CmResourceTypeInterrupt             2
+#define CmResourceTypeMemory                3
+#define CmResourceTypeDma                   4
+
+typedef enum _DMA_WIDTH {
+    Width8Bits,
+    Width16Bits,
+    Width32Bits,
+    Width64Bits,
+    WidthNoWrap,
+    MaximumDmaWidth
+} DMA_WIDTH;
+
+typedef enum _INTERFACE_TYPE {
+    Internal = 0
+} INTERFACE_TYPE;
+
+typedef struct _CM_PARTIAL_RESOURCE_DESCRIPTOR {
+    UCHAR Type;
+    UCHAR ShareDisposition;
+    USHORT Flags;
+    union {
+        struct {
+            PHYSICAL_ADDRESS Start;
+            ULONG Length;
+        } Memory;
+        struct {
+            ULONG Level;
+            ULONG Vector;
+            KAFFINITY Affinity;
+        } Interrupt;
+        struct {
+            ULONG Channel;
+            ULONG RequestLine;
+            UCHAR TransferWidth;
+            UCHAR Reserved1;
+            UCHAR Reserved2;
+            UCHAR Reserved3;
+        } DmaV3;
+    } u;
+} CM_PARTIAL_RESOURCE_DESCRIPTOR, *PCM_PARTIAL_RESOURCE_DESCRIPTOR;
+
+typedef struct _CM_PARTIAL_RESOURCE_LIST {
+    USHORT Version;
+    USHORT Revision;
+    ULONG Count;
+    CM_PARTIAL_RESOURCE_DESCRIPTOR PartialDescriptors[1];
+} CM_PARTIAL_RESOURCE_LIST, *PCM_PARTIAL_RESOURCE_LIST;
+
+typedef struct _CM_FULL_RESOURCE_DESCRIPTOR {
+    INTERFACE_TYPE InterfaceType;
+    ULONG BusNumber;
+    CM_PARTIAL_RESOURCE_LIST PartialResourceList;
+} CM_FULL_RESOURCE_DESCRIPTOR, *PCM_FULL_RESOURCE_DESCRIPTOR;
+
+typedef struct _CM_RESOURCE_LIST {
+    ULONG Count;
+    CM_FULL_RESOURCE_DESCRIPTOR List[1];
+} CM_RESOURCE_LIST, *PCM_RESOURCE_LIST;
+
+struct _DRIVER_OBJECT;
+struct _DEVICE_OBJECT;
+struct _IRP;
+
+typedef NTSTATUS DRIVER_INITIALIZE (
+    struct _DRIVER_OBJECT* DriverObject,
+    PUNICODE_STRING RegistryPath
+    );
+typedef DRIVER_INITIALIZE* PDRIVER_INITIALIZE;
+
+typedef NTSTATUS DRIVER_DISPATCH (
+    struct _DEVICE_OBJECT* DeviceObject,
+    struct _IRP* Irp
+    );
+typedef DRIVER_DISPATCH* PDRIVER_DISPATCH;
+
+typedef VOID DRIVER_UNLOAD (
+    struct _DRIVER_OBJECT* DriverObject
+    );
+typedef DRIVER_UNLOAD* PDRIVER_UNLOAD;
+
+typedef struct _DRIVER_OBJECT {
+    SHORT Type;
+    SHORT Size;
+    struct _DEVICE_OBJECT* DeviceObject;
+    PVOID DriverExtension;
+    UNICODE_STRING DriverName;
+    PDRIVER_INITIALIZE DriverInit;
+    PDRIVER_UNLOAD DriverUnload;
+    PDRIVER_DISPATCH MajorFunction[IRP_MJ_MAXIMUM_FUNCTION + 1];
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef struct _DEVICE_OBJECT {
+    SHORT Type;
+    USHORT Size;
+    struct _DRIVER_OBJECT* DriverObject;
+    struct _DEVICE_OBJECT* NextDevice;
+    ULONG Flags;
+    ULONG Characteristics;
+    PVOID DeviceExtension;
+    DEVICE_TYPE DeviceType;
+    CHAR StackSize;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _FILE_OBJECT {
+    SHORT Type;
+    SHORT Size;
+    PDEVICE_OBJECT DeviceObject;
+    PVOID FsContext;
+    PVOID FsContext2;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _IO_STACK_LOCATION {
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    UCHAR Flags;
+    UCHAR Control;
+    union {
+        struct {
+            ULONG OutputBufferLength;
+            ULONG InputBufferLength;
+            ULONG IoControlCode;
+            PVOID Type3InputBuffer;
+        } DeviceIoControl;
+        struct {
+            PCM_RESOURCE_LIST AllocatedResources;
+            PCM_RESOURCE_LIST AllocatedResourcesTranslated;
+        } StartDevice;
+        struct {
+            PVOID Argument1;
+            PVOID Argument2;
+            PVOID Argument3;
+            PVOID Argument4;
+        } Others;
+    } Parameters;
+    PDEVICE_OBJECT DeviceObject;
+    PFILE_OBJECT FileObject;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP {
+    SHORT Type;
+    USHORT Size;
+    IO_STATUS_BLOCK IoStatus;
+    union {
+        PVOID SystemBuffer;
+    } AssociatedIrp;
+    PVOID UserBuffer;
+    PIO_STATUS_BLOCK UserIosb;
+    PKEVENT UserEvent;
+    CHAR StackCount;
+    CHAR CurrentLocation;
+    IO_STACK_LOCATION Stack[4];
+} IRP, *PIRP;
+
+#define IoGetCurrentIrpStackLocation(irp)   (&(irp)->Stack[(irp)->CurrentLocation - 1])
+#define IoGetNextIrpStackLocation(irp)      (&(irp)->Stack[(irp)->CurrentLocation - 2])
+
+//
+// Debug output and assertions
+//
+
+#define DPFLTR_IHVDRIVER_ID                 77
+#define DPFLTR_DEFAULT_ID                   101
+#define DPFLTR_ERROR_LEVEL                  0
+#define DPFLTR_WARNING_LEVEL                1
+#define DPFLTR_TRACE_LEVEL                  2
+#define DPFLTR_INFO_LEVEL                   3
+
+#define TRACE_LEVEL_NONE                    0
+#define TRACE_LEVEL_CRITICAL                1
+#define TRACE_LEVEL_FATAL                   1
+#define TRACE_LEVEL_ERROR                   2
+#define TRACE_LEVEL_WARNING                 3
+#define TRACE_LEVEL_INFORMATION             4
+#define TRACE_LEVEL_VERBOSE                 5
+
+#define NT_ASSERT(e) \
+    ((void)((e) ? 0 : (SimAssertionFailure(#e, __FILE__, __LINE__), 0)))
+#define NT_ASSERTMSG(m, e) \
+    ((void)((e) ? 0 : (SimAssertionFailure(m, __FILE__, __LINE__), 0)))
+#define NT_VERIFY(e)                        NT_ASSERT(e)
+#define ASSERT(e)                           NT_ASSERT(e)
+#define ASSERTMSG(m, e)                     NT_ASSERTMSG(m, e)
+
+#include "simkernel.h"
+
+#endif // _WDKHOST_H_
@@ -0,0 +1,14 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Host-side test harness stand-in for the WDK header of the same name
+//
+
+#ifndef _WINAPIFAMILY_H_
+#define _WINAPIFAMILY_H_
+
+#define WINAPI_PARTITION_DESKTOP            1
+#define WINAPI_PARTITION_APP                1
+#define WINAPI_FAMILY_PARTITION(p)          (p)
+
+#endif // _WINAPIFAMILY_H_
@@ -5,8 +5,10 @@
 #include <Ntddk.h>
 #include <wdf.h>
 #include <wdmguid.h>
+#include <wdmsec.h>
 
 #include <rpiq.h>
+#include "rpisdhcstats.h"
 
 extern "C" {
     #include <sdport.h>
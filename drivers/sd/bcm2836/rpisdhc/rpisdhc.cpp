@@ -41,6 +41,44 @@ NTSTATUS SDHC::readFromFifo (
 #endif // ENABLE_PERFORMANCE_LOGGING
 
     while (count) {
+
+#if ENABLE_FIFO_BURST_IO
+
+        //
+        // Drain whatever the FIFO already holds in one fence-free run, and only
+        // fall back to polling the data flag per word when the FIFO is empty
+        //
+        _EDM edm; this->readRegisterNoFence(&edm);
+        ULONG burstCount = min(ULONG(edm.Fields.FifoCount), count);
+        if (burstCount) {
+            count -= burstCount;
+
+            while (burstCount >= 4) {
+                wordPtr[0] = this->readRegisterNoFence<_DATA>().AsUint32;
+                wordPtr[1] = this->readRegisterNoFence<_DATA>().AsUint32;
+                wordPtr[2] = this->readRegisterNoFence<_DATA>().AsUint32;
+                wordPtr[3] = this->readRegisterNoFence<_DATA>().AsUint32;
+                wordPtr += 4;
+                burstCount -= 4;
+            } // while (burstCount >= 4)
+
+            while (burstCount) {
+                *wordPtr = this->readRegisterNoFence<_DATA>().AsUint32;
+                ++wordPtr;
+                --burstCount;
+            } // while (burstCount)
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+            ++this->currRequestStats.FifoBurstCount;
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
+            continue;
+        } // if
+
+#endif // ENABLE_FIFO_BURST_IO
+
         NTSTATUS waitStatus = this->waitForDataFlag(&waitTimeUs);
         if (!NT_SUCCESS(waitStatus)) {
             this->updateAllRegistersDump();
@@ -68,6 +106,23 @@ NTSTATUS SDHC::readFromFifo (
         --count;
     } // while (count)
 
+#if ENABLE_FIFO_BURST_IO
+
+    //
+    // Bursts don't look at the status register, catch any FIFO or CRC error
+    // raised during the block
+    //
+    _HSTS hsts; this->readRegisterNoFence(&hsts);
+    if (hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) {
+        this->updateAllRegistersDump();
+        SDHC_LOG_ERROR(
+            "HW error reported during FIFO IO. (hsts.AsUint32 = 0x%lx)",
+            ULONG(hsts.AsUint32));
+        return this->getErrorStatus(hsts);
+    } // if
+
+#endif // ENABLE_FIFO_BURST_IO
+
 #if ENABLE_PERFORMANCE_LOGGING
 
     LARGE_INTEGER endTimestamp = KeQueryPerformanceCounter(NULL);
@@ -97,6 +152,45 @@ NTSTATUS SDHC::writeToFifo (
 #endif // ENABLE_PERFORMANCE_LOGGING
 
     while (count) {
+
+#if ENABLE_FIFO_BURST_IO
+
+        //
+        // Fill whatever room the FIFO has in one fence-free run, and only
+        // fall back to polling the data flag per word when the FIFO is full
+        //
+        _EDM edm; this->readRegisterNoFence(&edm);
+        ULONG fifoCount = min(ULONG(edm.Fields.FifoCount), ULONG(_FIFO_WORDS));
+        ULONG burstCount = min(ULONG(_FIFO_WORDS) - fifoCount, count);
+        if (burstCount) {
+            count -= burstCount;
+
+            while (burstCount >= 4) {
+                this->writeRegisterNoFence(_DATA{ wordPtr[0] });
+                this->writeRegisterNoFence(_DATA{ wordPtr[1] });
+                this->writeRegisterNoFence(_DATA{ wordPtr[2] });
+                this->writeRegisterNoFence(_DATA{ wordPtr[3] });
+                wordPtr += 4;
+                burstCount -= 4;
+            } // while (burstCount >= 4)
+
+            while (burstCount) {
+                this->writeRegisterNoFence(_DATA{ *wordPtr });
+                ++wordPtr;
+                --burstCount;
+            } // while (burstCount)
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+            ++this->currRequestStats.FifoBurstCount;
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
+            continue;
+        } // if
+
+#endif // ENABLE_FIFO_BURST_IO
+
         NTSTATUS waitStatus = this->waitForDataFlag(&waitTimeUs);
         if (!NT_SUCCESS(waitStatus)) {
             this->updateAllRegistersDump();
@@ -124,6 +218,23 @@ NTSTATUS SDHC::writeToFifo (
         --count;
     } // while (count)
 
+#if ENABLE_FIFO_BURST_IO
+
+    //
+    // Bursts don't look at the status register, catch any FIFO or CRC error
+    // raised during the block
+    //
+    _HSTS hsts; this->readRegisterNoFence(&hsts);
+    if (hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) {
+        this->updateAllRegistersDump();
+        SDHC_LOG_ERROR(
+            "HW error reported during FIFO IO. (hsts.AsUint32 = 0x%lx)",
+            ULONG(hsts.AsUint32));
+        return this->getErrorStatus(hsts);
+    } // if
+
+#endif // ENABLE_FIFO_BURST_IO
+
 #if ENABLE_PERFORMANCE_LOGGING
 
     LARGE_INTEGER endTimestamp = KeQueryPerformanceCounter(NULL);
@@ -174,9 +285,26 @@ NTSTATUS SDHC::waitForFsmState (
     ) throw ()
 {
     ULONG retry = _POLL_RETRY_COUNT;
+    ULONG waitTimeUs = 0;
+    ULONG polledTimeUs = 0;
+
+#if ENABLE_ADAPTIVE_FSM_WAIT
+
+    //
+    // Block writes take the SDCard program time to reach WRITESTART1, give
+    // up the core for most of it before falling back to tight polling
+    //
+    ULONG relaxTimeUs = 0;
+    ULONG relaxTargetUs = 0;
+    if (state == _EDM::UINT32_FSM_WRITESTART1) {
+        relaxTimeUs = this->relaxForFsmState(state, &relaxTargetUs);
+        waitTimeUs += relaxTimeUs;
+    } // if
+
+#endif // ENABLE_ADAPTIVE_FSM_WAIT
+
     _HSTS hsts; this->readRegisterNoFence(&hsts);
     _EDM edm; this->readRegisterNoFence(&edm);
-    ULONG waitTimeUs = 0;
 
     while ((edm.Fields.StateMachine != state) &&
            !(hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) &&
@@ -184,6 +312,7 @@ NTSTATUS SDHC::waitForFsmState (
 
         ::SdPortWait(_POLL_WAIT_US);
         waitTimeUs += _POLL_WAIT_US;
+        polledTimeUs += _POLL_WAIT_US;
         this->readRegisterNoFence(&hsts);
         this->readRegisterNoFence(&edm);
         --retry;
@@ -201,8 +330,33 @@ NTSTATUS SDHC::waitForFsmState (
     this->currRequestStats.FsmStateMinWaitTimeUs =
         min(this->currRequestStats.FsmStateMinWaitTimeUs, waitTimeUs);
 
+    ++this->sdhcStats.FsmStateWaitHistogram[
+        getHistogramBucket(waitTimeUs, _FSM_WAIT_HISTOGRAM_BUCKETS)];
+
 #endif // ENABLE_PERFORMANCE_LOGGING
 
+#if ENABLE_ADAPTIVE_FSM_WAIT
+
+    if ((state == _EDM::UINT32_FSM_WRITESTART1) &&
+        (edm.Fields.StateMachine == state)) {
+        //
+        // Only learn from what polling observed, the relax time overshoots by
+        // the timer latency. Still short of the state after relaxing means the
+        // SDCard took the relax time plus the polled time. Reaching it while
+        // relaxing only tells it took at most the relax target
+        //
+        ULONG sampleUs = polledTimeUs;
+        if (relaxTimeUs) {
+            sampleUs = polledTimeUs ? (relaxTimeUs + polledTimeUs) : relaxTargetUs;
+        } // if
+
+        LONG deltaUs = LONG(sampleUs) - LONG(this->fsmWaitEstimateUs);
+        this->fsmWaitEstimateUs = ULONG(
+            LONG(this->fsmWaitEstimateUs) + (deltaUs / (1 << _FSM_WAIT_ESTIMATE_EWMA_SHIFT)));
+    } // if
+
+#endif // ENABLE_ADAPTIVE_FSM_WAIT
+
     if (hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) {
         if (hsts.Fields.RewTimeOut) {
             SDHC_LOG_ERROR(
@@ -246,6 +400,71 @@ NTSTATUS SDHC::waitForFsmState (
 
 } // SDHC::waitForFsmState ()
 
+_Use_decl_annotations_
+ULONG SDHC::relaxForFsmState (
+    ULONG State,
+    ULONG* RelaxTargetUsPtr
+    ) throw ()
+{
+    *RelaxTargetUsPtr = 0;
+
+    //
+    // Only the transfer worker running at PASSIVE_LEVEL, or at APC_LEVEL holding
+    // the outstanding request lock, can give up its core. Cards programming
+    // faster than the timer period plus the spin window gain nothing from it
+    //
+    if (this->crashdumpMode ||
+        (KeGetCurrentIrql() > APC_LEVEL) ||
+        (this->fsmWaitEstimateUs <= this->fsmRelaxSpinMarginUs)) {
+        return 0;
+    } // if
+
+    _HSTS hsts; this->readRegisterNoFence(&hsts);
+    _EDM edm; this->readRegisterNoFence(&edm);
+    if ((edm.Fields.StateMachine == State) ||
+        (hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK)) {
+        return 0;
+    } // if
+
+    LONGLONG relaxTimeUs = this->fsmWaitEstimateUs - this->fsmRelaxSpinMarginUs;
+    LARGE_INTEGER hpcFreqHz;
+    LARGE_INTEGER startTimestamp = KeQueryPerformanceCounter(&hpcFreqHz);
+
+    if (this->fsmRelaxTimerPtr) {
+        KeClearEvent(&this->fsmRelaxTimerEvt);
+        (void)ExSetTimer(this->fsmRelaxTimerPtr, -10ll * relaxTimeUs, 0, NULL);
+        (void)KeWaitForSingleObject(
+            &this->fsmRelaxTimerEvt,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL);
+    } else {
+        LARGE_INTEGER interval;
+        interval.QuadPart = -10ll * relaxTimeUs;
+        (void)KeDelayExecutionThread(KernelMode, FALSE, &interval);
+    } // iff
+
+    LARGE_INTEGER endTimestamp = KeQueryPerformanceCounter(NULL);
+    *RelaxTargetUsPtr = ULONG(relaxTimeUs);
+
+    return ULONG(
+        ((endTimestamp.QuadPart - startTimestamp.QuadPart) * 1000000ll) /
+        hpcFreqHz.QuadPart);
+} // SDHC::relaxForFsmState (...)
+
+_Use_decl_annotations_
+VOID SDHC::fsmRelaxTimerCallback (
+    PEX_TIMER TimerPtr,
+    PVOID ContextPtr
+    )
+{
+    UNREFERENCED_PARAMETER(TimerPtr);
+
+    auto thisPtr = static_cast<SDHC*>(ContextPtr);
+    (void)KeSetEvent(&thisPtr->fsmRelaxTimerEvt, 0, FALSE);
+} // SDHC::fsmRelaxTimerCallback (...)
+
 NTSTATUS SDHC::waitForLastCommandCompletion () throw ()
 {
     ULONG retry = _POLL_RETRY_COUNT;
@@ -293,6 +512,80 @@ NTSTATUS SDHC::drainReadFifo () throw ()
     } // iff
 }
 
+bool SDHC::isDataIdle () throw ()
+{
+    //
+    // An error ends the wait for data idle right away as well
+    //
+    _HSTS hsts; this->readRegisterNoFence(&hsts);
+    _EDM edm; this->readRegisterNoFence(&edm);
+
+    return (edm.Fields.StateMachine == _EDM::UINT32_FSM_IDENTMODE) ||
+        (edm.Fields.StateMachine == _EDM::UINT32_FSM_DATAMODE) ||
+        (edm.Fields.StateMachine == this->dataIdleAlternateFsmState) ||
+        ((hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) != 0);
+} // SDHC::isDataIdle ()
+
+NTSTATUS SDHC::waitForDataIdle () throw ()
+{
+    if (!this->dataIdlePending) {
+        return STATUS_SUCCESS;
+    } // if
+
+    this->dataIdlePending = false;
+
+#if ENABLE_ADAPTIVE_FSM_WAIT
+
+    //
+    // The transfer worker gives up its core while the SDCard programs the last
+    // written block, instead of polling for all of it
+    //
+    if (this->dataIdleAlternateFsmState == _EDM::UINT32_FSM_WRITESTART1) {
+        ULONG relaxTargetUs;
+        (void)this->relaxForFsmState(_EDM::UINT32_FSM_WRITESTART1, &relaxTargetUs);
+    } // if
+
+#endif // ENABLE_ADAPTIVE_FSM_WAIT
+
+    ULONG retry = _POLL_RETRY_COUNT;
+    _HSTS hsts; this->readRegisterNoFence(&hsts);
+    _EDM edm; this->readRegisterNoFence(&edm);
+
+    while ((edm.Fields.StateMachine != _EDM::UINT32_FSM_IDENTMODE) &&
+           (edm.Fields.StateMachine != _EDM::UINT32_FSM_DATAMODE) &&
+           (edm.Fields.StateMachine != this->dataIdleAlternateFsmState) &&
+           !(hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) &&
+            retry) {
+
+        ::SdPortWait(_POLL_WAIT_US);
+        this->readRegisterNoFence(&hsts);
+        this->readRegisterNoFence(&edm);
+        --retry;
+    } // while (...)
+
+    if (hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) {
+        return this->getErrorStatus(hsts);
+    } else if (!retry) {
+        SDHC_LOG_ERROR(
+            "Poll timeout waiting on data idle. (edm.Fields.StateMachine = 0x%lx)",
+            edm.Fields.StateMachine);
+        return STATUS_IO_TIMEOUT;
+    } // iff
+
+    //
+    // WORKAROUND:
+    // Without a STOP_TRANSMISSION, the SDHC FSM parks in READWAIT/WRITESTART1
+    // after the last block of a pre-defined block count transfer, and has to be
+    // forced back to data mode
+    //
+    if (edm.Fields.StateMachine == this->dataIdleAlternateFsmState) {
+        edm.Fields.Force = 1;
+        this->writeRegisterNoFence(edm);
+    } // if
+
+    return STATUS_SUCCESS;
+} // SDHC::waitForDataIdle ()
+
 _Use_decl_annotations_
 NTSTATUS SDHC::sdhcGetSlotCount (
    SD_MINIPORT* MiniportPtr,
@@ -386,6 +679,17 @@ BOOLEAN SDHC::sdhcInterrupt (
         (void)thisPtr->maskInterrupts(irptMask);
     } // if
 
+    //
+    // Block interrupt is only used to signal the end of a DMA data phase, mask
+    // it until the next DMA transfer re-enables it
+    //
+    if (hcfg.Fields.BlockIrptEn &&
+        sdhcEvents.Fields.BlockIrpt) {
+        _HCFG irptMask{ 0 };
+        irptMask.Fields.BlockIrptEn = 1;
+        (void)thisPtr->maskInterrupts(irptMask);
+    } // if
+
     *NotifySdioInterruptPtr = sdhcEvents.Fields.SdioIrpt;
 
     //
@@ -426,6 +730,39 @@ void SDHC::sdhcRequestDpc (
         ULONG(events.AsUint32),
         ULONG(errors.AsUint32));
 
+    //
+    // A DMA transfer request is owned by the transfer worker until it issues
+    // STOP_TRANSMISSION. Only report to the worker the end of the data phase on
+    // the block interrupt, or the error that cut it short, the worker tears down
+    // the DMA engine and hands the request back for completion
+    //
+    if (!thisPtr->crashdumpMode) {
+        bool dmaOwned = false;
+
+        KeAcquireSpinLockAtDpcLevel(&thisPtr->dmaRequestLock);
+
+        if (RequestPtr == thisPtr->dmaRequestPtr) {
+            dmaOwned = true;
+
+            if (errors.AsUint32 &&
+                ((thisPtr->dmaDataPhaseStatus == STATUS_PENDING) ||
+                 NT_SUCCESS(thisPtr->dmaDataPhaseStatus))) {
+                thisPtr->dmaDataPhaseStatus = thisPtr->getErrorStatus(errors);
+                (void)KeSetEvent(&thisPtr->dmaDataPhaseEvt, 0, FALSE);
+            } else if (events.Fields.BlockIrpt &&
+                       (thisPtr->dmaDataPhaseStatus == STATUS_PENDING)) {
+                thisPtr->dmaDataPhaseStatus = STATUS_SUCCESS;
+                (void)KeSetEvent(&thisPtr->dmaDataPhaseEvt, 0, FALSE);
+            } // iff
+        } // if
+
+        KeReleaseSpinLockFromDpcLevel(&thisPtr->dmaRequestLock);
+
+        if (dmaOwned) {
+            return;
+        } // if
+    } // if
+
     //
     // Clear the request's required events if they have completed.
     //
@@ -496,29 +833,43 @@ NTSTATUS SDHC::sdhcIssueRequest (
     case SdRequestTypeCommandNoTransfer:
     case SdRequestTypeCommandWithTransfer:
     {
-        status = thisPtr->sendRequestCommand(RequestPtr);
-        if (!NT_SUCCESS(status)) {
-            thisPtr->updateAllRegistersDump();
-            SDHC_LOG_ERROR(
-                "thisPtr->sendRequestCommand(...) failed. (status = %!STATUS!)",
-                status);
-            return status;
-        } // if
-
 #if ENABLE_PERFORMANCE_LOGGING
 
+        //
+        // The command may get issued by the transfer worker, have the request
+        // statistics ready before handing it over
+        //
         if (RequestPtr->Type == SdRequestTypeCommandWithTransfer) {
             RtlZeroMemory(&thisPtr->currRequestStats, sizeof(_REQUEST_STATISTICS));
             thisPtr->currRequestStats.StartTimestamp = KeQueryPerformanceCounter(NULL);
             thisPtr->currRequestStats.FsmStateMinWaitTimeUs = MAXLONGLONG;
             thisPtr->currRequestStats.BlockCount= RequestPtr->Command.BlockCount;
+            thisPtr->currRequestStats.DmaTransfer = thisPtr->isDmaTransfer(RequestPtr);
         } // if
 
 #endif // ENABLE_PERFORMANCE_LOGGING
 
+        status = thisPtr->sendRequestCommand(RequestPtr);
+        if (!NT_SUCCESS(status)) {
+            thisPtr->updateAllRegistersDump();
+            SDHC_LOG_ERROR(
+                "thisPtr->sendRequestCommand(...) failed. (status = %!STATUS!)",
+                status);
+            return status;
+        } // if
+
         break;
     }
     case SdRequestTypeStartTransfer:
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+        thisPtr->currRequestStats.CommandLatencyTicks =
+            KeQueryPerformanceCounter(NULL).QuadPart -
+            thisPtr->currRequestStats.StartTimestamp.QuadPart;
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
         status = thisPtr->startTransfer(RequestPtr);
         if (!NT_SUCCESS(status)) {
             thisPtr->updateAllRegistersDump();
@@ -719,6 +1070,45 @@ NTSTATUS SDHC::sdhcInitialize (
     } // if
 
     ExInitializeFastMutex(&thisPtr->outstandingRequestLock);
+    KeInitializeSpinLock(&thisPtr->dmaRequestLock);
+
+    KeInitializeEvent(
+        &thisPtr->dmaDataPhaseEvt,
+        NotificationEvent,
+        FALSE);
+
+#if ENABLE_ADAPTIVE_FSM_WAIT
+
+    KeInitializeEvent(
+        &thisPtr->fsmRelaxTimerEvt,
+        NotificationEvent,
+        FALSE);
+
+    thisPtr->fsmRelaxTimerPtr = ExAllocateTimer(
+        fsmRelaxTimerCallback,
+        thisPtr,
+        EX_TIMER_HIGH_RESOLUTION);
+    if (!thisPtr->fsmRelaxTimerPtr) {
+        SDHC_LOG_WARNING(
+            "Failed to allocate high resolution FSM relax timer, falling back to system timer sleeps");
+    } // if
+
+    //
+    // A high resolution timer expires up to the minimum timer period late, a
+    // system timer sleep up to a whole tick of the current timer resolution.
+    // Timer resolution is in 100ns units
+    //
+    ULONG maximumTime;
+    ULONG minimumTime;
+    ULONG currentTime;
+    ExQueryTimerResolution(&maximumTime, &minimumTime, &currentTime);
+
+    const ULONG timerPeriod =
+        thisPtr->fsmRelaxTimerPtr ? minimumTime : currentTime;
+    thisPtr->fsmRelaxSpinMarginUs =
+        ((timerPeriod + 9) / 10) + _ADAPTIVE_FSM_SPIN_WINDOW_US;
+
+#endif // ENABLE_ADAPTIVE_FSM_WAIT
 
     KeInitializeEvent(
         &thisPtr->transferWorkerStartedEvt,
@@ -832,6 +1222,25 @@ NTSTATUS SDHC::sdhcInitialize (
         return status;
     } // if
 
+#if ENABLE_DMA_TRANSFER
+
+    //
+    // DMA is an optimization, failing to set it up leaves the SDHC on PIO
+    //
+    status = thisPtr->initializeDma();
+    if (NT_SUCCESS(status)) {
+        //
+        // A DMA data phase is bounded by the largest block count HBLC can hold
+        //
+        thisPtr->sdhcCapabilities.MaximumBlockCount = _HBLC_MAX_BLOCK_COUNT;
+    } else {
+        SDHC_LOG_WARNING(
+            "thisPtr->initializeDma() failed, falling back to PIO transfers. (status = %!STATUS!)",
+            status);
+    } // iff
+
+#endif // ENABLE_DMA_TRANSFER
+
 #if ENABLE_STATUS_SAMPLING
 
     KeInitializeEvent(
@@ -885,6 +1294,23 @@ NTSTATUS SDHC::sdhcInitialize (
 
 #endif // ENABLE_STATUS_SAMPLING
 
+#if ENABLE_PERFORMANCE_LOGGING
+
+    //
+    // The statistics control device lives as long as there is an SDHC
+    // instance to collect statistics from, SDHC works just fine without it
+    //
+    status = referenceStatsDevice();
+    if (NT_SUCCESS(status)) {
+        thisPtr->statsDeviceReferenced = true;
+    } else {
+        SDHC_LOG_WARNING(
+            "SDHC::referenceStatsDevice() failed, statistics will not be exported. (status = %!STATUS!)",
+            status);
+    } // iff
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
     return STATUS_SUCCESS;
 } // SDHC::sdhcInitialize (...)
 
@@ -1063,6 +1489,33 @@ void SDHC::sdhcCleanup (
 
 #endif // ENABLE_STATUS_SAMPLING
 
+        thisPtr->releaseDma();
+
+        if (thisPtr->fsmRelaxTimerPtr) {
+            (void)ExDeleteTimer(thisPtr->fsmRelaxTimerPtr, TRUE, TRUE, NULL);
+            thisPtr->fsmRelaxTimerPtr = nullptr;
+        } // if
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+        if (thisPtr->statsDeviceReferenced) {
+            dereferenceStatsDevice();
+            thisPtr->statsDeviceReferenced = false;
+        } // if
+
+
+        for (ULONG bucket = 0; bucket < _FSM_WAIT_HISTOGRAM_BUCKETS; ++bucket) {
+            if (thisPtr->sdhcStats.FsmStateWaitHistogram[bucket]) {
+                SDHC_LOG_INFORMATION(
+                    "Fsm Wait Histogram [%luus, %luus): %lld",
+                    (bucket ? (1ul << (bucket - 1)) : 0ul),
+                    (1ul << bucket),
+                    thisPtr->sdhcStats.FsmStateWaitHistogram[bucket]);
+            } // if
+        } // for (bucket)
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
         thisPtr->~SDHC();
     } // while (slotCount)
 
@@ -1079,6 +1532,21 @@ NTSTATUS SDHC::resetHost (
         ULONG(ResetType));
 
     if (!this->crashdumpMode) {
+        //
+        // Cut short a DMA data phase the transfer worker may be waiting on, so
+        // that it tears down the DMA engine and gives up the request lock
+        //
+        KIRQL oldIrql;
+        KeAcquireSpinLock(&this->dmaRequestLock, &oldIrql);
+
+        if (this->dmaRequestPtr &&
+            (this->dmaDataPhaseStatus == STATUS_PENDING)) {
+            this->dmaDataPhaseStatus = STATUS_CANCELLED;
+            (void)KeSetEvent(&this->dmaDataPhaseEvt, 0, FALSE);
+        } // if
+
+        KeReleaseSpinLock(&this->dmaRequestLock, oldIrql);
+
         ExAcquireFastMutex(&this->outstandingRequestLock);
 
         //
@@ -1104,6 +1572,32 @@ NTSTATUS SDHC::resetHost (
                 "Acquired transfer request before reaching transfer worker (requestPtr = 0x%p)",
                 requestPtr);
         } // if
+
+        //
+        // The transfer worker is done with any DMA transfer by now, a DMA transfer
+        // request still around was reclaimed above before the worker started it
+        //
+        KeAcquireSpinLock(&this->dmaRequestLock, &oldIrql);
+        requestPtr = this->dmaRequestPtr;
+        this->dmaRequestPtr = nullptr;
+        KeReleaseSpinLock(&this->dmaRequestLock, oldIrql);
+
+        if (requestPtr) {
+            SDHC_LOG_TRACE(
+                "Aborted DMA transfer request (requestPtr = 0x%p)",
+                requestPtr);
+        } // if
+    } // if
+
+    //
+    // A reset settles the SDHC FSM on its own, and any SDCard insertion
+    // will be followed by a fresh SCR read
+    //
+    this->blockCountPredefined = false;
+    this->dataIdlePending = false;
+    if (ResetType == SdResetTypeAll) {
+        this->cmd23Supported = false;
+        this->fsmWaitEstimateUs = 0;
     } // if
 
     NTSTATUS status;
@@ -1158,8 +1652,8 @@ NTSTATUS SDHC::resetHost (
         // RPi foundation
         //
         _EDM edm; this->readRegisterNoFence(&edm);
-        edm.Fields.ReadThreshold = 4;
-        edm.Fields.WriteThreshold = 4;
+        edm.Fields.ReadThreshold = _FIFO_READ_THRESHOLD;
+        edm.Fields.WriteThreshold = _FIFO_WRITE_THRESHOLD;
         this->writeRegisterNoFence(edm);
         _HBCT hbct{ 0 };
         hbct.Fields.ByteCount = 512;
@@ -1286,9 +1780,95 @@ NTSTATUS SDHC::sendRequestCommand (
     RequestPtr->RequiredEvents = 0;
 
     //
-    // Initialize transfer parameters if this command is a data command.
+    // The SDCard may still be programming the last block of a previous pre-defined
+    // block count transfer, which can take as long as the SDCard program time.
+    // Don't poll for it at DISPATCH_LEVEL, hand the request to the transfer worker
+    // to wait it out and issue the command from there
     //
-    if (RequestPtr->Type == SdRequestTypeCommandWithTransfer) {
+    if (this->dataIdlePending &&
+        !this->crashdumpMode &&
+        !this->isDataIdle()) {
+
+        if (InterlockedCompareExchangePointer(
+                reinterpret_cast<PVOID volatile *>(&this->outstandingRequestPtr),
+                RequestPtr,
+                nullptr)) {
+            this->updateAllRegistersDump();
+            SDHC_LOG_ASSERTION(
+                "A stale request not acquired by transfer worker");
+            return STATUS_DEVICE_PROTOCOL_ERROR;
+        } // if
+
+        (void)KeSetEvent(&this->transferWorkerDoIoEvt, 0, FALSE);
+        return STATUS_SUCCESS;
+    } // if
+
+    //
+    // Settle the SDHC FSM left behind by a previous pre-defined block count
+    // transfer before touching any transfer parameters
+    //
+    status = this->waitForDataIdle();
+    if (!NT_SUCCESS(status)) {
+        this->updateAllRegistersDump();
+        SDHC_LOG_ERROR(
+            "this->waitForDataIdle() failed. (status = %!STATUS!)",
+            status);
+        return status;
+    } // if
+
+    status = this->prepareRequestCommand(RequestPtr);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    } // if
+
+    return this->issueRequestCommand(RequestPtr);
+} // SDHC::sendRequestCommand (...)
+
+_Use_decl_annotations_
+void SDHC::sendDeferredRequestCommand (
+    SDPORT_REQUEST* RequestPtr
+    ) throw ()
+{
+    NTSTATUS status = this->waitForDataIdle();
+    if (!NT_SUCCESS(status)) {
+        this->updateAllRegistersDump();
+        SDHC_LOG_ERROR(
+            "this->waitForDataIdle() failed. (status = %!STATUS!)",
+            status);
+    } // if
+
+    //
+    // Issue the command at DISPATCH_LEVEL as if it came right from Sdport, a
+    // failure to issue it is reported through the request completion
+    //
+    KIRQL oldIrql;
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+
+    if (NT_SUCCESS(status)) {
+        status = this->prepareRequestCommand(RequestPtr);
+        if (NT_SUCCESS(status)) {
+            (void)this->issueRequestCommand(RequestPtr);
+        } // if
+    } // if
+
+    if (!NT_SUCCESS(status)) {
+        this->completeRequest(RequestPtr, status);
+    } // if
+
+    KeLowerIrql(oldIrql);
+} // SDHC::sendDeferredRequestCommand (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::prepareRequestCommand (
+    SDPORT_REQUEST* RequestPtr
+    ) throw ()
+{
+    NTSTATUS status;
+
+    //
+    // Initialize transfer parameters if this command is a data command.
+    //
+    if (RequestPtr->Type == SdRequestTypeCommandWithTransfer) {
         switch (RequestPtr->Command.TransferMethod) {
         case SdTransferMethodPio:
             status = this->prepareTransferPio(RequestPtr);
@@ -1307,8 +1887,35 @@ NTSTATUS SDHC::sendRequestCommand (
                 ULONG(RequestPtr->Command.TransferMethod));
             return STATUS_NOT_SUPPORTED;
         } // switch (RequestPtr->Command.TransferMethod)
+
+        if (this->blockCountPredefined) {
+            status = this->sendNoTransferCommand(
+                SDCMD_SET_BLOCK_COUNT,
+                RequestPtr->Command.BlockCount,
+                SdTransferDirectionUndefined,
+                SdResponseTypeR1,
+                true);
+            if (!NT_SUCCESS(status)) {
+                this->blockCountPredefined = false;
+                this->updateAllRegistersDump();
+                SDHC_LOG_ERROR(
+                    "Failed to send SET_BLOCK_COUNT. (status = %!STATUS!)",
+                    status);
+                return status;
+            } // if
+        } // if
     } // if
 
+    return STATUS_SUCCESS;
+} // SDHC::prepareRequestCommand (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::issueRequestCommand (
+    SDPORT_REQUEST* RequestPtr
+    ) throw ()
+{
+    NTSTATUS status;
+
     _CMD cmd = this->buildCommand(
         RequestPtr->Command.Index,
         RequestPtr->Command.TransferDirection,
@@ -1354,7 +1961,7 @@ NTSTATUS SDHC::sendRequestCommand (
     } // if
 
     return STATUS_SUCCESS;
-} // SDHC::sendRequestCommand (...)
+} // SDHC::issueRequestCommand (...)
 
 _Use_decl_annotations_
 NTSTATUS SDHC::sendNoTransferCommand (
@@ -1379,7 +1986,7 @@ NTSTATUS SDHC::sendCommandInternal (
     _CMD Cmd,
     _ARG Arg,
     bool WaitCompletion
-    )
+    ) throw ()
 {
     NTSTATUS status = this->waitForLastCommandCompletion();
     if (!NT_SUCCESS(status)) {
@@ -1488,6 +2095,9 @@ NTSTATUS SDHC::startTransfer (
             switch (RequestPtr->Command.TransferDirection) {
             case SdTransferDirectionRead:
             case SdTransferDirectionWrite:
+                if (this->isDmaTransfer(RequestPtr)) {
+                    return this->startTransferDma(RequestPtr);
+                } // if
                 return this->startTransferPio(RequestPtr);
 
             default:
@@ -1589,6 +2199,21 @@ NTSTATUS SDHC::transferSingleBlockPio (
         status = this->readFromFifo(
             RequestPtr->Command.DataBuffer,
             RequestPtr->Command.BlockSize);
+
+        //
+        // Snoop the SCR on its way to Sdport to learn whether the SDCard
+        // supports SET_BLOCK_COUNT, CMD_SUPPORT bit 33 lives in the 4th byte
+        // of the big-endian SCR
+        //
+        if (NT_SUCCESS(status) &&
+            (RequestPtr->Command.Class == SdCommandClassApp) &&
+            (RequestPtr->Command.Index == SDACMD_SEND_SCR) &&
+            (RequestPtr->Command.BlockSize >= 8)) {
+            this->cmd23Supported = ((RequestPtr->Command.DataBuffer[3] & 0x02) != 0);
+            SDHC_LOG_INFORMATION(
+                "SDCard CMD23 support: %lu",
+                ULONG(this->cmd23Supported));
+        } // if
         break;
 
     case SdTransferDirectionWrite:
@@ -1604,6 +2229,12 @@ NTSTATUS SDHC::transferSingleBlockPio (
         if (NT_SUCCESS(status)) {
             if (RequestPtr->Command.TransferType == SdTransferTypeSingleBlock) {
                 status = this->waitForFsmState(_EDM::UINT32_FSM_DATAMODE);
+            } else if (this->blockCountPredefined &&
+                       (RequestPtr->Command.BlockCount == 1)) {
+                //
+                // The SDCard programs the last block of a pre-defined block count
+                // write on its own, the wait is deferred to the next command
+                //
             } else {
                 status = this->waitForFsmState(_EDM::UINT32_FSM_WRITESTART1);
             } //iff
@@ -1646,10 +2277,36 @@ NTSTATUS SDHC::transferMultiBlockPio (
         --RequestPtr->Command.BlockCount;
     } // while (RequestPtr->Command.BlockCount)
 
+    return this->endMultiBlockTransfer(RequestPtr, status);
+} // SDHC::transferMultiBlockPio (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::endMultiBlockTransfer (
+    SDPORT_REQUEST* RequestPtr,
+    NTSTATUS Status
+    ) throw ()
+{
+    //
+    // A successful pre-defined block count transfer leaves the SDCard back in
+    // tran state on its own, complete it inline without STOP_TRANSMISSION and
+    // overlap the SDCard programming with the issue of the next request
+    //
+    bool blockCountPredefined = this->blockCountPredefined;
+    this->blockCountPredefined = false;
+
+    if (blockCountPredefined && NT_SUCCESS(Status)) {
+        this->dataIdleAlternateFsmState =
+            (RequestPtr->Command.TransferDirection == SdTransferDirectionRead) ?
+                _EDM::UINT32_FSM_READWAIT : _EDM::UINT32_FSM_WRITESTART1;
+        this->dataIdlePending = true;
+        this->completeRequest(RequestPtr, Status);
+        return Status;
+    } // if
+
     //
     // The status with which we will complete the request in the DPC
     //
-    RequestPtr->Status = status;
+    RequestPtr->Status = Status;
 
     //
     // WORKAROUND:
@@ -1657,26 +2314,676 @@ NTSTATUS SDHC::transferMultiBlockPio (
     // the SDCard to tran state, otherwise the SDCard FSM will get stuck in
     // either rcv/data state depending on whether it was reading or writing
     //
-    // STOP_TRANSMISSION once completed will cause a busy interrupt to fire
-    // that will lead the request to complete in the DPC
+    // STOP_TRANSMISSION once completed will cause a busy interrupt to fire
+    // that will lead the request to complete in the DPC
+    //
+    NTSTATUS cmdStatus = this->stopTransmission(false);
+    if (NT_SUCCESS(Status) &&
+        !NT_SUCCESS(cmdStatus)) {
+        //
+        // It is not safe to complete the request with failure here due to possibility of
+        // race-condition with Sdport. A failure to issue STOP_TRANSMISSION means that the
+        // SDHC and/or SDCard are in a very bad state and a host reset bus operation is
+        // required. If we don't complete request the Sdport will timeout the request and
+        // issue an error recovery that leads to host reset bus operation, which is the
+        // required mitigation behavior
+        //
+        this->updateAllRegistersDump();
+        SDHC_LOG_ERROR("Failed to stop transmission after a successful transfer");
+    } // if
+
+    return Status;
+} // SDHC::endMultiBlockTransfer (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::initializeDma () throw ()
+{
+    SDHC_ASSERT(!this->crashdumpMode);
+
+    this->dmaChannel = findDmaChannel(this->basePhysicalAddress);
+    if (this->dmaChannel == _DMA_CHANNEL_NONE) {
+        SDHC_LOG_INFORMATION("No DMA channel assigned, using PIO only");
+        return STATUS_RESOURCE_TYPE_NOT_FOUND;
+    } // if
+
+    //
+    // The DMA controller shares the same peripherals window as the SDHC, locate
+    // the assigned channel registers relative to the SDHC base
+    //
+    PHYSICAL_ADDRESS dmaChannelPhysicalAddress;
+    dmaChannelPhysicalAddress.QuadPart =
+        this->basePhysicalAddress.QuadPart -
+        _SDHC_PERIPHERAL_OFFSET +
+        _DMA_PERIPHERAL_OFFSET +
+        (this->dmaChannel * _DMA_CHANNEL_REGISTERS_SIZE);
+
+    this->dmaChannelBasePtr = MmMapIoSpaceEx(
+        dmaChannelPhysicalAddress,
+        _DMA_CHANNEL_REGISTERS_SIZE,
+        PAGE_READWRITE | PAGE_NOCACHE);
+    if (!this->dmaChannelBasePtr) {
+        SDHC_LOG_ERROR(
+            "Failed to map DMA channel registers. (dmaChannelPhysicalAddress = 0x%llx)",
+            dmaChannelPhysicalAddress.QuadPart);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    } // if
+
+    //
+    // The DMA engine can only address the first 1GB of RAM, and it is not
+    // coherent with the ARM caches
+    //
+    PHYSICAL_ADDRESS lowestAcceptableAddress = { 0 };
+    PHYSICAL_ADDRESS highestAcceptableAddress = { 0 };
+    PHYSICAL_ADDRESS boundaryAddressMultiple = { 0 };
+    highestAcceptableAddress.QuadPart = 0x3FFFFFFF;
+
+    this->dmaBufferPtr = static_cast<UCHAR*>(MmAllocateContiguousNodeMemory(
+        _DMA_BUFFER_SIZE,
+        lowestAcceptableAddress,
+        highestAcceptableAddress,
+        boundaryAddressMultiple,
+        PAGE_READWRITE | PAGE_NOCACHE,
+        MM_ANY_NODE_OK));
+    if (!this->dmaBufferPtr) {
+        SDHC_LOG_ERROR(
+            "Failed to allocate DMA bounce buffer. (_DMA_BUFFER_SIZE = %lu)",
+            ULONG(_DMA_BUFFER_SIZE));
+        this->releaseDma();
+        return STATUS_INSUFFICIENT_RESOURCES;
+    } // if
+
+    this->dmaCbPtr = static_cast<_DMA_CB*>(MmAllocateContiguousNodeMemory(
+        sizeof(_DMA_CB) * _DMA_CB_COUNT,
+        lowestAcceptableAddress,
+        highestAcceptableAddress,
+        boundaryAddressMultiple,
+        PAGE_READWRITE | PAGE_NOCACHE,
+        MM_ANY_NODE_OK));
+    if (!this->dmaCbPtr) {
+        SDHC_LOG_ERROR("Failed to allocate DMA control blocks");
+        this->releaseDma();
+        return STATUS_INSUFFICIENT_RESOURCES;
+    } // if
+
+    //
+    // Memory is accessed by the DMA engine through the uncached VideoCore alias
+    //
+    this->dmaBufferBusAddress =
+        ULONG(MmGetPhysicalAddress(this->dmaBufferPtr).LowPart) | _UNCACHED_MEMORY_BUS_BASE;
+    this->dmaCbBusAddress =
+        ULONG(MmGetPhysicalAddress(this->dmaCbPtr).LowPart) | _UNCACHED_MEMORY_BUS_BASE;
+
+    this->stopDma();
+
+    SDHC_LOG_INFORMATION(
+        "DMA transfers enabled on channel %lu. (dmaBufferBusAddress = 0x%lx, dmaCbBusAddress = 0x%lx)",
+        this->dmaChannel,
+        this->dmaBufferBusAddress,
+        this->dmaCbBusAddress);
+
+    return STATUS_SUCCESS;
+} // SDHC::initializeDma ()
+
+_Use_decl_annotations_
+void SDHC::releaseDma () throw ()
+{
+    if (this->dmaChannelBasePtr) {
+        this->stopDma();
+        MmUnmapIoSpace(this->dmaChannelBasePtr, _DMA_CHANNEL_REGISTERS_SIZE);
+        this->dmaChannelBasePtr = nullptr;
+    } // if
+
+    if (this->dmaCbPtr) {
+        MmFreeContiguousMemory(this->dmaCbPtr);
+        this->dmaCbPtr = nullptr;
+    } // if
+
+    if (this->dmaBufferPtr) {
+        MmFreeContiguousMemory(this->dmaBufferPtr);
+        this->dmaBufferPtr = nullptr;
+    } // if
+} // SDHC::releaseDma ()
+
+_Use_decl_annotations_
+void SDHC::saveDmaResource (
+    const CM_RESOURCE_LIST* ResourceListPtr
+    ) throw ()
+{
+    if (!ResourceListPtr) {
+        return;
+    } // if
+
+    //
+    // The SDHC register block and at most one FixedDMA resource on the SDHost
+    // DREQ. A device started without one, or with one the SDHC cannot use,
+    // stays on PIO transfers
+    //
+    const CM_PARTIAL_RESOURCE_DESCRIPTOR* memoryResourcePtr = nullptr;
+    ULONG dmaChannel = _DMA_CHANNEL_NONE;
+    ULONG dmaCount = 0;
+    bool dmaValid = true;
+
+    const CM_FULL_RESOURCE_DESCRIPTOR* fullResourcePtr = ResourceListPtr->List;
+    for (ULONG i = 0; i < ResourceListPtr->Count; ++i) {
+        const CM_PARTIAL_RESOURCE_LIST* partialListPtr = &fullResourcePtr->PartialResourceList;
+
+        for (ULONG j = 0; j < partialListPtr->Count; ++j) {
+            const CM_PARTIAL_RESOURCE_DESCRIPTOR* resourcePtr =
+                &partialListPtr->PartialDescriptors[j];
+
+            switch (resourcePtr->Type) {
+            case CmResourceTypeMemory:
+                if (!memoryResourcePtr) {
+                    memoryResourcePtr = resourcePtr;
+                } // if
+                break;
+
+            case CmResourceTypeDma:
+                if ((dmaCount != 0) ||
+                    (resourcePtr->u.DmaV3.RequestLine != _DMA_DREQ_SDHOST) ||
+                    (resourcePtr->u.DmaV3.TransferWidth != Width32Bits) ||
+                    (resourcePtr->u.DmaV3.Channel >= _DMA_CHANNEL_COUNT)) {
+
+                    SDHC_LOG_ERROR(
+                        "DMA resource %lu invalid, falling back to PIO transfers. (Channel = %lu, RequestLine = %lu, TransferWidth = %lu)",
+                        dmaCount,
+                        resourcePtr->u.DmaV3.Channel,
+                        resourcePtr->u.DmaV3.RequestLine,
+                        ULONG(resourcePtr->u.DmaV3.TransferWidth));
+                    dmaValid = false;
+                } // if
+
+                dmaChannel = resourcePtr->u.DmaV3.Channel;
+                ++dmaCount;
+                break;
+            } // switch (...)
+        } // for (j)
+
+        fullResourcePtr = reinterpret_cast<const CM_FULL_RESOURCE_DESCRIPTOR*>(
+            &partialListPtr->PartialDescriptors[partialListPtr->Count]);
+    } // for (i)
+
+    if (!memoryResourcePtr) {
+        return;
+    } // if
+
+    if (!dmaValid) {
+        dmaChannel = _DMA_CHANNEL_NONE;
+    } // if
+
+    //
+    // A restarted SDHC replaces what it was assigned on its last start
+    //
+    ExAcquireFastMutex(&dmaResourcesLock);
+
+    ULONG index = 0;
+    while ((index < dmaResourceCount) &&
+           (dmaResources[index].BasePhysicalAddress.QuadPart !=
+            memoryResourcePtr->u.Memory.Start.QuadPart)) {
+        ++index;
+    } // while (...)
+
+    if (index < _MAX_DMA_RESOURCES) {
+        dmaResources[index].BasePhysicalAddress = memoryResourcePtr->u.Memory.Start;
+        dmaResources[index].Channel = dmaChannel;
+        dmaResourceCount = max(dmaResourceCount, index + 1);
+    } else {
+        SDHC_LOG_WARNING(
+            "Too many SDHC devices to track their DMA resources, using PIO only. (BasePhysicalAddress = 0x%llx)",
+            memoryResourcePtr->u.Memory.Start.QuadPart);
+    } // iff
+
+    ExReleaseFastMutex(&dmaResourcesLock);
+} // SDHC::saveDmaResource (...)
+
+_Use_decl_annotations_
+ULONG SDHC::findDmaChannel (
+    PHYSICAL_ADDRESS BasePhysicalAddress
+    ) throw ()
+{
+    ULONG dmaChannel = _DMA_CHANNEL_NONE;
+
+    ExAcquireFastMutex(&dmaResourcesLock);
+
+    for (ULONG index = 0; index < dmaResourceCount; ++index) {
+        if (dmaResources[index].BasePhysicalAddress.QuadPart ==
+            BasePhysicalAddress.QuadPart) {
+            dmaChannel = dmaResources[index].Channel;
+            break;
+        } // if
+    } // for (index)
+
+    ExReleaseFastMutex(&dmaResourcesLock);
+
+    return dmaChannel;
+} // SDHC::findDmaChannel (...)
+
+_Use_decl_annotations_
+bool SDHC::isDmaTransfer (
+    const SDPORT_REQUEST* RequestPtr
+    ) const throw ()
+{
+    //
+    // DMA is reserved for multi-block transfers where the DMA setup cost pays off,
+    // single block transfers and the crashdump environment stay on PIO
+    //
+    return !this->crashdumpMode &&
+        this->dmaBufferPtr &&
+        this->dmaCbPtr &&
+        ((RequestPtr->Command.TransferType == SdTransferTypeMultiBlock) ||
+         (RequestPtr->Command.TransferType == SdTransferTypeMultiBlockNoStop)) &&
+        (RequestPtr->Command.BlockSize == 0x200) &&
+        (RequestPtr->Command.BlockCount <= _HBLC_MAX_BLOCK_COUNT) &&
+        (RequestPtr->Command.Length <= _DMA_BUFFER_SIZE);
+} // SDHC::isDmaTransfer (...)
+
+_Use_decl_annotations_
+bool SDHC::isPredefinedBlockCountTransfer (
+    const SDPORT_REQUEST* RequestPtr
+    ) const throw ()
+{
+#if ENABLE_PREDEFINED_BLOCK_COUNT
+
+    //
+    // Only open-ended multi-block reads/writes that fit HBLC qualify, Sdport
+    // already took care of the block count for MultiBlockNoStop transfers
+    //
+    return !this->crashdumpMode &&
+        this->cmd23Supported &&
+        (RequestPtr->Command.Class == SdCommandClassStandard) &&
+        ((RequestPtr->Command.Index == SDCMD_READ_MULTIPLE_BLOCK) ||
+         (RequestPtr->Command.Index == SDCMD_WRITE_MULTIPLE_BLOCK)) &&
+        (RequestPtr->Command.TransferType == SdTransferTypeMultiBlock) &&
+        (RequestPtr->Command.BlockCount <= _HBLC_MAX_BLOCK_COUNT);
+
+#else
+
+    UNREFERENCED_PARAMETER(RequestPtr);
+    return false;
+
+#endif // ENABLE_PREDEFINED_BLOCK_COUNT
+} // SDHC::isPredefinedBlockCountTransfer (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::startTransferDma (
+    SDPORT_REQUEST* RequestPtr
+    ) throw ()
+{
+    SDHC_ASSERT(this->isDmaTransfer(RequestPtr));
+
+    //
+    // The block interrupt signals the end of the DMA data phase, and a busy signal
+    // from the STOP_TRANSMISSION completes the request
+    //
+    _HSTS* requiredEventsPtr = reinterpret_cast<_HSTS*>(&RequestPtr->RequiredEvents);
+    requiredEventsPtr->Fields.BlockIrpt = 1;
+    requiredEventsPtr->Fields.BusyIrpt = 1;
+
+    //
+    // From here on the transfer worker owns the request. It fills the bounce
+    // buffer and runs the DMA engine at PASSIVE_LEVEL, and the DPC only reports
+    // the end of the data phase to it
+    //
+    KeAcquireSpinLockAtDpcLevel(&this->dmaRequestLock);
+
+    if (this->dmaRequestPtr) {
+        KeReleaseSpinLockFromDpcLevel(&this->dmaRequestLock);
+        this->updateAllRegistersDump();
+        SDHC_LOG_ASSERTION(
+            "A stale request not finished by transfer worker");
+        return STATUS_DEVICE_PROTOCOL_ERROR;
+    } // if
+
+    this->dmaRequestPtr = RequestPtr;
+    this->dmaDataPhaseStatus = STATUS_PENDING;
+    KeClearEvent(&this->dmaDataPhaseEvt);
+
+    KeReleaseSpinLockFromDpcLevel(&this->dmaRequestLock);
+
+    //
+    // Arm the block interrupt to learn about the end of the data phase, dropping
+    // any stale one from a previous transfer
+    //
+    _HSTS staleEvents{ 0 };
+    staleEvents.Fields.BlockIrpt = 1;
+    this->writeRegisterNoFence(staleEvents);
+
+    _HCFG irptMask{ 0 };
+    irptMask.Fields.BlockIrptEn = 1;
+    (void)this->unmaskInterrupts(irptMask);
+
+    if (InterlockedCompareExchangePointer(
+            reinterpret_cast<PVOID volatile *>(&this->outstandingRequestPtr),
+            RequestPtr,
+            nullptr)) {
+        (void)this->maskInterrupts(irptMask);
+        (void)this->releaseDmaRequest(RequestPtr, STATUS_SUCCESS);
+        this->updateAllRegistersDump();
+        SDHC_LOG_ASSERTION(
+            "A stale request not acquired by transfer worker");
+        return STATUS_DEVICE_PROTOCOL_ERROR;
+    } // if
+
+    (void)KeSetEvent(&this->transferWorkerDoIoEvt, 0, FALSE);
+
+    return STATUS_SUCCESS;
+} // SDHC::startTransferDma (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::transferDma (
+    SDPORT_REQUEST* RequestPtr
+    ) throw ()
+{
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&this->dmaRequestLock, &oldIrql);
+    NTSTATUS status = this->dmaDataPhaseStatus;
+    bool aborted = (RequestPtr != this->dmaRequestPtr);
+    KeReleaseSpinLock(&this->dmaRequestLock, oldIrql);
+
+    if (aborted || (status == STATUS_CANCELLED)) {
+        (void)this->releaseDmaRequest(RequestPtr, STATUS_CANCELLED);
+        SDHC_LOG_WARNING(
+            "DMA transfer request got aborted before starting its data phase (RequestPtr = 0x%p)",
+            RequestPtr);
+        return STATUS_CANCELLED;
+    } // if
+
+    const bool isRead = (RequestPtr->Command.TransferDirection == SdTransferDirectionRead);
+    ULONG length = RequestPtr->Command.BlockCount * RequestPtr->Command.BlockSize;
+    SDHC_ASSERT(length <= _DMA_BUFFER_SIZE);
+
+    if (!isRead) {
+        RtlCopyMemory(this->dmaBufferPtr, RequestPtr->Command.DataBuffer, length);
+        this->dmaTransferLength = length;
+    } else {
+        //
+        // WORKAROUND:
+        // The SDHC doesn't raise its DREQ for the last words of a read that fall
+        // below the FIFO read threshold, leaving the DMA engine waiting forever.
+        // DMA all but the tail, and drain the tail from the FIFO by PIO
+        //
+        this->dmaTransferLength = length - ((_FIFO_READ_THRESHOLD - 1) * sizeof(ULONG));
+    } // iff
+
+    //
+    // Build a chain of control blocks pacing the SDHC FIFO on its DREQ, every
+    // control block moves at most _DMA_MAX_CB_TRANSFER_LENGTH bytes
+    //
+    const ULONG fifoBusAddress =
+        _PERIPHERALS_BUS_BASE + _SDHC_PERIPHERAL_OFFSET + ULONG(_DATA::OFFSET);
+
+    _DMA_TI ti{ 0 };
+    ti.Fields.WaitResp = 1;
+    ti.Fields.Permap = _DMA_DREQ_SDHOST;
+    if (isRead) {
+        ti.Fields.SrcDreq = 1;
+        ti.Fields.DestInc = 1;
+    } else {
+        ti.Fields.DestDreq = 1;
+        ti.Fields.SrcInc = 1;
+    } // iff
+
+    ULONG cbIndex = 0;
+    ULONG offset = 0;
+    while (offset < this->dmaTransferLength) {
+        SDHC_ASSERT(cbIndex < _DMA_CB_COUNT);
+        ULONG cbLength =
+            min(this->dmaTransferLength - offset, ULONG(_DMA_MAX_CB_TRANSFER_LENGTH));
+        _DMA_CB* cbPtr = &this->dmaCbPtr[cbIndex];
+
+        cbPtr->TI = ti;
+        cbPtr->SourceAd = isRead ? fifoBusAddress : (this->dmaBufferBusAddress + offset);
+        cbPtr->DestAd = isRead ? (this->dmaBufferBusAddress + offset) : fifoBusAddress;
+        cbPtr->TxfrLen = cbLength;
+        cbPtr->Stride = 0;
+        cbPtr->NextConbk = 0;
+
+        if (cbIndex > 0) {
+            this->dmaCbPtr[cbIndex - 1].NextConbk =
+                this->dmaCbBusAddress + (cbIndex * sizeof(_DMA_CB));
+        } // if
+
+        offset += cbLength;
+        ++cbIndex;
+    } // while (offset < this->dmaTransferLength)
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+    this->currRequestStats.DmaStartTimestamp = KeQueryPerformanceCounter(NULL);
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
+    //
+    // Control blocks have to be visible in memory before kicking off the DMA engine
+    //
+    KeMemoryBarrier();
+
+    _DMA_CONBLK_AD conblkAd{ this->dmaCbBusAddress };
+    this->writeDmaRegister(conblkAd);
+
+    _DMA_CS cs{ 0 };
+    cs.Fields.Active = 1;
+    cs.Fields.End = 1;
+    cs.Fields.Int = 1;
+    cs.Fields.Priority = 8;
+    cs.Fields.PanicPriority = 0xF;
+    cs.Fields.WaitForOutstandingWrites = 1;
+    this->writeDmaRegister(cs);
+
+    //
+    // Wait for the DPC to report the end of the data phase, or the error that
+    // cut it short, or for a host reset to abandon the transfer
+    //
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = -10000ll *
+        (_DMA_DATA_PHASE_TIMEOUT_MS +
+         (LONGLONG(RequestPtr->Command.BlockCount) * _DMA_DATA_PHASE_TIMEOUT_PER_BLOCK_MS));
+
+    NTSTATUS waitStatus = KeWaitForSingleObject(
+        &this->dmaDataPhaseEvt,
+        Executive,
+        KernelMode,
+        FALSE,
+        &timeout);
+
+    KeAcquireSpinLock(&this->dmaRequestLock, &oldIrql);
+    if (this->dmaDataPhaseStatus == STATUS_PENDING) {
+        SDHC_ASSERT(waitStatus == STATUS_TIMEOUT);
+        this->dmaDataPhaseStatus = STATUS_IO_TIMEOUT;
+    } // if
+    status = this->dmaDataPhaseStatus;
+    KeReleaseSpinLock(&this->dmaRequestLock, oldIrql);
+
+    if (status == STATUS_CANCELLED) {
+        this->stopDma();
+        (void)this->releaseDmaRequest(RequestPtr, status);
+        SDHC_LOG_WARNING(
+            "DMA transfer request got aborted before finishing its data phase (RequestPtr = 0x%p)",
+            RequestPtr);
+        return status;
+    } // if
+
+    if (NT_SUCCESS(status)) {
+        status = this->waitForDmaCompletion();
+        if (!NT_SUCCESS(status)) {
+            this->updateAllRegistersDump();
+            SDHC_LOG_ERROR(
+                "this->waitForDmaCompletion() failed. (status = %!STATUS!)",
+                status);
+            this->stopDma();
+        } // if
+    } else {
+        this->updateAllRegistersDump();
+        SDHC_LOG_ERROR(
+            "DMA data phase failed. (status = %!STATUS!)",
+            status);
+        this->stopDma();
+    } // iff
+
+    if (NT_SUCCESS(status) && isRead) {
+        //
+        // Drain the tail words held back from the DMA engine, the data flag may
+        // never get set for them since they fall below the FIFO read threshold
+        //
+        ULONG* wordPtr = reinterpret_cast<ULONG*>(this->dmaBufferPtr + this->dmaTransferLength);
+        ULONG count = (length - this->dmaTransferLength) / sizeof(ULONG);
+
+        while (count) {
+            ULONG retry = _POLL_RETRY_COUNT;
+            _HSTS hsts; this->readRegisterNoFence(&hsts);
+            _EDM edm; this->readRegisterNoFence(&edm);
+
+            while (!edm.Fields.FifoCount &&
+                   !(hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) &&
+                    retry) {
+
+                ::SdPortWait(_POLL_WAIT_US);
+                this->readRegisterNoFence(&hsts);
+                this->readRegisterNoFence(&edm);
+                --retry;
+            } // while (...)
+
+            if (hsts.AsUint32 & _HSTS::UINT32_ERROR_MASK) {
+                status = this->getErrorStatus(hsts);
+                break;
+            } else if (!retry) {
+                status = STATUS_IO_TIMEOUT;
+                break;
+            } // iff
+
+            *wordPtr = this->readRegisterNoFence<_DATA>().AsUint32;
+            ++wordPtr;
+            --count;
+        } // while (count)
+
+        if (!NT_SUCCESS(status)) {
+            this->updateAllRegistersDump();
+            SDHC_LOG_ERROR(
+                "Failed to drain FIFO read tail. (status = %!STATUS!)",
+                status);
+        } // if
+    } else if (NT_SUCCESS(status) && !this->blockCountPredefined) {
+        //
+        // Wait for the last block to be physically written before
+        // the STOP_TRANSMISSION
+        //
+        status = this->waitForFsmState(_EDM::UINT32_FSM_WRITESTART1);
+        if (!NT_SUCCESS(status)) {
+            this->updateAllRegistersDump();
+            SDHC_LOG_ERROR(
+                "this->waitForFsmState() failed. (status = %!STATUS!)",
+                status);
+        } // if
+    } // iff
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+    LARGE_INTEGER endTimestamp = KeQueryPerformanceCounter(NULL);
+    this->currRequestStats.FifoIoTimeTicks +=
+        endTimestamp.QuadPart - this->currRequestStats.DmaStartTimestamp.QuadPart;
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
+    if (NT_SUCCESS(status) && isRead) {
+        RtlCopyMemory(RequestPtr->Command.DataBuffer, this->dmaBufferPtr, length);
+    } // if
+
+    //
+    // The data phase is over either way, only the STOP_TRANSMISSION busy signal
+    // is left for the DPC to complete the request on once it is handed back
+    //
+    _HSTS* requiredEventsPtr = reinterpret_cast<_HSTS*>(&RequestPtr->RequiredEvents);
+    requiredEventsPtr->Fields.BlockIrpt = 0;
+
+    status = this->releaseDmaRequest(RequestPtr, status);
+
+    return this->endMultiBlockTransfer(RequestPtr, status);
+} // SDHC::transferDma (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::releaseDmaRequest (
+    SDPORT_REQUEST* RequestPtr,
+    NTSTATUS Status
+    ) throw ()
+{
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&this->dmaRequestLock, &oldIrql);
+
+    if (RequestPtr == this->dmaRequestPtr) {
+        this->dmaRequestPtr = nullptr;
+
+        //
+        // Don't lose an error the DPC reported after the data phase ended, the
+        // SDHC status got acknowledged by the ISR already
+        //
+        if (NT_SUCCESS(Status) &&
+            !NT_SUCCESS(this->dmaDataPhaseStatus) &&
+            (this->dmaDataPhaseStatus != STATUS_PENDING)) {
+            Status = this->dmaDataPhaseStatus;
+        } // if
+    } // if
+
+    KeReleaseSpinLock(&this->dmaRequestLock, oldIrql);
+
+    return Status;
+} // SDHC::releaseDmaRequest (...)
+
+NTSTATUS SDHC::waitForDmaCompletion () throw ()
+{
+    ULONG retry = _POLL_RETRY_COUNT;
+    _DMA_CS cs; this->readDmaRegister(&cs);
+
+    while (cs.Fields.Active &&
+           !cs.Fields.Error &&
+            retry) {
+
+        ::SdPortWait(_POLL_WAIT_US);
+        this->readDmaRegister(&cs);
+        --retry;
+    } // while (...)
+
+    if (cs.Fields.Error) {
+        _DMA_DEBUG debug; this->readDmaRegister(&debug);
+        SDHC_LOG_ERROR(
+            "DMA engine reported an error. (cs.AsUint32 = 0x%lx, debug.AsUint32 = 0x%lx)",
+            ULONG(cs.AsUint32),
+            ULONG(debug.AsUint32));
+        return STATUS_DEVICE_DATA_ERROR;
+    } else if (!retry) {
+        return STATUS_IO_TIMEOUT;
+    } else {
+        SDHC_ASSERT(!cs.Fields.Active);
+        return STATUS_SUCCESS;
+    } // iff
+
+} // SDHC::waitForDmaCompletion ()
+
+void SDHC::stopDma () throw ()
+{
+    if (!this->dmaChannelBasePtr) {
+        return;
+    } // if
+
+    //
+    // Abort the current control block and reset the channel, then acknowledge
+    // any pending end and error flags
     //
-    NTSTATUS cmdStatus = this->stopTransmission(false);
-    if (NT_SUCCESS(status) &&
-        !NT_SUCCESS(cmdStatus)) {
-        //
-        // It is not safe to complete the request with failure here due to possibility of
-        // race-condition with Sdport. A failure to issue STOP_TRANSMISSION means that the
-        // SDHC and/or SDCard are in a very bad state and a host reset bus operation is
-        // required. If we don't complete request the Sdport will timeout the request and
-        // issue an error recovery that leads to host reset bus operation, which is the
-        // required mitigation behavior
-        //
-        this->updateAllRegistersDump();
-        SDHC_LOG_ERROR("Failed to stop transmission after a successful transfer");
-    } // if
+    _DMA_CS cs{ 0 };
+    cs.Fields.Abort = 1;
+    this->writeDmaRegister(cs);
 
-    return status;
-} // SDHC::transferMultiBlockPio (...)
+    cs.AsUint32 = 0;
+    cs.Fields.Reset = 1;
+    this->writeDmaRegister(cs);
+
+    cs.AsUint32 = 0;
+    cs.Fields.End = 1;
+    cs.Fields.Int = 1;
+    this->writeDmaRegister(cs);
+
+    _DMA_DEBUG debug{ _DMA_DEBUG::UINT32_ERROR_MASK };
+    this->writeDmaRegister(debug);
+} // SDHC::stopDma ()
 
 _Use_decl_annotations_
 NTSTATUS SDHC::openDevice(
@@ -1808,7 +3115,7 @@ NTSTATUS SDHC::sendIoctlSynchronously(
 _Use_decl_annotations_
 NTSTATUS SDHC::setActivityLed(
     BOOLEAN enabled
-)
+) throw ()
 {
     DECLARE_CONST_UNICODE_STRING(rpiqDeviceName, RPIQ_SYMBOLIC_NAME);
 
@@ -1866,7 +3173,7 @@ _Use_decl_annotations_
 void SDHC::completeRequest (
     SDPORT_REQUEST* RequestPtr,
     NTSTATUS Status
-    )
+    ) throw ()
 {
     //
     // Legal request completion statuses expected by Sdport
@@ -1910,6 +3217,7 @@ void SDHC::completeRequest (
         //
         _EDM edm; this->readRegisterNoFence(&edm);
         if ((RequestPtr->Type ==  SdRequestTypeStartTransfer) &&
+            !this->dataIdlePending &&
             (edm.Fields.StateMachine != _EDM::UINT32_FSM_IDENTMODE) &&
             (edm.Fields.StateMachine != _EDM::UINT32_FSM_DATAMODE)) {
             this->updateAllRegistersDump();
@@ -1919,6 +3227,12 @@ void SDHC::completeRequest (
 
     }  // iff (NT_SUCCESS(Status))
 
+    //
+    // A DMA transfer request is only ever completed after the transfer worker
+    // tore down the DMA engine and handed the request back
+    //
+    SDHC_ASSERT(RequestPtr != this->dmaRequestPtr);
+
     if (RequestPtr->Type == SdRequestTypeStartTransfer) {
 
 #if ENABLE_PERFORMANCE_LOGGING
@@ -1970,9 +3284,17 @@ void SDHC::completeRequest (
         fifoIoTimeUs *= 1000000ll;
         fifoIoTimeUs /= hpcFreqHz.QuadPart;
 
+        LONGLONG commandTimeUs = this->currRequestStats.CommandLatencyTicks;
+        commandTimeUs *= 1000000ll;
+        commandTimeUs /= hpcFreqHz.QuadPart;
+
+        if (!this->crashdumpMode) {
+            this->updateExportedStats(RequestPtr, Status, commandTimeUs, requestServiceTimeUs);
+        } // if
+
         SDHC_LOG_INFORMATION(
-            "%s%d %s(0x%lx, %luB) %lldus %lldMB/s, Util:%lld%%, "
-            "Fifo Time:%lldus, "
+            "%s%d %s(0x%lx, %luB) %s %lldus %lldMB/s, Util:%lld%%, "
+            "Fifo Time:%lldus Bursts:%lld Blocks:%lu, "
             "Fifo Waits:%lldus Max:%lldus Avg:%lldus, "
             "Fsm Waits:%lldus Max:%lldus Avg:%lldus Min:%lldus. "
             "(RequestPtr = 0x%p, RequestPtr->Status = %!STATUS!)",
@@ -1981,10 +3303,13 @@ void SDHC::completeRequest (
             ((RequestPtr->Command.TransferDirection == SdTransferDirectionRead) ? "Read" : "Write"),
             RequestPtr->Command.Argument,
             RequestPtr->Command.Length,
+            (logData.DmaTransfer ? "DMA" : "PIO"),
             requestServiceTimeUs,
             actualTransferRateMBs,
             utilization,
             fifoIoTimeUs,
+            logData.FifoBurstCount,
+            ULONG(logData.BlockCount),
             logData.FifoWaitTimeUs,
             logData.FifoMaxWaitTimeUs,
             ((logData.FifoWaitCount > 0) ?
@@ -2114,7 +3439,17 @@ NTSTATUS SDHC::prepareTransferPio (
     hbct.Fields.ByteCount = RequestPtr->Command.BlockSize;
     this->writeRegisterNoFence(hbct);
 
+    //
+    // DMA transfers rely on the block count to raise the block interrupt
+    // at the end of the data phase, and pre-defined block count transfers
+    // rely on it to end the data phase without STOP_TRANSMISSION
+    //
+    this->blockCountPredefined = this->isPredefinedBlockCountTransfer(RequestPtr);
+
     _HBLC hblc{ 0 };
+    if (this->isDmaTransfer(RequestPtr) || this->blockCountPredefined) {
+        hblc.Fields.BlockCount = RequestPtr->Command.BlockCount;
+    } // if
     this->writeRegisterNoFence(hblc);
 
     return STATUS_SUCCESS;
@@ -2216,9 +3551,22 @@ VOID SDHC::transferWorker (
                 requestPtr);
 
             thisPtr->ledStatus = TRUE;
+            (void)InterlockedIncrement(&thisPtr->ledUpdateRequests);
             (void)KeSetEvent(&thisPtr->ledWorkerUpdateEvt, 0, FALSE);
 
-            if (requestPtr->Command.TransferType == SdTransferTypeSingleBlock) {
+            if (requestPtr->Type != SdRequestTypeStartTransfer) {
+                //
+                // A command deferred until the SDCard finishes programming the
+                // last block of the previous transfer
+                //
+                thisPtr->sendDeferredRequestCommand(requestPtr);
+            } else if (thisPtr->isDmaTransfer(requestPtr)) {
+                //
+                // Run the DMA data phase and STOP_TRANSMISSION, completion
+                // happens async in the STOP_TRANSMISSION command completion DPC
+                //
+                (void)thisPtr->transferDma(requestPtr);
+            } else if (requestPtr->Command.TransferType == SdTransferTypeSingleBlock) {
                 //
                 // Single block transfers do not require a STOP_TRANSMISSION, and hence
                 // completing the request inline is appropriate
@@ -2237,6 +3585,7 @@ VOID SDHC::transferWorker (
             SDHC_LOG_TRACE("Finished servicing IO transfer");
 
             thisPtr->ledStatus = FALSE;
+            (void)InterlockedIncrement(&thisPtr->ledUpdateRequests);
             (void)KeSetEvent(&thisPtr->ledWorkerUpdateEvt, 0, FALSE);
 
             ExReleaseFastMutex(&thisPtr->outstandingRequestLock);
@@ -2292,6 +3641,14 @@ VOID SDHC::ledWorker(
 
     (void)KeSetEvent(&thisPtr->ledWorkerStartedEvt, 0, FALSE);
 
+    //
+    // The LED state last written to the GPIO expander, it is unknown until the
+    // first write so that the first update always goes through
+    //
+    bool ledStateValid = false;
+    BOOLEAN ledState = FALSE;
+    ULONGLONG lastUpdateTime = 0;
+    const ULONGLONG updateInterval = ULONGLONG(ledUpdateIntervalMs) * 10000ull;
 
     for (;;) {
 
@@ -2306,7 +3663,44 @@ VOID SDHC::ledWorker(
             NULL);
 
         if (waitStatus == _WAIT_UPDATE_EVENT) {
-            thisPtr->setActivityLed(thisPtr->ledStatus);
+            //
+            // Each LED update is a mailbox round trip to the VC firmware, under
+            // heavy IO the LED state flips twice per request. Coalesce the updates
+            // by waiting out the rest of the update interval, then apply only the
+            // latest LED state
+            //
+            ULONGLONG elapsedTime = KeQueryInterruptTime() - lastUpdateTime;
+            if (ledStateValid && (elapsedTime < updateInterval)) {
+                LARGE_INTEGER timeout;
+                timeout.QuadPart = -LONGLONG(updateInterval - elapsedTime);
+                waitStatus = KeWaitForSingleObject(
+                    &thisPtr->ledWorkerShutdownEvt,
+                    Executive,
+                    KernelMode,
+                    FALSE,
+                    &timeout);
+                if (waitStatus == STATUS_SUCCESS) {
+                    SDHC_LOG_TRACE("LED Shutdown requested ...");
+                    break;
+                } // if
+            } // if
+
+            LONG updateRequests = InterlockedExchange(&thisPtr->ledUpdateRequests, 0);
+            BOOLEAN newLedState = thisPtr->ledStatus;
+            if (ledStateValid && (newLedState == ledState)) {
+                thisPtr->ledSuppressedUpdateCount += ULONG(updateRequests);
+                continue;
+            } // if
+
+            (void)thisPtr->setActivityLed(newLedState);
+            lastUpdateTime = KeQueryInterruptTime();
+            ledState = newLedState;
+            ledStateValid = true;
+
+            ++thisPtr->ledUpdateCount;
+            if (updateRequests > 1) {
+                thisPtr->ledSuppressedUpdateCount += ULONG(updateRequests - 1);
+            } // if
         }
         else if (waitStatus == _WAIT_SHUTDOWN_EVENT) {
             SDHC_LOG_TRACE("LED Shutdown requested ...");
@@ -2328,7 +3722,11 @@ VOID SDHC::ledWorker(
 
     } // for (;;)
 
-    SDHC_LOG_TRACE("LED Thread shutdown");
+    SDHC_LOG_INFORMATION(
+        "LED Thread shutdown - %lu LED updates, %lu suppressed (ledUpdateIntervalMs = %lu)",
+        thisPtr->ledUpdateCount,
+        thisPtr->ledSuppressedUpdateCount,
+        ledUpdateIntervalMs);
 }
 
 SDHC::_REGISTERS_DUMP::_REGISTERS_DUMP () throw () :
@@ -2418,6 +3816,29 @@ SDHC::SDHC (
     baseSpaceSize(BaseSpaceSize),
     outstandingRequestPtr(nullptr),
     sdhcCapabilities(),
+    dmaChannel(_DMA_CHANNEL_NONE),
+    dmaChannelBasePtr(nullptr),
+    dmaCbPtr(nullptr),
+    dmaCbBusAddress(0),
+    dmaBufferPtr(nullptr),
+    dmaBufferBusAddress(0),
+    dmaTransferLength(0),
+    dmaRequestPtr(nullptr),
+    dmaDataPhaseStatus(STATUS_SUCCESS),
+    cmd23Supported(false),
+    blockCountPredefined(false),
+    dataIdlePending(false),
+    dataIdleAlternateFsmState(0),
+    ledStatus(FALSE),
+    ledUpdateRequests(0),
+    ledUpdateCount(0),
+    ledSuppressedUpdateCount(0),
+    fsmWaitEstimateUs(0),
+    fsmRelaxTimerPtr(nullptr),
+    fsmRelaxSpinMarginUs(_ADAPTIVE_FSM_SPIN_WINDOW_US),
+#if ENABLE_PERFORMANCE_LOGGING
+    statsDeviceReferenced(false),
+#endif // ENABLE_PERFORMANCE_LOGGING
     crashdumpMode(CrashdumpMode)
 {
 } // ...::SDHC (...)
@@ -2426,9 +3847,455 @@ SDHC::~SDHC () throw ()
 {
 } // ...::~SDHC ()
 
+SDHC::_DMA_RESOURCE SDHC::dmaResources[_MAX_DMA_RESOURCES];
+ULONG SDHC::dmaResourceCount;
+FAST_MUTEX SDHC::dmaResourcesLock;
+DRIVER_DISPATCH* SDHC::sdportDispatchPtrs[IRP_MJ_MAXIMUM_FUNCTION + 1];
+
+_Use_decl_annotations_
+NTSTATUS SDHC::sdhcDispatch (
+    DEVICE_OBJECT* DeviceObjectPtr,
+    IRP* IrpPtr
+    )
+{
+    IO_STACK_LOCATION* stackPtr = IoGetCurrentIrpStackLocation(IrpPtr);
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+    //
+    // Handles to the control device may outlive it, tell it apart from the
+    // Sdport devices by its type rather than by the current device object.
+    // Sdport's dispatch routines must never see the control device, its
+    // extension is not theirs
+    //
+    if (DeviceObjectPtr->DeviceType == FILE_DEVICE_RPISDHC) {
+        return statsDispatch(IrpPtr);
+    } // if
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
+#if ENABLE_DMA_TRANSFER
+
+    if ((stackPtr->MajorFunction == IRP_MJ_PNP) &&
+        (stackPtr->MinorFunction == IRP_MN_START_DEVICE)) {
+        saveDmaResource(stackPtr->Parameters.StartDevice.AllocatedResourcesTranslated);
+    } // if
+
+#endif // ENABLE_DMA_TRANSFER
+
+    return sdportDispatchPtrs[stackPtr->MajorFunction](DeviceObjectPtr, IrpPtr);
+} // SDHC::sdhcDispatch (...)
+
+_Use_decl_annotations_
+void SDHC::chainDispatchRoutines (
+    DRIVER_OBJECT* DriverObjectPtr
+    ) throw ()
+{
+    ExInitializeFastMutex(&dmaResourcesLock);
+
+    for (ULONG majorFunction = 0; majorFunction <= IRP_MJ_MAXIMUM_FUNCTION; ++majorFunction) {
+        sdportDispatchPtrs[majorFunction] = DriverObjectPtr->MajorFunction[majorFunction];
+        DriverObjectPtr->MajorFunction[majorFunction] = sdhcDispatch;
+    } // for (majorFunction)
+} // SDHC::chainDispatchRoutines (...)
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+RPISDHC_STATISTICS SDHC::exportedStats;
+LARGE_INTEGER SDHC::exportedStatsResetTimestamp;
+KSPIN_LOCK SDHC::exportedStatsLock;
+DRIVER_OBJECT* SDHC::statsDriverObjPtr;
+DEVICE_OBJECT* SDHC::statsDeviceObjPtr;
+FAST_MUTEX SDHC::statsDeviceLock;
+ULONG SDHC::statsDeviceRefCount;
+DRIVER_UNLOAD* SDHC::sdportDriverUnloadPtr;
+
+_Use_decl_annotations_
+void SDHC::resetExportedStats () throw ()
+{
+    KLOCK_QUEUE_HANDLE lockHandle;
+    KeAcquireInStackQueuedSpinLock(&exportedStatsLock, &lockHandle);
+
+    RtlZeroMemory(&exportedStats, sizeof(exportedStats));
+    exportedStats.Version = RPISDHC_STATISTICS_VERSION;
+    exportedStats.Size = sizeof(exportedStats);
+    exportedStatsResetTimestamp = KeQueryPerformanceCounter(NULL);
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+} // SDHC::resetExportedStats ()
+
+_Use_decl_annotations_
+void SDHC::updateExportedStats (
+    const SDPORT_REQUEST* RequestPtr,
+    NTSTATUS Status,
+    LONGLONG CommandTimeUs,
+    LONGLONG RequestTimeUs
+    ) throw ()
+{
+    const auto& logData = this->currRequestStats;
+
+    ULONG direction =
+        (RequestPtr->Command.TransferDirection == SdTransferDirectionRead) ?
+            RpiSdhcDirectionRead : RpiSdhcDirectionWrite;
+
+    ULONG sizeClass;
+    if (logData.BlockCount <= 1) {
+        sizeClass = RpiSdhcSizeClass1Block;
+    } else if (logData.BlockCount <= 8) {
+        sizeClass = RpiSdhcSizeClass2To8Blocks;
+    } else if (logData.BlockCount <= 64) {
+        sizeClass = RpiSdhcSizeClass9To64Blocks;
+    } else {
+        sizeClass = RpiSdhcSizeClassOver64Blocks;
+    } // iff
+
+    ULONGLONG latenciesUs[RpiSdhcLatencyCount];
+    latenciesUs[RpiSdhcLatencyFifoWait] = ULONGLONG(max(logData.FifoWaitTimeUs, 0ll));
+    latenciesUs[RpiSdhcLatencyFsmWait] = ULONGLONG(max(logData.FsmStateWaitTimeUs, 0ll));
+    latenciesUs[RpiSdhcLatencyCommand] = ULONGLONG(max(CommandTimeUs, 0ll));
+    latenciesUs[RpiSdhcLatencyRequest] = ULONGLONG(max(RequestTimeUs, 0ll));
+
+    KLOCK_QUEUE_HANDLE lockHandle;
+    KeAcquireInStackQueuedSpinLock(&exportedStatsLock, &lockHandle);
+
+    RPISDHC_TRANSFER_STATISTICS* transferStatsPtr =
+        &exportedStats.Transfers[direction][sizeClass];
+
+    ++transferStatsPtr->RequestCount;
+    if (!NT_SUCCESS(Status)) {
+        ++transferStatsPtr->FailedRequestCount;
+    } // if
+
+    if (logData.DmaTransfer) {
+        ++transferStatsPtr->DmaRequestCount;
+    } // if
+
+    transferStatsPtr->BlockCount += logData.BlockCount;
+
+    for (ULONG latency = 0; latency < RpiSdhcLatencyCount; ++latency) {
+        transferStatsPtr->TotalTimeUs[latency] += latenciesUs[latency];
+        transferStatsPtr->MaxTimeUs[latency] =
+            max(transferStatsPtr->MaxTimeUs[latency], latenciesUs[latency]);
+        ++transferStatsPtr->Histogram[latency][
+            getHistogramBucket(latenciesUs[latency], RPISDHC_HISTOGRAM_BUCKETS)];
+    } // for (latency)
+
+    exportedStats.LongFsmStateWaitCount += logData.LongFsmStateWaitCount;
+    exportedStats.TotalLongFsmStateWaitTimeUs += logData.LongFsmStateWaitTimeUs;
+    if ((direction == RpiSdhcDirectionWrite) &&
+        (RequestPtr->Command.Length == PAGE_SIZE)) {
+        ++exportedStats.PageSized4KWritesCount;
+    } // if
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+} // SDHC::updateExportedStats (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::statsDispatch (
+    IRP* IrpPtr
+    ) throw ()
+{
+    IO_STACK_LOCATION* stackPtr = IoGetCurrentIrpStackLocation(IrpPtr);
+    NTSTATUS status;
+
+    switch (stackPtr->MajorFunction) {
+    case IRP_MJ_CREATE:
+    case IRP_MJ_CLOSE:
+    case IRP_MJ_CLEANUP:
+        status = STATUS_SUCCESS;
+        break;
+
+    case IRP_MJ_DEVICE_CONTROL:
+        return statsDeviceControl(IrpPtr);
+
+    default:
+        status = STATUS_INVALID_DEVICE_REQUEST;
+    } // switch (...)
+
+    IrpPtr->IoStatus.Status = status;
+    IrpPtr->IoStatus.Information = 0;
+    IoCompleteRequest(IrpPtr, IO_NO_INCREMENT);
+
+    return status;
+} // SDHC::statsDispatch (...)
+
+_Use_decl_annotations_
+NTSTATUS SDHC::statsDeviceControl (
+    IRP* IrpPtr
+    ) throw ()
+{
+    IO_STACK_LOCATION* stackPtr = IoGetCurrentIrpStackLocation(IrpPtr);
+    NTSTATUS status;
+    ULONG_PTR information = 0;
+
+    switch (stackPtr->Parameters.DeviceIoControl.IoControlCode) {
+    case IOCTL_RPISDHC_GET_STATISTICS:
+    {
+        if (stackPtr->Parameters.DeviceIoControl.OutputBufferLength <
+            sizeof(RPISDHC_STATISTICS)) {
+            status = STATUS_BUFFER_TOO_SMALL;
+            break;
+        } // if
+
+        auto statsPtr = static_cast<RPISDHC_STATISTICS*>(IrpPtr->AssociatedIrp.SystemBuffer);
+        LARGE_INTEGER hpcFreqHz;
+        LARGE_INTEGER nowTimestamp = KeQueryPerformanceCounter(&hpcFreqHz);
+
+        KLOCK_QUEUE_HANDLE lockHandle;
+        KeAcquireInStackQueuedSpinLock(&exportedStatsLock, &lockHandle);
+
+        *statsPtr = exportedStats;
+        statsPtr->ElapsedTimeUs = ULONGLONG(
+            ((nowTimestamp.QuadPart - exportedStatsResetTimestamp.QuadPart) * 1000000ll) /
+            hpcFreqHz.QuadPart);
+
+        KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+        information = sizeof(RPISDHC_STATISTICS);
+        status = STATUS_SUCCESS;
+        break;
+    } // case IOCTL_RPISDHC_GET_STATISTICS
+
+    case IOCTL_RPISDHC_RESET_STATISTICS:
+        resetExportedStats();
+        status = STATUS_SUCCESS;
+        break;
+
+    default:
+        status = STATUS_INVALID_DEVICE_REQUEST;
+    } // switch (...)
+
+    IrpPtr->IoStatus.Status = status;
+    IrpPtr->IoStatus.Information = information;
+    IoCompleteRequest(IrpPtr, IO_NO_INCREMENT);
+
+    return status;
+} // SDHC::statsDeviceControl (...)
+
+_Use_decl_annotations_
+void SDHC::statsDriverUnload (
+    DRIVER_OBJECT* DriverObjectPtr
+    )
+{
+    SDHC_ASSERT(!statsDeviceRefCount);
+    deleteStatsDevice();
+
+    if (sdportDriverUnloadPtr) {
+        sdportDriverUnloadPtr(DriverObjectPtr);
+    } // if
+} // SDHC::statsDriverUnload (...)
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
 SDHC_NONPAGED_SEGMENT_END; //==================================================
+SDHC_PAGED_SEGMENT_BEGIN; //===================================================
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+//
+// {139D3908-EC57-49E7-88F1-D462427C3017}
+// Class of the statistics control device, lets an administrator override its
+// default security descriptor through the device class registry key
+//
+const GUID SDHC::statsDeviceClassGuid =
+    { 0x139d3908, 0xec57, 0x49e7, { 0x88, 0xf1, 0xd4, 0x62, 0x42, 0x7c, 0x30, 0x17 } };
+
+NTSTATUS SDHC::referenceStatsDevice () throw ()
+{
+    PAGED_CODE();
+
+    NTSTATUS status = STATUS_SUCCESS;
+
+    ExAcquireFastMutex(&statsDeviceLock);
+
+    if (!statsDeviceRefCount) {
+        status = createStatsDevice();
+    } // if
+
+    if (NT_SUCCESS(status)) {
+        ++statsDeviceRefCount;
+    } // if
+
+    ExReleaseFastMutex(&statsDeviceLock);
+
+    return status;
+} // SDHC::referenceStatsDevice ()
+
+void SDHC::dereferenceStatsDevice () throw ()
+{
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&statsDeviceLock);
+
+    SDHC_ASSERT(statsDeviceRefCount);
+    if (!--statsDeviceRefCount) {
+        deleteStatsDevice();
+    } // if
+
+    ExReleaseFastMutex(&statsDeviceLock);
+} // SDHC::dereferenceStatsDevice ()
+
+NTSTATUS SDHC::createStatsDevice () throw ()
+{
+    PAGED_CODE();
+
+    DECLARE_CONST_UNICODE_STRING(deviceName, RPISDHC_STATS_DEVICE_NAME);
+    DECLARE_CONST_UNICODE_STRING(symbolicName, RPISDHC_STATS_SYMBOLIC_NAME);
+
+    //
+    // Only the system and administrators get to read or reset the statistics
+    //
+    DEVICE_OBJECT* deviceObjPtr;
+    NTSTATUS status = IoCreateDeviceSecure(
+        statsDriverObjPtr,
+        0,
+        const_cast<UNICODE_STRING*>(&deviceName),
+        FILE_DEVICE_RPISDHC,
+        FILE_DEVICE_SECURE_OPEN,
+        FALSE,
+        &SDDL_DEVOBJ_SYS_ALL_ADM_ALL,
+        &statsDeviceClassGuid,
+        &deviceObjPtr);
+    if (!NT_SUCCESS(status)) {
+        SDHC_LOG_ERROR(
+            "IoCreateDeviceSecure(...) failed. (status = %!STATUS!)",
+            status);
+        return status;
+    } // if
+
+    status = IoCreateSymbolicLink(
+        const_cast<UNICODE_STRING*>(&symbolicName),
+        const_cast<UNICODE_STRING*>(&deviceName));
+    if (!NT_SUCCESS(status)) {
+        SDHC_LOG_ERROR(
+            "IoCreateSymbolicLink(...) failed. (status = %!STATUS!)",
+            status);
+        IoDeleteDevice(deviceObjPtr);
+        return status;
+    } // if
+
+    statsDeviceObjPtr = deviceObjPtr;
+    deviceObjPtr->Flags |= DO_BUFFERED_IO;
+    deviceObjPtr->Flags &= ~DO_DEVICE_INITIALIZING;
+
+    return STATUS_SUCCESS;
+} // SDHC::createStatsDevice ()
+
+void SDHC::deleteStatsDevice () throw ()
+{
+    PAGED_CODE();
+
+    if (!statsDeviceObjPtr) {
+        return;
+    } // if
+
+    DECLARE_CONST_UNICODE_STRING(symbolicName, RPISDHC_STATS_SYMBOLIC_NAME);
+    (void)IoDeleteSymbolicLink(const_cast<UNICODE_STRING*>(&symbolicName));
+    IoDeleteDevice(statsDeviceObjPtr);
+    statsDeviceObjPtr = nullptr;
+} // SDHC::deleteStatsDevice ()
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
+SDHC_PAGED_SEGMENT_END; //=====================================================
 SDHC_INIT_SEGMENT_BEGIN; //====================================================
 
+ULONG SDHC::ledUpdateIntervalMs = SDHC::_LED_UPDATE_INTERVAL_DEFAULT_MS;
+
+_Use_decl_annotations_
+void SDHC::readDriverParameters (
+    const UNICODE_STRING* RegistryPathPtr
+    ) throw ()
+{
+    //
+    // Driver parameters are optional, failing to read any of them leaves
+    // the built-in default in place
+    //
+    HANDLE serviceKey;
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(
+        &attributes,
+        const_cast<UNICODE_STRING*>(RegistryPathPtr),
+        OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+        NULL,
+        NULL);
+    NTSTATUS status = ZwOpenKey(&serviceKey, KEY_READ, &attributes);
+    if (!NT_SUCCESS(status)) {
+        SDHC_LOG_WARNING(
+            "ZwOpenKey(...) failed for the service key. (status = %!STATUS!)",
+            status);
+        return;
+    } // if
+
+    HANDLE parametersKey;
+    UNICODE_STRING parametersKeyName = RTL_CONSTANT_STRING(L"Parameters");
+    InitializeObjectAttributes(
+        &attributes,
+        &parametersKeyName,
+        OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+        serviceKey,
+        NULL);
+    status = ZwOpenKey(&parametersKey, KEY_READ, &attributes);
+    (void)ZwClose(serviceKey);
+    if (!NT_SUCCESS(status)) {
+        SDHC_LOG_INFORMATION(
+            "No driver parameters, using defaults. (status = %!STATUS!)",
+            status);
+        return;
+    } // if
+
+    UCHAR valueBuffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)];
+    auto valueInfoPtr = reinterpret_cast<KEY_VALUE_PARTIAL_INFORMATION*>(valueBuffer);
+    UNICODE_STRING valueName = RTL_CONSTANT_STRING(L"LedUpdateIntervalMs");
+    ULONG resultLength;
+    status = ZwQueryValueKey(
+        parametersKey,
+        &valueName,
+        KeyValuePartialInformation,
+        valueInfoPtr,
+        sizeof(valueBuffer),
+        &resultLength);
+    if (NT_SUCCESS(status) &&
+        (valueInfoPtr->Type == REG_DWORD) &&
+        (valueInfoPtr->DataLength == sizeof(ULONG))) {
+
+        ULONG intervalMs = *reinterpret_cast<ULONG UNALIGNED*>(valueInfoPtr->Data);
+        if (intervalMs > _LED_UPDATE_INTERVAL_MAX_MS) {
+            SDHC_LOG_WARNING(
+                "LedUpdateIntervalMs is too large, clamping. (intervalMs = %lu)",
+                intervalMs);
+            intervalMs = _LED_UPDATE_INTERVAL_MAX_MS;
+        } // if
+
+        ledUpdateIntervalMs = intervalMs;
+    } // if
+
+    (void)ZwClose(parametersKey);
+
+    SDHC_LOG_INFORMATION(
+        "Driver parameters (ledUpdateIntervalMs = %lu)",
+        ledUpdateIntervalMs);
+} // SDHC::readDriverParameters (...)
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+_Use_decl_annotations_
+void SDHC::initializeStatsInterface (
+    DRIVER_OBJECT* DriverObjectPtr
+    ) throw ()
+{
+    KeInitializeSpinLock(&exportedStatsLock);
+    ExInitializeFastMutex(&statsDeviceLock);
+    resetExportedStats();
+
+    statsDriverObjPtr = DriverObjectPtr;
+    sdportDriverUnloadPtr = DriverObjectPtr->DriverUnload;
+    DriverObjectPtr->DriverUnload = statsDriverUnload;
+} // SDHC::initializeStatsInterface (...)
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+
+
 _Use_decl_annotations_
 NTSTATUS
 DriverEntry (
@@ -2442,6 +4309,7 @@ DriverEntry (
     //
     if (KeGetCurrentIrql() < DISPATCH_LEVEL) {
         SDHC_LOG_INIT(DriverObjectPtr, RegistryPathPtr);
+        SDHC::readDriverParameters(RegistryPathPtr);
     } // if
 
     SDHC_LOG_INFORMATION(
@@ -2484,6 +4352,21 @@ DriverEntry (
         return status;
     } // if
 
+    //
+    // The crashdump stack has no use for the FixedDMA resource nor for the
+    // statistics interface, whose control device comes and goes with the
+    // SDHC instances
+    //
+    if (KeGetCurrentIrql() < DISPATCH_LEVEL) {
+        SDHC::chainDispatchRoutines(DriverObjectPtr);
+
+#if ENABLE_PERFORMANCE_LOGGING
+
+        SDHC::initializeStatsInterface(DriverObjectPtr);
+
+#endif // ENABLE_PERFORMANCE_LOGGING
+    } // if
+
     return STATUS_SUCCESS;
 } // DriverEntry (...)
 
@@ -71,6 +71,15 @@ __forceinline void __cdecl operator delete ( void* Ptr, size_t ) throw ()
 
 #define SDCMD_STOP_TRANSMISSION     12
 #define SDCMD_SELECT_CARD           7
+#define SDCMD_READ_MULTIPLE_BLOCK   18
+#define SDCMD_SET_BLOCK_COUNT       23
+#define SDCMD_WRITE_MULTIPLE_BLOCK  25
+
+//
+// Standard SD App Commands Index
+//
+
+#define SDACMD_SEND_SCR             51
 
 #if DBG
 //
@@ -82,11 +91,55 @@ __forceinline void __cdecl operator delete ( void* Ptr, size_t ) throw ()
 #define ENABLE_STATUS_SAMPLING      0
 #endif
 
+//
+// Feature switches below can be overridden from the build command line, the
+// host-side test harness builds variants with some of them turned off
+//
+
 //
 // When enabled, logs on request completion of each data transfer request useful
 // measurements that aid in SDHC performance assessment
 //
+#ifndef ENABLE_PERFORMANCE_LOGGING
 #define ENABLE_PERFORMANCE_LOGGING  1
+#endif
+
+//
+// When enabled, multi-block data transfers are moved between memory and the
+// SDHC FIFO by a BCM2835 DMA channel paced on the SDHost DREQ, instead of the
+// PIO transfer worker polling the FIFO one word at a time
+// Crashdump mode always uses PIO regardless of this setting
+//
+#ifndef ENABLE_DMA_TRANSFER
+#define ENABLE_DMA_TRANSFER         1
+#endif
+
+//
+// When enabled, PIO moves as many words as the SDHC FIFO fill level allows
+// in one run, instead of polling the data flag before every word
+//
+#ifndef ENABLE_FIFO_BURST_IO
+#define ENABLE_FIFO_BURST_IO        1
+#endif
+
+//
+// When enabled, multi-block reads/writes to SDCards supporting CMD23 get
+// prefixed with SET_BLOCK_COUNT instead of being ended by STOP_TRANSMISSION,
+// which lets a request complete as soon as its data phase is over while the
+// SDCard is still busy programming the last written block
+//
+#ifndef ENABLE_PREDEFINED_BLOCK_COUNT
+#define ENABLE_PREDEFINED_BLOCK_COUNT 1
+#endif
+
+//
+// When enabled, the transfer worker gives up its core while an SDCard is
+// expected to be busy programming a block, and only polls the SDHC FSM near
+// the expected completion learned from previous block writes
+//
+#ifndef ENABLE_ADAPTIVE_FSM_WAIT
+#define ENABLE_ADAPTIVE_FSM_WAIT    1
+#endif
 
 extern "C" DRIVER_INITIALIZE DriverEntry;
 
@@ -123,12 +176,82 @@ private: // non-paged
         //
         _LONG_FSM_WAIT_TIME_THRESHOLD_US = 100000,
 
+        //
+        // Adaptive FSM wait tuning. The wait sleeps on a high resolution timer
+        // until the learned block program time minus the timer period and a
+        // spin window, then polls
+        // The learned time is an exponential moving average with 1/8 weight
+        //
+        _ADAPTIVE_FSM_SPIN_WINDOW_US = 100,
+        _FSM_WAIT_ESTIMATE_EWMA_SHIFT = 3,
+
+        //
+        // Number of log2 buckets of the FSM wait histogram, bucket i counts waits
+        // in [2^(i-1), 2^i) us with bucket 0 counting zero waits, the last bucket
+        // catches everything beyond
+        //
+        _FSM_WAIT_HISTOGRAM_BUCKETS = 22,
+
         //
         // Divider used to determine SDHC HW timeout for Read/Write/Erase
         // The time-out value set in TOUT register is SDCLK / _RWE_TIMEOUT_CLOCK_DIV
         // A value of 1 means 1s HW timeout, a value of 4 means 1/4 of a second timeout
         //
         _RWE_TIMEOUT_CLOCK_DIV = 1,
+
+        //
+        // SDHC FIFO read/write DREQ thresholds in 4-byte words
+        //
+        _FIFO_READ_THRESHOLD = 4,
+        _FIFO_WRITE_THRESHOLD = 4,
+
+        //
+        // SDHC FIFO depth in 4-byte words
+        //
+        _FIFO_WORDS = 16,
+
+        //
+        // BCM2835 peripherals layout used to locate the DMA channel registers
+        // relative to the SDHC registers, and to translate ARM physical addresses
+        // to VideoCore bus addresses as seen by the DMA engine
+        //
+        _SDHC_PERIPHERAL_OFFSET = 0x00202000,
+        _DMA_PERIPHERAL_OFFSET = 0x00007000,
+        _DMA_CHANNEL_REGISTERS_SIZE = 0x100,
+        _PERIPHERALS_BUS_BASE = 0x7E000000,
+        _UNCACHED_MEMORY_BUS_BASE = 0xC0000000,
+
+        //
+        // The DMA channel comes from the FixedDMA resource of the SDHC, channel
+        // 15 sits apart from the others and is never assigned
+        //
+        _DMA_CHANNEL_COUNT = 15,
+        _DMA_CHANNEL_NONE = 0xFFFFFFFF,
+
+        //
+        // DREQ peripheral number of the SDHost FIFO, the request line of the
+        // SDHC FixedDMA resource
+        //
+        _DMA_DREQ_SDHOST = 13,
+
+        //
+        // SDHC devices whose FixedDMA resource can be tracked at once
+        //
+        _MAX_DMA_RESOURCES = 4,
+
+        //
+        // Largest length moved by a single DMA control block, kept within the
+        // 16-bit XLENGTH limit of the DMA Lite channels and block aligned
+        //
+        _DMA_MAX_CB_TRANSFER_LENGTH = 0x8000,
+
+        //
+        // Activity LED updates are coalesced such that the LED GPIO gets written
+        // at most once per update interval. The interval can be overridden through
+        // the LedUpdateIntervalMs driver parameter, 0 disables the rate limiting
+        //
+        _LED_UPDATE_INTERVAL_DEFAULT_MS = 50,
+        _LED_UPDATE_INTERVAL_MAX_MS = 1000,
     }; // enum
 
     enum class _REGISTER : ULONG {
@@ -273,6 +396,7 @@ private: // non-paged
         enum : UINT32 {
             UINT32_FSM_IDENTMODE = 0x0,
             UINT32_FSM_DATAMODE = 0x1,
+            UINT32_FSM_READWAIT = 0x4,
             UINT32_FSM_WRITESTART1 = 0xa
         };
 
@@ -376,6 +500,117 @@ private: // non-paged
         } Fields;
     }; // _SDPORT_ERRORS
 
+    //
+    // BCM2835 DMA channel registers
+    //
+
+    enum class _DMA_REGISTER : ULONG {
+        CS        = 0x00,
+        CONBLK_AD = 0x04,
+        TI        = 0x08,
+        SOURCE_AD = 0x0C,
+        DEST_AD   = 0x10,
+        TXFR_LEN  = 0x14,
+        STRIDE    = 0x18,
+        NEXTCONBK = 0x1C,
+        DEBUG     = 0x20
+    }; // enum class _DMA_REGISTER
+
+    union _DMA_CS {
+        enum : ULONG { OFFSET = ULONG(_DMA_REGISTER::CS) };
+
+        UINT32 AsUint32;
+        struct {
+            unsigned Active                      : 1; // 0
+            unsigned End                         : 1; // 1
+            unsigned Int                         : 1; // 2
+            unsigned Dreq                        : 1; // 3
+            unsigned Paused                      : 1; // 4
+            unsigned DreqStopsDma                : 1; // 5
+            unsigned WaitingForOutstandingWrites : 1; // 6
+            unsigned _reserved0                  : 1; // 7
+            unsigned Error                       : 1; // 8
+            unsigned _reserved1                  : 7; // 9:15
+            unsigned Priority                    : 4; // 16:19
+            unsigned PanicPriority               : 4; // 20:23
+            unsigned _reserved2                  : 4; // 24:27
+            unsigned WaitForOutstandingWrites    : 1; // 28
+            unsigned DisDebug                    : 1; // 29
+            unsigned Abort                       : 1; // 30
+            unsigned Reset                       : 1; // 31
+        } Fields;
+    }; // union _DMA_CS
+
+    union _DMA_CONBLK_AD {
+        enum : ULONG { OFFSET = ULONG(_DMA_REGISTER::CONBLK_AD) };
+
+        UINT32 AsUint32;
+        struct {
+            unsigned ScbAddr : 32; // 0:31
+        } Fields;
+    }; // union _DMA_CONBLK_AD
+
+    union _DMA_TI {
+        enum : ULONG { OFFSET = ULONG(_DMA_REGISTER::TI) };
+
+        UINT32 AsUint32;
+        struct {
+            unsigned Inten        : 1; // 0
+            unsigned Tdmode       : 1; // 1
+            unsigned _reserved0   : 1; // 2
+            unsigned WaitResp     : 1; // 3
+            unsigned DestInc      : 1; // 4
+            unsigned DestWidth    : 1; // 5
+            unsigned DestDreq     : 1; // 6
+            unsigned DestIgnore   : 1; // 7
+            unsigned SrcInc       : 1; // 8
+            unsigned SrcWidth     : 1; // 9
+            unsigned SrcDreq      : 1; // 10
+            unsigned SrcIgnore    : 1; // 11
+            unsigned BurstLength  : 4; // 12:15
+            unsigned Permap       : 5; // 16:20
+            unsigned Waits        : 5; // 21:25
+            unsigned NoWideBursts : 1; // 26
+            unsigned _reserved1   : 5; // 27:31
+        } Fields;
+    }; // union _DMA_TI
+
+    union _DMA_DEBUG {
+        enum : ULONG { OFFSET = ULONG(_DMA_REGISTER::DEBUG) };
+
+        enum : UINT32 {
+            UINT32_ERROR_MASK = 0x7
+        };
+
+        UINT32 AsUint32;
+        struct {
+            unsigned ReadLastNotSetError : 1;  // 0
+            unsigned FifoError           : 1;  // 1
+            unsigned ReadError           : 1;  // 2
+            unsigned _reserved0          : 1;  // 3
+            unsigned OutstandingWrites   : 4;  // 4:7
+            unsigned DmaId               : 8;  // 8:15
+            unsigned DmaState            : 9;  // 16:24
+            unsigned Version             : 3;  // 25:27
+            unsigned Lite                : 1;  // 28
+            unsigned _reserved1          : 3;  // 29:31
+        } Fields;
+    }; // union _DMA_DEBUG
+
+    //
+    // DMA control block, has to be 256-bit aligned
+    //
+    struct _DMA_CB {
+        __declspec(align(32)) _DMA_TI TI;
+        UINT32 SourceAd;
+        UINT32 DestAd;
+        UINT32 TxfrLen;
+        UINT32 Stride;
+        UINT32 NextConbk;
+        UINT32 _reserved0;
+        UINT32 _reserved1;
+    }; // struct _DMA_CB
+
     template < typename _T_REG_UNION > __forceinline void readRegister (
         _Out_ _T_REG_UNION* RegUnionPtr
         ) const throw ()
@@ -428,6 +663,26 @@ private: // non-paged
         ::WRITE_REGISTER_NOFENCE_ULONG(regPtr, RegUnion.AsUint32);
     } // writeRegisterNoFence<...> ( _T_REG_UNION )
 
+    template < typename _T_REG_UNION > __forceinline void readDmaRegister (
+        _Out_ _T_REG_UNION* RegUnionPtr
+        ) const throw ()
+    {
+        C_ASSERT(sizeof(UINT32) == sizeof(ULONG));
+        ULONG* const regPtr = reinterpret_cast<ULONG*>(
+            ULONG_PTR(this->dmaChannelBasePtr) + ULONG(RegUnionPtr->OFFSET));
+        RegUnionPtr->AsUint32 = ::READ_REGISTER_ULONG(regPtr);
+    } // readDmaRegister<...> ( _T_REG_UNION* )
+
+    template < typename _T_REG_UNION > __forceinline void writeDmaRegister (
+        _T_REG_UNION RegUnion
+        ) const throw ()
+    {
+        C_ASSERT(sizeof(UINT32) == sizeof(ULONG));
+        ULONG* const regPtr = reinterpret_cast<ULONG*>(
+            ULONG_PTR(this->dmaChannelBasePtr) + ULONG(RegUnion.OFFSET));
+        ::WRITE_REGISTER_ULONG(regPtr, RegUnion.AsUint32);
+    } // writeDmaRegister<...> ( _T_REG_UNION )
+
     NTSTATUS readFromFifo (
         _Out_writes_bytes_(Size) void* BufferPtr,
         ULONG Size
@@ -475,6 +730,15 @@ private: // non-paged
     _IRQL_requires_(DISPATCH_LEVEL)
     NTSTATUS sendRequestCommand ( _Inout_ SDPORT_REQUEST* RequestPtr ) throw ();
 
+    _IRQL_requires_max_(APC_LEVEL)
+    void sendDeferredRequestCommand ( _Inout_ SDPORT_REQUEST* RequestPtr ) throw ();
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NTSTATUS prepareRequestCommand ( _Inout_ SDPORT_REQUEST* RequestPtr ) throw ();
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NTSTATUS issueRequestCommand ( _Inout_ SDPORT_REQUEST* RequestPtr ) throw ();
+
     _IRQL_requires_(DISPATCH_LEVEL)
     NTSTATUS sendCommandInternal (
         _CMD Cmd,
@@ -492,6 +756,58 @@ private: // non-paged
 
     NTSTATUS transferMultiBlockPio ( _Inout_ SDPORT_REQUEST* RequestPtr ) throw ();
 
+    NTSTATUS endMultiBlockTransfer (
+        _Inout_ SDPORT_REQUEST* RequestPtr,
+        NTSTATUS Status
+        ) throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS initializeDma () throw ();
+
+    //
+    // Sdport hands the miniport nothing but the register base of the SDHC, the
+    // FixedDMA channel is picked off IRP_MN_START_DEVICE on its way to Sdport
+    // and looked up by register base when the SDHC initializes
+    //
+    struct _DMA_RESOURCE {
+        PHYSICAL_ADDRESS BasePhysicalAddress;
+        ULONG Channel;
+    };
+
+    static _DMA_RESOURCE dmaResources[_MAX_DMA_RESOURCES];
+    static ULONG dmaResourceCount;
+    static FAST_MUTEX dmaResourcesLock;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static void saveDmaResource ( _In_opt_ const CM_RESOURCE_LIST* ResourceListPtr ) throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static ULONG findDmaChannel ( PHYSICAL_ADDRESS BasePhysicalAddress ) throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void releaseDma () throw ();
+
+    bool isDmaTransfer ( _In_ const SDPORT_REQUEST* RequestPtr ) const throw ();
+
+    bool isPredefinedBlockCountTransfer (
+        _In_ const SDPORT_REQUEST* RequestPtr
+        ) const throw ();
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NTSTATUS startTransferDma ( _Inout_ SDPORT_REQUEST* RequestPtr ) throw ();
+
+    _IRQL_requires_max_(APC_LEVEL)
+    NTSTATUS transferDma ( _Inout_ SDPORT_REQUEST* RequestPtr ) throw ();
+
+    NTSTATUS releaseDmaRequest (
+        _Inout_ SDPORT_REQUEST* RequestPtr,
+        NTSTATUS Status
+        ) throw ();
+
+    NTSTATUS waitForDmaCompletion () throw ();
+
+    void stopDma () throw ();
+
     _IRQL_requires_max_(DISPATCH_LEVEL)
     NTSTATUS sendNoTransferCommand (
         UCHAR Cmd,
@@ -534,8 +850,18 @@ private: // non-paged
 
     NTSTATUS waitForFsmState( ULONG state ) throw ();
 
+    _IRQL_requires_max_(APC_LEVEL)
+    ULONG relaxForFsmState (
+        ULONG State,
+        _Out_ ULONG* RelaxTargetUsPtr
+        ) throw ();
+
     NTSTATUS drainReadFifo() throw ();
 
+    bool isDataIdle () throw ();
+
+    NTSTATUS waitForDataIdle () throw ();
+
     NTSTATUS getErrorStatus ( _HSTS Hsts ) throw ();
 
     NTSTATUS getLastCommandCompletionStatus () throw ();
@@ -661,6 +987,21 @@ private: // non-paged
     //
     const BOOLEAN crashdumpMode;
 
+    //
+    // Driver Dispatch Filter
+    //
+    // Sdport owns the driver dispatch table. Every routine it installs is
+    // chained behind a filter that picks the FixedDMA resource off device
+    // starts and serves the statistics control device
+    //
+
+    static DRIVER_DISPATCH* sdportDispatchPtrs[IRP_MJ_MAXIMUM_FUNCTION + 1];
+
+    static DRIVER_DISPATCH sdhcDispatch;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static void chainDispatchRoutines ( _Inout_ DRIVER_OBJECT* DriverObjectPtr ) throw ();
+
 #if ENABLE_PERFORMANCE_LOGGING
 
     //
@@ -673,13 +1014,17 @@ private: // non-paged
         LONGLONG FifoWaitCount;
         LONGLONG FifoWaitTimeUs;
         LONGLONG FifoMaxWaitTimeUs;
+        LONGLONG FifoBurstCount;
         LONGLONG FsmStateWaitTimeUs;
         LONGLONG FsmStateWaitCount;
         LONGLONG FsmStateMinWaitTimeUs;
         LONGLONG FsmStateMaxWaitTimeUs;
         LONGLONG LongFsmStateWaitCount;
         LONGLONG LongFsmStateWaitTimeUs;
+        LONGLONG CommandLatencyTicks;
         USHORT BlockCount;
+        BOOLEAN DmaTransfer;
+        LARGE_INTEGER DmaStartTimestamp;
     } currRequestStats;
 
     struct _SDHC_STATISTICS {
@@ -688,8 +1033,76 @@ private: // non-paged
         LONGLONG TotalFsmStateWaitTimeUs;
         LONGLONG LongFsmStateWaitCount;
         LONGLONG TotalLongFsmStateWaitTimeUs;
+        LONGLONG FsmStateWaitHistogram[_FSM_WAIT_HISTOGRAM_BUCKETS];
     } sdhcStats;
 
+    //
+    // Statistics Interface
+    //
+    // Cumulative statistics exported to user mode through a control device,
+    // the dispatch filter completes the control device IRPs itself
+    //
+
+    static RPISDHC_STATISTICS exportedStats;
+    static LARGE_INTEGER exportedStatsResetTimestamp;
+    static KSPIN_LOCK exportedStatsLock;
+
+    static const GUID statsDeviceClassGuid;
+    static DRIVER_OBJECT* statsDriverObjPtr;
+    static DEVICE_OBJECT* statsDeviceObjPtr;
+    static FAST_MUTEX statsDeviceLock;
+    static ULONG statsDeviceRefCount;
+    static DRIVER_UNLOAD* sdportDriverUnloadPtr;
+
+    static DRIVER_UNLOAD statsDriverUnload;
+
+    static NTSTATUS statsDispatch ( _Inout_ IRP* IrpPtr ) throw ();
+
+    static NTSTATUS statsDeviceControl ( _Inout_ IRP* IrpPtr ) throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static void initializeStatsInterface ( _Inout_ DRIVER_OBJECT* DriverObjectPtr ) throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static NTSTATUS referenceStatsDevice () throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static void dereferenceStatsDevice () throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static NTSTATUS createStatsDevice () throw ();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static void deleteStatsDevice () throw ();
+
+    //
+    // Whether this SDHC instance holds a reference on the statistics control
+    // device, the last one going away deletes it
+    //
+    bool statsDeviceReferenced;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    static void resetExportedStats () throw ();
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void updateExportedStats (
+        _In_ const SDPORT_REQUEST* RequestPtr,
+        NTSTATUS Status,
+        LONGLONG CommandTimeUs,
+        LONGLONG RequestTimeUs
+        ) throw ();
+
+    static ULONG getHistogramBucket ( ULONGLONG ValueUs, ULONG BucketCount ) throw ()
+    {
+        ULONG bucket = 0;
+        while (ValueUs && (bucket < (BucketCount - 1))) {
+            ValueUs >>= 1;
+            ++bucket;
+        } // while (...)
+
+        return bucket;
+    }
+
 #endif // ENABLE_PERFORMANCE_LOGGING
 
     //
@@ -702,6 +1115,84 @@ private: // non-paged
     KEVENT transferWorkerDoIoEvt;
     PKTHREAD transferThreadObjPtr;
 
+    //
+    // DMA Transfer State Management
+    //
+    // The DMA engine moves data through a noncached contiguous bounce buffer
+    // since the BCM2835 DMA is not coherent with the ARM caches
+    //
+
+    enum : ULONG {
+        //
+        // Largest block count HBLC can hold, which also bounds the bounce buffer
+        // to 511 blocks of 512 bytes rounded up to a page multiple
+        //
+        _HBLC_MAX_BLOCK_COUNT = 0x1FF,
+        _DMA_BUFFER_SIZE = 0x40000,
+        _DMA_CB_COUNT =
+            (_DMA_BUFFER_SIZE + _DMA_MAX_CB_TRANSFER_LENGTH - 1) / _DMA_MAX_CB_TRANSFER_LENGTH,
+
+        //
+        // Backstop on the wait for the end of a DMA data phase, in case neither
+        // the block interrupt nor an SDHC error interrupt ever shows up. It allows
+        // for the 250ms worst case SDCard write time of every block
+        //
+        _DMA_DATA_PHASE_TIMEOUT_MS = 1000,
+        _DMA_DATA_PHASE_TIMEOUT_PER_BLOCK_MS = 250,
+    }; // enum
+
+    ULONG dmaChannel;
+    void* dmaChannelBasePtr;
+    _DMA_CB* dmaCbPtr;
+    ULONG dmaCbBusAddress;
+    UCHAR* dmaBufferPtr;
+    ULONG dmaBufferBusAddress;
+    ULONG dmaTransferLength;
+
+    //
+    // The transfer request currently being moved by the DMA engine. The transfer
+    // worker owns it from its start until it issues STOP_TRANSMISSION, and is the
+    // only one to touch the DMA engine and the request data buffer meanwhile. The
+    // DPC and a host reset only report the end of the data phase through the data
+    // phase status and event, all under the DMA request lock
+    //
+    SDPORT_REQUEST* dmaRequestPtr;
+    NTSTATUS dmaDataPhaseStatus;
+    KEVENT dmaDataPhaseEvt;
+    KSPIN_LOCK dmaRequestLock;
+
+    //
+    // Learned time in us the inserted SDCard takes to program a written block
+    //
+    ULONG fsmWaitEstimateUs;
+
+    //
+    // High resolution timer the FSM wait sleeps on, a system timer sleep would
+    // end up to a whole timer tick late
+    //
+    static EXT_CALLBACK fsmRelaxTimerCallback;
+    PEX_TIMER fsmRelaxTimerPtr;
+    KEVENT fsmRelaxTimerEvt;
+
+    //
+    // Time in us the FSM wait leaves for polling, the relax timer period
+    // plus _ADAPTIVE_FSM_SPIN_WINDOW_US
+    //
+    ULONG fsmRelaxSpinMarginUs;
+
+    //
+    // Pre-defined Block Count (CMD23) State Management
+    //
+    // A transfer with a pre-defined block count doesn't need STOP_TRANSMISSION,
+    // it completes on the end of its data phase and leaves the SDHC FSM parked
+    // in an alternate idle state until the next command gets issued
+    //
+
+    bool cmd23Supported;
+    bool blockCountPredefined;
+    bool dataIdlePending;
+    ULONG dataIdleAlternateFsmState;
+
     //
     // LED Control Worker State Management
     //
@@ -711,7 +1202,21 @@ private: // non-paged
     KEVENT ledWorkerShutdownEvt;
     KEVENT ledWorkerUpdateEvt;
     PKTHREAD ledWorkerThreadObjPtr;
-    BOOLEAN ledStatus;
+    BOOLEAN volatile ledStatus;
+
+    //
+    // Number of LED state changes signaled to the LED worker, and how many of
+    // them were absorbed by the rate limiting or were redundant and did not
+    // result in a GPIO write
+    //
+    LONG volatile ledUpdateRequests;
+    ULONG ledUpdateCount;
+    ULONG ledSuppressedUpdateCount;
+
+    static ULONG ledUpdateIntervalMs;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static void readDriverParameters ( _In_ const UNICODE_STRING* RegistryPathPtr ) throw ();
 
     //
     // An outstanding transfer request that is either owned by the SDHC
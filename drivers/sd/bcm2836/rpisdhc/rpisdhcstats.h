@@ -0,0 +1,146 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Abstract:
+//
+//  This file contains the public device path names, IOCTL definitions and
+//  statistics layout exported by the rpisdhc Sdhost miniport driver when
+//  built with performance logging enabled
+//
+// Environment:
+//
+//  Kernel and user mode
+//
+
+#ifndef _RPISDHCSTATS_H_
+#define _RPISDHCSTATS_H_
+
+#if (NTDDI_VERSION >= NTDDI_WINTHRESHOLD)
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+//
+// Device path names
+//
+
+#define RPISDHC_STATS_NAME L"RPISDHCSTATS"
+
+#define RPISDHC_STATS_DEVICE_NAME L"\\Device\\" RPISDHC_STATS_NAME
+#define RPISDHC_STATS_SYMBOLIC_NAME L"\\DosDevices\\" RPISDHC_STATS_NAME
+#define RPISDHC_STATS_USERMODE_PATH L"\\\\.\\" RPISDHC_STATS_NAME
+
+//
+// IOCTL codes
+//
+
+#define FILE_DEVICE_RPISDHC 0x401
+
+//
+// Get a snapshot of the statistics accumulated since the last reset
+//
+// Input buffer:
+// None
+//
+// Output buffer:
+// lpOutBuffer - pointer to a variable of type RPISDHC_STATISTICS
+// nOutBufferSize - sizeof(RPISDHC_STATISTICS)
+//
+#define IOCTL_RPISDHC_GET_STATISTICS    CTL_CODE(FILE_DEVICE_RPISDHC, 0x700, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Reset all statistics to zero
+//
+// Input buffer:
+// None
+//
+// Output buffer:
+// None
+//
+#define IOCTL_RPISDHC_RESET_STATISTICS  CTL_CODE(FILE_DEVICE_RPISDHC, 0x701, METHOD_BUFFERED, FILE_WRITE_DATA)
+
+//
+// Statistics layout
+//
+
+#define RPISDHC_STATISTICS_VERSION 1
+
+//
+// Latency histograms are log2 scaled in microseconds. Bucket 0 counts zero
+// latencies, bucket i counts latencies in [2^(i-1), 2^i) us, and the last
+// bucket counts everything beyond
+//
+#define RPISDHC_HISTOGRAM_BUCKETS 24
+
+typedef enum _RPISDHC_DIRECTION {
+    RpiSdhcDirectionRead = 0,
+    RpiSdhcDirectionWrite,
+    RpiSdhcDirectionCount
+} RPISDHC_DIRECTION;
+
+typedef enum _RPISDHC_SIZE_CLASS {
+    RpiSdhcSizeClass1Block = 0,
+    RpiSdhcSizeClass2To8Blocks,
+    RpiSdhcSizeClass9To64Blocks,
+    RpiSdhcSizeClassOver64Blocks,
+    RpiSdhcSizeClassCount
+} RPISDHC_SIZE_CLASS;
+
+typedef enum _RPISDHC_LATENCY {
+    //
+    // Total time spent polling for the FIFO data flag during a request
+    //
+    RpiSdhcLatencyFifoWait = 0,
+
+    //
+    // Total time spent polling for SDHC FSM transitions during a request
+    //
+    RpiSdhcLatencyFsmWait,
+
+    //
+    // Time from issuing the data command until its data phase got started
+    //
+    RpiSdhcLatencyCommand,
+
+    //
+    // Time from issuing the data command until request completion
+    //
+    RpiSdhcLatencyRequest,
+
+    RpiSdhcLatencyCount
+} RPISDHC_LATENCY;
+
+typedef struct _RPISDHC_TRANSFER_STATISTICS {
+    ULONGLONG RequestCount;
+    ULONGLONG FailedRequestCount;
+    ULONGLONG DmaRequestCount;
+    ULONGLONG BlockCount;
+    ULONGLONG TotalTimeUs[RpiSdhcLatencyCount];
+    ULONGLONG MaxTimeUs[RpiSdhcLatencyCount];
+    ULONGLONG Histogram[RpiSdhcLatencyCount][RPISDHC_HISTOGRAM_BUCKETS];
+} RPISDHC_TRANSFER_STATISTICS;
+
+typedef struct _RPISDHC_STATISTICS {
+    ULONG Version;
+    ULONG Size;
+
+    //
+    // Time covered by this snapshot since the last statistics reset
+    //
+    ULONGLONG ElapsedTimeUs;
+
+    ULONGLONG LongFsmStateWaitCount;
+    ULONGLONG TotalLongFsmStateWaitTimeUs;
+    ULONGLONG PageSized4KWritesCount;
+
+    RPISDHC_TRANSFER_STATISTICS Transfers[RpiSdhcDirectionCount][RpiSdhcSizeClassCount];
+} RPISDHC_STATISTICS;
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // NTDDI_VERSION >= NTDDI_WINTHRESHOLD
+
+#endif // _RPISDHCSTATS_H_
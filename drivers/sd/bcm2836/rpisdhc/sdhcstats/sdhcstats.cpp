@@ -0,0 +1,187 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Abstract:
+//
+//  User mode tool that dumps or resets the statistics exported by the
+//  rpisdhc Sdhost miniport driver
+//
+// Environment:
+//
+//  User mode only
+//
+
+#include <windows.h>
+#include <winioctl.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "..\rpisdhcstats.h"
+
+namespace { // static
+
+const char* const directionNames[RpiSdhcDirectionCount] = {
+    "Read",
+    "Write"
+};
+
+const char* const sizeClassNames[RpiSdhcSizeClassCount] = {
+    "1 block",
+    "2-8 blocks",
+    "9-64 blocks",
+    ">64 blocks"
+};
+
+const char* const latencyNames[RpiSdhcLatencyCount] = {
+    "Fifo Wait",
+    "Fsm Wait",
+    "Command",
+    "Request"
+};
+
+void printUsage ()
+{
+    wprintf(
+        L"Usage: sdhcstats [-reset]\n"
+        L"  Dumps the rpisdhc statistics accumulated since the last reset\n"
+        L"  -reset  Resets the statistics after dumping them\n");
+} // printUsage ()
+
+void printTransferStats (
+    RPISDHC_DIRECTION Direction,
+    RPISDHC_SIZE_CLASS SizeClass,
+    const RPISDHC_TRANSFER_STATISTICS& Stats
+    )
+{
+    printf(
+        "%s %s: Requests:%llu Failed:%llu DMA:%llu Blocks:%llu\n",
+        directionNames[Direction],
+        sizeClassNames[SizeClass],
+        Stats.RequestCount,
+        Stats.FailedRequestCount,
+        Stats.DmaRequestCount,
+        Stats.BlockCount);
+
+    for (ULONG latency = 0; latency < RpiSdhcLatencyCount; ++latency) {
+        printf(
+            "  %-9s Avg:%lluus Max:%lluus\n   ",
+            latencyNames[latency],
+            Stats.TotalTimeUs[latency] / Stats.RequestCount,
+            Stats.MaxTimeUs[latency]);
+
+        for (ULONG bucket = 0; bucket < RPISDHC_HISTOGRAM_BUCKETS; ++bucket) {
+            if (Stats.Histogram[latency][bucket]) {
+                printf(
+                    " [%lu,%lu):%llu",
+                    (bucket ? (1ul << (bucket - 1)) : 0ul),
+                    (1ul << bucket),
+                    Stats.Histogram[latency][bucket]);
+            } // if
+        } // for (bucket)
+
+        printf("\n");
+    } // for (latency)
+} // printTransferStats (...)
+
+} // namespace "static"
+
+int __cdecl wmain (
+    int ArgC,
+    wchar_t* ArgV[]
+    )
+{
+    bool reset = false;
+    if (ArgC == 2 && (_wcsicmp(ArgV[1], L"-reset") == 0)) {
+        reset = true;
+    } else if (ArgC != 1) {
+        printUsage();
+        return 1;
+    } // iff
+
+    HANDLE deviceHandle = CreateFileW(
+        RPISDHC_STATS_USERMODE_PATH,
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (deviceHandle == INVALID_HANDLE_VALUE) {
+        wprintf(
+            L"Failed to open %s. (GetLastError() = %lu)\n",
+            RPISDHC_STATS_USERMODE_PATH,
+            GetLastError());
+        return 1;
+    } // if
+
+    RPISDHC_STATISTICS stats;
+    DWORD bytesReturned;
+    if (!DeviceIoControl(
+            deviceHandle,
+            IOCTL_RPISDHC_GET_STATISTICS,
+            nullptr,
+            0,
+            &stats,
+            sizeof(stats),
+            &bytesReturned,
+            nullptr)) {
+        wprintf(
+            L"IOCTL_RPISDHC_GET_STATISTICS failed. (GetLastError() = %lu)\n",
+            GetLastError());
+        CloseHandle(deviceHandle);
+        return 1;
+    } // if
+
+    if ((bytesReturned < sizeof(stats)) ||
+        (stats.Version != RPISDHC_STATISTICS_VERSION)) {
+        wprintf(
+            L"Unexpected statistics layout. (Version = %lu, Size = %lu)\n",
+            stats.Version,
+            stats.Size);
+        CloseHandle(deviceHandle);
+        return 1;
+    } // if
+
+    printf(
+        "Elapsed:%llums, #Long Fsm Waits:%llu %lluus, #4K Writes:%llu\n",
+        stats.ElapsedTimeUs / 1000,
+        stats.LongFsmStateWaitCount,
+        stats.TotalLongFsmStateWaitTimeUs,
+        stats.PageSized4KWritesCount);
+
+    for (ULONG direction = 0; direction < RpiSdhcDirectionCount; ++direction) {
+        for (ULONG sizeClass = 0; sizeClass < RpiSdhcSizeClassCount; ++sizeClass) {
+            const RPISDHC_TRANSFER_STATISTICS& transferStats =
+                stats.Transfers[direction][sizeClass];
+            if (transferStats.RequestCount) {
+                printTransferStats(
+                    RPISDHC_DIRECTION(direction),
+                    RPISDHC_SIZE_CLASS(sizeClass),
+                    transferStats);
+            } // if
+        } // for (sizeClass)
+    } // for (direction)
+
+    if (reset) {
+        if (!DeviceIoControl(
+                deviceHandle,
+                IOCTL_RPISDHC_RESET_STATISTICS,
+                nullptr,
+                0,
+                nullptr,
+                0,
+                &bytesReturned,
+                nullptr)) {
+            wprintf(
+                L"IOCTL_RPISDHC_RESET_STATISTICS failed. (GetLastError() = %lu)\n",
+                GetLastError());
+            CloseHandle(deviceHandle);
+            return 1;
+        } // if
+
+        printf("Statistics reset\n");
+    } // if
+
+    CloseHandle(deviceHandle);
+    return 0;
+} // wmain (...)
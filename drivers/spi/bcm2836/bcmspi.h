@@ -87,6 +87,7 @@ BCM_SPI_REGISTERS, *PBCM_SPI_REGISTERS;
 
 // from BCM2835 ARM peripherals 10.6.2
 #define BCM_SPI_FIFO_BYTE_SIZE              16
+#define BCM_SPI_FIFO_RXR_BYTE_COUNT         ((BCM_SPI_FIFO_BYTE_SIZE * 3) / 4)
 #define BCM_SPI_DATA_BIT_LENGTH_SUPPORTED   8
 #define BCM_SPI_CS_SUPPORTED                3
 
@@ -132,9 +133,120 @@ BCM_SPI_REGISTERS, *PBCM_SPI_REGISTERS;
 #define BCM_SPI_REG_DC_TDREQ            0x000000ff
 #define BCM_SPI_REG_DC_TDREQ_SET(v)     ((v) & BCM_SPI_REG_DC_TDREQ)
 
+// DREQ and panic thresholds used in DMA mode
+#define BCM_SPI_REG_DC_DEFAULT          \
+    (BCM_SPI_REG_DC_RPANIC_SET(0x30) |  \
+     BCM_SPI_REG_DC_RDREQ_SET(0x20) |   \
+     BCM_SPI_REG_DC_TPANIC_SET(0x10) |  \
+     BCM_SPI_REG_DC_TDREQ_SET(0x20))
+
 // Number of clocks it takes the SPI HW to clock 1 byte
 // The SPI HW waits an extra clock after each byte transfered
 #define BCM_SPI_SCLK_TICKS_PER_BYTE 9
 
+//
+// DMA transfer mode.
+//
+// The TX and RX FIFOs are moved by two channels of the SoC DMA controller,
+// paced by the SPI TX and RX DREQs. The DMA controller is not coherent with
+// the ARM caches and only reaches the first GB of RAM, so data is staged in
+// noncached bounce buffers. DLEN limits a DMA transfer to 64KB, longer
+// transfers are split without deasserting chip select.
+//
+
+// BCM2836 peripherals layout, used to locate the DMA channel registers
+// relative to the SPI registers and to translate addresses for the DMA engine
+#define BCM_SPI_PERIPHERAL_OFFSET       0x00204000
+#define BCM_DMA_PERIPHERAL_OFFSET       0x00007000
+#define BCM_DMA_CHANNEL_REGISTERS_SIZE  0x100
+#define BCM_PERIPHERALS_BUS_BASE        0x7E000000
+#define BCM_UNCACHED_MEMORY_BUS_BASE    0xC0000000
+#define BCM_DMA_MAX_ADDRESS             0x3FFFFFFF
+
+// The DMA channels of SPI0 are assigned by two ACPI FixedDMA resources,
+// the first one feeds the Tx FIFO and the second one drains the Rx FIFO.
+// Channels 0 to 14 are in the DMA register block, channel 15 is not.
+#define BCM_DMA_CHANNEL_COUNT           15
+
+// DREQ peripheral numbers of SPI0
+#define BCM_SPI_DMA_DREQ_TX             6
+#define BCM_SPI_DMA_DREQ_RX             7
+
+// largest DMA transfer, bounded by DLEN, kept word aligned
+#define BCM_SPI_DMA_MAX_TRANSFER_LENGTH 0xfffc
+
+// default smallest transfer moved by DMA, shorter ones are moved by PIO
+#define BCM_SPI_DMA_THRESHOLD_DEFAULT   64
+
+// define DMA channel register map
+
+typedef struct BCM_DMA_REGISTERS
+{
+    __declspec(align(4)) ULONG CS;        // Control and Status
+    __declspec(align(4)) ULONG CONBLK_AD; // Control Block Address
+    __declspec(align(4)) ULONG TI;        // CB Word 0 (Transfer Information)
+    __declspec(align(4)) ULONG SOURCE_AD; // CB Word 1 (Source Address)
+    __declspec(align(4)) ULONG DEST_AD;   // CB Word 2 (Destination Address)
+    __declspec(align(4)) ULONG TXFR_LEN;  // CB Word 3 (Transfer Length)
+    __declspec(align(4)) ULONG STRIDE;    // CB Word 4 (2D Stride)
+    __declspec(align(4)) ULONG NEXTCONBK; // CB Word 5 (Next CB Address)
+    __declspec(align(4)) ULONG DEBUG;     // Debug
+}
+BCM_DMA_REGISTERS, *PBCM_DMA_REGISTERS;
+
+// DMA control block, has to be 256 bit aligned
+
+typedef struct BCM_DMA_CB
+{
+    __declspec(align(32)) ULONG TI;
+    ULONG SOURCE_AD;
+    ULONG DEST_AD;
+    ULONG TXFR_LEN;
+    ULONG STRIDE;
+    ULONG NEXTCONBK;
+    ULONG Reserved[2];
+}
+BCM_DMA_CB, *PBCM_DMA_CB;
+
+//
+// DMA CS register bits.
+//
+
+#define BCM_DMA_REG_CS_RESET            0x80000000
+#define BCM_DMA_REG_CS_ABORT            0x40000000
+#define BCM_DMA_REG_CS_WAIT_FOR_WRITES  0x10000000
+#define BCM_DMA_REG_CS_PANIC_PRIORITY_SET(v) (((v) << 20) & 0x00f00000)
+#define BCM_DMA_REG_CS_PRIORITY_SET(v)  (((v) << 16) & 0x000f0000)
+#define BCM_DMA_REG_CS_ERROR            0x00000100
+#define BCM_DMA_REG_CS_INT              0x00000004
+#define BCM_DMA_REG_CS_END              0x00000002
+#define BCM_DMA_REG_CS_ACTIVE           0x00000001
+
+#define BCM_DMA_REG_CS_START            \
+    (BCM_DMA_REG_CS_WAIT_FOR_WRITES |   \
+     BCM_DMA_REG_CS_PANIC_PRIORITY_SET(0xf) | \
+     BCM_DMA_REG_CS_PRIORITY_SET(0x8) | \
+     BCM_DMA_REG_CS_INT |               \
+     BCM_DMA_REG_CS_END |               \
+     BCM_DMA_REG_CS_ACTIVE)
+
+//
+// DMA TI bits.
+//
+
+#define BCM_DMA_TI_PERMAP_SET(v)        (((v) << 16) & 0x001f0000)
+#define BCM_DMA_TI_SRC_DREQ             0x00000400
+#define BCM_DMA_TI_SRC_INC              0x00000100
+#define BCM_DMA_TI_DEST_IGNORE          0x00000080
+#define BCM_DMA_TI_DEST_DREQ            0x00000040
+#define BCM_DMA_TI_DEST_INC             0x00000010
+#define BCM_DMA_TI_WAIT_RESP            0x00000008
+
+//
+// DMA DEBUG register bits.
+//
+
+#define BCM_DMA_REG_DEBUG_ERRORS        0x00000007
+
 #endif
 
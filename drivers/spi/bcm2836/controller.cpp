@@ -104,6 +104,7 @@ ControllerInitialize(
     pDevice->SPI_CS_COPY = BCM_SPI_REG_CS_POLL_DEFAULT;
     pDevice->CurrentConnectionSpeed = BCM_SPI_REG_CLK_DEFAULT;
     WRITE_REGISTER_ULONG(&pDevice->pSPIRegisters->CS, pDevice->SPI_CS_COPY);
+    WRITE_REGISTER_ULONG(&pDevice->pSPIRegisters->DC, BCM_SPI_REG_DC_DEFAULT);
     ControllerConfigClock(pDevice, BCM_SPI_REG_CLK_DEFAULT);
 
     FuncExit(TRACE_FLAG_PBCLOADING);
@@ -140,9 +141,251 @@ ControllerUninitialize(
     FuncExit(TRACE_FLAG_PBCLOADING);
 }
 
+inline void
+ControllerStopDma(
+    _In_ PPBC_DEVICE pDevice
+    )
+/*++
+
+    Routine Description:
+
+        This routine aborts the SPI DMA channels and clears their status.
+
+    Arguments:
+
+        pDevice - a pointer to the PBC device context
+
+    Return Value:
+
+        None.
+
+--*/
+{
+    PBCM_DMA_REGISTERS channels[] = { pDevice->pDmaTxRegisters, pDevice->pDmaRxRegisters };
+
+    for (ULONG i = 0; i < ARRAYSIZE(channels); i++)
+    {
+        WRITE_REGISTER_ULONG(&channels[i]->CS, BCM_DMA_REG_CS_RESET);
+        WRITE_REGISTER_ULONG(&channels[i]->CS, BCM_DMA_REG_CS_INT | BCM_DMA_REG_CS_END);
+        WRITE_REGISTER_ULONG(&channels[i]->DEBUG, BCM_DMA_REG_DEBUG_ERRORS);
+    }
+}
+
 _Use_decl_annotations_
 NTSTATUS
-ControllerDoOneTransferPollMode(
+ControllerInitializeDma(
+    PPBC_DEVICE pDevice
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine maps the DMA channels assigned to the SPI controller
+    and allocates the control blocks and bounce buffers for DMA transfers.
+    On failure DMA is not available and all transfers are moved by PIO.
+
+  Arguments:
+
+    pDevice - a pointer to the PBC device context
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    FuncEntry(TRACE_FLAG_PBCLOADING);
+
+    NT_ASSERT(pDevice->pSPIRegisters != NULL);
+    NT_ASSERT(pDevice->pDmaCb == NULL);
+
+    NTSTATUS status = STATUS_SUCCESS;
+    PHYSICAL_ADDRESS lowAddress = { 0 };
+    PHYSICAL_ADDRESS highAddress = { 0 };
+    PHYSICAL_ADDRESS boundaryAddress = { 0 };
+
+    //
+    // The DMA controller is in the same peripherals window as the
+    // SPI controller, locate the channel registers relative to it
+    //
+
+    PHYSICAL_ADDRESS dmaPhysicalAddress;
+    dmaPhysicalAddress.QuadPart =
+        pDevice->pSPIRegistersPhysicalAddress.QuadPart -
+        BCM_SPI_PERIPHERAL_OFFSET +
+        BCM_DMA_PERIPHERAL_OFFSET;
+
+    PHYSICAL_ADDRESS channelPhysicalAddress;
+    channelPhysicalAddress.QuadPart = dmaPhysicalAddress.QuadPart + 
+        (pDevice->DmaTxChannel * BCM_DMA_CHANNEL_REGISTERS_SIZE);
+    pDevice->pDmaTxRegisters = (PBCM_DMA_REGISTERS)MmMapIoSpaceEx(
+        channelPhysicalAddress,
+        BCM_DMA_CHANNEL_REGISTERS_SIZE,
+        PAGE_READWRITE | PAGE_NOCACHE);
+
+    channelPhysicalAddress.QuadPart = dmaPhysicalAddress.QuadPart + 
+        (pDevice->DmaRxChannel * BCM_DMA_CHANNEL_REGISTERS_SIZE);
+    pDevice->pDmaRxRegisters = (PBCM_DMA_REGISTERS)MmMapIoSpaceEx(
+        channelPhysicalAddress,
+        BCM_DMA_CHANNEL_REGISTERS_SIZE,
+        PAGE_READWRITE | PAGE_NOCACHE);
+
+    if ((pDevice->pDmaTxRegisters == NULL) || (pDevice->pDmaRxRegisters == NULL))
+    {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_PBCLOADING,
+            "Error mapping DMA channel registers (PA:%I64x) for WDFDEVICE %p - %!STATUS!",
+            dmaPhysicalAddress.QuadPart,
+            pDevice->FxDevice,
+            status);
+        goto exit;
+    }
+
+    //
+    // The DMA engine only reaches the first GB of RAM and is not
+    // coherent with the ARM caches
+    //
+
+    highAddress.QuadPart = BCM_DMA_MAX_ADDRESS;
+
+    pDevice->pDmaTxBuffer = (PUCHAR)MmAllocateContiguousNodeMemory(
+        BCM_SPI_DMA_MAX_TRANSFER_LENGTH,
+        lowAddress,
+        highAddress,
+        boundaryAddress,
+        PAGE_READWRITE | PAGE_NOCACHE,
+        MM_ANY_NODE_OK);
+
+    pDevice->pDmaRxBuffer = (PUCHAR)MmAllocateContiguousNodeMemory(
+        BCM_SPI_DMA_MAX_TRANSFER_LENGTH,
+        lowAddress,
+        highAddress,
+        boundaryAddress,
+        PAGE_READWRITE | PAGE_NOCACHE,
+        MM_ANY_NODE_OK);
+
+    pDevice->pDmaCb = (PBCM_DMA_CB)MmAllocateContiguousNodeMemory(
+        PAGE_SIZE,
+        lowAddress,
+        highAddress,
+        boundaryAddress,
+        PAGE_READWRITE | PAGE_NOCACHE,
+        MM_ANY_NODE_OK);
+
+    if ((pDevice->pDmaTxBuffer == NULL) ||
+        (pDevice->pDmaRxBuffer == NULL) ||
+        (pDevice->pDmaCb == NULL))
+    {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_PBCLOADING,
+            "Error allocating DMA buffers for WDFDEVICE %p - %!STATUS!",
+            pDevice->FxDevice,
+            status);
+        goto exit;
+    }
+
+    //
+    // Memory is accessed by the DMA engine through the uncached bus alias
+    //
+
+    pDevice->DmaTxBufferBusAddress = 
+        MmGetPhysicalAddress(pDevice->pDmaTxBuffer).LowPart | BCM_UNCACHED_MEMORY_BUS_BASE;
+    pDevice->DmaRxBufferBusAddress = 
+        MmGetPhysicalAddress(pDevice->pDmaRxBuffer).LowPart | BCM_UNCACHED_MEMORY_BUS_BASE;
+    pDevice->DmaCbBusAddress = 
+        MmGetPhysicalAddress(pDevice->pDmaCb).LowPart | BCM_UNCACHED_MEMORY_BUS_BASE;
+
+    ControllerStopDma(pDevice);
+
+    Trace(
+        TRACE_LEVEL_INFORMATION,
+        TRACE_FLAG_PBCLOADING,
+        "DMA transfers enabled on channels %u/%u for transfers of %lu bytes and more (WDFDEVICE %p)",
+        pDevice->DmaTxChannel,
+        pDevice->DmaRxChannel,
+        pDevice->DmaThresholdBytes,
+        pDevice->FxDevice);
+
+exit:
+
+    if (!NT_SUCCESS(status))
+    {
+        ControllerReleaseDma(pDevice);
+    }
+
+    FuncExit(TRACE_FLAG_PBCLOADING);
+
+    return status;
+}
+
+_Use_decl_annotations_
+VOID
+ControllerReleaseDma(
+    PPBC_DEVICE pDevice
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine stops the SPI DMA channels and frees the DMA resources.
+
+  Arguments:
+
+    pDevice - a pointer to the PBC device context
+
+  Return Value:
+
+    None.
+
+--*/
+{
+    FuncEntry(TRACE_FLAG_PBCLOADING);
+
+    if ((pDevice->pDmaTxRegisters != NULL) && (pDevice->pDmaRxRegisters != NULL))
+    {
+        ControllerStopDma(pDevice);
+    }
+
+    if (pDevice->pDmaTxRegisters != NULL)
+    {
+        MmUnmapIoSpace(pDevice->pDmaTxRegisters, BCM_DMA_CHANNEL_REGISTERS_SIZE);
+        pDevice->pDmaTxRegisters = NULL;
+    }
+
+    if (pDevice->pDmaRxRegisters != NULL)
+    {
+        MmUnmapIoSpace(pDevice->pDmaRxRegisters, BCM_DMA_CHANNEL_REGISTERS_SIZE);
+        pDevice->pDmaRxRegisters = NULL;
+    }
+
+    if (pDevice->pDmaCb != NULL)
+    {
+        MmFreeContiguousMemory(pDevice->pDmaCb);
+        pDevice->pDmaCb = NULL;
+    }
+
+    if (pDevice->pDmaTxBuffer != NULL)
+    {
+        MmFreeContiguousMemory(pDevice->pDmaTxBuffer);
+        pDevice->pDmaTxBuffer = NULL;
+    }
+
+    if (pDevice->pDmaRxBuffer != NULL)
+    {
+        MmFreeContiguousMemory(pDevice->pDmaRxBuffer);
+        pDevice->pDmaRxBuffer = NULL;
+    }
+
+    FuncExit(TRACE_FLAG_PBCLOADING);
+}
+
+_Use_decl_annotations_
+NTSTATUS
+ControllerDoOneTransfer(
     PPBC_DEVICE pDevice,
     PPBC_REQUEST pRequest
     )
@@ -150,7 +393,10 @@ ControllerDoOneTransferPollMode(
  
   Routine Description:
 
-    This routine transfers data to or from the device in polling mode.
+    This routine applies the transfer delay and moves the data of
+    the current transfer in the transfer mode of the request. 
+    Interrupt mode transfers of at least DmaThresholdBytes are 
+    moved by DMA.
 
   Arguments:
 
@@ -159,14 +405,10 @@ ControllerDoOneTransferPollMode(
 
   Return Value:
 
-    None.
+    Status
 
 --*/
 {
-    FuncEntry(TRACE_FLAG_TRANSFER);
-
-    size_t bytesToWrite = 0;
-    size_t bytesToRead = 0;
     NTSTATUS status = STATUS_SUCCESS;
 
     if (pRequest->CurrentTransferDelayInUs > 0)
@@ -174,10 +416,337 @@ ControllerDoOneTransferPollMode(
         status = ControllerDelayTransfer(pDevice, pRequest);
         if (!NT_SUCCESS(status))
         {
-            goto exit;
+            return status;
         }
     }
 
+    size_t transferByteLength = max(
+        pRequest->CurrentTransferWriteLength,
+        pRequest->CurrentTransferReadLength);
+
+    if (pRequest->TransferMode == PbcTransferModePoll)
+    {
+        status = ControllerDoOneTransferPollMode(pDevice, pRequest);
+    }
+    else if ((pDevice->pDmaCb != NULL) &&
+             (pDevice->DmaThresholdBytes > 0) &&
+             (transferByteLength >= pDevice->DmaThresholdBytes))
+    {
+        status = ControllerDoOneTransferDmaMode(pDevice, pRequest);
+    }
+    else
+    {
+        status = ControllerDoOneTransferInterruptMode(pDevice, pRequest);
+    }
+
+    return status;
+}
+
+inline NTSTATUS
+ControllerWriteFifo(
+    _In_ PPBC_DEVICE pDevice,
+    _Inout_ PMDL_CURSOR pCursor,
+    _Inout_ size_t* pBytesToWrite,
+    _In_ size_t Count
+    )
+/*++
+
+    Routine Description:
+
+        This routine writes bytes from the write buffer to the Tx Fifo,
+        and zeros once the write buffer is exhausted. The caller makes
+        sure the Tx Fifo has room for all bytes.
+
+    Arguments:
+
+        pDevice - a pointer to the PBC device context
+        pCursor - cursor on the next byte of the write buffer
+        pBytesToWrite - bytes left in the write buffer
+        Count - number of bytes to write to the Tx Fifo
+
+    Return Value:
+
+        Status
+
+--*/
+{
+    PUCHAR pSpan;
+    size_t spanLength;
+    NTSTATUS status;
+
+    while ((Count > 0) && (*pBytesToWrite > 0))
+    {
+        status = MdlCursorGetSpan(pCursor, &pSpan, &spanLength);
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+
+        spanLength = min(spanLength, min(Count, *pBytesToWrite));
+        for (size_t i = 0; i < spanLength; ++i)
+        {
+            WRITE_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO, pSpan[i]);
+        }
+
+        MdlCursorAdvance(pCursor, spanLength);
+        *pBytesToWrite -= spanLength;
+        Count -= spanLength;
+    }
+
+    for (; Count > 0; --Count)
+    {
+        WRITE_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO, 0);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+inline NTSTATUS
+ControllerReadFifo(
+    _In_ PPBC_DEVICE pDevice,
+    _Inout_ PMDL_CURSOR pCursor,
+    _Inout_ size_t* pBytesToRead,
+    _In_ size_t Count
+    )
+/*++
+
+    Routine Description:
+
+        This routine reads bytes from the Rx Fifo to the read buffer,
+        and discards them once the read buffer is full. The caller makes
+        sure the Rx Fifo holds at least Count bytes.
+
+    Arguments:
+
+        pDevice - a pointer to the PBC device context
+        pCursor - cursor on the next byte of the read buffer
+        pBytesToRead - bytes left in the read buffer
+        Count - number of bytes to read from the Rx Fifo
+
+    Return Value:
+
+        Status
+
+--*/
+{
+    PUCHAR pSpan;
+    size_t spanLength;
+    NTSTATUS status;
+
+    while ((Count > 0) && (*pBytesToRead > 0))
+    {
+        status = MdlCursorGetSpan(pCursor, &pSpan, &spanLength);
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+
+        spanLength = min(spanLength, min(Count, *pBytesToRead));
+        for (size_t i = 0; i < spanLength; ++i)
+        {
+            pSpan[i] = (UCHAR)READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO);
+        }
+
+        MdlCursorAdvance(pCursor, spanLength);
+        *pBytesToRead -= spanLength;
+        Count -= spanLength;
+    }
+
+    for (; Count > 0; --Count)
+    {
+        (void)READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+inline void
+ControllerInitializeFifoTransfer(
+    _In_ PPBC_REQUEST pRequest,
+    _In_ size_t BytesToWrite,
+    _In_ size_t BytesToRead,
+    _Out_ PPBC_FIFO_TRANSFER pFifo
+    )
+/*++
+
+    Routine Description:
+
+        This routine sets up the FIFO state of a PIO transfer.
+
+    Arguments:
+
+        pRequest - a pointer to the PBC request context
+        BytesToWrite - number of bytes in the write buffer
+        BytesToRead - number of bytes in the read buffer
+        pFifo - the FIFO state
+
+    Return Value:
+
+        None.
+
+--*/
+{
+    MdlCursorInitialize(&pFifo->WriteCursor, pRequest->pCurrentTransferWriteMdlChain);
+    MdlCursorInitialize(&pFifo->ReadCursor, pRequest->pCurrentTransferReadMdlChain);
+
+    pFifo->BytesToWrite = BytesToWrite;
+    pFifo->BytesToRead = BytesToRead;
+    pFifo->BytesToTransmit = max(BytesToWrite, BytesToRead);
+    pFifo->BytesToReceive = pFifo->BytesToTransmit;
+    pFifo->BytesInFlight = 0;
+}
+
+inline NTSTATUS
+ControllerServiceFifos(
+    _In_ PPBC_DEVICE pDevice,
+    _Inout_opt_ PPBC_FIFO_TRANSFER pPrevious,
+    _Inout_ PPBC_FIFO_TRANSFER pFifo,
+    _In_ ULONG CS,
+    _In_ size_t MaxBytesInFlight
+    )
+/*++
+
+    Routine Description:
+
+        This routine drains the Rx Fifo and refills the Tx Fifo
+        as far as a single read of the CS register allows.
+
+        Every byte written to the Tx Fifo is either still in the Tx Fifo,
+        on the wire or in the Rx Fifo. Keeping at most a Fifo worth of bytes
+        in flight, the Tx Fifo never overflows and the Rx Fifo never blocks
+        the transfer, so runs of bytes can be moved without polling CS.
+
+    Arguments:
+
+        pDevice - a pointer to the PBC device context
+        pPrevious - optional FIFO state of a chained transfer that has
+            bytes in flight, they are received before those of pFifo
+        pFifo - the FIFO state
+        CS - value of the CS register
+        MaxBytesInFlight - limit of bytes in flight after the refill
+
+    Return Value:
+
+        Status
+
+--*/
+{
+    NT_ASSERT(MaxBytesInFlight <= BCM_SPI_FIFO_BYTE_SIZE);
+    NT_ASSERT((pPrevious == NULL) || (pPrevious->BytesToTransmit == 0));
+
+    NTSTATUS status;
+    size_t bytesInFlight = pFifo->BytesInFlight;
+    size_t fifoByteCount;
+    size_t previousByteCount;
+
+    if (pPrevious != NULL)
+    {
+        bytesInFlight += pPrevious->BytesInFlight;
+    }
+
+    //
+    // Drain the Rx Fifo. DONE means every byte in flight has been
+    // received, RXR a 3/4 full Rx Fifo and RXD at least one byte
+    //
+
+    if (CS & BCM_SPI_REG_CS_DONE)
+    {
+        fifoByteCount = bytesInFlight;
+    }
+    else if (CS & BCM_SPI_REG_CS_RXR)
+    {
+        fifoByteCount = min(bytesInFlight, BCM_SPI_FIFO_RXR_BYTE_COUNT);
+    }
+    else if (CS & BCM_SPI_REG_CS_RXD)
+    {
+        fifoByteCount = min(bytesInFlight, size_t(1));
+    }
+    else
+    {
+        fifoByteCount = 0;
+    }
+
+    bytesInFlight -= fifoByteCount;
+
+    if ((pPrevious != NULL) && (fifoByteCount > 0))
+    {
+        previousByteCount = min(pPrevious->BytesInFlight, fifoByteCount);
+
+        status = ControllerReadFifo(pDevice, &pPrevious->ReadCursor, &pPrevious->BytesToRead, previousByteCount);
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+
+        pPrevious->BytesInFlight -= previousByteCount;
+        pPrevious->BytesToReceive -= previousByteCount;
+        fifoByteCount -= previousByteCount;
+    }
+
+    if (fifoByteCount > 0)
+    {
+        status = ControllerReadFifo(pDevice, &pFifo->ReadCursor, &pFifo->BytesToRead, fifoByteCount);
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+
+        pFifo->BytesInFlight -= fifoByteCount;
+        pFifo->BytesToReceive -= fifoByteCount;
+    }
+
+    //
+    // Refill the Tx Fifo
+    //
+
+    if ((CS & BCM_SPI_REG_CS_TXD) && 
+        (pFifo->BytesToTransmit > 0) &&
+        (bytesInFlight < MaxBytesInFlight))
+    {
+        fifoByteCount = min(MaxBytesInFlight - bytesInFlight, pFifo->BytesToTransmit);
+
+        status = ControllerWriteFifo(pDevice, &pFifo->WriteCursor, &pFifo->BytesToWrite, fifoByteCount);
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+
+        pFifo->BytesInFlight += fifoByteCount;
+        pFifo->BytesToTransmit -= fifoByteCount;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+ControllerDoOneTransferPollMode(
+    PPBC_DEVICE pDevice,
+    PPBC_REQUEST pRequest
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine transfers data to or from the device in polling mode.
+
+  Arguments:
+
+    pDevice - a pointer to the PBC device context
+    pRequest - a pointer to the PBC request context
+
+  Return Value:
+
+    None.
+
+--*/
+{
+    FuncEntry(TRACE_FLAG_TRANSFER);
+
+    size_t bytesToWrite = 0;
+    size_t bytesToRead = 0;
+    NTSTATUS status = STATUS_SUCCESS;
+
     if (pRequest->CurrentTransferDirection == SpbTransferDirectionToDevice)
     {
         //
@@ -228,27 +797,321 @@ ControllerDoOneTransferPollMode(
             pDevice->pCurrentTarget->Settings.DeviceSelection);
     }
 
-    size_t readByteIndex = 0;
-    size_t writeByteIndex = 0;
-    size_t transferByteLength = max(bytesToWrite, bytesToRead);
-    size_t zeroBytesToWrite = transferByteLength - bytesToWrite;
-    size_t readBytesToDiscard = transferByteLength - bytesToRead;
-    UCHAR nextByte;
-    ULONG CS;
-
-    NT_ASSERT(
-        (bytesToWrite + zeroBytesToWrite + bytesToRead + readBytesToDiscard) == 
-        (transferByteLength * 2));
+    PBC_FIFO_TRANSFER fifo;
+    ControllerInitializeFifoTransfer(pRequest, bytesToWrite, bytesToRead, &fifo);
 
 #ifdef DBG
     ULONGLONG numPolls = 0;
 #endif
 
+    //
+    // Bytes of a chained previous transfer still in flight
+    // come out of the Rx FIFO before the bytes of this one
+    //
+
+    PPBC_FIFO_TRANSFER pPrevious = NULL;
+
+    if (pRequest->ChainedFifoPending)
+    {
+        pPrevious = &pRequest->ChainedFifo;
+    }
+
     // As long as there are bytes to transfer and request has not been canceled
-    while ((bytesToWrite > 0) ||
-           (zeroBytesToWrite > 0) ||
-           (bytesToRead > 0) ||
-           (readBytesToDiscard > 0))
+    while ((fifo.BytesToReceive > 0) || (pPrevious != NULL))
+    {
+        //
+        // Once all bytes are queued, a chained next transfer 
+        // takes over the bytes in flight
+        //
+
+        if (pRequest->ChainNextTransfer &&
+            (pPrevious == NULL) &&
+            (fifo.BytesToTransmit == 0))
+        {
+            break;
+        }
+
+        if (WdfRequestIsCanceled(pRequest->SpbRequest))
+        {
+            status = STATUS_CANCELLED;
+
+            Trace(
+                TRACE_LEVEL_INFORMATION,
+                TRACE_FLAG_TRANSFER,
+                "Terminating transfer due to request cancelled SPBREQUEST %p",
+                pRequest->SpbRequest);
+
+            break;
+        }
+
+        status = ControllerServiceFifos(
+            pDevice,
+            pPrevious,
+            &fifo,
+            READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->CS),
+            BCM_SPI_FIFO_BYTE_SIZE);
+        if (!NT_SUCCESS(status))
+        {
+            NT_ASSERTMSG("MDL size must match request set buffer length", false);
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if ((pPrevious != NULL) && (pPrevious->BytesToReceive == 0))
+        {
+            pPrevious = NULL;
+            pRequest->ChainedFifoPending = FALSE;
+        }
+
+    #ifdef DBG
+        ++numPolls;
+    #endif
+    }
+
+    if (NT_SUCCESS(status) && (fifo.BytesToReceive > 0))
+    {
+        //
+        // Chained, the next transfer receives the remaining bytes. 
+        // They are accounted to this transfer now, and taken back
+        // if the next transfer fails to receive them.
+        //
+
+        pRequest->ChainedFifo = fifo;
+        pRequest->ChainedFifoPending = TRUE;
+
+        pRequest->CurrentTransferInformation = bytesToRead + bytesToWrite;
+    }
+    else
+    {
+        ControllerFlushFifos(pDevice);
+
+        if (pPrevious != NULL)
+        {
+            NT_ASSERT(pRequest->TotalInformation >= pPrevious->BytesToRead);
+            pRequest->TotalInformation -= pPrevious->BytesToRead;
+            pRequest->ChainedFifoPending = FALSE;
+        }
+
+        pRequest->CurrentTransferInformation =
+            (bytesToRead - fifo.BytesToRead) +
+            (bytesToWrite - fifo.BytesToWrite);
+    }
+
+#ifdef DBG
+    Trace(
+        TRACE_LEVEL_INFORMATION,
+        TRACE_FLAG_TRANSFER,
+        "Polled %I64u time(s) to transfer %Iu byte(s)",
+        numPolls,
+        pRequest->CurrentTransferInformation);
+#endif
+
+    FuncExit(TRACE_FLAG_TRANSFER);
+    
+    return status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+ControllerDoOneTransferInterruptMode(
+    PPBC_DEVICE pDevice,
+    PPBC_REQUEST pRequest
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine transfers data to or from the device in interrupt mode.
+    The interrupt DPC moves up to 3/4 of the FIFO per DONE or RXR
+    interrupt, the calling thread waits for the end of the transfer.
+
+  Arguments:
+
+    pDevice - a pointer to the PBC device context
+    pRequest - a pointer to the PBC request context
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    FuncEntry(TRACE_FLAG_TRANSFER);
+
+    NTSTATUS status;
+    size_t bytesToWrite = pRequest->CurrentTransferWriteLength;
+    size_t bytesToRead = pRequest->CurrentTransferReadLength;
+    size_t transferByteLength = max(bytesToWrite, bytesToRead);
+
+    Trace(
+        TRACE_LEVEL_VERBOSE,
+        TRACE_FLAG_TRANSFER,
+        "Ready to write/read %Iu/%Iu byte(s) in interrupt mode for device 0x%lx",
+        bytesToWrite,
+        bytesToRead,
+        pDevice->pCurrentTarget->Settings.DeviceSelection);
+
+    ControllerInitializeFifoTransfer(pRequest, bytesToWrite, bytesToRead, &pDevice->InterruptFifo);
+    pDevice->InterruptTransferStatus = STATUS_SUCCESS;
+
+    KeClearEvent(&pDevice->TransferDoneEvt);
+
+    //
+    // The Tx FIFO is empty, so enabling INTD raises the first
+    // interrupt right away and the DPC starts filling the FIFO
+    //
+
+    WdfInterruptAcquireLock(pDevice->InterruptObject);
+    pDevice->pInterruptRequest = pRequest;
+    WRITE_REGISTER_ULONG(
+        &pDevice->pSPIRegisters->CS,
+        pDevice->SPI_CS_COPY | BCM_SPI_REG_CS_INTD | BCM_SPI_REG_CS_INTR);
+    WdfInterruptReleaseLock(pDevice->InterruptObject);
+
+    //
+    // Wait for the DPC to finish the transfer, allowing twice the time
+    // on the wire and some scheduling latency
+    //
+
+    ULONGLONG timeoutUs = 
+        (ULONGLONG(transferByteLength) * ULONGLONG(BCM_SPI_SCLK_TICKS_PER_BYTE) * 1000000ull) /
+        ULONGLONG(pDevice->CurrentConnectionSpeed);
+    timeoutUs = timeoutUs * 2 + 10000;
+
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = LONGLONG(WDF_REL_TIMEOUT_IN_US(timeoutUs));
+
+    status = KeWaitForSingleObject(
+        &pDevice->TransferDoneEvt,
+        Executive,
+        KernelMode,
+        FALSE,
+        &timeout);
+
+    if (status == STATUS_TIMEOUT)
+    {
+        //
+        // Stop the DPC from arming the interrupt again and
+        // wait for a DPC that may still be running
+        //
+
+        WdfInterruptAcquireLock(pDevice->InterruptObject);
+        pDevice->pInterruptRequest = NULL;
+        WRITE_REGISTER_ULONG(&pDevice->pSPIRegisters->CS, pDevice->SPI_CS_COPY);
+        WdfInterruptReleaseLock(pDevice->InterruptObject);
+
+        KeFlushQueuedDpcs();
+
+        status = STATUS_IO_TIMEOUT;
+    }
+    else
+    {
+        // the DPC disarmed the interrupt before signalling
+        pDevice->pInterruptRequest = NULL;
+        status = pDevice->InterruptTransferStatus;
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        ControllerFlushFifos(pDevice);
+    }
+    else
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_TRANSFER,
+            "Interrupt mode transfer failed with %Iu byte(s) left, CS 0x%lx (SPBREQUEST %p) - %!STATUS!",
+            pDevice->InterruptFifo.BytesToReceive,
+            READ_REGISTER_ULONG(&pDevice->pSPIRegisters->CS),
+            pRequest->SpbRequest,
+            status);
+
+        WRITE_REGISTER_ULONG(
+            &pDevice->pSPIRegisters->CS,
+            pDevice->SPI_CS_COPY | BCM_SPI_REG_CS_CLEARTX | BCM_SPI_REG_CS_CLEARRX);
+    }
+
+    pRequest->CurrentTransferInformation =
+        (bytesToRead - pDevice->InterruptFifo.BytesToRead) +
+        (bytesToWrite - pDevice->InterruptFifo.BytesToWrite);
+
+    FuncExit(TRACE_FLAG_TRANSFER);
+
+    return status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+ControllerDoOneTransferDmaMode(
+    PPBC_DEVICE pDevice,
+    PPBC_REQUEST pRequest
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine transfers data to or from the device in DMA mode.
+    The TX channel feeds the Tx FIFO from the TX bounce buffer, then
+    enables the DONE interrupt. The RX channel drains the Rx FIFO to the
+    RX bounce buffer, or discards the read bytes of a write transfer.
+    Transfers longer than the DLEN limit are split into several DMA
+    transfers while TA stays set.
+
+  Arguments:
+
+    pDevice - a pointer to the PBC device context
+    pRequest - a pointer to the PBC request context
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    FuncEntry(TRACE_FLAG_TRANSFER);
+
+    NT_ASSERT(pDevice->pDmaCb != NULL);
+
+    NTSTATUS status = STATUS_SUCCESS;
+    size_t bytesToWrite = pRequest->CurrentTransferWriteLength;
+    size_t bytesToRead = pRequest->CurrentTransferReadLength;
+    size_t transferByteLength = max(bytesToWrite, bytesToRead);
+    size_t offset = 0;
+
+    Trace(
+        TRACE_LEVEL_VERBOSE,
+        TRACE_FLAG_TRANSFER,
+        "Ready to DMA write/read %Iu/%Iu byte(s) for device 0x%lx",
+        bytesToWrite,
+        bytesToRead,
+        pDevice->pCurrentTarget->Settings.DeviceSelection);
+
+    const ULONG spiBusAddress = BCM_PERIPHERALS_BUS_BASE + BCM_SPI_PERIPHERAL_OFFSET;
+    const ULONG fifoBusAddress = spiBusAddress + FIELD_OFFSET(BCM_SPI_REGISTERS, FIFO);
+    const ULONG csBusAddress = spiBusAddress + FIELD_OFFSET(BCM_SPI_REGISTERS, CS);
+
+    //
+    // The TX chain is a data control block followed by a control block
+    // writing CS with INTD set, the CS value is stored behind the
+    // control blocks. The RX chain is a single data control block.
+    //
+
+    PBCM_DMA_CB pTxCb = &pDevice->pDmaCb[0];
+    PBCM_DMA_CB pTxCsCb = &pDevice->pDmaCb[1];
+    PBCM_DMA_CB pRxCb = &pDevice->pDmaCb[2];
+    PULONG pCsValue = (PULONG)&pDevice->pDmaCb[3];
+
+    const ULONG txCbBusAddress = pDevice->DmaCbBusAddress;
+    const ULONG txCsCbBusAddress = pDevice->DmaCbBusAddress + 1 * sizeof(BCM_DMA_CB);
+    const ULONG rxCbBusAddress = pDevice->DmaCbBusAddress + 2 * sizeof(BCM_DMA_CB);
+    const ULONG csValueBusAddress = pDevice->DmaCbBusAddress + 3 * sizeof(BCM_DMA_CB);
+
+    MDL_CURSOR writeCursor;
+    MDL_CURSOR readCursor;
+    MdlCursorInitialize(&writeCursor, pRequest->pCurrentTransferWriteMdlChain);
+    MdlCursorInitialize(&readCursor, pRequest->pCurrentTransferReadMdlChain);
+
+    while (offset < transferByteLength)
     {
         if (WdfRequestIsCanceled(pRequest->SpbRequest))
         {
@@ -263,90 +1126,189 @@ ControllerDoOneTransferPollMode(
             break;
         }
 
-        CS = READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->CS);
+        ULONG chunkLength = ULONG(min(transferByteLength - offset, size_t(BCM_SPI_DMA_MAX_TRANSFER_LENGTH)));
+        size_t writeLength = (offset < bytesToWrite) ? min(bytesToWrite - offset, size_t(chunkLength)) : 0;
+        size_t readLength = (offset < bytesToRead) ? min(bytesToRead - offset, size_t(chunkLength)) : 0;
 
-        if (CS & BCM_SPI_REG_CS_TXD)
+        //
+        // Stage write bytes, past the end of the write buffer zeros are sent
+        //
+
+        if (writeLength > 0)
         {
-            // Write bytes to Tx FIFO from client buffer if any left
-            // otherwise fill with zeros
-            if (bytesToWrite)
-            {
-                status = MdlGetByte(
-                    pRequest->pCurrentTransferWriteMdlChain,
-                    writeByteIndex,
-                    pRequest->CurrentTransferWriteLength,
-                    &nextByte);
-                if (!NT_SUCCESS(status))
-                {
-                    NT_ASSERTMSG("MDL size must match request set write buffer length", false);
-                    status = STATUS_INVALID_PARAMETER;
-                    goto exit;
-                }
-
-                WRITE_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO, nextByte);
-                --bytesToWrite;
-                ++writeByteIndex;
-            }
-            else if (zeroBytesToWrite)
+            status = MdlCursorCopyToBuffer(
+                &writeCursor,
+                pDevice->pDmaTxBuffer,
+                writeLength);
+            if (!NT_SUCCESS(status))
             {
-                WRITE_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO, 0);
-                --zeroBytesToWrite;
+                NT_ASSERTMSG("MDL size must match request set write buffer length", false);
+                status = STATUS_INVALID_PARAMETER;
+                break;
             }
         }
 
-        if (CS & BCM_SPI_REG_CS_RXD)
+        if (writeLength < chunkLength)
+        {
+            RtlZeroMemory(pDevice->pDmaTxBuffer + writeLength, chunkLength - writeLength);
+        }
+
+        pTxCb->TI = 
+            BCM_DMA_TI_PERMAP_SET(BCM_SPI_DMA_DREQ_TX) |
+            BCM_DMA_TI_DEST_DREQ |
+            BCM_DMA_TI_SRC_INC |
+            BCM_DMA_TI_WAIT_RESP;
+        pTxCb->SOURCE_AD = pDevice->DmaTxBufferBusAddress;
+        pTxCb->DEST_AD = fifoBusAddress;
+        pTxCb->TXFR_LEN = chunkLength;
+        pTxCb->STRIDE = 0;
+        pTxCb->NEXTCONBK = txCsCbBusAddress;
+
+        pTxCsCb->TI = BCM_DMA_TI_WAIT_RESP;
+        pTxCsCb->SOURCE_AD = csValueBusAddress;
+        pTxCsCb->DEST_AD = csBusAddress;
+        pTxCsCb->TXFR_LEN = sizeof(ULONG);
+        pTxCsCb->STRIDE = 0;
+        pTxCsCb->NEXTCONBK = 0;
+
+        pRxCb->TI = 
+            BCM_DMA_TI_PERMAP_SET(BCM_SPI_DMA_DREQ_RX) |
+            BCM_DMA_TI_SRC_DREQ |
+            BCM_DMA_TI_WAIT_RESP |
+            ((readLength > 0) ? BCM_DMA_TI_DEST_INC : BCM_DMA_TI_DEST_IGNORE);
+        pRxCb->SOURCE_AD = fifoBusAddress;
+        pRxCb->DEST_AD = pDevice->DmaRxBufferBusAddress;
+        pRxCb->TXFR_LEN = chunkLength;
+        pRxCb->STRIDE = 0;
+        pRxCb->NEXTCONBK = 0;
+
+        //
+        // INTD is only set by the TX channel once all data is in the Tx FIFO,
+        // DONE is also set while the FIFO runs empty between DREQs
+        //
+
+        pDevice->SPI_CS_COPY |= BCM_SPI_REG_CS_DMAEN;
+        *pCsValue = pDevice->SPI_CS_COPY | BCM_SPI_REG_CS_INTD;
+
+        KeClearEvent(&pDevice->TransferDoneEvt);
+
+        // control blocks have to be visible in memory before kicking off the DMA engine
+        KeMemoryBarrier();
+
+        WRITE_REGISTER_ULONG(&pDevice->pSPIRegisters->DLEN, BCM_SPI_REG_DLEN_LEN_SET(chunkLength));
+        WRITE_REGISTER_ULONG(&pDevice->pSPIRegisters->CS, pDevice->SPI_CS_COPY);
+
+        WRITE_REGISTER_ULONG(&pDevice->pDmaRxRegisters->CONBLK_AD, rxCbBusAddress);
+        WRITE_REGISTER_ULONG(&pDevice->pDmaRxRegisters->CS, BCM_DMA_REG_CS_START);
+        WRITE_REGISTER_ULONG(&pDevice->pDmaTxRegisters->CONBLK_AD, txCbBusAddress);
+        WRITE_REGISTER_ULONG(&pDevice->pDmaTxRegisters->CS, BCM_DMA_REG_CS_START);
+
+        //
+        // Wait for the DONE interrupt, allowing twice the time
+        // on the wire and some scheduling latency
+        //
+
+        ULONGLONG timeoutUs = 
+            (ULONGLONG(chunkLength) * ULONGLONG(BCM_SPI_SCLK_TICKS_PER_BYTE) * 1000000ull) /
+            ULONGLONG(pDevice->CurrentConnectionSpeed);
+        timeoutUs = timeoutUs * 2 + 10000;
+
+        LARGE_INTEGER timeout;
+        timeout.QuadPart = LONGLONG(WDF_REL_TIMEOUT_IN_US(timeoutUs));
+
+        status = KeWaitForSingleObject(
+            &pDevice->TransferDoneEvt,
+            Executive,
+            KernelMode,
+            FALSE,
+            &timeout);
+
+        if (status == STATUS_TIMEOUT)
         {
-            // Read bvtes from Rx FIFO as long as there is a place in the client 
-            // read buffer, otherwise discard read bytes
-            if (bytesToRead > 0)
+            status = STATUS_IO_TIMEOUT;
+        }
+        else
+        {
+            //
+            // The RX channel drains the last bytes from the Rx FIFO after DONE
+            //
+
+            ULONG drainTimeout = BCM_SPI_FIFO_FLUSH_TIMEOUT_US;
+            while ((drainTimeout > 0) &&
+                   (READ_REGISTER_ULONG(&pDevice->pDmaRxRegisters->CS) & BCM_DMA_REG_CS_ACTIVE))
+            {
+                KeStallExecutionProcessor(1);
+                drainTimeout--;
+            }
+
+            if (drainTimeout == 0)
+            {
+                status = STATUS_IO_TIMEOUT;
+            }
+            else if ((READ_REGISTER_ULONG(&pDevice->pDmaTxRegisters->DEBUG) |
+                      READ_REGISTER_ULONG(&pDevice->pDmaRxRegisters->DEBUG)) & BCM_DMA_REG_DEBUG_ERRORS)
             {
-                nextByte = (UCHAR)READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO);
-                status = MdlSetByte(
-                    pRequest->pCurrentTransferReadMdlChain, 
-                    readByteIndex,
-                    pRequest->CurrentTransferReadLength,
-                    nextByte);
-                if (!NT_SUCCESS(status))
-                {
-                    NT_ASSERTMSG("MDL size must match request set read buffer length", false);
-                    status = STATUS_INVALID_PARAMETER;
-                    goto exit;
-                }
-
-                --bytesToRead;
-                ++readByteIndex;
+                status = STATUS_IO_DEVICE_ERROR;
             }
-            else if (readBytesToDiscard > 0)
+            else
             {
-                (void)READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->FIFO);
-                --readBytesToDiscard;
+                status = STATUS_SUCCESS;
             }
         }
 
-    #ifdef DBG
-        ++numPolls;
-    #endif
-    }
+        pDevice->SPI_CS_COPY &= ~BCM_SPI_REG_CS_DMAEN;
 
-    ControllerFlushFifos(pDevice);
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_FLAG_TRANSFER,
+                "DMA transfer of %lu byte(s) at offset %Iu failed, TX CS 0x%lx RX CS 0x%lx SPI CS 0x%lx (SPBREQUEST %p) - %!STATUS!",
+                chunkLength,
+                offset,
+                READ_REGISTER_ULONG(&pDevice->pDmaTxRegisters->CS),
+                READ_REGISTER_ULONG(&pDevice->pDmaRxRegisters->CS),
+                READ_REGISTER_ULONG(&pDevice->pSPIRegisters->CS),
+                pRequest->SpbRequest,
+                status);
 
-    pRequest->CurrentTransferInformation =
-        (pRequest->CurrentTransferReadLength - bytesToRead) +
-        (pRequest->CurrentTransferWriteLength - bytesToWrite);
+            ControllerStopDma(pDevice);
+            WRITE_REGISTER_ULONG(
+                &pDevice->pSPIRegisters->CS,
+                pDevice->SPI_CS_COPY | BCM_SPI_REG_CS_CLEARTX | BCM_SPI_REG_CS_CLEARRX);
+            break;
+        }
+
+        WRITE_REGISTER_ULONG(&pDevice->pSPIRegisters->CS, pDevice->SPI_CS_COPY);
+
+        if (readLength > 0)
+        {
+            status = MdlCursorCopyFromBuffer(
+                &readCursor,
+                pDevice->pDmaRxBuffer,
+                readLength);
+            if (!NT_SUCCESS(status))
+            {
+                NT_ASSERTMSG("MDL size must match request set read buffer length", false);
+                status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+        }
+
+        offset += chunkLength;
+    }
+
+    pRequest->CurrentTransferInformation = min(offset, bytesToRead) + min(offset, bytesToWrite);
 
-#ifdef DBG
     Trace(
         TRACE_LEVEL_INFORMATION,
         TRACE_FLAG_TRANSFER,
-        "Polled %I64u time(s) to transfer %Iu byte(s)",
-        numPolls,
-        pRequest->CurrentTransferInformation);
-#endif
-
-exit:
+        "DMA transferred %Iu byte(s) (SPBREQUEST %p)",
+        pRequest->CurrentTransferInformation,
+        pRequest->SpbRequest);
 
     FuncExit(TRACE_FLAG_TRANSFER);
-    
+
     return status;
 }
 
@@ -414,6 +1376,20 @@ ControllerCompleteTransfer(
         goto exit;
     }
 
+    //
+    // A chained transfer may not have picked up the
+    // bytes in flight of the previous one
+    //
+
+    if (pRequest->ChainedFifoPending)
+    {
+        ControllerFlushFifos(pDevice);
+
+        NT_ASSERT(pRequest->TotalInformation >= pRequest->ChainedFifo.BytesToRead);
+        pRequest->TotalInformation -= pRequest->ChainedFifo.BytesToRead;
+        pRequest->ChainedFifoPending = FALSE;
+    }
+
     //
     // end the current transfer if this was a single sequence or the last
     //
@@ -524,56 +1500,115 @@ ControllerUnlockTransfer(
 
 _Use_decl_annotations_
 VOID
-ControllerConfigForTargetAndActivate(
-    PPBC_DEVICE pDevice
+ControllerPrepareTargetConfig(
+    PPBC_TARGET pTarget
     )
+/*++
+ 
+  Routine Description:
+
+    This routine computes the controller register image
+    of a target from its connection settings.
+
+  Arguments:
+
+    pTarget - a pointer to the PBC target context
+
+  Return Value:
+
+    None.
+
+--*/
 {
-    FuncEntry(TRACE_FLAG_TRANSFER);
+    FuncEntry(TRACE_FLAG_SPBDDI);
 
-    PPBC_TARGET_SETTINGS pSettings = &pDevice->pCurrentTarget->Settings;
+    PPBC_TARGET_SETTINGS pSettings = &pTarget->Settings;
 
-    if (pDevice->CurrentConnectionSpeed != pSettings->ConnectionSpeed)
-    {
-        pDevice->CurrentConnectionSpeed = pSettings->ConnectionSpeed;
+    // WireMode, only 4 wire supported yet
+    NT_ASSERT((pSettings->TypeSpecificFlags & SPI_WIREMODE_BIT) == 0);
 
-        // set clock
-        ControllerConfigClock(pDevice, pSettings->ConnectionSpeed);
-    }
+    //
+    // Chip select, CPHA, CPOL and the polarity of the own chip select line.
+    // The polarity bits of the other lines are left as they are.
+    //
+
+    ULONG csPolarityBit = BCM_SPI_REG_CS_CSPOL0 << pSettings->DeviceSelection;
+
+    pTarget->CsMask = 
+        BCM_SPI_REG_CS_CS | 
+        BCM_SPI_REG_CS_CPHA | 
+        BCM_SPI_REG_CS_CPOL |
+        BCM_SPI_REG_CS_CSPOL |
+        csPolarityBit;
 
-    // set chip select, CPHA and CPOL
-    pDevice->SPI_CS_COPY &= ~(BCM_SPI_REG_CS_CS | BCM_SPI_REG_CS_CPHA | BCM_SPI_REG_CS_CPOL);
-    pDevice->SPI_CS_COPY |= BCM_SPI_REG_CS_CS_SET(pSettings->DeviceSelection);
+    pTarget->CsImage = BCM_SPI_REG_CS_CS_SET(pSettings->DeviceSelection);
 
     // CPOL
     if (pSettings->Polarity)
     {
-        pDevice->SPI_CS_COPY |= BCM_SPI_REG_CS_CPOL;
+        pTarget->CsImage |= BCM_SPI_REG_CS_CPOL;
     }
 
     // CPHA
     if (pSettings->Phase)
     {
-        pDevice->SPI_CS_COPY |= BCM_SPI_REG_CS_CPHA;
+        pTarget->CsImage |= BCM_SPI_REG_CS_CPHA;
     }
 
-    // WireMode, only 4 wire supported yet
-    NT_ASSERT((pSettings->TypeSpecificFlags & SPI_WIREMODE_BIT) == 0);
-
     // DevicePolarity
-    ULONG csPolarityBit = BCM_SPI_REG_CS_CSPOL0 << pSettings->DeviceSelection;
     if (pSettings->TypeSpecificFlags & SPI_DEVICEPOLARITY_BIT)
     {   // active high
-        pDevice->SPI_CS_COPY |= csPolarityBit | BCM_SPI_REG_CS_CSPOL;
+        pTarget->CsImage |= csPolarityBit | BCM_SPI_REG_CS_CSPOL;
     }
-    else
-    {   // active low
-        pDevice->SPI_CS_COPY &= ~(csPolarityBit | BCM_SPI_REG_CS_CSPOL);
+
+    pTarget->ClockDivider = ControllerClockDivider(pSettings->ConnectionSpeed);
+
+    Trace(
+        TRACE_LEVEL_VERBOSE,
+        TRACE_FLAG_SPBDDI,
+        "Target on CS%hu uses CS 0x%lx (mask 0x%lx) and CDIV=%lu",
+        pSettings->DeviceSelection,
+        pTarget->CsImage,
+        pTarget->CsMask,
+        pTarget->ClockDivider);
+
+    FuncExit(TRACE_FLAG_SPBDDI);
+}
+
+_Use_decl_annotations_
+VOID
+ControllerConfigForTargetAndActivate(
+    PPBC_DEVICE pDevice
+    )
+{
+    FuncEntry(TRACE_FLAG_TRANSFER);
+
+    PPBC_TARGET pTarget = pDevice->pCurrentTarget;
+
+    //
+    // Only program what differs from the target's register image,
+    // back-to-back requests to the same target just set TA
+    //
+
+    pDevice->CurrentConnectionSpeed = pTarget->Settings.ConnectionSpeed;
+
+    if (pDevice->CurrentClockDivider != pTarget->ClockDivider)
+    {
+        // set clock
+        ControllerConfigClock(pDevice, pTarget->Settings.ConnectionSpeed);
+    }
+
+    if ((pDevice->SPI_CS_COPY & pTarget->CsMask) != pTarget->CsImage)
+    {
+        // set chip select, CPHA, CPOL and chip select polarity
+        pDevice->SPI_CS_COPY &= ~pTarget->CsMask;
+        pDevice->SPI_CS_COPY |= pTarget->CsImage;
+
+        // reset Tx/Rx Fifos, they are empty after a transfer to the same target
+        WRITE_REGISTER_ULONG(
+            &pDevice->pSPIRegisters->CS,
+            pDevice->SPI_CS_COPY | BCM_SPI_REG_CS_CLEARTX | BCM_SPI_REG_CS_CLEARRX);
     }
-    
-    // reset Tx/Rx Fifos
-    WRITE_REGISTER_ULONG(
-        &pDevice->pSPIRegisters->CS,
-        pDevice->SPI_CS_COPY | BCM_SPI_REG_CS_CLEARTX | BCM_SPI_REG_CS_CLEARRX);
 
     // start transfer
     ControllerActivateTransfer(pDevice);
@@ -582,7 +1617,7 @@ ControllerConfigForTargetAndActivate(
         TRACE_LEVEL_VERBOSE,
         TRACE_FLAG_TRANSFER,
         "Controller configured for transfers to device on CS%hu (WDFDEVICE %p)",
-        pDevice->pCurrentTarget->Settings.DeviceSelection,
+        pTarget->Settings.DeviceSelection,
         pDevice->FxDevice);
 
     FuncExit(TRACE_FLAG_TRANSFER);
@@ -598,47 +1633,122 @@ ControllerDelayTransfer(
     FuncEntry(TRACE_FLAG_TRANSFER);
 
     NTSTATUS status;
-
-    if (pRequest->CurrentTransferDelayInUs == 0)
+    ULONG delayUs = pRequest->CurrentTransferDelayInUs;
+    bool onTimer = false;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER spinStart;
+    LARGE_INTEGER now;
+    LONGLONG deadline;
+    ULONGLONG measuredUs;
+    ULONGLONG spinUs;
+    PPBC_DELAY_STATISTICS pStats = &pDevice->DelayStatistics;
+
+    if (delayUs == 0)
     {
         status = STATUS_SUCCESS;
         goto exit;
     }
 
-    if (pRequest->CurrentTransferDelayInUs <= 1000)
+    start = KeQueryPerformanceCounter(&frequency);
+    deadline = start.QuadPart + 
+        LONGLONG((ULONGLONG(delayUs) * ULONGLONG(frequency.QuadPart)) / 1000000ull);
+
+    if (delayUs > pDevice->DelaySpinUs)
     {
         //
-        // Achieve high precision delay in us resolution by stalling
+        // Give up the CPU until DelaySpinUs before the deadline
         //
 
-        KeStallExecutionProcessor(pRequest->CurrentTransferDelayInUs);
-        status = STATUS_SUCCESS;
-    }
-    else
-    {
-        LARGE_INTEGER wait = { 0 };
-        wait.QuadPart = LONGLONG(WDF_REL_TIMEOUT_IN_US(ULONGLONG(pRequest->CurrentTransferDelayInUs)));
+        LONGLONG sleep = LONGLONG(WDF_REL_TIMEOUT_IN_US(ULONGLONG(delayUs - pDevice->DelaySpinUs)));
+
+        if (pDevice->pDelayTimer != NULL)
+        {
+            KeClearEvent(&pDevice->DelayTimerEvt);
+
+            (void)ExSetTimer(pDevice->pDelayTimer, sleep, 0, NULL);
+
+            status = KeWaitForSingleObject(
+                &pDevice->DelayTimerEvt,
+                Executive,
+                KernelMode,
+                FALSE,
+                NULL);
+        }
+        else
+        {
+            LARGE_INTEGER wait;
+            wait.QuadPart = sleep;
+
+            (void)ExSetTimerResolution(pDevice->DelayTimerResolution, TRUE);
+
+            status = KeDelayExecutionThread(KernelMode, FALSE, &wait);
+
+            (void)ExSetTimerResolution(0, FALSE);
+        }
 
-        status = KeDelayExecutionThread(KernelMode, FALSE, &wait);
         if (!NT_SUCCESS(status))
         {
             Trace(
                 TRACE_LEVEL_ERROR,
                 TRACE_FLAG_TRANSFER,
                 "Delaying %lu failed for SPBREQUEST %p WDFDEVICE %p - %!STATUS!",
-                pRequest->CurrentTransferDelayInUs,
+                delayUs,
                 pRequest->SpbRequest,
                 pDevice->FxDevice,
                 status);
             goto exit;
         }
+
+        onTimer = true;
+    }
+
+    //
+    // Spin for the rest, the performance counter gives
+    // sub microsecond resolution
+    //
+
+    spinStart = KeQueryPerformanceCounter(NULL);
+    now = spinStart;
+
+    while (now.QuadPart < deadline)
+    {
+        YieldProcessor();
+        now = KeQueryPerformanceCounter(NULL);
+    }
+
+    status = STATUS_SUCCESS;
+
+    //
+    // Update the delay accuracy statistics, only the
+    // transfer thread updates them
+    //
+
+    measuredUs = 
+        (ULONGLONG(now.QuadPart - start.QuadPart) * 1000000ull) / ULONGLONG(frequency.QuadPart);
+    spinUs = 
+        (ULONGLONG(now.QuadPart - spinStart.QuadPart) * 1000000ull) / ULONGLONG(frequency.QuadPart);
+
+    ++pStats->DelayCount;
+    if (onTimer)
+    {
+        ++pStats->TimerDelayCount;
+    }
+    pStats->RequestedUs += delayUs;
+    pStats->MeasuredUs += measuredUs;
+    pStats->SpinUs += spinUs;
+    if (measuredUs > delayUs)
+    {
+        pStats->MaxOvershootUs = max(pStats->MaxOvershootUs, measuredUs - delayUs);
     }
 
     Trace(
         TRACE_LEVEL_INFORMATION,
         TRACE_FLAG_TRANSFER,
-        "Delayed %lu us before starting transfer for SPBREQUEST %p WDFDEVICE %p",
-        pRequest->CurrentTransferDelayInUs,
+        "Delayed %lu us (measured %I64u us, spun %I64u us) before starting transfer for SPBREQUEST %p WDFDEVICE %p",
+        delayUs,
+        measuredUs,
+        spinUs,
         pRequest->SpbRequest,
         pDevice->FxDevice);
 
@@ -649,14 +1759,11 @@ exit:
     return status;
 }
 
-VOID
-ControllerConfigClock(
-    PPBC_DEVICE pDevice,
+ULONG
+ControllerClockDivider(
     ULONG clockHz
     )
 {
-    FuncEntry(TRACE_FLAG_TRANSFER);
-
     ULONG cdiv;
 
     if (clockHz <= BCM_SPI_CLK_MIN_HZ)
@@ -678,7 +1785,21 @@ ControllerConfigClock(
         cdiv = (BCM_APB_CLK / clockHz) & ULONG(~1);
     }
 
+    return cdiv;
+}
+
+VOID
+ControllerConfigClock(
+    PPBC_DEVICE pDevice,
+    ULONG clockHz
+    )
+{
+    FuncEntry(TRACE_FLAG_TRANSFER);
+
+    ULONG cdiv = ControllerClockDivider(clockHz);
+
     WRITE_REGISTER_ULONG(&pDevice->pSPIRegisters->CLK, BCM_SPI_REG_CLK_CDIV_SET(cdiv));
+    pDevice->CurrentClockDivider = cdiv;
 
     Trace(
         TRACE_LEVEL_INFORMATION,
@@ -772,4 +1893,120 @@ ControllerEstimateRequestCompletionTimeUs(
     FuncExit(TRACE_FLAG_TRANSFER);
 
     return allTransfersTimeEstimateUs;
-}
\ No newline at end of file
+}
+
+_Use_decl_annotations_
+BOOLEAN
+ControllerServiceInterrupt(
+    PPBC_DEVICE pDevice
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine is called from the ISR. It acknowledges the DONE
+    and RXR interrupts by disabling INTD and INTR.
+
+  Arguments:
+
+    pDevice - a pointer to the PBC device context
+
+  Return Value:
+
+    TRUE if the interrupt was raised by the SPI controller
+
+--*/
+{
+    ULONG CS = READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->CS);
+
+    if (((CS & (BCM_SPI_REG_CS_INTD | BCM_SPI_REG_CS_DONE)) != 
+         (BCM_SPI_REG_CS_INTD | BCM_SPI_REG_CS_DONE)) &&
+        ((CS & (BCM_SPI_REG_CS_INTR | BCM_SPI_REG_CS_RXR)) != 
+         (BCM_SPI_REG_CS_INTR | BCM_SPI_REG_CS_RXR)))
+    {
+        return FALSE;
+    }
+
+    //
+    // The shadow copy never has INTD or INTR set, the DPC arms them 
+    // again in interrupt mode. DMAEN stays set until the RX channel
+    // has drained the Rx FIFO
+    //
+
+    WRITE_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->CS, pDevice->SPI_CS_COPY);
+
+    return TRUE;
+}
+
+_Use_decl_annotations_
+VOID
+ControllerServiceInterruptDpc(
+    PPBC_DEVICE pDevice
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine is called from the interrupt DPC. In interrupt mode
+    it moves the FIFO data and arms the interrupt again until the
+    transfer is done, otherwise it signals the end of a DMA transfer.
+
+  Arguments:
+
+    pDevice - a pointer to the PBC device context
+
+  Return Value:
+
+    None.
+
+--*/
+{
+    PPBC_REQUEST pRequest = pDevice->pInterruptRequest;
+    NTSTATUS status;
+
+    if (pRequest == NULL)
+    {
+        (void)KeSetEvent(&pDevice->TransferDoneEvt, IO_NO_INCREMENT, FALSE);
+        return;
+    }
+
+    if (WdfRequestIsCanceled(pRequest->SpbRequest))
+    {
+        status = STATUS_CANCELLED;
+    }
+    else
+    {
+        //
+        // Refill at most 3/4 of the FIFO, so RXR interrupts
+        // before the Rx FIFO is full
+        //
+
+        status = ControllerServiceFifos(
+            pDevice,
+            NULL,
+            &pDevice->InterruptFifo,
+            READ_REGISTER_NOFENCE_ULONG(&pDevice->pSPIRegisters->CS),
+            BCM_SPI_FIFO_RXR_BYTE_COUNT);
+        if (!NT_SUCCESS(status))
+        {
+            NT_ASSERTMSG("MDL size must match request set buffer length", false);
+            status = STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    if (!NT_SUCCESS(status) || (pDevice->InterruptFifo.BytesToReceive == 0))
+    {
+        pDevice->InterruptTransferStatus = status;
+        (void)KeSetEvent(&pDevice->TransferDoneEvt, IO_NO_INCREMENT, FALSE);
+        return;
+    }
+
+    WdfInterruptAcquireLock(pDevice->InterruptObject);
+    if (pDevice->pInterruptRequest != NULL)
+    {
+        WRITE_REGISTER_ULONG(
+            &pDevice->pSPIRegisters->CS,
+            pDevice->SPI_CS_COPY | BCM_SPI_REG_CS_INTD | BCM_SPI_REG_CS_INTR);
+    }
+    WdfInterruptReleaseLock(pDevice->InterruptObject);
+}
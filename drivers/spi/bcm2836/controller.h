@@ -40,12 +40,50 @@ ControllerTransferData(
     _Inout_ PPBC_REQUEST pRequest
     );
 
+NTSTATUS
+ControllerInitializeDma(
+    _Inout_ PPBC_DEVICE pDevice
+    );
+
+VOID
+ControllerReleaseDma(
+    _Inout_ PPBC_DEVICE pDevice
+    );
+
+NTSTATUS
+ControllerDoOneTransfer(
+    _Inout_ PPBC_DEVICE pDevice,
+    _Inout_ PPBC_REQUEST pRequest
+    );
+
 NTSTATUS
 ControllerDoOneTransferPollMode(
     _Inout_ PPBC_DEVICE pDevice,
     _Inout_ PPBC_REQUEST pRequest
     );
 
+NTSTATUS
+ControllerDoOneTransferInterruptMode(
+    _Inout_ PPBC_DEVICE pDevice,
+    _Inout_ PPBC_REQUEST pRequest
+    );
+
+NTSTATUS
+ControllerDoOneTransferDmaMode(
+    _Inout_ PPBC_DEVICE pDevice,
+    _Inout_ PPBC_REQUEST pRequest
+    );
+
+BOOLEAN
+ControllerServiceInterrupt(
+    _In_ PPBC_DEVICE pDevice
+    );
+
+VOID
+ControllerServiceInterruptDpc(
+    _Inout_ PPBC_DEVICE pDevice
+    );
+
 bool
 ControllerCompleteTransfer(
     _Inout_ PPBC_DEVICE pDevice,
@@ -58,6 +96,11 @@ ControllerUnlockTransfer(
     _Inout_ PPBC_DEVICE pDevice
     );
 
+VOID
+ControllerPrepareTargetConfig(
+    _Inout_ PPBC_TARGET pTarget
+    );
+
 VOID
 ControllerConfigForTargetAndActivate(
     _In_ PPBC_DEVICE pDevice
@@ -75,6 +118,11 @@ ControllerDelayTransfer(
     _In_ PPBC_REQUEST pRequest
     );
 
+ULONG
+ControllerClockDivider(
+    ULONG clockHz
+    );
+
 VOID
 ControllerConfigClock(
     _In_ PPBC_DEVICE pDevice,
@@ -66,6 +66,7 @@ OnPrepareHardware(
     NT_ASSERT(pDevice != NULL);
 
     ULONG irqCount = 0;
+    ULONG dmaCount = 0;
     NTSTATUS status = STATUS_SUCCESS; 
 
     UNREFERENCED_PARAMETER(FxResourcesRaw);
@@ -158,6 +159,45 @@ OnPrepareHardware(
             {
                 irqCount++;
             }
+            else if (res->Type == CmResourceTypeDma)
+            {
+                //
+                // The first FixedDMA resource is the Tx channel,
+                // the second one the Rx channel
+                //
+
+                ULONG requestLine = (dmaCount == 0) ? BCM_SPI_DMA_DREQ_TX : BCM_SPI_DMA_DREQ_RX;
+
+                if ((dmaCount >= 2) ||
+                    (res->u.DmaV3.RequestLine != requestLine) ||
+                    (res->u.DmaV3.TransferWidth != Width32Bits) ||
+                    (res->u.DmaV3.Channel >= BCM_DMA_CHANNEL_COUNT))
+                {
+                    status = STATUS_DEVICE_CONFIGURATION_ERROR;
+                    Trace(
+                        TRACE_LEVEL_ERROR,
+                        TRACE_FLAG_WDFLOADING,
+                        "Error DMA resource %lu invalid (channel:%lu, DREQ:%lu, width:%lu) for WDFDEVICE %p - %!STATUS!",
+                        dmaCount,
+                        res->u.DmaV3.Channel,
+                        res->u.DmaV3.RequestLine,
+                        (ULONG)res->u.DmaV3.TransferWidth,
+                        pDevice->FxDevice,
+                        status);
+                    goto exit;
+                }
+
+                if (dmaCount == 0)
+                {
+                    pDevice->DmaTxChannel = res->u.DmaV3.Channel;
+                }
+                else
+                {
+                    pDevice->DmaRxChannel = res->u.DmaV3.Channel;
+                }
+
+                dmaCount++;
+            }
         }
     }
 
@@ -186,6 +226,66 @@ OnPrepareHardware(
         goto exit;
     }
 
+    if ((dmaCount != 0) && (dmaCount != 2))
+    {
+        status = STATUS_DEVICE_CONFIGURATION_ERROR;
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_WDFLOADING,
+            "Error number of assigned DMA channels incorrect (%d instead of 0 or 2) for WDFDEVICE %p - %!STATUS!",
+            dmaCount,
+            pDevice->FxDevice,
+            status);
+        goto exit;
+    }
+
+    //
+    // Read the DMA threshold and set up the DMA channels. Without
+    // FixedDMA resources or DMA, transfers are moved by PIO.
+    //
+
+    {
+        WDFKEY key;
+        ULONG dmaThresholdBytes = BCM_SPI_DMA_THRESHOLD_DEFAULT;
+
+        if (NT_SUCCESS(WdfDeviceOpenRegistryKey(
+                FxDevice,
+                PLUGPLAY_REGKEY_DEVICE,
+                KEY_READ,
+                WDF_NO_OBJECT_ATTRIBUTES,
+                &key)))
+        {
+            DECLARE_CONST_UNICODE_STRING(valueName, L"DmaThresholdBytes");
+
+            (void)WdfRegistryQueryULong(key, &valueName, &dmaThresholdBytes);
+            WdfRegistryClose(key);
+        }
+
+        pDevice->DmaThresholdBytes = dmaThresholdBytes;
+
+        if (dmaCount == 0)
+        {
+            Trace(
+                TRACE_LEVEL_INFORMATION,
+                TRACE_FLAG_WDFLOADING,
+                "No DMA channels assigned, using PIO only for WDFDEVICE %p",
+                pDevice->FxDevice);
+        }
+        else if (dmaThresholdBytes > 0)
+        {
+            NTSTATUS dmaStatus = ControllerInitializeDma(pDevice);
+            if (!NT_SUCCESS(dmaStatus))
+            {
+                Trace(
+                    TRACE_LEVEL_WARNING,
+                    TRACE_FLAG_WDFLOADING,
+                    "DMA not available, using poll mode only for WDFDEVICE %p - %!STATUS!",
+                    pDevice->FxDevice,
+                    dmaStatus);
+            }
+        }
+    }
+
 exit:
 
     if (!NT_SUCCESS(status))
@@ -233,6 +333,8 @@ OnReleaseHardware(
     NTSTATUS status = STATUS_SUCCESS;
     
     UNREFERENCED_PARAMETER(FxResourcesTranslated);
+
+    ControllerReleaseDma(pDevice);
     
     if (pDevice->pSPIRegisters != NULL)
     {
@@ -324,6 +426,23 @@ OnD0Exit(
     
     UNREFERENCED_PARAMETER(FxPreviousState);
 
+    PPBC_DELAY_STATISTICS pStats = &pDevice->DelayStatistics;
+    if (pStats->DelayCount > 0)
+    {
+        Trace(
+            TRACE_LEVEL_INFORMATION,
+            TRACE_FLAG_WDFLOADING,
+            "Transfer delays: %I64u (%I64u on timer), requested %I64u us, measured %I64u us, "
+            "spun %I64u us, max overshoot %I64u us (WDFDEVICE %p)",
+            pStats->DelayCount,
+            pStats->TimerDelayCount,
+            pStats->RequestedUs,
+            pStats->MeasuredUs,
+            pStats->SpinUs,
+            pStats->MaxOvershootUs,
+            pDevice->FxDevice);
+    }
+
     //
     // Uninitialize controller.
     //
@@ -622,6 +741,8 @@ OnTargetConnect(
         pTarget->SpbTarget = SpbTarget;
         pTarget->pCurrentRequest = NULL;
 
+        ControllerPrepareTargetConfig(pTarget);
+
         Trace(
             TRACE_LEVEL_INFORMATION,
             TRACE_FLAG_SPBDDI,
@@ -942,6 +1063,9 @@ OnNonSequenceRequest(
     pRequest->CurrentTransferIndex = 0;
     pRequest->TotalInformation = 0;
     pRequest->RequestLength = params.Length;
+    pRequest->PrefetchedTransferIndex = 0;
+    pRequest->ChainNextTransfer = FALSE;
+    pRequest->ChainedFifoPending = FALSE;
 
     status = OnRequest(pDevice, pTarget, pRequest);
 
@@ -1019,6 +1143,9 @@ OnSequenceRequest(
     pRequest->TotalInformation = 0;
     pRequest->RequestLength = params.Length;
     pRequest->TransferCount = params.SequenceTransferCount;
+    pRequest->PrefetchedTransferIndex = 0;
+    pRequest->ChainNextTransfer = FALSE;
+    pRequest->ChainedFifoPending = FALSE;
 
     //
     // Special handling for fullduplex transfer
@@ -1385,6 +1512,110 @@ OnOther(
     FuncExit(TRACE_FLAG_SPBDDI);
 }
 
+_Use_decl_annotations_
+BOOLEAN
+OnInterruptIsr(
+    WDFINTERRUPT Interrupt,
+    ULONG MessageID
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine acknowledges the DONE and RXR interrupts
+    and queues the DPC to continue the transfer.
+
+  Arguments:
+
+    Interrupt - a handle to the framework interrupt object
+    MessageID - message number identifying the device's
+        hardware interrupt message (if using MSI)
+
+  Return Value:
+
+    TRUE if the interrupt was raised by the SPI controller
+
+--*/
+{
+    UNREFERENCED_PARAMETER(MessageID);
+
+    PPBC_DEVICE pDevice = GetDeviceContext(WdfInterruptGetDevice(Interrupt));
+    NT_ASSERT(pDevice != NULL);
+
+    if (!ControllerServiceInterrupt(pDevice))
+    {
+        return FALSE;
+    }
+
+    WdfInterruptQueueDpcForIsr(Interrupt);
+
+    return TRUE;
+}
+
+_Use_decl_annotations_
+VOID
+OnInterruptDpc(
+    WDFINTERRUPT Interrupt,
+    WDFOBJECT AssociatedObject
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine services interrupt mode transfers and 
+    signals the completion of DMA transfers.
+
+  Arguments:
+
+    Interrupt - a handle to the framework interrupt object
+    AssociatedObject - a handle to the framework device object
+
+  Return Value:
+
+    None.
+
+--*/
+{
+    UNREFERENCED_PARAMETER(AssociatedObject);
+
+    PPBC_DEVICE pDevice = GetDeviceContext(WdfInterruptGetDevice(Interrupt));
+    NT_ASSERT(pDevice != NULL);
+
+    ControllerServiceInterruptDpc(pDevice);
+}
+
+_Use_decl_annotations_
+VOID
+OnDelayTimer(
+    PEX_TIMER Timer,
+    PVOID Context
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine wakes up the transfer thread
+    sleeping on a transfer delay.
+
+  Arguments:
+
+    Timer - the delay timer
+    Context - a pointer to the PBC device context
+
+  Return Value:
+
+    None.
+
+--*/
+{
+    UNREFERENCED_PARAMETER(Timer);
+
+    PPBC_DEVICE pDevice = (PPBC_DEVICE)Context;
+    NT_ASSERT(pDevice != NULL);
+
+    (void)KeSetEvent(&pDevice->DelayTimerEvt, IO_NO_INCREMENT, FALSE);
+}
+
 /////////////////////////////////////////////////
 //
 // PBC functions.
@@ -1537,14 +1768,24 @@ PbcRequestSetNthTransferInfo(
 
     SPB_TRANSFER_DESCRIPTOR descriptor;
     PMDL pMdl;
-    
-    SPB_TRANSFER_DESCRIPTOR_INIT(&descriptor);
 
-    SpbRequestGetTransferParameters(
-        pRequest->SpbRequest, 
-        TransferIndex,
-        &descriptor, 
-        &pMdl);
+    if ((pRequest->Type == SpbRequestTypeSequence) &&
+        (TransferIndex > 0) &&
+        (TransferIndex == pRequest->PrefetchedTransferIndex))
+    {
+        descriptor = pRequest->PrefetchedTransferDescriptor;
+        pMdl = pRequest->pPrefetchedTransferMdl;
+    }
+    else
+    {
+        SPB_TRANSFER_DESCRIPTOR_INIT(&descriptor);
+
+        SpbRequestGetTransferParameters(
+            pRequest->SpbRequest, 
+            TransferIndex,
+            &descriptor, 
+            &pMdl);
+    }
        
     NT_ASSERT(pMdl != NULL);
     
@@ -1607,6 +1848,28 @@ PbcRequestSetNthTransferInfo(
         }
     }
 
+    //
+    // Fetch the next transfer of a sequence ahead, it is
+    // chained to this one if it does not ask for a delay.
+    //
+
+    pRequest->ChainNextTransfer = FALSE;
+
+    if ((pRequest->Type == SpbRequestTypeSequence) &&
+        ((TransferIndex + 1) < pRequest->TransferCount))
+    {
+        SPB_TRANSFER_DESCRIPTOR_INIT(&pRequest->PrefetchedTransferDescriptor);
+
+        SpbRequestGetTransferParameters(
+            pRequest->SpbRequest, 
+            TransferIndex + 1,
+            &pRequest->PrefetchedTransferDescriptor, 
+            &pRequest->pPrefetchedTransferMdl);
+
+        pRequest->PrefetchedTransferIndex = TransferIndex + 1;
+        pRequest->ChainNextTransfer = (pRequest->PrefetchedTransferDescriptor.DelayInUs == 0);
+    }
+
     FuncExit(TRACE_FLAG_TRANSFER);
 
     return status;
@@ -1659,17 +1922,29 @@ OnRequestPollMode(
 {
     PPBC_REQUEST pRequest = pDevice->pCurrentTarget->pCurrentRequest;
 
-#if DBG
+    //
+    // Short requests are polled, waiting for an interrupt would take
+    // longer than the transfer itself. Longer requests free the CPU.
+    //
+
     ULONGLONG requestTimeNoDelayUs = ControllerEstimateRequestCompletionTimeUs(pDevice->pCurrentTarget, pRequest, false);
+
+    pRequest->TransferMode = (requestTimeNoDelayUs > BCM_SPI_POLL_MODE_MAX_US) ?
+        PbcTransferModeInterrupt :
+        PbcTransferModePoll;
+    pRequest->ChainedFifoPending = FALSE;
+
+#if DBG
     ULONGLONG requestTimeWithDelayUs = ControllerEstimateRequestCompletionTimeUs(pDevice->pCurrentTarget, pRequest, true);
 
     Trace(
         TRACE_LEVEL_INFORMATION,
         TRACE_FLAG_TRANSFER,
-        "Controller estimated request time to be %I64u us for %Iu bytes, with %I64u us spent in delays (SPBREQUEST %p, WDFDEVICE %p)",
+        "Controller estimated request time to be %I64u us for %Iu bytes, with %I64u us spent in delays, %s mode (SPBREQUEST %p, WDFDEVICE %p)",
         requestTimeWithDelayUs,
         pRequest->RequestLength,
         requestTimeWithDelayUs - requestTimeNoDelayUs,
+        (pRequest->TransferMode == PbcTransferModePoll) ? "poll" : "interrupt",
         pRequest->SpbRequest,
         pDevice->FxDevice);
 #endif
@@ -1695,7 +1970,7 @@ OnRequestPollMode(
 
     if (pRequest->Type == SpbRequestTypeOther)
     {
-        status = ControllerDoOneTransferPollMode(pDevice, pRequest);
+        status = ControllerDoOneTransfer(pDevice, pRequest);
 
         bIsRequestComplete = ControllerCompleteTransfer(pDevice, pRequest, status);
         NT_ASSERT(bIsRequestComplete);
@@ -1707,7 +1982,7 @@ OnRequestPollMode(
             status = PbcRequestSetNthTransferInfo(pRequest, pRequest->CurrentTransferIndex);
             if (NT_SUCCESS(status))
             {
-                status = ControllerDoOneTransferPollMode(pDevice, pRequest);
+                status = ControllerDoOneTransfer(pDevice, pRequest);
             }
 
             bIsRequestComplete = ControllerCompleteTransfer(pDevice, pRequest, status);
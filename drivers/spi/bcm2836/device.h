@@ -35,6 +35,11 @@ EVT_WDF_DEVICE_SELF_MANAGED_IO_CLEANUP  OnSelfManagedIoCleanup;
 
 EVT_WDF_REQUEST_CANCEL                  OnCancel;
 
+EVT_WDF_INTERRUPT_ISR                   OnInterruptIsr;
+EVT_WDF_INTERRUPT_DPC                   OnInterruptDpc;
+
+EXT_CALLBACK                            OnDelayTimer;
+
 //
 // Power framework event callbacks.
 //
@@ -108,158 +113,242 @@ PbcRequestDoTransfer(
     _In_ PPBC_REQUEST pRequest
     );
 
+//
+// MDL cursor helpers, see MDL_CURSOR.
+//
+
+VOID
+FORCEINLINE
+MdlCursorInitialize(
+    _Out_ PMDL_CURSOR pCursor,
+    _In_opt_ PMDL mdl
+    )
+/*++
+ 
+  Routine Description:
+
+    This is a helper routine used to position a cursor
+    on the first byte of a transfer descriptor buffer.
+
+  Arguments:
+
+    pCursor - the cursor
+
+    mdl - the MDL chain of the transfer descriptor buffer
+
+  Return Value:
+
+    None.
+
+--*/
+{
+    pCursor->Mdl = mdl;
+    pCursor->pBuffer = NULL;
+    pCursor->Offset = 0;
+}
+
 NTSTATUS
 FORCEINLINE
-MdlGetByte(
-    _In_ PMDL mdl,
-    _In_ size_t Index,
-    _In_ size_t Length,
-   _Out_ UCHAR* pByte
-   )
+MdlCursorGetSpan(
+    _Inout_ PMDL_CURSOR pCursor,
+    _Outptr_result_bytebuffer_(*pLength) PUCHAR* ppSpan,
+    _Out_ size_t* pLength
+    )
 /*++
  
   Routine Description:
 
-    This is a helper routine used to retrieve the 
-    specified byte of the current transfer descriptor buffer.
+    This is a helper routine used to retrieve the contiguous
+    run of bytes from the cursor to the end of the current MDL.
+    The cursor does not move.
 
   Arguments:
 
-    pRequest - a pointer to the PBC request context
+    pCursor - the cursor
 
-    Index - index of desired byte in current transfer descriptor buffer
+    ppSpan - pointer to the location for the first byte of the run
 
-    pByte - pointer to the location for the specified byte
+    pLength - pointer to the location for the length of the run
 
   Return Value:
 
-    STATUS_INFO_LENGTH_MISMATCH if invalid index, 
+    STATUS_INFO_LENGTH_MISMATCH if the cursor is at the end of the chain,
+    STATUS_INSUFFICIENT_RESOURCES if the buffer can not be mapped,
     otherwise STATUS_SUCCESS
 
 --*/
 {
-    size_t mdlByteCount;
-    size_t currentOffset = Index;
-    PUCHAR pBuffer;
-    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+    *ppSpan = NULL;
+    *pLength = 0;
 
     //
-    // Check for out-of-bounds index
+    // Skip exhausted and empty MDLs
     //
 
-    if (Index < Length)
+    while ((pCursor->Mdl != NULL) &&
+           (pCursor->Offset >= MmGetMdlByteCount(pCursor->Mdl)))
+    {
+        pCursor->Offset -= MmGetMdlByteCount(pCursor->Mdl);
+        pCursor->Mdl = pCursor->Mdl->Next;
+        pCursor->pBuffer = NULL;
+    }
+
+    if (pCursor->Mdl == NULL)
     {
-        while (mdl != NULL)
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    if (pCursor->pBuffer == NULL)
+    {
+        pCursor->pBuffer = (PUCHAR) MmGetSystemAddressForMdlSafe(
+            pCursor->Mdl, 
+            NormalPagePriority);
+
+        if (pCursor->pBuffer == NULL)
         {
-            mdlByteCount = MmGetMdlByteCount(mdl);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
 
-            if (currentOffset < mdlByteCount)
-            {
-                pBuffer = (PUCHAR) MmGetSystemAddressForMdlSafe(
-                    mdl, 
-                    NormalPagePriority);
+    *ppSpan = pCursor->pBuffer + pCursor->Offset;
+    *pLength = MmGetMdlByteCount(pCursor->Mdl) - pCursor->Offset;
 
-                if (pBuffer != NULL)
-                {
-                    //
-                    // Byte found, mark successful
-                    //
+    return STATUS_SUCCESS;
+}
 
-                    *pByte = pBuffer[currentOffset];
-                    status = STATUS_SUCCESS;
-                }
+VOID
+FORCEINLINE
+MdlCursorAdvance(
+    _Inout_ PMDL_CURSOR pCursor,
+    _In_ size_t Length
+    )
+/*++
+ 
+  Routine Description:
 
-                break;
-            }
+    This is a helper routine used to move a cursor forward.
+    MDLs are only mapped when a span is retrieved, so a cursor
+    can skip over bytes that are not accessed.
 
-            currentOffset -= mdlByteCount;
-            mdl = mdl->Next;
-        }
+  Arguments:
 
-        //
-        // If after walking the MDL the byte hasn't been found,
-        // status will still be STATUS_INFO_LENGTH_MISMATCH
-        //
-    }
+    pCursor - the cursor
+
+    Length - number of bytes to move
+
+  Return Value:
+
+    None.
 
-    return status;
+--*/
+{
+    pCursor->Offset += Length;
 }
 
 NTSTATUS
 FORCEINLINE
-MdlSetByte(
-   _In_ PMDL mdl,
-   _In_ size_t Index,
-   _In_ size_t Length,
-   _In_ UCHAR Byte
-   )
+MdlCursorCopyToBuffer(
+    _Inout_ PMDL_CURSOR pCursor,
+    _Out_writes_bytes_(Length) PUCHAR pBuffer,
+    _In_ size_t Length
+    )
 /*++
  
   Routine Description:
 
-    This is a helper routine used to set the 
-    specified byte of the current transfer descriptor buffer.
+    This is a helper routine used to copy bytes from the cursor
+    to a linear buffer and move the cursor past them.
 
   Arguments:
 
-    pRequest - a pointer to the PBC request context
+    pCursor - the cursor
 
-    Index - index of desired byte in current transfer descriptor buffer
+    pBuffer - the destination buffer
 
-    Byte - the byte
+    Length - number of bytes to copy
 
   Return Value:
 
-    STATUS_INFO_LENGTH_MISMATCH if invalid index, 
+    STATUS_INFO_LENGTH_MISMATCH if the range exceeds the MDL chain,
+    STATUS_INSUFFICIENT_RESOURCES if a buffer can not be mapped,
     otherwise STATUS_SUCCESS
 
 --*/
 {
-    size_t mdlByteCount;
-    size_t currentOffset = Index;
-    PUCHAR pBuffer;
-    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+    PUCHAR pSpan;
+    size_t spanLength;
+    NTSTATUS status;
 
-    //
-    // Check for out-of-bounds index
-    //
-
-    if (Index < Length)
+    while (Length > 0)
     {
-        while (mdl != NULL)
+        status = MdlCursorGetSpan(pCursor, &pSpan, &spanLength);
+        if (!NT_SUCCESS(status))
         {
-            mdlByteCount = MmGetMdlByteCount(mdl);
+            return status;
+        }
+
+        spanLength = min(spanLength, Length);
+        RtlCopyMemory(pBuffer, pSpan, spanLength);
+        MdlCursorAdvance(pCursor, spanLength);
+
+        pBuffer += spanLength;
+        Length -= spanLength;
+    }
+
+    return STATUS_SUCCESS;
+}
 
-            if (currentOffset < mdlByteCount)
-            {
-                pBuffer = (PUCHAR) MmGetSystemAddressForMdlSafe(
-                    mdl, 
-                    NormalPagePriority);
+NTSTATUS
+FORCEINLINE
+MdlCursorCopyFromBuffer(
+    _Inout_ PMDL_CURSOR pCursor,
+    _In_reads_bytes_(Length) const UCHAR* pBuffer,
+    _In_ size_t Length
+    )
+/*++
+ 
+  Routine Description:
+
+    This is a helper routine used to copy a linear buffer to
+    the bytes at the cursor and move the cursor past them.
 
-                if (pBuffer != NULL)
-                {
-                    //
-                    // Byte found, mark successful
-                    //
+  Arguments:
 
-                    pBuffer[currentOffset] = Byte;
-                    status = STATUS_SUCCESS;
-                }
+    pCursor - the cursor
 
-                break;
-            }
+    pBuffer - the source buffer
 
-            currentOffset -= mdlByteCount;
-            mdl = mdl->Next;
+    Length - number of bytes to copy
+
+  Return Value:
+
+    STATUS_INFO_LENGTH_MISMATCH if the range exceeds the MDL chain,
+    STATUS_INSUFFICIENT_RESOURCES if a buffer can not be mapped,
+    otherwise STATUS_SUCCESS
+
+--*/
+{
+    PUCHAR pSpan;
+    size_t spanLength;
+    NTSTATUS status;
+
+    while (Length > 0)
+    {
+        status = MdlCursorGetSpan(pCursor, &pSpan, &spanLength);
+        if (!NT_SUCCESS(status))
+        {
+            return status;
         }
 
-        //
-        // If after walking the MDL the byte hasn't been found,
-        // status will still be STATUS_INFO_LENGTH_MISMATCH
-        //
+        spanLength = min(spanLength, Length);
+        RtlCopyMemory(pSpan, pBuffer, spanLength);
+        MdlCursorAdvance(pCursor, spanLength);
+
+        pBuffer += spanLength;
+        Length -= spanLength;
     }
 
-    return status;
+    return STATUS_SUCCESS;
 }
 
 #endif
@@ -309,6 +309,89 @@ OnDeviceAdd(
 
         goto exit;
     }
+
+    //
+    // Create the interrupt driving interrupt mode and DMA transfers.
+    //
+    {
+        KeInitializeEvent(
+            &pDevice->TransferDoneEvt,
+            NotificationEvent,
+            FALSE);
+
+        WDF_INTERRUPT_CONFIG interruptConfig;
+        WDF_INTERRUPT_CONFIG_INIT(
+            &interruptConfig,
+            OnInterruptIsr,
+            OnInterruptDpc);
+
+        status = WdfInterruptCreate(
+            pDevice->FxDevice,
+            &interruptConfig,
+            WDF_NO_OBJECT_ATTRIBUTES,
+            &pDevice->InterruptObject);
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_FLAG_WDFLOADING,
+                "Failed to create interrupt object for WDFDEVICE %p - %!STATUS!",
+                pDevice->FxDevice,
+                status);
+
+            goto exit;
+        }
+    }
+
+    //
+    // Create the high resolution timer for transfer delays,
+    // without it delays fall back to thread delays.
+    //
+    {
+        KeInitializeEvent(
+            &pDevice->DelayTimerEvt,
+            NotificationEvent,
+            FALSE);
+
+        RtlZeroMemory(&pDevice->DelayStatistics, sizeof(pDevice->DelayStatistics));
+
+        pDevice->pDelayTimer = ExAllocateTimer(
+            OnDelayTimer,
+            pDevice,
+            EX_TIMER_HIGH_RESOLUTION);
+
+        ULONG maximumTime;
+        ULONG minimumTime;
+        ULONG currentTime;
+        ExQueryTimerResolution(&maximumTime, &minimumTime, &currentTime);
+
+        //
+        // A pending high resolution timer runs the clock at the minimum
+        // timer resolution. Thread delays only expire on a clock tick,
+        // they raise the timer resolution to the minimum while they
+        // sleep. Timer resolution is in 100ns units.
+        //
+
+        pDevice->DelayTimerResolution = minimumTime;
+        pDevice->DelaySpinUs = BCM_SPI_DELAY_SPIN_US + ((minimumTime + 9) / 10);
+
+        if (pDevice->pDelayTimer == NULL)
+        {
+            Trace(
+                TRACE_LEVEL_WARNING,
+                TRACE_FLAG_WDFLOADING,
+                "Failed to allocate high resolution delay timer, transfer delays fall back to thread delays for WDFDEVICE %p",
+                pDevice->FxDevice);
+        }
+
+        Trace(
+            TRACE_LEVEL_INFORMATION,
+            TRACE_FLAG_WDFLOADING,
+            "Transfer delays spin for the last %lu us for WDFDEVICE %p",
+            pDevice->DelaySpinUs,
+            pDevice->FxDevice);
+    }
     
     //
     // Configure idle settings to use system
@@ -423,4 +506,10 @@ OnDeviceCleanup(
         NULL);
 
     ObDereferenceObject(pDevice->pTransferThread);
+
+    if (pDevice->pDelayTimer != NULL)
+    {
+        (void)ExDeleteTimer(pDevice->pDelayTimer, TRUE, TRUE, NULL);
+        pDevice->pDelayTimer = NULL;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,2654 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    spisim.cpp
+
+Abstract:
+
+    Simulated system for the SPI0 controller driver.
+
+    Implements the kernel, KMDF and SPBCx routines of wdk/wdkhost.h and
+    models of the SPI0 controller and of the DMA controller behind the
+    registers the driver maps. See spisim.h.
+
+    Every kernel thread is a host thread, but a thread only runs while it
+    holds the baton, which moves on a wait or a thread exit. So the driver
+    sees a single CPU without preemption, and the simulation needs no
+    locking beyond the mutex the baton is passed under. The ISR, the DPCs
+    and the timer callbacks run on whichever thread holds the baton when
+    their IRQL allows it, or on the idle thread while every thread waits.
+
+--*/
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "internal.h"
+#include "driver.h"
+#include "spisim.h"
+
+namespace
+{
+
+//
+// Addresses of the simulated system. The SPI0 registers are at their
+// BCM2836 address, so the DMA channel registers the driver locates from
+// them are too. The memory the driver allocates with
+// MmAllocateContiguousNodeMemory lives in an arena at ArenaPa. The DMA
+// decodes the peripherals at their VideoCore bus address and memory
+// modulo 1 GB, like the cache aliases of the bus.
+//
+
+const ULONG SpiRegsPa = 0x3F204000;
+const ULONG SpiRegsLength = 0x20;
+const ULONG SpiInterruptVector = 0x76;
+const ULONG DmaRegsPa = SpiRegsPa - BCM_SPI_PERIPHERAL_OFFSET + BCM_DMA_PERIPHERAL_OFFSET;
+const ULONG PeripheralsPa = SpiRegsPa - BCM_SPI_PERIPHERAL_OFFSET;
+const ULONG PeripheralsBusMask = 0xFF000000;
+const ULONG ArenaPa = 0x10000000;
+const ULONG ArenaSize = 1024 * 1024;
+const ULONG BusAddressMask = 0x3FFFFFFF;
+
+//
+// Simulated CPU costs in ns.
+//
+
+const ULONGLONG RegisterReadNs = 80;
+const ULONGLONG RegisterWriteNs = 25;
+const ULONGLONG RegisterFenceNs = 20;
+const ULONGLONG PerformanceCounterNs = 40;
+const ULONGLONG YieldProcessorNs = 10;
+const ULONGLONG IsrEntryNs = 2000;
+const ULONGLONG DpcEntryNs = 1500;
+const ULONGLONG ContextSwitchNs = 5000;
+
+//
+// A high resolution timer expires this long after its due time, other
+// timers and timeouts on the first clock tick after it.
+//
+
+const ULONGLONG HighResolutionTimerLatencyNs = 10000;
+
+//
+// Timer resolutions in 100 ns, and the performance counter frequency.
+//
+
+const ULONG MaximumTimerResolution = 156250;
+const ULONG MinimumTimerResolution = 5000;
+const ULONGLONG PerformanceFrequency = 19200000;
+
+const ULONG ProcessorCount = 4;
+const KAFFINITY AllProcessors = (KAFFINITY(1) << ProcessorCount) - 1;
+const KIRQL DeviceIrql = 8;
+
+const ULONGLONG Never = ~0ull;
+const ULONG StallLimit = 100000;
+const ULONG InterruptStormLimit = 1000;
+
+const NTSTATUS StatusObjectNameNotFound = ((NTSTATUS)0xC0000034L);
+
+//
+// SPI0 FIFO depth in bytes, and the Rx FIFO level that sets RXR.
+//
+
+const size_t SpiFifoBytes = 64;
+const size_t SpiRxrBytes = (SpiFifoBytes * 3) / 4;
+
+const ULONG SpiCsStatusBits =
+    BCM_SPI_REG_CS_RXF |
+    BCM_SPI_REG_CS_RXR |
+    BCM_SPI_REG_CS_TXD |
+    BCM_SPI_REG_CS_RXD |
+    BCM_SPI_REG_CS_DONE;
+
+//
+// DMA channel CS and TI bits the driver does not define.
+//
+
+const ULONG DmaCsConfigBits = BCM_DMA_REG_CS_WAIT_FOR_WRITES | 0x00FF0000 | BCM_DMA_REG_CS_ACTIVE;
+const ULONG DmaTiInten = 0x00000001;
+const ULONG DmaDebugReadError = 0x00000004;
+
+//
+// Dispatcher object types.
+//
+
+const UCHAR NotificationEventObject = 0;
+const UCHAR SynchronizationEventObject = 1;
+const UCHAR ThreadObject = 6;
+
+enum THREAD_STATE
+{
+    ThreadReady,
+    ThreadWaiting,
+    ThreadTerminated
+};
+
+struct SIM_THREAD
+{
+    //
+    // Signaled when the thread exits, it is what ObReferenceObjectByHandle
+    // returns for the thread handle.
+    //
+    DISPATCHER_HEADER               Header;
+
+    THREAD_STATE                    State;
+    KIRQL                           Irql;
+    KAFFINITY                       Affinity;
+    ULONGLONG                       ReadySequence;
+
+    DISPATCHER_HEADER*              WaitObject;
+    ULONGLONG                       WaitDeadline;
+    ULONGLONG                       WaitSequence;
+    NTSTATUS                        WaitStatus;
+
+    PKSTART_ROUTINE                 StartRoutine;
+    PVOID                           StartContext;
+
+    //
+    // The thread runs while the simulation runs it, it holds Lock except
+    // while it waits on Baton.
+    //
+    std::condition_variable         Baton;
+    std::unique_lock<std::mutex>*   Lock;
+    std::thread                     Host;
+};
+
+//
+// KMDF object header, with the context of the type the object
+// attributes declared.
+//
+
+struct SIM_OBJECT
+{
+    const WDF_OBJECT_CONTEXT_TYPE_INFO* ContextType;
+    PVOID                               Context;
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP      Cleanup;
+};
+
+struct SIM_TRANSFER
+{
+    SPB_TRANSFER_DESCRIPTOR Descriptor;
+    PMDL                    Mdl;
+};
+
+struct SIM_MAPPING
+{
+    PUCHAR  Va;
+    SIZE_T  Length;
+    ULONG   Pa;
+};
+
+//
+// DMA channel registers, as loaded from the current control block.
+//
+
+struct DMA_MODEL
+{
+    ULONG   Cs;
+    ULONG   ConblkAd;
+    ULONG   Ti;
+    ULONG   SourceAd;
+    ULONG   DestAd;
+    ULONG   TxfrLen;
+    ULONG   Stride;
+    ULONG   NextConbk;
+    ULONG   Debug;
+
+    //
+    // A control block is loaded, the channel resumes it when ACTIVE is set.
+    //
+    bool    Loaded;
+};
+
+//
+// SPI0 controller. A byte is shifted out of the Tx FIFO and the byte the
+// peripheral answers is pushed to the Rx FIFO when it is done, which
+// stalls while the Rx FIFO is full.
+//
+
+struct SPI_MODEL
+{
+    ULONG               Cs;
+    ULONG               Clk;
+    ULONG               Dlen;
+    ULONG               Ltoh;
+    ULONG               Dc;
+    std::deque<UCHAR>   TxFifo;
+    std::deque<UCHAR>   RxFifo;
+
+    bool                Shifting;
+    UCHAR               ShiftByte;
+    ULONGLONG           ShiftEnd;
+
+    //
+    // Index of the next byte within the current frame.
+    //
+    size_t              FrameIndex;
+};
+
+} // namespace
+
+struct _EX_TIMER
+{
+    PEXT_CALLBACK   Callback;
+    PVOID           Context;
+    bool            HighResolution;
+    bool            Armed;
+    ULONGLONG       Due;
+};
+
+struct WDFDEVICE_INIT
+{
+    WDF_PNPPOWER_EVENT_CALLBACKS    PnpPowerCallbacks;
+    bool                            SpbInitialized;
+};
+
+struct WDFDRIVER__
+{
+    SIM_OBJECT                  Object;
+    PFN_WDF_DRIVER_DEVICE_ADD   DeviceAdd;
+};
+
+struct WDFDEVICE__
+{
+    SIM_OBJECT  Object;
+};
+
+struct SPBTARGET__
+{
+    SIM_OBJECT          Object;
+    std::vector<UCHAR>  ConnectionParameters;
+};
+
+struct WDFREQUEST__
+{
+    SIM_OBJECT                  Object;
+    SPBTARGET                   Target;
+    WDF_REQUEST_TYPE            Type;
+    ULONG                       IoControlCode;
+    SPB_REQUEST_PARAMETERS      Parameters;
+    std::vector<SIM_TRANSFER>   Transfers;
+    std::deque<MDL>             Mdls;
+    bool                        Captured;
+    bool                        Completed;
+    NTSTATUS                    Status;
+    ULONG_PTR                   Information;
+    KEVENT                      CompletionEvt;
+};
+
+struct WDFINTERRUPT__
+{
+    WDF_INTERRUPT_CONFIG    Config;
+    bool                    DpcQueued;
+    bool                    LockHeld;
+    KIRQL                   LockIrql;
+};
+
+struct WDFSPINLOCK__
+{
+    bool    Held;
+    KIRQL   OldIrql;
+};
+
+struct WDFCMRESLIST__
+{
+    std::vector<CM_PARTIAL_RESOURCE_DESCRIPTOR> Descriptors;
+};
+
+struct WDFKEY__
+{
+    ULONG   Unused;
+};
+
+namespace
+{
+
+//
+// A queued DPC, the interrupt DPC or the callback of an expired timer.
+//
+
+struct SIM_DPC
+{
+    WDFINTERRUPT    Interrupt;
+    PEX_TIMER       Timer;
+};
+
+struct SIM_SYSTEM
+{
+    SPISIM_CONFIG                   Config;
+    SPISIM_STATS                    Stats;
+
+    //
+    // Simulated time, and the time of the device event being processed.
+    //
+    ULONGLONG                       Now;
+    ULONGLONG                       DeviceTime;
+
+    //
+    // Timer resolution requested with ExSetTimerResolution, 0 if none.
+    //
+    ULONG                           RequestedTimerResolution;
+
+    //
+    // Scheduler. Threads[0] is the harness thread.
+    //
+    std::vector<SIM_THREAD*>        Threads;
+    SIM_THREAD                      Idle;
+    SIM_THREAD*                     Running;
+    ULONGLONG                       Sequence;
+    ULONGLONG                       NextDeadline;
+    ULONG                           StallCount;
+    bool                            InIsr;
+    bool                            InDpc;
+    std::deque<SIM_DPC>             Dpcs;
+    std::vector<PEX_TIMER>          Timers;
+
+    //
+    // Memory, the contiguous allocations by arena offset and the mapped
+    // register blocks.
+    //
+    PUCHAR                          Arena;
+    std::map<ULONG, ULONG>          Allocations;
+    std::vector<SIM_MAPPING>        Mappings;
+
+    //
+    // Devices.
+    //
+    SPI_MODEL                       Spi;
+    DMA_MODEL                       Dma[SPISIM_DMA_CHANNELS];
+    bool                            InDeviceUpdate;
+    std::vector<SPISIM_FRAME>       Frames;
+
+    //
+    // KMDF and SPBCx objects and callbacks.
+    //
+    std::map<WDFOBJECT, SIM_OBJECT*> Objects;
+    ULONG                           DriverObject;
+    WDFDRIVER                       Driver;
+    WDFDEVICE                       Device;
+    WDF_PNPPOWER_EVENT_CALLBACKS    PnpPowerCallbacks;
+    SPB_CONTROLLER_CONFIG           SpbConfig;
+    PFN_SPB_CONTROLLER_OTHER        IoOther;
+    PFN_WDF_IO_IN_CALLER_CONTEXT    IoInCallerContext;
+    WDF_OBJECT_ATTRIBUTES           TargetAttributes;
+    WDF_OBJECT_ATTRIBUTES           RequestAttributes;
+    WDFINTERRUPT                    Interrupt;
+    std::vector<WDFSPINLOCK>        SpinLocks;
+    std::vector<SPBTARGET>          Targets;
+    WDFCMRESLIST__                  Resources;
+    WDFKEY__                        RegistryKey;
+    PPOWER_SETTING_CALLBACK         PowerSettingCallback;
+
+    bool                            HardwarePrepared;
+    bool                            InterruptsConnected;
+    bool                            SelfManagedIoStarted;
+};
+
+SIM_SYSTEM* g_Sim;
+ULONG g_TraceLevel = TRACE_LEVEL_NONE;
+ULONG g_AssertionCount;
+
+//
+// The baton is passed under g_Lock, t_Current is the simulated thread of
+// the host thread, or the idle thread while it runs the idle loop.
+//
+
+std::mutex g_Lock;
+thread_local SIM_THREAD* t_Current;
+
+//
+// Trace formats translated to printf, by format string.
+//
+
+std::map<const char*, std::string> g_TraceFormats;
+
+VOID Charge(ULONGLONG Ns);
+VOID Poll();
+
+[[noreturn]] VOID SimFatal(const char* Message)
+{
+    fprintf(stderr, "FATAL: %s at %.3f ms\n", Message, g_Sim->Now / 1e6);
+    fflush(stdout);
+    abort();
+}
+
+//
+// Bus accesses of the DMA. Memory is the arena, the only peripherals are
+// the FIFO and CS registers of SPI0.
+//
+
+PUCHAR BusToHost(ULONG BusAddress, ULONG Length)
+{
+    ULONG pa = BusAddress & BusAddressMask;
+    if ((pa < ArenaPa) || (pa - ArenaPa > ArenaSize - Length))
+    {
+        return nullptr;
+    }
+    return g_Sim->Arena + (pa - ArenaPa);
+}
+
+bool BusToSpiRegister(ULONG BusAddress, ULONG* Offset)
+{
+    if ((BusAddress & PeripheralsBusMask) != BCM_PERIPHERALS_BUS_BASE)
+    {
+        return false;
+    }
+    ULONG pa = BusAddress - BCM_PERIPHERALS_BUS_BASE + PeripheralsPa;
+    *Offset = pa - SpiRegsPa;
+    return true;
+}
+
+//
+// SPI0 model.
+//
+
+bool SpiDone()
+{
+    const SPI_MODEL& spi = g_Sim->Spi;
+    return (spi.Cs & BCM_SPI_REG_CS_TA) && spi.TxFifo.empty() && !spi.Shifting;
+}
+
+ULONG SpiReadCs()
+{
+    const SPI_MODEL& spi = g_Sim->Spi;
+    ULONG cs = spi.Cs;
+    if (spi.RxFifo.size() >= SpiFifoBytes)
+    {
+        cs |= BCM_SPI_REG_CS_RXF;
+    }
+    if ((spi.Cs & BCM_SPI_REG_CS_TA) && (spi.RxFifo.size() >= SpiRxrBytes))
+    {
+        cs |= BCM_SPI_REG_CS_RXR;
+    }
+    if (spi.TxFifo.size() < SpiFifoBytes)
+    {
+        cs |= BCM_SPI_REG_CS_TXD;
+    }
+    if (!spi.RxFifo.empty())
+    {
+        cs |= BCM_SPI_REG_CS_RXD;
+    }
+    if (SpiDone())
+    {
+        cs |= BCM_SPI_REG_CS_DONE;
+    }
+    return cs;
+}
+
+bool SpiInterruptAsserted()
+{
+    ULONG cs = SpiReadCs();
+    return ((cs & BCM_SPI_REG_CS_INTD) && (cs & BCM_SPI_REG_CS_DONE)) ||
+           ((cs & BCM_SPI_REG_CS_INTR) && (cs & BCM_SPI_REG_CS_RXR));
+}
+
+ULONGLONG SpiByteNs()
+{
+    ULONGLONG cdiv = g_Sim->Spi.Clk & BCM_SPI_REG_CLK_CDIV;
+    if (cdiv == 0)
+    {
+        cdiv = 65536;
+    }
+    return (cdiv * BCM_SPI_SCLK_TICKS_PER_BYTE * 1000000000ull) / BCM_APB_CLK;
+}
+
+bool SpiStartShift()
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    if (spi.Shifting ||
+        !(spi.Cs & BCM_SPI_REG_CS_TA) ||
+        spi.TxFifo.empty() ||
+        (spi.RxFifo.size() >= SpiFifoBytes))
+    {
+        return false;
+    }
+    spi.ShiftByte = spi.TxFifo.front();
+    spi.TxFifo.pop_front();
+    spi.Shifting = true;
+    spi.ShiftEnd = g_Sim->DeviceTime + SpiByteNs();
+    return true;
+}
+
+VOID SpiFinishShift()
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    spi.Shifting = false;
+    spi.RxFifo.push_back(SpiSimMisoByte(spi.FrameIndex));
+    spi.FrameIndex++;
+    g_Sim->Frames.back().Mosi.push_back(spi.ShiftByte);
+    g_Sim->Stats.BytesShifted++;
+}
+
+//
+// DREQ lines of SPI0. The Tx DREQ asks for data while the Tx FIFO is at
+// most TDREQ full, the Rx DREQ while the Rx FIFO holds more than RDREQ
+// bytes, or the last bytes once DLEN bytes are on the wire.
+//
+
+bool DmaRequest(ULONG Permap)
+{
+    const SPI_MODEL& spi = g_Sim->Spi;
+    if (!(spi.Cs & BCM_SPI_REG_CS_DMAEN))
+    {
+        return false;
+    }
+    switch (Permap)
+    {
+    case BCM_SPI_DMA_DREQ_TX:
+        return (spi.Cs & BCM_SPI_REG_CS_TA) &&
+               (spi.TxFifo.size() <= (spi.Dc & BCM_SPI_REG_DC_TDREQ));
+    case BCM_SPI_DMA_DREQ_RX:
+        return (spi.RxFifo.size() > ((spi.Dc & BCM_SPI_REG_DC_RDREQ) >> 16)) ||
+               (!spi.RxFifo.empty() && (spi.Dlen == 0) && spi.TxFifo.empty() && !spi.Shifting);
+    default:
+        return false;
+    }
+}
+
+VOID DeviceUpdate();
+
+//
+// In DMA mode every FIFO access moves a word, of which only the bytes left
+// of DLEN go on the wire.
+//
+
+VOID SpiWriteFifo(ULONG Value)
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    ULONG count = 1;
+    if (spi.Cs & BCM_SPI_REG_CS_DMAEN)
+    {
+        count = min(ULONG(sizeof(ULONG)), spi.Dlen);
+        spi.Dlen -= count;
+        if (count == 0)
+        {
+            g_Sim->Stats.TxOverflows++;
+        }
+    }
+    for (ULONG i = 0; i < count; i++)
+    {
+        if (spi.TxFifo.size() >= SpiFifoBytes)
+        {
+            g_Sim->Stats.TxOverflows++;
+            continue;
+        }
+        spi.TxFifo.push_back(UCHAR(Value >> (i * 8)));
+    }
+    DeviceUpdate();
+}
+
+ULONG SpiReadFifo()
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    ULONG count = (spi.Cs & BCM_SPI_REG_CS_DMAEN) ? sizeof(ULONG) : 1;
+    ULONG value = 0;
+    if (spi.RxFifo.empty())
+    {
+        g_Sim->Stats.RxUnderflows++;
+    }
+    for (ULONG i = 0; (i < count) && !spi.RxFifo.empty(); i++)
+    {
+        value |= ULONG(spi.RxFifo.front()) << (i * 8);
+        spi.RxFifo.pop_front();
+    }
+    DeviceUpdate();
+    return value;
+}
+
+//
+// A frame starts when TA is set and ends when it is cleared, clearing TA
+// aborts the byte on the wire.
+//
+
+VOID SpiWriteCs(ULONG Value)
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    ULONG previous = spi.Cs;
+    if (Value & BCM_SPI_REG_CS_CLEARTX)
+    {
+        spi.TxFifo.clear();
+    }
+    if (Value & BCM_SPI_REG_CS_CLEARRX)
+    {
+        spi.RxFifo.clear();
+    }
+    spi.Cs = Value & ~(SpiCsStatusBits | BCM_SPI_REG_CS_CLEARTX | BCM_SPI_REG_CS_CLEARRX);
+
+    if (!(previous & BCM_SPI_REG_CS_TA) && (spi.Cs & BCM_SPI_REG_CS_TA))
+    {
+        g_Sim->Frames.push_back({ spi.Cs & BCM_SPI_REG_CS_CS, {} });
+        spi.FrameIndex = 0;
+    }
+    else if ((previous & BCM_SPI_REG_CS_TA) && !(spi.Cs & BCM_SPI_REG_CS_TA))
+    {
+        spi.Shifting = false;
+    }
+    else if ((previous & BCM_SPI_REG_CS_TA) && ((previous ^ spi.Cs) & BCM_SPI_REG_CS_CS))
+    {
+        SimAssertionFailure("chip select changed while TA is set", __FILE__, __LINE__);
+    }
+    DeviceUpdate();
+}
+
+ULONG SpiRead(ULONG Offset)
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, CS):
+        return SpiReadCs();
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, FIFO):
+        return SpiReadFifo();
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, CLK):
+        return spi.Clk;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, DLEN):
+        return spi.Dlen;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, LTOH):
+        return spi.Ltoh;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, DC):
+        return spi.Dc;
+    }
+    SimAssertionFailure("read of an unknown SPI register", __FILE__, __LINE__);
+    return 0;
+}
+
+VOID SpiWrite(ULONG Offset, ULONG Value)
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, CS):
+        SpiWriteCs(Value);
+        return;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, FIFO):
+        SpiWriteFifo(Value);
+        return;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, CLK):
+        spi.Clk = Value & BCM_SPI_REG_CLK_CDIV;
+        return;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, DLEN):
+        spi.Dlen = Value & BCM_SPI_REG_DLEN_LEN;
+        return;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, LTOH):
+        spi.Ltoh = Value & BCM_SPI_REG_LTOH_TOF;
+        return;
+    case FIELD_OFFSET(BCM_SPI_REGISTERS, DC):
+        spi.Dc = Value;
+        DeviceUpdate();
+        return;
+    }
+    SimAssertionFailure("write of an unknown SPI register", __FILE__, __LINE__);
+}
+
+//
+// DMA model. A channel moves a word at a time, right away, for as long as
+// the DREQ of its peripheral allows.
+//
+
+VOID DmaStop(DMA_MODEL& Dma, ULONG Debug)
+{
+    Dma.Debug |= Debug;
+    Dma.Cs &= ~BCM_DMA_REG_CS_ACTIVE;
+    Dma.Cs |= BCM_DMA_REG_CS_ERROR;
+    Dma.Loaded = false;
+}
+
+VOID DmaLoadControlBlock(DMA_MODEL& Dma, ULONG BusAddress)
+{
+    PULONG cb = (PULONG)BusToHost(BusAddress, sizeof(BCM_DMA_CB));
+    if ((cb == nullptr) || (BusAddress & (sizeof(BCM_DMA_CB) - 1)))
+    {
+        SimAssertionFailure("DMA control block not 256 bit aligned in DMA memory", __FILE__, __LINE__);
+        DmaStop(Dma, DmaDebugReadError);
+        return;
+    }
+    Dma.ConblkAd = BusAddress;
+    Dma.Ti = cb[FIELD_OFFSET(BCM_DMA_CB, TI) / sizeof(ULONG)];
+    Dma.SourceAd = cb[FIELD_OFFSET(BCM_DMA_CB, SOURCE_AD) / sizeof(ULONG)];
+    Dma.DestAd = cb[FIELD_OFFSET(BCM_DMA_CB, DEST_AD) / sizeof(ULONG)];
+    Dma.TxfrLen = cb[FIELD_OFFSET(BCM_DMA_CB, TXFR_LEN) / sizeof(ULONG)];
+    Dma.Stride = cb[FIELD_OFFSET(BCM_DMA_CB, STRIDE) / sizeof(ULONG)];
+    Dma.NextConbk = cb[FIELD_OFFSET(BCM_DMA_CB, NEXTCONBK) / sizeof(ULONG)];
+    Dma.Loaded = true;
+}
+
+//
+// The control block is done. The channel raises INT if the block asks for
+// it and loads the next block, or stops with CONBLK_AD 0.
+//
+
+VOID DmaFinishControlBlock(DMA_MODEL& Dma)
+{
+    Dma.Cs |= BCM_DMA_REG_CS_END;
+    if (Dma.Ti & DmaTiInten)
+    {
+        Dma.Cs |= BCM_DMA_REG_CS_INT;
+    }
+    Dma.Loaded = false;
+    Dma.ConblkAd = Dma.NextConbk;
+    if (Dma.NextConbk != 0)
+    {
+        DmaLoadControlBlock(Dma, Dma.NextConbk);
+    }
+    else
+    {
+        Dma.Cs &= ~BCM_DMA_REG_CS_ACTIVE;
+    }
+}
+
+bool DmaBusRead(ULONG BusAddress, ULONG* Value)
+{
+    ULONG offset;
+    if (BusToSpiRegister(BusAddress, &offset))
+    {
+        if (offset != FIELD_OFFSET(BCM_SPI_REGISTERS, FIFO))
+        {
+            return false;
+        }
+        *Value = SpiReadFifo();
+        return true;
+    }
+    PUCHAR source = BusToHost(BusAddress, sizeof(ULONG));
+    if (source == nullptr)
+    {
+        return false;
+    }
+    memcpy(Value, source, sizeof(ULONG));
+    return true;
+}
+
+bool DmaBusWrite(ULONG BusAddress, ULONG Value, ULONG Length)
+{
+    ULONG offset;
+    if (BusToSpiRegister(BusAddress, &offset))
+    {
+        if (offset == FIELD_OFFSET(BCM_SPI_REGISTERS, FIFO))
+        {
+            SpiWriteFifo(Value);
+            return true;
+        }
+        if (offset == FIELD_OFFSET(BCM_SPI_REGISTERS, CS))
+        {
+            SpiWriteCs(Value);
+            return true;
+        }
+        return false;
+    }
+    PUCHAR destination = BusToHost(BusAddress, Length);
+    if (destination == nullptr)
+    {
+        return false;
+    }
+    memcpy(destination, &Value, Length);
+    return true;
+}
+
+bool DmaService(ULONG Channel)
+{
+    DMA_MODEL& dma = g_Sim->Dma[Channel];
+    bool progress = false;
+    while ((dma.Cs & BCM_DMA_REG_CS_ACTIVE) && dma.Loaded)
+    {
+        if (dma.TxfrLen == 0)
+        {
+            DmaFinishControlBlock(dma);
+            progress = true;
+            continue;
+        }
+        if ((dma.Ti & (BCM_DMA_TI_SRC_DREQ | BCM_DMA_TI_DEST_DREQ)) &&
+            !DmaRequest((dma.Ti >> 16) & 0x1F))
+        {
+            break;
+        }
+
+        ULONG length = min(ULONG(sizeof(ULONG)), dma.TxfrLen);
+        ULONG value;
+        if (!DmaBusRead(dma.SourceAd, &value) ||
+            (!(dma.Ti & BCM_DMA_TI_DEST_IGNORE) && !DmaBusWrite(dma.DestAd, value, length)))
+        {
+            SimAssertionFailure("DMA access outside of the DMA memory and the SPI FIFO", __FILE__, __LINE__);
+            DmaStop(dma, DmaDebugReadError);
+            break;
+        }
+        if (dma.Ti & BCM_DMA_TI_SRC_INC)
+        {
+            dma.SourceAd += sizeof(ULONG);
+        }
+        if (dma.Ti & BCM_DMA_TI_DEST_INC)
+        {
+            dma.DestAd += sizeof(ULONG);
+        }
+        dma.TxfrLen -= length;
+        g_Sim->Stats.DmaWords++;
+        progress = true;
+    }
+    return progress;
+}
+
+ULONG DmaRead(ULONG Channel, ULONG Offset)
+{
+    const DMA_MODEL& dma = g_Sim->Dma[Channel];
+    g_Sim->Stats.DmaChannelAccesses[Channel]++;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, CS):
+        return dma.Cs;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, CONBLK_AD):
+        return dma.ConblkAd;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, TI):
+        return dma.Ti;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, SOURCE_AD):
+        return dma.SourceAd;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, DEST_AD):
+        return dma.DestAd;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, TXFR_LEN):
+        return dma.TxfrLen;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, STRIDE):
+        return dma.Stride;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, NEXTCONBK):
+        return dma.NextConbk;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, DEBUG):
+        return dma.Debug;
+    }
+    SimAssertionFailure("read of an unknown DMA register", __FILE__, __LINE__);
+    return 0;
+}
+
+VOID DmaWrite(ULONG Channel, ULONG Offset, ULONG Value)
+{
+    DMA_MODEL& dma = g_Sim->Dma[Channel];
+    g_Sim->Stats.DmaChannelAccesses[Channel]++;
+    switch (Offset)
+    {
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, CS):
+        if (Value & BCM_DMA_REG_CS_RESET)
+        {
+            dma = DMA_MODEL();
+            return;
+        }
+        dma.Cs &= ~(Value & (BCM_DMA_REG_CS_INT | BCM_DMA_REG_CS_END));
+        dma.Cs = (dma.Cs & ~DmaCsConfigBits) | (Value & DmaCsConfigBits);
+        if ((dma.Cs & BCM_DMA_REG_CS_ACTIVE) && !dma.Loaded)
+        {
+            if (dma.ConblkAd == 0)
+            {
+                dma.Cs &= ~BCM_DMA_REG_CS_ACTIVE;
+                return;
+            }
+            g_Sim->Stats.DmaChannelStarts[Channel]++;
+            DmaLoadControlBlock(dma, dma.ConblkAd);
+        }
+        DeviceUpdate();
+        return;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, CONBLK_AD):
+        dma.ConblkAd = Value;
+        return;
+    case FIELD_OFFSET(BCM_DMA_REGISTERS, DEBUG):
+        dma.Debug &= ~(Value & BCM_DMA_REG_DEBUG_ERRORS);
+        return;
+    }
+    SimAssertionFailure("write of a read-only or unknown DMA register", __FILE__, __LINE__);
+}
+
+//
+// Lets the DMA channels and the shift register react to a state change,
+// until neither moves anything. Changes made from within are picked up by
+// the outer loop.
+//
+
+VOID DeviceUpdate()
+{
+    if (g_Sim->InDeviceUpdate)
+    {
+        return;
+    }
+    g_Sim->InDeviceUpdate = true;
+    for (;;)
+    {
+        bool progress = false;
+        for (ULONG channel = 0; channel < SPISIM_DMA_CHANNELS; channel++)
+        {
+            progress = DmaService(channel) || progress;
+        }
+        progress = SpiStartShift() || progress;
+        if (!progress)
+        {
+            break;
+        }
+    }
+    g_Sim->InDeviceUpdate = false;
+}
+
+//
+// Brings the devices up to the simulated time, byte by byte.
+//
+
+VOID RunDevices()
+{
+    SPI_MODEL& spi = g_Sim->Spi;
+    while (spi.Shifting && (spi.ShiftEnd <= g_Sim->Now))
+    {
+        g_Sim->DeviceTime = spi.ShiftEnd;
+        SpiFinishShift();
+        DeviceUpdate();
+    }
+    g_Sim->DeviceTime = g_Sim->Now;
+}
+
+ULONGLONG NextDeviceEvent()
+{
+    return g_Sim->Spi.Shifting ? g_Sim->Spi.ShiftEnd : Never;
+}
+
+ULONGLONG NextTimerEvent()
+{
+    ULONGLONG next = Never;
+    for (PEX_TIMER timer : g_Sim->Timers)
+    {
+        if (timer->Armed)
+        {
+            next = min(next, timer->Due);
+        }
+    }
+    return next;
+}
+
+//
+// CPU accesses to the registers the driver mapped.
+//
+
+bool RegisterPa(volatile ULONG* Register, ULONG* Pa)
+{
+    PUCHAR address = (PUCHAR)Register;
+    for (const SIM_MAPPING& mapping : g_Sim->Mappings)
+    {
+        if ((address >= mapping.Va) && (address + sizeof(ULONG) <= mapping.Va + mapping.Length))
+        {
+            *Pa = mapping.Pa + ULONG(address - mapping.Va);
+            return true;
+        }
+    }
+    return false;
+}
+
+ULONG DeviceRead(ULONG Pa)
+{
+    if (Pa - SpiRegsPa < sizeof(BCM_SPI_REGISTERS))
+    {
+        g_Sim->Stats.RegisterReads++;
+        if (Pa == SpiRegsPa + FIELD_OFFSET(BCM_SPI_REGISTERS, CS))
+        {
+            g_Sim->Stats.CsReads++;
+        }
+        return SpiRead(Pa - SpiRegsPa);
+    }
+    if (Pa - DmaRegsPa < SPISIM_DMA_CHANNELS * BCM_DMA_CHANNEL_REGISTERS_SIZE)
+    {
+        return DmaRead((Pa - DmaRegsPa) / BCM_DMA_CHANNEL_REGISTERS_SIZE, (Pa - DmaRegsPa) % BCM_DMA_CHANNEL_REGISTERS_SIZE);
+    }
+    SimAssertionFailure("register read outside of the simulated devices", __FILE__, __LINE__);
+    return 0;
+}
+
+VOID DeviceWrite(ULONG Pa, ULONG Value)
+{
+    if (Pa - SpiRegsPa < sizeof(BCM_SPI_REGISTERS))
+    {
+        g_Sim->Stats.RegisterWrites++;
+        SpiWrite(Pa - SpiRegsPa, Value);
+        return;
+    }
+    if (Pa - DmaRegsPa < SPISIM_DMA_CHANNELS * BCM_DMA_CHANNEL_REGISTERS_SIZE)
+    {
+        DmaWrite((Pa - DmaRegsPa) / BCM_DMA_CHANNEL_REGISTERS_SIZE, (Pa - DmaRegsPa) % BCM_DMA_CHANNEL_REGISTERS_SIZE, Value);
+        return;
+    }
+    SimAssertionFailure("register write outside of the simulated devices", __FILE__, __LINE__);
+}
+
+ULONG RegisterRead(volatile ULONG* Register, bool Fence)
+{
+    ULONG pa;
+    ULONG value = 0;
+    RunDevices();
+    if (RegisterPa(Register, &pa))
+    {
+        value = DeviceRead(pa);
+    }
+    else
+    {
+        SimAssertionFailure("register read outside of the mapped registers", __FILE__, __LINE__);
+    }
+    Charge(RegisterReadNs + (Fence ? RegisterFenceNs : 0));
+    return value;
+}
+
+VOID RegisterWrite(volatile ULONG* Register, ULONG Value, bool Fence)
+{
+    ULONG pa;
+    RunDevices();
+    if (RegisterPa(Register, &pa))
+    {
+        DeviceWrite(pa, Value);
+    }
+    else
+    {
+        SimAssertionFailure("register write outside of the mapped registers", __FILE__, __LINE__);
+    }
+    Charge(RegisterWriteNs + (Fence ? RegisterFenceNs : 0));
+}
+
+//
+// Interrupts and DPCs. The ISR runs as long as the interrupt is asserted
+// and the IRQL is below DeviceIrql, the DPCs once it is below DISPATCH_LEVEL.
+//
+
+VOID DeliverInterrupts()
+{
+    WDFINTERRUPT interrupt = g_Sim->Interrupt;
+    SIM_THREAD* thread = t_Current;
+    if (!g_Sim->InterruptsConnected || g_Sim->InIsr || (thread->Irql >= DeviceIrql))
+    {
+        return;
+    }
+    ULONG unclaimed = 0;
+    while (SpiInterruptAsserted())
+    {
+        KIRQL irql = thread->Irql;
+        thread->Irql = DeviceIrql;
+        g_Sim->InIsr = true;
+        g_Sim->Stats.IsrCount++;
+        Charge(IsrEntryNs);
+        BOOLEAN claimed = interrupt->Config.EvtInterruptIsr(interrupt, 0);
+        g_Sim->InIsr = false;
+        thread->Irql = irql;
+        if (claimed)
+        {
+            unclaimed = 0;
+        }
+        else
+        {
+            g_Sim->Stats.UnclaimedInterrupts++;
+            if (++unclaimed >= InterruptStormLimit)
+            {
+                SimFatal("interrupt storm, the ISR does not claim the asserted interrupt");
+            }
+        }
+        RunDevices();
+    }
+}
+
+VOID DeliverDpcs()
+{
+    SIM_THREAD* thread = t_Current;
+    if (g_Sim->InIsr || g_Sim->InDpc || (thread->Irql >= DISPATCH_LEVEL))
+    {
+        return;
+    }
+    while (!g_Sim->Dpcs.empty())
+    {
+        SIM_DPC dpc = g_Sim->Dpcs.front();
+        g_Sim->Dpcs.pop_front();
+        KIRQL irql = thread->Irql;
+        thread->Irql = DISPATCH_LEVEL;
+        g_Sim->InDpc = true;
+        g_Sim->Stats.DpcCount++;
+        Charge(DpcEntryNs);
+        if (dpc.Timer != nullptr)
+        {
+            dpc.Timer->Callback(dpc.Timer, dpc.Timer->Context);
+        }
+        else
+        {
+            dpc.Interrupt->DpcQueued = false;
+            dpc.Interrupt->Config.EvtInterruptDpc(dpc.Interrupt, (WDFOBJECT)g_Sim->Device);
+        }
+        g_Sim->InDpc = false;
+        thread->Irql = irql;
+    }
+}
+
+VOID FireTimers()
+{
+    for (PEX_TIMER timer : g_Sim->Timers)
+    {
+        if (timer->Armed && (timer->Due <= g_Sim->Now))
+        {
+            timer->Armed = false;
+            g_Sim->Dpcs.push_back({ nullptr, timer });
+        }
+    }
+}
+
+VOID Poll()
+{
+    RunDevices();
+    FireTimers();
+    DeliverInterrupts();
+    DeliverDpcs();
+}
+
+//
+// Runs the simulated CPU for Ns, the devices, the timers and the
+// interrupts keep up with it.
+//
+
+VOID Charge(ULONGLONG Ns)
+{
+    ULONGLONG target = g_Sim->Now + Ns;
+    for (;;)
+    {
+        ULONGLONG next = min(NextDeviceEvent(), NextTimerEvent());
+        if (next >= target)
+        {
+            break;
+        }
+        g_Sim->Now = max(g_Sim->Now, next);
+        Poll();
+    }
+    g_Sim->Now = target;
+    Poll();
+}
+
+//
+// Waits. Timeouts other than those of high resolution timers expire on
+// the first clock tick after them.
+//
+
+ULONG CurrentTimerResolution()
+{
+    ULONG resolution = (g_Sim->Config.TimerResolution != 0) ? g_Sim->Config.TimerResolution : MaximumTimerResolution;
+    if ((g_Sim->RequestedTimerResolution != 0) && (g_Sim->RequestedTimerResolution < resolution))
+    {
+        resolution = g_Sim->RequestedTimerResolution;
+    }
+    return resolution;
+}
+
+ULONGLONG RelativeDeadline(LONGLONG Interval, bool HighResolution)
+{
+    if (Interval > 0)
+    {
+        SimAssertionFailure("absolute timeouts are not simulated", __FILE__, __LINE__);
+        Interval = 0;
+    }
+    ULONGLONG deadline = g_Sim->Now + ULONGLONG(-Interval) * 100;
+    if (HighResolution)
+    {
+        return deadline + HighResolutionTimerLatencyNs;
+    }
+    if (Interval == 0)
+    {
+        return deadline;
+    }
+    ULONGLONG tick = ULONGLONG(CurrentTimerResolution()) * 100;
+    return ((deadline + tick - 1) / tick) * tick;
+}
+
+bool TrySatisfy(DISPATCHER_HEADER* Object)
+{
+    if (Object->SignalState <= 0)
+    {
+        return false;
+    }
+    if (Object->Type == SynchronizationEventObject)
+    {
+        Object->SignalState = 0;
+    }
+    return true;
+}
+
+VOID MakeReady(SIM_THREAD* Thread, NTSTATUS WaitStatus)
+{
+    Thread->State = ThreadReady;
+    Thread->WaitStatus = WaitStatus;
+    Thread->WaitObject = nullptr;
+    Thread->ReadySequence = ++g_Sim->Sequence;
+}
+
+//
+// Satisfies the waits in the order they started and times them out.
+//
+
+VOID EvaluateWaits()
+{
+    std::vector<SIM_THREAD*> waiting;
+    for (SIM_THREAD* thread : g_Sim->Threads)
+    {
+        if (thread->State == ThreadWaiting)
+        {
+            waiting.push_back(thread);
+        }
+    }
+    std::sort(waiting.begin(), waiting.end(), [](const SIM_THREAD* A, const SIM_THREAD* B)
+    {
+        return A->WaitSequence < B->WaitSequence;
+    });
+
+    g_Sim->NextDeadline = Never;
+    for (SIM_THREAD* thread : waiting)
+    {
+        if ((thread->WaitObject != nullptr) && TrySatisfy(thread->WaitObject))
+        {
+            MakeReady(thread, STATUS_SUCCESS);
+        }
+        else if (thread->WaitDeadline <= g_Sim->Now)
+        {
+            MakeReady(thread, STATUS_TIMEOUT);
+        }
+        else
+        {
+            g_Sim->NextDeadline = min(g_Sim->NextDeadline, thread->WaitDeadline);
+        }
+    }
+}
+
+SIM_THREAD* PickReady(SIM_THREAD* Self)
+{
+    SIM_THREAD* next = nullptr;
+    for (SIM_THREAD* thread : g_Sim->Threads)
+    {
+        if ((thread != Self) &&
+            (thread->State == ThreadReady) &&
+            ((next == nullptr) || (thread->ReadySequence < next->ReadySequence)))
+        {
+            next = thread;
+        }
+    }
+    return next;
+}
+
+VOID SwitchTo(SIM_THREAD* Self, SIM_THREAD* Next)
+{
+    g_Sim->Stats.SwitchCount++;
+    g_Sim->Now += ContextSwitchNs;
+    g_Sim->Running = Next;
+    Next->Baton.notify_one();
+    if (Self->State == ThreadTerminated)
+    {
+        return;
+    }
+    Self->Baton.wait(*Self->Lock, [Self] { return g_Sim->Running == Self; });
+}
+
+//
+// No thread can run. Jumps to the next device, timer or timeout event
+// and handles it on the idle thread.
+//
+
+VOID IdleStep(SIM_THREAD* Self)
+{
+    t_Current = &g_Sim->Idle;
+
+    ULONGLONG next = min(min(NextDeviceEvent(), NextTimerEvent()), g_Sim->NextDeadline);
+    if (!g_Sim->Dpcs.empty() || (g_Sim->InterruptsConnected && SpiInterruptAsserted()))
+    {
+        next = g_Sim->Now;
+    }
+    if (next == Never)
+    {
+        SimFatal("deadlock, every thread waits and no event is pending");
+    }
+    if (next > g_Sim->Now)
+    {
+        g_Sim->Now = next;
+        g_Sim->StallCount = 0;
+    }
+    else if (++g_Sim->StallCount >= StallLimit)
+    {
+        SimFatal("the idle loop makes no progress");
+    }
+
+    Poll();
+    EvaluateWaits();
+
+    t_Current = Self;
+}
+
+VOID Reschedule(SIM_THREAD* Self)
+{
+    for (;;)
+    {
+        EvaluateWaits();
+        if (Self->State == ThreadReady)
+        {
+            return;
+        }
+        SIM_THREAD* next = PickReady(Self);
+        if (next != nullptr)
+        {
+            SwitchTo(Self, next);
+            return;
+        }
+        IdleStep(Self);
+    }
+}
+
+NTSTATUS WaitFor(DISPATCHER_HEADER* Object, ULONGLONG Deadline)
+{
+    SIM_THREAD* self = t_Current;
+    if (g_Sim->InIsr || g_Sim->InDpc || (self->Irql >= DISPATCH_LEVEL))
+    {
+        SimFatal("wait at DISPATCH_LEVEL or above");
+    }
+    if ((Object != nullptr) && TrySatisfy(Object))
+    {
+        return STATUS_SUCCESS;
+    }
+    if (Deadline <= g_Sim->Now)
+    {
+        return STATUS_TIMEOUT;
+    }
+    self->State = ThreadWaiting;
+    self->WaitObject = Object;
+    self->WaitDeadline = Deadline;
+    self->WaitSequence = ++g_Sim->Sequence;
+    Reschedule(self);
+    return self->WaitStatus;
+}
+
+VOID ThreadEntry(SIM_THREAD* Thread)
+{
+    std::unique_lock<std::mutex> lock(g_Lock);
+    Thread->Lock = &lock;
+    t_Current = Thread;
+    Thread->Baton.wait(lock, [Thread] { return g_Sim->Running == Thread; });
+
+    Thread->StartRoutine(Thread->StartContext);
+
+    Thread->State = ThreadTerminated;
+    Thread->Header.SignalState = 1;
+    Reschedule(Thread);
+}
+
+SIM_THREAD* NewThread()
+{
+    SIM_THREAD* thread = new SIM_THREAD();
+    thread->Header.Type = ThreadObject;
+    thread->Irql = PASSIVE_LEVEL;
+    thread->Affinity = AllProcessors;
+    thread->WaitDeadline = Never;
+    MakeReady(thread, STATUS_SUCCESS);
+    return thread;
+}
+
+//
+// KMDF objects.
+//
+
+VOID InitializeObject(WDFOBJECT Handle, SIM_OBJECT* Object, const WDF_OBJECT_ATTRIBUTES* Attributes)
+{
+    Object->ContextType = nullptr;
+    Object->Context = nullptr;
+    Object->Cleanup = nullptr;
+    if (Attributes != nullptr)
+    {
+        Object->Cleanup = Attributes->EvtCleanupCallback;
+        if (Attributes->ContextTypeInfo != nullptr)
+        {
+            Object->ContextType = Attributes->ContextTypeInfo;
+            Object->Context = calloc(1, max(Attributes->ContextTypeInfo->ContextSize, Attributes->ContextSizeOverride));
+        }
+    }
+    g_Sim->Objects[Handle] = Object;
+}
+
+VOID DestroyObject(WDFOBJECT Handle)
+{
+    SIM_OBJECT* object = g_Sim->Objects[Handle];
+    if (object->Cleanup != nullptr)
+    {
+        object->Cleanup(Handle);
+    }
+    free(object->Context);
+    g_Sim->Objects.erase(Handle);
+}
+
+VOID CompleteRequest(WDFREQUEST Request, NTSTATUS Status)
+{
+    if (Request->Completed)
+    {
+        SimAssertionFailure("request completed twice", __FILE__, __LINE__);
+        return;
+    }
+    Request->Completed = true;
+    Request->Status = Status;
+    (void)KeSetEvent(&Request->CompletionEvt, IO_NO_INCREMENT, FALSE);
+}
+
+//
+// Describes the transfer buffer by MdlCount MDLs of growing size, each at
+// least a byte long.
+//
+
+PMDL BuildMdlChain(WDFREQUEST Request, const SPISIM_TRANSFER& Transfer)
+{
+    size_t count = max(size_t(1), min(size_t(Transfer.MdlCount), Transfer.Length));
+    size_t weights = (count * (count + 1)) / 2;
+    size_t spare = Transfer.Length - min(Transfer.Length, count);
+    size_t offset = 0;
+    size_t weight = 0;
+    PMDL previous = nullptr;
+    PMDL first = nullptr;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t start = (spare * weight) / weights;
+        weight += i + 1;
+        size_t length = ((spare * weight) / weights) - start + ((Transfer.Length > 0) ? 1 : 0);
+
+        Request->Mdls.push_back({ nullptr, Transfer.Buffer + offset, ULONG(length) });
+        PMDL mdl = &Request->Mdls.back();
+        if (previous != nullptr)
+        {
+            previous->Next = mdl;
+        }
+        else
+        {
+            first = mdl;
+        }
+        previous = mdl;
+        offset += length;
+    }
+    return first;
+}
+
+//
+// Trace formats use the WPP and Windows printf extensions, and ULONG is
+// 32 bit on the host too.
+//
+
+std::string TranslateFormat(const char* Format)
+{
+    std::string format;
+    const char* p = Format;
+    while (*p != '\0')
+    {
+        if (*p != '%')
+        {
+            format += *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            format += "%%";
+            p += 2;
+            continue;
+        }
+        if (strncmp(p, "%!STATUS!", 9) == 0)
+        {
+            format += "0x%08x";
+            p += 9;
+            continue;
+        }
+        if (strncmp(p, "%!FUNC!", 7) == 0)
+        {
+            format += "<function>";
+            p += 7;
+            continue;
+        }
+        format += *p++;
+        while ((*p != '\0') && (strchr("-+ #0123456789.", *p) != nullptr))
+        {
+            format += *p++;
+        }
+        if (strncmp(p, "I64", 3) == 0)
+        {
+            format += "ll";
+            p += 3;
+        }
+        else if (*p == 'I')
+        {
+            format += "z";
+            p++;
+        }
+        else if ((p[0] == 'l') && (p[1] != '\0') && (strchr("diuxX", p[1]) != nullptr))
+        {
+            p++;
+        }
+        if (*p != '\0')
+        {
+            format += *p++;
+        }
+    }
+    return format;
+}
+
+//
+// Cycle counter.
+//
+
+int g_CycleCounterFd = -2;
+
+int CycleCounter()
+{
+    if (g_CycleCounterFd == -2)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        g_CycleCounterFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return g_CycleCounterFd;
+}
+
+} // namespace
+
+//
+// Simulation support of wdkhost.h.
+//
+
+VOID SimAssertionFailure(const char* Expression, const char* File, int Line)
+{
+    g_AssertionCount++;
+    fprintf(stderr, "ASSERTION FAILED: %s (%s:%d)\n", Expression, File, Line);
+}
+
+VOID SimTrace(ULONG Level, const char* Format, ...)
+{
+    if (Level > g_TraceLevel)
+    {
+        return;
+    }
+    auto format = g_TraceFormats.find(Format);
+    if (format == g_TraceFormats.end())
+    {
+        format = g_TraceFormats.emplace(Format, TranslateFormat(Format)).first;
+    }
+    va_list args;
+    va_start(args, Format);
+    printf("  [%10.3f ms] ", g_Sim ? g_Sim->Now / 1e6 : 0.0);
+    vprintf(format->second.c_str(), args);
+    printf("\n");
+    va_end(args);
+}
+
+VOID SimYieldProcessor()
+{
+    Charge(YieldProcessorNs);
+}
+
+PVOID SimGetObjectContext(WDFOBJECT Handle, const WDF_OBJECT_CONTEXT_TYPE_INFO* TypeInfo)
+{
+    auto object = g_Sim->Objects.find(Handle);
+    if ((object == g_Sim->Objects.end()) || (object->second->ContextType != TypeInfo))
+    {
+        SimAssertionFailure("context of an object without a context of this type", __FILE__, __LINE__);
+        return nullptr;
+    }
+    return object->second->Context;
+}
+
+const GUID GUID_MONITOR_POWER_ON = { 0x02731015, 0x4510, 0x4526, { 0x99, 0xe6, 0xe5, 0xa1, 0x7e, 0xbd, 0x1a, 0xea } };
+
+//
+// Registers.
+//
+
+ULONG READ_REGISTER_ULONG(volatile ULONG* Register)
+{
+    return RegisterRead(Register, true);
+}
+
+VOID WRITE_REGISTER_ULONG(volatile ULONG* Register, ULONG Value)
+{
+    RegisterWrite(Register, Value, true);
+}
+
+ULONG READ_REGISTER_NOFENCE_ULONG(volatile ULONG* Register)
+{
+    return RegisterRead(Register, false);
+}
+
+VOID WRITE_REGISTER_NOFENCE_ULONG(volatile ULONG* Register, ULONG Value)
+{
+    RegisterWrite(Register, Value, false);
+}
+
+//
+// Memory manager.
+//
+
+PVOID MmGetSystemAddressForMdlSafe(PMDL Mdl, ULONG Priority)
+{
+    UNREFERENCED_PARAMETER(Priority);
+    g_Sim->Stats.MdlMappings++;
+    return Mdl->MappedSystemVa;
+}
+
+PVOID MmMapIoSpace(PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, MEMORY_CACHING_TYPE CacheType)
+{
+    UNREFERENCED_PARAMETER(CacheType);
+    return MmMapIoSpaceEx(PhysicalAddress, NumberOfBytes, PAGE_READWRITE | PAGE_NOCACHE);
+}
+
+PVOID MmMapIoSpaceEx(PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, ULONG Protect)
+{
+    UNREFERENCED_PARAMETER(Protect);
+    SIM_MAPPING mapping;
+    mapping.Va = (PUCHAR)calloc(1, NumberOfBytes);
+    mapping.Length = NumberOfBytes;
+    mapping.Pa = PhysicalAddress.LowPart;
+    g_Sim->Mappings.push_back(mapping);
+    return mapping.Va;
+}
+
+VOID MmUnmapIoSpace(PVOID BaseAddress, SIZE_T NumberOfBytes)
+{
+    for (auto mapping = g_Sim->Mappings.begin(); mapping != g_Sim->Mappings.end(); ++mapping)
+    {
+        if (mapping->Va == BaseAddress)
+        {
+            if (mapping->Length != NumberOfBytes)
+            {
+                SimAssertionFailure("I/O space unmapped with another length", __FILE__, __LINE__);
+            }
+            free(mapping->Va);
+            g_Sim->Mappings.erase(mapping);
+            return;
+        }
+    }
+    SimAssertionFailure("unmapping I/O space that is not mapped", __FILE__, __LINE__);
+}
+
+PVOID MmAllocateContiguousNodeMemory(SIZE_T NumberOfBytes, PHYSICAL_ADDRESS LowestAcceptableAddress,
+    PHYSICAL_ADDRESS HighestAcceptableAddress, PHYSICAL_ADDRESS BoundaryAddressMultiple, ULONG Protect,
+    NODE_REQUIREMENT PreferredNode)
+{
+    UNREFERENCED_PARAMETER(BoundaryAddressMultiple);
+    UNREFERENCED_PARAMETER(Protect);
+    UNREFERENCED_PARAMETER(PreferredNode);
+
+    //
+    // First fit in the arena. The memory is not cleared, like
+    // contiguous memory on the target.
+    //
+
+    ULONG length = ULONG(ROUND_TO_PAGES(NumberOfBytes));
+    ULONG offset = 0;
+    for (const auto& allocation : g_Sim->Allocations)
+    {
+        if (allocation.first - offset >= length)
+        {
+            break;
+        }
+        offset = allocation.first + allocation.second;
+    }
+    if ((ArenaSize - offset < length) ||
+        (ArenaPa + offset < ULONGLONG(LowestAcceptableAddress.QuadPart)) ||
+        (ArenaPa + offset + length - 1 > ULONGLONG(HighestAcceptableAddress.QuadPart)))
+    {
+        return nullptr;
+    }
+    g_Sim->Allocations[offset] = length;
+    memset(g_Sim->Arena + offset, 0xA5, length);
+    return g_Sim->Arena + offset;
+}
+
+VOID MmFreeContiguousMemory(PVOID BaseAddress)
+{
+    if (g_Sim->Allocations.erase(ULONG((PUCHAR)BaseAddress - g_Sim->Arena)) == 0)
+    {
+        SimAssertionFailure("freeing contiguous memory that is not allocated", __FILE__, __LINE__);
+    }
+}
+
+PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID BaseAddress)
+{
+    PHYSICAL_ADDRESS address;
+    address.QuadPart = 0;
+    PUCHAR va = (PUCHAR)BaseAddress;
+    if ((va < g_Sim->Arena) || (va >= g_Sim->Arena + ArenaSize))
+    {
+        SimAssertionFailure("physical address of memory outside of the arena", __FILE__, __LINE__);
+        return address;
+    }
+    address.QuadPart = ArenaPa + (va - g_Sim->Arena);
+    return address;
+}
+
+//
+// Dispatcher objects, threads and timing.
+//
+
+KIRQL KeGetCurrentIrql()
+{
+    return t_Current->Irql;
+}
+
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State)
+{
+    Event->Header.Type = (Type == NotificationEvent) ? NotificationEventObject : SynchronizationEventObject;
+    Event->Header.SignalState = State ? 1 : 0;
+}
+
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+    LONG previous = Event->Header.SignalState;
+    Event->Header.SignalState = 1;
+    EvaluateWaits();
+    return previous;
+}
+
+VOID KeClearEvent(PRKEVENT Event)
+{
+    Event->Header.SignalState = 0;
+}
+
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable, PLARGE_INTEGER Timeout)
+{
+    UNREFERENCED_PARAMETER(WaitReason);
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+    return WaitFor(
+        (DISPATCHER_HEADER*)Object,
+        (Timeout != nullptr) ? RelativeDeadline(Timeout->QuadPart, false) : Never);
+}
+
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval)
+{
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+    (void)WaitFor(nullptr, RelativeDeadline(Interval->QuadPart, false));
+    return STATUS_SUCCESS;
+}
+
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequencyOut)
+{
+    Charge(PerformanceCounterNs);
+    if (PerformanceFrequencyOut != nullptr)
+    {
+        PerformanceFrequencyOut->QuadPart = PerformanceFrequency;
+    }
+    LARGE_INTEGER counter;
+    counter.QuadPart = LONGLONG((g_Sim->Now * PerformanceFrequency) / 1000000000ull);
+    return counter;
+}
+
+VOID KeStallExecutionProcessor(ULONG MicroSeconds)
+{
+    Charge(ULONGLONG(MicroSeconds) * 1000);
+}
+
+VOID KeFlushQueuedDpcs()
+{
+    Poll();
+}
+
+ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER ProcNumber)
+{
+    ULONG number = 0;
+    while (!(t_Current->Affinity & (KAFFINITY(1) << number)))
+    {
+        number++;
+    }
+    if (ProcNumber != nullptr)
+    {
+        ProcNumber->Group = 0;
+        ProcNumber->Number = UCHAR(number);
+        ProcNumber->Reserved = 0;
+    }
+    return number;
+}
+
+ULONG KeQueryActiveProcessorCountEx(USHORT GroupNumber)
+{
+    UNREFERENCED_PARAMETER(GroupNumber);
+    return ProcessorCount;
+}
+
+KAFFINITY KeSetSystemAffinityThreadEx(KAFFINITY Affinity)
+{
+    KAFFINITY previous = t_Current->Affinity;
+    if ((Affinity & AllProcessors) == 0)
+    {
+        SimAssertionFailure("affinity without an active processor", __FILE__, __LINE__);
+        return previous;
+    }
+    t_Current->Affinity = Affinity & AllProcessors;
+    return previous;
+}
+
+VOID KeRevertToUserAffinityThreadEx(KAFFINITY Affinity)
+{
+    t_Current->Affinity = (Affinity != 0) ? Affinity : AllProcessors;
+}
+
+PEX_TIMER ExAllocateTimer(PEXT_CALLBACK Callback, PVOID CallbackContext, ULONG Attributes)
+{
+    bool highResolution = (Attributes & EX_TIMER_HIGH_RESOLUTION) != 0;
+    if (highResolution && g_Sim->Config.NoHighResolutionTimer)
+    {
+        return nullptr;
+    }
+    PEX_TIMER timer = new _EX_TIMER { Callback, CallbackContext, highResolution, false, 0 };
+    g_Sim->Timers.push_back(timer);
+    return timer;
+}
+
+BOOLEAN ExSetTimer(PEX_TIMER Timer, LONGLONG DueTime, LONGLONG Period, PEXT_SET_PARAMETERS Parameters)
+{
+    UNREFERENCED_PARAMETER(Parameters);
+    NT_ASSERT(Period == 0);
+    BOOLEAN wasArmed = Timer->Armed;
+    Timer->Due = RelativeDeadline(DueTime, Timer->HighResolution);
+    Timer->Armed = true;
+    return wasArmed;
+}
+
+BOOLEAN ExDeleteTimer(PEX_TIMER Timer, BOOLEAN Cancel, BOOLEAN Wait, PEXT_DELETE_PARAMETERS Parameters)
+{
+    UNREFERENCED_PARAMETER(Cancel);
+    UNREFERENCED_PARAMETER(Wait);
+    UNREFERENCED_PARAMETER(Parameters);
+    BOOLEAN wasArmed = Timer->Armed;
+    g_Sim->Timers.erase(std::find(g_Sim->Timers.begin(), g_Sim->Timers.end(), Timer));
+    g_Sim->Dpcs.erase(
+        std::remove_if(g_Sim->Dpcs.begin(), g_Sim->Dpcs.end(), [Timer](const SIM_DPC& Dpc) { return Dpc.Timer == Timer; }),
+        g_Sim->Dpcs.end());
+    delete Timer;
+    return wasArmed;
+}
+
+ULONG ExQueryTimerResolution(PULONG MaximumTime, PULONG MinimumTime, PULONG CurrentTime)
+{
+    *MaximumTime = MaximumTimerResolution;
+    *MinimumTime = MinimumTimerResolution;
+    *CurrentTime = CurrentTimerResolution();
+    return *CurrentTime;
+}
+
+ULONG ExSetTimerResolution(ULONG DesiredTime, BOOLEAN SetResolution)
+{
+    if (SetResolution)
+    {
+        g_Sim->RequestedTimerResolution = max(DesiredTime, MinimumTimerResolution);
+    }
+    else
+    {
+        g_Sim->RequestedTimerResolution = 0;
+    }
+    return CurrentTimerResolution();
+}
+
+NTSTATUS PsCreateSystemThread(PHANDLE ThreadHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes,
+    HANDLE ProcessHandle, PCLIENT_ID ClientId, PKSTART_ROUTINE StartRoutine, PVOID StartContext)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectAttributes);
+    UNREFERENCED_PARAMETER(ProcessHandle);
+    UNREFERENCED_PARAMETER(ClientId);
+    SIM_THREAD* thread = NewThread();
+    thread->StartRoutine = StartRoutine;
+    thread->StartContext = StartContext;
+    g_Sim->Threads.push_back(thread);
+    thread->Host = std::thread(ThreadEntry, thread);
+    *ThreadHandle = thread;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS ObReferenceObjectByHandle(HANDLE Handle, ACCESS_MASK DesiredAccess, POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode, PVOID* Object, POBJECT_HANDLE_INFORMATION HandleInformation)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectType);
+    UNREFERENCED_PARAMETER(AccessMode);
+    UNREFERENCED_PARAMETER(HandleInformation);
+    *Object = &((SIM_THREAD*)Handle)->Header;
+    return STATUS_SUCCESS;
+}
+
+VOID ObDereferenceObject(PVOID Object)
+{
+    UNREFERENCED_PARAMETER(Object);
+}
+
+NTSTATUS ZwClose(HANDLE Handle)
+{
+    UNREFERENCED_PARAMETER(Handle);
+    return STATUS_SUCCESS;
+}
+
+//
+// Power manager. The current monitor state is reported when the callback
+// is registered, the monitor stays on.
+//
+
+NTSTATUS PoRegisterPowerSettingCallback(PDEVICE_OBJECT DeviceObject, LPCGUID SettingGuid,
+    PPOWER_SETTING_CALLBACK Callback, PVOID Context, PVOID* Handle)
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
+    ULONG monitorOn = MONITOR_POWER_ON;
+    g_Sim->PowerSettingCallback = Callback;
+    *Handle = &g_Sim->PowerSettingCallback;
+    return Callback(SettingGuid, &monitorOn, sizeof(monitorOn), Context);
+}
+
+NTSTATUS PoUnregisterPowerSettingCallback(PVOID Handle)
+{
+    if (Handle != &g_Sim->PowerSettingCallback)
+    {
+        SimAssertionFailure("unregistering an unknown power setting callback", __FILE__, __LINE__);
+    }
+    g_Sim->PowerSettingCallback = nullptr;
+    return STATUS_SUCCESS;
+}
+
+//
+// Driver and device.
+//
+
+NTSTATUS WdfDriverCreate(PDRIVER_OBJECT DriverObject, PCUNICODE_STRING RegistryPath,
+    PWDF_OBJECT_ATTRIBUTES DriverAttributes, PWDF_DRIVER_CONFIG DriverConfig, WDFDRIVER* Driver)
+{
+    UNREFERENCED_PARAMETER(DriverObject);
+    UNREFERENCED_PARAMETER(RegistryPath);
+    WDFDRIVER driver = new WDFDRIVER__();
+    InitializeObject(driver, &driver->Object, DriverAttributes);
+    driver->DeviceAdd = DriverConfig->EvtDriverDeviceAdd;
+    g_Sim->Driver = driver;
+    if (Driver != nullptr)
+    {
+        *Driver = driver;
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(PWDFDEVICE_INIT DeviceInit,
+    PWDF_PNPPOWER_EVENT_CALLBACKS PnpPowerEventCallbacks)
+{
+    DeviceInit->PnpPowerCallbacks = *PnpPowerEventCallbacks;
+}
+
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* DeviceInit, PWDF_OBJECT_ATTRIBUTES DeviceAttributes, WDFDEVICE* Device)
+{
+    if (!(*DeviceInit)->SpbInitialized)
+    {
+        SimAssertionFailure("WdfDeviceCreate before SpbDeviceInitConfig", __FILE__, __LINE__);
+    }
+    WDFDEVICE device = new WDFDEVICE__();
+    InitializeObject(device, &device->Object, DeviceAttributes);
+    g_Sim->PnpPowerCallbacks = (*DeviceInit)->PnpPowerCallbacks;
+    g_Sim->Device = device;
+    *DeviceInit = nullptr;
+    *Device = device;
+    return STATUS_SUCCESS;
+}
+
+PDEVICE_OBJECT WdfDeviceWdmGetDeviceObject(WDFDEVICE Device)
+{
+    return (PDEVICE_OBJECT)Device;
+}
+
+VOID WdfDeviceSetDeviceState(WDFDEVICE Device, PWDF_DEVICE_STATE DeviceState)
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(DeviceState);
+}
+
+NTSTATUS WdfDeviceAssignS0IdleSettings(WDFDEVICE Device, PWDF_DEVICE_POWER_POLICY_IDLE_SETTINGS Settings)
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(Settings);
+    return STATUS_SUCCESS;
+}
+
+//
+// Resource lists and registry.
+//
+
+ULONG WdfCmResourceListGetCount(WDFCMRESLIST List)
+{
+    return ULONG(List->Descriptors.size());
+}
+
+PCM_PARTIAL_RESOURCE_DESCRIPTOR WdfCmResourceListGetDescriptor(WDFCMRESLIST List, ULONG Index)
+{
+    return (Index < List->Descriptors.size()) ? &List->Descriptors[Index] : nullptr;
+}
+
+NTSTATUS WdfDeviceOpenRegistryKey(WDFDEVICE Device, ULONG DeviceInstanceKeyType, ACCESS_MASK DesiredAccess,
+    PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key)
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(DeviceInstanceKeyType);
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(KeyAttributes);
+    *Key = &g_Sim->RegistryKey;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryQueryULong(WDFKEY Key, PCUNICODE_STRING ValueName, PULONG Value)
+{
+    UNREFERENCED_PARAMETER(Key);
+    std::wstring name(ValueName->Buffer, ValueName->Length / sizeof(WCHAR));
+    if ((name != L"DmaThresholdBytes") || !g_Sim->Config.DmaThresholdSet)
+    {
+        return StatusObjectNameNotFound;
+    }
+    *Value = g_Sim->Config.DmaThresholdBytes;
+    return STATUS_SUCCESS;
+}
+
+VOID WdfRegistryClose(WDFKEY Key)
+{
+    UNREFERENCED_PARAMETER(Key);
+}
+
+//
+// Spin locks and interrupts.
+//
+
+NTSTATUS WdfSpinLockCreate(PWDF_OBJECT_ATTRIBUTES SpinLockAttributes, WDFSPINLOCK* SpinLock)
+{
+    UNREFERENCED_PARAMETER(SpinLockAttributes);
+    *SpinLock = new WDFSPINLOCK__();
+    g_Sim->SpinLocks.push_back(*SpinLock);
+    return STATUS_SUCCESS;
+}
+
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock)
+{
+    if (SpinLock->Held)
+    {
+        SimFatal("spin lock acquired recursively");
+    }
+    NT_ASSERT(t_Current->Irql <= DISPATCH_LEVEL);
+    SpinLock->Held = true;
+    SpinLock->OldIrql = t_Current->Irql;
+    t_Current->Irql = DISPATCH_LEVEL;
+}
+
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock)
+{
+    NT_ASSERT(SpinLock->Held);
+    SpinLock->Held = false;
+    t_Current->Irql = SpinLock->OldIrql;
+    Poll();
+}
+
+NTSTATUS WdfInterruptCreate(WDFDEVICE Device, PWDF_INTERRUPT_CONFIG Configuration,
+    PWDF_OBJECT_ATTRIBUTES Attributes, WDFINTERRUPT* Interrupt)
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(Attributes);
+    WDFINTERRUPT interrupt = new WDFINTERRUPT__();
+    interrupt->Config = *Configuration;
+    g_Sim->Interrupt = interrupt;
+    *Interrupt = interrupt;
+    return STATUS_SUCCESS;
+}
+
+VOID WdfInterruptAcquireLock(WDFINTERRUPT Interrupt)
+{
+    if (Interrupt->LockHeld)
+    {
+        SimFatal("interrupt lock acquired recursively");
+    }
+    Interrupt->LockHeld = true;
+    Interrupt->LockIrql = t_Current->Irql;
+    t_Current->Irql = DeviceIrql;
+}
+
+VOID WdfInterruptReleaseLock(WDFINTERRUPT Interrupt)
+{
+    NT_ASSERT(Interrupt->LockHeld);
+    Interrupt->LockHeld = false;
+    t_Current->Irql = Interrupt->LockIrql;
+    Poll();
+}
+
+BOOLEAN WdfInterruptQueueDpcForIsr(WDFINTERRUPT Interrupt)
+{
+    if (Interrupt->DpcQueued)
+    {
+        return FALSE;
+    }
+    Interrupt->DpcQueued = true;
+    g_Sim->Dpcs.push_back({ Interrupt, nullptr });
+    return TRUE;
+}
+
+WDFDEVICE WdfInterruptGetDevice(WDFINTERRUPT Interrupt)
+{
+    UNREFERENCED_PARAMETER(Interrupt);
+    return g_Sim->Device;
+}
+
+//
+// Requests.
+//
+
+VOID WdfRequestGetParameters(WDFREQUEST Request, PWDF_REQUEST_PARAMETERS Parameters)
+{
+    Parameters->Type = Request->Type;
+    Parameters->Parameters.DeviceIoControl.OutputBufferLength = 0;
+    Parameters->Parameters.DeviceIoControl.InputBufferLength = 0;
+    Parameters->Parameters.DeviceIoControl.IoControlCode = Request->IoControlCode;
+    Parameters->Parameters.DeviceIoControl.Type3InputBuffer = nullptr;
+}
+
+BOOLEAN WdfRequestIsCanceled(WDFREQUEST Request)
+{
+    UNREFERENCED_PARAMETER(Request);
+    return FALSE;
+}
+
+VOID WdfRequestSetInformation(WDFREQUEST Request, ULONG_PTR Information)
+{
+    Request->Information = Information;
+}
+
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status)
+{
+    CompleteRequest(Request, Status);
+}
+
+//
+// The controller queue is sequential and the harness sends one request
+// at a time, so an enqueued request is presented right away.
+//
+
+NTSTATUS WdfDeviceEnqueueRequest(WDFDEVICE Device, WDFREQUEST Request)
+{
+    if (!Request->Captured)
+    {
+        SimAssertionFailure("IO other request enqueued without its transfer list", __FILE__, __LINE__);
+    }
+    g_Sim->IoOther(Device, Request->Target, Request, 0, 0, Request->IoControlCode);
+    return STATUS_SUCCESS;
+}
+
+//
+// SPB framework extension.
+//
+
+NTSTATUS SpbDeviceInitConfig(PWDFDEVICE_INIT DeviceInit)
+{
+    DeviceInit->SpbInitialized = true;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SpbDeviceInitialize(WDFDEVICE Device, PSPB_CONTROLLER_CONFIG Config)
+{
+    UNREFERENCED_PARAMETER(Device);
+    g_Sim->SpbConfig = *Config;
+    return STATUS_SUCCESS;
+}
+
+VOID SpbControllerSetIoOtherCallback(WDFDEVICE Device, PFN_SPB_CONTROLLER_OTHER EvtSpbIoOther,
+    PFN_WDF_IO_IN_CALLER_CONTEXT EvtIoInCallerContext)
+{
+    UNREFERENCED_PARAMETER(Device);
+    g_Sim->IoOther = EvtSpbIoOther;
+    g_Sim->IoInCallerContext = EvtIoInCallerContext;
+}
+
+VOID SpbControllerSetTargetAttributes(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES Attributes)
+{
+    UNREFERENCED_PARAMETER(Device);
+    g_Sim->TargetAttributes = *Attributes;
+}
+
+VOID SpbControllerSetRequestAttributes(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES Attributes)
+{
+    UNREFERENCED_PARAMETER(Device);
+    g_Sim->RequestAttributes = *Attributes;
+}
+
+VOID SpbTargetGetConnectionParameters(SPBTARGET Target, PSPB_CONNECTION_PARAMETERS Parameters)
+{
+    Parameters->ConnectionParameters = Target->ConnectionParameters.data();
+}
+
+VOID SpbRequestGetParameters(SPBREQUEST Request, PSPB_REQUEST_PARAMETERS Parameters)
+{
+    *Parameters = Request->Parameters;
+}
+
+VOID SpbRequestGetTransferParameters(SPBREQUEST Request, ULONG Index,
+    PSPB_TRANSFER_DESCRIPTOR TransferDescriptor, PMDL* TransferBuffer)
+{
+    if (Index >= Request->Transfers.size())
+    {
+        SimAssertionFailure("transfer index beyond the transfer list", __FILE__, __LINE__);
+        return;
+    }
+    *TransferDescriptor = Request->Transfers[Index].Descriptor;
+    if (TransferBuffer != nullptr)
+    {
+        *TransferBuffer = Request->Transfers[Index].Mdl;
+    }
+}
+
+NTSTATUS SpbRequestCaptureIoOtherTransferList(SPBREQUEST Request)
+{
+    Request->Captured = true;
+    return STATUS_SUCCESS;
+}
+
+VOID SpbRequestComplete(SPBREQUEST Request, NTSTATUS CompletionStatus)
+{
+    CompleteRequest(Request, CompletionStatus);
+}
+
+//
+// Harness interface.
+//
+
+_Use_decl_annotations_
+NTSTATUS
+SpiSimCreate
+(
+    const SPISIM_CONFIG* Config
+)
+{
+    NT_ASSERT(g_Sim == nullptr);
+
+    g_Sim = new SIM_SYSTEM();
+    g_Sim->Config = *Config;
+    g_Sim->Arena = (PUCHAR)aligned_alloc(PAGE_SIZE, ArenaSize);
+    g_Sim->NextDeadline = Never;
+    g_Sim->Idle.Irql = PASSIVE_LEVEL;
+    g_Sim->Idle.Affinity = AllProcessors;
+    g_AssertionCount = 0;
+
+    //
+    // The harness runs on the first simulated thread.
+    //
+
+    SIM_THREAD* harness = NewThread();
+    harness->Lock = new std::unique_lock<std::mutex>(g_Lock);
+    g_Sim->Threads.push_back(harness);
+    g_Sim->Running = harness;
+    t_Current = harness;
+
+    //
+    // Resources of the ACPI device: the SPI0 registers, the interrupt
+    // and the FixedDMA resources of the configuration.
+    //
+
+    CM_PARTIAL_RESOURCE_DESCRIPTOR descriptor;
+    RtlZeroMemory(&descriptor, sizeof(descriptor));
+    descriptor.Type = CmResourceTypeMemory;
+    descriptor.u.Memory.Start.QuadPart = SpiRegsPa;
+    descriptor.u.Memory.Length = SpiRegsLength;
+    g_Sim->Resources.Descriptors.push_back(descriptor);
+
+    RtlZeroMemory(&descriptor, sizeof(descriptor));
+    descriptor.Type = CmResourceTypeInterrupt;
+    descriptor.u.Interrupt.Vector = SpiInterruptVector;
+    descriptor.u.Interrupt.Affinity = 1;
+    g_Sim->Resources.Descriptors.push_back(descriptor);
+
+    for (ULONG i = 0; i < Config->DmaResourceCount; i++)
+    {
+        RtlZeroMemory(&descriptor, sizeof(descriptor));
+        descriptor.Type = CmResourceTypeDma;
+        descriptor.u.DmaV3.Channel = Config->DmaResources[i].Channel;
+        descriptor.u.DmaV3.RequestLine = Config->DmaResources[i].RequestLine;
+        descriptor.u.DmaV3.TransferWidth = Config->DmaResources[i].TransferWidth;
+        g_Sim->Resources.Descriptors.push_back(descriptor);
+    }
+
+    //
+    // Load the driver and start the device like PnP and KMDF do.
+    //
+
+    WCHAR registryPathBuffer[] = L"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\bcmspi";
+    UNICODE_STRING registryPath = { sizeof(registryPathBuffer) - sizeof(WCHAR), sizeof(registryPathBuffer), registryPathBuffer };
+
+    NTSTATUS status = DriverEntry((PDRIVER_OBJECT)&g_Sim->DriverObject, &registryPath);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    WDFDEVICE_INIT deviceInit = {};
+    PWDFDEVICE_INIT pDeviceInit = &deviceInit;
+    status = g_Sim->Driver->DeviceAdd(g_Sim->Driver, pDeviceInit);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    const WDF_PNPPOWER_EVENT_CALLBACKS& pnpPower = g_Sim->PnpPowerCallbacks;
+    status = pnpPower.EvtDevicePrepareHardware(g_Sim->Device, &g_Sim->Resources, &g_Sim->Resources);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+    g_Sim->HardwarePrepared = true;
+
+    status = pnpPower.EvtDeviceD0Entry(g_Sim->Device, WdfPowerDeviceD3Final);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+    g_Sim->InterruptsConnected = true;
+
+    if (pnpPower.EvtDeviceSelfManagedIoInit != nullptr)
+    {
+        status = pnpPower.EvtDeviceSelfManagedIoInit(g_Sim->Device);
+        g_Sim->SelfManagedIoStarted = true;
+    }
+    return status;
+}
+
+VOID
+SpiSimDestroy()
+{
+    const WDF_PNPPOWER_EVENT_CALLBACKS& pnpPower = g_Sim->PnpPowerCallbacks;
+    WDFDEVICE device = g_Sim->Device;
+
+    //
+    // Remove the device like KMDF does, then unload the driver.
+    //
+
+    if (g_Sim->InterruptsConnected)
+    {
+        g_Sim->InterruptsConnected = false;
+        (void)pnpPower.EvtDeviceD0Exit(device, WdfPowerDeviceD3Final);
+    }
+    if (g_Sim->HardwarePrepared)
+    {
+        (void)pnpPower.EvtDeviceReleaseHardware(device, &g_Sim->Resources);
+    }
+    if (g_Sim->SelfManagedIoStarted && (pnpPower.EvtDeviceSelfManagedIoCleanup != nullptr))
+    {
+        pnpPower.EvtDeviceSelfManagedIoCleanup(device);
+    }
+    for (SPBTARGET target : g_Sim->Targets)
+    {
+        DestroyObject(target);
+        delete target;
+    }
+    if (device != nullptr)
+    {
+        DestroyObject(device);
+        delete device;
+    }
+    if (g_Sim->Driver != nullptr)
+    {
+        DestroyObject(g_Sim->Driver);
+        delete g_Sim->Driver;
+    }
+
+    if (!g_Sim->Mappings.empty())
+    {
+        SimAssertionFailure("I/O space still mapped after the driver unloaded", __FILE__, __LINE__);
+    }
+    if (!g_Sim->Allocations.empty())
+    {
+        SimAssertionFailure("contiguous memory still allocated after the driver unloaded", __FILE__, __LINE__);
+    }
+    if (!g_Sim->Timers.empty())
+    {
+        SimAssertionFailure("timer not deleted after the driver unloaded", __FILE__, __LINE__);
+    }
+
+    //
+    // Every thread but the harness thread has to be done by now, the
+    // device cleanup waits for the transfer thread.
+    //
+
+    SIM_THREAD* harness = g_Sim->Threads[0];
+    harness->Lock->unlock();
+    for (size_t i = 1; i < g_Sim->Threads.size(); i++)
+    {
+        SIM_THREAD* thread = g_Sim->Threads[i];
+        if (thread->State != ThreadTerminated)
+        {
+            SimFatal("system thread still running after the driver unloaded");
+        }
+        thread->Host.join();
+        delete thread;
+    }
+    delete harness->Lock;
+    delete harness;
+    t_Current = nullptr;
+
+    for (const SIM_MAPPING& mapping : g_Sim->Mappings)
+    {
+        free(mapping.Va);
+    }
+    for (PEX_TIMER timer : g_Sim->Timers)
+    {
+        delete timer;
+    }
+    for (WDFSPINLOCK spinLock : g_Sim->SpinLocks)
+    {
+        delete spinLock;
+    }
+    delete g_Sim->Interrupt;
+    free(g_Sim->Arena);
+    delete g_Sim;
+    g_Sim = nullptr;
+}
+
+PVOID
+SpiSimDeviceContext()
+{
+    return g_Sim->Objects[g_Sim->Device]->Context;
+}
+
+_Use_decl_annotations_
+SPBTARGET
+SpiSimConnectTarget
+(
+    USHORT DeviceSelection,
+    ULONG ConnectionSpeed
+)
+{
+    SPBTARGET target = new SPBTARGET__();
+    InitializeObject(target, &target->Object, &g_Sim->TargetAttributes);
+
+    //
+    // What the resource hub returns for a SpiSerialBusV2 descriptor of a
+    // 4 wire, mode 0 peripheral with an active low chip select.
+    //
+
+    PNP_SPI_SERIAL_BUS_DESCRIPTOR descriptor;
+    RtlZeroMemory(&descriptor, sizeof(descriptor));
+    descriptor.SerialBusDescriptor.Tag = 0x8E;
+    descriptor.SerialBusDescriptor.Length = sizeof(descriptor) - FIELD_OFFSET(PNP_SERIAL_BUS_DESCRIPTOR, RevisionId);
+    descriptor.SerialBusDescriptor.RevisionId = 1;
+    descriptor.SerialBusDescriptor.SerialBusType = SPI_SERIAL_BUS_TYPE;
+    descriptor.SerialBusDescriptor.TypeSpecificRevisionId = 1;
+    descriptor.SerialBusDescriptor.TypeDataLength =
+        sizeof(descriptor) - FIELD_OFFSET(PNP_SPI_SERIAL_BUS_DESCRIPTOR, ConnectionSpeed);
+    descriptor.ConnectionSpeed = ConnectionSpeed;
+    descriptor.DataBitLength = BCM_SPI_DATA_BIT_LENGTH_SUPPORTED;
+    descriptor.DeviceSelection = DeviceSelection;
+
+    target->ConnectionParameters.resize(
+        FIELD_OFFSET(RH_QUERY_CONNECTION_PROPERTIES_OUTPUT_BUFFER, ConnectionProperties) + sizeof(descriptor));
+    PRH_QUERY_CONNECTION_PROPERTIES_OUTPUT_BUFFER connection =
+        (PRH_QUERY_CONNECTION_PROPERTIES_OUTPUT_BUFFER)target->ConnectionParameters.data();
+    connection->PropertiesLength = sizeof(descriptor);
+    memcpy(connection->ConnectionProperties, &descriptor, sizeof(descriptor));
+
+    NTSTATUS status = g_Sim->SpbConfig.EvtSpbTargetConnect(g_Sim->Device, target);
+    if (!NT_SUCCESS(status))
+    {
+        DestroyObject(target);
+        delete target;
+        return nullptr;
+    }
+    g_Sim->Targets.push_back(target);
+    return target;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+SpiSimRequest
+(
+    SPBTARGET Target,
+    SPB_REQUEST_TYPE Type,
+    SPISIM_TRANSFER* Transfers,
+    ULONG TransferCount,
+    size_t* Information
+)
+{
+    WDFREQUEST request = new WDFREQUEST__();
+    InitializeObject(request, &request->Object, &g_Sim->RequestAttributes);
+    KeInitializeEvent(&request->CompletionEvt, NotificationEvent, FALSE);
+    request->Target = Target;
+
+    size_t length = 0;
+    for (ULONG i = 0; i < TransferCount; i++)
+    {
+        SIM_TRANSFER transfer;
+        SPB_TRANSFER_DESCRIPTOR_INIT(&transfer.Descriptor);
+        transfer.Descriptor.Direction = Transfers[i].Direction;
+        transfer.Descriptor.DelayInUs = Transfers[i].DelayInUs;
+        transfer.Descriptor.TransferLength = Transfers[i].Length;
+        transfer.Mdl = BuildMdlChain(request, Transfers[i]);
+        request->Transfers.push_back(transfer);
+        length += Transfers[i].Length;
+    }
+
+    SPB_REQUEST_PARAMETERS_INIT(&request->Parameters);
+    request->Parameters.Position = SpbRequestSequencePositionSingle;
+    request->Parameters.Type = Type;
+    request->Parameters.Length = length;
+    request->Parameters.SequenceTransferCount = TransferCount;
+
+    switch (Type)
+    {
+    case SpbRequestTypeRead:
+        g_Sim->SpbConfig.EvtSpbIoRead(g_Sim->Device, Target, request, length);
+        break;
+    case SpbRequestTypeWrite:
+        g_Sim->SpbConfig.EvtSpbIoWrite(g_Sim->Device, Target, request, length);
+        break;
+    case SpbRequestTypeSequence:
+        g_Sim->SpbConfig.EvtSpbIoSequence(g_Sim->Device, Target, request, TransferCount);
+        break;
+    case SpbRequestTypeOther:
+        request->Type = WdfRequestTypeDeviceControl;
+        request->IoControlCode = IOCTL_SPB_FULL_DUPLEX;
+        g_Sim->IoInCallerContext(g_Sim->Device, request);
+        break;
+    default:
+        SimAssertionFailure("request type not simulated", __FILE__, __LINE__);
+        CompleteRequest(request, STATUS_NOT_SUPPORTED);
+        break;
+    }
+
+    (void)KeWaitForSingleObject(&request->CompletionEvt, Executive, KernelMode, FALSE, nullptr);
+
+    NTSTATUS status = request->Status;
+    *Information = request->Information;
+    DestroyObject(request);
+    delete request;
+    return status;
+}
+
+const std::vector<SPISIM_FRAME>&
+SpiSimFrames()
+{
+    return g_Sim->Frames;
+}
+
+VOID
+SpiSimClearFrames()
+{
+    g_Sim->Frames.clear();
+}
+
+_Use_decl_annotations_
+VOID
+SpiSimGetStats
+(
+    PSPISIM_STATS Stats
+)
+{
+    *Stats = g_Sim->Stats;
+    Stats->AssertionCount = g_AssertionCount;
+}
+
+VOID
+SpiSimResetStats()
+{
+    RtlZeroMemory(&g_Sim->Stats, sizeof(g_Sim->Stats));
+}
+
+ULONGLONG
+SpiSimNow()
+{
+    return g_Sim->Now;
+}
+
+_Use_decl_annotations_
+VOID
+SpiSimSetTraceLevel
+(
+    ULONG Level
+)
+{
+    g_TraceLevel = Level;
+}
+
+ULONGLONG
+SpiSimReadCycles()
+{
+    int fd = CycleCounter();
+    if (fd >= 0)
+    {
+        ULONGLONG count;
+        if (read(fd, &count, sizeof(count)) == sizeof(count))
+        {
+            return count;
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+const char*
+SpiSimCycleUnit()
+{
+    if (CycleCounter() >= 0)
+    {
+        return "cycles";
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return "TSC ticks";
+#else
+    return "ns";
+#endif
+}
@@ -0,0 +1,247 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    spisim.h
+
+Abstract:
+
+    Harness side interface of the simulated SPI0 controller.
+
+    driver.cpp, device.cpp and controller.cpp run unmodified on top of a
+    simulated kernel with a single CPU. Kernel threads are host threads,
+    but only the one holding the baton runs, and the baton only moves on
+    a wait or a thread exit. Register accesses, the performance counter,
+    stalls, ISR and DPC entries and context switches are charged to a
+    simulated clock in ns. When no thread can run, the clock jumps to the
+    next device, timer or timeout event. The ISR runs as soon as the SPI
+    interrupt is asserted and the IRQL allows it, the DPC and the timer
+    callbacks as soon as the IRQL drops below DISPATCH_LEVEL.
+
+    Behind the register accesses are models of the SPI0 controller with
+    its 64 byte FIFOs, of the 15 channels of the DMA controller and of a
+    peripheral on each chip select, which records the bytes it receives
+    and answers with SpiSimMisoByte.
+
+    Include after the wdk/ stand-ins, which provide the basic types.
+
+Environment:
+
+    Host user mode
+
+--*/
+
+#pragma once
+
+#include <vector>
+
+#define SPISIM_DMA_CHANNELS     15
+#define SPISIM_CHIP_SELECTS     3
+
+typedef struct _SPISIM_DMA_RESOURCE
+{
+    ULONG   Channel;
+    ULONG   RequestLine;
+    UCHAR   TransferWidth;
+} SPISIM_DMA_RESOURCE, *PSPISIM_DMA_RESOURCE;
+
+typedef struct _SPISIM_CONFIG
+{
+    //
+    // FixedDMA resources of the device, in the order of the resource list.
+    //
+    ULONG               DmaResourceCount;
+    SPISIM_DMA_RESOURCE DmaResources[4];
+
+    //
+    // DmaThresholdBytes value of the device hardware key, none if FALSE.
+    //
+    BOOLEAN             DmaThresholdSet;
+    ULONG               DmaThresholdBytes;
+
+    //
+    // ExAllocateTimer fails, so transfer delays fall back to
+    // KeDelayExecutionThread.
+    //
+    BOOLEAN             NoHighResolutionTimer;
+
+    //
+    // Current timer resolution in 100 ns, 0 for the maximum of 15.625 ms.
+    //
+    ULONG               TimerResolution;
+} SPISIM_CONFIG, *PSPISIM_CONFIG;
+
+typedef struct _SPISIM_TRANSFER
+{
+    SPB_TRANSFER_DIRECTION  Direction;
+    ULONG                   DelayInUs;
+    PUCHAR                  Buffer;
+    size_t                  Length;
+
+    //
+    // The buffer is described by a chain of this many MDLs of uneven size.
+    //
+    ULONG                   MdlCount;
+} SPISIM_TRANSFER, *PSPISIM_TRANSFER;
+
+typedef struct _SPISIM_FRAME
+{
+    ULONG               ChipSelect;
+    std::vector<UCHAR>  Mosi;
+} SPISIM_FRAME, *PSPISIM_FRAME;
+
+typedef struct _SPISIM_STATS
+{
+    //
+    // Bytes on the wire, writes to a full Tx FIFO and reads of an empty
+    // Rx FIFO.
+    //
+    ULONGLONG   BytesShifted;
+    ULONGLONG   TxOverflows;
+    ULONGLONG   RxUnderflows;
+
+    //
+    // CPU accesses to the SPI registers, and reads of CS alone.
+    //
+    ULONGLONG   RegisterReads;
+    ULONGLONG   RegisterWrites;
+    ULONGLONG   CsReads;
+
+    //
+    // Interrupts, those no ISR claimed, DPCs and context switches.
+    //
+    ULONGLONG   IsrCount;
+    ULONGLONG   UnclaimedInterrupts;
+    ULONGLONG   DpcCount;
+    ULONGLONG   SwitchCount;
+
+    //
+    // Register accesses and START writes per DMA channel, and the words
+    // the DMA controller moved.
+    //
+    ULONGLONG   DmaChannelAccesses[SPISIM_DMA_CHANNELS];
+    ULONGLONG   DmaChannelStarts[SPISIM_DMA_CHANNELS];
+    ULONGLONG   DmaWords;
+
+    //
+    // MmGetSystemAddressForMdlSafe calls.
+    //
+    ULONGLONG   MdlMappings;
+
+    ULONG       AssertionCount;
+} SPISIM_STATS, *PSPISIM_STATS;
+
+//
+// Loads the driver and starts the device: DriverEntry, the device add
+// callback, PrepareHardware with the memory, interrupt and FixedDMA
+// resources of Config, D0Entry and SelfManagedIoInit. Returns the first
+// failure, the simulation has to be destroyed either way.
+//
+
+NTSTATUS
+SpiSimCreate
+(
+    _In_    const SPISIM_CONFIG*    Config
+);
+
+VOID
+SpiSimDestroy();
+
+//
+// The PBC_DEVICE context of the device.
+//
+
+PVOID
+SpiSimDeviceContext();
+
+//
+// Opens a target on a chip select, like the resource hub does for a
+// SpiSerialBusV2 connection, and returns its SPBTARGET.
+//
+
+SPBTARGET
+SpiSimConnectTarget
+(
+    _In_    USHORT  DeviceSelection,
+    _In_    ULONG   ConnectionSpeed
+);
+
+//
+// Sends a request to the driver and waits for its completion. Read and
+// Write take one transfer, Sequence one or more, and Other is a full
+// duplex IOCTL_SPB_FULL_DUPLEX with a write and a read transfer.
+//
+
+NTSTATUS
+SpiSimRequest
+(
+    _In_    SPBTARGET           Target,
+    _In_    SPB_REQUEST_TYPE    Type,
+    _In_    SPISIM_TRANSFER*    Transfers,
+    _In_    ULONG               TransferCount,
+    _Out_   size_t*             Information
+);
+
+//
+// Byte the peripheral sends at Index of a frame.
+//
+
+inline UCHAR
+SpiSimMisoByte
+(
+    _In_    size_t  Index
+)
+{
+    return UCHAR((Index * 7) + 3);
+}
+
+//
+// Frames seen by the peripherals, from chip select assertion to
+// deassertion, in order.
+//
+
+const std::vector<SPISIM_FRAME>&
+SpiSimFrames();
+
+VOID
+SpiSimClearFrames();
+
+VOID
+SpiSimGetStats
+(
+    _Out_   PSPISIM_STATS   Stats
+);
+
+VOID
+SpiSimResetStats();
+
+//
+// Simulated time in ns.
+//
+
+ULONGLONG
+SpiSimNow();
+
+//
+// Prints the driver traces up to Level.
+//
+
+VOID
+SpiSimSetTraceLevel
+(
+    _In_    ULONG   Level
+);
+
+//
+// CPU time stamps for the benchmarks. Core cycles from the perf counters
+// where the host allows them, otherwise the time stamp counter on x86 or
+// nanoseconds.
+//
+
+ULONGLONG
+SpiSimReadCycles();
+
+const char*
+SpiSimCycleUnit();
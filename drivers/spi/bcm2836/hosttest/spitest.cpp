@@ -0,0 +1,906 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    spitest.cpp
+
+Abstract:
+
+    Host-side tests of the SPI0 controller driver.
+
+    The driver runs unmodified on the simulated SPI0 and DMA controllers
+    of sim/spisim.cpp. The tests start the device with different FixedDMA
+    resources, check which DMA channels it programs, and send read, write,
+    sequence and full duplex requests in poll, interrupt and DMA mode,
+    checking the bytes on the wire and in the request buffers.
+
+    --bench compares the per byte MdlGetByte and MdlSetByte the FIFO loop
+    used to call with the MDL_CURSOR spans and copies it uses now.
+
+Environment:
+
+    Host user mode
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "internal.h"
+#include "device.h"
+#include "spisim.h"
+
+namespace
+{
+
+const ULONG DefaultDmaThreshold = BCM_SPI_DMA_THRESHOLD_DEFAULT;
+
+//
+// FixedDMA resources of the Raspberry Pi 2 and 3 ACPI tables.
+//
+
+const SPISIM_DMA_RESOURCE DefaultDmaResources[] =
+{
+    { 8, BCM_SPI_DMA_DREQ_TX, Width32Bits },
+    { 9, BCM_SPI_DMA_DREQ_RX, Width32Bits },
+};
+
+enum TRANSFER_MODE
+{
+    ModePoll,
+    ModeInterrupt,
+    ModeDma
+};
+
+const char* const ModeNames[] = { "poll", "interrupt", "DMA" };
+
+typedef struct _TRANSFER_SPEC
+{
+    SPB_TRANSFER_DIRECTION  Direction;
+    size_t                  Length;
+    ULONG                   DelayInUs;
+    ULONG                   MdlCount;
+} TRANSFER_SPEC;
+
+typedef struct _REQUEST_CASE
+{
+    const char*         Name;
+    USHORT              ChipSelect;
+    ULONG               ConnectionSpeed;
+    TRANSFER_MODE       Mode;
+    SPB_REQUEST_TYPE    Type;
+    ULONG               TransferCount;
+    TRANSFER_SPEC       Transfers[3];
+} REQUEST_CASE;
+
+const REQUEST_CASE RequestCases[] =
+{
+    { "write 8 bytes at 4 MHz", 0, 4000000, ModePoll, SpbRequestTypeWrite, 1,
+        { { SpbTransferDirectionToDevice, 8, 0, 1 } } },
+    { "read 8 bytes at 4 MHz", 1, 4000000, ModePoll, SpbRequestTypeRead, 1,
+        { { SpbTransferDirectionFromDevice, 8, 0, 2 } } },
+    { "write 40 bytes at 1 MHz", 2, 1000000, ModeInterrupt, SpbRequestTypeWrite, 1,
+        { { SpbTransferDirectionToDevice, 40, 0, 3 } } },
+    { "full duplex 40/40 bytes at 1 MHz", 0, 1000000, ModeInterrupt, SpbRequestTypeOther, 2,
+        { { SpbTransferDirectionToDevice, 40, 0, 1 }, { SpbTransferDirectionFromDevice, 40, 0, 2 } } },
+    { "write 1000 bytes at 1 MHz", 0, 1000000, ModeDma, SpbRequestTypeWrite, 1,
+        { { SpbTransferDirectionToDevice, 1000, 0, 3 } } },
+    { "read 1000 bytes at 1 MHz", 1, 1000000, ModeDma, SpbRequestTypeRead, 1,
+        { { SpbTransferDirectionFromDevice, 1000, 0, 1 } } },
+    { "full duplex 1000/600 bytes at 1 MHz", 0, 1000000, ModeDma, SpbRequestTypeOther, 2,
+        { { SpbTransferDirectionToDevice, 1000, 0, 3 }, { SpbTransferDirectionFromDevice, 600, 0, 4 } } },
+    { "write 70000 bytes at 16 MHz", 0, 16000000, ModeDma, SpbRequestTypeWrite, 1,
+        { { SpbTransferDirectionToDevice, 70000, 0, 16 } } },
+    { "sequence 4 + 60 bytes at 1 MHz", 0, 1000000, ModeInterrupt, SpbRequestTypeSequence, 2,
+        { { SpbTransferDirectionToDevice, 4, 0, 1 }, { SpbTransferDirectionFromDevice, 60, 0, 3 } } },
+    { "sequence 8 + 8 bytes at 4 MHz, 50 us delay", 2, 4000000, ModePoll, SpbRequestTypeSequence, 2,
+        { { SpbTransferDirectionToDevice, 8, 0, 1 }, { SpbTransferDirectionFromDevice, 8, 50, 1 } } },
+    { "sequence 200 + 1000 + 16 bytes at 8 MHz", 1, 8000000, ModeDma, SpbRequestTypeSequence, 3,
+        { { SpbTransferDirectionToDevice, 200, 0, 3 }, { SpbTransferDirectionFromDevice, 1000, 0, 3 },
+          { SpbTransferDirectionToDevice, 16, 0, 1 } } },
+};
+
+//
+// Resource configurations PrepareHardware has to reject.
+//
+
+typedef struct _RESOURCE_CASE
+{
+    const char*         Name;
+    ULONG               DmaResourceCount;
+    SPISIM_DMA_RESOURCE DmaResources[4];
+} RESOURCE_CASE;
+
+const RESOURCE_CASE InvalidResourceCases[] =
+{
+    { "Rx channel first", 2,
+        { { 4, BCM_SPI_DMA_DREQ_RX, Width32Bits }, { 5, BCM_SPI_DMA_DREQ_TX, Width32Bits } } },
+    { "single FixedDMA", 1,
+        { { 4, BCM_SPI_DMA_DREQ_TX, Width32Bits } } },
+    { "channel 15", 2,
+        { { 4, BCM_SPI_DMA_DREQ_TX, Width32Bits }, { 15, BCM_SPI_DMA_DREQ_RX, Width32Bits } } },
+    { "8 bit transfer width", 2,
+        { { 4, BCM_SPI_DMA_DREQ_TX, Width8Bits }, { 5, BCM_SPI_DMA_DREQ_RX, Width32Bits } } },
+    { "three FixedDMA", 3,
+        { { 4, BCM_SPI_DMA_DREQ_TX, Width32Bits }, { 5, BCM_SPI_DMA_DREQ_RX, Width32Bits },
+          { 6, BCM_SPI_DMA_DREQ_RX, Width32Bits } } },
+};
+
+//
+// Harness helpers.
+//
+
+SPISIM_CONFIG DefaultConfig()
+{
+    SPISIM_CONFIG config = {};
+    config.DmaResourceCount = ARRAYSIZE(DefaultDmaResources);
+    memcpy(config.DmaResources, DefaultDmaResources, sizeof(DefaultDmaResources));
+    config.DmaThresholdSet = TRUE;
+    config.DmaThresholdBytes = DefaultDmaThreshold;
+    return config;
+}
+
+bool CreateDevice(const SPISIM_CONFIG& Config)
+{
+    if (!NT_SUCCESS(SpiSimCreate(&Config)))
+    {
+        printf("  could not start the simulated device\n");
+        SpiSimDestroy();
+        return false;
+    }
+    return true;
+}
+
+bool CheckAssertions()
+{
+    SPISIM_STATS stats;
+    SpiSimGetStats(&stats);
+    if (stats.AssertionCount)
+    {
+        printf("  %u driver assertions failed\n", stats.AssertionCount);
+        return false;
+    }
+    return true;
+}
+
+ULONGLONG DmaAccesses(const SPISIM_STATS& Stats, ULONG ExceptTx, ULONG ExceptRx)
+{
+    ULONGLONG accesses = 0;
+    for (ULONG channel = 0; channel < SPISIM_DMA_CHANNELS; channel++)
+    {
+        if ((channel != ExceptTx) && (channel != ExceptRx))
+        {
+            accesses += Stats.DmaChannelAccesses[channel];
+        }
+    }
+    return accesses;
+}
+
+//
+// Sends the request of Case and checks the frame the peripheral saw, the
+// bytes read and the transfer mode. Read bytes and the bytes the
+// controller shifts out during a read are not checked on the wire.
+//
+
+bool RunRequest(const REQUEST_CASE& Case, SPBTARGET Target, TRANSFER_MODE* Mode)
+{
+    bool pass = true;
+    std::vector<std::vector<UCHAR>> buffers(Case.TransferCount);
+    SPISIM_TRANSFER transfers[ARRAYSIZE(Case.Transfers)];
+    std::vector<int> expectedMosi;
+    size_t expectedInformation = 0;
+    size_t frameOffset = 0;
+
+    for (ULONG i = 0; i < Case.TransferCount; i++)
+    {
+        const TRANSFER_SPEC& spec = Case.Transfers[i];
+        buffers[i].resize(spec.Length);
+        for (size_t j = 0; j < spec.Length; j++)
+        {
+            buffers[i][j] = (spec.Direction == SpbTransferDirectionToDevice) ? UCHAR((j * 13) + (i * 101) + 1) : 0xEE;
+        }
+        transfers[i].Direction = spec.Direction;
+        transfers[i].DelayInUs = spec.DelayInUs;
+        transfers[i].Buffer = buffers[i].data();
+        transfers[i].Length = spec.Length;
+        transfers[i].MdlCount = spec.MdlCount;
+        expectedInformation += spec.Length;
+
+        //
+        // The transfers of a full duplex request share the frame, those of
+        // a sequence follow each other.
+        //
+
+        if (Case.Type == SpbRequestTypeOther)
+        {
+            frameOffset = 0;
+        }
+        if (expectedMosi.size() < frameOffset + spec.Length)
+        {
+            expectedMosi.resize(frameOffset + spec.Length, -1);
+        }
+        if (spec.Direction == SpbTransferDirectionToDevice)
+        {
+            for (size_t j = 0; j < spec.Length; j++)
+            {
+                expectedMosi[frameOffset + j] = buffers[i][j];
+            }
+        }
+        frameOffset += spec.Length;
+    }
+
+    SpiSimClearFrames();
+    SpiSimResetStats();
+    ULONGLONG start = SpiSimNow();
+
+    size_t information = 0;
+    NTSTATUS status = SpiSimRequest(Target, Case.Type, transfers, Case.TransferCount, &information);
+    if (!NT_SUCCESS(status) || (information != expectedInformation))
+    {
+        printf("  request completed with 0x%08x and %zu bytes, %zu expected\n", status, information, expectedInformation);
+        return false;
+    }
+
+    const std::vector<SPISIM_FRAME>& frames = SpiSimFrames();
+    if ((frames.size() != 1) || (frames[0].ChipSelect != Case.ChipSelect))
+    {
+        printf("  %zu frames, 1 on chip select %u expected\n", frames.size(), Case.ChipSelect);
+        return false;
+    }
+
+    const std::vector<UCHAR>& mosi = frames[0].Mosi;
+    if (mosi.size() != expectedMosi.size())
+    {
+        printf("  %zu bytes on the wire, %zu expected\n", mosi.size(), expectedMosi.size());
+        pass = false;
+    }
+    for (size_t j = 0; j < min(mosi.size(), expectedMosi.size()); j++)
+    {
+        if ((expectedMosi[j] >= 0) && (mosi[j] != expectedMosi[j]))
+        {
+            printf("  byte %zu on the wire is 0x%02x, 0x%02x expected\n", j, mosi[j], expectedMosi[j]);
+            pass = false;
+            break;
+        }
+    }
+
+    frameOffset = 0;
+    for (ULONG i = 0; i < Case.TransferCount; i++)
+    {
+        const TRANSFER_SPEC& spec = Case.Transfers[i];
+        if (Case.Type == SpbRequestTypeOther)
+        {
+            frameOffset = 0;
+        }
+        if (spec.Direction == SpbTransferDirectionFromDevice)
+        {
+            for (size_t j = 0; j < spec.Length; j++)
+            {
+                if (buffers[i][j] != SpiSimMisoByte(frameOffset + j))
+                {
+                    printf("  byte %zu of transfer %u read 0x%02x, 0x%02x expected\n",
+                        j, i, buffers[i][j], SpiSimMisoByte(frameOffset + j));
+                    pass = false;
+                    break;
+                }
+            }
+        }
+        frameOffset += spec.Length;
+    }
+
+    SPISIM_STATS stats;
+    SpiSimGetStats(&stats);
+    if (stats.TxOverflows || stats.RxUnderflows || stats.UnclaimedInterrupts)
+    {
+        printf("  %llu Tx FIFO overflows, %llu Rx FIFO underflows, %llu unclaimed interrupts\n",
+            (unsigned long long)stats.TxOverflows, (unsigned long long)stats.RxUnderflows,
+            (unsigned long long)stats.UnclaimedInterrupts);
+        pass = false;
+    }
+
+    if (stats.DmaWords != 0)
+    {
+        *Mode = ModeDma;
+    }
+    else if (stats.IsrCount != 0)
+    {
+        *Mode = ModeInterrupt;
+    }
+    else
+    {
+        *Mode = ModePoll;
+    }
+
+    printf("  %s: %.1f us, %llu register reads, %llu writes, %llu ISRs, %llu DPCs, %llu DMA words, %llu MDL mappings\n",
+        Case.Name, (SpiSimNow() - start) / 1e3, (unsigned long long)stats.RegisterReads,
+        (unsigned long long)stats.RegisterWrites, (unsigned long long)stats.IsrCount,
+        (unsigned long long)stats.DpcCount, (unsigned long long)stats.DmaWords,
+        (unsigned long long)stats.MdlMappings);
+    return pass;
+}
+
+//
+// Writes 1000 bytes at 1 MHz, which the driver moves with DMA when it
+// has DMA channels, and checks which channels it accessed.
+//
+
+bool CheckDmaChannels(ULONG TxChannel, ULONG RxChannel, bool DmaExpected)
+{
+    const REQUEST_CASE& dmaCase = RequestCases[4];
+    SPBTARGET target = SpiSimConnectTarget(dmaCase.ChipSelect, dmaCase.ConnectionSpeed);
+    if (target == nullptr)
+    {
+        printf("  could not connect a target\n");
+        return false;
+    }
+
+    TRANSFER_MODE mode;
+    bool pass = RunRequest(dmaCase, target, &mode);
+
+    SPISIM_STATS stats;
+    SpiSimGetStats(&stats);
+    ULONGLONG otherAccesses = DmaAccesses(stats, TxChannel, RxChannel);
+    if (DmaExpected)
+    {
+        if ((mode != ModeDma) || !stats.DmaChannelStarts[TxChannel] || !stats.DmaChannelStarts[RxChannel] || otherAccesses)
+        {
+            printf("  %s mode, channel %u started %llu times, channel %u %llu times, %llu accesses to other channels\n",
+                ModeNames[mode], TxChannel, (unsigned long long)stats.DmaChannelStarts[TxChannel],
+                RxChannel, (unsigned long long)stats.DmaChannelStarts[RxChannel], (unsigned long long)otherAccesses);
+            pass = false;
+        }
+    }
+    else if ((mode == ModeDma) || otherAccesses)
+    {
+        printf("  %s mode, %llu DMA channel accesses without DMA\n", ModeNames[mode], (unsigned long long)otherAccesses);
+        pass = false;
+    }
+    return pass;
+}
+
+//
+// The DMA channels come from the two FixedDMA resources, Tx first. Without
+// them, or with a DMA threshold of 0, transfers use the FIFO.
+//
+
+bool TestDmaResources()
+{
+    bool pass = true;
+
+    SPISIM_CONFIG config = DefaultConfig();
+    config.DmaResources[0].Channel = 4;
+    config.DmaResources[1].Channel = 5;
+    if (!CreateDevice(config))
+    {
+        return false;
+    }
+    PPBC_DEVICE pDevice = (PPBC_DEVICE)SpiSimDeviceContext();
+    if ((pDevice->DmaTxChannel != 4) || (pDevice->DmaRxChannel != 5) || (pDevice->pDmaCb == NULL))
+    {
+        printf("  DMA on channels %u/%u, control blocks %p, 4/5 expected\n",
+            pDevice->DmaTxChannel, pDevice->DmaRxChannel, pDevice->pDmaCb);
+        pass = false;
+    }
+    pass = CheckDmaChannels(4, 5, true) && pass;
+    pass = CheckAssertions() && pass;
+    SpiSimDestroy();
+
+    config = DefaultConfig();
+    config.DmaResourceCount = 0;
+    if (!CreateDevice(config))
+    {
+        return false;
+    }
+    pDevice = (PPBC_DEVICE)SpiSimDeviceContext();
+    if (pDevice->pDmaCb != NULL)
+    {
+        printf("  DMA enabled without FixedDMA resources\n");
+        pass = false;
+    }
+    pass = CheckDmaChannels(SPISIM_DMA_CHANNELS, SPISIM_DMA_CHANNELS, false) && pass;
+    pass = CheckAssertions() && pass;
+    SpiSimDestroy();
+
+    config = DefaultConfig();
+    config.DmaThresholdBytes = 0;
+    if (!CreateDevice(config))
+    {
+        return false;
+    }
+    pDevice = (PPBC_DEVICE)SpiSimDeviceContext();
+    if (pDevice->pDmaCb != NULL)
+    {
+        printf("  DMA enabled with a DMA threshold of 0\n");
+        pass = false;
+    }
+    pass = CheckDmaChannels(SPISIM_DMA_CHANNELS, SPISIM_DMA_CHANNELS, false) && pass;
+    pass = CheckAssertions() && pass;
+    SpiSimDestroy();
+
+    return pass;
+}
+
+bool TestInvalidDmaResources(const RESOURCE_CASE& Case)
+{
+    SPISIM_CONFIG config = DefaultConfig();
+    config.DmaResourceCount = Case.DmaResourceCount;
+    memcpy(config.DmaResources, Case.DmaResources, sizeof(config.DmaResources));
+
+    bool pass = true;
+    NTSTATUS status = SpiSimCreate(&config);
+    if (status != STATUS_DEVICE_CONFIGURATION_ERROR)
+    {
+        printf("  device started with 0x%08x, 0x%08x expected\n", status, STATUS_DEVICE_CONFIGURATION_ERROR);
+        pass = false;
+    }
+    pass = CheckAssertions() && pass;
+    SpiSimDestroy();
+    return pass;
+}
+
+//
+// Sends every request case to a device with the default resources.
+//
+
+bool TestRequest(const REQUEST_CASE& Case)
+{
+    if (!CreateDevice(DefaultConfig()))
+    {
+        return false;
+    }
+
+    bool pass = true;
+    SPBTARGET target = SpiSimConnectTarget(Case.ChipSelect, Case.ConnectionSpeed);
+    if (target == nullptr)
+    {
+        printf("  could not connect a target\n");
+        pass = false;
+    }
+    else
+    {
+        TRANSFER_MODE mode;
+        pass = RunRequest(Case, target, &mode);
+        if (mode != Case.Mode)
+        {
+            printf("  transferred in %s mode, %s mode expected\n", ModeNames[mode], ModeNames[Case.Mode]);
+            pass = false;
+        }
+    }
+
+    pass = CheckAssertions() && pass;
+    SpiSimDestroy();
+    return pass;
+}
+
+//
+// Delays of transfers. The time spun before the deadline has to cover the
+// period of the timer the delay sleeps on. KeDelayExecutionThread only
+// expires on a clock tick, so delays falling back to it raise the timer
+// resolution to the minimum while they sleep, and spin no longer than on
+// a high resolution timer. Otherwise the delay overshoots by up to a tick
+// or spins for most of it.
+//
+
+typedef struct _DELAY_CASE
+{
+    const char* Name;
+    BOOLEAN     NoHighResolutionTimer;
+    ULONG       TimerResolution;
+    ULONG       TimerDelays;
+} DELAY_CASE;
+
+const ULONG TransferDelaysUs[] = { 2000, 5000, 20000 };
+const ULONG MaxDelayOvershootUs = 50;
+
+const DELAY_CASE DelayCases[] =
+{
+    { "high resolution timer", FALSE, 0, 3 },
+    { "thread delay at 15.625 ms resolution", TRUE, 156250, 3 },
+    { "thread delay at 1 ms resolution", TRUE, 10000, 3 },
+};
+
+bool TestDelays(const DELAY_CASE& Case)
+{
+    SPISIM_CONFIG config = DefaultConfig();
+    config.NoHighResolutionTimer = Case.NoHighResolutionTimer;
+    config.TimerResolution = Case.TimerResolution;
+    if (!CreateDevice(config))
+    {
+        return false;
+    }
+
+    bool pass = true;
+    SPBTARGET target = SpiSimConnectTarget(0, 4000000);
+    if (target == nullptr)
+    {
+        printf("  could not connect a target\n");
+        pass = false;
+    }
+
+    UCHAR buffer[8] = {};
+    for (ULONG i = 0; (i < ARRAYSIZE(TransferDelaysUs)) && pass; i++)
+    {
+        SPISIM_TRANSFER transfers[2] =
+        {
+            { SpbTransferDirectionToDevice, 0, buffer, 4, 1 },
+            { SpbTransferDirectionToDevice, TransferDelaysUs[i], buffer + 4, 4, 1 },
+        };
+        size_t information;
+        NTSTATUS status = SpiSimRequest(target, SpbRequestTypeSequence, transfers, ARRAYSIZE(transfers), &information);
+        if (!NT_SUCCESS(status))
+        {
+            printf("  request with a delay of %u us completed with 0x%08x\n", TransferDelaysUs[i], status);
+            pass = false;
+        }
+    }
+
+    PPBC_DEVICE pDevice = (PPBC_DEVICE)SpiSimDeviceContext();
+    const PBC_DELAY_STATISTICS& stats = pDevice->DelayStatistics;
+    ULONG maximumTime;
+    ULONG minimumTime;
+    ULONG currentTime;
+    ExQueryTimerResolution(&maximumTime, &minimumTime, &currentTime);
+    printf("  %s: spin %u us, %llu delays, %llu slept first, requested %llu us, measured %llu us, spun %llu us, max overshoot %llu us\n",
+        Case.Name, pDevice->DelaySpinUs, (unsigned long long)stats.DelayCount,
+        (unsigned long long)stats.TimerDelayCount, (unsigned long long)stats.RequestedUs,
+        (unsigned long long)stats.MeasuredUs, (unsigned long long)stats.SpinUs,
+        (unsigned long long)stats.MaxOvershootUs);
+
+    if (pass &&
+        ((stats.DelayCount != ARRAYSIZE(TransferDelaysUs)) ||
+         (stats.TimerDelayCount != Case.TimerDelays) ||
+         (stats.MeasuredUs < stats.RequestedUs) ||
+         (stats.MaxOvershootUs > MaxDelayOvershootUs)))
+    {
+        printf("  %u delays, %u sleeping before the spin, none shorter than requested and none more than %u us longer expected\n",
+            ULONG(ARRAYSIZE(TransferDelaysUs)), Case.TimerDelays, MaxDelayOvershootUs);
+        pass = false;
+    }
+
+    if (pass &&
+        ((pDevice->DelaySpinUs > BCM_SPI_DELAY_SPIN_US + ((minimumTime + 9) / 10)) ||
+         (stats.SpinUs > stats.DelayCount * pDevice->DelaySpinUs)))
+    {
+        printf("  no delay spinning longer than the minimum timer resolution plus %u us expected\n",
+            ULONG(BCM_SPI_DELAY_SPIN_US));
+        pass = false;
+    }
+
+    if (pass && (currentTime != ((Case.TimerResolution != 0) ? Case.TimerResolution : maximumTime)))
+    {
+        printf("  timer resolution of %u00 ns left after the delays\n", currentTime);
+        pass = false;
+    }
+
+    pass = CheckAssertions() && pass;
+    SpiSimDestroy();
+    return pass;
+}
+
+//
+// MdlGetByte and MdlSetByte as device.h had them before MDL_CURSOR. Each
+// call walks the chain from its head and maps the MDL of the byte.
+//
+
+NTSTATUS LegacyMdlGetByte(PMDL Mdl, size_t Index, size_t Length, UCHAR* pByte)
+{
+    size_t currentOffset = Index;
+    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+
+    if (Index < Length)
+    {
+        while (Mdl != NULL)
+        {
+            size_t mdlByteCount = MmGetMdlByteCount(Mdl);
+            if (currentOffset < mdlByteCount)
+            {
+                PUCHAR pBuffer = (PUCHAR)MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+                if (pBuffer != NULL)
+                {
+                    *pByte = pBuffer[currentOffset];
+                    status = STATUS_SUCCESS;
+                }
+                break;
+            }
+            currentOffset -= mdlByteCount;
+            Mdl = Mdl->Next;
+        }
+    }
+    return status;
+}
+
+NTSTATUS LegacyMdlSetByte(PMDL Mdl, size_t Index, size_t Length, UCHAR Byte)
+{
+    size_t currentOffset = Index;
+    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+
+    if (Index < Length)
+    {
+        while (Mdl != NULL)
+        {
+            size_t mdlByteCount = MmGetMdlByteCount(Mdl);
+            if (currentOffset < mdlByteCount)
+            {
+                PUCHAR pBuffer = (PUCHAR)MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+                if (pBuffer != NULL)
+                {
+                    pBuffer[currentOffset] = Byte;
+                    status = STATUS_SUCCESS;
+                }
+                break;
+            }
+            currentOffset -= mdlByteCount;
+            Mdl = Mdl->Next;
+        }
+    }
+    return status;
+}
+
+//
+// Buffer access benchmark. The Tx side moves the transfer buffer to the
+// FIFO, the Rx side the FIFO to the transfer buffer.
+//
+
+const size_t BenchTransferLength = 4096;
+const ULONG BenchMdlCounts[] = { 1, 4, 16 };
+const ULONG BenchPasses = 256;
+
+enum BENCH_METHOD
+{
+    BenchLegacyByte,
+    BenchCursorSpan,
+    BenchCursorCopy
+};
+
+const char* const BenchMethodNames[] =
+{
+    "MdlGetByte/MdlSetByte",
+    "MDL_CURSOR spans",
+    "MDL_CURSOR copy",
+};
+
+volatile UCHAR g_BenchFifo[BCM_SPI_FIFO_BYTE_SIZE];
+UCHAR g_BenchStaging[BenchTransferLength];
+
+//
+// Splits Buffer into MdlCount MDLs of growing size.
+//
+
+PMDL BuildBenchChain(std::vector<MDL>& Mdls, PUCHAR Buffer, size_t Length, ULONG MdlCount)
+{
+    size_t weights = (size_t(MdlCount) * (MdlCount + 1)) / 2;
+    size_t weight = 0;
+    size_t offset = 0;
+
+    Mdls.resize(MdlCount);
+    for (ULONG i = 0; i < MdlCount; i++)
+    {
+        weight += i + 1;
+        size_t end = (Length * weight) / weights;
+        Mdls[i].Next = (i + 1 < MdlCount) ? &Mdls[i + 1] : NULL;
+        Mdls[i].MappedSystemVa = Buffer + offset;
+        Mdls[i].ByteCount = ULONG(end - offset);
+        offset = end;
+    }
+    return &Mdls[0];
+}
+
+VOID BenchTransmit(BENCH_METHOD Method, PMDL Chain, size_t Length)
+{
+    MDL_CURSOR cursor;
+    MdlCursorInitialize(&cursor, Chain);
+
+    switch (Method)
+    {
+    case BenchLegacyByte:
+        for (size_t i = 0; i < Length; i++)
+        {
+            UCHAR byte = 0;
+            (void)LegacyMdlGetByte(Chain, i, Length, &byte);
+            g_BenchFifo[i % BCM_SPI_FIFO_BYTE_SIZE] = byte;
+        }
+        break;
+
+    case BenchCursorSpan:
+        while (Length > 0)
+        {
+            PUCHAR pSpan;
+            size_t spanLength;
+            if (!NT_SUCCESS(MdlCursorGetSpan(&cursor, &pSpan, &spanLength)))
+            {
+                break;
+            }
+            spanLength = min(spanLength, min(Length, size_t(BCM_SPI_FIFO_BYTE_SIZE)));
+            for (size_t i = 0; i < spanLength; i++)
+            {
+                g_BenchFifo[i] = pSpan[i];
+            }
+            MdlCursorAdvance(&cursor, spanLength);
+            Length -= spanLength;
+        }
+        break;
+
+    case BenchCursorCopy:
+        (void)MdlCursorCopyToBuffer(&cursor, g_BenchStaging, Length);
+        break;
+    }
+}
+
+VOID BenchReceive(BENCH_METHOD Method, PMDL Chain, size_t Length)
+{
+    MDL_CURSOR cursor;
+    MdlCursorInitialize(&cursor, Chain);
+
+    switch (Method)
+    {
+    case BenchLegacyByte:
+        for (size_t i = 0; i < Length; i++)
+        {
+            (void)LegacyMdlSetByte(Chain, i, Length, g_BenchFifo[i % BCM_SPI_FIFO_BYTE_SIZE]);
+        }
+        break;
+
+    case BenchCursorSpan:
+        while (Length > 0)
+        {
+            PUCHAR pSpan;
+            size_t spanLength;
+            if (!NT_SUCCESS(MdlCursorGetSpan(&cursor, &pSpan, &spanLength)))
+            {
+                break;
+            }
+            spanLength = min(spanLength, min(Length, size_t(BCM_SPI_FIFO_BYTE_SIZE)));
+            for (size_t i = 0; i < spanLength; i++)
+            {
+                pSpan[i] = g_BenchFifo[i];
+            }
+            MdlCursorAdvance(&cursor, spanLength);
+            Length -= spanLength;
+        }
+        break;
+
+    case BenchCursorCopy:
+        (void)MdlCursorCopyFromBuffer(&cursor, g_BenchStaging, Length);
+        break;
+    }
+}
+
+//
+// Reports the cost per byte and the MmGetSystemAddressForMdlSafe calls
+// per transfer of each way the driver has accessed transfer buffers:
+// the per byte helpers of the original FIFO loop, the spans the FIFO
+// loop streams now, and the copies that stage DMA transfers.
+//
+
+VOID BenchmarkMdlAccess()
+{
+    if (!CreateDevice(DefaultConfig()))
+    {
+        return;
+    }
+
+    const char* unit = SpiSimCycleUnit();
+    std::vector<UCHAR> buffer(BenchTransferLength);
+    std::vector<MDL> mdls;
+
+    printf("MDL buffer access, %zu byte transfers, %s per byte and MDL mappings per transfer\n",
+        BenchTransferLength, unit);
+
+    for (ULONG mdlCount : BenchMdlCounts)
+    {
+        PMDL chain = BuildBenchChain(mdls, buffer.data(), buffer.size(), mdlCount);
+        for (ULONG method = BenchLegacyByte; method <= BenchCursorCopy; method++)
+        {
+            SPISIM_STATS stats;
+
+            SpiSimResetStats();
+            ULONGLONG start = SpiSimReadCycles();
+            for (ULONG pass = 0; pass < BenchPasses; pass++)
+            {
+                BenchTransmit((BENCH_METHOD)method, chain, buffer.size());
+            }
+            double transmitCost = double(SpiSimReadCycles() - start) / (double(BenchPasses) * buffer.size());
+            SpiSimGetStats(&stats);
+            ULONGLONG transmitMappings = stats.MdlMappings / BenchPasses;
+
+            SpiSimResetStats();
+            start = SpiSimReadCycles();
+            for (ULONG pass = 0; pass < BenchPasses; pass++)
+            {
+                BenchReceive((BENCH_METHOD)method, chain, buffer.size());
+            }
+            double receiveCost = double(SpiSimReadCycles() - start) / (double(BenchPasses) * buffer.size());
+            SpiSimGetStats(&stats);
+            ULONGLONG receiveMappings = stats.MdlMappings / BenchPasses;
+
+            printf("  %2u MDLs  %-22s  Tx %7.2f %s, %5llu mappings  Rx %7.2f %s, %5llu mappings\n",
+                mdlCount, BenchMethodNames[method], transmitCost, unit, (unsigned long long)transmitMappings,
+                receiveCost, unit, (unsigned long long)receiveMappings);
+        }
+    }
+
+    SpiSimDestroy();
+}
+
+void Usage()
+{
+    printf(
+        "usage: spitest [--test] [--bench] [--trace LEVEL]\n"
+        "  --test          DMA resources, transfers in every mode and transfer delays\n"
+        "  --bench         transfer buffer access through MDL chains\n"
+        "  --trace LEVEL   print the SPI driver traces up to LEVEL\n");
+}
+
+} // namespace
+
+int main(int Argc, char** Argv)
+{
+    bool test = false;
+    bool bench = false;
+
+    for (int arg = 1; arg < Argc; arg++)
+    {
+        if (strcmp(Argv[arg], "--test") == 0)
+        {
+            test = true;
+        }
+        else if (strcmp(Argv[arg], "--bench") == 0)
+        {
+            bench = true;
+        }
+        else if ((strcmp(Argv[arg], "--trace") == 0) && (arg + 1 < Argc))
+        {
+            SpiSimSetTraceLevel(strtoul(Argv[++arg], nullptr, 0));
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (!test && !bench)
+    {
+        test = true;
+    }
+
+    bool pass = true;
+    if (test)
+    {
+        bool result = TestDmaResources();
+        printf("%s: DMA channels from FixedDMA resources\n", result ? "PASS" : "FAIL");
+        pass = pass && result;
+
+        for (const RESOURCE_CASE& resourceCase : InvalidResourceCases)
+        {
+            result = TestInvalidDmaResources(resourceCase);
+            printf("%s: %s rejected\n", result ? "PASS" : "FAIL", resourceCase.Name);
+            pass = pass && result;
+        }
+
+        for (const REQUEST_CASE& requestCase : RequestCases)
+        {
+            result = TestRequest(requestCase);
+            printf("%s: %s\n", result ? "PASS" : "FAIL", requestCase.Name);
+            pass = pass && result;
+        }
+
+        for (const DELAY_CASE& delayCase : DelayCases)
+        {
+            result = TestDelays(delayCase);
+            printf("%s: transfer delays on a %s\n", result ? "PASS" : "FAIL", delayCase.Name);
+            pass = pass && result;
+        }
+    }
+
+    if (bench)
+    {
+        BenchmarkMdlAccess();
+    }
+
+    return pass ? 0 : 1;
+}
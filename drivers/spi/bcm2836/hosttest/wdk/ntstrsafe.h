@@ -0,0 +1,12 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Abstract:
+    Host-side test harness stand-in for the WDK header of the same name.
+
+--*/
+
+#pragma once
+
+#include "wdkhost.h"
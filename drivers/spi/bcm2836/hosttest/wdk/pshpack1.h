@@ -0,0 +1,11 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Abstract:
+    Host-side test harness stand-in for the WDK header of the same name.
+    Included once per packed region, so it has no include guard.
+
+--*/
+
+#pragma pack(push, 1)
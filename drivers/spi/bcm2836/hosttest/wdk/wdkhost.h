@@ -0,0 +1,867 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    wdkhost.h
+
+Abstract:
+
+    The subset of the WDK kernel, KMDF and SPBCx headers the SPI0
+    controller driver compiles against. driver.cpp, device.cpp and
+    controller.cpp build unmodified on top of it, the routines are
+    implemented by the simulated system in sim/spisim.cpp. Types keep
+    their Windows widths, so the register and control block layouts
+    of bcmspi.h are the same as on the target.
+
+Environment:
+
+    Host user mode
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//
+// Target version.
+//
+
+#define NTDDI_WINBLUE               0x06030000
+#define NTDDI_WINTHRESHOLD          0x0A000000
+#define NTDDI_VERSION               NTDDI_WINTHRESHOLD
+
+//
+// Compiler keywords.
+//
+
+#define __declspec(x)               __declspec_##x
+#define __declspec_align(n)         __attribute__((aligned(n)))
+#define __forceinline               inline __attribute__((always_inline))
+#define FORCEINLINE                 __forceinline
+
+//
+// SAL annotations.
+//
+
+#define _Use_decl_annotations_
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _In_reads_bytes_(n)
+#define _Out_writes_bytes_(n)
+#define _Outptr_result_bytebuffer_(n)
+#define _Function_class_(n)
+#define _IRQL_requires_same_
+#define __drv_functionClass(n)
+
+//
+// Base types.
+//
+
+typedef void                VOID;
+typedef void*               PVOID;
+typedef char                CHAR;
+typedef CHAR*               PCHAR;
+typedef wchar_t             WCHAR;
+typedef WCHAR*              PWCH;
+typedef unsigned char       UCHAR;
+typedef UCHAR*              PUCHAR;
+typedef int16_t             SHORT;
+typedef uint16_t            USHORT;
+typedef int32_t             LONG;
+typedef LONG*               PLONG;
+typedef uint32_t            ULONG;
+typedef ULONG*              PULONG;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef uint8_t             UINT8;
+typedef uint32_t            UINT32;
+typedef uintptr_t           ULONG_PTR;
+typedef ULONG_PTR           SIZE_T;
+typedef ULONG_PTR           KAFFINITY;
+typedef UCHAR               BOOLEAN;
+typedef UCHAR               KIRQL;
+typedef LONG                NTSTATUS;
+typedef LONG                KPRIORITY;
+typedef ULONG               ACCESS_MASK;
+typedef PVOID               HANDLE;
+typedef HANDLE*             PHANDLE;
+
+#ifndef NULL
+#define NULL                0
+#endif
+#define TRUE                1
+#define FALSE               0
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef LARGE_INTEGER PHYSICAL_ADDRESS, *PPHYSICAL_ADDRESS;
+
+typedef struct _GUID {
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+typedef const GUID* LPCGUID;
+
+inline bool IsEqualGUID(const GUID& A, const GUID& B)
+{
+    return memcmp(&A, &B, sizeof(GUID)) == 0;
+}
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define DECLARE_CONST_UNICODE_STRING(_var, _string) \
+    const UNICODE_STRING _var = { sizeof(_string) - sizeof(WCHAR), sizeof(_string), (PWCH)_string }
+
+//
+// Helper macros.
+//
+
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+#define FIELD_OFFSET(t, f)          ((LONG)offsetof(t, f))
+#define ARRAYSIZE(a)                (sizeof(a) / sizeof((a)[0]))
+#define RtlCopyMemory(d, s, l)      memcpy((d), (s), (l))
+#define RtlZeroMemory(d, l)         memset((d), 0, (l))
+
+#ifndef min
+#define min(a, b)                   (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)                   (((a) > (b)) ? (a) : (b))
+#endif
+
+#define PAGE_SIZE                   0x1000
+#define ROUND_TO_PAGES(s)           (((ULONG_PTR)(s) + PAGE_SIZE - 1) & ~((ULONG_PTR)PAGE_SIZE - 1))
+
+//
+// Status codes.
+//
+
+#define NT_SUCCESS(s)                       (((NTSTATUS)(s)) >= 0)
+#define NT_ERROR(s)                         ((((ULONG)(s)) >> 30) == 3)
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103L)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_INFO_LENGTH_MISMATCH         ((NTSTATUS)0xC0000004L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BBL)
+#define STATUS_CANCELLED                    ((NTSTATUS)0xC0000120L)
+#define STATUS_DEVICE_CONFIGURATION_ERROR   ((NTSTATUS)0xC0000182L)
+#define STATUS_IO_DEVICE_ERROR              ((NTSTATUS)0xC0000185L)
+#define STATUS_IO_TIMEOUT                   ((NTSTATUS)0xC00000B5L)
+
+//
+// Assertions, counted and reported by the simulation.
+//
+
+VOID SimAssertionFailure(const char* Expression, const char* File, int Line);
+
+#define NT_ASSERT(e) \
+    ((void)((e) ? 0 : (SimAssertionFailure(#e, __FILE__, __LINE__), 0)))
+#define NT_ASSERTMSG(m, e) \
+    ((void)((e) ? 0 : (SimAssertionFailure(m, __FILE__, __LINE__), 0)))
+
+//
+// Register access. Every access is routed to the simulated devices and
+// charged to the simulated CPU.
+//
+
+ULONG READ_REGISTER_ULONG(volatile ULONG* Register);
+VOID WRITE_REGISTER_ULONG(volatile ULONG* Register, ULONG Value);
+ULONG READ_REGISTER_NOFENCE_ULONG(volatile ULONG* Register);
+VOID WRITE_REGISTER_NOFENCE_ULONG(volatile ULONG* Register, ULONG Value);
+
+#define KeMemoryBarrier()           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+VOID SimYieldProcessor();
+
+#define YieldProcessor()            SimYieldProcessor()
+
+inline LONG InterlockedOr(volatile LONG* Destination, LONG Value)
+{
+    return __atomic_fetch_or(Destination, Value, __ATOMIC_SEQ_CST);
+}
+
+//
+// Memory manager.
+//
+
+typedef enum _MEMORY_CACHING_TYPE {
+    MmNonCached = 0,
+    MmCached = 1
+} MEMORY_CACHING_TYPE;
+
+typedef enum _MM_PAGE_PRIORITY {
+    LowPagePriority = 0,
+    NormalPagePriority = 16,
+    HighPagePriority = 32
+} MM_PAGE_PRIORITY;
+
+typedef ULONG NODE_REQUIREMENT;
+
+#define MM_ANY_NODE_OK              0x80000000
+#define PAGE_READWRITE              0x04
+#define PAGE_NOCACHE                0x200
+
+typedef struct _MDL {
+    struct _MDL* Next;
+    PVOID MappedSystemVa;
+    ULONG ByteCount;
+} MDL, *PMDL;
+
+#define MmGetMdlByteCount(Mdl)      ((Mdl)->ByteCount)
+
+PVOID MmGetSystemAddressForMdlSafe(PMDL Mdl, ULONG Priority);
+PVOID MmMapIoSpace(PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, MEMORY_CACHING_TYPE CacheType);
+PVOID MmMapIoSpaceEx(PHYSICAL_ADDRESS PhysicalAddress, SIZE_T NumberOfBytes, ULONG Protect);
+VOID MmUnmapIoSpace(PVOID BaseAddress, SIZE_T NumberOfBytes);
+PVOID MmAllocateContiguousNodeMemory(SIZE_T NumberOfBytes, PHYSICAL_ADDRESS LowestAcceptableAddress,
+    PHYSICAL_ADDRESS HighestAcceptableAddress, PHYSICAL_ADDRESS BoundaryAddressMultiple, ULONG Protect,
+    NODE_REQUIREMENT PreferredNode);
+VOID MmFreeContiguousMemory(PVOID BaseAddress);
+PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID BaseAddress);
+
+//
+// Dispatcher objects, threads and timing.
+//
+
+#define PASSIVE_LEVEL               0
+#define DISPATCH_LEVEL              2
+#define IO_NO_INCREMENT             0
+#define ALL_PROCESSOR_GROUPS        0xffff
+
+typedef struct _DISPATCHER_HEADER {
+    UCHAR Type;
+    LONG SignalState;
+} DISPATCHER_HEADER;
+
+typedef enum _EVENT_TYPE {
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+typedef struct _KEVENT {
+    DISPATCHER_HEADER Header;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef enum _KWAIT_REASON {
+    Executive
+} KWAIT_REASON;
+
+typedef enum _MODE {
+    KernelMode,
+    UserMode
+} KPROCESSOR_MODE;
+
+typedef struct _PROCESSOR_NUMBER {
+    USHORT Group;
+    UCHAR Number;
+    UCHAR Reserved;
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+KIRQL KeGetCurrentIrql();
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State);
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait);
+VOID KeClearEvent(PRKEVENT Event);
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable, PLARGE_INTEGER Timeout);
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval);
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency);
+VOID KeStallExecutionProcessor(ULONG MicroSeconds);
+VOID KeFlushQueuedDpcs();
+ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER ProcNumber);
+ULONG KeQueryActiveProcessorCountEx(USHORT GroupNumber);
+KAFFINITY KeSetSystemAffinityThreadEx(KAFFINITY Affinity);
+VOID KeRevertToUserAffinityThreadEx(KAFFINITY Affinity);
+
+typedef struct _EX_TIMER* PEX_TIMER;
+typedef struct _EXT_SET_PARAMETERS_V0* PEXT_SET_PARAMETERS;
+typedef struct _EXT_DELETE_PARAMETERS* PEXT_DELETE_PARAMETERS;
+typedef VOID EXT_CALLBACK(PEX_TIMER Timer, PVOID Context);
+typedef EXT_CALLBACK* PEXT_CALLBACK;
+
+#define EX_TIMER_HIGH_RESOLUTION    0x4
+
+PEX_TIMER ExAllocateTimer(PEXT_CALLBACK Callback, PVOID CallbackContext, ULONG Attributes);
+BOOLEAN ExSetTimer(PEX_TIMER Timer, LONGLONG DueTime, LONGLONG Period, PEXT_SET_PARAMETERS Parameters);
+BOOLEAN ExDeleteTimer(PEX_TIMER Timer, BOOLEAN Cancel, BOOLEAN Wait, PEXT_DELETE_PARAMETERS Parameters);
+ULONG ExQueryTimerResolution(PULONG MaximumTime, PULONG MinimumTime, PULONG CurrentTime);
+ULONG ExSetTimerResolution(ULONG DesiredTime, BOOLEAN SetResolution);
+
+typedef VOID KSTART_ROUTINE(PVOID StartContext);
+typedef KSTART_ROUTINE* PKSTART_ROUTINE;
+
+typedef struct _OBJECT_ATTRIBUTES {
+    ULONG Length;
+    HANDLE RootDirectory;
+    PUNICODE_STRING ObjectName;
+    ULONG Attributes;
+    PVOID SecurityDescriptor;
+    PVOID SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+typedef struct _CLIENT_ID* PCLIENT_ID;
+typedef struct _OBJECT_TYPE* POBJECT_TYPE;
+typedef struct _OBJECT_HANDLE_INFORMATION* POBJECT_HANDLE_INFORMATION;
+
+#define OBJ_KERNEL_HANDLE           0x00000200
+#define THREAD_ALL_ACCESS           0x001fffff
+
+#define InitializeObjectAttributes(p, n, a, r, s) \
+    { (p)->Length = sizeof(OBJECT_ATTRIBUTES); (p)->RootDirectory = r; (p)->Attributes = a; \
+      (p)->ObjectName = n; (p)->SecurityDescriptor = s; (p)->SecurityQualityOfService = NULL; }
+
+NTSTATUS PsCreateSystemThread(PHANDLE ThreadHandle, ULONG DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes,
+    HANDLE ProcessHandle, PCLIENT_ID ClientId, PKSTART_ROUTINE StartRoutine, PVOID StartContext);
+NTSTATUS ObReferenceObjectByHandle(HANDLE Handle, ACCESS_MASK DesiredAccess, POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode, PVOID* Object, POBJECT_HANDLE_INFORMATION HandleInformation);
+VOID ObDereferenceObject(PVOID Object);
+NTSTATUS ZwClose(HANDLE Handle);
+
+//
+// Power manager.
+//
+
+typedef struct _DEVICE_OBJECT* PDEVICE_OBJECT;
+typedef struct _DRIVER_OBJECT* PDRIVER_OBJECT;
+
+typedef NTSTATUS POWER_SETTING_CALLBACK(LPCGUID SettingGuid, PVOID Value, ULONG ValueLength, PVOID Context);
+typedef POWER_SETTING_CALLBACK* PPOWER_SETTING_CALLBACK;
+
+extern const GUID GUID_MONITOR_POWER_ON;
+
+NTSTATUS PoRegisterPowerSettingCallback(PDEVICE_OBJECT DeviceObject, LPCGUID SettingGuid,
+    PPOWER_SETTING_CALLBACK Callback, PVOID Context, PVOID* Handle);
+NTSTATUS PoUnregisterPowerSettingCallback(PVOID Handle);
+
+//
+// Resource descriptors.
+//
+
+#define CmResourceTypeNull          0
+#define CmResourceTypePort          1
+#define CmResourceTypeInterrupt     2
+#define CmResourceTypeMemory        3
+#define CmResourceTypeDma           4
+
+typedef enum _DMA_WIDTH {
+    Width8Bits,
+    Width16Bits,
+    Width32Bits,
+    Width64Bits,
+    WidthNoWrap,
+    MaximumDmaWidth
+} DMA_WIDTH;
+
+#include "pshpack4.h"
+
+typedef struct _CM_PARTIAL_RESOURCE_DESCRIPTOR {
+    UCHAR Type;
+    UCHAR ShareDisposition;
+    USHORT Flags;
+    union {
+        struct {
+            PHYSICAL_ADDRESS Start;
+            ULONG Length;
+        } Memory;
+        struct {
+            ULONG Level;
+            ULONG Vector;
+            KAFFINITY Affinity;
+        } Interrupt;
+        struct {
+            ULONG Channel;
+            ULONG RequestLine;
+            UCHAR TransferWidth;
+            UCHAR Reserved1;
+            UCHAR Reserved2;
+            UCHAR Reserved3;
+        } DmaV3;
+    } u;
+} CM_PARTIAL_RESOURCE_DESCRIPTOR, *PCM_PARTIAL_RESOURCE_DESCRIPTOR;
+
+#include "poppack.h"
+
+//
+// WPP tracing. Trace prints at the level selected by the harness, the
+// WPP format extensions are translated by SimTrace.
+//
+
+#define TRACE_LEVEL_NONE            0
+#define TRACE_LEVEL_CRITICAL        1
+#define TRACE_LEVEL_ERROR           2
+#define TRACE_LEVEL_WARNING         3
+#define TRACE_LEVEL_INFORMATION     4
+#define TRACE_LEVEL_VERBOSE         5
+
+VOID SimTrace(ULONG Level, const char* Format, ...);
+
+#define Trace(Level, Flags, ...)    SimTrace((Level), __VA_ARGS__)
+#define FuncEntry(Flags)
+#define FuncExit(Flags)
+#define WPP_INIT_TRACING(d, r)      UNREFERENCED_PARAMETER(r)
+#define WPP_CLEANUP(d)
+
+//
+// KMDF handles, object attributes and contexts.
+//
+
+typedef PVOID WDFOBJECT;
+typedef struct WDFDRIVER__* WDFDRIVER;
+typedef struct WDFDEVICE__* WDFDEVICE;
+typedef struct WDFREQUEST__* WDFREQUEST;
+typedef struct WDFINTERRUPT__* WDFINTERRUPT;
+typedef struct WDFSPINLOCK__* WDFSPINLOCK;
+typedef struct WDFKEY__* WDFKEY;
+typedef struct WDFCMRESLIST__* WDFCMRESLIST;
+typedef struct WDFDEVICE_INIT* PWDFDEVICE_INIT;
+
+typedef struct _WDF_OBJECT_CONTEXT_TYPE_INFO {
+    const char* ContextName;
+    size_t ContextSize;
+} WDF_OBJECT_CONTEXT_TYPE_INFO, *PWDF_OBJECT_CONTEXT_TYPE_INFO;
+
+typedef VOID EVT_WDF_OBJECT_CONTEXT_CLEANUP(WDFOBJECT Object);
+typedef EVT_WDF_OBJECT_CONTEXT_CLEANUP* PFN_WDF_OBJECT_CONTEXT_CLEANUP;
+typedef EVT_WDF_OBJECT_CONTEXT_CLEANUP EVT_WDF_DEVICE_CONTEXT_CLEANUP;
+
+typedef struct _WDF_OBJECT_ATTRIBUTES {
+    ULONG Size;
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP EvtCleanupCallback;
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP EvtDestroyCallback;
+    WDFOBJECT ParentObject;
+    size_t ContextSizeOverride;
+    const WDF_OBJECT_CONTEXT_TYPE_INFO* ContextTypeInfo;
+} WDF_OBJECT_ATTRIBUTES, *PWDF_OBJECT_ATTRIBUTES;
+
+#define WDF_NO_OBJECT_ATTRIBUTES    NULL
+
+inline VOID WDF_OBJECT_ATTRIBUTES_INIT(PWDF_OBJECT_ATTRIBUTES Attributes)
+{
+    RtlZeroMemory(Attributes, sizeof(WDF_OBJECT_ATTRIBUTES));
+    Attributes->Size = sizeof(WDF_OBJECT_ATTRIBUTES);
+}
+
+PVOID SimGetObjectContext(WDFOBJECT Handle, const WDF_OBJECT_CONTEXT_TYPE_INFO* TypeInfo);
+
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(type, name) \
+    inline const WDF_OBJECT_CONTEXT_TYPE_INFO WDF_CONTEXT_TYPE_##type##_INFO = { #type, sizeof(type) }; \
+    inline type* name(WDFOBJECT Handle) \
+    { return (type*)SimGetObjectContext(Handle, &WDF_CONTEXT_TYPE_##type##_INFO); }
+
+#define WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(a, type) \
+    (WDF_OBJECT_ATTRIBUTES_INIT(a), (a)->ContextTypeInfo = &WDF_CONTEXT_TYPE_##type##_INFO)
+
+#define WDF_REL_TIMEOUT_IN_US(us)   (-((LONGLONG)(us) * 10))
+
+typedef enum _WDF_TRI_STATE {
+    WdfFalse = 0,
+    WdfTrue = 1,
+    WdfUseDefault = 2
+} WDF_TRI_STATE;
+
+//
+// Driver and device.
+//
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+typedef NTSTATUS EVT_WDF_DRIVER_DEVICE_ADD(WDFDRIVER Driver, PWDFDEVICE_INIT DeviceInit);
+typedef EVT_WDF_DRIVER_DEVICE_ADD* PFN_WDF_DRIVER_DEVICE_ADD;
+
+typedef struct _WDF_DRIVER_CONFIG {
+    ULONG Size;
+    PFN_WDF_DRIVER_DEVICE_ADD EvtDriverDeviceAdd;
+    PVOID EvtDriverUnload;
+    ULONG DriverInitFlags;
+    ULONG DriverPoolTag;
+} WDF_DRIVER_CONFIG, *PWDF_DRIVER_CONFIG;
+
+inline VOID WDF_DRIVER_CONFIG_INIT(PWDF_DRIVER_CONFIG Config, PFN_WDF_DRIVER_DEVICE_ADD EvtDriverDeviceAdd)
+{
+    RtlZeroMemory(Config, sizeof(WDF_DRIVER_CONFIG));
+    Config->Size = sizeof(WDF_DRIVER_CONFIG);
+    Config->EvtDriverDeviceAdd = EvtDriverDeviceAdd;
+}
+
+NTSTATUS WdfDriverCreate(PDRIVER_OBJECT DriverObject, PCUNICODE_STRING RegistryPath,
+    PWDF_OBJECT_ATTRIBUTES DriverAttributes, PWDF_DRIVER_CONFIG DriverConfig, WDFDRIVER* Driver);
+
+typedef enum _WDF_POWER_DEVICE_STATE {
+    WdfPowerDeviceInvalid = 0,
+    WdfPowerDeviceD0,
+    WdfPowerDeviceD1,
+    WdfPowerDeviceD2,
+    WdfPowerDeviceD3,
+    WdfPowerDeviceD3Final,
+    WdfPowerDevicePrepareForHibernation,
+    WdfPowerDeviceMaximum
+} WDF_POWER_DEVICE_STATE;
+
+typedef NTSTATUS EVT_WDF_DEVICE_PREPARE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesRaw,
+    WDFCMRESLIST ResourcesTranslated);
+typedef NTSTATUS EVT_WDF_DEVICE_RELEASE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesTranslated);
+typedef NTSTATUS EVT_WDF_DEVICE_D0_ENTRY(WDFDEVICE Device, WDF_POWER_DEVICE_STATE PreviousState);
+typedef NTSTATUS EVT_WDF_DEVICE_D0_EXIT(WDFDEVICE Device, WDF_POWER_DEVICE_STATE TargetState);
+typedef NTSTATUS EVT_WDF_DEVICE_SELF_MANAGED_IO_INIT(WDFDEVICE Device);
+typedef VOID EVT_WDF_DEVICE_SELF_MANAGED_IO_CLEANUP(WDFDEVICE Device);
+
+typedef struct _WDF_PNPPOWER_EVENT_CALLBACKS {
+    ULONG Size;
+    EVT_WDF_DEVICE_D0_ENTRY* EvtDeviceD0Entry;
+    EVT_WDF_DEVICE_D0_EXIT* EvtDeviceD0Exit;
+    EVT_WDF_DEVICE_PREPARE_HARDWARE* EvtDevicePrepareHardware;
+    EVT_WDF_DEVICE_RELEASE_HARDWARE* EvtDeviceReleaseHardware;
+    EVT_WDF_DEVICE_SELF_MANAGED_IO_INIT* EvtDeviceSelfManagedIoInit;
+    EVT_WDF_DEVICE_SELF_MANAGED_IO_CLEANUP* EvtDeviceSelfManagedIoCleanup;
+} WDF_PNPPOWER_EVENT_CALLBACKS, *PWDF_PNPPOWER_EVENT_CALLBACKS;
+
+inline VOID WDF_PNPPOWER_EVENT_CALLBACKS_INIT(PWDF_PNPPOWER_EVENT_CALLBACKS Callbacks)
+{
+    RtlZeroMemory(Callbacks, sizeof(WDF_PNPPOWER_EVENT_CALLBACKS));
+    Callbacks->Size = sizeof(WDF_PNPPOWER_EVENT_CALLBACKS);
+}
+
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(PWDFDEVICE_INIT DeviceInit,
+    PWDF_PNPPOWER_EVENT_CALLBACKS PnpPowerEventCallbacks);
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* DeviceInit, PWDF_OBJECT_ATTRIBUTES DeviceAttributes, WDFDEVICE* Device);
+PDEVICE_OBJECT WdfDeviceWdmGetDeviceObject(WDFDEVICE Device);
+
+typedef struct _WDF_DEVICE_STATE {
+    ULONG Size;
+    WDF_TRI_STATE Disabled;
+    WDF_TRI_STATE DontDisplayInUI;
+    WDF_TRI_STATE Failed;
+    WDF_TRI_STATE NotDisableable;
+    WDF_TRI_STATE Removed;
+    WDF_TRI_STATE ResourcesChanged;
+} WDF_DEVICE_STATE, *PWDF_DEVICE_STATE;
+
+inline VOID WDF_DEVICE_STATE_INIT(PWDF_DEVICE_STATE PnpDeviceState)
+{
+    RtlZeroMemory(PnpDeviceState, sizeof(WDF_DEVICE_STATE));
+    PnpDeviceState->Size = sizeof(WDF_DEVICE_STATE);
+    PnpDeviceState->Disabled = WdfUseDefault;
+    PnpDeviceState->DontDisplayInUI = WdfUseDefault;
+    PnpDeviceState->Failed = WdfUseDefault;
+    PnpDeviceState->NotDisableable = WdfUseDefault;
+    PnpDeviceState->Removed = WdfUseDefault;
+    PnpDeviceState->ResourcesChanged = WdfUseDefault;
+}
+
+VOID WdfDeviceSetDeviceState(WDFDEVICE Device, PWDF_DEVICE_STATE DeviceState);
+
+typedef enum _WDF_POWER_POLICY_S0_IDLE_CAPABILITIES {
+    IdleCapsInvalid = 0,
+    IdleCannotWakeFromS0,
+    IdleCanWakeFromS0,
+    IdleUsbSelectiveSuspend
+} WDF_POWER_POLICY_S0_IDLE_CAPABILITIES;
+
+typedef enum _WDF_POWER_POLICY_IDLE_TIMEOUT_TYPE {
+    DriverManagedIdleTimeout = 0,
+    SystemManagedIdleTimeout,
+    SystemManagedIdleTimeoutWithHint
+} WDF_POWER_POLICY_IDLE_TIMEOUT_TYPE;
+
+typedef struct _WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS {
+    ULONG Size;
+    WDF_POWER_POLICY_S0_IDLE_CAPABILITIES IdleCaps;
+    ULONG IdleTimeout;
+    WDF_POWER_POLICY_IDLE_TIMEOUT_TYPE IdleTimeoutType;
+} WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS, *PWDF_DEVICE_POWER_POLICY_IDLE_SETTINGS;
+
+inline VOID WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS_INIT(PWDF_DEVICE_POWER_POLICY_IDLE_SETTINGS Settings,
+    WDF_POWER_POLICY_S0_IDLE_CAPABILITIES IdleCaps)
+{
+    RtlZeroMemory(Settings, sizeof(WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS));
+    Settings->Size = sizeof(WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS);
+    Settings->IdleCaps = IdleCaps;
+}
+
+NTSTATUS WdfDeviceAssignS0IdleSettings(WDFDEVICE Device, PWDF_DEVICE_POWER_POLICY_IDLE_SETTINGS Settings);
+
+//
+// Resource lists and registry.
+//
+
+ULONG WdfCmResourceListGetCount(WDFCMRESLIST List);
+PCM_PARTIAL_RESOURCE_DESCRIPTOR WdfCmResourceListGetDescriptor(WDFCMRESLIST List, ULONG Index);
+
+#define PLUGPLAY_REGKEY_DEVICE      1
+#define KEY_READ                    0x20019
+
+NTSTATUS WdfDeviceOpenRegistryKey(WDFDEVICE Device, ULONG DeviceInstanceKeyType, ACCESS_MASK DesiredAccess,
+    PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key);
+NTSTATUS WdfRegistryQueryULong(WDFKEY Key, PCUNICODE_STRING ValueName, PULONG Value);
+VOID WdfRegistryClose(WDFKEY Key);
+
+//
+// Spin locks and interrupts.
+//
+
+NTSTATUS WdfSpinLockCreate(PWDF_OBJECT_ATTRIBUTES SpinLockAttributes, WDFSPINLOCK* SpinLock);
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock);
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock);
+
+typedef BOOLEAN EVT_WDF_INTERRUPT_ISR(WDFINTERRUPT Interrupt, ULONG MessageID);
+typedef VOID EVT_WDF_INTERRUPT_DPC(WDFINTERRUPT Interrupt, WDFOBJECT AssociatedObject);
+
+typedef struct _WDF_INTERRUPT_CONFIG {
+    ULONG Size;
+    WDFSPINLOCK SpinLock;
+    WDF_TRI_STATE ShareVector;
+    BOOLEAN FloatingSave;
+    BOOLEAN AutomaticSerialization;
+    EVT_WDF_INTERRUPT_ISR* EvtInterruptIsr;
+    EVT_WDF_INTERRUPT_DPC* EvtInterruptDpc;
+} WDF_INTERRUPT_CONFIG, *PWDF_INTERRUPT_CONFIG;
+
+inline VOID WDF_INTERRUPT_CONFIG_INIT(PWDF_INTERRUPT_CONFIG Configuration,
+    EVT_WDF_INTERRUPT_ISR* EvtInterruptIsr, EVT_WDF_INTERRUPT_DPC* EvtInterruptDpc)
+{
+    RtlZeroMemory(Configuration, sizeof(WDF_INTERRUPT_CONFIG));
+    Configuration->Size = sizeof(WDF_INTERRUPT_CONFIG);
+    Configuration->ShareVector = WdfUseDefault;
+    Configuration->EvtInterruptIsr = EvtInterruptIsr;
+    Configuration->EvtInterruptDpc = EvtInterruptDpc;
+}
+
+NTSTATUS WdfInterruptCreate(WDFDEVICE Device, PWDF_INTERRUPT_CONFIG Configuration,
+    PWDF_OBJECT_ATTRIBUTES Attributes, WDFINTERRUPT* Interrupt);
+VOID WdfInterruptAcquireLock(WDFINTERRUPT Interrupt);
+VOID WdfInterruptReleaseLock(WDFINTERRUPT Interrupt);
+BOOLEAN WdfInterruptQueueDpcForIsr(WDFINTERRUPT Interrupt);
+WDFDEVICE WdfInterruptGetDevice(WDFINTERRUPT Interrupt);
+
+//
+// Requests.
+//
+
+typedef enum _WDF_REQUEST_TYPE {
+    WdfRequestTypeCreate = 0x0,
+    WdfRequestTypeRead = 0x3,
+    WdfRequestTypeWrite = 0x4,
+    WdfRequestTypeDeviceControl = 0xE,
+    WdfRequestTypeDeviceControlInternal = 0xF
+} WDF_REQUEST_TYPE;
+
+typedef struct _WDF_REQUEST_PARAMETERS {
+    USHORT Size;
+    UCHAR MinorFunction;
+    WDF_REQUEST_TYPE Type;
+    union {
+        struct {
+            size_t OutputBufferLength;
+            size_t InputBufferLength;
+            ULONG IoControlCode;
+            PVOID Type3InputBuffer;
+        } DeviceIoControl;
+    } Parameters;
+} WDF_REQUEST_PARAMETERS, *PWDF_REQUEST_PARAMETERS;
+
+inline VOID WDF_REQUEST_PARAMETERS_INIT(PWDF_REQUEST_PARAMETERS Parameters)
+{
+    RtlZeroMemory(Parameters, sizeof(WDF_REQUEST_PARAMETERS));
+    Parameters->Size = sizeof(WDF_REQUEST_PARAMETERS);
+}
+
+typedef VOID EVT_WDF_REQUEST_CANCEL(WDFREQUEST Request);
+typedef VOID EVT_WDF_IO_IN_CALLER_CONTEXT(WDFDEVICE Device, WDFREQUEST Request);
+typedef EVT_WDF_IO_IN_CALLER_CONTEXT* PFN_WDF_IO_IN_CALLER_CONTEXT;
+
+typedef enum _WDF_IO_QUEUE_DISPATCH_TYPE {
+    WdfIoQueueDispatchInvalid = 0,
+    WdfIoQueueDispatchSequential,
+    WdfIoQueueDispatchParallel,
+    WdfIoQueueDispatchManual
+} WDF_IO_QUEUE_DISPATCH_TYPE;
+
+VOID WdfRequestGetParameters(WDFREQUEST Request, PWDF_REQUEST_PARAMETERS Parameters);
+BOOLEAN WdfRequestIsCanceled(WDFREQUEST Request);
+VOID WdfRequestSetInformation(WDFREQUEST Request, ULONG_PTR Information);
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status);
+NTSTATUS WdfDeviceEnqueueRequest(WDFDEVICE Device, WDFREQUEST Request);
+
+//
+// SPB framework extension.
+//
+
+typedef struct SPBTARGET__* SPBTARGET;
+typedef WDFREQUEST SPBREQUEST;
+
+typedef enum SPB_TRANSFER_DIRECTION {
+    SpbTransferDirectionNone = 0,
+    SpbTransferDirectionFromDevice,
+    SpbTransferDirectionToDevice,
+    SpbTransferDirectionMax
+} SPB_TRANSFER_DIRECTION;
+
+typedef enum SPB_REQUEST_TYPE {
+    SpbRequestTypeUndefined = 0,
+    SpbRequestTypeRead,
+    SpbRequestTypeWrite,
+    SpbRequestTypeSequence,
+    SpbRequestTypeLockController,
+    SpbRequestTypeUnlockController,
+    SpbRequestTypeLockConnection,
+    SpbRequestTypeUnlockConnection,
+    SpbRequestTypeOther,
+    SpbRequestTypeMax
+} SPB_REQUEST_TYPE;
+
+typedef enum SPB_REQUEST_SEQUENCE_POSITION {
+    SpbRequestSequencePositionInvalid = 0,
+    SpbRequestSequencePositionSingle,
+    SpbRequestSequencePositionFirst,
+    SpbRequestSequencePositionContinue,
+    SpbRequestSequencePositionLast,
+    SpbRequestSequencePositionMax
+} SPB_REQUEST_SEQUENCE_POSITION;
+
+#define FILE_DEVICE_CONTROLLER      0x00000004
+#define METHOD_BUFFERED             0
+#define FILE_ANY_ACCESS             0
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+typedef enum SpbIoctl {
+    IOCTL_SPB_LOCK_CONTROLLER = CTL_CODE(FILE_DEVICE_CONTROLLER, 0x100, METHOD_BUFFERED, FILE_ANY_ACCESS),
+    IOCTL_SPB_UNLOCK_CONTROLLER = CTL_CODE(FILE_DEVICE_CONTROLLER, 0x101, METHOD_BUFFERED, FILE_ANY_ACCESS),
+    IOCTL_SPB_EXECUTE_SEQUENCE = CTL_CODE(FILE_DEVICE_CONTROLLER, 0x102, METHOD_BUFFERED, FILE_ANY_ACCESS),
+    IOCTL_SPB_LOCK_CONNECTION = CTL_CODE(FILE_DEVICE_CONTROLLER, 0x103, METHOD_BUFFERED, FILE_ANY_ACCESS),
+    IOCTL_SPB_UNLOCK_CONNECTION = CTL_CODE(FILE_DEVICE_CONTROLLER, 0x104, METHOD_BUFFERED, FILE_ANY_ACCESS),
+    IOCTL_SPB_FULL_DUPLEX = CTL_CODE(FILE_DEVICE_CONTROLLER, 0x112, METHOD_BUFFERED, FILE_ANY_ACCESS)
+} SpbIoctl;
+
+typedef struct _SPB_CONNECTION_PARAMETERS {
+    ULONG Size;
+    PVOID ConnectionParameters;
+} SPB_CONNECTION_PARAMETERS, *PSPB_CONNECTION_PARAMETERS;
+
+inline VOID SPB_CONNECTION_PARAMETERS_INIT(PSPB_CONNECTION_PARAMETERS Parameters)
+{
+    RtlZeroMemory(Parameters, sizeof(SPB_CONNECTION_PARAMETERS));
+    Parameters->Size = sizeof(SPB_CONNECTION_PARAMETERS);
+}
+
+typedef struct _SPB_REQUEST_PARAMETERS {
+    ULONG Size;
+    SPB_REQUEST_SEQUENCE_POSITION Position;
+    SPB_REQUEST_TYPE Type;
+    size_t Length;
+    ULONG SequenceTransferCount;
+} SPB_REQUEST_PARAMETERS, *PSPB_REQUEST_PARAMETERS;
+
+inline VOID SPB_REQUEST_PARAMETERS_INIT(PSPB_REQUEST_PARAMETERS Parameters)
+{
+    RtlZeroMemory(Parameters, sizeof(SPB_REQUEST_PARAMETERS));
+    Parameters->Size = sizeof(SPB_REQUEST_PARAMETERS);
+}
+
+typedef struct _SPB_TRANSFER_DESCRIPTOR {
+    ULONG Size;
+    SPB_TRANSFER_DIRECTION Direction;
+    ULONG DelayInUs;
+    size_t TransferLength;
+} SPB_TRANSFER_DESCRIPTOR, *PSPB_TRANSFER_DESCRIPTOR;
+
+inline VOID SPB_TRANSFER_DESCRIPTOR_INIT(PSPB_TRANSFER_DESCRIPTOR Descriptor)
+{
+    RtlZeroMemory(Descriptor, sizeof(SPB_TRANSFER_DESCRIPTOR));
+    Descriptor->Size = sizeof(SPB_TRANSFER_DESCRIPTOR);
+}
+
+typedef NTSTATUS EVT_SPB_TARGET_CONNECT(WDFDEVICE Controller, SPBTARGET Target);
+typedef VOID EVT_SPB_CONTROLLER_LOCK(WDFDEVICE Controller, SPBTARGET Target, SPBREQUEST Request);
+typedef VOID EVT_SPB_CONTROLLER_UNLOCK(WDFDEVICE Controller, SPBTARGET Target, SPBREQUEST Request);
+typedef VOID EVT_SPB_CONTROLLER_READ(WDFDEVICE Controller, SPBTARGET Target, SPBREQUEST Request, size_t Length);
+typedef VOID EVT_SPB_CONTROLLER_WRITE(WDFDEVICE Controller, SPBTARGET Target, SPBREQUEST Request, size_t Length);
+typedef VOID EVT_SPB_CONTROLLER_SEQUENCE(WDFDEVICE Controller, SPBTARGET Target, SPBREQUEST Request,
+    ULONG TransferCount);
+typedef VOID EVT_SPB_CONTROLLER_OTHER(WDFDEVICE Controller, SPBTARGET Target, SPBREQUEST Request,
+    size_t OutputBufferLength, size_t InputBufferLength, ULONG IoControlCode);
+typedef EVT_SPB_CONTROLLER_OTHER* PFN_SPB_CONTROLLER_OTHER;
+
+typedef struct _SPB_CONTROLLER_CONFIG {
+    ULONG Size;
+    WDF_IO_QUEUE_DISPATCH_TYPE ControllerDispatchType;
+    WDF_TRI_STATE PowerManaged;
+    EVT_SPB_TARGET_CONNECT* EvtSpbTargetConnect;
+    PVOID EvtSpbTargetDisconnect;
+    EVT_SPB_CONTROLLER_LOCK* EvtSpbControllerLock;
+    EVT_SPB_CONTROLLER_UNLOCK* EvtSpbControllerUnlock;
+    EVT_SPB_CONTROLLER_READ* EvtSpbIoRead;
+    EVT_SPB_CONTROLLER_WRITE* EvtSpbIoWrite;
+    EVT_SPB_CONTROLLER_SEQUENCE* EvtSpbIoSequence;
+} SPB_CONTROLLER_CONFIG, *PSPB_CONTROLLER_CONFIG;
+
+inline VOID SPB_CONTROLLER_CONFIG_INIT(PSPB_CONTROLLER_CONFIG Config)
+{
+    RtlZeroMemory(Config, sizeof(SPB_CONTROLLER_CONFIG));
+    Config->Size = sizeof(SPB_CONTROLLER_CONFIG);
+    Config->ControllerDispatchType = WdfIoQueueDispatchSequential;
+    Config->PowerManaged = WdfUseDefault;
+}
+
+NTSTATUS SpbDeviceInitConfig(PWDFDEVICE_INIT DeviceInit);
+NTSTATUS SpbDeviceInitialize(WDFDEVICE Device, PSPB_CONTROLLER_CONFIG Config);
+VOID SpbControllerSetIoOtherCallback(WDFDEVICE Device, PFN_SPB_CONTROLLER_OTHER EvtSpbIoOther,
+    PFN_WDF_IO_IN_CALLER_CONTEXT EvtIoInCallerContext);
+VOID SpbControllerSetTargetAttributes(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES Attributes);
+VOID SpbControllerSetRequestAttributes(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES Attributes);
+VOID SpbTargetGetConnectionParameters(SPBTARGET Target, PSPB_CONNECTION_PARAMETERS Parameters);
+VOID SpbRequestGetParameters(SPBREQUEST Request, PSPB_REQUEST_PARAMETERS Parameters);
+VOID SpbRequestGetTransferParameters(SPBREQUEST Request, ULONG Index,
+    PSPB_TRANSFER_DESCRIPTOR TransferDescriptor, PMDL* TransferBuffer);
+NTSTATUS SpbRequestCaptureIoOtherTransferList(SPBREQUEST Request);
+VOID SpbRequestComplete(SPBREQUEST Request, NTSTATUS CompletionStatus);
+
+//
+// Resource hub connection properties.
+//
+
+#include "pshpack1.h"
+
+typedef struct _PNP_SERIAL_BUS_DESCRIPTOR {
+    UCHAR Tag;
+    USHORT Length;
+    UCHAR RevisionId;
+    UCHAR ResourceSourceIndex;
+    UCHAR SerialBusType;
+    UCHAR GeneralFlags;
+    USHORT TypeSpecificFlags;
+    UCHAR TypeSpecificRevisionId;
+    USHORT TypeDataLength;
+} PNP_SERIAL_BUS_DESCRIPTOR, *PPNP_SERIAL_BUS_DESCRIPTOR;
+
+typedef struct _RH_QUERY_CONNECTION_PROPERTIES_OUTPUT_BUFFER {
+    ULONG PropertiesLength;
+    UCHAR ConnectionProperties[1];
+} RH_QUERY_CONNECTION_PROPERTIES_OUTPUT_BUFFER, *PRH_QUERY_CONNECTION_PROPERTIES_OUTPUT_BUFFER;
+
+#include "poppack.h"
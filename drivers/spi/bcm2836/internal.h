@@ -123,6 +123,77 @@ typedef struct PBC_TARGET_SETTINGS
 }
 PBC_TARGET_SETTINGS, *PPBC_TARGET_SETTINGS;
 
+//
+// MDL cursor, streams a transfer descriptor buffer front to back.
+// Each MDL of the chain is mapped once when the cursor enters it.
+//
+
+typedef struct _MDL_CURSOR
+{
+    PMDL Mdl;
+    PUCHAR pBuffer;
+    size_t Offset;
+} MDL_CURSOR, *PMDL_CURSOR;
+
+//
+// FIFO state of a PIO transfer, shared by poll and interrupt mode.
+//
+
+typedef struct PBC_FIFO_TRANSFER
+{
+    MDL_CURSOR WriteCursor;
+    MDL_CURSOR ReadCursor;
+    // bytes left in the client write and read buffers
+    size_t BytesToWrite;
+    size_t BytesToRead;
+    // bytes left to put into the Tx FIFO and take from
+    // the Rx FIFO, including padding and discarded bytes
+    size_t BytesToTransmit;
+    size_t BytesToReceive;
+    // bytes written to the Tx FIFO but not read from the Rx FIFO yet
+    size_t BytesInFlight;
+}
+PBC_FIFO_TRANSFER, *PPBC_FIFO_TRANSFER;
+
+//
+// Transfer mode of a request, chosen from its estimated time on the wire.
+// Requests up to BCM_SPI_POLL_MODE_MAX_US are polled, longer requests
+// are interrupt driven and their transfers of at least DmaThresholdBytes
+// are moved by DMA.
+//
+
+typedef enum PBC_TRANSFER_MODE
+{
+    PbcTransferModePoll,
+    PbcTransferModeInterrupt
+}
+PBC_TRANSFER_MODE;
+
+#define BCM_SPI_POLL_MODE_MAX_US 100
+
+//
+// Transfer delays sleep until the minimum timer resolution plus
+// BCM_SPI_DELAY_SPIN_US before the deadline, and spin for the rest.
+// Delays falling back to KeDelayExecutionThread raise the timer
+// resolution to the minimum while they sleep. Shorter delays only spin.
+//
+
+#define BCM_SPI_DELAY_SPIN_US 20
+
+typedef struct PBC_DELAY_STATISTICS
+{
+    // number of delays, and of those that slept before spinning
+    ULONGLONG DelayCount;
+    ULONGLONG TimerDelayCount;
+    // sums of requested, measured and spun delay time
+    ULONGLONG RequestedUs;
+    ULONGLONG MeasuredUs;
+    ULONGLONG SpinUs;
+    // largest measured minus requested delay
+    ULONGLONG MaxOvershootUs;
+}
+PBC_DELAY_STATISTICS, *PPBC_DELAY_STATISTICS;
+
 /////////////////////////////////////////////////
 //
 // Context definitions.
@@ -150,6 +221,7 @@ struct PBC_DEVICE
     // shadow copy of CS hardware register and clock speed
     ULONG                           SPI_CS_COPY;                 
     ULONG                           CurrentConnectionSpeed;
+    ULONG                           CurrentClockDivider;
 
     // Target that the controller is currently
     // configured for. In most cases this value is only
@@ -168,6 +240,43 @@ struct PBC_DEVICE
     PVOID                           pTransferThread;
     KEVENT                          TransferThreadWakeEvt;
     LONG                            TransferThreadShutdown;
+
+    // High resolution timer for transfer delays, NULL if not available.
+    // DelaySpinUs is the time spun before the deadline, the minimum
+    // timer resolution (DelayTimerResolution, in 100ns) plus
+    // BCM_SPI_DELAY_SPIN_US.
+    PEX_TIMER                       pDelayTimer;
+    KEVENT                          DelayTimerEvt;
+    ULONG                           DelayTimerResolution;
+    ULONG                           DelaySpinUs;
+    PBC_DELAY_STATISTICS            DelayStatistics;
+
+    // SPI interrupt, drives interrupt mode transfers and 
+    // signals the end of DMA transfers
+    WDFINTERRUPT                    InterruptObject;
+    KEVENT                          TransferDoneEvt;
+
+    // Interrupt mode transfer serviced by the interrupt DPC,
+    // only set while the transfer is active
+    PPBC_REQUEST                    pInterruptRequest;
+    PBC_FIFO_TRANSFER               InterruptFifo;
+    NTSTATUS                        InterruptTransferStatus;
+
+    // DMA transfer mode, only available if pDmaCb is set.
+    // Transfers shorter than DmaThresholdBytes are moved by PIO,
+    // a threshold of 0 disables DMA. The channels come from the
+    // FixedDMA resources of the device.
+    ULONG                           DmaTxChannel;
+    ULONG                           DmaRxChannel;
+    PBCM_DMA_REGISTERS              pDmaTxRegisters;
+    PBCM_DMA_REGISTERS              pDmaRxRegisters;
+    PBCM_DMA_CB                     pDmaCb;
+    ULONG                           DmaCbBusAddress;
+    PUCHAR                          pDmaTxBuffer;
+    ULONG                           DmaTxBufferBusAddress;
+    PUCHAR                          pDmaRxBuffer;
+    ULONG                           DmaRxBufferBusAddress;
+    ULONG                           DmaThresholdBytes;
 };
 
 //
@@ -181,6 +290,13 @@ struct PBC_TARGET
 
     // Target specific settings.
     PBC_TARGET_SETTINGS            Settings;
+
+    // Controller register image for this target, computed
+    // on connect. CsImage holds the CS register bits under
+    // CsMask, ClockDivider the CLK register value.
+    ULONG                          CsImage;
+    ULONG                          CsMask;
+    ULONG                          ClockDivider;
     
     // Current request associated with the 
     // target. This value should only be non-null
@@ -217,6 +333,23 @@ struct PBC_REQUEST
 
     size_t                         RequestLength;
 
+    // Poll or interrupt mode, see PBC_TRANSFER_MODE.
+    PBC_TRANSFER_MODE              TransferMode;
+
+    // Descriptor of the next sequence transfer, fetched
+    // ahead to find out whether it can be chained.
+    ULONG                          PrefetchedTransferIndex;
+    SPB_TRANSFER_DESCRIPTOR        PrefetchedTransferDescriptor;
+    PMDL                           pPrefetchedTransferMdl;
+
+    // A polled transfer followed by a transfer without delay
+    // hands its last bytes in flight over to the next transfer,
+    // which receives them before its own. TA stays set and the
+    // FIFOs keep running across the transfer boundary.
+    BOOLEAN                        ChainNextTransfer;
+    BOOLEAN                        ChainedFifoPending;
+    PBC_FIFO_TRANSFER              ChainedFifo;
+
     //
     // Variables that are reused for each transfer within
     // each request.